@@ -32,6 +32,8 @@
 #ifndef SPIRE_CONTEXT_H
 #define SPIRE_CONTEXT_H
 
+#include <memory>
+
 namespace CPM_SPIRE_NS {
 
 /// Generalized OpenGL context.
@@ -56,6 +58,27 @@ public:
   /// Swap the front and back buffers.
   virtual void swapBuffers()    = 0;
 
+  //============================================================================
+  // Optional OpenGL-context related functions
+  //============================================================================
+
+  /// Release the context from the active thread. Called before Spire's render
+  /// thread makes the context current (see Interface::startRenderThread) and
+  /// by the render thread when it stops. Platforms that refuse to make a
+  /// context current on one thread while it is current on another need this.
+  virtual void doneCurrent()    {}
+
+  /// Creates a context that shares buffer and texture objects with this one.
+  /// Spire makes it current on a loader thread of its own and uploads
+  /// buffers and textures from there, so large uploads don't stall
+  /// rendering. The returned context is only ever made current on that
+  /// thread. Returns an empty pointer if shared contexts are not supported
+  /// (the default); uploads then happen on the rendering thread.
+  virtual std::shared_ptr<Context> createSharedContext()
+  {
+    return std::shared_ptr<Context>();
+  }
+
 private:
 };
 
@@ -29,13 +29,22 @@
 /// \author James Hughes
 /// \date   September 2012
 
+#include <fstream>
 #include <sstream>
 #include "Interface.h"
+#include "src/AssetFile.h"
 #include "src/Exceptions.h"
+#include "src/GLUploader.h"
 #include "src/Hub.h"
+#include "src/HubThread.h"
 #include "src/Log.h"
+#include "src/MeshImport.h"
 #include "src/InterfaceImplementation.h"
+#include "src/MeshOptimizer.h"
+#include "src/MeshStream.h"
+#include "src/SceneCommand.h"
 #include "src/SpireObject.h"
+#include "src/ThreadPool.h"
 
 using namespace std::placeholders;
 
@@ -60,6 +69,12 @@ Interface::Interface(std::shared_ptr<Context> context,
 //------------------------------------------------------------------------------
 Interface::~Interface()
 {
+  stopRenderThread();
+
+  // Uploads still in flight fail; running the render tasks hands every
+  // outstanding future its result instead of a broken promise.
+  mHub->stopUploader();
+  mImpl->runRenderTasks();
   mImpl.reset();
   mHub.reset();
 }
@@ -80,7 +95,7 @@ size_t Interface::getNumObjects() const
 }
 
 //------------------------------------------------------------------------------
-std::shared_ptr<SpireObject>
+std::shared_ptr<const SpireObject>
 Interface::getObjectWithName(const std::string& name) const
 {
   return mImpl->getObjectWithName(name);
@@ -95,9 +110,10 @@ void Interface::clearGLResources()
 //------------------------------------------------------------------------------
 void Interface::addVBO(const std::string& name,
                        const uint8_t* vboData, size_t vboSize,
-                       const std::vector<std::string>& attribNames)
+                       const std::vector<std::string>& attribNames,
+                       bool narrowDoubles)
 {
-  mImpl->addConcurrentVBO(name, vboData, vboSize, attribNames);
+  mImpl->addConcurrentVBO(name, vboData, vboSize, attribNames, narrowDoubles);
 }
 
 //------------------------------------------------------------------------------
@@ -111,8 +127,159 @@ void Interface::addIBO(const std::string& name,
 void Interface::renderObject(const std::string& objectName,
                              const std::string& pass)
 {
-  std::shared_ptr<SpireObject> obj = getObjectWithName(objectName);
-  obj->renderPass(pass);
+  mImpl->getRenderObject(objectName)->renderPass(pass);
+}
+
+//------------------------------------------------------------------------------
+void Interface::setObjectTransform(const std::string& object,
+                                   const M44& transform)
+{
+  mImpl->setObjectTransform(object, transform);
+}
+
+//------------------------------------------------------------------------------
+void Interface::setObjectBounds(const std::string& object, const V3& min,
+                                const V3& max)
+{
+  mImpl->setObjectBounds(object, min, max);
+}
+
+//------------------------------------------------------------------------------
+void Interface::setObjectBounds(const std::string& object, const V3& center,
+                                float radius)
+{
+  mImpl->setObjectBounds(object, center, radius);
+}
+
+//------------------------------------------------------------------------------
+void Interface::setObjectOccluder(const std::string& object, bool occluder)
+{
+  mImpl->setObjectOccluder(object, occluder);
+}
+
+//------------------------------------------------------------------------------
+size_t Interface::prepareFrame(const M44& worldToProjection,
+                               const std::vector<std::string>& passes)
+{
+  return mImpl->prepareFrame(worldToProjection, passes);
+}
+
+//------------------------------------------------------------------------------
+void Interface::setSmallFeatureCulling(float minPixels, float viewportHeight)
+{
+  mImpl->setSmallFeatureCulling(minPixels, viewportHeight);
+}
+
+//------------------------------------------------------------------------------
+void Interface::setLODPixelError(float maxPixels, float viewportHeight)
+{
+  mImpl->setLODPixelError(maxPixels, viewportHeight);
+}
+
+//------------------------------------------------------------------------------
+size_t Interface::getNumCoarseDraws() const
+{
+  return mImpl->getNumCoarseDraws();
+}
+
+//------------------------------------------------------------------------------
+void Interface::setOcclusionCulling(bool enabled)
+{
+  mImpl->setOcclusionCulling(enabled);
+}
+
+//------------------------------------------------------------------------------
+void Interface::setSoftwareOcclusionCulling(bool enabled)
+{
+  mImpl->setSoftwareOcclusionCulling(enabled);
+}
+
+//------------------------------------------------------------------------------
+size_t Interface::getNumOccluders() const
+{
+  return mImpl->getNumOccluders();
+}
+
+//------------------------------------------------------------------------------
+void Interface::setClusterCulling(bool enabled, bool backFaces)
+{
+  mImpl->setClusterCulling(enabled, backFaces);
+}
+
+//------------------------------------------------------------------------------
+size_t Interface::getNumClustersCulled() const
+{
+  return mImpl->getNumClustersCulled();
+}
+
+//------------------------------------------------------------------------------
+void Interface::setTargetFrameTime(double milliseconds, float maxPixelError)
+{
+  mImpl->setTargetFrameTime(milliseconds, maxPixelError);
+}
+
+//------------------------------------------------------------------------------
+void Interface::setOptionalPasses(const std::vector<std::string>& passes)
+{
+  mImpl->setOptionalPasses(passes);
+}
+
+//------------------------------------------------------------------------------
+Interface::FrameTiming Interface::getFrameTiming() const
+{
+  return mImpl->getFrameTiming();
+}
+
+//------------------------------------------------------------------------------
+size_t Interface::getNumOccludedObjects() const
+{
+  return mImpl->getNumOccludedObjects();
+}
+
+//------------------------------------------------------------------------------
+void Interface::renderPreparedFrame()
+{
+  mImpl->renderPreparedFrame();
+}
+
+//------------------------------------------------------------------------------
+std::vector<std::string> Interface::queryObjectsInBox(const V3& min,
+                                                      const V3& max) const
+{
+  return mImpl->queryObjectsInBox(min, max);
+}
+
+//------------------------------------------------------------------------------
+std::vector<std::string>
+Interface::queryObjectsInFrustum(const M44& worldToProjection) const
+{
+  return mImpl->queryObjectsInFrustum(worldToProjection);
+}
+
+//------------------------------------------------------------------------------
+std::vector<std::string> Interface::queryObjectsOnRay(
+    const V3& origin, const V3& direction, std::vector<float>* distances) const
+{
+  return mImpl->queryObjectsOnRay(origin, direction, distances);
+}
+
+//------------------------------------------------------------------------------
+void Interface::setMeshRetention(bool retain)
+{
+  mImpl->setMeshRetention(retain);
+}
+
+//------------------------------------------------------------------------------
+Interface::PickResult Interface::pick(float x, float y) const
+{
+  return mImpl->pick(x, y);
+}
+
+//------------------------------------------------------------------------------
+Interface::PickResult Interface::pickRay(const V3& origin,
+                                         const V3& direction) const
+{
+  return mImpl->pickRay(origin, direction);
 }
 
 //------------------------------------------------------------------------------
@@ -142,9 +309,10 @@ void Interface::removeAllObjects()
 //------------------------------------------------------------------------------
 void Interface::addVBO(const std::string& name,
                        std::shared_ptr<std::vector<uint8_t>> vboData,
-                       const std::vector<std::string>& attribNames)
+                       const std::vector<std::string>& attribNames,
+                       bool narrowDoubles)
 {
-  mImpl->addVBO(name, vboData, attribNames);
+  mImpl->addVBO(name, vboData, attribNames, narrowDoubles);
 }
 
 //------------------------------------------------------------------------------
@@ -153,6 +321,21 @@ void Interface::removeVBO(const std::string& vboName)
   mImpl->removeVBO(vboName);
 }
 
+//------------------------------------------------------------------------------
+void Interface::setVBOBounds(const std::string& vboName, const V3& min,
+                             const V3& max)
+{
+  mImpl->setVBOBounds(vboName, min, max);
+}
+
+//------------------------------------------------------------------------------
+void Interface::setIBOClusters(
+    const std::string& iboName,
+    std::shared_ptr<const std::vector<MeshCluster>> clusters)
+{
+  mImpl->setIBOClusters(iboName, clusters);
+}
+
 //------------------------------------------------------------------------------
 void Interface::addIBO(const std::string& name,
                        std::shared_ptr<std::vector<uint8_t>> iboData,
@@ -179,6 +362,16 @@ void Interface::addPassToObject(const std::string& object,
   mImpl->addPassToObject(object, program, vboName, iboName, type, pass, parentPass);
 }
 
+//------------------------------------------------------------------------------
+void Interface::addPassLODToObject(const std::string& object,
+                                   const std::string& vboName,
+                                   const std::string& iboName,
+                                   float geometricError,
+                                   const std::string& pass)
+{
+  mImpl->addPassLODToObject(object, vboName, iboName, geometricError, pass);
+}
+
 //------------------------------------------------------------------------------
 void Interface::removePassFromObject(const std::string& object, const std::string& pass)
 {
@@ -189,7 +382,7 @@ void Interface::removePassFromObject(const std::string& object, const std::strin
 std::vector<Interface::UnsatisfiedUniform> Interface::getUnsatisfiedUniforms(
     const std::string& object, const std::string& pass)
 {
-  std::shared_ptr<SpireObject> obj = getObjectWithName(object);
+  std::shared_ptr<const SpireObject> obj = getObjectWithName(object);
   return obj->getUnsatisfiedUniforms(pass);
 }
 
@@ -222,7 +415,7 @@ void Interface::addGlobalUniformConcrete(const std::string& uniformName,
 std::shared_ptr<const AbstractUniformStateItem>
 Interface::getGlobalUniformConcrete(const std::string& uniformName)
 {
-  return mHub->getGlobalUniformStateMan().getGlobalUniform(uniformName);
+  return mImpl->getGlobalUniform(uniformName);
 }
 
 //------------------------------------------------------------------------------
@@ -231,7 +424,7 @@ Interface::getObjectPassUniformConcrete(const std::string& object,
                                         const std::string& uniformName,
                                         const std::string& pass)
 {
-  std::shared_ptr<SpireObject> obj = getObjectWithName(object);
+  std::shared_ptr<const SpireObject> obj = getObjectWithName(object);
   return obj->getPassUniform(pass, uniformName);
 }
 
@@ -240,7 +433,7 @@ std::shared_ptr<const AbstractUniformStateItem>
 Interface::getObjectGlobalUniformConcrete(const std::string& object,
                                           const std::string& uniformName)
 {
-  std::shared_ptr<SpireObject> obj = getObjectWithName(object);
+  std::shared_ptr<const SpireObject> obj = getObjectWithName(object);
   return obj->getGlobalUniform(uniformName);
 }
 
@@ -271,146 +464,649 @@ void Interface::addPersistentShader(const std::string& programName,
 }
 
 
+//------------------------------------------------------------------------------
+/// Moves an asset mesh into vbo / ibo, packing indices as 16 bit when they fit.
+/// Its levels of detail are packed the same way into 'info'.
+/// With 'buildClusters', large unquantized meshes without clusters get them.
+static size_t getAssetBuffers(AssetMesh& mesh, std::vector<uint8_t>& vbo,
+                              std::vector<uint8_t>& ibo,
+                              Interface::AssetInfo& info,
+                              bool buildClusters = false)
+{
+  info.quantized      = (mesh.vertexFormat == ASSET_VERTEX_QUANTIZED);
+  info.stride         = mesh.vertexSize();
+  info.positionOffset = V3(mesh.quantization.offset[0],
+                           mesh.quantization.offset[1],
+                           mesh.quantization.offset[2]);
+  info.positionScale  = V3(mesh.quantization.scale[0],
+                           mesh.quantization.scale[1],
+                           mesh.quantization.scale[2]);
+  info.numTriangles   = mesh.indices.size() / 3;
+
+  if (   buildClusters && mesh.clusters.empty()
+      && mesh.vertexFormat == ASSET_VERTEX_FLOAT
+      && info.numTriangles >= MESH_CLUSTER_MIN_TRIANGLES)
+  {
+    buildMeshClusters(mesh.vbo.empty() ? nullptr : &mesh.vbo[0], info.stride, 0,
+                      mesh.numVertices(), mesh.indices, mesh.clusters);
+  }
+  info.clusters.reset();
+  if (!mesh.clusters.empty())
+  {
+    info.clusters = std::make_shared<const std::vector<MeshCluster>>(
+        std::move(mesh.clusters));
+    mesh.clusters.clear();
+  }
+
+  size_t indexSize = sizeof(uint32_t);
+  info.iboType = Interface::IBO_32BIT;
+  if (mesh.numVertices() <= 65536)
+  {
+    indexSize = sizeof(uint16_t);
+    info.iboType = Interface::IBO_16BIT;
+  }
+  packIndices(mesh.indices, indexSize, ibo);
+
+  info.lods.resize(mesh.lods.size());
+  for (size_t i = 0; i < mesh.lods.size(); ++i)
+  {
+    info.lods[i].geometricError = mesh.lods[i].error;
+    info.lods[i].numTriangles = mesh.lods[i].indices.size() / 3;
+    packIndices(mesh.lods[i].indices, indexSize, info.lods[i].ibo);
+  }
+  mesh.lods.clear();
+
+  vbo.swap(mesh.vbo);
+  return info.numTriangles;
+}
+
 //------------------------------------------------------------------------------
 size_t Interface::loadProprietarySR5AssetFile(std::istream& stream,
                                               std::vector<uint8_t>& vbo,
                                               std::vector<uint8_t>& ibo)
 {
-  // Read default SCIRun asset header.
-  std::string header = "SCR5";
+  // Only the first mesh is used.
+  std::vector<AssetMesh> meshes;
+  readAssetFile(stream, meshes, 1);
+  AssetMesh& mesh = meshes.front();
+
+  if (mesh.vertexFormat == ASSET_VERTEX_QUANTIZED)
+    dequantizeVertices(mesh.vbo, mesh.quantization, vbo);
+  else
+    vbo.swap(mesh.vbo);
+
+  packIndices(mesh.indices, sizeof(uint16_t), ibo);
+  return mesh.indices.size() / 3;
+}
 
-  char headerStrIn_Raw[5];
-  stream.read(headerStrIn_Raw, 4);
-  headerStrIn_Raw[4] = '\0';
-  std::string headerStrIn = headerStrIn_Raw;
+//------------------------------------------------------------------------------
+size_t Interface::loadAssetFile(std::istream& stream, std::vector<uint8_t>& vbo,
+                                std::vector<uint8_t>& ibo, AssetInfo& info)
+{
+  std::vector<AssetMesh> meshes;
+  readAssetFile(stream, meshes, 1);
+  return getAssetBuffers(meshes.front(), vbo, ibo, info);
+}
 
-  if (headerStrIn != header)
+//------------------------------------------------------------------------------
+size_t Interface::importMeshFile(std::istream& stream, MESH_FILE_FORMAT format,
+                                 std::vector<uint8_t>& vbo,
+                                 std::vector<uint8_t>& ibo, AssetInfo& info)
+{
+  MeshFileFormat meshFormat = MESH_FILE_PLY;
+  switch (format)
   {
-    /// \todo Use more appropriate I/O exception.
-    throw std::invalid_argument("Header does not match asset file.");
+    case MESH_PLY: meshFormat = MESH_FILE_PLY; break;
+    case MESH_STL: meshFormat = MESH_FILE_STL; break;
+    case MESH_OBJ: meshFormat = MESH_FILE_OBJ; break;
   }
 
-  // Read in the number of meshes (this is ignored for now and the first mesh is
-  // used).
-  uint32_t numMeshes = 0;
-  stream.read(reinterpret_cast<char*>(&numMeshes), sizeof(uint32_t));
-  if (numMeshes == 0)
+  AssetMesh mesh;
+  importMesh(stream, meshFormat, mesh);
+  return getAssetBuffers(mesh, vbo, ibo, info);
+}
+
+//------------------------------------------------------------------------------
+void Interface::readMeshStream(std::istream& stream, MeshStream& meshStream,
+                               size_t trianglesPerPart)
+{
+  try
   {
-    throw std::invalid_argument("Need at least one mesh in asset file.");
+    streamAssetFile(stream, trianglesPerPart,
+                    [&meshStream](const AssetMeshLayout& layout)
+                    {
+                      meshStream.setLayout(layout);
+                    },
+                    [&meshStream](AssetMeshPart& part)
+                    {
+                      meshStream.addPart(part);
+                    });
   }
+  catch (const std::exception& e)
+  {
+    meshStream.setError(e.what());
+  }
+}
 
-  // Read in the first mesh (this is the only mesh we will read in)
-  uint32_t numVertices = 0;
-  stream.read(reinterpret_cast<char*>(&numVertices), sizeof(uint32_t));
-
-  V3 position;
-  V3 normal;
-
-  // Reserve appropriate space in the vbo.
-  size_t vboSize = sizeof(float) * 6 * numVertices;
-  vbo.resize(vboSize); // linear complexity.
-  float* vboPtr = reinterpret_cast<float*>(&vbo[0]); // Remember, standard guarantees that vectors are contiguous in memory.
+//------------------------------------------------------------------------------
+bool Interface::uploadMeshStream(MeshStream& meshStream,
+                                 const std::string& vboName,
+                                 const std::string& iboName,
+                                 const std::vector<std::string>& attribNames)
+{
+  return mImpl->uploadMeshStream(meshStream, vboName, iboName, attribNames);
+}
 
-  for (size_t i = 0; i < numVertices; i++)
+//------------------------------------------------------------------------------
+/// Runs 'upload' on the loader thread if there is one, otherwise on the render
+/// thread. 'publish' always runs on the render thread, during
+/// processAsyncLoads, and receives the exception thrown by 'upload' if any.
+static void runUpload(
+    std::weak_ptr<GLUploader> uploader,
+    std::shared_ptr<InterfaceImplementation::RenderTaskQueue> renderTasks,
+    std::function<void ()> upload,
+    std::function<void (InterfaceImplementation&, std::exception_ptr)> publish)
+{
+  std::shared_ptr<GLUploader> loader = uploader.lock();
+  if (loader)
   {
-    // Read position data
-    stream.read(reinterpret_cast<char*>(&position.x), sizeof(float));
-    stream.read(reinterpret_cast<char*>(&position.y), sizeof(float));
-    stream.read(reinterpret_cast<char*>(&position.z), sizeof(float));
-    vboPtr[0] = position.x;
-    vboPtr[1] = position.y;
-    vboPtr[2] = position.z;
-    vboPtr += 3;
-
-    // Read normal data
-    stream.read(reinterpret_cast<char*>(&normal.x), sizeof(float));
-    stream.read(reinterpret_cast<char*>(&normal.y), sizeof(float));
-    stream.read(reinterpret_cast<char*>(&normal.z), sizeof(float));
-    vboPtr[0] = normal.x;
-    vboPtr[1] = normal.y;
-    vboPtr[2] = normal.z;
-    vboPtr += 3;
+    loader->queue(upload, [renderTasks, publish](std::exception_ptr error)
+    {
+      renderTasks->push([publish, error](InterfaceImplementation& impl)
+      {
+        publish(impl, error);
+      });
+    });
   }
+  else
+  {
+    renderTasks->push([upload, publish](InterfaceImplementation& impl)
+    {
+      std::exception_ptr error;
+      try
+      {
+        upload();
+      }
+      catch (...)
+      {
+        error = std::current_exception();
+      }
+      publish(impl, error);
+    });
+  }
+}
+
+//------------------------------------------------------------------------------
+/// Buffers of an asynchronous upload. Either buffer may be missing.
+struct AsyncBuffers
+{
+  AsyncBuffers() : iboType(Interface::IBO_16BIT), vboIndex(0), iboIndex(0),
+                   iboSize(0) {}
+
+  std::string                           name;
+  std::shared_ptr<std::vector<uint8_t>> vbo;
+  std::vector<std::string>              attribNames;
+  std::shared_ptr<std::vector<uint8_t>> ibo;
+  Interface::IBO_TYPE                   iboType;
+  std::shared_ptr<const std::vector<MeshCluster>> clusters;
 
-  // Read in the IBO data.
-  uint32_t numTriangles = 0;  // Will be counted when loading.
-  uint32_t numFaces = 0;
-  stream.read(reinterpret_cast<char*>(&numFaces), sizeof(uint32_t));
-
-  // Worst case number of triangles: 2 * numFaces (all quads).
-  // The following has pretty harsh algorithmic time -- 3*N. Can easily be sped
-  // up by using the preprocessing program to determine how many triangles there
-  // are in the object. This would reduce the complexity to 2*N.
-  uint32_t numTrianglesWorstCase = numFaces * 2;
-  size_t iboWorstCaseSize = numTrianglesWorstCase * sizeof(uint16_t) * 3;
-  ibo.resize(iboWorstCaseSize); // linear in complexity
-  uint16_t* iboPtr = reinterpret_cast<uint16_t*>(&ibo[0]); // Remember, standard guarantees that vectors are contiguous in memory.
-
-  for (size_t i = 0; i < numFaces; i++)
+  GLuint                                vboIndex;
+  GLuint                                iboIndex;
+  size_t                                iboSize;
+};
+
+//------------------------------------------------------------------------------
+/// Uploads 'buffers' (see runUpload) and calls 'done' on the render thread
+/// once they have been added, or with the reason they could not be.
+static void uploadBuffers(
+    std::weak_ptr<GLUploader> uploader,
+    std::shared_ptr<InterfaceImplementation::RenderTaskQueue> renderTasks,
+    std::shared_ptr<AsyncBuffers> buffers,
+    std::function<void (std::exception_ptr)> done)
+{
+  auto upload = [buffers]()
   {
-    uint8_t numIndices;
-    stream.read(reinterpret_cast<char*>(&numIndices), sizeof(uint8_t));
-    if (numIndices == 3)
+    if (buffers->vbo)
     {
-      uint16_t index0;
-      uint16_t index1;
-      uint16_t index2;
-      stream.read(reinterpret_cast<char*>(&index0), sizeof(uint16_t));
-      stream.read(reinterpret_cast<char*>(&index1), sizeof(uint16_t));
-      stream.read(reinterpret_cast<char*>(&index2), sizeof(uint16_t));
-      iboPtr[0] = index0;
-      iboPtr[1] = index1;
-      iboPtr[2] = index2;
-
-      iboPtr += 3;
-      ++numTriangles;
+      buffers->vboIndex = GLUploader::createBuffer(
+          GL_ARRAY_BUFFER, buffers->vbo->data(), buffers->vbo->size());
     }
-    else if (numIndices == 4)
+    if (buffers->ibo)
     {
-      // Two triangles
+      try
+      {
+        buffers->iboIndex = GLUploader::createBuffer(
+            GL_ELEMENT_ARRAY_BUFFER, buffers->ibo->data(), buffers->ibo->size());
+      }
+      catch (...)
       {
-        uint16_t index0;
-        uint16_t index1;
-        uint16_t index2;
-        stream.read(reinterpret_cast<char*>(&index0), sizeof(uint16_t));
-        stream.read(reinterpret_cast<char*>(&index1), sizeof(uint16_t));
-        stream.read(reinterpret_cast<char*>(&index2), sizeof(uint16_t));
-
-        iboPtr[0] = index0;
-        iboPtr[1] = index1;
-        iboPtr[2] = index2;
-
-        iboPtr += 3;
+        if (buffers->vboIndex != 0)
+          GL(glDeleteBuffers(1, &buffers->vboIndex));
+        throw;
       }
+      buffers->iboSize = buffers->ibo->size();
+    }
+
+    // The vertices are still needed for the bounds of the VBO.
+    buffers->ibo.reset();
+  };
 
+  auto publish = [buffers, done](InterfaceImplementation& impl,
+                                 std::exception_ptr error)
+  {
+    if (!error)
+    {
+      try
       {
-        uint16_t index0;
-        uint16_t index1;
-        uint16_t index2;
-        stream.read(reinterpret_cast<char*>(&index0), sizeof(uint16_t));
-        stream.read(reinterpret_cast<char*>(&index1), sizeof(uint16_t));
-        stream.read(reinterpret_cast<char*>(&index2), sizeof(uint16_t));
-
-        iboPtr[0] = index0;
-        iboPtr[1] = index1;
-        iboPtr[2] = index2;
-
-        iboPtr += 3;
+        impl.addUploadedBuffers(buffers->name, buffers->vboIndex,
+                                buffers->attribNames, buffers->iboIndex,
+                                buffers->iboSize, buffers->iboType,
+                                buffers->vbo.get(), buffers->clusters);
       }
+      catch (...)
+      {
+        error = std::current_exception();
+      }
+    }
+    buffers->vbo.reset();
+    done(error);
+  };
+
+  runUpload(uploader, renderTasks, upload, publish);
+}
+
+//------------------------------------------------------------------------------
+std::future<Interface::MeshHandle>
+Interface::loadMeshAsync(const std::string& path,
+                         const std::vector<std::string>& attribNames,
+                         const std::string& name)
+{
+  std::shared_ptr<std::promise<MeshHandle>> promise =
+      std::make_shared<std::promise<MeshHandle>>();
+  std::future<MeshHandle> result = promise->get_future();
+  std::weak_ptr<GLUploader> uploader = mHub->getUploader();
+  std::shared_ptr<InterfaceImplementation::RenderTaskQueue> renderTasks =
+      mImpl->getRenderTaskQueue();
+  std::string bufferName = name.empty() ? path : name;
+
+  ThreadPool::getShared()->submit(
+      [promise, uploader, renderTasks, path, attribNames, bufferName]()
+  {
+    try
+    {
+      std::ifstream file(path, std::ios::binary);
+      if (!file)
+        throw std::runtime_error("Unable to open mesh file " + path);
 
-      numTriangles += 2;
+      std::shared_ptr<AsyncBuffers> buffers = std::make_shared<AsyncBuffers>();
+      buffers->name = bufferName;
+      buffers->attribNames = attribNames;
+      buffers->vbo = std::make_shared<std::vector<uint8_t>>();
+      buffers->ibo = std::make_shared<std::vector<uint8_t>>();
+
+      MeshHandle handle;
+      handle.name = bufferName;
+
+      MeshFileFormat format;
+      if (getMeshFileFormat(path, format))
+      {
+        AssetMesh mesh;
+        importMesh(file, format, mesh);
+        getAssetBuffers(mesh, *buffers->vbo, *buffers->ibo, handle.info, true);
+      }
+      else
+      {
+        std::vector<AssetMesh> meshes;
+        readAssetFile(file, meshes, 1);
+        getAssetBuffers(meshes.front(), *buffers->vbo, *buffers->ibo,
+                        handle.info, true);
+      }
+      buffers->iboType = handle.info.iboType;
+      buffers->clusters = handle.info.clusters;
+
+      uploadBuffers(uploader, renderTasks, buffers,
+                    [promise, handle](std::exception_ptr error)
+                    {
+                      if (error)
+                        promise->set_exception(error);
+                      else
+                        promise->set_value(handle);
+                    });
+    }
+    catch (...)
+    {
+      promise->set_exception(std::current_exception());
     }
+  });
 
+  return result;
+}
+
+//------------------------------------------------------------------------------
+std::future<void>
+Interface::addVBOAsync(const std::string& name,
+                       std::shared_ptr<std::vector<uint8_t>> vboData,
+                       const std::vector<std::string>& attribNames)
+{
+  std::shared_ptr<std::promise<void>> promise =
+      std::make_shared<std::promise<void>>();
+  std::shared_ptr<AsyncBuffers> buffers = std::make_shared<AsyncBuffers>();
+  buffers->name = name;
+  buffers->vbo = vboData;
+  buffers->attribNames = attribNames;
+
+  uploadBuffers(mHub->getUploader(), mImpl->getRenderTaskQueue(), buffers,
+                [promise](std::exception_ptr error)
+                {
+                  if (error)
+                    promise->set_exception(error);
+                  else
+                    promise->set_value();
+                });
+  return promise->get_future();
+}
+
+//------------------------------------------------------------------------------
+std::future<void>
+Interface::addIBOAsync(const std::string& name,
+                       std::shared_ptr<std::vector<uint8_t>> iboData,
+                       IBO_TYPE type)
+{
+  std::shared_ptr<std::promise<void>> promise =
+      std::make_shared<std::promise<void>>();
+  std::shared_ptr<AsyncBuffers> buffers = std::make_shared<AsyncBuffers>();
+  buffers->name = name;
+  buffers->ibo = iboData;
+  buffers->iboType = type;
+
+  uploadBuffers(mHub->getUploader(), mImpl->getRenderTaskQueue(), buffers,
+                [promise](std::exception_ptr error)
+                {
+                  if (error)
+                    promise->set_exception(error);
+                  else
+                    promise->set_value();
+                });
+  return promise->get_future();
+}
+
+//------------------------------------------------------------------------------
+std::future<GLuint>
+Interface::uploadTextureAsync(std::shared_ptr<std::vector<uint8_t>> pixels,
+                              size_t width, size_t height)
+{
+  if (pixels->size() != width * height * 4)
+    throw std::invalid_argument("Texture size does not match its pixels.");
+
+  std::shared_ptr<std::promise<GLuint>> promise =
+      std::make_shared<std::promise<GLuint>>();
+  std::shared_ptr<GLuint> texture = std::make_shared<GLuint>(0);
+
+  auto upload = [pixels, width, height, texture]()
+  {
+    GL(glGenTextures(1, texture.get()));
+    GL(glBindTexture(GL_TEXTURE_2D, *texture));
+    GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+    GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+    GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+    GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+    GL(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
+    GL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, static_cast<GLsizei>(width),
+                    static_cast<GLsizei>(height), 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                    pixels->data()));
+    GL(glBindTexture(GL_TEXTURE_2D, 0));
+  };
+
+  auto publish = [promise, texture](InterfaceImplementation&,
+                                    std::exception_ptr error)
+  {
+    if (error)
+      promise->set_exception(error);
+    else
+      promise->set_value(*texture);
+  };
+
+  runUpload(mHub->getUploader(), mImpl->getRenderTaskQueue(), upload, publish);
+  return promise->get_future();
+}
+
+//------------------------------------------------------------------------------
+size_t Interface::processAsyncLoads()
+{
+  std::shared_ptr<GLUploader> uploader = mHub->getUploader();
+  if (uploader)
+    uploader->publishFinished();
+  return mImpl->runRenderTasks();
+}
+
+//------------------------------------------------------------------------------
+void Interface::setThreadPoolSize(size_t numThreads)
+{
+  ThreadPool::setSharedNumThreads(numThreads);
+}
+
+//------------------------------------------------------------------------------
+size_t Interface::optimizeMesh(std::vector<uint8_t>& vbo, size_t stride,
+                               size_t positionOffset,
+                               std::vector<uint8_t>& ibo, IBO_TYPE type)
+{
+  size_t indexSize = sizeof(uint16_t);
+  switch (type)
+  {
+    case IBO_8BIT:  indexSize = sizeof(uint8_t);  break;
+    case IBO_16BIT: indexSize = sizeof(uint16_t); break;
+    case IBO_32BIT: indexSize = sizeof(uint32_t); break;
   }
 
-  // Resize the IBO appropriately (this is the operation that can be eliminated
-  // if we know how many triangles there will be beforehand).
-  size_t realIBOSize = numTriangles * sizeof(uint16_t) * 3;
-  ibo.resize(realIBOSize); // linear in complexity
+  std::vector<uint32_t> indices = unpackIndices(ibo.empty() ? nullptr : &ibo[0],
+                                                ibo.size(), indexSize);
+  size_t numVertices = CPM_SPIRE_NS::optimizeMesh(vbo, stride, positionOffset,
+                                                  indices);
+  packIndices(indices, indexSize, ibo);
+  return numVertices;
+}
 
-  return numTriangles;
+//------------------------------------------------------------------------------
+void Interface::buildMeshClusters(const std::vector<uint8_t>& vbo, size_t stride,
+                                  size_t positionOffset,
+                                  std::vector<uint8_t>& ibo, IBO_TYPE type,
+                                  std::vector<MeshCluster>& clusters)
+{
+  size_t indexSize = sizeof(uint16_t);
+  switch (type)
+  {
+    case IBO_8BIT:  indexSize = sizeof(uint8_t);  break;
+    case IBO_16BIT: indexSize = sizeof(uint16_t); break;
+    case IBO_32BIT: indexSize = sizeof(uint32_t); break;
+  }
+  if (stride == 0)
+    throw std::invalid_argument("Vertex stride must not be 0.");
+
+  std::vector<uint32_t> indices = unpackIndices(ibo.empty() ? nullptr : &ibo[0],
+                                                ibo.size(), indexSize);
+  CPM_SPIRE_NS::buildMeshClusters(vbo.empty() ? nullptr : &vbo[0], stride,
+                                  positionOffset, vbo.size() / stride,
+                                  indices, clusters);
+  packIndices(indices, indexSize, ibo);
 }
 
 
-} // namespace CPM_SPIRE_NS 
+//============================================================================
+// QUEUED SCENE EDITS
+//============================================================================
+
+//------------------------------------------------------------------------------
+void Interface::beginFrame()
+{
+  mImpl->executeCommands();
+  processAsyncLoads();
+  mImpl->publishScene();
+}
+
+//------------------------------------------------------------------------------
+Interface::FrameStatistics Interface::getFrameStatistics() const
+{
+  return mImpl->getFrameStatistics();
+}
+
+//------------------------------------------------------------------------------
+bool Interface::queueAddObject(const std::string& object)
+{
+  SceneCommand command = SceneCommand();
+  command.type = SceneCommand::ADD_OBJECT;
+  setCommandName(command.object, object);
+  return queueCommand(command);
+}
+
+//------------------------------------------------------------------------------
+bool Interface::queueRemoveObject(const std::string& object)
+{
+  SceneCommand command = SceneCommand();
+  command.type = SceneCommand::REMOVE_OBJECT;
+  setCommandName(command.object, object);
+  return queueCommand(command);
+}
+
+//------------------------------------------------------------------------------
+bool Interface::queueUpdateVBO(const std::string& vboName, size_t offset,
+                               const uint8_t* data, size_t size)
+{
+  SceneCommand command = SceneCommand();
+  command.type = SceneCommand::UPDATE_VBO;
+  setCommandName(command.name, vboName);
+  command.offset = offset;
+  command.size = size;
+  command.data = new uint8_t[size];
+  std::copy(data, data + size, command.data);
+
+  if (!queueCommand(command))
+  {
+    delete[] command.data;
+    return false;
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+/// Fills in the uniform of a queued uniform command.
+static void setCommandUniform(SceneCommand& command,
+                              const std::string& uniformName,
+                              UNIFORM_TYPE type, const float* values,
+                              size_t size)
+{
+  size_t numValues = getCommandUniformSize(type);
+  if (numValues == 0 || numValues * sizeof(float) != size)
+    throw std::invalid_argument("Uniform type can not be queued.");
+
+  setCommandName(command.name, uniformName);
+  command.uniformType = type;
+  std::copy(values, values + numValues, command.values);
+}
+
+//------------------------------------------------------------------------------
+bool Interface::queueObjectPassUniformConcrete(const std::string& object,
+                                               const std::string& uniformName,
+                                               UNIFORM_TYPE type,
+                                               const float* values,
+                                               size_t size,
+                                               const std::string& pass)
+{
+  SceneCommand command = SceneCommand();
+  command.type = SceneCommand::SET_OBJECT_PASS_UNIFORM;
+  setCommandName(command.object, object);
+  setCommandName(command.pass, pass);
+  setCommandUniform(command, uniformName, type, values, size);
+  return queueCommand(command);
+}
+
+//------------------------------------------------------------------------------
+bool Interface::queueObjectGlobalUniformConcrete(const std::string& object,
+                                                 const std::string& uniformName,
+                                                 UNIFORM_TYPE type,
+                                                 const float* values,
+                                                 size_t size)
+{
+  SceneCommand command = SceneCommand();
+  command.type = SceneCommand::SET_OBJECT_GLOBAL_UNIFORM;
+  setCommandName(command.object, object);
+  setCommandUniform(command, uniformName, type, values, size);
+  return queueCommand(command);
+}
+
+//------------------------------------------------------------------------------
+bool Interface::queueGlobalUniformConcrete(const std::string& uniformName,
+                                           UNIFORM_TYPE type,
+                                           const float* values, size_t size)
+{
+  SceneCommand command = SceneCommand();
+  command.type = SceneCommand::SET_GLOBAL_UNIFORM;
+  setCommandUniform(command, uniformName, type, values, size);
+  return queueCommand(command);
+}
+
+//------------------------------------------------------------------------------
+bool Interface::queueCommand(const SceneCommand& command)
+{
+  if (!mImpl->queueCommand(command))
+    return false;
+  requestRedraw();
+  return true;
+}
+
+//============================================================================
+// RENDER THREAD
+//============================================================================
+
+//------------------------------------------------------------------------------
+void Interface::startRenderThread(RenderFunction render,
+                                  const RenderThreadOptions& options)
+{
+  if (mHubThread)
+    throw std::logic_error("The render thread is already running.");
+
+  mHub->doneCurrent();
+  try
+  {
+    mHubThread.reset(new HubThread(*this, *mHub, render, options));
+  }
+  catch (...)
+  {
+    mHub->makeCurrent();
+    throw;
+  }
+
+  // Loads finishing before the listener is in place are picked up by the
+  // extra frame asked for below.
+  HubThread* thread = mHubThread.get();
+  mImpl->getRenderTaskQueue()->setPushListener([thread]()
+  {
+    thread->requestFrame();
+  });
+  thread->requestFrame();
+}
+
+//------------------------------------------------------------------------------
+void Interface::stopRenderThread()
+{
+  if (!mHubThread)
+    return;
+
+  mImpl->getRenderTaskQueue()->setPushListener(std::function<void ()>());
+  mHubThread.reset();
+  mHub->makeCurrent();
+}
+
+//------------------------------------------------------------------------------
+bool Interface::hasRenderThread() const
+{
+  return static_cast<bool>(mHubThread);
+}
+
+//------------------------------------------------------------------------------
+void Interface::requestRedraw()
+{
+  if (mHubThread)
+    mHubThread->requestFrame();
+}
 
+} // namespace CPM_SPIRE_NS
@@ -38,6 +38,7 @@
 #include <vector>
 #include <list>
 #include <functional>
+#include <future>
 #include <memory>
 
 #include <gl-platform/GLPlatform.hpp>
@@ -58,12 +59,16 @@ class HubThread;
 class LambdaInterface;
 class ObjectLambdaInterface;
 class InterfaceImplementation;
+class MeshStream;
 class SpireObject;
+struct MeshCluster;
+struct SceneCommand;
 
 /// Interface to the renderer.
 /// A new interface will need to be created per-context.
 /// Spire expects that only one thread will be communicating with it at any
-/// given time.
+/// given time. The exceptions are the queued scene edits and, once frames
+/// are in use, the object edits (see beginFrame).
 class Interface
 {
 public:
@@ -79,12 +84,9 @@ public:
   typedef std::function<void (const std::string&, Interface::LOG_LEVEL level)> 
       LogFunction;
 
-  /// Constructs an interface to the renderer.
+  /// Constructs an interface to the renderer. Rendering happens on the
+  /// calling thread unless startRenderThread is used.
   /// \param  shaderDirs    A list of directories to search for shader files.
-  /// \param  createThread  If true, then a thread will be created in which the
-  ///                       renderer will run. The renderer will do it's best
-  ///                       to manage time allocation and only use cycles
-  ///                       when there is something to do.
   /// \param  logFP         The logging function to use when logging rendering
   ///                       messages.
   Interface(std::shared_ptr<Context> context, 
@@ -101,6 +103,14 @@ public:
     IBO_32BIT,
   };
 
+  /// Mesh file formats read natively by importMeshFile.
+  enum MESH_FILE_FORMAT
+  {
+    MESH_PLY,   ///< ASCII and binary (either endianness) PLY.
+    MESH_STL,   ///< Binary STL.
+    MESH_OBJ,   ///< Wavefront OBJ (positions, normals and faces only).
+  };
+
   /// Generally not needed at this stage.
   /// \todo Add supported OpenGL version to spire. This will allow us to 
   ///       determine what shaders we should us.
@@ -146,7 +156,7 @@ public:
     TYPE_INT,       ///< GLint    - 32-bit integer          C-Type (long),          Suffix (I)
     TYPE_UINT,      ///< GLuint   - 32-bit unsigned integer,C-Type (unsigned long), Suffix (ui)
     TYPE_FLOAT,     ///< GLfloat  - 32-bit floating,        C-Type (float),         Suffix (f)
-    TYPE_HALFFLOAT, ///< GLfloat  - 16-bit floating,        C-Type (?),             Suffix (?)
+    TYPE_HALFFLOAT, ///< GLhalf   - 16-bit floating,        C-Type (uint16_t),      Suffix (h)
     TYPE_DOUBLE,    ///< GLdouble - 64-bit floating,        C-Type (double),        Suffix (d)
   };
 
@@ -193,9 +203,15 @@ public:
   ///                       attributes match up with what you have provided in
   ///                       in the VBO. This only checked when a call to
   ///                       addPassToObject is made.
+  /// \param  narrowDoubles If true, TYPE_DOUBLE attributes are converted to
+  ///                       TYPE_FLOAT before the data is handed to OpenGL.
+  ///                       Double attributes are very slow on most GPUs.
+  ///                       See src/VertexConversion.h for converting to half
+  ///                       floats yourself.
   void addVBO(const std::string& name,
               const uint8_t* vboData, size_t vboSize,
-              const std::vector<std::string>& attribNames);
+              const std::vector<std::string>& attribNames,
+              bool narrowDoubles = false);
 
   /// Adds an IBO.
   /// \param  name          Name of the IBO.
@@ -209,12 +225,15 @@ public:
               IBO_TYPE type);
 
   /// Obtain the current number of objects.
-  /// \todo This function nedes to go to the implementation.
   size_t getNumObjects() const;
 
-  /// Obtain the object associated with 'name'.
-  /// throws std::range_error if the object is not found.
-  std::shared_ptr<SpireObject> getObjectWithName(const std::string& name) const;
+  /// Obtain the object associated with 'name'. The object is an immutable
+  /// snapshot; later edits produce a new object instead of modifying it.
+  /// Dropping the pointer on any thread is safe: the object, and the GL
+  /// buffers only it still references, are released on the render thread
+  /// at the next frame. Drop it before destroying the interface.
+  /// throws std::out_of_range if the object is not found.
+  std::shared_ptr<const SpireObject> getObjectWithName(const std::string& name) const;
 
   /// Cleans up all GL resources.
   /// Should ONLY be called from the rendering thread.
@@ -234,6 +253,16 @@ public:
   // Objects
   //---------
 
+  // addObject, removeObject, removeAllObjects, the pass functions
+  // (addPassToObject, addPassLODToObject, removePassFromObject) and the
+  // object uniform functions are thread safe. See beginFrame for when their
+  // effects become visible to rendering.
+  //
+  // The query functions (getNumObjects, getObjectWithName,
+  // getUnsatisfiedUniforms and the get*Uniform functions) may be called from
+  // any thread. They take no locks, never wait on edits or rendering, and see
+  // every edit that completed before they were called.
+
   /// Adds a renderable 'object' to the scene.
   void addObject(const std::string& object);
 
@@ -261,15 +290,32 @@ public:
   ///                       attributes match up with what you have provided in
   ///                       in the VBO. This only checked when a call to
   ///                       addPassToObject is made.
+  /// \param  narrowDoubles Convert TYPE_DOUBLE attributes to TYPE_FLOAT.
   void addVBO(const std::string& name,
               std::shared_ptr<std::vector<uint8_t>> vboData,
-              const std::vector<std::string>& attribNames);
+              const std::vector<std::string>& attribNames,
+              bool narrowDoubles = false);
 
   // Removes the specified vbo. It is safe to issue this call even though some
   // of your passes may still be referencing the VBOs/IBOs. When the passes are
   // destroyed, their associated VBOs/IBOs will be destroyed.
   void removeVBO(const std::string& vboName);
 
+  /// Sets the object space bounds of the VBO 'vboName'. By default they are
+  /// computed from its three float "aPos" attribute when it is added; VBOs
+  /// without one, or added without data, have none. Objects get the bounds
+  /// of the VBOs of passes added afterwards, see setObjectBounds.
+  /// Throws an std::out_of_range exception if the VBO is not found.
+  void setVBOBounds(const std::string& vboName, const V3& min, const V3& max);
+
+  /// Sets the clusters of the triangle IBO 'iboName' (see buildMeshClusters
+  /// and src/MeshClusters.h), which setClusterCulling culls one by one. Null
+  /// removes them. Call from the render thread.
+  /// Throws an std::out_of_range exception if the IBO is not found and
+  /// std::invalid_argument if the clusters do not fit it.
+  void setIBOClusters(const std::string& iboName,
+                      std::shared_ptr<const std::vector<MeshCluster>> clusters);
+
   /// Adds an IBO. Throws an std::out_of_range exception if the object is not
   /// found in the system.
   /// \param  name          Name of the IBO. You might find it odd that you are
@@ -295,7 +341,8 @@ public:
   /// Loads an asset file and populates the given vectors with vbo and ibo
   /// data. In the future, we should expand this to include other asset types.
   /// Always uses 16bit IBOs and 32bit per component position / normal in the
-  /// vbo.
+  /// vbo. Quantized assets are expanded back to floats, use loadAssetFile to
+  /// keep them quantized.
   /// \return Returns the number of triangles read into ibo.
   /// \todo This should be moved into SCI-Run appspecific. It doesn't belong in
   ///       spire.
@@ -303,6 +350,160 @@ public:
                                             std::vector<uint8_t>& vbo,
                                             std::vector<uint8_t>& ibo);
 
+  /// Describes the buffers returned by loadAssetFile.
+  struct AssetInfo
+  {
+    /// When true, every vertex is 12 bytes: a position made of 4 normalized
+    /// TYPE_SHORT components (w is unused) followed by an octahedral normal
+    /// made of 2 normalized TYPE_SHORT components. The object space position
+    /// is positionOffset + positionScale * position.xyz; pass both to the
+    /// shader as uniforms. See src/VertexQuantization.h for the normal
+    /// decoding. Otherwise vertices are 3 float positions followed by 3
+    /// float normals.
+    bool      quantized;
+    size_t    stride;         ///< Size of one vertex in bytes.
+    IBO_TYPE  iboType;        ///< 32 bit only when 16 bit indices don't fit.
+    size_t    numTriangles;
+    V3        positionOffset;
+    V3        positionScale;
+
+    /// Clusters stored in the file (assetConv --clusters), for
+    /// setIBOClusters. Null if there are none.
+    std::shared_ptr<const std::vector<MeshCluster>> clusters;
+
+    /// A level of detail stored in the file (assetConv --lods): an IBO of
+    /// iboType indexing the same VBO. Add it with addIBO and hand it to
+    /// addPassLODToObject together with 'geometricError'.
+    struct LOD
+    {
+      float                 geometricError;
+      size_t                numTriangles;
+      std::vector<uint8_t>  ibo;
+    };
+    std::vector<LOD> lods;  ///< From fine to coarse.
+  };
+
+  /// Loads the first mesh of an asset file without converting its vertex
+  /// format. Reads both quantized and unquantized files.
+  /// \return Returns the number of triangles read into ibo.
+  static size_t loadAssetFile(std::istream& stream, std::vector<uint8_t>& vbo,
+                              std::vector<uint8_t>& ibo, AssetInfo& info);
+
+  /// Imports a PLY, STL or OBJ mesh without going through assimp. The file is
+  /// read whole and parsed on multiple threads. Vertices are 3 float
+  /// positions followed by 3 float normals; normals missing from the file are
+  /// computed from the faces. Polygons are triangulated as fans. Throws
+  /// std::invalid_argument on malformed input.
+  /// \return Returns the number of triangles read into ibo.
+  static size_t importMeshFile(std::istream& stream, MESH_FILE_FORMAT format,
+                               std::vector<uint8_t>& vbo,
+                               std::vector<uint8_t>& ibo, AssetInfo& info);
+
+  /// Reads the first mesh of an asset file into 'meshStream' (see
+  /// src/MeshStream.h) part by part, for progressive display with
+  /// uploadMeshStream. Does not touch OpenGL and is meant to be run on a
+  /// background thread. Files written by assetConv --parts are streamed as
+  /// they are read; other files are read whole and then split into parts of
+  /// at most 'trianglesPerPart' triangles. Errors do not throw; they are
+  /// recorded in 'meshStream' and rethrown by uploadMeshStream.
+  static void readMeshStream(std::istream& stream, MeshStream& meshStream,
+                             size_t trianglesPerPart = 16384);
+
+  /// Uploads the parts of 'meshStream' that arrived since the last call.
+  /// The first call after the reader has determined the mesh layout creates
+  /// the VBO 'vboName' and IBO 'iboName', sized for the whole mesh. Passes
+  /// using them only draw the triangles uploaded so far, so addPassToObject
+  /// can be called right away. Vertices use the layout described by
+  /// AssetInfo. Throws std::runtime_error if the reader failed.
+  /// \return True once the VBO and IBO exist.
+  bool uploadMeshStream(MeshStream& meshStream, const std::string& vboName,
+                        const std::string& iboName,
+                        const std::vector<std::string>& attribNames);
+
+  /// Result of loadMeshAsync.
+  struct MeshHandle
+  {
+    std::string name;   ///< Name of both the VBO and the IBO.
+    AssetInfo   info;   ///< Vertex layout and index type of the buffers.
+  };
+
+  /// Loads a mesh in the background. The file is read, decoded and
+  /// processed (normals, vertex format) on the shared thread pool. The VBO
+  /// and IBO are uploaded on the loader thread when the context provides a
+  /// shared context (see Context::createSharedContext), otherwise on the
+  /// render thread; either way they are added during processAsyncLoads.
+  /// Asset files (.sp) and the formats of importMeshFile (.ply, .stl, .obj)
+  /// are recognized by their extension. The IBO gets the clusters stored in
+  /// the file; unquantized meshes of 4096 triangles or more without are
+  /// clustered while loading (see setClusterCulling).
+  /// \param  path          File to load.
+  /// \param  attribNames   Attribute names of the VBO, see addVBO.
+  /// \param  name          Name given to both the VBO and the IBO. Defaults
+  ///                       to 'path'.
+  /// \return The future fails with the exception that stopped the load. It
+  ///         only becomes ready after a call to processAsyncLoads, so do not
+  ///         wait on it from the render thread without making that call.
+  std::future<MeshHandle> loadMeshAsync(
+      const std::string& path, const std::vector<std::string>& attribNames,
+      const std::string& name = "");
+
+  /// Same as addVBO, but the buffer is uploaded on the loader thread when the
+  /// context provides a shared context. The VBO appears during the
+  /// processAsyncLoads call that completes the future.
+  std::future<void> addVBOAsync(const std::string& name,
+                                std::shared_ptr<std::vector<uint8_t>> vboData,
+                                const std::vector<std::string>& attribNames);
+
+  /// Same as addIBO, but uploaded like addVBOAsync.
+  std::future<void> addIBOAsync(const std::string& name,
+                                std::shared_ptr<std::vector<uint8_t>> iboData,
+                                IBO_TYPE type);
+
+  /// Creates a 2D texture from tightly packed RGBA pixels (8 bits per
+  /// channel, first row at the bottom) with linear filtering, uploaded like
+  /// addVBOAsync. Spire does not manage textures: the returned texture
+  /// belongs to the caller, who deletes it on the render thread.
+  std::future<GLuint> uploadTextureAsync(
+      std::shared_ptr<std::vector<uint8_t>> pixels, size_t width,
+      size_t height);
+
+  /// Finishes asynchronous loads and uploads: adds the buffers whose upload
+  /// the GPU has completed and performs the uploads left to the render
+  /// thread. Never waits for the loader thread. Call from the render thread,
+  /// e.g. once per frame.
+  /// \return Number of loads and uploads finished.
+  size_t processAsyncLoads();
+
+  /// Sets the number of worker threads used for background loading and for
+  /// the parallel parts of asset processing (0 is one per core). Lower it to
+  /// share cores with the application's own scheduler. Loads already queued
+  /// finish on the previous threads.
+  static void setThreadPoolSize(size_t numThreads);
+
+  /// Optimizes a triangle mesh before it is handed to addVBO / addIBO.
+  /// Welds identical vertices, reorders triangles for the post-transform
+  /// cache and for reduced overdraw, and reorders vertices for fetch
+  /// locality. See src/MeshOptimizer.h for the individual steps.
+  /// \param  vbo             Interleaved vertex data. Resized in place.
+  /// \param  stride          Size of one vertex in bytes.
+  /// \param  positionOffset  Byte offset of the 3 float position attribute.
+  /// \param  ibo             Triangle list. Rewritten in place.
+  /// \param  type            Index type of 'ibo'.
+  /// \return Returns the number of vertices remaining in vbo.
+  static size_t optimizeMesh(std::vector<uint8_t>& vbo, size_t stride,
+                             size_t positionOffset,
+                             std::vector<uint8_t>& ibo, IBO_TYPE type);
+
+  /// Splits a triangle mesh into clusters of about 128 spatially close
+  /// triangles for setIBOClusters. Reorders the triangles of 'ibo' so that
+  /// every cluster is a contiguous range; call after optimizeMesh, whose
+  /// triangle order is mostly kept within a cluster. Parameters are those
+  /// of optimizeMesh.
+  static void buildMeshClusters(const std::vector<uint8_t>& vbo, size_t stride,
+                                size_t positionOffset,
+                                std::vector<uint8_t>& ibo, IBO_TYPE type,
+                                std::vector<MeshCluster>& clusters);
+
   /// Adds a geometry pass to an object given by the identifier 'object'.
   /// Throws an std::out_of_range exception if the object is not found in the 
   /// system. If there already exists a geometry pass, it throws a 'Duplicate' 
@@ -331,6 +532,50 @@ public:
   void removePassFromObject(const std::string& object,
                             const std::string& pass);
 
+  /// Appends a coarser level of detail to a pass of an object. prepareFrame
+  /// draws the coarsest level whose error is within setLODPixelError on
+  /// screen, the pass's own buffers if none is. Levels are appended from
+  /// the finest to the coarsest.
+  /// Throws an std::out_of_range exception if the VBO or IBO is not found,
+  /// NotFound if the pass is not, and std::invalid_argument if
+  /// 'geometricError' is not above that of the level before.
+  /// \param  object        Unique object name.
+  /// \param  vboName       VBO of the level. Empty to use the pass's VBO.
+  /// \param  iboName       IBO of the level, same primitive type as the pass.
+  /// \param  geometricError How far the surface of the level strays from
+  ///                       the full detail one, in object space.
+  /// \param  pass          Pass name.
+  void addPassLODToObject(const std::string& object,
+                          const std::string& vboName,
+                          const std::string& iboName,
+                          float geometricError,
+                          const std::string& pass = SPIRE_DEFAULT_PASS);
+
+  /// Sets the object -> world transform of 'object' (identity by default).
+  /// prepareFrame derives the uObject and uProjIVObject uniforms of the
+  /// object's passes from it.
+  /// Throws an std::out_of_range exception if the object is not found.
+  void setObjectTransform(const std::string& object, const M44& transform);
+
+  /// Sets the bounding box of 'object', in object space, for culling in
+  /// prepareFrame. Until set, the bounds of an object are the union of the
+  /// bounds of the VBOs of its passes (see setVBOBounds); objects with a
+  /// VBO without bounds are never culled. queueUpdateVBO does not change
+  /// the bounds: set them here if an update moves vertices outside.
+  /// Throws an std::out_of_range exception if the object is not found.
+  void setObjectBounds(const std::string& object, const V3& min,
+                       const V3& max);
+
+  /// Same as above, with a bounding sphere.
+  void setObjectBounds(const std::string& object, const V3& center,
+                       float radius);
+
+  /// Makes software occlusion culling (setSoftwareOcclusionCulling) prefer
+  /// 'object' as an occluder when it is in view. Flag large objects that
+  /// hide many others, like walls and outer isosurfaces.
+  /// Throws an std::out_of_range exception if the object is not found.
+  void setObjectOccluder(const std::string& object, bool occluder);
+
 
   //----------
   // Uniforms
@@ -483,6 +728,391 @@ public:
   void addPersistentShader(const std::string& programName,
                            const std::vector<std::tuple<std::string, SHADER_TYPES>>& shaders);
 
+  //--------------------
+  // Queued scene edits
+  //--------------------
+
+  // Unlike the rest of the interface, the functions below may be called from
+  // any number of threads at once. They record the edit in a bounded
+  // lock-free queue which the render thread applies in beginFrame, in the
+  // order the edits were queued. Names are limited to 63 characters
+  // (std::invalid_argument otherwise). When the queue is full nothing is
+  // queued and false is returned; try again after the next frame. Edits that
+  // fail when they are applied are logged instead of thrown.
+
+  /// Statistics gathered by beginFrame.
+  struct FrameStatistics
+  {
+    FrameStatistics() :
+        numCommandsQueued(0),
+        numCommandsApplied(0),
+        numObjectsCopied(0)
+    {}
+
+    size_t numCommandsQueued;   ///< Scene edits taken off the queue.
+    size_t numCommandsApplied;  ///< Scene edits left after coalescing.
+    size_t numObjectsCopied;    ///< Object copies made by edits since last frame.
+
+    /// Fraction of the queued scene edits that coalescing removed (0 when
+    /// nothing was queued).
+    double getCoalescingRatio() const
+    {
+      if (numCommandsQueued == 0) return 0.0;
+      return static_cast<double>(numCommandsQueued - numCommandsApplied)
+          / static_cast<double>(numCommandsQueued);
+    }
+  };
+
+  /// Applies the queued scene edits, finishes asynchronous loads (see
+  /// processAsyncLoads), then publishes the scene for rendering. Call from
+  /// the render thread at the start of every frame.
+  /// Only the net change of the queued edits reaches GL: repeated sets of
+  /// the same uniform, VBO updates of a range that is later overwritten and
+  /// objects added and removed again are dropped.
+  ///
+  /// Once beginFrame has been called, the scene is double buffered: object
+  /// edits (objects, passes, object uniforms) go to a back copy and
+  /// renderObject draws the copy published by the last beginFrame. Edits
+  /// made between two frames therefore show up together, and the object
+  /// edit functions may be called from other threads while the render thread
+  /// draws. Every edit copies the object it changes; unchanged objects are
+  /// shared between the copies.
+  /// Without beginFrame, edits are visible to renderObject at once.
+  void beginFrame();
+
+  /// Statistics of the last call to beginFrame.
+  FrameStatistics getFrameStatistics() const;
+
+  /// Queued version of addObject.
+  bool queueAddObject(const std::string& object);
+
+  /// Queued version of removeObject.
+  bool queueRemoveObject(const std::string& object);
+
+  /// Queues an update of 'size' bytes of the VBO 'vboName', starting at byte
+  /// 'offset'. The data is copied; it must already be in the uploaded layout.
+  bool queueUpdateVBO(const std::string& vboName, size_t offset,
+                      const uint8_t* data, size_t size);
+
+  /// Queued version of addObjectPassUniform. Supports float, V2, V3, V4 and
+  /// M44 uniforms.
+  template <typename T>
+  bool queueObjectPassUniform(const std::string& object,
+                              const std::string& uniformName,
+                              const T& uniformData,
+                              const std::string& pass = SPIRE_DEFAULT_PASS)
+  {
+    return queueObjectPassUniformConcrete(
+        object, uniformName, UniformStateItem<T>(uniformData).getGLType(),
+        reinterpret_cast<const float*>(&uniformData), sizeof(T), pass);
+  }
+
+  /// Concrete implementation of the above templated function.
+  bool queueObjectPassUniformConcrete(const std::string& object,
+                                      const std::string& uniformName,
+                                      UNIFORM_TYPE type, const float* values,
+                                      size_t size, const std::string& pass);
+
+  /// Queued version of addObjectGlobalUniform. Same types as
+  /// queueObjectPassUniform.
+  template <typename T>
+  bool queueObjectGlobalUniform(const std::string& object,
+                                const std::string& uniformName,
+                                const T& uniformData)
+  {
+    return queueObjectGlobalUniformConcrete(
+        object, uniformName, UniformStateItem<T>(uniformData).getGLType(),
+        reinterpret_cast<const float*>(&uniformData), sizeof(T));
+  }
+
+  /// Concrete implementation of the above templated function.
+  bool queueObjectGlobalUniformConcrete(const std::string& object,
+                                        const std::string& uniformName,
+                                        UNIFORM_TYPE type, const float* values,
+                                        size_t size);
+
+  /// Queued version of addGlobalUniform. Same types as
+  /// queueObjectPassUniform.
+  template <typename T>
+  bool queueGlobalUniform(const std::string& uniformName, const T& uniformData)
+  {
+    return queueGlobalUniformConcrete(
+        uniformName, UniformStateItem<T>(uniformData).getGLType(),
+        reinterpret_cast<const float*>(&uniformData), sizeof(T));
+  }
+
+  /// Concrete implementation of the above templated function.
+  bool queueGlobalUniformConcrete(const std::string& uniformName,
+                                  UNIFORM_TYPE type, const float* values,
+                                  size_t size);
+
+  //-------------------
+  // Frame preparation
+  //-------------------
+
+  /// Builds the draw list of the published scene (see beginFrame) for
+  /// renderPreparedFrame, on the shared thread pool (see setThreadPoolSize):
+  /// objects whose bounds (setObjectBounds) are outside of the view frustum
+  /// of 'worldToProjection' are culled, uObject and uProjIVObject are
+  /// computed for the others (setObjectTransform), and their draws are
+  /// sorted by pass (in the order of 'passes'), shader program, then front
+  /// to back. The draw list does not depend on the number of threads. While
+  /// 'worldToProjection' does not change, culling results of unchanged
+  /// objects are reused, and so is the draw list if nothing changed. Call
+  /// from the render thread after beginFrame.
+  /// \return Number of draws prepared.
+  size_t prepareFrame(const M44& worldToProjection,
+                      const std::vector<std::string>& passes);
+
+  /// Makes prepareFrame also cull objects whose bounding sphere covers
+  /// less than 'minPixels' pixels (diameter) of a viewport 'viewportHeight'
+  /// pixels high. 0 disables small feature culling (the default).
+  void setSmallFeatureCulling(float minPixels, float viewportHeight);
+
+  /// Makes prepareFrame draw passes with levels of detail (see
+  /// addPassLODToObject) at the coarsest level whose geometric error covers
+  /// at most 'maxPixels' pixels of a viewport 'viewportHeight' pixels high,
+  /// measured at the point of the object's bounds closest to the eye. 0
+  /// draws full detail (the default). setTargetFrameTime may raise it.
+  void setLODPixelError(float maxPixels, float viewportHeight);
+
+  /// Number of draws the last prepareFrame made at a coarser level of
+  /// detail than full.
+  size_t getNumCoarseDraws() const;
+
+  /// Makes prepareFrame also skip objects hidden behind others, as found by
+  /// hardware occlusion queries (GL_ANY_SAMPLES_PASSED) against their
+  /// bounding boxes. renderPreparedFrame issues the queries after drawing,
+  /// and later frames use the results that are ready without waiting for
+  /// the others, so an object coming out from behind another may appear a
+  /// frame or two late. Objects in view that were visible are tested every
+  /// few frames only. Objects without bounds and objects whose bounds reach
+  /// the near plane are always drawn. The queries use the depth test state
+  /// the draws left behind: with depth testing disabled nothing is culled.
+  /// Off by default. Call from the render thread.
+  /// throws UnsupportedException on OpenGL ES 2.0.
+  void setOcclusionCulling(bool enabled);
+
+  /// Makes prepareFrame also skip objects hidden behind a few large
+  /// occluders, rasterized on the CPU in the same frame: no queries, no
+  /// latency, and available on OpenGL ES 2.0. After frustum culling, up to
+  /// 16 objects in view are picked as occluders, those flagged with
+  /// setObjectOccluder first, then the largest on screen (bounding sphere
+  /// radius covering a tenth of the view height or more), within a budget
+  /// of 65536 triangles. Their triangles are rasterized from the retained
+  /// meshes of their passes (see setMeshRetention): objects without are
+  /// never occluders. The other objects' boxes are then tested against a
+  /// hierarchical depth buffer of the occluders, four at a time, on the
+  /// shared thread pool. Off by default.
+  void setSoftwareOcclusionCulling(bool enabled);
+
+  /// Number of objects rasterized as occluders by the last prepareFrame.
+  size_t getNumOccluders() const;
+
+  /// Makes prepareFrame cull the clusters of clustered IBOs (see
+  /// setIBOClusters) of the objects in view against the view frustum, and
+  /// if 'backFaces' against the cones bounding their normals. Passes then
+  /// draw the clusters left as index ranges, with one glMultiDrawElements
+  /// (a loop of glDrawElements on OpenGL ES 2.0). Only cull back faces when
+  /// the application culls them too, with counter clockwise front faces:
+  /// spire does not enable GL_CULL_FACE itself. Off by default. Call from
+  /// the render thread.
+  void setClusterCulling(bool enabled, bool backFaces = false);
+
+  /// Number of clusters the last prepareFrame culled.
+  size_t getNumClustersCulled() const;
+
+  /// Makes prepareFrame and renderPreparedFrame hold a frame time of
+  /// 'milliseconds'. Their CPU time and the GPU time of the draws (timer
+  /// queries, read without waiting; OpenGL ES 2.0 has none) are measured
+  /// and a cost model predicts the time of a frame from its draws and
+  /// indices. When frames take too long, detail is traded for time: first
+  /// a pixel error of up to 'maxPixelError' pixels picks coarser levels of
+  /// detail (raising setLODPixelError), then objects smaller than up to
+  /// 'maxPixelError' pixels are skipped (raising setSmallFeatureCulling),
+  /// then the optional passes (setOptionalPasses). Detail comes back in the
+  /// reverse order once frames are well under the target for a few frames
+  /// in a row. 0 disables frame time control (the
+  /// default). Call from the render thread.
+  void setTargetFrameTime(double milliseconds, float maxPixelError = 16.0f);
+
+  /// Passes that frame time control may skip, most important first: the
+  /// last one is skipped first.
+  void setOptionalPasses(const std::vector<std::string>& passes);
+
+  /// Measurements and decisions of frame time control.
+  struct FrameTiming
+  {
+    FrameTiming() :
+        cpuMs(0.0),
+        gpuMs(-1.0),
+        predictedMs(0.0),
+        pixelError(0.0f),
+        cullPixels(0.0f),
+        numSkippedPasses(0)
+    {}
+
+    double  cpuMs;            ///< Of the last frame whose GPU time is in.
+    double  gpuMs;            ///< Same, negative without timer queries.
+    double  predictedMs;      ///< Cost model's time of the last prepareFrame.
+    float   pixelError;       ///< Current tolerance, 0 for full detail.
+    float   cullPixels;       ///< Current culled size, 0 culls nothing.
+    size_t  numSkippedPasses; ///< Optional passes skipped.
+  };
+
+  /// Frame time control measurements. Call from the render thread.
+  FrameTiming getFrameTiming() const;
+
+  /// Number of objects in view that the last prepareFrame skipped as
+  /// occluded, by either kind of occlusion culling.
+  size_t getNumOccludedObjects() const;
+
+  /// Renders the draws of the last prepareFrame. The computed uObject and
+  /// uProjIVObject take the place of the global uniforms of the same names;
+  /// uniforms set on the object or pass still take precedence. The draws
+  /// are first recorded into command lists on the shared thread pool, then
+  /// replayed with OpenGL on the calling thread; state already set by the
+  /// previous draw is not set again.
+  void renderPreparedFrame();
+
+  //-----------------
+  // Spatial queries
+  //-----------------
+
+  // Queries over the world space bounds of the objects (setObjectBounds
+  // transformed by setObjectTransform, or the bounds of the objects' VBOs),
+  // for selection and clipping. They are answered by a bounding volume
+  // hierarchy in time sublinear in the number of objects. Objects without
+  // bounds are returned by every query, after the others.
+  //
+  // The queries may be called from any thread, except from within thread
+  // pool tasks, and see every edit that completed before they were called.
+  // They are serialized with each other. The first query after edits brings
+  // the hierarchy up to date, in time proportional to the number of objects
+  // edited, or rebuilds it on the shared thread pool after many edits.
+
+  /// Names of the objects whose bounds intersect the box ['min', 'max'], in
+  /// no particular order.
+  std::vector<std::string> queryObjectsInBox(const V3& min, const V3& max) const;
+
+  /// Names of the objects whose bounds are not entirely outside of the view
+  /// frustum of 'worldToProjection' (the frustum culling of prepareFrame),
+  /// in no particular order.
+  std::vector<std::string> queryObjectsInFrustum(const M44& worldToProjection) const;
+
+  /// Names of the objects whose bounds are hit by the ray starting at
+  /// 'origin' along 'direction', nearest first: use for picking.
+  /// \param  distances If not null, set to the ray parameter (in multiples
+  ///                   of 'direction') at which the ray enters each object's
+  ///                   bounds; 0 if it starts inside of them, infinite for
+  ///                   objects without bounds.
+  std::vector<std::string> queryObjectsOnRay(const V3& origin,
+                                             const V3& direction,
+                                             std::vector<float>* distances = nullptr) const;
+
+  //---------
+  // Picking
+  //---------
+
+  /// Keeps CPU copies of the positions ("aPos") of VBOs and the indices of
+  /// IBOs added by addVBO and addIBO from now on, so pick can find the
+  /// triangles of passes drawing them. Off by default. Costs 12 bytes per
+  /// vertex and 4 per index, plus about 56 bytes per triangle for the BVH
+  /// of each mesh that was picked. Thread safe.
+  void setMeshRetention(bool retain);
+
+  /// Triangle found by pick.
+  struct PickResult
+  {
+    PickResult() :
+        hit(false),
+        triangle(0),
+        distance(0.0f)
+    {
+      vertices[0] = vertices[1] = vertices[2] = 0;
+    }
+
+    bool          hit;          ///< False if nothing was found.
+    std::string   object;
+    std::string   pass;
+
+    /// Index of the triangle among those drawn by the pass: every third
+    /// index of TRIANGLES, every index after the first two of strips and
+    /// fans.
+    size_t        triangle;
+    uint32_t      vertices[3];  ///< VBO indices of its corners.
+    V3            barycentric;  ///< Weights of the corners at the hit point.
+    V3            position;     ///< World space hit point.
+    float         distance;     ///< Ray parameter of the hit point.
+  };
+
+  /// Finds the nearest triangle under the point ('x', 'y') of the view of
+  /// the last prepareFrame, in normalized device coordinates (-1 to 1, y
+  /// up). The ray runs from the near plane (distance 0) to the far plane
+  /// (distance 1). Only triangles of passes whose VBO and IBO were both
+  /// retained (setMeshRetention) are found. Candidate objects come from the
+  /// spatial queries and are tested nearest first. The BVH over the
+  /// triangles of a mesh is built in the background on the shared thread
+  /// pool when a pick first reaches it. Picks do not wait for it: until it
+  /// is ready they test the triangles of the mesh one by one. Thread safe,
+  /// with the same restrictions as the spatial queries.
+  PickResult pick(float x, float y) const;
+
+  /// Same as pick, for the ray starting at 'origin' along 'direction' in
+  /// world space.
+  PickResult pickRay(const V3& origin, const V3& direction) const;
+
+  //---------------
+  // Render thread
+  //---------------
+
+  /// Renders one frame on the render thread. Called after beginFrame; the
+  /// buffers are swapped when it returns.
+  typedef std::function<void (Interface&)> RenderFunction;
+
+  /// How the render thread schedules frames.
+  struct RenderThreadOptions
+  {
+    RenderThreadOptions() :
+        targetFrameRate(60.0),
+        continuous(false)
+    {}
+
+    /// Maximum number of frames per second, 0 to render as fast as the
+    /// buffer swap allows (which is paced by vsync if the context swaps with
+    /// vsync enabled).
+    double  targetFrameRate;
+
+    /// Render every frame even when nothing has changed (animations). When
+    /// false, the thread sleeps until a scene edit is queued, an asynchronous
+    /// load finishes or requestRedraw is called.
+    bool    continuous;
+  };
+
+  /// Hands rendering over to a thread owned by Spire. The context is released
+  /// from the calling thread (Context::doneCurrent) and made current once on
+  /// the render thread, which then runs frames: beginFrame, 'render', and
+  /// Context::swapBuffers. While the thread runs, other threads may only use
+  /// the queue* functions, the asynchronous load functions and
+  /// requestRedraw; everything else belongs in 'render'. Exceptions thrown by
+  /// 'render' are logged. Throws std::logic_error if the thread is already
+  /// running.
+  void startRenderThread(RenderFunction render,
+                         const RenderThreadOptions& options = RenderThreadOptions());
+
+  /// Stops the render thread after its current frame and makes the context
+  /// current on the calling thread again. Does nothing if no render thread is
+  /// running. Must not race with the queue* functions or requestRedraw.
+  void stopRenderThread();
+
+  /// True between startRenderThread and stopRenderThread.
+  bool hasRenderThread() const;
+
+  /// Asks the render thread for a frame, for changes it can not see (such as
+  /// state the render function reads from the host). Thread safe. Does
+  /// nothing without a render thread.
+  void requestRedraw();
+
 protected:
 
   std::shared_ptr<const AbstractUniformStateItem> 
@@ -497,8 +1127,12 @@ protected:
       getObjectGlobalUniformConcrete(const std::string& object,
                                      const std::string& uniformName);
 
+  /// Queues 'command' and wakes the render thread.
+  bool queueCommand(const SceneCommand& command);
+
   std::unique_ptr<Hub>                      mHub;
   std::shared_ptr<InterfaceImplementation>  mImpl;
+  std::unique_ptr<HubThread>                mHubThread;
 
 };
 
@@ -0,0 +1,945 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <algorithm>
+#include <cstring>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+
+#include "AssetFile.h"
+#include "IndexCompression.h"
+#include "MeshOptimizer.h"
+
+namespace CPM_SPIRE_NS {
+
+namespace {
+
+const char ASSET_V1_MAGIC[] = "SCR5";
+const char ASSET_V2_MAGIC[] = "SPV2";
+
+const char CHUNK_VERTICES[] = "VERT";
+const char CHUNK_INDICES[]  = "INDX";
+const char CHUNK_COMPRESSED_INDICES[] = "INDC";
+const char CHUNK_PART_LAYOUT[] = "PLAY";
+const char CHUNK_PART[] = "PART";
+const char CHUNK_CLUSTERS[] = "CLUS";
+const char CHUNK_LOD[] = "LODL";
+
+/// Index encodings of PART and LODL chunks. Plain indices use their size in
+/// bytes.
+const uint32_t PART_INDICES_COMPRESSED = 0;
+
+const size_t FLOAT_VERTEX_SIZE = sizeof(float) * 6;
+
+template <typename T>
+T readValue(std::istream& stream)
+{
+  T value;
+  stream.read(reinterpret_cast<char*>(&value), sizeof(T));
+  if (!stream)
+    throw std::invalid_argument("Unexpected end of asset file.");
+  return value;
+}
+
+void readBytes(std::istream& stream, void* out, size_t size)
+{
+  stream.read(reinterpret_cast<char*>(out), static_cast<std::streamsize>(size));
+  if (!stream)
+    throw std::invalid_argument("Unexpected end of asset file.");
+}
+
+/// Bounds checked reader over an in-memory chunk payload.
+class ChunkReader
+{
+public:
+  ChunkReader(const std::vector<uint8_t>& data) : mData(data), mPos(0) {}
+
+  template <typename T>
+  T read()
+  {
+    T value;
+    readBytes(&value, sizeof(T));
+    return value;
+  }
+
+  void readBytes(void* out, size_t size)
+  {
+    if (size > remaining())
+      throw std::invalid_argument("Asset file chunk is truncated.");
+    if (size > 0)
+      std::memcpy(out, &mData[mPos], size);
+    mPos += size;
+  }
+
+  size_t remaining() const        {return mData.size() - mPos;}
+  const uint8_t* current() const  {return mData.data() + mPos;}
+
+private:
+  const std::vector<uint8_t>& mData;
+  size_t                      mPos;
+};
+
+template <typename T>
+void append(std::vector<uint8_t>& out, const T& value)
+{
+  const uint8_t* raw = reinterpret_cast<const uint8_t*>(&value);
+  out.insert(out.end(), raw, raw + sizeof(T));
+}
+
+void appendBytes(std::vector<uint8_t>& out, const void* data, size_t size)
+{
+  const uint8_t* raw = reinterpret_cast<const uint8_t*>(data);
+  out.insert(out.end(), raw, raw + size);
+}
+
+void appendChunk(std::vector<uint8_t>& out, const char* tag,
+                 const std::vector<uint8_t>& payload)
+{
+  appendBytes(out, tag, 4);
+  append(out, static_cast<uint32_t>(payload.size()));
+  out.insert(out.end(), payload.begin(), payload.end());
+}
+
+size_t getVertexSize(AssetVertexFormat format)
+{
+  return (format == ASSET_VERTEX_QUANTIZED) ? QUANTIZED_VERTEX_SIZE
+                                            : FLOAT_VERTEX_SIZE;
+}
+
+/// Object space position of 'vertex'.
+void getPosition(AssetVertexFormat format, const QuantizationInfo& quantization,
+                 const uint8_t* vertex, float out[3])
+{
+  if (format == ASSET_VERTEX_QUANTIZED)
+  {
+    int16_t q[3];
+    std::memcpy(q, vertex, sizeof(q));
+    for (size_t i = 0; i < 3; ++i)
+      out[i] = quantization.offset[i] + quantization.scale[i] * dequantizeSnorm16(q[i]);
+  }
+  else
+  {
+    std::memcpy(out, vertex, sizeof(float) * 3);
+  }
+}
+
+/// Reads the magic number and mesh count of an asset file.
+/// \return True for version 1 files.
+bool readHeader(std::istream& stream, uint32_t& numMeshes)
+{
+  char magic[4];
+  stream.read(magic, 4);
+  if (!stream)
+    throw std::invalid_argument("Header does not match asset file.");
+
+  bool v1 = (std::memcmp(magic, ASSET_V1_MAGIC, 4) == 0);
+  if (!v1)
+  {
+    if (std::memcmp(magic, ASSET_V2_MAGIC, 4) != 0)
+      throw std::invalid_argument("Header does not match asset file.");
+
+    uint32_t version = readValue<uint32_t>(stream);
+    if (version > ASSET_FILE_VERSION)
+      throw std::invalid_argument("Asset file version is not supported.");
+  }
+
+  numMeshes = readValue<uint32_t>(stream);
+  if (numMeshes == 0)
+    throw std::invalid_argument("Need at least one mesh in asset file.");
+  return v1;
+}
+
+//------------------------------------------------------------------------------
+void readMeshV1(std::istream& stream, AssetMesh& mesh)
+{
+  mesh.vertexFormat = ASSET_VERTEX_FLOAT;
+
+  uint32_t numVertices = readValue<uint32_t>(stream);
+  mesh.vbo.resize(numVertices * FLOAT_VERTEX_SIZE);
+  if (numVertices > 0)
+    readBytes(stream, &mesh.vbo[0], mesh.vbo.size());
+
+  uint32_t numFaces = readValue<uint32_t>(stream);
+  mesh.indices.clear();
+  mesh.indices.reserve(numFaces * 3);
+  for (uint32_t i = 0; i < numFaces; ++i)
+  {
+    // Quads have already been split into two triangles by assetConv. Other
+    // faces (points and lines) are written without any indices.
+    uint8_t numIndices = readValue<uint8_t>(stream);
+    size_t count = (numIndices == 3) ? 3 : ((numIndices == 4) ? 6 : 0);
+    for (size_t j = 0; j < count; ++j)
+      mesh.indices.push_back(readValue<uint16_t>(stream));
+  }
+}
+
+//------------------------------------------------------------------------------
+void readVertexChunk(const std::vector<uint8_t>& payload, AssetMesh& mesh)
+{
+  ChunkReader reader(payload);
+  uint32_t format = reader.read<uint32_t>();
+  if (format != ASSET_VERTEX_FLOAT && format != ASSET_VERTEX_QUANTIZED)
+    throw std::invalid_argument("Unknown vertex format in asset file.");
+  mesh.vertexFormat = static_cast<AssetVertexFormat>(format);
+
+  uint32_t numVertices = reader.read<uint32_t>();
+  if (mesh.vertexFormat == ASSET_VERTEX_QUANTIZED)
+  {
+    reader.readBytes(mesh.quantization.offset, sizeof(float) * 3);
+    reader.readBytes(mesh.quantization.scale, sizeof(float) * 3);
+  }
+
+  if (numVertices > reader.remaining() / mesh.vertexSize())
+    throw std::invalid_argument("Asset file chunk is truncated.");
+
+  mesh.vbo.resize(numVertices * mesh.vertexSize());
+  if (!mesh.vbo.empty())
+    reader.readBytes(&mesh.vbo[0], mesh.vbo.size());
+}
+
+//------------------------------------------------------------------------------
+void readIndexChunk(const std::vector<uint8_t>& payload, AssetMesh& mesh)
+{
+  ChunkReader reader(payload);
+  uint32_t indexSize = reader.read<uint32_t>();
+  uint32_t numIndices = reader.read<uint32_t>();
+  if (indexSize != sizeof(uint16_t) && indexSize != sizeof(uint32_t))
+    throw std::invalid_argument("Unsupported index size in asset file.");
+  if (numIndices > reader.remaining() / indexSize)
+    throw std::invalid_argument("Asset file chunk is truncated.");
+
+  mesh.indices.resize(numIndices);
+  if (indexSize == sizeof(uint16_t))
+  {
+    for (uint32_t i = 0; i < numIndices; ++i)
+      mesh.indices[i] = reader.read<uint16_t>();
+  }
+  else if (numIndices > 0)
+  {
+    reader.readBytes(&mesh.indices[0], numIndices * sizeof(uint32_t));
+  }
+}
+
+//------------------------------------------------------------------------------
+/// Decodes 'numIndices' compressed indices, which must use up the rest of
+/// 'reader'.
+void readCompressedIndices(ChunkReader& reader, size_t numIndices,
+                           std::vector<uint32_t>& indices)
+{
+  // Every index takes at least one byte, which bounds the allocation below.
+  if (numIndices > reader.remaining())
+    throw std::invalid_argument("Asset file chunk is truncated.");
+
+  indices.resize(numIndices);
+  size_t used = decodeIndices(reader.current(), reader.remaining(),
+                              indices.data(), numIndices);
+  if (used != reader.remaining())
+    throw std::invalid_argument("Malformed compressed index data.");
+}
+
+//------------------------------------------------------------------------------
+void readCompressedIndexChunk(const std::vector<uint8_t>& payload,
+                              AssetMesh& mesh)
+{
+  ChunkReader reader(payload);
+  uint32_t numIndices = reader.read<uint32_t>();
+  readCompressedIndices(reader, numIndices, mesh.indices);
+}
+
+//------------------------------------------------------------------------------
+void readClusterChunk(const std::vector<uint8_t>& payload, AssetMesh& mesh)
+{
+  ChunkReader reader(payload);
+  uint32_t numClusters = reader.read<uint32_t>();
+  if (numClusters > reader.remaining() / (sizeof(uint32_t) * 2 + sizeof(float) * 8))
+    throw std::invalid_argument("Asset file chunk is truncated.");
+
+  mesh.clusters.resize(numClusters);
+  for (auto it = mesh.clusters.begin(); it != mesh.clusters.end(); ++it)
+  {
+    it->firstIndex = reader.read<uint32_t>();
+    it->numIndices = reader.read<uint32_t>();
+    reader.readBytes(it->center, sizeof(float) * 3);
+    it->radius = reader.read<float>();
+    reader.readBytes(it->coneAxis, sizeof(float) * 3);
+    it->coneCutoff = reader.read<float>();
+  }
+}
+
+//------------------------------------------------------------------------------
+/// Reads 'numIndices' indices of the given encoding, which must use up the
+/// rest of 'reader'.
+void readEncodedIndices(ChunkReader& reader, uint32_t encoding,
+                        size_t numIndices, std::vector<uint32_t>& indices)
+{
+  if (encoding == PART_INDICES_COMPRESSED)
+  {
+    readCompressedIndices(reader, numIndices, indices);
+  }
+  else if (encoding == sizeof(uint16_t))
+  {
+    indices.resize(numIndices);
+    for (size_t i = 0; i < numIndices; ++i)
+      indices[i] = reader.read<uint16_t>();
+  }
+  else if (encoding == sizeof(uint32_t))
+  {
+    indices.resize(numIndices);
+    if (numIndices > 0)
+      reader.readBytes(&indices[0], numIndices * sizeof(uint32_t));
+  }
+  else
+  {
+    throw std::invalid_argument("Unsupported index size in asset file.");
+  }
+}
+
+//------------------------------------------------------------------------------
+void readLODChunk(const std::vector<uint8_t>& payload, AssetMesh& mesh)
+{
+  ChunkReader reader(payload);
+  MeshLOD lod;
+  lod.error = reader.read<float>();
+  uint32_t encoding = reader.read<uint32_t>();
+  uint32_t numIndices = reader.read<uint32_t>();
+  if (numIndices > reader.remaining())
+    throw std::invalid_argument("Asset file chunk is truncated.");
+  readEncodedIndices(reader, encoding, numIndices, lod.indices);
+  mesh.lods.push_back(std::move(lod));
+}
+
+//------------------------------------------------------------------------------
+/// Reads PLAY and PART chunks and checks that the parts arrive in order.
+class PartReader
+{
+public:
+  PartReader() :
+      mHaveLayout(false), mHaveWholeMesh(false),
+      mNumParts(0), mNextVertex(0), mNextIndex(0)
+  {}
+
+  bool haveLayout() const               {return mHaveLayout;}
+  const AssetMeshLayout& layout() const {return mLayout;}
+
+  /// Throws if 'tag' holds vertices or indices of the whole mesh and the
+  /// mesh is split into parts: a mesh is stored one way or the other.
+  void checkChunk(const char* tag)
+  {
+    if (   std::memcmp(tag, CHUNK_VERTICES, 4) != 0
+        && std::memcmp(tag, CHUNK_INDICES, 4) != 0
+        && std::memcmp(tag, CHUNK_COMPRESSED_INDICES, 4) != 0)
+      return;
+    if (mHaveLayout)
+      throw std::invalid_argument("Asset file mixes whole meshes and parts.");
+    mHaveWholeMesh = true;
+  }
+
+  void readLayout(const std::vector<uint8_t>& payload)
+  {
+    if (mHaveLayout)
+      throw std::invalid_argument("Duplicate part layout in asset file.");
+    if (mHaveWholeMesh)
+      throw std::invalid_argument("Asset file mixes whole meshes and parts.");
+
+    ChunkReader reader(payload);
+    uint32_t format = reader.read<uint32_t>();
+    if (format != ASSET_VERTEX_FLOAT && format != ASSET_VERTEX_QUANTIZED)
+      throw std::invalid_argument("Unknown vertex format in asset file.");
+    mLayout.vertexFormat = static_cast<AssetVertexFormat>(format);
+    mLayout.numVertices  = reader.read<uint32_t>();
+    mLayout.numIndices   = reader.read<uint32_t>();
+    mLayout.numParts     = reader.read<uint32_t>();
+    if (mLayout.vertexFormat == ASSET_VERTEX_QUANTIZED)
+    {
+      reader.readBytes(mLayout.quantization.offset, sizeof(float) * 3);
+      reader.readBytes(mLayout.quantization.scale, sizeof(float) * 3);
+    }
+    mHaveLayout = true;
+  }
+
+  void readPart(const std::vector<uint8_t>& payload, AssetMeshPart& part)
+  {
+    if (!mHaveLayout || mNumParts == mLayout.numParts)
+      throw std::invalid_argument("Unexpected part in asset file.");
+
+    ChunkReader reader(payload);
+    part.firstVertex = reader.read<uint32_t>();
+    size_t numVertices = reader.read<uint32_t>();
+    part.firstIndex = reader.read<uint32_t>();
+    size_t numIndices = reader.read<uint32_t>();
+    reader.readBytes(part.boundsMin, sizeof(float) * 3);
+    reader.readBytes(part.boundsMax, sizeof(float) * 3);
+    uint32_t encoding = reader.read<uint32_t>();
+
+    if (   part.firstVertex != mNextVertex
+        || part.firstIndex != mNextIndex
+        || numVertices > mLayout.numVertices - mNextVertex
+        || numIndices > mLayout.numIndices - mNextIndex)
+      throw std::invalid_argument("Asset file parts are out of order.");
+
+    // The counts of the layout are not trusted either: every vertex and
+    // index takes up space in the chunk.
+    if (   numVertices > reader.remaining() / mLayout.vertexSize()
+        || numIndices > reader.remaining())
+      throw std::invalid_argument("Asset file chunk is truncated.");
+
+    part.vbo.resize(numVertices * mLayout.vertexSize());
+    if (!part.vbo.empty())
+      reader.readBytes(&part.vbo[0], part.vbo.size());
+
+    readEncodedIndices(reader, encoding, numIndices, part.indices);
+
+    // Parts may only reference vertices that have already been delivered.
+    mNextVertex += numVertices;
+    mNextIndex += numIndices;
+    for (auto it = part.indices.begin(); it != part.indices.end(); ++it)
+    {
+      if (*it >= mNextVertex)
+        throw std::invalid_argument("Asset file part references a later vertex.");
+    }
+    ++mNumParts;
+  }
+
+  /// Throws if parts announced by the layout are missing.
+  void checkComplete() const
+  {
+    if (   mNumParts != mLayout.numParts
+        || mNextVertex != mLayout.numVertices
+        || mNextIndex != mLayout.numIndices)
+      throw std::invalid_argument("Asset file is missing mesh parts.");
+  }
+
+private:
+  AssetMeshLayout mLayout;
+  bool            mHaveLayout;
+  bool            mHaveWholeMesh;
+  size_t          mNumParts;
+  size_t          mNextVertex;
+  size_t          mNextIndex;
+};
+
+//------------------------------------------------------------------------------
+/// Hands every chunk of a version 2 mesh to 'onChunk'.
+void readMeshChunks(
+    std::istream& stream,
+    const std::function<void (const char*, const std::vector<uint8_t>&)>& onChunk)
+{
+  uint32_t numChunks = readValue<uint32_t>(stream);
+  std::vector<uint8_t> payload;
+  for (uint32_t i = 0; i < numChunks; ++i)
+  {
+    char tag[4];
+    readBytes(stream, tag, 4);
+    uint32_t size = readValue<uint32_t>(stream);
+
+    payload.resize(size);
+    if (size > 0)
+      readBytes(stream, &payload[0], size);
+    onChunk(tag, payload);
+  }
+}
+
+//------------------------------------------------------------------------------
+/// Reads the whole-mesh chunks. Returns false for any other chunk.
+bool readMeshChunk(const char* tag, const std::vector<uint8_t>& payload,
+                   AssetMesh& mesh)
+{
+  if (std::memcmp(tag, CHUNK_VERTICES, 4) == 0)
+    readVertexChunk(payload, mesh);
+  else if (std::memcmp(tag, CHUNK_INDICES, 4) == 0)
+    readIndexChunk(payload, mesh);
+  else if (std::memcmp(tag, CHUNK_COMPRESSED_INDICES, 4) == 0)
+    readCompressedIndexChunk(payload, mesh);
+  else if (std::memcmp(tag, CHUNK_CLUSTERS, 4) == 0)
+    readClusterChunk(payload, mesh);
+  else if (std::memcmp(tag, CHUNK_LOD, 4) == 0)
+    readLODChunk(payload, mesh);
+  else
+    return false;
+  return true;
+}
+
+//------------------------------------------------------------------------------
+/// Throws unless every index of the whole mesh references one of its
+/// vertices. Parts are checked as they are read.
+void validateMeshIndices(const AssetMesh& mesh)
+{
+  size_t numVertices = mesh.numVertices();
+  for (auto it = mesh.indices.begin(); it != mesh.indices.end(); ++it)
+  {
+    if (*it >= numVertices)
+      throw std::invalid_argument("Asset file index references a vertex outside of the VBO.");
+  }
+}
+
+//------------------------------------------------------------------------------
+void readMeshV2(std::istream& stream, AssetMesh& mesh)
+{
+  PartReader parts;
+  AssetMeshPart part;
+  readMeshChunks(stream, [&](const char* tag, const std::vector<uint8_t>& payload)
+  {
+    parts.checkChunk(tag);
+    if (readMeshChunk(tag, payload, mesh))
+      return;
+
+    if (std::memcmp(tag, CHUNK_PART_LAYOUT, 4) == 0)
+    {
+      // Nothing is allocated up front: the buffers grow with the parts
+      // actually read.
+      parts.readLayout(payload);
+      const AssetMeshLayout& layout = parts.layout();
+      mesh.vertexFormat = layout.vertexFormat;
+      mesh.quantization = layout.quantization;
+      mesh.vbo.clear();
+      mesh.indices.clear();
+    }
+    else if (std::memcmp(tag, CHUNK_PART, 4) == 0)
+    {
+      // Parts arrive in order, so each one continues the buffers.
+      parts.readPart(payload, part);
+      if (   part.firstVertex * mesh.vertexSize() != mesh.vbo.size()
+          || part.firstIndex != mesh.indices.size())
+        throw std::invalid_argument("Asset file parts are out of order.");
+      mesh.vbo.insert(mesh.vbo.end(), part.vbo.begin(), part.vbo.end());
+      mesh.indices.insert(mesh.indices.end(), part.indices.begin(),
+                          part.indices.end());
+    }
+    // Unknown chunks are skipped.
+  });
+
+  if (parts.haveLayout())
+    parts.checkComplete();
+  validateMeshIndices(mesh);
+  validateMeshClusters(mesh.clusters, mesh.indices.size());
+  validateMeshLODs(mesh.lods, mesh.numVertices());
+}
+
+//------------------------------------------------------------------------------
+void appendVertexChunk(std::vector<uint8_t>& out, const AssetMesh& mesh)
+{
+  std::vector<uint8_t> payload;
+  append(payload, static_cast<uint32_t>(mesh.vertexFormat));
+  append(payload, static_cast<uint32_t>(mesh.numVertices()));
+  if (mesh.vertexFormat == ASSET_VERTEX_QUANTIZED)
+  {
+    appendBytes(payload, mesh.quantization.offset, sizeof(float) * 3);
+    appendBytes(payload, mesh.quantization.scale, sizeof(float) * 3);
+  }
+  payload.insert(payload.end(), mesh.vbo.begin(), mesh.vbo.end());
+  appendChunk(out, CHUNK_VERTICES, payload);
+}
+
+//------------------------------------------------------------------------------
+void appendIndexChunk(std::vector<uint8_t>& out, const AssetMesh& mesh,
+                      bool compressIndices)
+{
+  std::vector<uint8_t> payload;
+  if (compressIndices)
+  {
+    append(payload, static_cast<uint32_t>(mesh.indices.size()));
+    encodeIndices(mesh.indices, payload);
+    appendChunk(out, CHUNK_COMPRESSED_INDICES, payload);
+    return;
+  }
+
+  bool shortIndices = mesh.numVertices() <= 65536;
+  append(payload, static_cast<uint32_t>(shortIndices ? sizeof(uint16_t)
+                                                     : sizeof(uint32_t)));
+  append(payload, static_cast<uint32_t>(mesh.indices.size()));
+  for (auto idx = mesh.indices.begin(); idx != mesh.indices.end(); ++idx)
+  {
+    if (shortIndices)
+      append(payload, static_cast<uint16_t>(*idx));
+    else
+      append(payload, *idx);
+  }
+  appendChunk(out, CHUNK_INDICES, payload);
+}
+
+//------------------------------------------------------------------------------
+void appendClusterChunk(std::vector<uint8_t>& out, const AssetMesh& mesh)
+{
+  std::vector<uint8_t> payload;
+  append(payload, static_cast<uint32_t>(mesh.clusters.size()));
+  for (auto it = mesh.clusters.begin(); it != mesh.clusters.end(); ++it)
+  {
+    append(payload, it->firstIndex);
+    append(payload, it->numIndices);
+    appendBytes(payload, it->center, sizeof(float) * 3);
+    append(payload, it->radius);
+    appendBytes(payload, it->coneAxis, sizeof(float) * 3);
+    append(payload, it->coneCutoff);
+  }
+  appendChunk(out, CHUNK_CLUSTERS, payload);
+}
+
+//------------------------------------------------------------------------------
+/// Appends indices in the given encoding (see readEncodedIndices).
+void appendEncodedIndices(std::vector<uint8_t>& out, uint32_t encoding,
+                          const std::vector<uint32_t>& indices)
+{
+  if (encoding == PART_INDICES_COMPRESSED)
+  {
+    encodeIndices(indices, out);
+    return;
+  }
+  for (auto idx = indices.begin(); idx != indices.end(); ++idx)
+  {
+    if (encoding == sizeof(uint16_t))
+      append(out, static_cast<uint16_t>(*idx));
+    else
+      append(out, *idx);
+  }
+}
+
+//------------------------------------------------------------------------------
+/// Appends a LODL chunk per level of detail. 'remap' gives the new number of
+/// every vertex when the vertices have been reordered, otherwise it is empty.
+void appendLODChunks(std::vector<uint8_t>& out, const AssetMesh& mesh,
+                     size_t numVertices, const std::vector<uint32_t>& remap,
+                     bool compressIndices)
+{
+  uint32_t encoding = compressIndices ? PART_INDICES_COMPRESSED
+      : static_cast<uint32_t>(numVertices <= 65536 ? sizeof(uint16_t)
+                                                   : sizeof(uint32_t));
+  std::vector<uint32_t> indices;
+  for (auto lod = mesh.lods.begin(); lod != mesh.lods.end(); ++lod)
+  {
+    indices = lod->indices;
+    if (!remap.empty())
+    {
+      for (auto it = indices.begin(); it != indices.end(); ++it)
+        *it = remap[*it];
+    }
+
+    std::vector<uint8_t> payload;
+    append(payload, lod->error);
+    append(payload, encoding);
+    append(payload, static_cast<uint32_t>(indices.size()));
+    appendEncodedIndices(payload, encoding, indices);
+    appendChunk(out, CHUNK_LOD, payload);
+  }
+}
+
+//------------------------------------------------------------------------------
+void appendPartChunks(std::vector<uint8_t>& out, const AssetMesh& mesh,
+                      const AssetWriteOptions& options)
+{
+  AssetMeshLayout layout;
+  std::vector<AssetMeshPart> parts;
+  splitAssetMesh(mesh, options.trianglesPerPart, layout, parts);
+
+  // Parts keep the order of the indices, so the clusters still apply.
+  bool clusters = !mesh.clusters.empty();
+  append(out, static_cast<uint32_t>(1 + parts.size() + (clusters ? 1 : 0)
+                                    + mesh.lods.size()));
+
+  std::vector<uint8_t> payload;
+  append(payload, static_cast<uint32_t>(layout.vertexFormat));
+  append(payload, static_cast<uint32_t>(layout.numVertices));
+  append(payload, static_cast<uint32_t>(layout.numIndices));
+  append(payload, static_cast<uint32_t>(layout.numParts));
+  if (layout.vertexFormat == ASSET_VERTEX_QUANTIZED)
+  {
+    appendBytes(payload, layout.quantization.offset, sizeof(float) * 3);
+    appendBytes(payload, layout.quantization.scale, sizeof(float) * 3);
+  }
+  appendChunk(out, CHUNK_PART_LAYOUT, payload);
+
+  bool shortIndices = layout.numVertices <= 65536;
+  for (auto it = parts.begin(); it != parts.end(); ++it)
+  {
+    size_t numVertices = it->vbo.size() / layout.vertexSize();
+    payload.clear();
+    append(payload, static_cast<uint32_t>(it->firstVertex));
+    append(payload, static_cast<uint32_t>(numVertices));
+    append(payload, static_cast<uint32_t>(it->firstIndex));
+    append(payload, static_cast<uint32_t>(it->indices.size()));
+    appendBytes(payload, it->boundsMin, sizeof(float) * 3);
+    appendBytes(payload, it->boundsMax, sizeof(float) * 3);
+
+    uint32_t encoding = options.compressIndices ? PART_INDICES_COMPRESSED
+        : static_cast<uint32_t>(shortIndices ? sizeof(uint16_t) : sizeof(uint32_t));
+    append(payload, encoding);
+    payload.insert(payload.end(), it->vbo.begin(), it->vbo.end());
+    appendEncodedIndices(payload, encoding, it->indices);
+    appendChunk(out, CHUNK_PART, payload);
+  }
+  if (clusters)
+    appendClusterChunk(out, mesh);
+
+  // The parts renumber the vertices by first use (see splitAssetMesh). Every
+  // level of detail only uses vertices of the full mesh.
+  if (!mesh.lods.empty())
+  {
+    std::vector<uint32_t> remap(mesh.numVertices(), 0);
+    std::vector<uint8_t> seen(mesh.numVertices(), 0);
+    uint32_t next = 0;
+    for (auto it = mesh.indices.begin(); it != mesh.indices.end(); ++it)
+    {
+      if (!seen[*it])
+      {
+        seen[*it] = 1;
+        remap[*it] = next++;
+      }
+    }
+    for (auto lod = mesh.lods.begin(); lod != mesh.lods.end(); ++lod)
+    {
+      for (auto it = lod->indices.begin(); it != lod->indices.end(); ++it)
+      {
+        if (*it >= seen.size() || !seen[*it])
+          throw std::invalid_argument("Level of detail uses a vertex the mesh does not.");
+      }
+    }
+    appendLODChunks(out, mesh, layout.numVertices, remap, options.compressIndices);
+  }
+}
+
+} // namespace
+
+//------------------------------------------------------------------------------
+AssetMesh::AssetMesh() :
+    vertexFormat(ASSET_VERTEX_FLOAT)
+{
+}
+
+//------------------------------------------------------------------------------
+size_t AssetMesh::vertexSize() const
+{
+  return getVertexSize(vertexFormat);
+}
+
+//------------------------------------------------------------------------------
+size_t AssetMesh::numVertices() const
+{
+  return vbo.size() / vertexSize();
+}
+
+//------------------------------------------------------------------------------
+AssetMeshLayout::AssetMeshLayout() :
+    vertexFormat(ASSET_VERTEX_FLOAT),
+    numVertices(0),
+    numIndices(0),
+    numParts(0)
+{
+}
+
+//------------------------------------------------------------------------------
+size_t AssetMeshLayout::vertexSize() const
+{
+  return getVertexSize(vertexFormat);
+}
+
+//------------------------------------------------------------------------------
+AssetMeshPart::AssetMeshPart() :
+    firstVertex(0),
+    firstIndex(0)
+{
+  std::fill(boundsMin, boundsMin + 3, 0.0f);
+  std::fill(boundsMax, boundsMax + 3, 0.0f);
+}
+
+//------------------------------------------------------------------------------
+AssetWriteOptions::AssetWriteOptions() :
+    compressIndices(false),
+    trianglesPerPart(0)
+{
+}
+
+//------------------------------------------------------------------------------
+void splitAssetMesh(const AssetMesh& mesh, size_t trianglesPerPart,
+                    AssetMeshLayout& layout, std::vector<AssetMeshPart>& parts)
+{
+  if (trianglesPerPart == 0)
+    throw std::invalid_argument("Mesh parts need at least one triangle.");
+
+  size_t stride = mesh.vertexSize();
+  std::vector<uint8_t> vbo = mesh.vbo;
+  std::vector<uint32_t> indices = mesh.indices;
+  size_t numVertices = optimizeVertexFetch(vbo, stride, indices);
+
+  size_t indicesPerPart = trianglesPerPart * 3;
+  layout.vertexFormat = mesh.vertexFormat;
+  layout.quantization = mesh.quantization;
+  layout.numVertices  = numVertices;
+  layout.numIndices   = indices.size();
+  layout.numParts     = (indices.size() + indicesPerPart - 1) / indicesPerPart;
+
+  parts.clear();
+  parts.resize(layout.numParts);
+  size_t nextVertex = 0;
+  for (size_t p = 0; p < layout.numParts; ++p)
+  {
+    AssetMeshPart& part = parts[p];
+    size_t begin = p * indicesPerPart;
+    size_t end = std::min(begin + indicesPerPart, indices.size());
+    part.firstIndex = begin;
+    part.indices.assign(indices.begin() + static_cast<ptrdiff_t>(begin),
+                        indices.begin() + static_cast<ptrdiff_t>(end));
+
+    // Vertices are in first use order, so the vertices new to this part are
+    // the ones past everything earlier parts used.
+    std::fill(part.boundsMin, part.boundsMin + 3, std::numeric_limits<float>::max());
+    std::fill(part.boundsMax, part.boundsMax + 3, -std::numeric_limits<float>::max());
+    size_t endVertex = nextVertex;
+    for (auto it = part.indices.begin(); it != part.indices.end(); ++it)
+    {
+      endVertex = std::max(endVertex, static_cast<size_t>(*it) + 1);
+
+      float position[3];
+      getPosition(mesh.vertexFormat, mesh.quantization, &vbo[*it * stride], position);
+      for (size_t i = 0; i < 3; ++i)
+      {
+        part.boundsMin[i] = std::min(part.boundsMin[i], position[i]);
+        part.boundsMax[i] = std::max(part.boundsMax[i], position[i]);
+      }
+    }
+
+    part.firstVertex = nextVertex;
+    part.vbo.assign(vbo.begin() + static_cast<ptrdiff_t>(nextVertex * stride),
+                    vbo.begin() + static_cast<ptrdiff_t>(endVertex * stride));
+    nextVertex = endVertex;
+  }
+}
+
+//------------------------------------------------------------------------------
+void streamAssetFile(std::istream& stream, size_t trianglesPerPart,
+                     const std::function<void (const AssetMeshLayout&)>& onLayout,
+                     const std::function<void (AssetMeshPart&)>& onPart)
+{
+  uint32_t numMeshes = 0;
+  AssetMesh mesh;
+  PartReader parts;
+  if (readHeader(stream, numMeshes))
+  {
+    readMeshV1(stream, mesh);
+  }
+  else
+  {
+    AssetMeshPart part;
+    readMeshChunks(stream, [&](const char* tag, const std::vector<uint8_t>& payload)
+    {
+      parts.checkChunk(tag);
+      if (readMeshChunk(tag, payload, mesh))
+        return;
+
+      if (std::memcmp(tag, CHUNK_PART_LAYOUT, 4) == 0)
+      {
+        parts.readLayout(payload);
+        onLayout(parts.layout());
+      }
+      else if (std::memcmp(tag, CHUNK_PART, 4) == 0)
+      {
+        parts.readPart(payload, part);
+        onPart(part);
+      }
+    });
+  }
+
+  if (parts.haveLayout())
+  {
+    parts.checkComplete();
+    return;
+  }
+
+  // The file stores the mesh whole; split it now.
+  AssetMeshLayout layout;
+  std::vector<AssetMeshPart> split;
+  splitAssetMesh(mesh, trianglesPerPart, layout, split);
+  onLayout(layout);
+  for (auto it = split.begin(); it != split.end(); ++it)
+    onPart(*it);
+}
+
+//------------------------------------------------------------------------------
+void readAssetFile(std::istream& stream, std::vector<AssetMesh>& meshes,
+                   size_t maxMeshes)
+{
+  uint32_t numMeshes = 0;
+  bool v1 = readHeader(stream, numMeshes);
+
+  size_t numToRead = std::min(static_cast<size_t>(numMeshes), maxMeshes);
+  meshes.clear();
+  meshes.resize(numToRead);
+  for (size_t i = 0; i < numToRead; ++i)
+  {
+    if (v1)
+      readMeshV1(stream, meshes[i]);
+    else
+      readMeshV2(stream, meshes[i]);
+  }
+}
+
+//------------------------------------------------------------------------------
+void writeAssetFile(std::ostream& stream, const std::vector<AssetMesh>& meshes,
+                    const AssetWriteOptions& options)
+{
+  // The whole file is assembled in memory and handed to the stream at once.
+  std::vector<uint8_t> out;
+  serializeAssetFile(meshes, out, options);
+  stream.write(reinterpret_cast<const char*>(&out[0]),
+               static_cast<std::streamsize>(out.size()));
+}
+
+//------------------------------------------------------------------------------
+void serializeAssetFile(const std::vector<AssetMesh>& meshes,
+                        std::vector<uint8_t>& out,
+                        const AssetWriteOptions& options)
+{
+  bool needsVersion3 = options.compressIndices || options.trianglesPerPart > 0;
+
+  out.clear();
+  appendBytes(out, ASSET_V2_MAGIC, 4);
+  append(out, needsVersion3 ? ASSET_FILE_VERSION : static_cast<uint32_t>(2));
+  append(out, static_cast<uint32_t>(meshes.size()));
+
+  for (auto it = meshes.begin(); it != meshes.end(); ++it)
+  {
+    if (options.trianglesPerPart > 0)
+    {
+      appendPartChunks(out, *it, options);
+    }
+    else
+    {
+      bool clusters = !it->clusters.empty();
+      append(out, static_cast<uint32_t>((clusters ? 3 : 2) + it->lods.size()));
+      appendVertexChunk(out, *it);
+      appendIndexChunk(out, *it, options.compressIndices);
+      if (clusters)
+        appendClusterChunk(out, *it);
+      appendLODChunks(out, *it, it->numVertices(), std::vector<uint32_t>(),
+                      options.compressIndices);
+    }
+  }
+}
+
+} // namespace CPM_SPIRE_NS
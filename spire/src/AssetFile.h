@@ -0,0 +1,188 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+/// \brief  Reading and writing of .sp asset files. Two versions exist:
+///
+///         Version 1 ("SCR5"), written by older versions of assetConv:
+///           u32 numMeshes, then per mesh u32 numVertices, 6 floats per
+///           vertex (position, normal), u32 numFaces and per face a u8 arity
+///           (3 or 4) followed by that many u16 indices. Quads are stored as
+///           two triangles. The file ends with a u32 0.
+///
+///         Version 2 ("SPV2"):
+///           u32 version, u32 numMeshes, then per mesh u32 numChunks followed
+///           by that many chunks. Every chunk is a 4 character tag, a u32
+///           payload size and the payload. Readers skip chunks they do not
+///           understand, so new data can be added without breaking old
+///           readers.
+///
+///           A "CLUS" chunk may follow the geometry: the clusters of the
+///           mesh (see MeshClusters.h), each a u32 first index, u32 index
+///           count, 4 floats of bounding sphere and 4 floats of normal cone.
+///           Older readers skip it and draw the mesh whole.
+///
+///           "LODL" chunks may follow as well, one per level of detail from
+///           fine to coarse (see MeshSimplifier.h): a f32 geometric error, a
+///           u32 index encoding (2 or 4 byte indices, 0 for compressed ones,
+///           see IndexCompression.h), a u32 index count and the indices.
+///           They index the vertices of the mesh. Older readers skip them.
+///
+///         Version 3 is identical to version 2, but may store indices in an
+///         "INDC" chunk (see IndexCompression.h) instead of "INDX", or split
+///         a mesh into a "PLAY" chunk (part layout) followed by "PART" chunks
+///         that can be streamed. It gets its own version number because a
+///         version 2 reader would skip these chunks and end up without
+///         geometry. Files using neither are still written as version 2.
+
+#ifndef SPIRE_HIGH_ASSETFILE_H
+#define SPIRE_HIGH_ASSETFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <vector>
+
+#include "MeshClusters.h"
+#include "MeshSimplifier.h"
+#include "VertexQuantization.h"
+
+namespace CPM_SPIRE_NS {
+
+/// Newest version read and written by this file.
+const uint32_t ASSET_FILE_VERSION = 3;
+
+/// Vertex layouts stored in asset files.
+enum AssetVertexFormat
+{
+  ASSET_VERTEX_FLOAT      = 0,  ///< 3 float position, 3 float normal (24 bytes).
+  ASSET_VERTEX_QUANTIZED  = 1,  ///< See VertexQuantization.h (12 bytes).
+};
+
+/// A single mesh of an asset file.
+struct AssetMesh
+{
+  AssetMesh();
+
+  /// Size of one vertex in bytes for the current vertex format.
+  size_t vertexSize() const;
+
+  /// Number of vertices in 'vbo'.
+  size_t numVertices() const;
+
+  AssetVertexFormat       vertexFormat;
+  std::vector<uint8_t>    vbo;
+  QuantizationInfo        quantization; ///< Only used by quantized vertices.
+  std::vector<uint32_t>   indices;      ///< Triangle list.
+  std::vector<MeshCluster> clusters;    ///< Empty unless built, see MeshClusters.h.
+  std::vector<MeshLOD>    lods;         ///< Coarser levels, see MeshSimplifier.h.
+};
+
+/// Describes a mesh delivered in parts. Known before the first part arrives.
+struct AssetMeshLayout
+{
+  AssetMeshLayout();
+
+  /// Size of one vertex in bytes for the current vertex format.
+  size_t vertexSize() const;
+
+  AssetVertexFormat       vertexFormat;
+  QuantizationInfo        quantization; ///< Only used by quantized vertices.
+  size_t                  numVertices;
+  size_t                  numIndices;
+  size_t                  numParts;
+};
+
+/// A contiguous piece of a mesh. Parts are produced in order: every part
+/// continues the index range of the part before it and only adds vertices
+/// after the ones the earlier parts added. Its indices reference only
+/// vertices of this part or earlier ones, so any prefix of the parts is a
+/// renderable mesh.
+struct AssetMeshPart
+{
+  AssetMeshPart();
+
+  size_t                  firstVertex;  ///< Index of the first vertex in 'vbo'.
+  std::vector<uint8_t>    vbo;          ///< Vertices first used by this part.
+  size_t                  firstIndex;   ///< Position of 'indices' in the mesh.
+  std::vector<uint32_t>   indices;      ///< Triangles, indexing the whole mesh.
+  float                   boundsMin[3]; ///< Object space bounds of the part's
+  float                   boundsMax[3]; ///< triangles.
+};
+
+/// Splits 'mesh' into parts of at most 'trianglesPerPart' triangles.
+/// Vertices are reordered by first use, which is what allows every part to
+/// add a contiguous range of vertices.
+void splitAssetMesh(const AssetMesh& mesh, size_t trianglesPerPart,
+                    AssetMeshLayout& layout, std::vector<AssetMeshPart>& parts);
+
+/// Reads the first mesh of an asset file part by part. Meshes written with
+/// AssetWriteOptions::trianglesPerPart are handed out as each part is read.
+/// Other meshes are read whole and split with splitAssetMesh. Only the full
+/// detail mesh is streamed; levels of detail are skipped.
+/// 'onLayout' is called once, before the first call to 'onPart'. Both are
+/// called on the calling thread. Throws std::invalid_argument if the file is
+/// malformed.
+void streamAssetFile(std::istream& stream, size_t trianglesPerPart,
+                     const std::function<void (const AssetMeshLayout&)>& onLayout,
+                     const std::function<void (AssetMeshPart&)>& onPart);
+
+/// Reads a version 1, 2 or 3 asset file.
+/// Throws std::invalid_argument if the file is malformed.
+/// \param  maxMeshes   Stop reading after this many meshes.
+void readAssetFile(std::istream& stream, std::vector<AssetMesh>& meshes,
+                   size_t maxMeshes = SIZE_MAX);
+
+/// Options for writeAssetFile. Everything but the defaults requires a
+/// version 3 reader.
+struct AssetWriteOptions
+{
+  AssetWriteOptions();
+
+  /// Store delta / varint coded indices (see IndexCompression.h).
+  bool    compressIndices;
+
+  /// When non-zero, meshes are split into parts of at most this many
+  /// triangles (see splitAssetMesh) so they can be streamed.
+  size_t  trianglesPerPart;
+};
+
+/// Writes a version 2 asset file, or a version 3 one when 'options' compress
+/// indices or split meshes into parts. Uncompressed indices are stored as 16
+/// bit values when the mesh has few enough vertices.
+void writeAssetFile(std::ostream& stream, const std::vector<AssetMesh>& meshes,
+                    const AssetWriteOptions& options = AssetWriteOptions());
+
+/// Same as writeAssetFile, but builds the file contents in 'out'.
+void serializeAssetFile(const std::vector<AssetMesh>& meshes,
+                        std::vector<uint8_t>& out,
+                        const AssetWriteOptions& options = AssetWriteOptions());
+
+} // namespace CPM_SPIRE_NS
+
+#endif
@@ -0,0 +1,125 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#include "BoundingVolume.h"
+
+namespace CPM_SPIRE_NS {
+
+//------------------------------------------------------------------------------
+bool computePositionBounds(const uint8_t* vertices, size_t numVertices,
+                           size_t stride, size_t offset, V3& min, V3& max)
+{
+  if (numVertices == 0)
+    return false;
+
+  const uint8_t* position = vertices + offset;
+  size_t i = 0;
+  float lo[4];
+  float hi[4];
+  std::memcpy(lo, position, 3 * sizeof(float));
+  std::memcpy(hi, position, 3 * sizeof(float));
+#if defined(__SSE2__) || defined(_M_X64)
+  // x, y and z of a vertex in one register. Only 12 bytes are read, the
+  // position may be the last thing in the buffer.
+  auto load = [](const uint8_t* p)
+  {
+    return _mm_movelh_ps(
+        _mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(p))),
+        _mm_load_ss(reinterpret_cast<const float*>(p + 8)));
+  };
+  __m128 vmin  = load(position);
+  __m128 vmax  = vmin;
+  __m128 vmin2 = vmin;
+  __m128 vmax2 = vmin;
+  for (; i + 2 <= numVertices; i += 2)
+  {
+    __m128 pa = load(position + i * stride);
+    __m128 pb = load(position + (i + 1) * stride);
+    vmin  = _mm_min_ps(vmin, pa);
+    vmax  = _mm_max_ps(vmax, pa);
+    vmin2 = _mm_min_ps(vmin2, pb);
+    vmax2 = _mm_max_ps(vmax2, pb);
+  }
+  _mm_storeu_ps(lo, _mm_min_ps(vmin, vmin2));
+  _mm_storeu_ps(hi, _mm_max_ps(vmax, vmax2));
+#endif
+  for (; i < numVertices; ++i)
+  {
+    float p[3];
+    std::memcpy(p, position + i * stride, sizeof(p));
+    for (int c = 0; c < 3; ++c)
+    {
+      lo[c] = std::min(lo[c], p[c]);
+      hi[c] = std::max(hi[c], p[c]);
+    }
+  }
+
+  min = V3(lo[0], lo[1], lo[2]);
+  max = V3(hi[0], hi[1], hi[2]);
+  return true;
+}
+
+//------------------------------------------------------------------------------
+float computeBoundingRadius(const uint8_t* vertices, size_t numVertices,
+                            size_t stride, size_t offset, const V3& center)
+{
+  float radius2 = 0.0f;
+  for (size_t i = 0; i < numVertices; ++i)
+  {
+    float p[3];
+    std::memcpy(p, vertices + i * stride + offset, sizeof(p));
+    V3 d = V3(p[0], p[1], p[2]) - center;
+    radius2 = std::max(radius2, glm::dot(d, d));
+  }
+  return std::sqrt(radius2);
+}
+
+//------------------------------------------------------------------------------
+void transformBox(const M44& transform, const V3& min, const V3& max,
+                  V3& center, V3& extent)
+{
+  V3 localCenter = (min + max) * 0.5f;
+  V3 localExtent = (max - min) * 0.5f;
+  center = V3(transform * V4(localCenter, 1.0f));
+  for (int row = 0; row < 3; ++row)
+  {
+    extent[row] =   std::fabs(transform[0][row]) * localExtent.x
+                  + std::fabs(transform[1][row]) * localExtent.y
+                  + std::fabs(transform[2][row]) * localExtent.z;
+  }
+}
+
+} // namespace CPM_SPIRE_NS
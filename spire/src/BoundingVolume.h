@@ -0,0 +1,61 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+/// \brief  Bounding volumes of vertex data, computed when VBOs are added and
+///         used by frame preparation to cull objects. The min / max scan
+///         uses SSE2 when the compiler targets it and gives the same result
+///         as the scalar code otherwise.
+
+#ifndef SPIRE_HIGH_BOUNDINGVOLUME_H
+#define SPIRE_HIGH_BOUNDINGVOLUME_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Common.h"
+
+namespace CPM_SPIRE_NS {
+
+/// Axis aligned box of the positions of 'numVertices' vertices that are
+/// 'stride' bytes apart, with three floats at byte 'offset' of each vertex.
+/// Returns false, leaving 'min' and 'max' alone, if there are no vertices.
+bool computePositionBounds(const uint8_t* vertices, size_t numVertices,
+                           size_t stride, size_t offset, V3& min, V3& max);
+
+/// Radius of the sphere around 'center' containing the same positions.
+float computeBoundingRadius(const uint8_t* vertices, size_t numVertices,
+                            size_t stride, size_t offset, const V3& center);
+
+/// Center and half extents of the axis aligned box containing the box
+/// ['min', 'max'] transformed by 'transform' (Arvo).
+void transformBox(const M44& transform, const V3& min, const V3& max,
+                  V3& center, V3& extent);
+
+} // namespace CPM_SPIRE_NS
+
+#endif
@@ -0,0 +1,371 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <algorithm>
+#include <cstring>
+
+#include "CommandList.h"
+#include "Exceptions.h"
+#include "FramePrep.h"
+#include "Parallel.h"
+#include "ShaderUniformStateManTemplates.h"
+
+#ifndef SPIRE_OPENGL_ES_2
+#define SPIRE_MULTI_DRAW
+#endif
+
+namespace CPM_SPIRE_NS {
+
+const size_t CommandList::DrawsPerList;
+
+//------------------------------------------------------------------------------
+CommandList::CommandList() :
+    mNumDraws(0),
+    mProgram(0),
+    mVBO(0),
+    mIBO(0),
+    mAttribs(nullptr),
+    mNumAttribs(0)
+{
+}
+
+//------------------------------------------------------------------------------
+void CommandList::clear()
+{
+  mCommands.clear();
+  mNumDraws = 0;
+  mProgram = 0;
+  mVBO = 0;
+  mIBO = 0;
+  mAttribs = nullptr;
+  mNumAttribs = 0;
+  mUniforms.clear();
+}
+
+//------------------------------------------------------------------------------
+void CommandList::bindProgram(GLuint program)
+{
+  if (program == mProgram)
+    return;
+
+  RenderCommand command;
+  command.op = RenderCommand::BIND_PROGRAM;
+  command.program = program;
+  mCommands.push_back(command);
+
+  mProgram = program;
+  mUniforms.clear();
+}
+
+//------------------------------------------------------------------------------
+void CommandList::bindBuffers(GLuint vbo, GLuint ibo,
+                              const std::vector<VertexAttribBinding>& attribs)
+{
+  // Passes with the same layout still have their own copy of it, so the
+  // layouts are compared by value.
+  const VertexAttribBinding* attribPtr = attribs.empty() ? nullptr : &attribs[0];
+  if (vbo == mVBO && ibo == mIBO && attribs.size() == mNumAttribs
+      && (attribPtr == mAttribs
+          || std::memcmp(attribPtr, mAttribs,
+                         mNumAttribs * sizeof(VertexAttribBinding)) == 0))
+    return;
+
+  RenderCommand command;
+  command.op = RenderCommand::BIND_BUFFERS;
+  command.buffers.vbo = vbo;
+  command.buffers.ibo = ibo;
+  command.buffers.attribs = attribPtr;
+  command.buffers.numAttribs = static_cast<uint32_t>(attribs.size());
+  mCommands.push_back(command);
+
+  mVBO = vbo;
+  mIBO = ibo;
+  mAttribs = attribPtr;
+  mNumAttribs = attribs.size();
+}
+
+//------------------------------------------------------------------------------
+bool CommandList::isUniformCurrent(GLint location, const void* data)
+{
+  for (auto it = mUniforms.begin(); it != mUniforms.end(); ++it)
+  {
+    if (it->first == location)
+    {
+      if (it->second == data)
+        return true;
+      it->second = data;
+      return false;
+    }
+  }
+  mUniforms.push_back(std::make_pair(location, data));
+  return false;
+}
+
+//------------------------------------------------------------------------------
+void CommandList::pushUniform(RenderCommand::Op op, GLint location,
+                              const float* data)
+{
+  RenderCommand command;
+  command.op = op;
+  command.uniform.location = location;
+  command.uniform.intValue = 0;
+  command.uniform.data = data;
+  mCommands.push_back(command);
+}
+
+//------------------------------------------------------------------------------
+void CommandList::setUniform(GLint location, const AbstractUniformStateItem& item)
+{
+  // Uniform items are replaced, never modified, so the same item means the
+  // same value.
+  const void* data = item.getRawData();
+  if (isUniformCurrent(location, data))
+    return;
+
+  const float* values = static_cast<const float*>(data);
+  switch (item.getGLType())
+  {
+    case UNIFORM_FLOAT:
+      pushUniform(RenderCommand::UNIFORM_1F, location, values);
+      break;
+
+    case UNIFORM_FLOAT_VEC2:
+      pushUniform(RenderCommand::UNIFORM_2F, location, values);
+      break;
+
+    case UNIFORM_FLOAT_VEC3:
+      pushUniform(RenderCommand::UNIFORM_3F, location, values);
+      break;
+
+    case UNIFORM_FLOAT_VEC4:
+      pushUniform(RenderCommand::UNIFORM_4F, location, values);
+      break;
+
+    case UNIFORM_FLOAT_MAT4:
+      pushUniform(RenderCommand::UNIFORM_MATRIX4, location, values);
+      break;
+
+    case UNIFORM_SAMPLER_1D:
+    case UNIFORM_SAMPLER_2D:
+    case UNIFORM_SAMPLER_3D:
+      // Same as ShaderUniformMan::applyUniformGLState: always unit 0.
+      pushUniform(RenderCommand::UNIFORM_1I, location, nullptr);
+      break;
+
+    default:
+      throw UnsupportedException("Uniform not supported.");
+  }
+}
+
+//------------------------------------------------------------------------------
+void CommandList::setUniformMatrix4(GLint location, const float* data)
+{
+  if (isUniformCurrent(location, data))
+    return;
+  pushUniform(RenderCommand::UNIFORM_MATRIX4, location, data);
+}
+
+//------------------------------------------------------------------------------
+void CommandList::draw(GLenum primitive, GLsizei count, GLenum indexType)
+{
+  RenderCommand command;
+  command.op = RenderCommand::DRAW;
+  command.draw.primitive = primitive;
+  command.draw.count = count;
+  command.draw.indexType = indexType;
+  mCommands.push_back(command);
+  ++mNumDraws;
+}
+
+//------------------------------------------------------------------------------
+void CommandList::drawRanges(GLenum primitive, GLenum indexType,
+                             const DrawRanges* ranges)
+{
+  RenderCommand command;
+  command.op = RenderCommand::DRAW_RANGES;
+  command.rangeDraw.primitive = primitive;
+  command.rangeDraw.indexType = indexType;
+  command.rangeDraw.ranges = ranges;
+  mCommands.push_back(command);
+  ++mNumDraws;
+}
+
+//------------------------------------------------------------------------------
+void recordCommandLists(const std::vector<DrawItem>& draws,
+                        std::vector<CommandList>& lists)
+{
+  size_t numLists = (draws.size() + CommandList::DrawsPerList - 1)
+      / CommandList::DrawsPerList;
+  lists.resize(numLists);
+
+  parallelFor(numLists, [&draws, &lists](size_t i)
+  {
+    CommandList& list = lists[i];
+    list.clear();
+
+    size_t begin = i * CommandList::DrawsPerList;
+    size_t end = std::min(begin + CommandList::DrawsPerList, draws.size());
+    for (size_t d = begin; d < end; ++d)
+      draws[d].pass->recordPass(list, draws[d].transforms, draws[d].ranges,
+                                draws[d].lod);
+  });
+}
+
+//------------------------------------------------------------------------------
+// GLCommandBackend
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+GLCommandBackend::GLCommandBackend() :
+    mProgram(0),
+    mVBO(0),
+    mIBO(0)
+{
+}
+
+//------------------------------------------------------------------------------
+void GLCommandBackend::bindProgram(GLuint program)
+{
+  if (program == mProgram)
+    return;
+  GL(glUseProgram(program));
+  mProgram = program;
+}
+
+//------------------------------------------------------------------------------
+void GLCommandBackend::bindBuffers(const RenderCommand::Buffers& buffers)
+{
+  if (buffers.vbo != mVBO)
+  {
+    GL(glBindBuffer(GL_ARRAY_BUFFER, buffers.vbo));
+    mVBO = buffers.vbo;
+  }
+  if (buffers.ibo != mIBO)
+  {
+    GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.ibo));
+    mIBO = buffers.ibo;
+  }
+
+  // Disable the arrays the new layout does not use, so that no enabled
+  // array points into a buffer the shader does not expect.
+  const VertexAttribBinding* begin = buffers.attribs;
+  const VertexAttribBinding* end = buffers.attribs + buffers.numAttribs;
+  for (size_t i = 0; i < mEnabledAttribs.size();)
+  {
+    GLuint location = mEnabledAttribs[i];
+    bool used = std::find_if(begin, end, [location](const VertexAttribBinding& b)
+                             {return b.location == location;}) != end;
+    if (used)
+    {
+      ++i;
+      continue;
+    }
+    GL(glDisableVertexAttribArray(location));
+    mEnabledAttribs[i] = mEnabledAttribs.back();
+    mEnabledAttribs.pop_back();
+  }
+
+  for (const VertexAttribBinding* it = begin; it != end; ++it)
+  {
+    if (std::find(mEnabledAttribs.begin(), mEnabledAttribs.end(), it->location)
+        == mEnabledAttribs.end())
+    {
+      GL(glEnableVertexAttribArray(it->location));
+      mEnabledAttribs.push_back(it->location);
+    }
+    GL(glVertexAttribPointer(it->location, it->numComponents, it->type,
+                             it->normalize, it->stride,
+                             reinterpret_cast<const void*>(it->offset)));
+  }
+}
+
+//------------------------------------------------------------------------------
+void GLCommandBackend::uniform(RenderCommand::Op op,
+                               const RenderCommand::Uniform& uniform)
+{
+  const float* v = uniform.data;
+  switch (op)
+  {
+    case RenderCommand::UNIFORM_1F:
+      GL(glUniform1f(uniform.location, v[0]));
+      break;
+
+    case RenderCommand::UNIFORM_2F:
+      GL(glUniform2f(uniform.location, v[0], v[1]));
+      break;
+
+    case RenderCommand::UNIFORM_3F:
+      GL(glUniform3f(uniform.location, v[0], v[1], v[2]));
+      break;
+
+    case RenderCommand::UNIFORM_4F:
+      GL(glUniform4f(uniform.location, v[0], v[1], v[2], v[3]));
+      break;
+
+    case RenderCommand::UNIFORM_MATRIX4:
+      GL(glUniformMatrix4fv(uniform.location, 1, GL_FALSE, v));
+      break;
+
+    case RenderCommand::UNIFORM_1I:
+      GL(glUniform1i(uniform.location, uniform.intValue));
+      break;
+
+    default:
+      throw UnsupportedException("Unknown render command.");
+  }
+}
+
+//------------------------------------------------------------------------------
+void GLCommandBackend::draw(const RenderCommand::Draw& draw)
+{
+  GL(glDrawElements(draw.primitive, draw.count, draw.indexType, 0));
+}
+
+//------------------------------------------------------------------------------
+void GLCommandBackend::drawRanges(const RenderCommand::RangeDraw& draw)
+{
+  const DrawRanges& ranges = *draw.ranges;
+#ifdef SPIRE_MULTI_DRAW
+  GL(glMultiDrawElements(draw.primitive, ranges.counts, draw.indexType,
+                         ranges.offsets, ranges.numRanges));
+#else
+  for (GLsizei i = 0; i < ranges.numRanges; ++i)
+    GL(glDrawElements(draw.primitive, ranges.counts[i], draw.indexType,
+                      ranges.offsets[i]));
+#endif
+}
+
+//------------------------------------------------------------------------------
+void GLCommandBackend::finish()
+{
+  for (auto it = mEnabledAttribs.begin(); it != mEnabledAttribs.end(); ++it)
+    GL(glDisableVertexAttribArray(*it));
+  mEnabledAttribs.clear();
+}
+
+} // namespace CPM_SPIRE_NS
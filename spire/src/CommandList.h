@@ -0,0 +1,273 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef SPIRE_HIGH_COMMANDLIST_H
+#define SPIRE_HIGH_COMMANDLIST_H
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "Common.h"
+
+namespace CPM_SPIRE_NS {
+
+class AbstractUniformStateItem;
+struct DrawItem;
+
+/// Pointer setup of one vertex attribute of a pass, resolved once when the
+/// pass is created.
+struct VertexAttribBinding
+{
+  GLuint      location;
+  GLint       numComponents;
+  GLenum      type;
+  GLboolean   normalize;
+  GLsizei     stride;
+  size_t      offset;
+};
+
+/// Index ranges of one draw, in the form glMultiDrawElements takes them:
+/// element counts and byte offsets into the bound IBO.
+struct DrawRanges
+{
+  const GLsizei*      counts;
+  const void* const*  offsets;
+  GLsizei             numRanges;
+};
+
+/// One recorded command. Plain data: recording does not call OpenGL, only
+/// replay does. Pointers refer to the scene version the draw list was built
+/// from and are valid for the frame only.
+struct RenderCommand
+{
+  enum Op : uint8_t
+  {
+    BIND_PROGRAM,
+    BIND_BUFFERS,
+    UNIFORM_1F,
+    UNIFORM_2F,
+    UNIFORM_3F,
+    UNIFORM_4F,
+    UNIFORM_MATRIX4,
+    UNIFORM_1I,
+    DRAW,
+    DRAW_RANGES
+  };
+
+  struct Buffers
+  {
+    GLuint                      vbo;
+    GLuint                      ibo;
+    const VertexAttribBinding*  attribs;
+    uint32_t                    numAttribs;
+  };
+
+  struct Uniform
+  {
+    GLint         location;
+    GLint         intValue;   ///< UNIFORM_1I only.
+    const float*  data;       ///< Float uniforms only.
+  };
+
+  struct Draw
+  {
+    GLenum        primitive;
+    GLsizei       count;
+    GLenum        indexType;
+  };
+
+  struct RangeDraw
+  {
+    GLenum              primitive;
+    GLenum              indexType;
+    const DrawRanges*   ranges;
+  };
+
+  Op op;
+  union
+  {
+    GLuint        program;
+    Buffers       buffers;
+    Uniform       uniform;
+    Draw          draw;
+    RangeDraw     rangeDraw;
+  };
+};
+
+/// Draw commands of a slice of the draw list. State that is already set by
+/// an earlier command of the same list (program, buffers and attribute
+/// layout, uniform values) is not recorded again.
+class CommandList
+{
+public:
+  /// Draws recorded into one list by recordCommandLists.
+  static const size_t DrawsPerList = 1024;
+
+  CommandList();
+
+  void clear();
+
+  void bindProgram(GLuint program);
+  void bindBuffers(GLuint vbo, GLuint ibo,
+                   const std::vector<VertexAttribBinding>& attribs);
+
+  /// Records the value of 'item' for the uniform at 'location'.
+  /// throws UnsupportedException if the uniform type cannot be applied.
+  void setUniform(GLint location, const AbstractUniformStateItem& item);
+  void setUniformMatrix4(GLint location, const float* data);
+
+  void draw(GLenum primitive, GLsizei count, GLenum indexType);
+
+  /// Draws the index ranges 'ranges', which must stay valid until replay.
+  void drawRanges(GLenum primitive, GLenum indexType, const DrawRanges* ranges);
+
+  const std::vector<RenderCommand>& getCommands() const {return mCommands;}
+  size_t getNumDraws() const                            {return mNumDraws;}
+
+private:
+  /// Returns true if 'data' was already recorded for 'location' since the
+  /// program was bound, remembers it otherwise.
+  bool isUniformCurrent(GLint location, const void* data);
+
+  void pushUniform(RenderCommand::Op op, GLint location, const float* data);
+
+  std::vector<RenderCommand>                    mCommands;
+  size_t                                        mNumDraws;
+
+  GLuint                                        mProgram;
+  GLuint                                        mVBO;
+  GLuint                                        mIBO;
+  const VertexAttribBinding*                    mAttribs;
+  size_t                                        mNumAttribs;
+  std::vector<std::pair<GLint, const void*>>    mUniforms;
+};
+
+/// Records 'draws' into 'lists', DrawsPerList draws per list, in parallel
+/// on the shared thread pool. Resizes 'lists'; the lists are reused between
+/// frames to keep their storage. The result does not depend on the number
+/// of threads.
+void recordCommandLists(const std::vector<DrawItem>& draws,
+                        std::vector<CommandList>& lists);
+
+/// Replays 'list' into 'backend'. The backend provides bindProgram,
+/// bindBuffers, uniform, draw and drawRanges; see GLCommandBackend.
+template <typename Backend>
+void replayCommandList(const CommandList& list, Backend& backend)
+{
+  const std::vector<RenderCommand>& commands = list.getCommands();
+  for (auto it = commands.begin(); it != commands.end(); ++it)
+  {
+    switch (it->op)
+    {
+      case RenderCommand::BIND_PROGRAM:
+        backend.bindProgram(it->program);
+        break;
+
+      case RenderCommand::BIND_BUFFERS:
+        backend.bindBuffers(it->buffers);
+        break;
+
+      case RenderCommand::DRAW:
+        backend.draw(it->draw);
+        break;
+
+      case RenderCommand::DRAW_RANGES:
+        backend.drawRanges(it->rangeDraw);
+        break;
+
+      default:
+        backend.uniform(it->op, it->uniform);
+        break;
+    }
+  }
+}
+
+/// Executes commands with OpenGL. Bindings are tracked across lists, so
+/// the first commands of a list cost nothing if the previous list left the
+/// same state behind. Must be used on the thread owning the context.
+class GLCommandBackend
+{
+public:
+  GLCommandBackend();
+
+  void bindProgram(GLuint program);
+  void bindBuffers(const RenderCommand::Buffers& buffers);
+  void uniform(RenderCommand::Op op, const RenderCommand::Uniform& uniform);
+  void draw(const RenderCommand::Draw& draw);
+
+  /// One glMultiDrawElements call, or a draw per range where it is missing
+  /// (OpenGL ES 2).
+  void drawRanges(const RenderCommand::RangeDraw& draw);
+
+  /// Disables the vertex attribute arrays enabled during replay.
+  void finish();
+
+private:
+  GLuint                  mProgram;
+  GLuint                  mVBO;
+  GLuint                  mIBO;
+  std::vector<GLuint>     mEnabledAttribs;
+};
+
+/// Counts commands instead of executing them. Used to measure replay
+/// without a GL context.
+class NullCommandBackend
+{
+public:
+  NullCommandBackend() :
+      numPrograms(0), numBufferBinds(0), numUniforms(0), numDraws(0),
+      numIndices(0)
+  {}
+
+  void bindProgram(GLuint)                                {++numPrograms;}
+  void bindBuffers(const RenderCommand::Buffers&)         {++numBufferBinds;}
+  void uniform(RenderCommand::Op, const RenderCommand::Uniform&) {++numUniforms;}
+  void draw(const RenderCommand::Draw& draw)
+  {
+    ++numDraws;
+    numIndices += static_cast<size_t>(draw.count);
+  }
+  void drawRanges(const RenderCommand::RangeDraw& draw)
+  {
+    ++numDraws;
+    for (GLsizei i = 0; i < draw.ranges->numRanges; ++i)
+      numIndices += static_cast<size_t>(draw.ranges->counts[i]);
+  }
+
+  size_t numPrograms;
+  size_t numBufferBinds;
+  size_t numUniforms;
+  size_t numDraws;
+  size_t numIndices;
+};
+
+} // namespace CPM_SPIRE_NS
+
+#endif
@@ -0,0 +1,468 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "FrameManager.h"
+
+namespace CPM_SPIRE_NS {
+
+namespace {
+
+/// Scales of the draws and indices in the cost model, for its conditioning.
+const double DrawScale = 1.0e-3;
+const double IndexScale = 1.0e-6;
+
+/// Solves the 'n' by 'n' system 'a' x = 'b' in place by Gaussian elimination
+/// with partial pivoting. False if it is singular.
+bool solve(double a[3][3], double b[3], size_t n)
+{
+  for (size_t col = 0; col < n; ++col)
+  {
+    size_t pivot = col;
+    for (size_t row = col + 1; row < n; ++row)
+      if (std::abs(a[row][col]) > std::abs(a[pivot][col]))
+        pivot = row;
+    if (!(std::abs(a[pivot][col]) > 1.0e-12))
+      return false;
+    std::swap(a[col], a[pivot]);
+    std::swap(b[col], b[pivot]);
+    for (size_t row = col + 1; row < n; ++row)
+    {
+      double factor = a[row][col] / a[col][col];
+      for (size_t k = col; k < n; ++k)
+        a[row][k] -= factor * a[col][k];
+      b[row] -= factor * b[col];
+    }
+  }
+  for (size_t col = n; col-- > 0;)
+  {
+    for (size_t k = col + 1; k < n; ++k)
+      b[col] -= a[col][k] * b[k];
+    b[col] /= a[col][col];
+  }
+  return true;
+}
+
+} // namespace
+
+const double FrameManager::Headroom = 0.15;
+const float FrameManager::MinPixelError = 1.0f;
+const double FrameManager::ModelDecay = 0.9;
+
+//------------------------------------------------------------------------------
+FrameManager::FrameManager() :
+    mTargetMs(0.0),
+    mMaxPixelError(16.0f),
+    mPixelError(0.0f),
+    mCullPixels(0.0f),
+    mNumSkipped(0),
+    mEpoch(0),
+    mFramesUnder(0),
+    mNumSamples(0),
+    mCPUTiming(false),
+    mCPUMs(0.0),
+    mGPUQuery(0),
+    mGPUTiming(false)
+{
+  clear();
+}
+
+//------------------------------------------------------------------------------
+FrameManager::~FrameManager()
+{
+  // Query objects are left to the context: it may not be current here, and
+  // clear() is called on the render thread when it goes away.
+}
+
+//------------------------------------------------------------------------------
+void FrameManager::setTargetFrameTime(double milliseconds, float maxPixelError)
+{
+  mTargetMs = milliseconds > 0.0 ? milliseconds : 0.0;
+  mMaxPixelError = std::max(maxPixelError, MinPixelError);
+  if (!isEnabled())
+  {
+    mPixelError = 0.0f;
+    mCullPixels = 0.0f;
+    mNumSkipped = 0;
+    mSkipped.clear();
+  }
+  mPixelError = std::min(mPixelError, mMaxPixelError);
+  mCullPixels = std::min(mCullPixels, mMaxPixelError);
+  mFramesUnder = 0;
+  ++mEpoch;
+}
+
+//------------------------------------------------------------------------------
+void FrameManager::setOptionalPasses(const std::vector<std::string>& passes)
+{
+  mOptionalPasses = passes;
+  mNumSkipped = std::min(mNumSkipped, passes.size());
+  mSkipped.resize(mNumSkipped);
+  ++mEpoch;
+}
+
+//------------------------------------------------------------------------------
+void FrameManager::selectPasses(const std::vector<std::string>& passes,
+                                std::vector<std::string>& selected) const
+{
+  selected.clear();
+  auto skippedBegin = mOptionalPasses.end() - static_cast<ptrdiff_t>(mNumSkipped);
+  for (auto it = passes.begin(); it != passes.end(); ++it)
+  {
+    if (std::find(skippedBegin, mOptionalPasses.end(), *it) == mOptionalPasses.end())
+      selected.push_back(*it);
+  }
+}
+
+//------------------------------------------------------------------------------
+void FrameManager::startCPUTimer()
+{
+  mCPUTiming = true;
+  mCPUStart = Clock::now();
+}
+
+//------------------------------------------------------------------------------
+void FrameManager::stopCPUTimer()
+{
+  if (!mCPUTiming)
+    return;
+  mCPUTiming = false;
+  mCPUMs += std::chrono::duration<double, std::milli>(Clock::now() - mCPUStart).count();
+}
+
+//------------------------------------------------------------------------------
+void FrameManager::startGPUTimer()
+{
+#ifdef SPIRE_TIMER_QUERIES
+  if (mGPUQuery != 0)
+    return;
+  if (mFreeQueries.empty())
+  {
+    GLuint query = 0;
+    GL(glGenQueries(1, &query));
+    mFreeQueries.push_back(query);
+  }
+  mGPUQuery = mFreeQueries.back();
+  mFreeQueries.pop_back();
+  GL(glBeginQuery(GL_TIME_ELAPSED, mGPUQuery));
+  mGPUTiming = true;
+#endif
+}
+
+//------------------------------------------------------------------------------
+void FrameManager::stopGPUTimer()
+{
+#ifdef SPIRE_TIMER_QUERIES
+  if (!mGPUTiming)
+    return;
+  GL(glEndQuery(GL_TIME_ELAPSED));
+  mGPUTiming = false;
+#endif
+}
+
+//------------------------------------------------------------------------------
+void FrameManager::endFrame(size_t numDraws, size_t numIndices)
+{
+  stopCPUTimer();
+  stopGPUTimer();
+
+  PendingFrame frame;
+  frame.query = mGPUQuery;
+  frame.epoch = mEpoch;
+  frame.sample.numDraws = numDraws;
+  frame.sample.numIndices = numIndices;
+  frame.sample.cpuMs = mCPUMs;
+  mPending.push_back(frame);
+
+  mGPUQuery = 0;
+  mCPUMs = 0.0;
+}
+
+//------------------------------------------------------------------------------
+void FrameManager::endFrame(const FrameSample& sample)
+{
+  PendingFrame frame;
+  frame.query = 0;
+  frame.epoch = mEpoch;
+  frame.sample = sample;
+  mPending.push_back(frame);
+}
+
+//------------------------------------------------------------------------------
+void FrameManager::update()
+{
+  while (!mPending.empty())
+  {
+    PendingFrame& frame = mPending.front();
+#ifdef SPIRE_TIMER_QUERIES
+    if (frame.query != 0)
+    {
+      GLuint available = 0;
+      GL(glGetQueryObjectuiv(frame.query, GL_QUERY_RESULT_AVAILABLE, &available));
+      if (!available)
+        break;
+      GLuint64 nanoseconds = 0;
+      GL(glGetQueryObjectui64v(frame.query, GL_QUERY_RESULT, &nanoseconds));
+      frame.sample.gpuMs = static_cast<double>(nanoseconds) * 1.0e-6;
+      mFreeQueries.push_back(frame.query);
+    }
+#endif
+    FrameSample sample = frame.sample;
+    bool current = (frame.epoch == mEpoch);
+    mPending.pop_front();
+
+    addSample(sample);
+    if (current && isEnabled())
+      control(sample);
+  }
+}
+
+//------------------------------------------------------------------------------
+void FrameManager::addSample(const FrameSample& sample)
+{
+  double x[3] = {1.0, static_cast<double>(sample.numDraws) * DrawScale,
+                 static_cast<double>(sample.numIndices) * IndexScale};
+  double time = sample.getFrameTime();
+  for (size_t i = 0; i < 3; ++i)
+  {
+    for (size_t j = 0; j < 3; ++j)
+      mNormal[i][j] = mNormal[i][j] * ModelDecay + x[i] * x[j];
+    mRight[i] = mRight[i] * ModelDecay + x[i] * time;
+  }
+  mLastSample = sample;
+  ++mNumSamples;
+  fitModel();
+}
+
+//------------------------------------------------------------------------------
+void FrameManager::fitModel()
+{
+  // A slight pull of the fixed and per draw costs towards 0 settles the
+  // model when draws and indices vary together (or not at all): the time
+  // is then put on the indices, which is what LOD can change. Coefficients
+  // that come out negative are dropped and the rest refitted.
+  double ridge = 1.0e-4 * (mNormal[0][0] + mNormal[1][1] + mNormal[2][2]);
+  bool active[3] = {true, true, true};
+  for (size_t attempt = 0; attempt < 3; ++attempt)
+  {
+    size_t map[3];
+    size_t n = 0;
+    for (size_t i = 0; i < 3; ++i)
+      if (active[i])
+        map[n++] = i;
+
+    double a[3][3];
+    double b[3];
+    for (size_t i = 0; i < n; ++i)
+    {
+      for (size_t j = 0; j < n; ++j)
+        a[i][j] = mNormal[map[i]][map[j]];
+      if (map[i] != 2)
+        a[i][i] += ridge;
+      b[i] = mRight[map[i]];
+    }
+
+    for (size_t i = 0; i < 3; ++i)
+      mCoefficients[i] = 0.0;
+    if (n == 0 || !solve(a, b, n))
+      return;
+
+    size_t worst = 3;
+    for (size_t i = 0; i < n; ++i)
+    {
+      mCoefficients[map[i]] = b[i];
+      if (b[i] < 0.0 && (worst == 3 || b[i] < mCoefficients[worst]))
+        worst = map[i];
+    }
+    if (worst == 3)
+      return;
+    active[worst] = false;
+  }
+}
+
+//------------------------------------------------------------------------------
+double FrameManager::predictFrameTime(size_t numDraws, size_t numIndices) const
+{
+  return   mCoefficients[0]
+         + predictObjectTime(numDraws, numIndices);
+}
+
+//------------------------------------------------------------------------------
+double FrameManager::predictObjectTime(size_t numDraws, size_t numIndices) const
+{
+  return   mCoefficients[1] * static_cast<double>(numDraws) * DrawScale
+         + mCoefficients[2] * static_cast<double>(numIndices) * IndexScale;
+}
+
+//------------------------------------------------------------------------------
+double FrameManager::getIndexBudget(double milliseconds, size_t numDraws) const
+{
+  double rest = milliseconds - mCoefficients[0]
+                - mCoefficients[1] * static_cast<double>(numDraws) * DrawScale;
+  if (rest <= 0.0)
+    return 0.0;
+  if (mCoefficients[2] <= 0.0)
+    return std::numeric_limits<double>::infinity();
+  return rest / (mCoefficients[2] * IndexScale);
+}
+
+//------------------------------------------------------------------------------
+void FrameManager::control(const FrameSample& sample)
+{
+  // The first frame without a pass tells what the pass cost.
+  if (!mSkipped.empty() && !mSkipped.back().measured)
+  {
+    SkippedPass& skipped = mSkipped.back();
+    skipped.numDraws = skipped.before.numDraws > sample.numDraws ?
+        skipped.before.numDraws - sample.numDraws : 0;
+    skipped.numIndices = skipped.before.numIndices > sample.numIndices ?
+        skipped.before.numIndices - sample.numIndices : 0;
+    skipped.measured = true;
+  }
+
+  double time = sample.getFrameTime();
+  double goal = mTargetMs * (1.0 - 0.5 * Headroom);
+  double indices = static_cast<double>(sample.numIndices);
+  if (time > mTargetMs)
+  {
+    // Over: coarsen now, by as much as the model says it takes. Levels of
+    // detail go first, then small objects.
+    mFramesUnder = 0;
+    double budget = getIndexBudget(goal, sample.numDraws);
+    double step = 4.0;
+    if (budget > 0.0 && indices > 0.0)
+      step = std::min(std::max(std::sqrt(indices / budget), 1.25), 4.0);
+    if (mPixelError < mMaxPixelError)
+    {
+      float coarser = std::max(mPixelError, MinPixelError) * static_cast<float>(step);
+      mPixelError = std::min(coarser, mMaxPixelError);
+    }
+    else if (mCullPixels < mMaxPixelError)
+    {
+      float coarser = std::max(mCullPixels, MinPixelError) * static_cast<float>(step);
+      mCullPixels = std::min(coarser, mMaxPixelError);
+    }
+    else if (mNumSkipped < mOptionalPasses.size())
+    {
+      SkippedPass skipped;
+      skipped.before = sample;
+      skipped.numDraws = 0;
+      skipped.numIndices = 0;
+      skipped.measured = false;
+      mSkipped.push_back(skipped);
+      ++mNumSkipped;
+    }
+    else
+    {
+      return;
+    }
+    ++mEpoch;
+  }
+  else if (time < mTargetMs * (1.0 - Headroom))
+  {
+    // Under for a while: add back what the model predicts fits, the last
+    // thing taken away first.
+    if (++mFramesUnder < RefineDelay)
+      return;
+    mFramesUnder = 0;
+    if (mNumSkipped > 0)
+    {
+      const SkippedPass& skipped = mSkipped.back();
+      if (predictFrameTime(sample.numDraws + skipped.numDraws,
+                           sample.numIndices + skipped.numIndices) > goal)
+        return;
+      mSkipped.pop_back();
+      --mNumSkipped;
+    }
+    else if (mCullPixels > 0.0f || mPixelError > 0.0f)
+    {
+      double budget = getIndexBudget(goal, sample.numDraws);
+      double step = 2.0;
+      if (indices > 0.0)
+        step = std::min(std::sqrt(budget / indices), 2.0);
+      if (!(step > 1.05))
+        return;
+      float& tolerance = mCullPixels > 0.0f ? mCullPixels : mPixelError;
+      tolerance /= static_cast<float>(step);
+      if (tolerance < MinPixelError)
+        tolerance = 0.0f;
+    }
+    else
+    {
+      return;
+    }
+    ++mEpoch;
+  }
+  else
+  {
+    mFramesUnder = 0;
+  }
+}
+
+//------------------------------------------------------------------------------
+void FrameManager::clear()
+{
+#ifdef SPIRE_TIMER_QUERIES
+  stopGPUTimer();
+  for (auto it = mPending.begin(); it != mPending.end(); ++it)
+    if (it->query != 0)
+      mFreeQueries.push_back(it->query);
+  if (mGPUQuery != 0)
+    mFreeQueries.push_back(mGPUQuery);
+  if (!mFreeQueries.empty())
+    GL(glDeleteQueries(static_cast<GLsizei>(mFreeQueries.size()), &mFreeQueries[0]));
+#endif
+  mFreeQueries.clear();
+  mPending.clear();
+  mGPUQuery = 0;
+  mGPUTiming = false;
+  mCPUTiming = false;
+  mCPUMs = 0.0;
+
+  mPixelError = 0.0f;
+  mCullPixels = 0.0f;
+  mNumSkipped = 0;
+  mSkipped.clear();
+  mFramesUnder = 0;
+  ++mEpoch;
+
+  for (size_t i = 0; i < 3; ++i)
+  {
+    for (size_t j = 0; j < 3; ++j)
+      mNormal[i][j] = 0.0;
+    mRight[i] = 0.0;
+    mCoefficients[i] = 0.0;
+  }
+  mNumSamples = 0;
+  mLastSample = FrameSample();
+}
+
+} // namespace CPM_SPIRE_NS
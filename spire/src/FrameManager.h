@@ -29,18 +29,205 @@
 #ifndef SPIRE_HIGH_FRAMEMANAGER_H
 #define SPIRE_HIGH_FRAMEMANAGER_H
 
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "Common.h"
+
+// OpenGL ES 2.0 has no timer queries.
+#if !defined(SPIRE_OPENGL_ES_2) && defined(GL_TIME_ELAPSED)
+  #define SPIRE_TIMER_QUERIES
+#endif
+
 namespace CPM_SPIRE_NS {
 
 /// Manages the current frame.
 /// Attempts to intelligently tune scenes so that they run in real-time treating
 /// LOD and composition rate as the independent variables to tune.
+///
+/// Every frame, the CPU time spent preparing and recording it and the GPU
+/// time of its draws (GL_TIME_ELAPSED queries, read once available, a frame
+/// or two late) are measured. The slower of the two is the frame time. A
+/// cost model is fitted to the recent frames by weighted least squares:
+///   time = fixed + perDraw * draws + perIndex * indices.
+/// From its predictions the manager picks the detail of the next frame:
+///  - LOD: a screen space error tolerance in pixels. It picks the levels of
+///    detail of the passes that have them (see FramePrep::setLODPixelError).
+///    Indices drawn are assumed to fall with the square of the tolerance.
+///  - Culling: once the tolerance is at its maximum, objects whose projected
+///    size is below a second size in pixels, raised up to the same maximum,
+///    are dropped (see FramePrep::setSmallFeatureCulling).
+///  - Composition: once both are at their maximum, the optional passes are
+///    skipped, least important first.
+///
+/// Detail comes back in the reverse order: passes, then small objects, then
+/// finer levels of detail.
+///
+/// Hysteresis keeps the detail from popping back and forth: a frame over
+/// the target coarsens right away, but detail only comes back after
+/// RefineDelay frames below (1 - Headroom) times the target, by bounded
+/// steps, and only as far as the model predicts still fits. Frames drawn
+/// before the last change are not used to decide the next one.
 class FrameManager
 {
 public:
+  /// Measurements of one frame.
+  struct FrameSample
+  {
+    FrameSample() : numDraws(0), numIndices(0), cpuMs(0.0), gpuMs(-1.0) {}
+
+    size_t  numDraws;
+    size_t  numIndices;
+    double  cpuMs;
+    double  gpuMs;      ///< Negative when unknown.
+
+    double getFrameTime() const {return gpuMs > cpuMs ? gpuMs : cpuMs;}
+  };
+
+  /// Frames under budget before detail is added back.
+  static const size_t RefineDelay = 8;
+
+  /// Fraction of the target kept free before adding detail back.
+  static const double Headroom;
+
+  /// Tolerances below this many pixels are full detail.
+  static const float MinPixelError;
+
+  /// Weight of a frame in the cost model relative to the one after it.
+  static const double ModelDecay;
+
   FrameManager();
   virtual ~FrameManager();
 
+  /// Sets the frame time to hold, in milliseconds, and the coarsest LOD
+  /// tolerance and culled size to go to before skipping passes. 0 disables the manager
+  /// (the default): full detail and every pass.
+  void setTargetFrameTime(double milliseconds, float maxPixelError = 16.0f);
+  double getTargetFrameTime() const     {return mTargetMs;}
+  bool isEnabled() const                {return mTargetMs > 0.0;}
+
+  /// Passes that may be skipped, most important first.
+  void setOptionalPasses(const std::vector<std::string>& passes);
+
+  /// Copies the passes of 'passes' that are not skipped into 'selected'.
+  void selectPasses(const std::vector<std::string>& passes,
+                    std::vector<std::string>& selected) const;
+
+  /// LOD tolerance for the next frame, in pixels (0 is full detail).
+  float getPixelError() const           {return mPixelError;}
+
+  /// Size below which objects are culled in the next frame, in pixels (0
+  /// culls nothing). Only raised once the LOD tolerance is at its maximum.
+  float getCullPixels() const           {return mCullPixels;}
+
+  /// Number of optional passes skipped, from the end of the list.
+  size_t getNumSkippedPasses() const    {return mNumSkipped;}
+
+  /// Accumulate the CPU time spent on the current frame.
+  void startCPUTimer();
+  void stopCPUTimer();
+
+  /// Measure the GPU time of the draws of the current frame. Render thread
+  /// only; does nothing without timer queries.
+  void startGPUTimer();
+  void stopGPUTimer();
+
+  /// Closes the current frame, which drew 'numDraws' draws of 'numIndices'
+  /// indices in total. Its sample is complete once its GPU time is in.
+  void endFrame(size_t numDraws, size_t numIndices);
+
+  /// Closes the current frame with times the host measured itself, in
+  /// place of the timers.
+  void endFrame(const FrameSample& sample);
+
+  /// Reads the GPU times that are available without waiting and picks the
+  /// detail of the next frame. Call before preparing it.
+  void update();
+
+  /// Adds a complete sample to the cost model only, without controlling
+  /// the detail. update() adds those of the frames that ended.
+  void addSample(const FrameSample& sample);
+
+  /// Last complete sample.
+  const FrameSample& getLastSample() const  {return mLastSample;}
+
+  /// Time the cost model predicts for a frame, in milliseconds.
+  double predictFrameTime(size_t numDraws, size_t numIndices) const;
+
+  /// Time the cost model predicts an object adds to a frame: the cost of
+  /// its draws and of their indices (three per triangle).
+  double predictObjectTime(size_t numDraws, size_t numIndices) const;
+
+  /// Indices the cost model predicts fit in 'milliseconds' along with
+  /// 'numDraws' draws. Infinite if indices cost nothing, 0 if nothing fits.
+  double getIndexBudget(double milliseconds, size_t numDraws) const;
+
+  /// Deletes the timer queries and forgets the measurements. Render thread
+  /// only.
+  void clear();
+
 private:
+  FrameManager(const FrameManager&);
+  FrameManager& operator=(const FrameManager&);
+
+  /// Picks the detail of the next frame from 'sample'.
+  void control(const FrameSample& sample);
+
+  /// Refits the model coefficients to the accumulated normal equations.
+  void fitModel();
+
+  /// A skipped pass and what it cost, measured by the first frame without.
+  struct SkippedPass
+  {
+    FrameSample   before;
+    size_t        numDraws;
+    size_t        numIndices;
+    bool          measured;
+  };
+
+  struct PendingFrame
+  {
+    GLuint        query;
+    uint32_t      epoch;
+    FrameSample   sample;
+  };
+
+  typedef std::chrono::steady_clock Clock;
+
+  double                    mTargetMs;
+  float                     mMaxPixelError;
+  std::vector<std::string>  mOptionalPasses;
+
+  /// Current decision, and a count of its changes: samples of frames drawn
+  /// with an older one are not used to control.
+  float                     mPixelError;
+  float                     mCullPixels;
+  size_t                    mNumSkipped;
+  uint32_t                  mEpoch;
+  size_t                    mFramesUnder;
+  std::vector<SkippedPass>  mSkipped;
+
+  /// Weighted normal equations of the cost model over (1, draws / 1000,
+  /// indices / 1e6), and its coefficients in milliseconds.
+  double                    mNormal[3][3];
+  double                    mRight[3];
+  double                    mCoefficients[3];
+  size_t                    mNumSamples;
+  FrameSample               mLastSample;
+
+  /// Current frame.
+  bool                      mCPUTiming;
+  Clock::time_point         mCPUStart;
+  double                    mCPUMs;
+  GLuint                    mGPUQuery;
+  bool                      mGPUTiming;
+
+  std::deque<PendingFrame>  mPending;
+  std::vector<GLuint>       mFreeQueries;
 };
 
 } // namespace CPM_SPIRE_NS
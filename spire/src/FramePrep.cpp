@@ -0,0 +1,1040 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#include "BoundingVolume.h"
+#include "FramePrep.h"
+#include "IBOObject.h"
+#include "Parallel.h"
+#include "TriangleBVH.h"
+#include "VBOObject.h"
+
+namespace CPM_SPIRE_NS {
+
+namespace {
+
+bool drawItemLess(const DrawItem& a, const DrawItem& b)
+{
+  if (a.sortKey != b.sortKey)
+    return a.sortKey < b.sortKey;
+  return a.sequence < b.sequence;
+}
+
+/// Triangles of the retained mesh of 'pass', 0 if it has none.
+size_t getRetainedTriangles(const ObjectPass& pass)
+{
+  if (pass.getVBO() == nullptr || pass.getIBO() == nullptr)
+    return 0;
+  if (   pass.getVBO()->getRetainedPositions() == nullptr
+      || pass.getIBO()->getRetainedIndices() == nullptr)
+    return 0;
+  return TriangleBVH::getNumTriangles(pass.getIBO()->getRetainedIndices()->size(),
+                                      pass.getPrimitiveType());
+}
+
+} // namespace
+
+const float FramePrep::MinOccluderSize = 0.1f;
+
+//------------------------------------------------------------------------------
+FramePrep::CullParams::CullParams() :
+    worldToProjection(1.0f),
+    minPixels(0.0f),
+    viewportHeight(0.0f),
+    sizeScale(0.0f),
+    ndcScale(0.0f),
+    lodPixels(0.0f),
+    lodViewportHeight(0.0f),
+    lodScale(0.0f)
+{
+}
+
+//------------------------------------------------------------------------------
+FramePrep::FramePrep() :
+    mHaveDrawList(false),
+    mNumObjects(0),
+    mNumVisible(0),
+    mNumCulled(0),
+    mNumIndices(0),
+    mNumCoarseDraws(0),
+    mOcclusionCulling(false),
+    mFrame(0),
+    mNumOccluded(0),
+    mSoftwareOcclusion(false),
+    mNumOccluders(0),
+    mClusterCulling(false),
+    mClusterBackFaces(false),
+    mNumClustersCulled(0)
+{
+}
+
+//------------------------------------------------------------------------------
+void FramePrep::setSmallFeatureCulling(float minPixels, float viewportHeight)
+{
+  mCull.minPixels = minPixels;
+  mCull.viewportHeight = viewportHeight;
+  mHaveDrawList = false;
+}
+
+//------------------------------------------------------------------------------
+void FramePrep::setLODPixelError(float maxPixels, float viewportHeight)
+{
+  mCull.lodPixels = maxPixels;
+  mCull.lodViewportHeight = viewportHeight;
+  mHaveDrawList = false;
+}
+
+//------------------------------------------------------------------------------
+void FramePrep::setOcclusionCulling(bool enabled)
+{
+  if (enabled == mOcclusionCulling)
+    return;
+  mOcclusionCulling = enabled;
+  mHaveDrawList = false;
+  mOcclusionTests.clear();
+  mNumOccluded = 0;
+
+  // Rebuild the shard caches so that they assign (or drop) the states.
+  for (auto it = mShards.begin(); it != mShards.end(); ++it)
+  {
+    it->shard.reset();
+    it->occlusionIds.clear();
+    it->occlusion.clear();
+    it->freeOcclusionIds.clear();
+    it->objectOcclusionIds.clear();
+  }
+}
+
+//------------------------------------------------------------------------------
+void FramePrep::setSoftwareOcclusionCulling(bool enabled)
+{
+  mSoftwareOcclusion = enabled;
+  mHaveDrawList = false;
+  mNumOccluders = 0;
+  mHiZ.clear(mCull.worldToProjection);
+}
+
+//------------------------------------------------------------------------------
+void FramePrep::setClusterCulling(bool enabled, bool backFaces)
+{
+  mClusterCulling = enabled;
+  mClusterBackFaces = backFaces;
+  mHaveDrawList = false;
+  mNumClustersCulled = 0;
+}
+
+//------------------------------------------------------------------------------
+void FramePrep::setOcclusionPending(const OcclusionTest& test)
+{
+  ShardCache& cache = mShards[test.shard];
+  if (test.id < cache.occlusion.size() && cache.occlusion[test.id].serial == test.serial)
+    cache.occlusion[test.id].pending = 1;
+}
+
+//------------------------------------------------------------------------------
+void FramePrep::setOcclusionResult(const OcclusionTest& test, bool visible)
+{
+  ShardCache& cache = mShards[test.shard];
+  if (test.id >= cache.occlusion.size() || cache.occlusion[test.id].serial != test.serial)
+    return;
+
+  OcclusionState& state = cache.occlusion[test.id];
+  state.pending = 0;
+  uint8_t occluded = visible ? 0 : 1;
+  if (state.occluded != occluded)
+  {
+    state.occluded = occluded;
+    mHaveDrawList = false;
+  }
+}
+
+//------------------------------------------------------------------------------
+uint64_t FramePrep::makeSortKey(size_t passIndex, GLuint program, float depth)
+{
+  // Non-negative floats order like their bit patterns. Objects behind the
+  // eye (and NaNs) go first.
+  float clamped = depth > 0.0f ? depth : 0.0f;
+  uint32_t depthBits;
+  std::memcpy(&depthBits, &clamped, sizeof(depthBits));
+
+  return   (static_cast<uint64_t>(passIndex & 0xFF) << 56)
+         | (static_cast<uint64_t>(program & 0xFFFFFF) << 32)
+         | depthBits;
+}
+
+//------------------------------------------------------------------------------
+void FramePrep::extractFrustumPlanes(const M44& m, V4 planes[6])
+{
+  // Gribb / Hartmann. GLM matrices are column major: m[column][row].
+  V4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+  V4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+  V4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+  V4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+  planes[0] = row3 + row0;    // Left
+  planes[1] = row3 - row0;    // Right
+  planes[2] = row3 + row1;    // Bottom
+  planes[3] = row3 - row1;    // Top
+  planes[4] = row3 + row2;    // Near
+  planes[5] = row3 - row2;    // Far
+
+  for (int i = 0; i < 6; ++i)
+  {
+    float length = glm::length(V3(planes[i]));
+    if (length > 0.0f)
+      planes[i] /= length;
+  }
+}
+
+//------------------------------------------------------------------------------
+bool FramePrep::isSphereVisible(const V4 planes[6], const V3& center,
+                                float radius)
+{
+  for (int i = 0; i < 6; ++i)
+  {
+    if (glm::dot(V3(planes[i]), center) + planes[i].w < -radius)
+      return false;
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+bool FramePrep::isBoxVisible(const V4 planes[6], const V3& center,
+                             const V3& extent)
+{
+  for (int i = 0; i < 6; ++i)
+  {
+    float distance = glm::dot(V3(planes[i]), center) + planes[i].w;
+    float reach = glm::dot(glm::abs(V3(planes[i])), extent);
+    if (distance + reach < 0.0f)
+      return false;
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+V4 FramePrep::getObjectSpaceEye(const M44& m)
+{
+  // The eye projects to x = y = w = 0: it spans the null space of rows 0, 1
+  // and 3, found as their cofactors.
+  V4 a(m[0][0], m[1][0], m[2][0], m[3][0]);
+  V4 b(m[0][1], m[1][1], m[2][1], m[3][1]);
+  V4 c(m[0][3], m[1][3], m[2][3], m[3][3]);
+  auto det3 = [](const V3& x, const V3& y, const V3& z)
+  {
+    return glm::dot(x, glm::cross(y, z));
+  };
+  V4 eye( det3(V3(a.y, a.z, a.w), V3(b.y, b.z, b.w), V3(c.y, c.z, c.w)),
+         -det3(V3(a.x, a.z, a.w), V3(b.x, b.z, b.w), V3(c.x, c.z, c.w)),
+          det3(V3(a.x, a.y, a.w), V3(b.x, b.y, b.w), V3(c.x, c.y, c.w)),
+         -det3(V3(a.x, a.y, a.z), V3(b.x, b.y, b.z), V3(c.x, c.y, c.z)));
+
+  if (eye.w != 0.0f)
+    return V4(V3(eye) / eye.w, 1.0f);
+
+  // Orthographic: point the direction away from the near plane.
+  V3 direction(eye);
+  float length = glm::length(direction);
+  if (length > 0.0f)
+    direction /= length;
+  if (glm::dot(V3(m[0][2], m[1][2], m[2][2]), direction) < 0.0f)
+    direction = -direction;
+  return V4(direction, 0.0f);
+}
+
+//------------------------------------------------------------------------------
+bool FramePrep::isClusterBackFacing(const MeshCluster& cluster, const V4& eye)
+{
+  V3 axis(cluster.coneAxis[0], cluster.coneAxis[1], cluster.coneAxis[2]);
+  if (eye.w == 0.0f)
+    return glm::dot(V3(eye), axis) > cluster.coneCutoff;
+
+  V3 toCenter = V3(cluster.center[0], cluster.center[1], cluster.center[2])
+                - V3(eye);
+  return glm::dot(toCenter, axis) >   cluster.coneCutoff * glm::length(toCenter)
+                                    + cluster.radius * (1.0f + cluster.coneCutoff);
+}
+
+//------------------------------------------------------------------------------
+void FramePrep::prepare(std::shared_ptr<const SceneVersion> scene,
+                        const M44& worldToProjection,
+                        const std::vector<std::string>& passes)
+{
+  if (passes.size() > 256)
+    throw std::invalid_argument("At most 256 passes can be prepared at once.");
+
+  ++mFrame;
+  bool sameView = (worldToProjection == mCull.worldToProjection);
+  if (mHaveDrawList && sameView && scene == mScene && passes == mPasses)
+  {
+    mNumCulled = 0;
+    collectOcclusionTests();
+    return;
+  }
+
+  if (!sameView || !mHaveDrawList)
+  {
+    const M44& m = worldToProjection;
+    mCull.worldToProjection = m;
+    extractFrustumPlanes(m, mCull.planes);
+    mCull.clipW = V4(m[0][3], m[1][3], m[2][3], m[3][3]);
+    mCull.ndcScale = glm::length(V3(m[0][1], m[1][1], m[2][1]));
+    mCull.sizeScale = mCull.ndcScale * mCull.viewportHeight;
+    float lodPixelScale = 0.5f * mCull.ndcScale * mCull.lodViewportHeight;
+    mCull.lodScale = lodPixelScale > 0.0f ? mCull.lodPixels / lodPixelScale : 0.0f;
+    for (auto it = mShards.begin(); it != mShards.end(); ++it)
+      it->culled = false;
+  }
+
+  mScene = scene;
+  mPasses = passes;
+  mHaveDrawList = false;
+
+  // Shards and chunks are laid out in scene order.
+  mNumObjects = 0;
+  size_t numChunks = 0;
+  for (size_t i = 0; i < SceneVersion::NumShards; ++i)
+  {
+    size_t size = mScene->shards[i]->size();
+    mShards[i].start = mNumObjects;
+    mNumObjects += size;
+    numChunks += (size + ObjectsPerChunk - 1) / ObjectsPerChunk;
+  }
+
+  parallelFor(SceneVersion::NumShards, [this](size_t shard)
+  {
+    updateShardCache(shard);
+  });
+
+  mChunks.resize(numChunks);
+  size_t chunk = 0;
+  for (size_t i = 0; i < SceneVersion::NumShards; ++i)
+  {
+    size_t size = mShards[i].objects.size();
+    for (size_t begin = 0; begin < size; begin += ObjectsPerChunk)
+    {
+      mChunks[chunk].shard = i;
+      mChunks[chunk].begin = begin;
+      mChunks[chunk].end = std::min(begin + ObjectsPerChunk, size);
+      ++chunk;
+    }
+  }
+
+  // Cull every chunk (unless reusing its results), rasterize the
+  // occluders found, then sort every chunk into its own buffer.
+  parallelFor(numChunks, [this](size_t i)
+  {
+    mChunks[i].culled = !mShards[mChunks[i].shard].culled;
+    if (mChunks[i].culled)
+      cullChunk(mChunks[i]);
+    if (mSoftwareOcclusion)
+      collectOccluderCandidates(mChunks[i]);
+  });
+  if (mSoftwareOcclusion)
+    renderOccluders();
+  parallelFor(numChunks, [&](size_t i)
+  {
+    prepareChunk(i, passes);
+  });
+  for (auto it = mShards.begin(); it != mShards.end(); ++it)
+    it->culled = true;
+
+  // Concatenate the chunks, then merge them.
+  mRunStarts.resize(numChunks + 1);
+  mRunStarts[0] = 0;
+  mNumVisible = 0;
+  mNumCulled = 0;
+  mNumOccluded = 0;
+  mNumClustersCulled = 0;
+  mNumIndices = 0;
+  mNumCoarseDraws = 0;
+  for (size_t i = 0; i < numChunks; ++i)
+  {
+    mRunStarts[i + 1] = mRunStarts[i] + mChunks[i].draws.size();
+    mNumVisible += mChunks[i].numVisible;
+    mNumOccluded += mChunks[i].numOccluded;
+    mNumClustersCulled += mChunks[i].numClustersCulled;
+    mNumIndices += mChunks[i].numIndices;
+    mNumCoarseDraws += mChunks[i].numCoarseDraws;
+    if (mChunks[i].culled)
+      mNumCulled += mChunks[i].end - mChunks[i].begin;
+  }
+
+  mDrawList.resize(mRunStarts[numChunks]);
+  parallelFor(numChunks, [this](size_t i)
+  {
+    std::copy(mChunks[i].draws.begin(), mChunks[i].draws.end(),
+              mDrawList.begin() + static_cast<ptrdiff_t>(mRunStarts[i]));
+  });
+
+  mergeRuns();
+  mHaveDrawList = true;
+  collectOcclusionTests();
+}
+
+//------------------------------------------------------------------------------
+void FramePrep::updateShardCache(size_t shard)
+{
+  ShardCache& cache = mShards[shard];
+  const std::shared_ptr<const SceneVersion::Shard>& source = mScene->shards[shard];
+  if (cache.shard == source)
+    return;
+
+  // Reading the objects is the expensive part of culling: they are spread
+  // over the heap. Copy what culling needs into flat arrays, with the
+  // bounds already in world space.
+  cache.shard = source;
+  cache.culled = false;
+  cache.objects.clear();
+  cache.transforms.clear();
+  cache.centerX.clear();
+  cache.centerY.clear();
+  cache.centerZ.clear();
+  cache.extentX.clear();
+  cache.extentY.clear();
+  cache.extentZ.clear();
+  cache.radius.clear();
+  cache.scale.clear();
+  cache.occluder.clear();
+  const float infinity = std::numeric_limits<float>::infinity();
+  for (auto it = source->begin(); it != source->end(); ++it)
+  {
+    const SpireObject& object = *it->second;
+    const M44& transform = object.getTransform();
+    cache.objects.push_back(&object);
+    cache.transforms.push_back(transform);
+
+    V3 center(transform[3]);
+    V3 extent(infinity, infinity, infinity);
+    float radius = infinity;
+    float scale = std::max(glm::length(V3(transform[0])),
+                           std::max(glm::length(V3(transform[1])),
+                                    glm::length(V3(transform[2]))));
+    if (object.hasBounds())
+    {
+      transformBox(transform, object.getBoundsMin(), object.getBoundsMax(),
+                   center, extent);
+      radius = object.getBoundingSphere().w * scale;
+    }
+    cache.centerX.push_back(center.x);
+    cache.centerY.push_back(center.y);
+    cache.centerZ.push_back(center.z);
+    cache.extentX.push_back(extent.x);
+    cache.extentY.push_back(extent.y);
+    cache.extentZ.push_back(extent.z);
+    cache.radius.push_back(radius);
+    cache.scale.push_back(scale);
+    cache.occluder.push_back(object.isOccluder() ? 1 : 0);
+  }
+  cache.visible.resize(cache.objects.size());
+  cache.depths.resize(cache.objects.size());
+  cache.uniforms.resize(cache.objects.size());
+  if (mOcclusionCulling)
+    updateOcclusionIds(cache);
+}
+
+//------------------------------------------------------------------------------
+void FramePrep::updateOcclusionIds(ShardCache& cache)
+{
+  // Objects are found by name: edits replace them, but should not make
+  // them lose their visibility.
+  uint32_t mark = ++cache.occlusionMark;
+  cache.objectOcclusionIds.clear();
+  for (auto it = cache.shard->begin(); it != cache.shard->end(); ++it)
+  {
+    auto found = cache.occlusionIds.find(it->first);
+    uint32_t id;
+    if (found != cache.occlusionIds.end())
+    {
+      id = found->second;
+    }
+    else
+    {
+      if (!cache.freeOcclusionIds.empty())
+      {
+        id = cache.freeOcclusionIds.back();
+        cache.freeOcclusionIds.pop_back();
+      }
+      else
+      {
+        id = static_cast<uint32_t>(cache.occlusion.size());
+        cache.occlusion.push_back(OcclusionState());
+      }
+      OcclusionState& state = cache.occlusion[id];
+      state.serial = cache.nextSerial++;
+      state.occluded = 0;
+      state.pending = 0;
+      cache.occlusionIds[it->first] = id;
+    }
+    cache.occlusion[id].mark = mark;
+    cache.objectOcclusionIds.push_back(id);
+  }
+
+  for (auto it = cache.occlusionIds.begin(); it != cache.occlusionIds.end();)
+  {
+    if (cache.occlusion[it->second].mark != mark)
+    {
+      cache.freeOcclusionIds.push_back(it->second);
+      it = cache.occlusionIds.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+FramePrep::OcclusionState* FramePrep::getOcclusionState(ShardCache& cache,
+                                                        size_t i) const
+{
+  // Boxes reaching the near plane would be clipped when tested. Infinite
+  // bounds fail the comparison.
+  const V4& near = mCull.planes[4];
+  float distance = near.x * cache.centerX[i] + near.y * cache.centerY[i]
+      + near.z * cache.centerZ[i] + near.w;
+  float reach = std::fabs(near.x) * cache.extentX[i]
+      + std::fabs(near.y) * cache.extentY[i]
+      + std::fabs(near.z) * cache.extentZ[i];
+  if (!(distance - reach > 0.0f))
+    return nullptr;
+  return &cache.occlusion[cache.objectOcclusionIds[i]];
+}
+
+//------------------------------------------------------------------------------
+void FramePrep::collectOcclusionTests()
+{
+  mOcclusionTests.clear();
+  if (!mOcclusionCulling)
+    return;
+
+  parallelFor(mChunks.size(), [this](size_t c)
+  {
+    Chunk& chunk = mChunks[c];
+    ShardCache& cache = mShards[chunk.shard];
+    chunk.occlusionTests.clear();
+    bool softwareCulled = mSoftwareOcclusion && mNumOccluders > 0;
+    for (size_t i = chunk.begin; i < chunk.end; ++i)
+    {
+      if (softwareCulled && !chunk.unoccluded[i - chunk.begin])
+        continue;
+      OcclusionState* state = cache.visible[i] ? getOcclusionState(cache, i) : nullptr;
+      if (state == nullptr || state->pending)
+        continue;
+      uint32_t id = cache.objectOcclusionIds[i];
+      if (!state->occluded && (mFrame + id) % VisibleTestInterval != 0)
+        continue;
+
+      // Enlarged so that the box of a flat object does not lose the depth
+      // test against the object itself.
+      OcclusionTest test;
+      test.center = V3(cache.centerX[i], cache.centerY[i], cache.centerZ[i]);
+      V3 extent(cache.extentX[i], cache.extentY[i], cache.extentZ[i]);
+      float pad = 0.01f * std::max(extent.x, std::max(extent.y, extent.z)) + 1e-5f;
+      test.extent = extent + V3(pad, pad, pad);
+      test.shard = static_cast<uint32_t>(chunk.shard);
+      test.id = id;
+      test.serial = state->serial;
+      chunk.occlusionTests.push_back(test);
+    }
+  });
+
+  for (auto it = mChunks.begin(); it != mChunks.end(); ++it)
+    mOcclusionTests.insert(mOcclusionTests.end(), it->occlusionTests.begin(),
+                           it->occlusionTests.end());
+}
+
+//------------------------------------------------------------------------------
+void FramePrep::cullChunk(const Chunk& chunk)
+{
+  ShardCache& cache = mShards[chunk.shard];
+  const CullParams& cull = mCull;
+  size_t i = chunk.begin;
+
+  // An object is culled if its box is behind one of the planes, or if it
+  // is small: in front of the eye (w > radius) and radius * sizeScale / w
+  // below minPixels. Infinite bounds pass both tests (NaNs included).
+#if defined(__SSE2__) || defined(_M_X64)
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+  const __m128 minPixels = _mm_set1_ps(cull.minPixels);
+  const __m128 sizeScale = _mm_set1_ps(cull.sizeScale);
+  for (; i + 4 <= chunk.end; i += 4)
+  {
+    __m128 cx = _mm_loadu_ps(&cache.centerX[i]);
+    __m128 cy = _mm_loadu_ps(&cache.centerY[i]);
+    __m128 cz = _mm_loadu_ps(&cache.centerZ[i]);
+    __m128 ex = _mm_loadu_ps(&cache.extentX[i]);
+    __m128 ey = _mm_loadu_ps(&cache.extentY[i]);
+    __m128 ez = _mm_loadu_ps(&cache.extentZ[i]);
+
+    __m128 culled = zero;
+    for (int p = 0; p < 6; ++p)
+    {
+      const V4& plane = cull.planes[p];
+      __m128 nx = _mm_set1_ps(plane.x);
+      __m128 ny = _mm_set1_ps(plane.y);
+      __m128 nz = _mm_set1_ps(plane.z);
+      __m128 distance = _mm_add_ps(
+          _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, cx), _mm_mul_ps(ny, cy)),
+                     _mm_mul_ps(nz, cz)),
+          _mm_set1_ps(plane.w));
+      __m128 reach = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(_mm_and_ps(nx, absMask), ex),
+                     _mm_mul_ps(_mm_and_ps(ny, absMask), ey)),
+          _mm_mul_ps(_mm_and_ps(nz, absMask), ez));
+      culled = _mm_or_ps(culled, _mm_cmplt_ps(_mm_add_ps(distance, reach), zero));
+    }
+
+    __m128 w = _mm_add_ps(
+        _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(cull.clipW.x), cx),
+                              _mm_mul_ps(_mm_set1_ps(cull.clipW.y), cy)),
+                   _mm_mul_ps(_mm_set1_ps(cull.clipW.z), cz)),
+        _mm_set1_ps(cull.clipW.w));
+    __m128 radius = _mm_loadu_ps(&cache.radius[i]);
+    __m128 small = _mm_and_ps(
+        _mm_cmpgt_ps(w, radius),
+        _mm_cmplt_ps(_mm_mul_ps(radius, sizeScale), _mm_mul_ps(minPixels, w)));
+    culled = _mm_or_ps(culled, small);
+
+    int mask = _mm_movemask_ps(culled);
+    float depths[4];
+    _mm_storeu_ps(depths, w);
+    for (int k = 0; k < 4; ++k)
+    {
+      cache.visible[i + k] = ((mask >> k) & 1) ? 0 : 1;
+      cache.depths[i + k] = depths[k];
+    }
+  }
+#endif
+  for (; i < chunk.end; ++i)
+  {
+    bool culled = false;
+    for (int p = 0; p < 6; ++p)
+    {
+      const V4& plane = cull.planes[p];
+      float distance = plane.x * cache.centerX[i] + plane.y * cache.centerY[i]
+          + plane.z * cache.centerZ[i] + plane.w;
+      float reach = std::fabs(plane.x) * cache.extentX[i]
+          + std::fabs(plane.y) * cache.extentY[i]
+          + std::fabs(plane.z) * cache.extentZ[i];
+      if (distance + reach < 0.0f)
+        culled = true;
+    }
+
+    float w = cull.clipW.x * cache.centerX[i] + cull.clipW.y * cache.centerY[i]
+        + cull.clipW.z * cache.centerZ[i] + cull.clipW.w;
+    float radius = cache.radius[i];
+    if (w > radius && radius * cull.sizeScale < cull.minPixels * w)
+      culled = true;
+
+    cache.visible[i] = culled ? 0 : 1;
+    cache.depths[i] = w;
+  }
+
+  for (i = chunk.begin; i < chunk.end; ++i)
+  {
+    if (cache.visible[i])
+    {
+      cache.uniforms[i].object = cache.transforms[i];
+      cache.uniforms[i].projIVObject = cull.worldToProjection * cache.transforms[i];
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+void FramePrep::collectOccluderCandidates(Chunk& chunk)
+{
+  ShardCache& cache = mShards[chunk.shard];
+  chunk.occluderCandidates.clear();
+  std::vector<const ObjectPass*> objectPasses;
+  for (size_t i = chunk.begin; i < chunk.end; ++i)
+  {
+    // Objects centered behind the eye (or without bounds) would mostly be
+    // left out by the rasterizer anyway. Walls holding the eye in their
+    // bounding sphere are the best occluders.
+    float radius = cache.radius[i];
+    float w = cache.depths[i];
+    if (   !cache.visible[i] || !(w > 0.0f)
+        || !(radius < std::numeric_limits<float>::infinity()))
+      continue;
+    OccluderCandidate candidate;
+    candidate.size = radius * mCull.ndcScale / w;
+    candidate.flagged = (cache.occluder[i] != 0);
+    if (!candidate.flagged && candidate.size < MinOccluderSize)
+      continue;
+
+    candidate.numTriangles = 0;
+    objectPasses.clear();
+    cache.objects[i]->getPasses(objectPasses);
+    for (auto it = objectPasses.begin(); it != objectPasses.end(); ++it)
+      candidate.numTriangles += getRetainedTriangles(**it);
+    if (candidate.numTriangles == 0)
+      continue;
+
+    candidate.shard = static_cast<uint32_t>(chunk.shard);
+    candidate.index = static_cast<uint32_t>(i);
+    chunk.occluderCandidates.push_back(candidate);
+  }
+}
+
+//------------------------------------------------------------------------------
+void FramePrep::renderOccluders()
+{
+  // Flagged objects first, then the largest on screen. Scene order breaks
+  // ties so the choice does not depend on the chunks.
+  mOccluderCandidates.clear();
+  for (auto it = mChunks.begin(); it != mChunks.end(); ++it)
+    mOccluderCandidates.insert(mOccluderCandidates.end(),
+                               it->occluderCandidates.begin(),
+                               it->occluderCandidates.end());
+  std::sort(mOccluderCandidates.begin(), mOccluderCandidates.end(),
+            [this](const OccluderCandidate& a, const OccluderCandidate& b)
+  {
+    if (a.flagged != b.flagged)
+      return a.flagged;
+    if (a.size != b.size)
+      return a.size > b.size;
+    return mShards[a.shard].start + a.index < mShards[b.shard].start + b.index;
+  });
+
+  mOccluders.clear();
+  mNumOccluders = 0;
+  size_t numTriangles = 0;
+  std::vector<const ObjectPass*> objectPasses;
+  for (auto it = mOccluderCandidates.begin();
+       it != mOccluderCandidates.end() && mNumOccluders < MaxOccluders; ++it)
+  {
+    if (numTriangles + it->numTriangles > OccluderTriangleBudget)
+      continue;
+    numTriangles += it->numTriangles;
+    ++mNumOccluders;
+
+    const ShardCache& cache = mShards[it->shard];
+    objectPasses.clear();
+    cache.objects[it->index]->getPasses(objectPasses);
+    for (auto pass = objectPasses.begin(); pass != objectPasses.end(); ++pass)
+    {
+      if (getRetainedTriangles(**pass) == 0)
+        continue;
+      Occluder occluder;
+      occluder.objectToProjection = mCull.worldToProjection * cache.transforms[it->index];
+      occluder.positions = (*pass)->getVBO()->getRetainedPositions();
+      occluder.indices = (*pass)->getIBO()->getRetainedIndices();
+      occluder.primitive = (*pass)->getPrimitiveType();
+      mOccluders.push_back(occluder);
+    }
+  }
+
+  if (mNumOccluders > 0)
+    mHiZ.render(mOccluders, mCull.worldToProjection);
+  else
+    mHiZ.clear(mCull.worldToProjection);
+  mOccluders.clear();
+}
+
+//------------------------------------------------------------------------------
+void FramePrep::prepareChunk(size_t chunkIndex,
+                             const std::vector<std::string>& passes)
+{
+  Chunk& chunk = mChunks[chunkIndex];
+  ShardCache& cache = mShards[chunk.shard];
+  chunk.draws.clear();
+  chunk.numVisible = 0;
+  chunk.numOccluded = 0;
+  chunk.numClustersCulled = 0;
+  chunk.numIndices = 0;
+  chunk.numCoarseDraws = 0;
+  chunk.drawRanges.clear();
+  chunk.rangeStarts.assign(1, 0);
+  chunk.rangedDraws.clear();
+  chunk.rangeCounts.clear();
+  chunk.rangeOffsets.clear();
+
+  bool softwareCulled = mSoftwareOcclusion && mNumOccluders > 0;
+  if (softwareCulled)
+  {
+    size_t begin = chunk.begin;
+    chunk.unoccluded.assign(cache.visible.begin() + static_cast<ptrdiff_t>(begin),
+                            cache.visible.begin() + static_cast<ptrdiff_t>(chunk.end));
+    mHiZ.cullBoxes(&cache.centerX[begin], &cache.centerY[begin],
+                   &cache.centerZ[begin], &cache.extentX[begin],
+                   &cache.extentY[begin], &cache.extentZ[begin],
+                   chunk.end - begin, &chunk.unoccluded[0]);
+  }
+
+  // Clip w does not change with depth under orthographic projections.
+  float radiusToW = glm::length(V3(mCull.clipW));
+
+  std::vector<const ObjectPass*> objectPasses;
+  for (size_t i = chunk.begin; i < chunk.end; ++i)
+  {
+    if (!cache.visible[i])
+      continue;
+    if (softwareCulled && !chunk.unoccluded[i - chunk.begin])
+    {
+      ++chunk.numOccluded;
+      continue;
+    }
+    if (mOcclusionCulling)
+    {
+      OcclusionState* state = getOcclusionState(cache, i);
+      if (state != nullptr && state->occluded)
+      {
+        ++chunk.numOccluded;
+        continue;
+      }
+    }
+    ++chunk.numVisible;
+
+    // Object space error allowed at the point of the bounding sphere
+    // closest to the eye. Full detail if the eye is inside of it, or if the
+    // object has no bounds.
+    float lodError = 0.0f;
+    float nearest = cache.depths[i] - cache.radius[i] * radiusToW;
+    if (mCull.lodScale > 0.0f && nearest > 0.0f)
+      lodError = mCull.lodScale * nearest / cache.scale[i];
+
+    uint64_t sequence = static_cast<uint64_t>(cache.start + i) << 16;
+    for (size_t p = 0; p < passes.size(); ++p)
+    {
+      objectPasses.clear();
+      cache.objects[i]->getRenderPasses(passes[p], objectPasses);
+      for (auto it = objectPasses.begin(); it != objectPasses.end(); ++it)
+      {
+        size_t lod = (*it)->selectLOD(lodError);
+        const IBOObject* ibo = (*it)->getIBO() != nullptr ? &(*it)->getLODIBO(lod) : nullptr;
+        size_t numRanges = chunk.rangeCounts.size();
+        size_t numRanged = chunk.rangedDraws.size();
+        if (   mClusterCulling && ibo != nullptr && ibo->getClusters() != nullptr
+            && (*it)->getPrimitiveType() == GL_TRIANGLES
+            && ibo->getNumDrawElements() == ibo->getNumElements()
+            && !cullClusters(chunk, *ibo, cache.uniforms[i]))
+          continue;
+
+        DrawItem item;
+        item.sortKey = makeSortKey(p, (*it)->getProgramID(), cache.depths[i]);
+        item.sequence = sequence++;
+        item.pass = *it;
+        item.transforms = &cache.uniforms[i];
+        item.ranges = nullptr;
+        item.lod = static_cast<uint32_t>(lod);
+        chunk.draws.push_back(item);
+        if (lod > 0)
+          ++chunk.numCoarseDraws;
+
+        if (chunk.rangedDraws.size() > numRanged)
+        {
+          for (size_t c = numRanges; c < chunk.rangeCounts.size(); ++c)
+            chunk.numIndices += static_cast<size_t>(chunk.rangeCounts[c]);
+        }
+        else if (ibo != nullptr)
+        {
+          chunk.numIndices += ibo->getNumDrawElements();
+        }
+      }
+    }
+  }
+
+  // The range arrays are complete: point the draws at them.
+  for (size_t r = 0; r < chunk.drawRanges.size(); ++r)
+  {
+    DrawRanges& ranges = chunk.drawRanges[r];
+    ranges.counts = &chunk.rangeCounts[chunk.rangeStarts[r]];
+    ranges.offsets = &chunk.rangeOffsets[chunk.rangeStarts[r]];
+    chunk.draws[chunk.rangedDraws[r]].ranges = &ranges;
+  }
+
+  std::sort(chunk.draws.begin(), chunk.draws.end(), drawItemLess);
+}
+
+//------------------------------------------------------------------------------
+bool FramePrep::cullClusters(Chunk& chunk, const IBOObject& ibo,
+                             const ObjectTransformUniforms& uniforms)
+{
+  const std::vector<MeshCluster>& clusters = *ibo.getClusters();
+  size_t numClusters = clusters.size();
+
+  // Test in object space, where the bounds are. A mirroring transform
+  // turns the front faces of its object around.
+  V4 planes[6];
+  extractFrustumPlanes(uniforms.projIVObject, planes);
+  V4 eye = getObjectSpaceEye(uniforms.projIVObject);
+  bool backFaces = mClusterBackFaces;
+  const M44& object = uniforms.object;
+  bool mirrored = glm::dot(V3(object[0]), glm::cross(V3(object[1]), V3(object[2]))) < 0.0f;
+
+  chunk.clusterVisible.resize(numClusters);
+  uint8_t* visible = &chunk.clusterVisible[0];
+  auto cull = [&](size_t begin, size_t end)
+  {
+    for (size_t c = begin; c < end; ++c)
+    {
+      const MeshCluster& cluster = clusters[c];
+      V3 center(cluster.center[0], cluster.center[1], cluster.center[2]);
+      bool inView = isSphereVisible(planes, center, cluster.radius);
+      if (inView && backFaces)
+      {
+        if (mirrored)
+        {
+          MeshCluster flipped = cluster;
+          for (int k = 0; k < 3; ++k)
+            flipped.coneAxis[k] = -flipped.coneAxis[k];
+          inView = !isClusterBackFacing(flipped, eye);
+        }
+        else
+        {
+          inView = !isClusterBackFacing(cluster, eye);
+        }
+      }
+      visible[c] = inView ? 1 : 0;
+    }
+  };
+  if (numClusters > ClustersPerTask)
+  {
+    parallelFor((numClusters + ClustersPerTask - 1) / ClustersPerTask,
+                [&](size_t task)
+    {
+      size_t begin = task * ClustersPerTask;
+      cull(begin, std::min(begin + ClustersPerTask, numClusters));
+    });
+  }
+  else
+  {
+    cull(0, numClusters);
+  }
+
+  // Merge the clusters in view that are adjacent in the IBO into ranges.
+  size_t first = chunk.rangeCounts.size();
+  size_t indexSize = ibo.getIndexSize();
+  size_t numVisible = 0;
+  uint32_t rangeEnd = 0;
+  for (size_t c = 0; c < numClusters; ++c)
+  {
+    if (!visible[c])
+      continue;
+    ++numVisible;
+    const MeshCluster& cluster = clusters[c];
+    if (chunk.rangeCounts.size() > first && cluster.firstIndex == rangeEnd)
+    {
+      chunk.rangeCounts.back() += static_cast<GLsizei>(cluster.numIndices);
+    }
+    else
+    {
+      chunk.rangeCounts.push_back(static_cast<GLsizei>(cluster.numIndices));
+      chunk.rangeOffsets.push_back(reinterpret_cast<const void*>(
+              static_cast<uintptr_t>(cluster.firstIndex) * indexSize));
+    }
+    rangeEnd = cluster.firstIndex + cluster.numIndices;
+  }
+  chunk.numClustersCulled += numClusters - numVisible;
+
+  if (numVisible == 0)
+    return false;
+  if (numVisible == numClusters)
+  {
+    // Nothing culled: one plain draw is cheaper.
+    chunk.rangeCounts.resize(first);
+    chunk.rangeOffsets.resize(first);
+    return true;
+  }
+
+  DrawRanges ranges;
+  ranges.counts = nullptr;
+  ranges.offsets = nullptr;
+  ranges.numRanges = static_cast<GLsizei>(chunk.rangeCounts.size() - first);
+  chunk.drawRanges.push_back(ranges);
+  chunk.rangeStarts.push_back(chunk.rangeCounts.size());
+  chunk.rangedDraws.push_back(chunk.draws.size());
+  return true;
+}
+
+//------------------------------------------------------------------------------
+void FramePrep::mergeRuns()
+{
+  mMergeBuffer.resize(mDrawList.size());
+  while (mRunStarts.size() > 2)
+  {
+    size_t numRuns = mRunStarts.size() - 1;
+    parallelFor((numRuns + 1) / 2, [this, numRuns](size_t pair)
+    {
+      size_t first = pair * 2;
+      auto begin  = mDrawList.begin();
+      auto middle = mDrawList.begin();
+      auto end    = mDrawList.begin();
+      begin  += static_cast<ptrdiff_t>(mRunStarts[first]);
+      middle += static_cast<ptrdiff_t>(mRunStarts[std::min(first + 1, numRuns)]);
+      end    += static_cast<ptrdiff_t>(mRunStarts[std::min(first + 2, numRuns)]);
+      std::merge(begin, middle, middle, end,
+                 mMergeBuffer.begin() + static_cast<ptrdiff_t>(mRunStarts[first]),
+                 drawItemLess);
+    });
+    mDrawList.swap(mMergeBuffer);
+
+    size_t numMerged = 0;
+    for (size_t i = 0; i < numRuns; i += 2)
+      mRunStarts[numMerged++] = mRunStarts[i];
+    mRunStarts[numMerged] = mRunStarts[numRuns];
+    mRunStarts.resize(numMerged + 1);
+  }
+}
+
+//------------------------------------------------------------------------------
+void FramePrep::clear()
+{
+  mScene.reset();
+  mPasses.clear();
+  mHaveDrawList = false;
+  for (auto it = mShards.begin(); it != mShards.end(); ++it)
+    *it = ShardCache();
+  mNumObjects = 0;
+  mChunks.clear();
+  mDrawList.clear();
+  mNumVisible = 0;
+  mNumCulled = 0;
+  mNumIndices = 0;
+  mNumCoarseDraws = 0;
+  mOcclusionTests.clear();
+  mNumOccluded = 0;
+  mNumOccluders = 0;
+  mHiZ.clear(mCull.worldToProjection);
+  mNumClustersCulled = 0;
+}
+
+} // namespace CPM_SPIRE_NS
+
@@ -0,0 +1,428 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef SPIRE_HIGH_FRAMEPREP_H
+#define SPIRE_HIGH_FRAMEPREP_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Common.h"
+#include "CommandList.h"
+#include "HiZBuffer.h"
+#include "SceneBuffer.h"
+#include "SpireObject.h"
+
+namespace CPM_SPIRE_NS {
+
+/// One draw of a prepared frame. Kept small since draws are sorted; the
+/// transforms are stored once per object.
+struct DrawItem
+{
+  uint64_t                        sortKey;
+  uint64_t                        sequence;   ///< Scene order, breaks ties.
+  const ObjectPass*               pass;
+  const ObjectTransformUniforms*  transforms;
+  const DrawRanges*               ranges;     ///< Null to draw the whole IBO.
+  uint32_t                        lod;        ///< Level of detail of the pass.
+};
+
+/// Box of an object in view to be tested for occlusion after the frame is
+/// drawn; see FramePrep::setOcclusionCulling.
+struct OcclusionTest
+{
+  V3        center;   ///< World space, slightly enlarged.
+  V3        extent;
+  uint32_t  shard;
+  uint32_t  id;       ///< Of the object's occlusion state within its shard.
+  uint32_t  serial;   ///< Tells apart objects that reused an id.
+};
+
+/// Builds the draw list of a frame on the shared thread pool: frustum,
+/// small feature and occlusion culling, sort keys and the per object
+/// transform uniforms.
+///
+/// The transforms and world space bounds of the objects are gathered per
+/// shard of the scene (see SceneVersion) into flat arrays, which are only
+/// rebuilt for the shards that changed since the last prepare. The bounds
+/// are kept as a structure of arrays and culled four objects at a time. The
+/// shards are split into chunks of at most ObjectsPerChunk objects. Every
+/// chunk is culled and sorted into its own buffer, then the buffers are
+/// merged pairwise, again in parallel. Draws are ordered by sort key and
+/// then by their position in the scene, so the draw list does not depend on
+/// the number of threads or on which thread processed which chunk.
+///
+/// While the camera does not move, the culling results of unchanged shards
+/// are reused, and so is the whole draw list if the scene did not change
+/// either.
+///
+/// Occlusion culling reuses the visibility found by the occlusion tests of
+/// earlier frames (as in CHC++), so the tests of a frame never have to be
+/// waited for. An object is skipped while its last test found it occluded.
+/// Occluded objects in view are tested every frame, visible ones every
+/// VisibleTestInterval frames, staggered so that a fraction of them is
+/// tested each frame. Objects keep their state (by name) across edits.
+///
+/// Software occlusion culling needs no results from earlier frames: after
+/// frustum culling, a few large objects in view are picked as occluders
+/// (those flagged with SpireObject::setOccluder first, then the largest on
+/// screen) and their retained meshes (see VBOObject and IBOObject) are
+/// rasterized into a HiZBuffer, which every other object in view is tested
+/// against.
+///
+/// Cluster culling goes below the objects: the passes of clustered IBOs
+/// (see MeshClusters.h) only draw the clusters in view, as index ranges
+/// that point into the chunk that found them.
+///
+/// Passes with levels of detail (see ObjectPass::addLODLevel) draw the
+/// coarsest level whose geometric error, projected from the point of the
+/// object's bounding sphere closest to the eye, is within the pixel error
+/// set by setLODPixelError. It takes one division per object and a look at
+/// the errors of the levels per pass.
+///
+/// The draw list points into the scene version it was built from, which is
+/// kept alive until the next prepare or clear.
+class FramePrep
+{
+public:
+  /// Objects per chunk.
+  static const size_t ObjectsPerChunk = 512;
+
+  /// Frames between the occlusion tests of objects that were visible.
+  static const uint32_t VisibleTestInterval = 8;
+
+  /// Most objects rasterized as occluders by software occlusion culling,
+  /// and their most triangles in total.
+  static const size_t MaxOccluders = 16;
+  static const size_t OccluderTriangleBudget = 65536;
+
+  /// Objects not flagged as occluders are only picked if the radius of
+  /// their bounding sphere covers at least this much of the view (in
+  /// normalized device coordinates, 2 being the height of the view).
+  static const float MinOccluderSize;
+
+  /// Clusters of one draw culled per task; draws with more are split.
+  static const size_t ClustersPerTask = 4096;
+
+  FramePrep();
+
+  /// Builds the draw list of 'scene' as seen through 'worldToProjection'.
+  /// Objects whose bounds are outside of the view frustum, or too small
+  /// (see setSmallFeatureCulling), are skipped. The passes are drawn in the order of 'passes' (at most 256);
+  /// within a pass, draws are sorted by shader program and then front to
+  /// back.
+  void prepare(std::shared_ptr<const SceneVersion> scene,
+               const M44& worldToProjection,
+               const std::vector<std::string>& passes);
+
+  /// Releases the draw list and the scene version.
+  void clear();
+
+  /// Culls objects whose bounding sphere covers less than 'minPixels'
+  /// pixels (diameter) of a viewport 'viewportHeight' pixels high. Objects
+  /// the eye is inside of are kept. 0 disables small feature culling (the
+  /// default).
+  void setSmallFeatureCulling(float minPixels, float viewportHeight);
+
+  /// Makes passes with levels of detail draw the coarsest one whose
+  /// geometric error covers at most 'maxPixels' pixels of a viewport
+  /// 'viewportHeight' pixels high. 0 draws full detail (the default).
+  void setLODPixelError(float maxPixels, float viewportHeight);
+
+  /// Number of draws of the last prepare at a coarser level of detail than
+  /// their pass's own buffers.
+  size_t getNumCoarseDraws() const      {return mNumCoarseDraws;}
+
+  /// Skips objects that the occlusion tests of earlier frames found to be
+  /// occluded (see getOcclusionTests). Off by default; turning it off
+  /// forgets all results.
+  void setOcclusionCulling(bool enabled);
+
+  /// Occlusion tests to run after drawing the last prepared frame: the
+  /// objects in view that are occluded or due for a test, except those
+  /// without bounds, with a test in flight (setOcclusionPending) or whose
+  /// box reaches the near plane (they are never culled as occluded).
+  const std::vector<OcclusionTest>& getOcclusionTests() const
+  {return mOcclusionTests;}
+
+  /// Skips objects hidden behind the occluders of the frame, rasterized on
+  /// the CPU. Off by default.
+  void setSoftwareOcclusionCulling(bool enabled);
+
+  /// Number of objects rasterized as occluders by the last prepare.
+  size_t getNumOccluders() const        {return mNumOccluders;}
+
+  /// Occluders of the last prepare.
+  const HiZBuffer& getHiZBuffer() const {return mHiZ;}
+
+  /// Culls the clusters of clustered IBOs of the objects in view against
+  /// the view frustum and, if 'backFaces', against their normal cones. Only
+  /// cull back faces if the application culls them as well (counter
+  /// clockwise front faces). Off by default.
+  void setClusterCulling(bool enabled, bool backFaces);
+
+  /// Number of clusters the last prepare skipped.
+  size_t getNumClustersCulled() const   {return mNumClustersCulled;}
+
+  /// Marks the object of 'test' as having a test in flight, so it is not
+  /// tested again until its result is in.
+  void setOcclusionPending(const OcclusionTest& test);
+
+  /// Records the result of 'test', used from the next prepare on. Ignored
+  /// if the object was removed since.
+  void setOcclusionResult(const OcclusionTest& test, bool visible);
+
+  const std::vector<DrawItem>& getDrawList() const  {return mDrawList;}
+
+  /// View of the last prepare.
+  const M44& getWorldToProjection() const   {return mCull.worldToProjection;}
+
+  /// Number of objects in the scene of the last prepare.
+  size_t getNumObjects() const          {return mNumObjects;}
+
+  /// Number of objects that passed culling in the last prepare.
+  size_t getNumVisibleObjects() const   {return mNumVisible;}
+
+  /// Number of indices the draw list of the last prepare draws.
+  size_t getNumIndices() const          {return mNumIndices;}
+
+  /// Number of objects in view that the last prepare skipped as occluded,
+  /// by either kind of occlusion culling.
+  size_t getNumOccludedObjects() const  {return mNumOccluded;}
+
+  /// Number of objects whose culling result was computed (not reused) by
+  /// the last prepare.
+  size_t getNumObjectsCulled() const    {return mNumCulled;}
+
+  /// Sort key: pass index, then shader program, then depth (front first).
+  static uint64_t makeSortKey(size_t passIndex, GLuint program, float depth);
+
+  /// Normalized planes (xyz normal pointing inside, w distance) of the view
+  /// frustum of 'worldToProjection'.
+  static void extractFrustumPlanes(const M44& worldToProjection, V4 planes[6]);
+
+  /// False if the sphere is entirely outside of one of the planes.
+  static bool isSphereVisible(const V4 planes[6], const V3& center,
+                              float radius);
+
+  /// False if the box is entirely outside of one of the planes.
+  static bool isBoxVisible(const V4 planes[6], const V3& center,
+                           const V3& extent);
+
+  /// Eye in the object space of 'objectToProjection': a point (w = 1), or
+  /// the viewing direction of an orthographic projection (w = 0).
+  static V4 getObjectSpaceEye(const M44& objectToProjection);
+
+  /// True if every triangle of 'cluster' faces away from 'eye' (see
+  /// getObjectSpaceEye).
+  static bool isClusterBackFacing(const MeshCluster& cluster, const V4& eye);
+
+private:
+  FramePrep(const FramePrep&);
+  FramePrep& operator=(const FramePrep&);
+
+  /// Occlusion state of an object.
+  struct OcclusionState
+  {
+    uint32_t  serial;
+    uint32_t  mark;       ///< Last shard update that saw the object.
+    uint8_t   occluded;
+    uint8_t   pending;
+  };
+
+  /// Flattened copy of one shard of the scene.
+  struct ShardCache
+  {
+    ShardCache() : start(0), culled(false), occlusionMark(0), nextSerial(0) {}
+
+    std::shared_ptr<const SceneVersion::Shard>  shard;  ///< Source.
+    size_t                                      start;  ///< First object's index in the scene.
+    std::vector<const SpireObject*>             objects;
+    std::vector<M44>                            transforms;
+
+    /// World space bounds. Objects without bounds have infinite extents
+    /// and radius.
+    std::vector<float>                          centerX;
+    std::vector<float>                          centerY;
+    std::vector<float>                          centerZ;
+    std::vector<float>                          extentX;
+    std::vector<float>                          extentY;
+    std::vector<float>                          extentZ;
+    std::vector<float>                          radius;
+    std::vector<float>                          scale;      ///< Largest of the transform.
+    std::vector<uint8_t>                        occluder;   ///< Flagged as occluder.
+
+    /// Culling results, valid if 'culled' is true.
+    bool                                        culled;
+    std::vector<uint8_t>                        visible;
+    std::vector<float>                          depths;
+    std::vector<ObjectTransformUniforms>        uniforms;   ///< Of visible objects.
+
+    /// Occlusion states of the objects by name, kept when the shard changes.
+    /// Only maintained while occlusion culling is on.
+    std::unordered_map<std::string, uint32_t>  occlusionIds;
+    std::vector<OcclusionState>                 occlusion;        ///< By id.
+    std::vector<uint32_t>                       freeOcclusionIds;
+    std::vector<uint32_t>                       objectOcclusionIds;
+    uint32_t                                    occlusionMark;
+    uint32_t                                    nextSerial;
+  };
+
+  /// View dependent culling state.
+  struct CullParams
+  {
+    CullParams();
+
+    M44     worldToProjection;
+    float   minPixels;
+    float   viewportHeight;
+
+    V4      planes[6];
+    V4      clipW;        ///< Row of worldToProjection giving clip w.
+    float   sizeScale;    ///< Pixels covered by a radius of 1 at w = 1.
+    float   ndcScale;     ///< Same in normalized device coordinates.
+
+    float   lodPixels;
+    float   lodViewportHeight;
+    float   lodScale;     ///< lodPixels over the pixels a length of 1 covers at w = 1.
+  };
+
+  /// Object in view that could be rasterized as an occluder.
+  struct OccluderCandidate
+  {
+    float     size;       ///< See MinOccluderSize.
+    bool      flagged;
+    uint32_t  shard;
+    uint32_t  index;      ///< In its shard.
+    size_t    numTriangles;
+  };
+
+  /// A range of objects of one shard, culled and sorted by one task.
+  struct Chunk
+  {
+    size_t                  shard;
+    size_t                  begin;
+    size_t                  end;
+    size_t                  numVisible;
+    size_t                  numOccluded;
+    size_t                  numIndices;
+    size_t                  numCoarseDraws;
+    bool                    culled;     ///< Culling results computed, not reused.
+    std::vector<DrawItem>   draws;
+    std::vector<OcclusionTest> occlusionTests;
+    std::vector<OccluderCandidate> occluderCandidates;
+    std::vector<uint8_t>    unoccluded;   ///< By the occluders, from begin.
+
+    /// Clusters in view of the ranged draws, referenced by the draws once
+    /// prepareChunk is done.
+    size_t                  numClustersCulled;
+    std::vector<uint8_t>    clusterVisible;
+    std::vector<DrawRanges> drawRanges;
+    std::vector<size_t>     rangeStarts;    ///< Into rangeCounts, plus the end.
+    std::vector<size_t>     rangedDraws;    ///< Into draws, by drawRanges.
+    std::vector<GLsizei>    rangeCounts;
+    std::vector<const void*> rangeOffsets;
+  };
+
+  /// Refreshes mShards[shard] from the scene if the shard changed.
+  void updateShardCache(size_t shard);
+
+  /// Gives the objects of 'cache' their occlusion states, creating those
+  /// of new objects and releasing those of removed ones.
+  void updateOcclusionIds(ShardCache& cache);
+
+  /// Computes the culling results of the objects of 'chunk'.
+  void cullChunk(const Chunk& chunk);
+
+  /// Returns the occlusion state of object 'i' of 'cache' if it is in view
+  /// and could be occluded: it has bounds that do not reach the near plane.
+  OcclusionState* getOcclusionState(ShardCache& cache, size_t i) const;
+
+  /// Fills mOcclusionTests from the chunks.
+  void collectOcclusionTests();
+
+  /// Lists the objects of 'chunk' that could be occluders.
+  void collectOccluderCandidates(Chunk& chunk);
+
+  /// Rasterizes the best occluder candidates of all chunks.
+  void renderOccluders();
+
+  /// Sorts the draws of the objects of mChunks[chunk] that are in view and
+  /// not occluded.
+  void prepareChunk(size_t chunk, const std::vector<std::string>& passes);
+
+  /// Culls the clusters of 'ibo' of an object seen through 'uniforms'.
+  /// Returns false if none is in view. Otherwise appends the ranges to draw
+  /// to 'chunk' for the draw about to be added, unless all are in view.
+  bool cullClusters(Chunk& chunk, const IBOObject& ibo,
+                    const ObjectTransformUniforms& uniforms);
+
+  /// Merges the sorted runs starting at mRunStarts into one.
+  void mergeRuns();
+
+  std::shared_ptr<const SceneVersion>                   mScene;
+  std::vector<std::string>                              mPasses;
+  CullParams                                            mCull;
+  bool                                                  mHaveDrawList;
+  std::array<ShardCache, SceneVersion::NumShards>       mShards;
+  size_t                                                mNumObjects;
+
+  std::vector<Chunk>                                    mChunks;
+  std::vector<size_t>                                   mRunStarts; ///< Plus the end.
+
+  std::vector<DrawItem>                                 mDrawList;
+  std::vector<DrawItem>                                 mMergeBuffer;
+  size_t                                                mNumVisible;
+  size_t                                                mNumCulled;
+  size_t                                                mNumIndices;
+  size_t                                                mNumCoarseDraws;
+
+  bool                                                  mOcclusionCulling;
+  uint32_t                                              mFrame;
+  std::vector<OcclusionTest>                            mOcclusionTests;
+  size_t                                                mNumOccluded;
+
+  bool                                                  mSoftwareOcclusion;
+  HiZBuffer                                             mHiZ;
+  size_t                                                mNumOccluders;
+  std::vector<OccluderCandidate>                        mOccluderCandidates;
+  std::vector<Occluder>                                 mOccluders;
+
+  bool                                                  mClusterCulling;
+  bool                                                  mClusterBackFaces;
+  size_t                                                mNumClustersCulled;
+};
+
+} // namespace CPM_SPIRE_NS
+
+#endif
@@ -0,0 +1,200 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <stdexcept>
+
+#include "../Context.h"
+#include "GLUploader.h"
+
+namespace CPM_SPIRE_NS {
+
+//------------------------------------------------------------------------------
+GLUploader::GLUploader(std::shared_ptr<Context> uploadContext) :
+    mContext(uploadContext),
+    mStop(false)
+{
+  mThread = std::thread(&GLUploader::threadMain, this);
+}
+
+//------------------------------------------------------------------------------
+GLUploader::~GLUploader()
+{
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mStop = true;
+  }
+  mWake.notify_one();
+  mThread.join();
+
+  // The loader thread deleted the fences of the issued uploads. Every
+  // caller still hears back about its upload.
+  std::deque<Upload> unpublished;
+  unpublished.swap(mIssued);
+  unpublished.insert(unpublished.end(), mPending.begin(), mPending.end());
+  mPending.clear();
+  std::exception_ptr error = std::make_exception_ptr(
+      std::runtime_error("Upload thread shut down before the upload was published."));
+  for (auto it = unpublished.begin(); it != unpublished.end(); ++it)
+    it->publish(error);
+}
+
+//------------------------------------------------------------------------------
+void GLUploader::queue(std::function<void ()> upload, PublishFunction publish)
+{
+  Upload job;
+  job.upload = std::move(upload);
+  job.publish = std::move(publish);
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mPending.push_back(std::move(job));
+  }
+  mWake.notify_one();
+}
+
+//------------------------------------------------------------------------------
+size_t GLUploader::publishFinished()
+{
+  size_t numPublished = 0;
+  for (;;)
+  {
+    Upload job;
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      if (mIssued.empty())
+        break;
+#ifdef SPIRE_UPLOAD_FENCES
+      // Uploads without a fence were finished by the loader thread.
+      Upload& issued = mIssued.front();
+      if (issued.fence != 0)
+      {
+        GLenum status = glClientWaitSync(issued.fence, 0, 0);
+        if (status == GL_TIMEOUT_EXPIRED)
+          break;
+        if (status == GL_WAIT_FAILED)
+        {
+          // Nothing tells whether the upload reached the buffers, so it
+          // failed.
+          while (glGetError() != GL_NO_ERROR) {}
+          if (!issued.error)
+            issued.error = std::make_exception_ptr(
+                std::runtime_error("Unable to wait for the upload to finish."));
+        }
+        GL(glDeleteSync(issued.fence));
+      }
+#endif
+      job = std::move(mIssued.front());
+      mIssued.pop_front();
+    }
+
+    job.publish(job.error);
+    ++numPublished;
+  }
+  return numPublished;
+}
+
+//------------------------------------------------------------------------------
+bool GLUploader::hasOutstandingUploads()
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  return !mPending.empty() || !mIssued.empty();
+}
+
+//------------------------------------------------------------------------------
+GLuint GLUploader::createBuffer(GLenum target, const uint8_t* data, size_t size)
+{
+  GLuint buffer = 0;
+  GL(glGenBuffers(1, &buffer));
+  GL(glBindBuffer(target, buffer));
+
+  // Out of memory is the one error we expect here, report it to the caller
+  // instead of logging it.
+  while (glGetError() != GL_NO_ERROR) {}
+  glBufferData(target, static_cast<GLsizeiptr>(size), data, GL_STATIC_DRAW);
+  GLenum error = glGetError();
+  GL(glBindBuffer(target, 0));
+  if (error != GL_NO_ERROR)
+  {
+    GL(glDeleteBuffers(1, &buffer));
+    throw std::runtime_error("Unable to allocate buffer object.");
+  }
+  return buffer;
+}
+
+//------------------------------------------------------------------------------
+void GLUploader::threadMain()
+{
+  mContext->makeCurrent();
+
+  for (;;)
+  {
+    Upload job;
+    {
+      std::unique_lock<std::mutex> lock(mMutex);
+      mWake.wait(lock, [this]() { return mStop || !mPending.empty(); });
+      if (mStop)
+        break;
+      job = std::move(mPending.front());
+      mPending.pop_front();
+    }
+
+    try
+    {
+      job.upload();
+    }
+    catch (...)
+    {
+      job.error = std::current_exception();
+    }
+
+#ifdef SPIRE_UPLOAD_FENCES
+    job.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // The fence has to reach the GPU before the rendering thread can see it
+    // signal. Without a fence, the upload is finished here instead.
+    if (job.fence != 0)
+      GL(glFlush());
+    else
+      GL(glFinish());
+#else
+    GL(glFinish());
+#endif
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    mIssued.push_back(std::move(job));
+  }
+
+#ifdef SPIRE_UPLOAD_FENCES
+  std::lock_guard<std::mutex> lock(mMutex);
+  for (auto it = mIssued.begin(); it != mIssued.end(); ++it)
+  {
+    if (it->fence != 0)
+      GL(glDeleteSync(it->fence));
+  }
+#endif
+}
+
+} // namespace CPM_SPIRE_NS
@@ -0,0 +1,121 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef SPIRE_HIGH_GLUPLOADER_H
+#define SPIRE_HIGH_GLUPLOADER_H
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Common.h"
+
+// OpenGL ES 2.0 and legacy OpenGL 2.1 headers have no fences, uploads are
+// completed with glFinish instead.
+#if !defined(SPIRE_OPENGL_ES_2) && defined(GL_SYNC_GPU_COMMANDS_COMPLETE)
+  #define SPIRE_UPLOAD_FENCES
+#endif
+
+namespace CPM_SPIRE_NS {
+
+class Context;
+
+/// Loader thread that issues OpenGL uploads on a context sharing objects
+/// with the rendering context (see Context::createSharedContext). Every
+/// upload is followed by a fence; its results are only handed to the
+/// rendering thread once the fence has signaled, so the render context never
+/// sees a partially written buffer. All functions are thread safe unless
+/// noted otherwise.
+class GLUploader
+{
+public:
+  /// Called on the rendering thread with the exception thrown by the upload
+  /// function, or a null pointer if it succeeded.
+  typedef std::function<void (std::exception_ptr error)> PublishFunction;
+
+  /// Starts the loader thread and makes 'uploadContext' current on it.
+  GLUploader(std::shared_ptr<Context> uploadContext);
+
+  /// Stops the loader thread. Uploads that have not been published yet are
+  /// published with a std::runtime_error instead, from the destroying
+  /// thread; objects they created are released along with the context share
+  /// group.
+  ~GLUploader();
+
+  /// Runs 'upload' on the loader thread, then hands it to 'publish' on the
+  /// rendering thread (see publishFinished). 'upload' is expected to delete
+  /// the objects it created if it throws.
+  void queue(std::function<void ()> upload, PublishFunction publish);
+
+  /// Rendering thread only. Calls the publish functions of the uploads whose
+  /// fences have signaled, in the order they were queued. Uploads whose
+  /// fence cannot be waited on are published with a std::runtime_error.
+  /// Never blocks.
+  /// \return Number of uploads published.
+  size_t publishFinished();
+
+  /// True while uploads are queued or waiting to be published.
+  bool hasOutstandingUploads();
+
+  /// Creates a buffer object bound to 'target' from 'size' bytes at 'data'
+  /// on the current context. Throws std::runtime_error if OpenGL runs out of
+  /// memory.
+  static GLuint createBuffer(GLenum target, const uint8_t* data, size_t size);
+
+private:
+  struct Upload
+  {
+    std::function<void ()>  upload;
+    PublishFunction         publish;
+    std::exception_ptr      error;
+#ifdef SPIRE_UPLOAD_FENCES
+    GLsync                  fence;
+#endif
+  };
+
+  void threadMain();
+
+  std::shared_ptr<Context>  mContext;
+
+  std::mutex                mMutex;
+  std::condition_variable   mWake;
+  std::deque<Upload>        mPending;   ///< Waiting for the loader thread.
+  std::deque<Upload>        mIssued;    ///< Waiting for their fences.
+  bool                      mStop;
+
+  std::thread               mThread;
+};
+
+} // namespace CPM_SPIRE_NS
+
+#endif
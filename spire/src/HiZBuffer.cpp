@@ -0,0 +1,491 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#include "HiZBuffer.h"
+#include "Parallel.h"
+#include "TriangleBVH.h"
+
+namespace CPM_SPIRE_NS {
+
+const int HiZBuffer::Width;
+const int HiZBuffer::Height;
+const int HiZBuffer::NumLevels;
+const int HiZBuffer::RowsPerBand;
+
+//------------------------------------------------------------------------------
+HiZBuffer::HiZBuffer() :
+    mWorldToProjection(1.0f),
+    mNumTriangles(0)
+{
+  clear(mWorldToProjection);
+}
+
+//------------------------------------------------------------------------------
+void HiZBuffer::clear(const M44& worldToProjection)
+{
+  mWorldToProjection = worldToProjection;
+  mNumTriangles = 0;
+  for (int level = 0; level < NumLevels; ++level)
+  {
+    mLevels[level].assign(static_cast<size_t>((Width >> level) * (Height >> level)),
+                          std::numeric_limits<float>::infinity());
+  }
+}
+
+//------------------------------------------------------------------------------
+void HiZBuffer::render(const std::vector<Occluder>& occluders,
+                       const M44& worldToProjection)
+{
+  mWorldToProjection = worldToProjection;
+  mTriangles.resize(occluders.size());
+  parallelFor(occluders.size(), [this, &occluders](size_t i)
+  {
+    mTriangles[i].clear();
+    setupTriangles(occluders[i], mTriangles[i]);
+  });
+
+  mNumTriangles = 0;
+  for (auto it = mTriangles.begin(); it != mTriangles.end(); ++it)
+    mNumTriangles += it->size();
+
+  // Bands write disjoint rows.
+  mLevels[0].assign(static_cast<size_t>(Width * Height),
+                    std::numeric_limits<float>::infinity());
+  parallelFor(Height / RowsPerBand, [this](size_t band)
+  {
+    int y0 = static_cast<int>(band) * RowsPerBand;
+    int y1 = y0 + RowsPerBand;
+    for (auto list = mTriangles.begin(); list != mTriangles.end(); ++list)
+    {
+      for (auto it = list->begin(); it != list->end(); ++it)
+      {
+        if (it->maxY >= y0 && it->minY < y1)
+          rasterize(*it, y0, y1);
+      }
+    }
+  });
+
+  buildPyramid();
+}
+
+//------------------------------------------------------------------------------
+void HiZBuffer::setupTriangles(const Occluder& occluder,
+                               std::vector<Triangle>& triangles)
+{
+  const std::vector<V3>& positions = *occluder.positions;
+  const std::vector<uint32_t>& indices = *occluder.indices;
+  size_t numTriangles = TriangleBVH::getNumTriangles(indices.size(),
+                                                     occluder.primitive);
+  if (numTriangles == 0)
+    return;
+
+  std::vector<V4> clip(positions.size());
+  for (size_t v = 0; v < positions.size(); ++v)
+    clip[v] = occluder.objectToProjection * V4(positions[v], 1.0f);
+
+  const float width = static_cast<float>(Width);
+  const float height = static_cast<float>(Height);
+  for (size_t t = 0; t < numTriangles; ++t)
+  {
+    uint32_t v[3];
+    TriangleBVH::getTriangle(&indices[0], occluder.primitive, t, v);
+
+    // Pixel coordinates and normalized device depth. Triangles reaching
+    // the near plane are left out rather than clipped.
+    V3 s[3];
+    bool inFront = true;
+    for (int k = 0; k < 3 && inFront; ++k)
+    {
+      if (v[k] >= clip.size())
+      {
+        inFront = false;
+        break;
+      }
+      const V4& c = clip[v[k]];
+      inFront = (c.z > -c.w) && (c.w > 0.0f);
+      float inverseW = 1.0f / c.w;
+      s[k] = V3((c.x * inverseW * 0.5f + 0.5f) * width,
+                (c.y * inverseW * 0.5f + 0.5f) * height,
+                c.z * inverseW);
+    }
+    if (!inFront)
+      continue;
+
+    float area = (s[1].x - s[0].x) * (s[2].y - s[0].y)
+               - (s[2].x - s[0].x) * (s[1].y - s[0].y);
+    if (!(std::fabs(area) > 1e-12f))
+      continue;
+    // Both sides are drawn: make the corners counterclockwise.
+    if (area < 0.0f)
+    {
+      std::swap(s[1], s[2]);
+      area = -area;
+    }
+
+    float minX = std::min(s[0].x, std::min(s[1].x, s[2].x));
+    float maxX = std::max(s[0].x, std::max(s[1].x, s[2].x));
+    float minY = std::min(s[0].y, std::min(s[1].y, s[2].y));
+    float maxY = std::max(s[0].y, std::max(s[1].y, s[2].y));
+    if (maxX < 0.0f || minX >= width || maxY < 0.0f || minY >= height)
+      continue;
+
+    Triangle tri;
+    tri.minX = static_cast<int>(std::max(minX, 0.0f));
+    tri.maxX = static_cast<int>(std::min(maxX, width - 1.0f));
+    tri.minY = static_cast<int>(std::max(minY, 0.0f));
+    tri.maxY = static_cast<int>(std::min(maxY, height - 1.0f));
+    for (int k = 0; k < 3; ++k)
+    {
+      const V3& a = s[k];
+      const V3& b = s[(k + 1) % 3];
+      tri.edgeA[k] = a.y - b.y;
+      tri.edgeB[k] = b.x - a.x;
+      tri.edgeC[k] = -(tri.edgeA[k] * a.x + tri.edgeB[k] * a.y);
+    }
+
+    // The depth at a pixel center, pushed to the farthest depth of the
+    // pixel, but no farther than the farthest corner.
+    float dz1 = s[1].z - s[0].z;
+    float dz2 = s[2].z - s[0].z;
+    tri.depthX = (dz1 * (s[2].y - s[0].y) - dz2 * (s[1].y - s[0].y)) / area;
+    tri.depthY = (dz2 * (s[1].x - s[0].x) - dz1 * (s[2].x - s[0].x)) / area;
+    tri.depthC = s[0].z - tri.depthX * s[0].x - tri.depthY * s[0].y
+        + 0.5f * (std::fabs(tri.depthX) + std::fabs(tri.depthY));
+    tri.maxDepth = std::max(s[0].z, std::max(s[1].z, s[2].z));
+    triangles.push_back(tri);
+  }
+}
+
+//------------------------------------------------------------------------------
+void HiZBuffer::rasterize(const Triangle& tri, int y0, int y1)
+{
+  int rowBegin = std::max(tri.minY, y0);
+  int rowEnd = std::min(tri.maxY + 1, y1);
+  float* depth = &mLevels[0][0];
+
+  // Pixels are covered if their center is inside of (or on) every edge.
+  // Rows are processed in aligned groups of pixels; pixels of a group
+  // outside of the bounding box fail the edge tests.
+#if defined(__AVX2__)
+  const __m256 lanes = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 a0 = _mm256_set1_ps(tri.edgeA[0]);
+  const __m256 a1 = _mm256_set1_ps(tri.edgeA[1]);
+  const __m256 a2 = _mm256_set1_ps(tri.edgeA[2]);
+  const __m256 dx = _mm256_set1_ps(tri.depthX);
+  const __m256 maxDepth = _mm256_set1_ps(tri.maxDepth);
+  for (int y = rowBegin; y < rowEnd; ++y)
+  {
+    float py = static_cast<float>(y) + 0.5f;
+    __m256 e0 = _mm256_set1_ps(tri.edgeB[0] * py + tri.edgeC[0]);
+    __m256 e1 = _mm256_set1_ps(tri.edgeB[1] * py + tri.edgeC[1]);
+    __m256 e2 = _mm256_set1_ps(tri.edgeB[2] * py + tri.edgeC[2]);
+    __m256 z = _mm256_set1_ps(tri.depthY * py + tri.depthC);
+    float* row = depth + y * Width;
+    for (int x = tri.minX & ~7; x <= tri.maxX; x += 8)
+    {
+      __m256 px = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(x)), lanes);
+      __m256 inside = _mm256_and_ps(
+          _mm256_and_ps(
+              _mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(a0, px), e0), zero, _CMP_GE_OQ),
+              _mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(a1, px), e1), zero, _CMP_GE_OQ)),
+          _mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(a2, px), e2), zero, _CMP_GE_OQ));
+      __m256 d = _mm256_min_ps(_mm256_add_ps(_mm256_mul_ps(dx, px), z), maxDepth);
+      __m256 old = _mm256_loadu_ps(row + x);
+      _mm256_storeu_ps(row + x, _mm256_blendv_ps(old, _mm256_min_ps(old, d), inside));
+    }
+  }
+#elif defined(__SSE2__) || defined(_M_X64)
+  const __m128 lanes = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 a0 = _mm_set1_ps(tri.edgeA[0]);
+  const __m128 a1 = _mm_set1_ps(tri.edgeA[1]);
+  const __m128 a2 = _mm_set1_ps(tri.edgeA[2]);
+  const __m128 dx = _mm_set1_ps(tri.depthX);
+  const __m128 maxDepth = _mm_set1_ps(tri.maxDepth);
+  for (int y = rowBegin; y < rowEnd; ++y)
+  {
+    float py = static_cast<float>(y) + 0.5f;
+    __m128 e0 = _mm_set1_ps(tri.edgeB[0] * py + tri.edgeC[0]);
+    __m128 e1 = _mm_set1_ps(tri.edgeB[1] * py + tri.edgeC[1]);
+    __m128 e2 = _mm_set1_ps(tri.edgeB[2] * py + tri.edgeC[2]);
+    __m128 z = _mm_set1_ps(tri.depthY * py + tri.depthC);
+    float* row = depth + y * Width;
+    for (int x = tri.minX & ~3; x <= tri.maxX; x += 4)
+    {
+      __m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), lanes);
+      __m128 inside = _mm_and_ps(
+          _mm_and_ps(_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a0, px), e0), zero),
+                     _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a1, px), e1), zero)),
+          _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a2, px), e2), zero));
+      __m128 d = _mm_min_ps(_mm_add_ps(_mm_mul_ps(dx, px), z), maxDepth);
+      __m128 old = _mm_loadu_ps(row + x);
+      __m128 nearer = _mm_min_ps(old, d);
+      _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer),
+                                       _mm_andnot_ps(inside, old)));
+    }
+  }
+#else
+  for (int y = rowBegin; y < rowEnd; ++y)
+  {
+    float py = static_cast<float>(y) + 0.5f;
+    float e0 = tri.edgeB[0] * py + tri.edgeC[0];
+    float e1 = tri.edgeB[1] * py + tri.edgeC[1];
+    float e2 = tri.edgeB[2] * py + tri.edgeC[2];
+    float z = tri.depthY * py + tri.depthC;
+    float* row = depth + y * Width;
+    for (int x = tri.minX; x <= tri.maxX; ++x)
+    {
+      float px = static_cast<float>(x) + 0.5f;
+      if (   tri.edgeA[0] * px + e0 >= 0.0f
+          && tri.edgeA[1] * px + e1 >= 0.0f
+          && tri.edgeA[2] * px + e2 >= 0.0f)
+      {
+        float d = std::min(tri.depthX * px + z, tri.maxDepth);
+        row[x] = std::min(row[x], d);
+      }
+    }
+  }
+#endif
+}
+
+//------------------------------------------------------------------------------
+void HiZBuffer::buildPyramid()
+{
+  for (int level = 1; level < NumLevels; ++level)
+  {
+    int width = Width >> level;
+    int height = Height >> level;
+    const float* below = &mLevels[level - 1][0];
+    float* texels = &mLevels[level][0];
+    for (int y = 0; y < height; ++y)
+    {
+      const float* row0 = below + (2 * y) * (2 * width);
+      const float* row1 = row0 + 2 * width;
+      for (int x = 0; x < width; ++x)
+      {
+        texels[y * width + x] = std::max(std::max(row0[2 * x], row0[2 * x + 1]),
+                                         std::max(row1[2 * x], row1[2 * x + 1]));
+      }
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+float HiZBuffer::getDepth(int x, int y, int level) const
+{
+  return mLevels[level][static_cast<size_t>(y * (Width >> level) + x)];
+}
+
+//------------------------------------------------------------------------------
+bool HiZBuffer::isRectOccluded(int x0, int y0, int x1, int y1, float depth) const
+{
+  // Coarsest level first where the rectangle covers at most 2 x 2 texels.
+  int level = 0;
+  while (   level + 1 < NumLevels
+         && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1))
+    ++level;
+
+  int width = Width >> level;
+  const float* texels = &mLevels[level][0];
+  for (int y = y0 >> level; y <= (y1 >> level); ++y)
+  {
+    for (int x = x0 >> level; x <= (x1 >> level); ++x)
+    {
+      if (!(texels[y * width + x] < depth))
+        return false;
+    }
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+bool HiZBuffer::isProjectionVisible(float minX, float minY, float maxX,
+                                    float maxY, float minZ) const
+{
+  const float width = static_cast<float>(Width);
+  const float height = static_cast<float>(Height);
+  float x0 = (minX * 0.5f + 0.5f) * width;
+  float x1 = (maxX * 0.5f + 0.5f) * width;
+  float y0 = (minY * 0.5f + 0.5f) * height;
+  float y1 = (maxY * 0.5f + 0.5f) * height;
+  // Out of view: up to frustum culling.
+  if (!(x1 >= 0.0f && x0 < width && y1 >= 0.0f && y0 < height))
+    return true;
+
+  return !isRectOccluded(static_cast<int>(std::max(x0, 0.0f)),
+                         static_cast<int>(std::max(y0, 0.0f)),
+                         static_cast<int>(std::min(x1, width - 1.0f)),
+                         static_cast<int>(std::min(y1, height - 1.0f)),
+                         minZ);
+}
+
+//------------------------------------------------------------------------------
+bool HiZBuffer::isBoxVisible(const V3& center, const V3& extent) const
+{
+  const M44& m = mWorldToProjection;
+  V4 clipCenter = m * V4(center, 1.0f);
+  V4 axes[3] = {m[0] * extent.x, m[1] * extent.y, m[2] * extent.z};
+
+  // The projection of a box is bounded by the projections of its corners,
+  // and so is its depth (z / w has no extremum inside of the box).
+  const float infinity = std::numeric_limits<float>::infinity();
+  float minX = infinity;
+  float minY = infinity;
+  float minZ = infinity;
+  float maxX = -infinity;
+  float maxY = -infinity;
+  for (int k = 0; k < 8; ++k)
+  {
+    V4 corner = clipCenter;
+    for (int a = 0; a < 3; ++a)
+      corner += axes[a] * (((k >> a) & 1) ? 1.0f : -1.0f);
+    if (!(corner.z > -corner.w) || !(corner.w > 0.0f))
+      return true;
+
+    float inverseW = 1.0f / corner.w;
+    minX = std::min(minX, corner.x * inverseW);
+    maxX = std::max(maxX, corner.x * inverseW);
+    minY = std::min(minY, corner.y * inverseW);
+    maxY = std::max(maxY, corner.y * inverseW);
+    minZ = std::min(minZ, corner.z * inverseW);
+  }
+  return isProjectionVisible(minX, minY, maxX, maxY, minZ);
+}
+
+//------------------------------------------------------------------------------
+void HiZBuffer::cullBoxes(const float* centerX, const float* centerY,
+                          const float* centerZ, const float* extentX,
+                          const float* extentY, const float* extentZ,
+                          size_t count, uint8_t* visible) const
+{
+  size_t i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+  // Same as isBoxVisible, four boxes at a time.
+  const M44& m = mWorldToProjection;
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 infinity = _mm_set1_ps(std::numeric_limits<float>::infinity());
+  for (; i + 4 <= count; i += 4)
+  {
+    uint32_t anyVisible;
+    std::memcpy(&anyVisible, visible + i, sizeof(anyVisible));
+    if (anyVisible == 0)
+      continue;
+
+    __m128 cx = _mm_loadu_ps(centerX + i);
+    __m128 cy = _mm_loadu_ps(centerY + i);
+    __m128 cz = _mm_loadu_ps(centerZ + i);
+    __m128 ex = _mm_loadu_ps(extentX + i);
+    __m128 ey = _mm_loadu_ps(extentY + i);
+    __m128 ez = _mm_loadu_ps(extentZ + i);
+
+    // Clip space center and half axes, per clip coordinate.
+    __m128 center[4];
+    __m128 axes[3][4];
+    for (int r = 0; r < 4; ++r)
+    {
+      center[r] = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[0][r]), cx),
+                     _mm_mul_ps(_mm_set1_ps(m[1][r]), cy)),
+          _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[2][r]), cz),
+                     _mm_set1_ps(m[3][r])));
+      axes[0][r] = _mm_mul_ps(_mm_set1_ps(m[0][r]), ex);
+      axes[1][r] = _mm_mul_ps(_mm_set1_ps(m[1][r]), ey);
+      axes[2][r] = _mm_mul_ps(_mm_set1_ps(m[2][r]), ez);
+    }
+
+    __m128 minX = infinity;
+    __m128 minY = infinity;
+    __m128 minZ = infinity;
+    __m128 maxX = _mm_sub_ps(zero, infinity);
+    __m128 maxY = maxX;
+    __m128 reachesNear = zero;
+    for (int k = 0; k < 8; ++k)
+    {
+      __m128 corner[4];
+      for (int r = 0; r < 4; ++r)
+      {
+        corner[r] = center[r];
+        for (int a = 0; a < 3; ++a)
+        {
+          corner[r] = ((k >> a) & 1) ? _mm_add_ps(corner[r], axes[a][r])
+                                     : _mm_sub_ps(corner[r], axes[a][r]);
+        }
+      }
+      reachesNear = _mm_or_ps(reachesNear, _mm_or_ps(
+          _mm_cmpngt_ps(corner[2], _mm_sub_ps(zero, corner[3])),
+          _mm_cmpngt_ps(corner[3], zero)));
+
+      __m128 inverseW = _mm_div_ps(one, corner[3]);
+      __m128 x = _mm_mul_ps(corner[0], inverseW);
+      __m128 y = _mm_mul_ps(corner[1], inverseW);
+      minX = _mm_min_ps(minX, x);
+      maxX = _mm_max_ps(maxX, x);
+      minY = _mm_min_ps(minY, y);
+      maxY = _mm_max_ps(maxY, y);
+      minZ = _mm_min_ps(minZ, _mm_mul_ps(corner[2], inverseW));
+    }
+
+    int nearMask = _mm_movemask_ps(reachesNear);
+    float x0[4];
+    float x1[4];
+    float y0[4];
+    float y1[4];
+    float z0[4];
+    _mm_storeu_ps(x0, minX);
+    _mm_storeu_ps(x1, maxX);
+    _mm_storeu_ps(y0, minY);
+    _mm_storeu_ps(y1, maxY);
+    _mm_storeu_ps(z0, minZ);
+    for (int lane = 0; lane < 4; ++lane)
+    {
+      if (   visible[i + lane] && !((nearMask >> lane) & 1)
+          && !isProjectionVisible(x0[lane], y0[lane], x1[lane], y1[lane], z0[lane]))
+        visible[i + lane] = 0;
+    }
+  }
+#endif
+  for (; i < count; ++i)
+  {
+    if (visible[i] && !isBoxVisible(V3(centerX[i], centerY[i], centerZ[i]),
+                                    V3(extentX[i], extentY[i], extentZ[i])))
+      visible[i] = 0;
+  }
+}
+
+} // namespace CPM_SPIRE_NS
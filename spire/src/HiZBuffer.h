@@ -0,0 +1,151 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+/// \brief  Low resolution depth buffer of a few large occluders, rasterized
+///         on the CPU, with a hierarchical-Z pyramid to test boxes against.
+///         Rasterizes eight pixels at once with AVX2 and four with SSE when
+///         the compiler targets them.
+
+#ifndef SPIRE_HIGH_HIZBUFFER_H
+#define SPIRE_HIGH_HIZBUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Common.h"
+
+namespace CPM_SPIRE_NS {
+
+/// Triangles drawn by a retained mesh (see TriangleBVH::getTriangle) and
+/// where they are.
+struct Occluder
+{
+  M44                                           objectToProjection;
+  std::shared_ptr<const std::vector<V3>>        positions;
+  std::shared_ptr<const std::vector<uint32_t>>  indices;
+  GLenum                                        primitive;
+};
+
+/// Depth buffer of Width x Height pixels covering the view, holding the
+/// normalized device depth of the nearest occluder at each pixel center
+/// (made conservative across the pixel), and a pyramid of half resolution
+/// levels holding the farthest depth of the four texels below. A box is
+/// occluded if its nearest point is behind the pyramid texels covering its
+/// projection, picked from the level where it covers at most 2 x 2 texels.
+///
+/// Occluders are rasterized in bands of rows in parallel on the shared
+/// thread pool. Triangles reaching the near plane are left out, so the
+/// depth buffer never claims more than the occluders cover.
+class HiZBuffer
+{
+public:
+  static const int Width = 256;
+  static const int Height = 128;
+  static const int NumLevels = 8;     ///< Down to 2 x 1.
+  static const int RowsPerBand = 16;
+
+  HiZBuffer();
+
+  /// Rasterizes 'occluders' and builds the pyramid. 'worldToProjection' is
+  /// the view boxes are then tested in.
+  void render(const std::vector<Occluder>& occluders,
+              const M44& worldToProjection);
+
+  /// Empties the depth buffer: nothing is occluded.
+  void clear(const M44& worldToProjection);
+
+  /// Tests 'count' world space boxes given as structure of arrays (centers
+  /// and half extents), four at a time, and sets visible[i] to 0 for those
+  /// hidden behind the occluders. Entries already 0 are left alone. Boxes
+  /// reaching the near plane are visible.
+  void cullBoxes(const float* centerX, const float* centerY,
+                 const float* centerZ, const float* extentX,
+                 const float* extentY, const float* extentZ,
+                 size_t count, uint8_t* visible) const;
+
+  /// Same as above for one box.
+  bool isBoxVisible(const V3& center, const V3& extent) const;
+
+  /// Depth at texel ('x', 'y') of 'level' (0 is the depth buffer), infinite
+  /// where no occluder was drawn. Row 0 is the bottom of the view.
+  float getDepth(int x, int y, int level = 0) const;
+
+  /// Triangles rasterized by the last render.
+  size_t getNumTriangles() const    {return mNumTriangles;}
+
+private:
+  HiZBuffer(const HiZBuffer&);
+  HiZBuffer& operator=(const HiZBuffer&);
+
+  /// Triangle set up for rasterization: edge functions A x + B y + C, which
+  /// are non-negative inside, and the depth plane, in pixel coordinates.
+  struct Triangle
+  {
+    float   edgeA[3];
+    float   edgeB[3];
+    float   edgeC[3];
+    float   depthX;
+    float   depthY;
+    float   depthC;     ///< Includes the slack making depths conservative.
+    float   maxDepth;   ///< Of the corners.
+    int     minX;
+    int     maxX;
+    int     minY;
+    int     maxY;
+  };
+
+  /// Appends the triangles of 'occluder' that are in view to 'triangles'.
+  static void setupTriangles(const Occluder& occluder,
+                             std::vector<Triangle>& triangles);
+
+  /// Draws the part of 'triangle' in rows ['y0', 'y1').
+  void rasterize(const Triangle& triangle, int y0, int y1);
+
+  void buildPyramid();
+
+  /// True if the pixel rectangle ['x0', 'x1'] x ['y0', 'y1'] is behind
+  /// 'depth' everywhere.
+  bool isRectOccluded(int x0, int y0, int x1, int y1, float depth) const;
+
+  /// Visibility of a box whose projection covers [minX, maxX] x [minY,
+  /// maxY] in normalized device coordinates, with its nearest point at
+  /// depth 'minZ'.
+  bool isProjectionVisible(float minX, float minY, float maxX, float maxY,
+                           float minZ) const;
+
+  M44                                 mWorldToProjection;
+  std::vector<std::vector<Triangle>>  mTriangles;   ///< Per occluder.
+  std::vector<float>                  mLevels[NumLevels];
+  size_t                              mNumTriangles;
+};
+
+} // namespace CPM_SPIRE_NS
+
+#endif
@@ -37,6 +37,7 @@
 #include "Hub.h"
 #include "Log.h"
 #include "FileUtil.h"
+#include "GLUploader.h"
 #include "InterfaceImplementation.h"
 #include "ShaderMan.h"
 #include "ShaderAttributeMan.h"
@@ -73,6 +74,15 @@ Hub::Hub(std::shared_ptr<Context> context,
   mShaderDirs.push_back(workingDir);
 
   oneTimeInit();
+
+  // Uploads move to a loader thread when the context can be shared. Context
+  // creation may change the current context, so restore ours afterwards.
+  std::shared_ptr<Context> uploadContext = mContext->createSharedContext();
+  if (uploadContext)
+  {
+    mContext->makeCurrent();
+    mUploader = std::make_shared<GLUploader>(uploadContext);
+  }
 }
 
 //------------------------------------------------------------------------------
@@ -93,5 +103,17 @@ void Hub::makeCurrent()
   mContext->makeCurrent();
 }
 
+//------------------------------------------------------------------------------
+void Hub::doneCurrent()
+{
+  mContext->doneCurrent();
+}
+
+//------------------------------------------------------------------------------
+void Hub::swapBuffers()
+{
+  mContext->swapBuffers();
+}
+
 } // namespace CPM_SPIRE_NS
 
@@ -43,6 +43,7 @@
 
 namespace CPM_SPIRE_NS {
 
+class GLUploader;
 class Log;
 class PipeDriver;
 class InterfaceImplementation;
@@ -99,9 +100,27 @@ public:
   /// Retrieves the interface implementation.
   std::shared_ptr<InterfaceImplementation> getInterfaceImpl() {return mInterfaceImpl;}
 
+  /// Logging function given to the interface.
+  const Interface::LogFunction& getLogFunction() const {return mLogFun;}
+
   /// Make context current.
   void makeCurrent();
 
+  /// Release the context from the calling thread.
+  void doneCurrent();
+
+  /// Swap the front and back buffers of the context.
+  void swapBuffers();
+
+  /// Loader thread uploading on a context shared with the rendering context.
+  /// Empty if the context could not be shared (see
+  /// Context::createSharedContext).
+  std::shared_ptr<GLUploader> getUploader()       {return mUploader;}
+
+  /// Stops the loader thread, see GLUploader::~GLUploader. Uploads queued
+  /// afterwards run on the render thread.
+  void stopUploader()                             {mUploader.reset();}
+
 private:
 
   Interface::LogFunction              mLogFun;          ///< Log function.
@@ -119,6 +138,9 @@ private:
 
   size_t                  mPixScreenWidth;  ///< Actual screen width in pxels.
   size_t                  mPixScreenHeight; ///< Actual screen height in pixels.
+
+  /// Declared last so the loader thread stops before anything else goes.
+  std::shared_ptr<GLUploader>         mUploader;
   
 };
 
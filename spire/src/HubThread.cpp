@@ -0,0 +1,166 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <stdexcept>
+
+#include "HubThread.h"
+#include "Hub.h"
+#include "GLUploader.h"
+#include "Log.h"
+
+namespace CPM_SPIRE_NS {
+
+//------------------------------------------------------------------------------
+HubThread::HubThread(Interface& iface, Hub& hub, Interface::RenderFunction render,
+                     const Interface::RenderThreadOptions& options) :
+    mInterface(iface),
+    mHub(hub),
+    mRender(render),
+    mOptions(options),
+    mFrameRequested(true),
+    mStop(false)
+{
+  if (!mRender)
+    throw std::invalid_argument("The render thread needs a render function.");
+  if (mOptions.targetFrameRate < 0.0)
+    throw std::invalid_argument("Target frame rate must not be negative.");
+
+  mThread = std::thread(&HubThread::threadMain, this);
+}
+
+//------------------------------------------------------------------------------
+HubThread::~HubThread()
+{
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mStop = true;
+  }
+  mWake.notify_one();
+  mThread.join();
+}
+
+//------------------------------------------------------------------------------
+void HubThread::requestFrame()
+{
+  // Scene edits are queued lock-free; only the first request of a frame pays
+  // for the wake up.
+  if (mFrameRequested.exchange(true))
+    return;
+
+  std::lock_guard<std::mutex> lock(mMutex);
+  mWake.notify_one();
+}
+
+//------------------------------------------------------------------------------
+bool HubThread::waitForFrame(std::unique_lock<std::mutex>& lock)
+{
+  if (mOptions.continuous)
+    return !mStop;
+
+  // Uploads finishing on the loader thread are only noticed by polling their
+  // fences, so wake up every now and then while some are outstanding.
+  const std::chrono::milliseconds uploadPollInterval(4);
+  std::shared_ptr<GLUploader> uploader = mHub.getUploader();
+  while (!mStop && !mFrameRequested)
+  {
+    if (uploader && uploader->hasOutstandingUploads())
+    {
+      if (mWake.wait_for(lock, uploadPollInterval) == std::cv_status::timeout)
+      {
+        // Only render if the poll published something.
+        lock.unlock();
+        size_t numFinished = mInterface.processAsyncLoads();
+        lock.lock();
+        if (numFinished > 0)
+          break;
+      }
+    }
+    else
+    {
+      mWake.wait(lock);
+    }
+  }
+  return !mStop;
+}
+
+//------------------------------------------------------------------------------
+void HubThread::threadMain()
+{
+  // Loggers are per thread.
+  Log log(mHub.getLogFunction());
+  mHub.makeCurrent();
+
+  Clock::duration period = Clock::duration::zero();
+  if (mOptions.targetFrameRate > 0.0)
+  {
+    period = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(1.0 / mOptions.targetFrameRate));
+  }
+  Clock::time_point nextFrame = Clock::now();
+
+  std::unique_lock<std::mutex> lock(mMutex);
+  for (;;)
+  {
+    if (!waitForFrame(lock))
+      break;
+
+    // Frames are paced against the target rate. A frame that runs late moves
+    // the schedule instead of causing a burst of frames to catch up.
+    if (period != Clock::duration::zero())
+    {
+      if (mWake.wait_until(lock, nextFrame, [this]() {return mStop;}))
+        break;
+      Clock::time_point now = Clock::now();
+      nextFrame += period;
+      if (nextFrame < now)
+        nextFrame = now + period;
+    }
+
+    mFrameRequested = false;
+    lock.unlock();
+
+    try
+    {
+      mInterface.beginFrame();
+      mRender(mInterface);
+    }
+    catch (const std::exception& e)
+    {
+      Log::error() << "Render thread frame failed: " << e.what() << std::endl;
+    }
+    // Blocks until the vertical retrace when the context swaps with vsync.
+    mHub.swapBuffers();
+
+    lock.lock();
+  }
+
+  lock.unlock();
+  mHub.doneCurrent();
+}
+
+} // namespace CPM_SPIRE_NS
@@ -0,0 +1,91 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef SPIRE_HIGH_HUBTHREAD_H
+#define SPIRE_HIGH_HUBTHREAD_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "../Interface.h"
+
+namespace CPM_SPIRE_NS {
+
+class Hub;
+
+/// Render thread owned by Spire (see Interface::startRenderThread). Makes the
+/// context current once, then runs frames: Interface::beginFrame, the host's
+/// render function and a buffer swap. Frames are paced to the target frame
+/// rate, and when not rendering continuously the thread sleeps until
+/// something asks for a frame.
+class HubThread
+{
+public:
+  /// Starts the thread. The context must not be current on any other thread.
+  HubThread(Interface& iface, Hub& hub, Interface::RenderFunction render,
+            const Interface::RenderThreadOptions& options);
+
+  /// Finishes the current frame and stops the thread. The context is left
+  /// released.
+  ~HubThread();
+
+  /// Asks for a frame to be rendered. Thread safe and cheap when a frame has
+  /// already been asked for.
+  void requestFrame();
+
+private:
+  HubThread(const HubThread&);
+  HubThread& operator=(const HubThread&);
+
+  typedef std::chrono::steady_clock Clock;
+
+  void threadMain();
+
+  /// Sleeps until a frame is due.
+  /// \return False if the thread should stop.
+  bool waitForFrame(std::unique_lock<std::mutex>& lock);
+
+  Interface&                        mInterface;
+  Hub&                              mHub;
+  Interface::RenderFunction         mRender;
+  Interface::RenderThreadOptions    mOptions;
+
+  std::mutex                        mMutex;
+  std::condition_variable           mWake;
+  std::atomic<bool>                 mFrameRequested;
+  bool                              mStop;
+
+  std::thread                       mThread;
+};
+
+} // namespace CPM_SPIRE_NS
+
+#endif
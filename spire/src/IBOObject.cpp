@@ -29,20 +29,29 @@
 /// \author James Hughes
 /// \date   February 2013
 
+#include <cstring>
+
 #include "IBOObject.h"
 
 namespace CPM_SPIRE_NS {
 
 IBOObject::IBOObject(std::shared_ptr<std::vector<uint8_t>> iboData,
-                     Interface::IBO_TYPE type)
+                     Interface::IBO_TYPE type, bool retainIndices)
 {
-  buildIBOObject(&(*iboData)[0], iboData->size(), type);
+  buildIBOObject(&(*iboData)[0], iboData->size(), type, retainIndices);
 }
 
 IBOObject::IBOObject(const uint8_t* iboData, size_t iboDataSize,
-                     Interface::IBO_TYPE type)
+                     Interface::IBO_TYPE type, bool retainIndices)
+{
+  buildIBOObject(iboData, iboDataSize, type, retainIndices);
+}
+
+IBOObject::IBOObject(GLuint glIndex, size_t iboDataSize,
+                     Interface::IBO_TYPE type) :
+    mGLIndex(glIndex)
 {
-  buildIBOObject(iboData, iboDataSize, type);
+  setElements(iboDataSize, type);
 }
 
 IBOObject::~IBOObject()
@@ -50,15 +59,59 @@ IBOObject::~IBOObject()
   GL(glDeleteBuffers(1, &mGLIndex));
 }
 
+void IBOObject::updateData(size_t offset, const uint8_t* data, size_t size)
+{
+  GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mGLIndex));
+  GL(glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, static_cast<GLintptr>(offset),
+                     static_cast<GLsizeiptr>(size), data));
+}
+
 
 void IBOObject::buildIBOObject(const uint8_t* iboData, size_t iboDataSize,
-                               Interface::IBO_TYPE type)
+                               Interface::IBO_TYPE type, bool retainIndices)
 {
   GL(glGenBuffers(1, &mGLIndex));
   GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mGLIndex));
   GL(glBufferData(GL_ELEMENT_ARRAY_BUFFER, static_cast<GLsizeiptr>(iboDataSize),
                   iboData, GL_STATIC_DRAW));
+  setElements(iboDataSize, type);
 
+  if (retainIndices && iboData != nullptr)
+  {
+    std::shared_ptr<std::vector<uint32_t>> indices =
+        std::make_shared<std::vector<uint32_t>>(mNumElements);
+    for (size_t i = 0; i < mNumElements; ++i)
+    {
+      if (mType == GL_UNSIGNED_BYTE)
+      {
+        (*indices)[i] = iboData[i];
+      }
+      else if (mType == GL_UNSIGNED_SHORT)
+      {
+        uint16_t index;
+        std::memcpy(&index, iboData + i * sizeof(index), sizeof(index));
+        (*indices)[i] = index;
+      }
+      else
+      {
+        std::memcpy(&(*indices)[i], iboData + i * sizeof(uint32_t), sizeof(uint32_t));
+      }
+    }
+    mRetainedIndices = indices;
+  }
+}
+
+size_t IBOObject::getIndexSize() const
+{
+  if (mType == GL_UNSIGNED_BYTE)
+    return sizeof(uint8_t);
+  if (mType == GL_UNSIGNED_SHORT)
+    return sizeof(uint16_t);
+  return sizeof(uint32_t);
+}
+
+void IBOObject::setElements(size_t iboDataSize, Interface::IBO_TYPE type)
+{
   // Calculate number of elements based on the IBO type.
   switch (type)
   {
@@ -85,6 +138,7 @@ void IBOObject::buildIBOObject(const uint8_t* iboData, size_t iboDataSize,
 #pragma clang diagnostic pop
 
   }
+  mNumDrawElements = mNumElements;
 }
 
 } // namespace CPM_SPIRE_NS
@@ -36,6 +36,7 @@
 #include <memory>
 
 #include "Common.h"
+#include "MeshClusters.h"
 #include "../Interface.h"
 
 namespace CPM_SPIRE_NS {
@@ -47,23 +48,60 @@ class IBOObject
 public:
   // This constructor delegates to the raw version below.
   IBOObject(std::shared_ptr<std::vector<uint8_t>> iboData,
-            Interface::IBO_TYPE type);
+            Interface::IBO_TYPE type, bool retainIndices = false);
 
-  IBOObject(const uint8_t* iboData, size_t iboDataSize, Interface::IBO_TYPE type);
+  /// If 'retainIndices' is true, a copy of the indices is kept for picking
+  /// (see getRetainedIndices).
+  IBOObject(const uint8_t* iboData, size_t iboDataSize, Interface::IBO_TYPE type,
+            bool retainIndices = false);
+
+  /// Takes ownership of the existing buffer object 'glIndex' holding
+  /// 'iboDataSize' bytes, e.g. one created on the upload context (see
+  /// GLUploader).
+  IBOObject(GLuint glIndex, size_t iboDataSize, Interface::IBO_TYPE type);
   ~IBOObject();
 
   GLuint getGLIndex() const               {return mGLIndex;}
   GLuint getNumElements() const           {return mNumElements;}
   GLenum getType() const                  {return mType;}
 
+  /// Number of elements drawn by passes using this IBO. Defaults to all of
+  /// them; streamed meshes draw the prefix uploaded so far.
+  GLuint getNumDrawElements() const       {return mNumDrawElements;}
+  void setNumDrawElements(GLuint count)   {mNumDrawElements = count;}
+
+  /// Replaces 'size' bytes of the buffer starting at byte 'offset'.
+  void updateData(size_t offset, const uint8_t* data, size_t size);
+
+  /// CPU copy of the indices, widened to 32 bits, if retained when the IBO
+  /// was built. Null otherwise.
+  const std::shared_ptr<const std::vector<uint32_t>>& getRetainedIndices() const
+  {return mRetainedIndices;}
+
+  /// Clusters of the triangles of this IBO (see MeshClusters.h) that frame
+  /// preparation culls one by one. Null if the IBO is not clustered.
+  const std::shared_ptr<const std::vector<MeshCluster>>& getClusters() const
+  {return mClusters;}
+  void setClusters(std::shared_ptr<const std::vector<MeshCluster>> clusters)
+  {mClusters = clusters;}
+
+  /// Size in bytes of one index.
+  size_t getIndexSize() const;
+
 private:
 
   void buildIBOObject(const uint8_t* iboData, size_t iboDataSize,
-                      Interface::IBO_TYPE type);
+                      Interface::IBO_TYPE type, bool retainIndices);
+
+  /// Sets the element type and count from the size of the buffer.
+  void setElements(size_t iboDataSize, Interface::IBO_TYPE type);
 
   GLuint                    mGLIndex;    ///< Corresponds to the map index but obtained from OpenGL.
   GLuint                    mNumElements;///< Number of elements in the IBO.
+  GLuint                    mNumDrawElements; ///< Number of elements to draw.
   GLenum                    mType;       ///< Type of index buffer.
+  std::shared_ptr<const std::vector<uint32_t>>  mRetainedIndices;
+  std::shared_ptr<const std::vector<MeshCluster>> mClusters;
 };
 
 } // namespace CPM_SPIRE_NS
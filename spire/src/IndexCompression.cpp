@@ -0,0 +1,127 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <stdexcept>
+
+#include "IndexCompression.h"
+
+namespace CPM_SPIRE_NS {
+
+namespace {
+
+/// Longest varint encoding of a 32 bit value.
+const size_t MAX_VARINT_SIZE = 5;
+
+inline uint32_t zigzagEncode(uint32_t delta)
+{
+  return (delta << 1) ^ (0u - (delta >> 31));
+}
+
+inline uint32_t zigzagDecode(uint32_t value)
+{
+  return (value >> 1) ^ (0u - (value & 1));
+}
+
+/// Decodes the remainder of a varint whose first byte had the continuation
+/// bit set. The caller guarantees MAX_VARINT_SIZE - 1 readable bytes.
+inline uint32_t decodeVarintTail(uint32_t value, const uint8_t*& p)
+{
+  value &= 0x7f;
+  for (unsigned shift = 7; shift < 35; shift += 7)
+  {
+    uint32_t byte = *p++;
+    value |= (byte & 0x7f) << shift;
+    if (byte < 0x80)
+      return value;
+  }
+  throw std::invalid_argument("Malformed compressed index data.");
+}
+
+} // namespace
+
+//------------------------------------------------------------------------------
+void encodeIndices(const std::vector<uint32_t>& indices,
+                   std::vector<uint8_t>& out)
+{
+  out.reserve(out.size() + indices.size() + indices.size() / 4);
+
+  uint32_t last = 0;
+  for (auto it = indices.begin(); it != indices.end(); ++it)
+  {
+    uint32_t value = zigzagEncode(*it - last);
+    last = *it;
+    while (value >= 0x80)
+    {
+      out.push_back(static_cast<uint8_t>(value | 0x80));
+      value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+  }
+}
+
+//------------------------------------------------------------------------------
+size_t decodeIndices(const uint8_t* data, size_t size, uint32_t* out,
+                     size_t count)
+{
+  const uint8_t* p = data;
+  const uint8_t* end = data + size;
+  uint32_t last = 0;
+  size_t i = 0;
+
+  // While a whole varint is guaranteed to fit in the remaining input, decode
+  // without bounds checks. Single byte values are by far the most common.
+  while (i < count && static_cast<size_t>(end - p) >= MAX_VARINT_SIZE)
+  {
+    uint32_t value = *p++;
+    if (value >= 0x80)
+      value = decodeVarintTail(value, p);
+    last += zigzagDecode(value);
+    out[i++] = last;
+  }
+
+  // The last few bytes are checked individually.
+  for (; i < count; ++i)
+  {
+    uint32_t value = 0;
+    for (unsigned shift = 0; ; shift += 7)
+    {
+      if (p == end || shift >= 35)
+        throw std::invalid_argument("Malformed compressed index data.");
+      uint32_t byte = *p++;
+      value |= (byte & 0x7f) << shift;
+      if (byte < 0x80)
+        break;
+    }
+    last += zigzagDecode(value);
+    out[i] = last;
+  }
+
+  return static_cast<size_t>(p - data);
+}
+
+} // namespace CPM_SPIRE_NS
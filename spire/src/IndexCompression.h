@@ -0,0 +1,61 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+/// \brief  Lossless compression of triangle index lists.
+///
+///         Every index is stored as the difference to the index before it,
+///         zigzag encoded so small negative steps stay small, and written as
+///         a little endian base 128 varint (7 bits per byte, high bit set on
+///         all but the last byte). Meshes ordered for the vertex cache (see
+///         MeshOptimizer.h) reference nearby vertices, so most indices take a
+///         single byte instead of two or four.
+///
+///         Triangle order and winding are preserved exactly.
+
+#ifndef SPIRE_HIGH_INDEXCOMPRESSION_H
+#define SPIRE_HIGH_INDEXCOMPRESSION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace CPM_SPIRE_NS {
+
+/// Appends the compressed form of 'indices' to 'out'.
+void encodeIndices(const std::vector<uint32_t>& indices,
+                   std::vector<uint8_t>& out);
+
+/// Decodes exactly 'count' indices from 'data' into 'out'. Throws
+/// std::invalid_argument if 'data' is truncated or malformed.
+/// \return Returns the number of bytes of 'data' consumed.
+size_t decodeIndices(const uint8_t* data, size_t size, uint32_t* out,
+                     size_t count);
+
+} // namespace CPM_SPIRE_NS
+
+#endif
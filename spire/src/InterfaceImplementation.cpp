@@ -29,10 +29,17 @@
 /// \author James Hughes
 /// \date   February 2013
 
+#include <algorithm>
+#include <chrono>
+#include <limits>
+
 #include "Hub.h"
 #include "InterfaceImplementation.h"
+#include "MeshOptimizer.h"
+#include "MeshStream.h"
 #include "SpireObject.h"
 #include "Exceptions.h"
+#include "ThreadPool.h"
 
 /// Remove types as we move away from making spire a one-stop-shop for OpenGL.
 /// Spire will only solve one uinque problem in terms of gathering shaders
@@ -42,6 +49,11 @@
   #define GL_HALF_FLOAT_OES GL_FLOAT
 #endif
 
+// Older desktop headers (OpenGL 2.1 on OSX) only define the ARB token.
+#ifndef GL_HALF_FLOAT
+  #define GL_HALF_FLOAT 0x140B
+#endif
+
 
 namespace CPM_SPIRE_NS {
 
@@ -52,87 +64,201 @@ GLenum getGLPrimitive(Interface::PRIMITIVE_TYPES type);
 
 //------------------------------------------------------------------------------
 InterfaceImplementation::InterfaceImplementation(Hub& hub) :
+    mDoubleBuffered(false),
+    mRetainMeshes(false),
+    mMinPixels(0.0f),
+    mViewportHeight(0.0f),
+    mAppliedMinPixels(0.0f),
+    mLODPixels(0.0f),
+    mLODViewportHeight(0.0f),
+    mAppliedLODPixels(0.0f),
+    mOcclusionCulling(false),
+    mRenderTasks(std::make_shared<RenderTaskQueue>()),
+    mCommands(4096),
     mHub(hub)
 {}
 
+//------------------------------------------------------------------------------
+InterfaceImplementation::~InterfaceImplementation()
+{
+  // Commands that were never applied still own their data.
+  SceneCommand command;
+  while (mCommands.pop(command))
+    delete[] command.data;
+}
+
 //------------------------------------------------------------------------------
 void InterfaceImplementation::clearGLResources()
 {
-  mNameToObject.clear();
+  mCommandLists.clear();
+  mOcclusionQueries.clear();
+  mFrameManager.clear();
+  mFramePrep.clear();
+  mScene.removeAllObjects();
+  mScene.publish();
   mPersistentShaders.clear();
+  std::lock_guard<std::mutex> lock(mBufferMutex);
   mVBOMap.clear();
   mIBOMap.clear();
 }
 
 //------------------------------------------------------------------------------
-std::shared_ptr<SpireObject>
+std::shared_ptr<const SpireObject>
 InterfaceImplementation::getObjectWithName(const std::string& name) const
 {
-  return mNameToObject.at(name);
+  return mScene.getObject(name);
 }
 
 //------------------------------------------------------------------------------
-void InterfaceImplementation::addObject(std::string objectName)
+std::shared_ptr<const SpireObject>
+InterfaceImplementation::getRenderObject(const std::string& name)
 {
-  if (mNameToObject.find(objectName) != mNameToObject.end())
-    throw Duplicate("There already exists an object by that name!");
+  if (!mDoubleBuffered)
+    mScene.publish();
+  std::shared_ptr<const SpireObject> object = mScene.getFront()->findObject(name);
+  if (object == nullptr)
+    throw std::out_of_range("Object to render does not exist: " + name);
+  return object;
+}
 
-  std::shared_ptr<SpireObject> obj = std::shared_ptr<SpireObject>(
-      new SpireObject(mHub, objectName));
-  mNameToObject[objectName] = obj;
+//------------------------------------------------------------------------------
+std::shared_ptr<const AbstractUniformStateItem>
+InterfaceImplementation::getGlobalUniform(const std::string& name) const
+{
+  return mScene.getGlobalUniform(name);
 }
 
 //------------------------------------------------------------------------------
-void InterfaceImplementation::removeObject(std::string objectName)
+void InterfaceImplementation::publishScene()
+{
+  mDoubleBuffered = true;
+  size_t numCopied = 0;
+  mScene.publish(&numCopied);
+  mFrameStats.numObjectsCopied = numCopied;
+}
+
+//------------------------------------------------------------------------------
+void InterfaceImplementation::addObject(std::string objectName)
 {
-  if (mNameToObject.find(objectName) == mNameToObject.end())
-    throw std::range_error("Object to remove does not exist!");
+  mScene.addObject(std::make_shared<SpireObject>(mHub, objectName));
+}
 
-  std::shared_ptr<SpireObject> obj = mNameToObject.at(objectName);
-  mNameToObject.erase(objectName);
+//------------------------------------------------------------------------------
+void InterfaceImplementation::removeObject(std::string objectName)
+{
+  mScene.removeObject(objectName);
 }
 
 //------------------------------------------------------------------------------
 void InterfaceImplementation::removeAllObjects()
 {
-  mNameToObject.clear();
+  mScene.removeAllObjects();
 }
 
 //------------------------------------------------------------------------------
 void InterfaceImplementation::addVBO(std::string vboName,
                                      std::shared_ptr<std::vector<uint8_t>> vboData,
-                                     std::vector<std::string> attribNames)
+                                     std::vector<std::string> attribNames,
+                                     bool narrowDoubles)
 {
   if (mVBOMap.find(vboName) != mVBOMap.end())
     throw Duplicate("Attempting to add duplicate VBO to object.");
 
-  mVBOMap.insert(std::make_pair(
-          vboName, std::shared_ptr<VBOObject>(
-              new VBOObject(vboData, attribNames, mHub.getShaderAttributeManager()))));
+  std::shared_ptr<VBOObject> vbo(
+      new VBOObject(vboData, attribNames, mHub.getShaderAttributeManager(),
+                    narrowDoubles, mRetainMeshes));
+  std::lock_guard<std::mutex> lock(mBufferMutex);
+  mVBOMap.insert(std::make_pair(vboName, vbo));
 }
 
 //------------------------------------------------------------------------------
 void InterfaceImplementation::addConcurrentVBO(
     const std::string& vboName, const uint8_t* vboData, size_t vboSize,
-    const std::vector<std::string>& attribNames)
+    const std::vector<std::string>& attribNames, bool narrowDoubles)
 {
   if (mVBOMap.find(vboName) != mVBOMap.end())
     throw Duplicate("Attempting to add duplicate VBO to object.");
 
-  mVBOMap.insert(std::make_pair(
-          vboName, std::shared_ptr<VBOObject>(
-              new VBOObject(vboData, vboSize, attribNames, 
-                            mHub.getShaderAttributeManager()))));
+  std::shared_ptr<VBOObject> vbo(
+      new VBOObject(vboData, vboSize, attribNames,
+                    mHub.getShaderAttributeManager(), narrowDoubles,
+                    mRetainMeshes));
+  std::lock_guard<std::mutex> lock(mBufferMutex);
+  mVBOMap.insert(std::make_pair(vboName, vbo));
+}
+
+//------------------------------------------------------------------------------
+void InterfaceImplementation::addUploadedBuffers(
+    const std::string& name, GLuint vboIndex,
+    const std::vector<std::string>& attribNames, GLuint iboIndex,
+    size_t iboSize, Interface::IBO_TYPE iboType,
+    const std::vector<uint8_t>* vboData,
+    std::shared_ptr<const std::vector<MeshCluster>> clusters)
+{
+  std::shared_ptr<VBOObject> vbo;
+  if (vboIndex != 0)
+  {
+    vbo.reset(new VBOObject(vboIndex, attribNames,
+                            mHub.getShaderAttributeManager()));
+    if (vboData != nullptr && !vboData->empty())
+      vbo->computeBounds(&(*vboData)[0], vboData->size());
+  }
+
+  std::shared_ptr<IBOObject> ibo;
+  if (iboIndex != 0)
+  {
+    ibo.reset(new IBOObject(iboIndex, iboSize, iboType));
+    if (clusters)
+    {
+      validateMeshClusters(*clusters, ibo->getNumElements());
+      ibo->setClusters(clusters);
+    }
+  }
+
+  if (vbo && mVBOMap.find(name) != mVBOMap.end())
+    throw Duplicate("Attempting to add duplicate VBO to object.");
+  if (ibo && mIBOMap.find(name) != mIBOMap.end())
+    throw Duplicate("Attempting to add duplicate IBO to object.");
+
+  std::lock_guard<std::mutex> lock(mBufferMutex);
+  if (vbo)
+    mVBOMap.insert(std::make_pair(name, vbo));
+  if (ibo)
+    mIBOMap.insert(std::make_pair(name, ibo));
 }
 
 //------------------------------------------------------------------------------
 void InterfaceImplementation::removeVBO(std::string vboName)
 {
+  std::lock_guard<std::mutex> lock(mBufferMutex);
   size_t numElementsRemoved = mVBOMap.erase(vboName);
   if (numElementsRemoved == 0)
     throw std::out_of_range("Could not find VBO to remove.");
 }
 
+//------------------------------------------------------------------------------
+void InterfaceImplementation::setVBOBounds(const std::string& vboName,
+                                           const V3& min, const V3& max)
+{
+  auto it = mVBOMap.find(vboName);
+  if (it == mVBOMap.end())
+    throw std::out_of_range("Could not find VBO.");
+  it->second->setBounds(min, max);
+}
+
+//------------------------------------------------------------------------------
+void InterfaceImplementation::setIBOClusters(
+    const std::string& iboName,
+    std::shared_ptr<const std::vector<MeshCluster>> clusters)
+{
+  auto it = mIBOMap.find(iboName);
+  if (it == mIBOMap.end())
+    throw std::out_of_range("Could not find IBO.");
+  if (clusters)
+    validateMeshClusters(*clusters, it->second->getNumElements());
+  it->second->setClusters(clusters);
+}
+
 //------------------------------------------------------------------------------
 void InterfaceImplementation::addIBO(std::string iboName,
                                      std::shared_ptr<std::vector<uint8_t>> iboData,
@@ -141,8 +267,9 @@ void InterfaceImplementation::addIBO(std::string iboName,
   if (mIBOMap.find(iboName) != mIBOMap.end())
     throw Duplicate("Attempting to add duplicate IBO to object.");
 
-  mIBOMap.insert(std::make_pair(
-          iboName, std::shared_ptr<IBOObject>(new IBOObject(iboData, type))));
+  std::shared_ptr<IBOObject> ibo(new IBOObject(iboData, type, mRetainMeshes));
+  std::lock_guard<std::mutex> lock(mBufferMutex);
+  mIBOMap.insert(std::make_pair(iboName, ibo));
 }
 
 //------------------------------------------------------------------------------
@@ -153,27 +280,230 @@ void InterfaceImplementation::addConcurrentIBO(
   if (mIBOMap.find(iboName) != mIBOMap.end())
     throw Duplicate("Attempting to add duplicate IBO to object.");
 
-  mIBOMap.insert(std::make_pair(
-          iboName, std::shared_ptr<IBOObject>(new IBOObject(iboData, iboSize, type))));
+  std::shared_ptr<IBOObject> ibo(
+      new IBOObject(iboData, iboSize, type, mRetainMeshes));
+  std::lock_guard<std::mutex> lock(mBufferMutex);
+  mIBOMap.insert(std::make_pair(iboName, ibo));
+}
+
+//------------------------------------------------------------------------------
+bool InterfaceImplementation::uploadMeshStream(
+    MeshStream& stream, const std::string& vboName, const std::string& iboName,
+    const std::vector<std::string>& attribNames)
+{
+  std::string error = stream.getError();
+  if (!error.empty())
+    throw std::runtime_error("Mesh stream failed: " + error);
+
+  AssetMeshLayout layout;
+  if (!stream.getLayout(layout))
+    return false;
+
+  size_t indexSize = (layout.numVertices <= 65536) ? sizeof(uint16_t)
+                                                   : sizeof(uint32_t);
+  if (!stream.buffersCreated)
+  {
+    // Allocate buffers for the whole mesh up front. Parts are written into
+    // them as they arrive and passes draw the prefix uploaded so far.
+    addConcurrentVBO(vboName, nullptr, layout.numVertices * layout.vertexSize(),
+                     attribNames, false);
+    addConcurrentIBO(iboName, nullptr, layout.numIndices * indexSize,
+                     (indexSize == sizeof(uint16_t)) ? Interface::IBO_16BIT
+                                                     : Interface::IBO_32BIT);
+    stream.vbo = mVBOMap.at(vboName);
+    stream.ibo = mIBOMap.at(iboName);
+    stream.ibo->setNumDrawElements(0);
+    stream.buffersCreated = true;
+  }
+
+  std::vector<AssetMeshPart> parts;
+  stream.takeParts(parts);
+  std::vector<uint8_t> packed;
+  for (auto it = parts.begin(); it != parts.end(); ++it)
+  {
+    if (!it->vbo.empty())
+      stream.vbo->updateData(it->firstVertex * layout.vertexSize(),
+                             &it->vbo[0], it->vbo.size());
+
+    packIndices(it->indices, indexSize, packed);
+    if (!packed.empty())
+      stream.ibo->updateData(it->firstIndex * indexSize, &packed[0], packed.size());
+
+    // Parts arrive in order, so everything up to here has been uploaded.
+    stream.ibo->setNumDrawElements(
+        static_cast<GLuint>(it->firstIndex + it->indices.size()));
+  }
+  if (!parts.empty())
+    stream.partsUploaded(parts);
+
+  // The passes hold on to the buffers from here on.
+  if (stream.isComplete())
+  {
+    stream.vbo.reset();
+    stream.ibo.reset();
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+void InterfaceImplementation::RenderTaskQueue::push(RenderTask task)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  mTasks.push_back(std::move(task));
+  if (mListener)
+    mListener();
+}
+
+//------------------------------------------------------------------------------
+void InterfaceImplementation::RenderTaskQueue::setPushListener(
+    std::function<void ()> listener)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  mListener = std::move(listener);
+}
+
+//------------------------------------------------------------------------------
+void InterfaceImplementation::RenderTaskQueue::takeAll(
+    std::vector<RenderTask>& tasks)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  tasks.swap(mTasks);
+  mTasks.clear();
+}
+
+//------------------------------------------------------------------------------
+size_t InterfaceImplementation::executeCommands()
+{
+  mCommandBatch.clear();
+  SceneCommand command;
+  while (mCommandBatch.size() < mCommands.capacity() && mCommands.pop(command))
+    mCommandBatch.push_back(command);
+  size_t numQueued = mCommandBatch.size();
+
+  coalesceSceneCommands(mCommandBatch, [this](const std::string& name)
+  {
+    return mScene.hasObject(name);
+  });
+
+  for (auto it = mCommandBatch.begin(); it != mCommandBatch.end(); ++it)
+  {
+    try
+    {
+      executeCommand(*it);
+    }
+    catch (const std::exception& e)
+    {
+      Log::error() << "Queued scene command failed: " << e.what() << std::endl;
+    }
+    delete[] it->data;
+  }
+
+  mFrameStats.numCommandsQueued = numQueued;
+  mFrameStats.numCommandsApplied = mCommandBatch.size();
+  mCommandBatch.clear();
+  return numQueued;
+}
+
+//------------------------------------------------------------------------------
+/// Builds the uniform state item carried by 'command'.
+static std::shared_ptr<AbstractUniformStateItem>
+makeCommandUniform(const SceneCommand& command)
+{
+  const float* v = command.values;
+  switch (command.uniformType)
+  {
+    case UNIFORM_FLOAT:
+      return std::make_shared<UniformStateItem<float>>(v[0]);
+    case UNIFORM_FLOAT_VEC2:
+      return std::make_shared<UniformStateItem<V2>>(V2(v[0], v[1]));
+    case UNIFORM_FLOAT_VEC3:
+      return std::make_shared<UniformStateItem<V3>>(V3(v[0], v[1], v[2]));
+    case UNIFORM_FLOAT_VEC4:
+      return std::make_shared<UniformStateItem<V4>>(V4(v[0], v[1], v[2], v[3]));
+    case UNIFORM_FLOAT_MAT4:
+      return std::make_shared<UniformStateItem<M44>>(
+          M44(V4(v[0], v[1], v[2], v[3]), V4(v[4], v[5], v[6], v[7]),
+              V4(v[8], v[9], v[10], v[11]), V4(v[12], v[13], v[14], v[15])));
+    default:
+      throw std::invalid_argument("Unsupported queued uniform type.");
+  }
+}
+
+//------------------------------------------------------------------------------
+void InterfaceImplementation::executeCommand(const SceneCommand& command)
+{
+  switch (command.type)
+  {
+    case SceneCommand::ADD_OBJECT:
+      addObject(command.object);
+      break;
+
+    case SceneCommand::REMOVE_OBJECT:
+      removeObject(command.object);
+      break;
+
+    case SceneCommand::UPDATE_VBO:
+      mVBOMap.at(command.name)->updateData(command.offset, command.data,
+                                           command.size);
+      break;
+
+    case SceneCommand::SET_OBJECT_PASS_UNIFORM:
+      addObjectPassUniformConcrete(command.object, command.name,
+                                   makeCommandUniform(command), command.pass);
+      break;
+
+    case SceneCommand::SET_OBJECT_GLOBAL_UNIFORM:
+      addObjectGlobalUniformConcrete(command.object, command.name,
+                                     makeCommandUniform(command));
+      break;
+
+    case SceneCommand::SET_GLOBAL_UNIFORM:
+      addGlobalUniformConcrete(command.name, makeCommandUniform(command));
+      break;
+  }
+}
+
+//------------------------------------------------------------------------------
+size_t InterfaceImplementation::runRenderTasks()
+{
+  std::vector<RenderTask> tasks;
+  mRenderTasks->takeAll(tasks);
+  for (auto it = tasks.begin(); it != tasks.end(); ++it)
+    (*it)(*this);
+  return tasks.size();
 }
 
 //------------------------------------------------------------------------------
 void InterfaceImplementation::removeIBO(std::string iboName)
 {
+  std::lock_guard<std::mutex> lock(mBufferMutex);
   size_t numElementsRemoved = mIBOMap.erase(iboName);
   if (numElementsRemoved == 0)
     throw std::out_of_range("Could not find IBO to remove.");
 }
 
+//------------------------------------------------------------------------------
+std::shared_ptr<VBOObject> InterfaceImplementation::findVBO(const std::string& name)
+{
+  std::lock_guard<std::mutex> lock(mBufferMutex);
+  return mVBOMap.at(name);
+}
+
+//------------------------------------------------------------------------------
+std::shared_ptr<IBOObject> InterfaceImplementation::findIBO(const std::string& name)
+{
+  std::lock_guard<std::mutex> lock(mBufferMutex);
+  return mIBOMap.at(name);
+}
+
 //------------------------------------------------------------------------------
 void InterfaceImplementation::addPassToObject(
     std::string object, std::string program, std::string vboName,
     std::string iboName, Interface::PRIMITIVE_TYPES type, std::string pass,
     std::string parentPass)
 {
-  std::shared_ptr<SpireObject> obj = mNameToObject.at(object);
-  std::shared_ptr<VBOObject> vbo = mVBOMap.at(vboName);
-  std::shared_ptr<IBOObject> ibo = mIBOMap.at(iboName);
+  std::shared_ptr<VBOObject> vbo = findVBO(vboName);
+  std::shared_ptr<IBOObject> ibo = findIBO(iboName);
 
   // The 'responsiblePass' must exist. It is under this pass in which objects
   // will be rendered.
@@ -181,15 +511,444 @@ void InterfaceImplementation::addPassToObject(
   if (parentPass.size() > 0)
     responsiblePass = parentPass;
 
-  obj->addPass(pass, program, vbo, ibo, getGLPrimitive(type), parentPass);
+  GLenum primitive = getGLPrimitive(type);
+  mScene.editObject(object, [&](SpireObject& obj)
+  {
+    obj.addPass(pass, program, vbo, ibo, primitive, parentPass);
+  });
 }
 
 
+//------------------------------------------------------------------------------
+void InterfaceImplementation::addPassLODToObject(
+    const std::string& object, const std::string& vboName,
+    const std::string& iboName, float geometricError, const std::string& pass)
+{
+  std::shared_ptr<VBOObject> vbo;
+  if (!vboName.empty())
+    vbo = findVBO(vboName);
+  std::shared_ptr<IBOObject> ibo = findIBO(iboName);
+
+  mScene.editObject(object, [&](SpireObject& obj)
+  {
+    obj.addPassLOD(pass, vbo, ibo, geometricError);
+  });
+}
+
 //------------------------------------------------------------------------------
 void InterfaceImplementation::removePassFromObject(std::string object, std::string pass)
 {
-  std::shared_ptr<SpireObject> obj = mNameToObject.at(object);
-  obj->removePass(pass);
+  mScene.editObject(object, [&pass](SpireObject& obj)
+  {
+    obj.removePass(pass);
+  });
+}
+
+//------------------------------------------------------------------------------
+void InterfaceImplementation::setObjectTransform(const std::string& object,
+                                                 const M44& transform)
+{
+  mScene.editObject(object, [&transform](SpireObject& obj)
+  {
+    obj.setTransform(transform);
+  });
+}
+
+//------------------------------------------------------------------------------
+void InterfaceImplementation::setObjectBounds(const std::string& object,
+                                              const V3& min, const V3& max)
+{
+  mScene.editObject(object, [&min, &max](SpireObject& obj)
+  {
+    obj.setBoundingBox(min, max);
+  });
+}
+
+//------------------------------------------------------------------------------
+void InterfaceImplementation::setObjectBounds(const std::string& object,
+                                              const V3& center, float radius)
+{
+  mScene.editObject(object, [&center, radius](SpireObject& obj)
+  {
+    obj.setBoundingSphere(center, radius);
+  });
+}
+
+//------------------------------------------------------------------------------
+void InterfaceImplementation::setObjectOccluder(const std::string& object,
+                                                bool occluder)
+{
+  mScene.editObject(object, [occluder](SpireObject& obj)
+  {
+    obj.setOccluder(occluder);
+  });
+}
+
+//------------------------------------------------------------------------------
+size_t InterfaceImplementation::prepareFrame(const M44& worldToProjection,
+                                             const std::vector<std::string>& passes)
+{
+  if (!mDoubleBuffered)
+    mScene.publish();
+  if (mOcclusionCulling)
+    mOcclusionQueries.readResults(mFramePrep);
+
+  if (mFrameManager.isEnabled())
+  {
+    // Detail and passes as picked from the frames before. The pixel error
+    // picks the levels of detail; small objects are only dropped once it
+    // is at its maximum.
+    mFrameManager.update();
+    float minPixels = std::max(mMinPixels, mFrameManager.getCullPixels());
+    float lodPixels = std::max(mLODPixels, mFrameManager.getPixelError());
+    if (minPixels != mAppliedMinPixels || lodPixels != mAppliedLODPixels)
+    {
+      GLint viewport[4];
+      GL(glGetIntegerv(GL_VIEWPORT, viewport));
+      float height = static_cast<float>(viewport[3]);
+      mFramePrep.setSmallFeatureCulling(
+          minPixels, mViewportHeight > 0.0f ? mViewportHeight : height);
+      mFramePrep.setLODPixelError(
+          lodPixels, mLODViewportHeight > 0.0f ? mLODViewportHeight : height);
+      mAppliedMinPixels = minPixels;
+      mAppliedLODPixels = lodPixels;
+    }
+    mFrameManager.selectPasses(passes, mFramePasses);
+
+    mFrameManager.startCPUTimer();
+    mFramePrep.prepare(mScene.getFront(), worldToProjection, mFramePasses);
+    mFrameManager.stopCPUTimer();
+  }
+  else
+  {
+    mFramePrep.prepare(mScene.getFront(), worldToProjection, passes);
+  }
+  {
+    std::lock_guard<std::mutex> lock(mPickMutex);
+    mPickView = worldToProjection;
+  }
+  return mFramePrep.getDrawList().size();
+}
+
+//------------------------------------------------------------------------------
+void InterfaceImplementation::setSmallFeatureCulling(float minPixels,
+                                                     float viewportHeight)
+{
+  mMinPixels = minPixels;
+  mViewportHeight = viewportHeight;
+  mAppliedMinPixels = minPixels;
+  mFramePrep.setSmallFeatureCulling(minPixels, viewportHeight);
+}
+
+//------------------------------------------------------------------------------
+void InterfaceImplementation::setLODPixelError(float maxPixels,
+                                               float viewportHeight)
+{
+  mLODPixels = maxPixels;
+  mLODViewportHeight = viewportHeight;
+  mAppliedLODPixels = maxPixels;
+  mFramePrep.setLODPixelError(maxPixels, viewportHeight);
+}
+
+//------------------------------------------------------------------------------
+void InterfaceImplementation::setTargetFrameTime(double milliseconds,
+                                                 float maxPixelError)
+{
+  mFrameManager.setTargetFrameTime(milliseconds, maxPixelError);
+  if (mFrameManager.isEnabled())
+    return;
+  if (mAppliedMinPixels != mMinPixels)
+  {
+    mFramePrep.setSmallFeatureCulling(mMinPixels, mViewportHeight);
+    mAppliedMinPixels = mMinPixels;
+  }
+  if (mAppliedLODPixels != mLODPixels)
+  {
+    mFramePrep.setLODPixelError(mLODPixels, mLODViewportHeight);
+    mAppliedLODPixels = mLODPixels;
+  }
+}
+
+//------------------------------------------------------------------------------
+Interface::FrameTiming InterfaceImplementation::getFrameTiming() const
+{
+  const FrameManager::FrameSample& sample = mFrameManager.getLastSample();
+  Interface::FrameTiming timing;
+  timing.cpuMs = sample.cpuMs;
+  timing.gpuMs = sample.gpuMs;
+  timing.predictedMs = mFrameManager.predictFrameTime(mFramePrep.getDrawList().size(),
+                                                      mFramePrep.getNumIndices());
+  timing.pixelError = mFrameManager.getPixelError();
+  timing.cullPixels = mFrameManager.getCullPixels();
+  timing.numSkippedPasses = mFrameManager.getNumSkippedPasses();
+  return timing;
+}
+
+//------------------------------------------------------------------------------
+void InterfaceImplementation::setOcclusionCulling(bool enabled)
+{
+#ifndef SPIRE_OCCLUSION_QUERIES
+  if (enabled)
+    throw UnsupportedException("Occlusion queries are not available on this platform.");
+#endif
+  mOcclusionCulling = enabled;
+  mFramePrep.setOcclusionCulling(enabled);
+  if (!enabled)
+    mOcclusionQueries.clear();
+}
+
+//------------------------------------------------------------------------------
+void InterfaceImplementation::renderPreparedFrame()
+{
+  bool timed = mFrameManager.isEnabled();
+  if (timed)
+  {
+    mFrameManager.startCPUTimer();
+    mFrameManager.startGPUTimer();
+  }
+
+  // Record on the pool, then replay here, on the thread owning the context.
+  try
+  {
+    recordCommandLists(mFramePrep.getDrawList(), mCommandLists);
+
+    GLCommandBackend backend;
+    for (auto it = mCommandLists.begin(); it != mCommandLists.end(); ++it)
+      replayCommandList(*it, backend);
+    backend.finish();
+  }
+  catch (...)
+  {
+    mFrameManager.stopGPUTimer();
+    mFrameManager.stopCPUTimer();
+    throw;
+  }
+
+  if (timed)
+    mFrameManager.endFrame(mFramePrep.getDrawList().size(),
+                           mFramePrep.getNumIndices());
+
+  // Against the depth buffer of the frame just drawn.
+  if (mOcclusionCulling)
+    mOcclusionQueries.issueQueries(mFramePrep);
+}
+
+//------------------------------------------------------------------------------
+void InterfaceImplementation::updateBVH()
+{
+  mScene.readLatest([this](const SceneVersion& latest)
+  {
+    mBVH.update(latest);
+  });
+}
+
+//------------------------------------------------------------------------------
+std::vector<std::string>
+InterfaceImplementation::queryObjectsInBox(const V3& min, const V3& max)
+{
+  std::vector<std::string> objects;
+  std::lock_guard<std::mutex> lock(mBVHMutex);
+  updateBVH();
+  mBVH.queryBox(min, max, objects);
+  return objects;
+}
+
+//------------------------------------------------------------------------------
+std::vector<std::string>
+InterfaceImplementation::queryObjectsInFrustum(const M44& worldToProjection)
+{
+  std::vector<std::string> objects;
+  std::lock_guard<std::mutex> lock(mBVHMutex);
+  updateBVH();
+  mBVH.queryFrustum(worldToProjection, objects);
+  return objects;
+}
+
+//------------------------------------------------------------------------------
+std::vector<std::string>
+InterfaceImplementation::queryObjectsOnRay(const V3& origin, const V3& direction,
+                                           std::vector<float>* distances)
+{
+  std::vector<RayHit> hits;
+  {
+    std::lock_guard<std::mutex> lock(mBVHMutex);
+    updateBVH();
+    mBVH.queryRay(origin, direction, hits);
+  }
+
+  std::vector<std::string> objects;
+  objects.reserve(hits.size());
+  if (distances)
+    distances->clear();
+  for (auto it = hits.begin(); it != hits.end(); ++it)
+  {
+    objects.push_back(it->object);
+    if (distances)
+      distances->push_back(it->distance);
+  }
+  return objects;
+}
+
+//------------------------------------------------------------------------------
+Interface::PickResult InterfaceImplementation::pick(float x, float y)
+{
+  M44 worldToProjection;
+  {
+    std::lock_guard<std::mutex> lock(mPickMutex);
+    worldToProjection = mPickView;
+  }
+  M44 projectionToWorld = glm::inverse(worldToProjection);
+  V4 near = projectionToWorld * V4(x, y, -1.0f, 1.0f);
+  V4 far = projectionToWorld * V4(x, y, 1.0f, 1.0f);
+  V3 origin = V3(near) / near.w;
+  return pickRay(origin, V3(far) / far.w - origin);
+}
+
+//------------------------------------------------------------------------------
+Interface::PickResult InterfaceImplementation::pickRay(const V3& origin,
+                                                       const V3& direction)
+{
+  std::vector<RayHit> candidates;
+  {
+    std::lock_guard<std::mutex> lock(mBVHMutex);
+    updateBVH();
+    mBVH.queryRay(origin, direction, candidates);
+  }
+
+  // Gather the retained meshes of the candidates. Only CPU data outlives the
+  // read of the scene.
+  struct PassMesh
+  {
+    std::string                                   pass;
+    std::shared_ptr<const std::vector<V3>>        positions;
+    std::shared_ptr<const std::vector<uint32_t>>  indices;
+    GLenum                                        primitive;
+  };
+  struct Target
+  {
+    M44                     objectToWorld;
+    std::vector<PassMesh>   meshes;
+  };
+  std::vector<Target> targets(candidates.size());
+  mScene.readLatest([&](const SceneVersion& latest)
+  {
+    std::vector<const ObjectPass*> passes;
+    for (size_t i = 0; i < candidates.size(); ++i)
+    {
+      const std::string& name = candidates[i].object;
+      const SceneVersion::Shard& shard =
+          *latest.shards[SceneVersion::getShardIndex(name)];
+      auto found = shard.find(name);
+      if (found == shard.end())
+        continue;
+
+      targets[i].objectToWorld = found->second->getTransform();
+      passes.clear();
+      found->second->getPasses(passes);
+      for (auto it = passes.begin(); it != passes.end(); ++it)
+      {
+        const ObjectPass& pass = **it;
+        if (pass.getVBO() == nullptr || pass.getIBO() == nullptr)
+          continue;
+        PassMesh mesh;
+        mesh.pass = pass.getName();
+        mesh.positions = pass.getVBO()->getRetainedPositions();
+        mesh.indices = pass.getIBO()->getRetainedIndices();
+        mesh.primitive = pass.getPrimitiveType();
+        if (   mesh.positions != nullptr && mesh.indices != nullptr
+            && TriangleBVH::getNumTriangles(mesh.indices->size(), mesh.primitive) > 0)
+          targets[i].meshes.push_back(mesh);
+      }
+    }
+  });
+
+  // Candidates come sorted by where the ray enters their bounds, so the
+  // search ends at the first one entered beyond the nearest hit.
+  Interface::PickResult result;
+  float nearest = std::numeric_limits<float>::infinity();
+  for (size_t i = 0; i < candidates.size() && !(candidates[i].distance > nearest); ++i)
+  {
+    if (targets[i].meshes.empty())
+      continue;
+
+    // Affine transforms keep the ray parameter.
+    M44 worldToObject = glm::inverse(targets[i].objectToWorld);
+    V3 objectOrigin = V3(worldToObject * V4(origin, 1.0f));
+    V3 objectDirection = V3(worldToObject * V4(direction, 0.0f));
+    for (auto it = targets[i].meshes.begin(); it != targets[i].meshes.end(); ++it)
+    {
+      // Until the BVH is built, the triangles are tested one by one.
+      TriangleHit hit;
+      std::shared_ptr<const TriangleBVH> bvh =
+          getTriangleBVH(it->positions, it->indices, it->primitive);
+      bool found = bvh != nullptr ?
+          bvh->intersect(objectOrigin, objectDirection, nearest, hit) :
+          TriangleBVH::intersectMesh(*it->positions, *it->indices, it->primitive,
+                                     objectOrigin, objectDirection, nearest, hit);
+      if (!found)
+        continue;
+
+      nearest = hit.distance;
+      result.hit = true;
+      result.object = candidates[i].object;
+      result.pass = it->pass;
+      result.triangle = hit.triangle;
+      std::copy(hit.vertices, hit.vertices + 3, result.vertices);
+      result.barycentric = hit.barycentric;
+      result.distance = hit.distance;
+    }
+  }
+  if (result.hit)
+    result.position = origin + direction * result.distance;
+  return result;
+}
+
+//------------------------------------------------------------------------------
+std::shared_ptr<const TriangleBVH> InterfaceImplementation::getTriangleBVH(
+    const std::shared_ptr<const std::vector<V3>>& positions,
+    const std::shared_ptr<const std::vector<uint32_t>>& indices,
+    GLenum primitive)
+{
+  std::shared_future<std::shared_ptr<const TriangleBVH>> bvh;
+  {
+    std::lock_guard<std::mutex> lock(mPickMutex);
+    PickMeshKey key(positions.get(), indices.get(), primitive);
+    auto found = mPickMeshes.find(key);
+    if (   found != mPickMeshes.end()
+        && !found->second.positions.owner_before(positions)
+        && !positions.owner_before(found->second.positions)
+        && !found->second.indices.owner_before(indices)
+        && !indices.owner_before(found->second.indices))
+    {
+      bvh = found->second.bvh;
+    }
+    else
+    {
+      // Forget the meshes whose data was released.
+      for (auto it = mPickMeshes.begin(); it != mPickMeshes.end();)
+      {
+        if (it->second.positions.expired() || it->second.indices.expired())
+          it = mPickMeshes.erase(it);
+        else
+          ++it;
+      }
+
+      PickMesh mesh;
+      mesh.positions = positions;
+      mesh.indices = indices;
+      mesh.bvh = ThreadPool::getShared()->async([positions, indices, primitive]()
+      {
+        return std::shared_ptr<const TriangleBVH>(
+            new TriangleBVH(*positions, indices, primitive));
+      }).share();
+      mPickMeshes[key] = mesh;
+      bvh = mesh.bvh;
+    }
+  }
+
+  if (bvh.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+    return nullptr;
+  return bvh.get();
 }
 
 //------------------------------------------------------------------------------
@@ -197,8 +956,10 @@ void InterfaceImplementation::addObjectPassUniformConcrete(std::string object, s
                                                            std::shared_ptr<AbstractUniformStateItem> item,
                                                            std::string pass)
 {
-  std::shared_ptr<SpireObject> obj = mNameToObject.at(object);
-  obj->addPassUniform(pass, uniformName, item);
+  mScene.editObject(object, [&](SpireObject& obj)
+  {
+    obj.addPassUniform(pass, uniformName, item);
+  });
 }
 
 //------------------------------------------------------------------------------
@@ -206,8 +967,10 @@ void InterfaceImplementation::addObjectGlobalUniformConcrete(std::string objectN
                                                              std::string uniformName,
                                                              std::shared_ptr<AbstractUniformStateItem> item)
 {
-  std::shared_ptr<SpireObject> obj = mNameToObject.at(objectName);
-  obj->addGlobalUniform(uniformName, item);
+  mScene.editObject(objectName, [&](SpireObject& obj)
+  {
+    obj.addGlobalUniform(uniformName, item);
+  });
 }
 
 
@@ -217,6 +980,7 @@ void InterfaceImplementation::addGlobalUniformConcrete(std::string uniformName,
 {
   // Access uniform state manager and apply/update uniform value.
   mHub.getGlobalUniformStateMan().updateGlobalUniform(uniformName, item);
+  mScene.setGlobalUniform(uniformName, item);
 }
 
 //------------------------------------------------------------------------------
@@ -322,9 +1086,8 @@ GLenum InterfaceImplementation::getGLType(Interface::DATA_TYPES type)
 #ifdef SPIRE_OPENGL_ES_2
     case Interface::TYPE_HALFFLOAT:   return GL_HALF_FLOAT_OES;
 #else
-    case Interface::TYPE_HALFFLOAT:
-      Log::error() << "Half-float not supported on non-ES platforms.";
-      return GL_FLOAT;
+    // Core as of OpenGL 3.0 (ARB_half_float_vertex before that).
+    case Interface::TYPE_HALFFLOAT:   return GL_HALF_FLOAT;
 #endif
 
     // Double type not sepported in OpenGL ES 2.0.
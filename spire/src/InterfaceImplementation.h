@@ -32,6 +32,8 @@
 #ifndef SPIRE_HIGH_INTERFACEIMPLEMENTATION_H
 #define SPIRE_HIGH_INTERFACEIMPLEMENTATION_H
 
+#include <atomic>
+#include <future>
 #include <memory>
 #include <utility>
 #include <vector>
@@ -41,7 +43,18 @@
 #include <map>
 #include <tuple>
 #include <cstdint>
+#include <functional>
+#include <mutex>
 #include "Common.h"
+#include "CommandList.h"
+#include "FrameManager.h"
+#include "FramePrep.h"
+#include "OcclusionQueries.h"
+#include "MPSCQueue.h"
+#include "SceneBVH.h"
+#include "SceneBuffer.h"
+#include "TriangleBVH.h"
+#include "SceneCommand.h"
 
 #include "ThreadMessage.h"
 
@@ -52,14 +65,15 @@ class SpireObject;
 class ShaderProgramAsset;
 class VBOObject;
 class IBOObject;
+class MeshStream;
 
 /// Implementation of the functions exposed in Interface.h
-/// All functions in this class are not thread safe.
+/// Functions are not thread safe unless noted otherwise.
 class InterfaceImplementation
 {
 public:
   InterfaceImplementation(Hub& hub);
-  virtual ~InterfaceImplementation()  {}
+  virtual ~InterfaceImplementation();
   
   //============================================================================
   // IMPLEMENTATION
@@ -67,11 +81,25 @@ public:
   /// Cleans up all GL resources.
   void clearGLResources();
 
-  /// Retrieves number of objects.
-  size_t getNumObjects()      {return mNameToObject.size();}
+  /// Retrieves number of objects. Thread safe and lock-free.
+  size_t getNumObjects()      {return mScene.getNumObjects();}
 
-  /// Retrieves the object with the specified name.
-  std::shared_ptr<SpireObject> getObjectWithName(const std::string& name) const;
+  /// Retrieves the object with the specified name, with all edits made so
+  /// far. Thread safe and lock-free.
+  std::shared_ptr<const SpireObject> getObjectWithName(const std::string& name) const;
+
+  /// Retrieves the value of a global uniform. Thread safe and lock-free.
+  std::shared_ptr<const AbstractUniformStateItem>
+      getGlobalUniform(const std::string& name) const;
+
+  /// Retrieves the object with the specified name as it is to be rendered:
+  /// from the scene published by the last publishScene. Until publishScene
+  /// is first called, edits are published immediately instead.
+  std::shared_ptr<const SpireObject> getRenderObject(const std::string& name);
+
+  /// Publishes the edited scene for rendering (see SceneBuffer::publish) and
+  /// switches to double buffering. Render thread only.
+  void publishScene();
 
   /// Retrieves appropriate primitive type GLenum from Interface primitives.
   static GLenum getGLPrimitive(Interface::PRIMITIVE_TYPES type);
@@ -81,12 +109,75 @@ public:
 
   void addConcurrentVBO(const std::string& vboName,
                         const uint8_t* vboData, size_t vboSize,
-                        const std::vector<std::string>& attribNames);
+                        const std::vector<std::string>& attribNames,
+                        bool narrowDoubles);
 
   void addConcurrentIBO(const std::string& iboName,
                         const uint8_t* iboData, size_t iboSize,
                         Interface::IBO_TYPE type);
 
+  /// Adds the buffer objects of an asynchronous upload (see GLUploader).
+  /// 'vboIndex' and 'iboIndex' were created by GLUploader::createBuffer; 0
+  /// skips the respective buffer. Ownership of both buffer objects is taken
+  /// even when throwing, nothing is added if either name is taken. The
+  /// bounds of the VBO are computed from 'vboData' if given.
+  void addUploadedBuffers(const std::string& name, GLuint vboIndex,
+                          const std::vector<std::string>& attribNames,
+                          GLuint iboIndex, size_t iboSize,
+                          Interface::IBO_TYPE iboType,
+                          const std::vector<uint8_t>* vboData = nullptr,
+                          std::shared_ptr<const std::vector<MeshCluster>> clusters
+                              = std::shared_ptr<const std::vector<MeshCluster>>());
+
+  /// See Interface::uploadMeshStream.
+  bool uploadMeshStream(MeshStream& stream, const std::string& vboName,
+                        const std::string& iboName,
+                        const std::vector<std::string>& attribNames);
+
+  /// Work handed to the render thread from other threads.
+  typedef std::function<void (InterfaceImplementation& impl)> RenderTask;
+
+  /// Thread safe queue of render tasks. Held through a shared_ptr so that
+  /// background tasks can outlive the interface; tasks still queued when the
+  /// interface goes away are destroyed without running.
+  class RenderTaskQueue
+  {
+  public:
+    void push(RenderTask task);
+    void takeAll(std::vector<RenderTask>& tasks);
+
+    /// 'listener' is called after every push, from the pushing thread.
+    void setPushListener(std::function<void ()> listener);
+
+  private:
+    std::mutex              mMutex;
+    std::vector<RenderTask> mTasks;
+    std::function<void ()>  mListener;
+  };
+
+  /// Queue used by background loaders to reach the render thread.
+  std::shared_ptr<RenderTaskQueue> getRenderTaskQueue() {return mRenderTasks;}
+
+  /// Queues a scene edit for executeCommands. Thread safe and lock-free.
+  /// \return False if the queue is full, in which case the caller keeps
+  ///         ownership of the command's data.
+  bool queueCommand(const SceneCommand& command) {return mCommands.push(command);}
+
+  /// Applies queued scene edits in order. Render thread only. Stops after one
+  /// queue's worth of commands so busy producers cannot stall a frame.
+  /// Redundant commands are coalesced away first (see coalesceSceneCommands).
+  /// Commands that fail are logged and dropped. Updates the command counts of
+  /// the frame statistics.
+  /// \return Number of commands taken off the queue.
+  size_t executeCommands();
+
+  /// Statistics of the last frame.
+  const Interface::FrameStatistics& getFrameStatistics() const {return mFrameStats;}
+
+  /// Runs all queued render tasks. Render thread only.
+  /// \return Number of tasks run.
+  size_t runRenderTasks();
+
   //============================================================================
   // CALLBACK IMPLEMENTATION -- Called from interface or a derived class.
   //============================================================================
@@ -100,8 +191,12 @@ public:
   void removeAllObjects();
   void addVBO(std::string vboName,
               std::shared_ptr<std::vector<uint8_t>> vboData,
-              std::vector<std::string> attribNames);
+              std::vector<std::string> attribNames,
+              bool narrowDoubles);
   void removeVBO(std::string vboName);
+  void setVBOBounds(const std::string& vboName, const V3& min, const V3& max);
+  void setIBOClusters(const std::string& iboName,
+                      std::shared_ptr<const std::vector<MeshCluster>> clusters);
   void addIBO(std::string iboName,
                      std::shared_ptr<std::vector<uint8_t>> iboData,
                      Interface::IBO_TYPE type);
@@ -112,6 +207,93 @@ public:
                               std::string pass, std::string parentPass);
   void removePassFromObject(std::string object,
                                    std::string pass);
+  void addPassLODToObject(const std::string& object, const std::string& vboName,
+                          const std::string& iboName, float geometricError,
+                          const std::string& pass);
+  void setObjectTransform(const std::string& object, const M44& transform);
+  void setObjectBounds(const std::string& object, const V3& min,
+                       const V3& max);
+  void setObjectBounds(const std::string& object, const V3& center,
+                       float radius);
+  void setObjectOccluder(const std::string& object, bool occluder);
+
+  //-------------------
+  // Frame preparation
+  //-------------------
+
+  /// See Interface::prepareFrame. Render thread only.
+  size_t prepareFrame(const M44& worldToProjection,
+                      const std::vector<std::string>& passes);
+
+  /// See Interface::setSmallFeatureCulling. Render thread only.
+  void setSmallFeatureCulling(float minPixels, float viewportHeight);
+
+  /// See Interface::setLODPixelError. Render thread only.
+  void setLODPixelError(float maxPixels, float viewportHeight);
+
+  /// See Interface::getNumCoarseDraws. Render thread only.
+  size_t getNumCoarseDraws() const      {return mFramePrep.getNumCoarseDraws();}
+
+  /// See Interface::setOcclusionCulling. Render thread only.
+  void setOcclusionCulling(bool enabled);
+
+  /// See Interface::setSoftwareOcclusionCulling. Render thread only.
+  void setSoftwareOcclusionCulling(bool enabled)
+  {mFramePrep.setSoftwareOcclusionCulling(enabled);}
+
+  /// See Interface::getNumOccluders. Render thread only.
+  size_t getNumOccluders() const        {return mFramePrep.getNumOccluders();}
+
+  /// See Interface::setClusterCulling. Render thread only.
+  void setClusterCulling(bool enabled, bool backFaces)
+  {mFramePrep.setClusterCulling(enabled, backFaces);}
+
+  /// See Interface::getNumClustersCulled. Render thread only.
+  size_t getNumClustersCulled() const   {return mFramePrep.getNumClustersCulled();}
+
+  /// See Interface::getNumOccludedObjects. Render thread only.
+  size_t getNumOccludedObjects() const  {return mFramePrep.getNumOccludedObjects();}
+
+  /// See Interface::renderPreparedFrame. Render thread only.
+  void renderPreparedFrame();
+
+  /// See Interface::setTargetFrameTime. Render thread only.
+  void setTargetFrameTime(double milliseconds, float maxPixelError);
+
+  /// See Interface::setOptionalPasses. Render thread only.
+  void setOptionalPasses(const std::vector<std::string>& passes)
+  {mFrameManager.setOptionalPasses(passes);}
+
+  /// See Interface::getFrameTiming. Render thread only.
+  Interface::FrameTiming getFrameTiming() const;
+
+  //-----------------
+  // Spatial queries
+  //-----------------
+
+  /// See Interface::queryObjectsInBox. Thread safe.
+  std::vector<std::string> queryObjectsInBox(const V3& min, const V3& max);
+
+  /// See Interface::queryObjectsInFrustum. Thread safe.
+  std::vector<std::string> queryObjectsInFrustum(const M44& worldToProjection);
+
+  /// See Interface::queryObjectsOnRay. Thread safe.
+  std::vector<std::string> queryObjectsOnRay(const V3& origin,
+                                             const V3& direction,
+                                             std::vector<float>* distances);
+
+  //---------
+  // Picking
+  //---------
+
+  /// See Interface::setMeshRetention. Thread safe.
+  void setMeshRetention(bool retain)    {mRetainMeshes = retain;}
+
+  /// See Interface::pick. Thread safe.
+  Interface::PickResult pick(float x, float y);
+
+  /// See Interface::pickRay. Thread safe.
+  Interface::PickResult pickRay(const V3& origin, const V3& direction);
 
   //----------
   // Uniforms
@@ -142,8 +324,78 @@ public:
 
 private:
 
-  /// This unordered map is a 1-1 mapping of object names onto objects.
-  std::unordered_map<std::string, std::shared_ptr<SpireObject>>   mNameToObject;
+  void executeCommand(const SceneCommand& command);
+
+  /// Buffer named 'name', under mBufferMutex. Thread safe.
+  /// Throws std::out_of_range if there is none.
+  std::shared_ptr<VBOObject> findVBO(const std::string& name);
+  std::shared_ptr<IBOObject> findIBO(const std::string& name);
+
+  /// Brings mBVH up to date with the latest scene. mBVHMutex must be held.
+  void updateBVH();
+
+  /// Triangle BVH of the retained mesh 'positions' / 'indices' drawn as
+  /// 'primitive'. Built on the shared thread pool the first time it is
+  /// asked for; null until the build is done.
+  std::shared_ptr<const TriangleBVH> getTriangleBVH(
+      const std::shared_ptr<const std::vector<V3>>& positions,
+      const std::shared_ptr<const std::vector<uint32_t>>& indices,
+      GLenum primitive);
+
+  /// Mapping of object names onto objects, double buffered.
+  SceneBuffer                                                     mScene;
+
+  /// False until the first publishScene; renders publish edits themselves
+  /// until then.
+  bool                                                            mDoubleBuffered;
+
+  /// Keep CPU copies of VBO positions and IBO indices (setMeshRetention).
+  std::atomic<bool>                                               mRetainMeshes;
+
+  /// Draw list of the last prepareFrame.
+  FramePrep                                                       mFramePrep;
+
+  /// Frame time control (setTargetFrameTime). It raises the small feature
+  /// culling and LOD pixel error asked for with setSmallFeatureCulling and
+  /// setLODPixelError, and removes skipped passes from those given to
+  /// prepareFrame.
+  FrameManager                                                    mFrameManager;
+  float                                                           mMinPixels;
+  float                                                           mViewportHeight;
+  float                                                           mAppliedMinPixels;
+  float                                                           mLODPixels;
+  float                                                           mLODViewportHeight;
+  float                                                           mAppliedLODPixels;
+  std::vector<std::string>                                        mFramePasses;
+
+  /// Occlusion culling (setOcclusionCulling) and its queries in flight.
+  bool                                                            mOcclusionCulling;
+  OcclusionQueries                                                mOcclusionQueries;
+
+  /// Spatial index of the scene for the query functions, updated by them
+  /// and guarded by mBVHMutex.
+  std::mutex                                                      mBVHMutex;
+  SceneBVH                                                        mBVH;
+
+  /// Triangle BVH of a retained mesh. The weak pointers tell whether the
+  /// key still refers to the same data.
+  struct PickMesh
+  {
+    std::weak_ptr<const std::vector<V3>>                    positions;
+    std::weak_ptr<const std::vector<uint32_t>>              indices;
+    std::shared_future<std::shared_ptr<const TriangleBVH>>  bvh;
+  };
+  typedef std::tuple<const void*, const void*, GLenum>    PickMeshKey;
+
+  /// Meshes picked so far and the view of the last prepareFrame, guarded by
+  /// mPickMutex.
+  std::mutex                                                      mPickMutex;
+  std::map<PickMeshKey, PickMesh>                                 mPickMeshes;
+  M44                                                             mPickView;
+
+  /// Commands recorded from the draw list by renderPreparedFrame. Kept to
+  /// reuse their storage.
+  std::vector<CommandList>                                        mCommandLists;
 
   /// List of shaders that are stored persistently by this pipe (will never
   /// be GC'ed unless this pipe is destroyed).
@@ -155,6 +407,22 @@ private:
   /// IBO names to our representation of an index buffer object.
   std::unordered_map<std::string, std::shared_ptr<IBOObject>>     mIBOMap;
 
+  /// Guards mVBOMap and mIBOMap. Only the render thread changes them, so it
+  /// reads them without the lock; passes resolve buffer names from any
+  /// thread through findVBO / findIBO.
+  std::mutex                                                      mBufferMutex;
+
+  /// Tasks queued for the render thread by background loaders.
+  std::shared_ptr<RenderTaskQueue>                                mRenderTasks;
+
+  /// Scene edits queued from any thread.
+  BoundedMPSCQueue<SceneCommand>                                  mCommands;
+
+  /// Commands taken off mCommands for coalescing. Kept to reuse its memory.
+  std::vector<SceneCommand>                                       mCommandBatch;
+
+  Interface::FrameStatistics                                      mFrameStats;
+
 private:
 
   Hub&            mHub;
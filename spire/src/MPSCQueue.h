@@ -0,0 +1,134 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef SPIRE_HIGH_MPSCQUEUE_H
+#define SPIRE_HIGH_MPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace CPM_SPIRE_NS {
+
+/// Bounded lock-free queue with any number of producers and a single
+/// consumer. Every cell carries a sequence number telling producers and the
+/// consumer whose turn it is, so neither side ever blocks the other (see
+/// Dmitry Vyukov's bounded MPMC queue). T should be cheap to copy; the queue
+/// does not allocate after construction.
+template <typename T>
+class BoundedMPSCQueue
+{
+public:
+  /// 'capacity' is rounded up to a power of two.
+  explicit BoundedMPSCQueue(size_t capacity) :
+      mEnqueuePos(0),
+      mDequeuePos(0)
+  {
+    size_t size = 2;
+    while (size < capacity)
+      size *= 2;
+    mMask = size - 1;
+
+    mCells.reset(new Cell[size]);
+    for (size_t i = 0; i < size; ++i)
+      mCells[i].sequence.store(i, std::memory_order_relaxed);
+  }
+
+  size_t capacity() const   {return mMask + 1;}
+
+  /// Appends 'value'. Thread safe.
+  /// \return False if the queue is full.
+  bool push(const T& value)
+  {
+    size_t pos = mEnqueuePos.load(std::memory_order_relaxed);
+    Cell* cell;
+    for (;;)
+    {
+      cell = &mCells[pos & mMask];
+      size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      if (sequence == pos)
+      {
+        if (mEnqueuePos.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed))
+          break;
+      }
+      else if (sequence < pos)
+      {
+        // The consumer has not released the cell from the previous lap.
+        return false;
+      }
+      else
+      {
+        pos = mEnqueuePos.load(std::memory_order_relaxed);
+      }
+    }
+
+    cell->value = value;
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Removes the oldest value. Must only be called from one thread at a time.
+  /// \return False if the queue is empty (or the oldest value is still being
+  ///         written by its producer).
+  bool pop(T& value)
+  {
+    Cell& cell = mCells[mDequeuePos & mMask];
+    if (cell.sequence.load(std::memory_order_acquire) != mDequeuePos + 1)
+      return false;
+
+    value = cell.value;
+    cell.sequence.store(mDequeuePos + mMask + 1, std::memory_order_release);
+    ++mDequeuePos;
+    return true;
+  }
+
+private:
+  BoundedMPSCQueue(const BoundedMPSCQueue&);
+  BoundedMPSCQueue& operator=(const BoundedMPSCQueue&);
+
+  struct Cell
+  {
+    std::atomic<size_t> sequence;
+    T                   value;
+  };
+
+  std::unique_ptr<Cell[]> mCells;
+  size_t                  mMask;
+
+  // Producers and the consumer write different positions; keep them on
+  // different cache lines.
+  char                    mPad0[64];
+  std::atomic<size_t>     mEnqueuePos;
+  char                    mPad1[64];
+  size_t                  mDequeuePos;  ///< Only touched by the consumer.
+};
+
+} // namespace CPM_SPIRE_NS
+
+#endif
@@ -0,0 +1,281 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include "MeshClusters.h"
+#include "Parallel.h"
+
+namespace CPM_SPIRE_NS {
+
+namespace {
+
+/// Clusters whose bounds are computed by one task.
+const size_t CLUSTERS_PER_TASK = 256;
+
+/// Normal cones wider than this (cosine of the half angle) are not worth
+/// testing: they only cull from a narrow range of directions.
+const float MIN_CONE_COSINE = 0.1f;
+
+void readPosition(const uint8_t* vbo, size_t stride, size_t positionOffset,
+                  uint32_t vertex, float* out)
+{
+  std::memcpy(out, vbo + static_cast<size_t>(vertex) * stride + positionOffset,
+              sizeof(float) * 3);
+}
+
+/// Unit normal of triangle 'tri' (counter clockwise is front facing).
+/// \return False for degenerate triangles.
+bool getFaceNormal(const uint8_t* vbo, size_t stride, size_t positionOffset,
+                   const uint32_t* tri, float n[3])
+{
+  float p[3][3];
+  for (int v = 0; v < 3; ++v)
+    readPosition(vbo, stride, positionOffset, tri[v], p[v]);
+  float e1[3] = {p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2]};
+  float e2[3] = {p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2]};
+  n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+  n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+  n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+  float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+  if (!(length > 0.0f))
+    return false;
+  for (int i = 0; i < 3; ++i)
+    n[i] /= length;
+  return true;
+}
+
+/// Spreads the low 10 bits of 'v' out to every third bit.
+uint32_t spreadBits(uint32_t v)
+{
+  v &= 0x3FF;
+  v = (v | (v << 16)) & 0x030000FF;
+  v = (v | (v <<  8)) & 0x0300F00F;
+  v = (v | (v <<  4)) & 0x030C30C3;
+  v = (v | (v <<  2)) & 0x09249249;
+  return v;
+}
+
+} // namespace
+
+//------------------------------------------------------------------------------
+void computeClusterBounds(const uint8_t* vbo, size_t stride,
+                          size_t positionOffset, const uint32_t* indices,
+                          MeshCluster& cluster)
+{
+  const uint32_t* begin = indices + cluster.firstIndex;
+  const uint32_t* end = begin + cluster.numIndices;
+
+  float min[3] = { std::numeric_limits<float>::max(),
+                   std::numeric_limits<float>::max(),
+                   std::numeric_limits<float>::max() };
+  float max[3] = { -std::numeric_limits<float>::max(),
+                   -std::numeric_limits<float>::max(),
+                   -std::numeric_limits<float>::max() };
+  float axis[3] = {0.0f, 0.0f, 0.0f};
+  for (const uint32_t* tri = begin; tri != end; tri += 3)
+  {
+    for (int v = 0; v < 3; ++v)
+    {
+      float p[3];
+      readPosition(vbo, stride, positionOffset, tri[v], p);
+      for (int i = 0; i < 3; ++i)
+      {
+        min[i] = std::min(min[i], p[i]);
+        max[i] = std::max(max[i], p[i]);
+      }
+    }
+
+    // Unit face normals, so that small triangles count as much as large
+    // ones: all of them have to face away for the cluster to.
+    float n[3];
+    if (getFaceNormal(vbo, stride, positionOffset, tri, n))
+    {
+      for (int i = 0; i < 3; ++i)
+        axis[i] += n[i];
+    }
+  }
+
+  float radius = 0.0f;
+  for (int i = 0; i < 3; ++i)
+    cluster.center[i] = (min[i] + max[i]) * 0.5f;
+  for (const uint32_t* idx = begin; idx != end; ++idx)
+  {
+    float p[3];
+    readPosition(vbo, stride, positionOffset, *idx, p);
+    float dx = p[0] - cluster.center[0];
+    float dy = p[1] - cluster.center[1];
+    float dz = p[2] - cluster.center[2];
+    radius = std::max(radius, dx * dx + dy * dy + dz * dz);
+  }
+  cluster.radius = std::sqrt(radius);
+
+  // The cone is bounded by the face normal furthest from the axis.
+  float axisLength = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+  float minDot = -1.0f;
+  if (axisLength > 0.0f)
+  {
+    for (int i = 0; i < 3; ++i)
+      axis[i] /= axisLength;
+    minDot = 1.0f;
+    for (const uint32_t* tri = begin; tri != end; tri += 3)
+    {
+      float n[3];
+      if (getFaceNormal(vbo, stride, positionOffset, tri, n))
+        minDot = std::min(minDot, n[0] * axis[0] + n[1] * axis[1] + n[2] * axis[2]);
+    }
+  }
+
+  std::copy(axis, axis + 3, cluster.coneAxis);
+  if (minDot < MIN_CONE_COSINE)
+    cluster.coneCutoff = 1.0f;
+  else
+    cluster.coneCutoff = std::sqrt(std::max(0.0f, 1.0f - minDot * minDot));
+}
+
+//------------------------------------------------------------------------------
+void buildMeshClusters(const uint8_t* vbo, size_t stride, size_t positionOffset,
+                       size_t numVertices, std::vector<uint32_t>& indices,
+                       std::vector<MeshCluster>& clusters,
+                       size_t trianglesPerCluster)
+{
+  if (indices.size() % 3 != 0)
+    throw std::invalid_argument("Index buffer is not a triangle list.");
+  if (trianglesPerCluster == 0)
+    throw std::invalid_argument("Clusters need at least one triangle.");
+  for (auto it = indices.begin(); it != indices.end(); ++it)
+  {
+    if (*it >= numVertices)
+      throw std::out_of_range("Index references a vertex outside of the VBO.");
+  }
+
+  size_t numTriangles = indices.size() / 3;
+  if (numTriangles > std::numeric_limits<uint32_t>::max())
+    throw std::invalid_argument("Too many triangles to cluster.");
+
+  float min[3] = { std::numeric_limits<float>::max(),
+                   std::numeric_limits<float>::max(),
+                   std::numeric_limits<float>::max() };
+  float max[3] = { -std::numeric_limits<float>::max(),
+                   -std::numeric_limits<float>::max(),
+                   -std::numeric_limits<float>::max() };
+  for (size_t v = 0; v < numVertices; ++v)
+  {
+    float p[3];
+    readPosition(vbo, stride, positionOffset, static_cast<uint32_t>(v), p);
+    for (int i = 0; i < 3; ++i)
+    {
+      min[i] = std::min(min[i], p[i]);
+      max[i] = std::max(max[i], p[i]);
+    }
+  }
+  float scale[3];
+  for (int i = 0; i < 3; ++i)
+    scale[i] = (max[i] > min[i]) ? 1023.0f / (max[i] - min[i]) : 0.0f;
+
+  // Sort keys: the Morton code of the centroid above the triangle index,
+  // so triangles of the same cell stay in their original order.
+  std::vector<uint64_t> keys(numTriangles);
+  const size_t blockSize = 65536;
+  parallelFor((numTriangles + blockSize - 1) / blockSize, [&](size_t block)
+  {
+    size_t end = std::min((block + 1) * blockSize, numTriangles);
+    for (size_t t = block * blockSize; t < end; ++t)
+    {
+      float centroid[3] = {0.0f, 0.0f, 0.0f};
+      for (int v = 0; v < 3; ++v)
+      {
+        float p[3];
+        readPosition(vbo, stride, positionOffset, indices[t * 3 + v], p);
+        for (int i = 0; i < 3; ++i)
+          centroid[i] += p[i] * (1.0f / 3.0f);
+      }
+      uint32_t cell[3];
+      for (int i = 0; i < 3; ++i)
+      {
+        float c = (centroid[i] - min[i]) * scale[i];
+        cell[i] = static_cast<uint32_t>(std::min(1023.0f, std::max(0.0f, c)));
+      }
+      uint64_t code = spreadBits(cell[0]) | (spreadBits(cell[1]) << 1)
+          | (spreadBits(cell[2]) << 2);
+      keys[t] = (code << 32) | t;
+    }
+  });
+  std::sort(keys.begin(), keys.end());
+
+  // Back to the original order within each cluster.
+  size_t numClusters = (numTriangles + trianglesPerCluster - 1) / trianglesPerCluster;
+  std::vector<uint32_t> reordered(indices.size());
+  clusters.resize(numClusters);
+  parallelFor((numClusters + CLUSTERS_PER_TASK - 1) / CLUSTERS_PER_TASK,
+              [&](size_t task)
+  {
+    size_t end = std::min((task + 1) * CLUSTERS_PER_TASK, numClusters);
+    for (size_t c = task * CLUSTERS_PER_TASK; c < end; ++c)
+    {
+      size_t first = c * trianglesPerCluster;
+      size_t last = std::min(first + trianglesPerCluster, numTriangles);
+      std::vector<uint64_t>::iterator begin = keys.begin() + static_cast<ptrdiff_t>(first);
+      std::vector<uint64_t>::iterator finish = keys.begin() + static_cast<ptrdiff_t>(last);
+      std::sort(begin, finish, [](uint64_t a, uint64_t b)
+      {
+        return static_cast<uint32_t>(a) < static_cast<uint32_t>(b);
+      });
+      for (size_t t = first; t < last; ++t)
+      {
+        size_t source = static_cast<uint32_t>(keys[t]);
+        std::copy(&indices[source * 3], &indices[source * 3] + 3, &reordered[t * 3]);
+      }
+
+      MeshCluster& cluster = clusters[c];
+      cluster.firstIndex = static_cast<uint32_t>(first * 3);
+      cluster.numIndices = static_cast<uint32_t>((last - first) * 3);
+      computeClusterBounds(vbo, stride, positionOffset, &reordered[0], cluster);
+    }
+  });
+  indices.swap(reordered);
+}
+
+//------------------------------------------------------------------------------
+void validateMeshClusters(const std::vector<MeshCluster>& clusters,
+                          size_t numIndices)
+{
+  for (auto it = clusters.begin(); it != clusters.end(); ++it)
+  {
+    if (   it->firstIndex % 3 != 0 || it->numIndices % 3 != 0
+        || it->firstIndex > numIndices
+        || it->numIndices > numIndices - it->firstIndex)
+      throw std::invalid_argument("Mesh cluster is outside of the index buffer.");
+  }
+}
+
+} // namespace CPM_SPIRE_NS
@@ -0,0 +1,91 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+/// \brief  Splits triangle meshes into clusters of about a hundred spatially
+///         close triangles, each with a bounding sphere and a cone bounding
+///         its face normals, so that large meshes can be culled piece by
+///         piece (see FramePrep::setClusterCulling). Clusters are contiguous
+///         ranges of the index buffer and are stored in asset files (see
+///         AssetFile.h).
+
+#ifndef SPIRE_HIGH_MESHCLUSTERS_H
+#define SPIRE_HIGH_MESHCLUSTERS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace CPM_SPIRE_NS {
+
+/// Triangles per cluster built by buildMeshClusters.
+const size_t MESH_CLUSTER_TRIANGLES = 128;
+
+/// Meshes with fewer triangles than this are not worth clustering: culling
+/// their clusters would cost more than drawing them.
+const size_t MESH_CLUSTER_MIN_TRIANGLES = 4096;
+
+/// A range of triangles of an index buffer and its object space bounds.
+struct MeshCluster
+{
+  uint32_t  firstIndex;
+  uint32_t  numIndices;
+  float     center[3];    ///< Bounding sphere.
+  float     radius;
+  float     coneAxis[3];  ///< Unit average of the face normals.
+
+  /// Sine of the largest angle between a face normal and the axis. The
+  /// cluster faces away from eye e if
+  ///   dot(center - e, axis) > coneCutoff * |center - e| + radius * (1 + coneCutoff).
+  /// 1 for clusters whose normals spread too far for the test to ever hold.
+  float     coneCutoff;
+};
+
+/// Reorders the triangles of 'indices' into clusters of at most
+/// 'trianglesPerCluster' triangles that are close to each other (in Morton
+/// order of their centroids) and computes the bounds of the clusters.
+/// Triangles keep their relative order within a cluster, which preserves
+/// most of the vertex cache optimization of MeshOptimizer.h.
+/// Positions are three floats located 'positionOffset' bytes into each vertex.
+void buildMeshClusters(const uint8_t* vbo, size_t stride, size_t positionOffset,
+                       size_t numVertices, std::vector<uint32_t>& indices,
+                       std::vector<MeshCluster>& clusters,
+                       size_t trianglesPerCluster = MESH_CLUSTER_TRIANGLES);
+
+/// Computes the bounds of 'cluster' from the triangles it covers.
+void computeClusterBounds(const uint8_t* vbo, size_t stride,
+                          size_t positionOffset, const uint32_t* indices,
+                          MeshCluster& cluster);
+
+/// Throws std::invalid_argument unless every cluster covers whole triangles
+/// within the first 'numIndices' indices.
+void validateMeshClusters(const std::vector<MeshCluster>& clusters,
+                          size_t numIndices);
+
+} // namespace CPM_SPIRE_NS
+
+#endif
@@ -0,0 +1,1163 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <istream>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "MeshImport.h"
+#include "MeshOptimizer.h"
+#include "Parallel.h"
+
+namespace CPM_SPIRE_NS {
+
+namespace {
+
+/// Text is parsed in chunks of roughly this many bytes.
+const size_t TEXT_CHUNK_SIZE = 1 << 20;
+
+/// Binary vertices / triangles are decoded in blocks of this many elements.
+const size_t BINARY_BLOCK_SIZE = 1 << 16;
+
+const size_t FLOAT_VERTEX_SIZE = sizeof(float) * 6;
+
+const int64_t NO_INDEX = std::numeric_limits<int64_t>::min();
+
+//------------------------------------------------------------------------------
+// Text parsing
+//------------------------------------------------------------------------------
+
+inline bool isBlank(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline void skipBlanks(const char*& p, const char* end)
+{
+  while (p < end && isBlank(*p))
+    ++p;
+}
+
+inline const char* findLineEnd(const char* p, const char* end)
+{
+  const char* eol = static_cast<const char*>(
+      std::memchr(p, '\n', static_cast<size_t>(end - p)));
+  return eol ? eol : end;
+}
+
+/// True if the line contains anything other than whitespace.
+inline bool hasContent(const char* p, const char* end)
+{
+  skipBlanks(p, end);
+  return p < end;
+}
+
+const double POWERS_OF_TEN[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+/// Parses a decimal floating point number. Far faster than strtod and locale
+/// independent. Falls back to strtod for anything unusual (inf, nan, hex).
+bool parseDouble(const char*& p, const char* end, double& out)
+{
+  skipBlanks(p, end);
+  const char* start = p;
+
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+'))
+    negative = (*p++ == '-');
+
+  uint64_t mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+  bool any = false;
+  for (; p < end && *p >= '0' && *p <= '9'; ++p, any = true)
+  {
+    if (digits < 19)
+    {
+      mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+      if (mantissa != 0)
+        ++digits;
+    }
+    else
+    {
+      ++exponent;
+    }
+  }
+  if (p < end && *p == '.')
+  {
+    for (++p; p < end && *p >= '0' && *p <= '9'; ++p, any = true)
+    {
+      if (digits < 19)
+      {
+        mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+        if (mantissa != 0)
+          ++digits;
+        --exponent;
+      }
+    }
+  }
+
+  if (!any)
+  {
+    // Let the C library deal with inf / nan.
+    const char* tokenEnd = start;
+    while (tokenEnd < end && !isBlank(*tokenEnd) && *tokenEnd != '\n')
+      ++tokenEnd;
+    std::string token(start, tokenEnd);
+    char* parsedEnd = nullptr;
+    out = std::strtod(token.c_str(), &parsedEnd);
+    if (token.empty() || parsedEnd == token.c_str())
+      return false;
+    p = start + (parsedEnd - token.c_str());
+    return true;
+  }
+
+  if (p < end && (*p == 'e' || *p == 'E'))
+  {
+    const char* expStart = p++;
+    bool negativeExp = false;
+    if (p < end && (*p == '-' || *p == '+'))
+      negativeExp = (*p++ == '-');
+    if (p < end && *p >= '0' && *p <= '9')
+    {
+      int e = 0;
+      for (; p < end && *p >= '0' && *p <= '9'; ++p)
+        e = std::min(e * 10 + (*p - '0'), 100000);
+      exponent += negativeExp ? -e : e;
+    }
+    else
+    {
+      p = expStart;
+    }
+  }
+
+  double value = static_cast<double>(mantissa);
+  if (exponent >= 0 && exponent <= 22)
+    value *= POWERS_OF_TEN[exponent];
+  else if (exponent < 0 && exponent >= -22)
+    value /= POWERS_OF_TEN[-exponent];
+  else
+    value *= std::pow(10.0, exponent);
+
+  out = negative ? -value : value;
+  return true;
+}
+
+bool parseFloat(const char*& p, const char* end, float& out)
+{
+  double value;
+  if (!parseDouble(p, end, value))
+    return false;
+  out = static_cast<float>(value);
+  return true;
+}
+
+bool parseInt(const char*& p, const char* end, int64_t& out)
+{
+  skipBlanks(p, end);
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+'))
+    negative = (*p++ == '-');
+
+  if (p >= end || *p < '0' || *p > '9')
+    return false;
+
+  int64_t value = 0;
+  for (; p < end && *p >= '0' && *p <= '9'; ++p)
+    value = value * 10 + (*p - '0');
+  out = negative ? -value : value;
+  return true;
+}
+
+/// Splits [begin, end) into chunks of roughly TEXT_CHUNK_SIZE bytes that end
+/// right after a newline.
+std::vector<const char*> splitIntoChunks(const char* begin, const char* end)
+{
+  std::vector<const char*> bounds;
+  bounds.push_back(begin);
+  const char* p = begin;
+  while (static_cast<size_t>(end - p) > TEXT_CHUNK_SIZE)
+  {
+    p = findLineEnd(p + TEXT_CHUNK_SIZE, end);
+    if (p < end)
+      ++p;
+    bounds.push_back(p);
+  }
+  if (bounds.back() != end)
+    bounds.push_back(end);
+  return bounds;
+}
+
+//------------------------------------------------------------------------------
+// Mesh assembly
+//------------------------------------------------------------------------------
+
+/// Builds an ASSET_VERTEX_FLOAT mesh from separate position and (optional)
+/// normal arrays.
+void assembleMesh(const std::vector<float>& positions,
+                  const std::vector<float>& normals,
+                  std::vector<uint32_t>& indices, AssetMesh& mesh)
+{
+  size_t numVertices = positions.size() / 3;
+  for (auto it = indices.begin(); it != indices.end(); ++it)
+  {
+    if (*it >= numVertices)
+      throw std::invalid_argument("Mesh file references a missing vertex.");
+  }
+
+  mesh.vertexFormat = ASSET_VERTEX_FLOAT;
+  mesh.vbo.resize(numVertices * FLOAT_VERTEX_SIZE);
+  mesh.indices.swap(indices);
+
+  size_t numBlocks = (numVertices + BINARY_BLOCK_SIZE - 1) / BINARY_BLOCK_SIZE;
+  bool hasNormals = (normals.size() == positions.size());
+  parallelFor(numBlocks, [&](size_t block)
+  {
+    size_t begin = block * BINARY_BLOCK_SIZE;
+    size_t end = std::min(begin + BINARY_BLOCK_SIZE, numVertices);
+    float* out = reinterpret_cast<float*>(&mesh.vbo[0]) + begin * 6;
+    for (size_t v = begin; v < end; ++v, out += 6)
+    {
+      std::memcpy(out, &positions[v * 3], sizeof(float) * 3);
+      if (hasNormals)
+        std::memcpy(out + 3, &normals[v * 3], sizeof(float) * 3);
+    }
+  });
+
+  if (!hasNormals)
+    computeVertexNormals(mesh);
+}
+
+/// Appends a fan triangulation of 'polygon' to 'indices'.
+template <typename T>
+void triangulate(const T* polygon, size_t count, std::vector<T>& indices)
+{
+  for (size_t i = 2; i < count; ++i)
+  {
+    indices.push_back(polygon[0]);
+    indices.push_back(polygon[i - 1]);
+    indices.push_back(polygon[i]);
+  }
+}
+
+//------------------------------------------------------------------------------
+// STL
+//------------------------------------------------------------------------------
+
+void importSTL(const char* data, size_t size, AssetMesh& mesh)
+{
+  const size_t headerSize = 84;
+  const size_t triangleSize = 50;
+
+  uint32_t numTriangles = 0;
+  if (size >= headerSize)
+    std::memcpy(&numTriangles, data + 80, sizeof(uint32_t));
+
+  if (size < headerSize || headerSize + numTriangles * triangleSize != size)
+  {
+    if (size >= 5 && std::strncmp(data, "solid", 5) == 0)
+      throw std::invalid_argument("ASCII STL files are not supported.");
+    throw std::invalid_argument("STL file size does not match its triangle count.");
+  }
+
+  // STL stores three unshared corners per facet. Decode them in parallel,
+  // then weld identical positions.
+  std::vector<uint8_t> positions(static_cast<size_t>(numTriangles) * 3 * sizeof(float) * 3);
+  std::vector<uint32_t> indices(static_cast<size_t>(numTriangles) * 3);
+  size_t numBlocks = (numTriangles + BINARY_BLOCK_SIZE - 1) / BINARY_BLOCK_SIZE;
+  parallelFor(numBlocks, [&](size_t block)
+  {
+    size_t begin = block * BINARY_BLOCK_SIZE;
+    size_t end = std::min(begin + BINARY_BLOCK_SIZE, static_cast<size_t>(numTriangles));
+    for (size_t t = begin; t < end; ++t)
+    {
+      // Skip the facet normal, it is recomputed per vertex.
+      const char* src = data + headerSize + t * triangleSize + sizeof(float) * 3;
+      std::memcpy(&positions[t * sizeof(float) * 9], src, sizeof(float) * 9);
+      for (size_t c = 0; c < 3; ++c)
+        indices[t * 3 + c] = static_cast<uint32_t>(t * 3 + c);
+    }
+  });
+
+  weldVertices(positions, sizeof(float) * 3, indices);
+
+  std::vector<float> floats(positions.size() / sizeof(float));
+  if (!floats.empty())
+    std::memcpy(&floats[0], &positions[0], positions.size());
+  assembleMesh(floats, std::vector<float>(), indices, mesh);
+}
+
+//------------------------------------------------------------------------------
+// OBJ
+//------------------------------------------------------------------------------
+
+/// Reference to a position / normal from a face. Negative (relative) OBJ
+/// indices are resolved against the number of elements seen so far in the
+/// chunk and flagged so the chunk's base offset can be added afterwards.
+struct ObjCorner
+{
+  int64_t position;
+  int64_t normal;
+  bool    positionLocal;
+  bool    normalLocal;
+};
+
+struct ObjChunk
+{
+  std::vector<float>      positions;
+  std::vector<float>      normals;
+  std::vector<ObjCorner>  corners;   ///< Already triangulated.
+};
+
+bool parseObjIndex(const char*& p, const char* end, size_t localCount,
+                   int64_t& index, bool& local)
+{
+  int64_t value;
+  if (!parseInt(p, end, value) || value == 0)
+    return false;
+
+  if (value < 0)
+  {
+    index = static_cast<int64_t>(localCount) + value;
+    local = true;
+  }
+  else
+  {
+    index = value - 1;
+    local = false;
+  }
+  return true;
+}
+
+void parseObjChunk(const char* p, const char* end, ObjChunk& chunk)
+{
+  std::vector<ObjCorner> polygon;
+  while (p < end)
+  {
+    const char* lineEnd = findLineEnd(p, end);
+    skipBlanks(p, lineEnd);
+
+    if (lineEnd - p >= 2 && p[0] == 'v' && isBlank(p[1]))
+    {
+      ++p;
+      float v[3];
+      for (size_t i = 0; i < 3; ++i)
+      {
+        if (!parseFloat(p, lineEnd, v[i]))
+          throw std::invalid_argument("Malformed vertex in OBJ file.");
+      }
+      chunk.positions.insert(chunk.positions.end(), v, v + 3);
+    }
+    else if (lineEnd - p >= 3 && p[0] == 'v' && p[1] == 'n' && isBlank(p[2]))
+    {
+      p += 2;
+      float n[3];
+      for (size_t i = 0; i < 3; ++i)
+      {
+        if (!parseFloat(p, lineEnd, n[i]))
+          throw std::invalid_argument("Malformed normal in OBJ file.");
+      }
+      chunk.normals.insert(chunk.normals.end(), n, n + 3);
+    }
+    else if (lineEnd - p >= 2 && p[0] == 'f' && isBlank(p[1]))
+    {
+      ++p;
+      polygon.clear();
+      for (;;)
+      {
+        skipBlanks(p, lineEnd);
+        if (p >= lineEnd)
+          break;
+
+        ObjCorner corner;
+        corner.normal = NO_INDEX;
+        corner.normalLocal = false;
+        if (!parseObjIndex(p, lineEnd, chunk.positions.size() / 3,
+                           corner.position, corner.positionLocal))
+          throw std::invalid_argument("Malformed face in OBJ file.");
+
+        // Optional texture coordinate (ignored) and normal: v/t, v//n, v/t/n.
+        if (p < lineEnd && *p == '/')
+        {
+          ++p;
+          int64_t ignored;
+          if (p < lineEnd && *p != '/')
+            parseInt(p, lineEnd, ignored);
+          if (p < lineEnd && *p == '/')
+          {
+            ++p;
+            if (!parseObjIndex(p, lineEnd, chunk.normals.size() / 3,
+                               corner.normal, corner.normalLocal))
+              throw std::invalid_argument("Malformed face normal in OBJ file.");
+          }
+        }
+        polygon.push_back(corner);
+      }
+      triangulate(polygon.empty() ? nullptr : &polygon[0], polygon.size(),
+                  chunk.corners);
+    }
+    // Everything else (comments, texture coordinates, groups, materials) is
+    // ignored.
+
+    p = (lineEnd < end) ? lineEnd + 1 : end;
+  }
+}
+
+void importOBJ(const char* data, size_t size, AssetMesh& mesh)
+{
+  std::vector<const char*> bounds = splitIntoChunks(data, data + size);
+  size_t numChunks = bounds.size() - 1;
+  std::vector<ObjChunk> chunks(numChunks);
+  parallelFor(numChunks, [&](size_t c)
+  {
+    parseObjChunk(bounds[c], bounds[c + 1], chunks[c]);
+  });
+
+  // Offsets of every chunk's positions / normals / triangles.
+  std::vector<size_t> positionBase(numChunks + 1, 0);
+  std::vector<size_t> normalBase(numChunks + 1, 0);
+  std::vector<size_t> cornerBase(numChunks + 1, 0);
+  bool allCornersHaveNormals = true;
+  for (size_t c = 0; c < numChunks; ++c)
+  {
+    positionBase[c + 1] = positionBase[c] + chunks[c].positions.size() / 3;
+    normalBase[c + 1]   = normalBase[c] + chunks[c].normals.size() / 3;
+    cornerBase[c + 1]   = cornerBase[c] + chunks[c].corners.size();
+    for (auto it = chunks[c].corners.begin(); it != chunks[c].corners.end(); ++it)
+      allCornersHaveNormals = allCornersHaveNormals && (it->normal != NO_INDEX);
+  }
+  size_t numPositions = positionBase[numChunks];
+  size_t numNormals   = normalBase[numChunks];
+  size_t numCorners   = cornerBase[numChunks];
+
+  std::vector<float> positions(numPositions * 3);
+  std::vector<float> normals(numNormals * 3);
+  std::vector<uint32_t> positionIndices(numCorners);
+  std::vector<uint32_t> normalIndices(allCornersHaveNormals ? numCorners : 0);
+  parallelFor(numChunks, [&](size_t c)
+  {
+    const ObjChunk& chunk = chunks[c];
+    std::copy(chunk.positions.begin(), chunk.positions.end(),
+              positions.begin() + static_cast<ptrdiff_t>(positionBase[c] * 3));
+    std::copy(chunk.normals.begin(), chunk.normals.end(),
+              normals.begin() + static_cast<ptrdiff_t>(normalBase[c] * 3));
+
+    for (size_t i = 0; i < chunk.corners.size(); ++i)
+    {
+      const ObjCorner& corner = chunk.corners[i];
+      int64_t position = corner.position
+          + (corner.positionLocal ? static_cast<int64_t>(positionBase[c]) : 0);
+      if (position < 0 || position >= static_cast<int64_t>(numPositions))
+        throw std::invalid_argument("OBJ face references a missing vertex.");
+      positionIndices[cornerBase[c] + i] = static_cast<uint32_t>(position);
+
+      if (allCornersHaveNormals)
+      {
+        int64_t normal = corner.normal
+            + (corner.normalLocal ? static_cast<int64_t>(normalBase[c]) : 0);
+        if (normal < 0 || normal >= static_cast<int64_t>(numNormals))
+          throw std::invalid_argument("OBJ face references a missing normal.");
+        normalIndices[cornerBase[c] + i] = static_cast<uint32_t>(normal);
+      }
+    }
+  });
+  chunks.clear();
+
+  if (!allCornersHaveNormals)
+  {
+    assembleMesh(positions, std::vector<float>(), positionIndices, mesh);
+    return;
+  }
+
+  // Positions and normals are indexed separately. Expand every corner into a
+  // full vertex and weld the identical ones.
+  mesh.vertexFormat = ASSET_VERTEX_FLOAT;
+  mesh.vbo.resize(numCorners * FLOAT_VERTEX_SIZE);
+  mesh.indices.resize(numCorners);
+  size_t numBlocks = (numCorners + BINARY_BLOCK_SIZE - 1) / BINARY_BLOCK_SIZE;
+  parallelFor(numBlocks, [&](size_t block)
+  {
+    size_t begin = block * BINARY_BLOCK_SIZE;
+    size_t end = std::min(begin + BINARY_BLOCK_SIZE, numCorners);
+    for (size_t i = begin; i < end; ++i)
+    {
+      float* out = reinterpret_cast<float*>(&mesh.vbo[i * FLOAT_VERTEX_SIZE]);
+      std::memcpy(out, &positions[positionIndices[i] * 3], sizeof(float) * 3);
+      std::memcpy(out + 3, &normals[normalIndices[i] * 3], sizeof(float) * 3);
+      mesh.indices[i] = static_cast<uint32_t>(i);
+    }
+  });
+  weldVertices(mesh.vbo, FLOAT_VERTEX_SIZE, mesh.indices);
+}
+
+//------------------------------------------------------------------------------
+// PLY
+//------------------------------------------------------------------------------
+
+enum PlyType
+{
+  PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16,
+  PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64,
+};
+
+struct PlyProperty
+{
+  std::string name;
+  PlyType     type;
+  bool        isList;
+  PlyType     countType;
+};
+
+struct PlyElement
+{
+  std::string               name;
+  size_t                    count;
+  std::vector<PlyProperty>  properties;
+};
+
+enum PlyFormat
+{
+  PLY_ASCII,
+  PLY_BINARY_LITTLE_ENDIAN,
+  PLY_BINARY_BIG_ENDIAN,
+};
+
+size_t plyTypeSize(PlyType type)
+{
+  switch (type)
+  {
+    case PLY_INT8:    case PLY_UINT8:   return 1;
+    case PLY_INT16:   case PLY_UINT16:  return 2;
+    case PLY_INT32:   case PLY_UINT32:
+    case PLY_FLOAT32:                   return 4;
+    case PLY_FLOAT64:                   return 8;
+  }
+  return 0;
+}
+
+PlyType parsePlyType(const std::string& name)
+{
+  if (name == "char"   || name == "int8")     return PLY_INT8;
+  if (name == "uchar"  || name == "uint8")    return PLY_UINT8;
+  if (name == "short"  || name == "int16")    return PLY_INT16;
+  if (name == "ushort" || name == "uint16")   return PLY_UINT16;
+  if (name == "int"    || name == "int32")    return PLY_INT32;
+  if (name == "uint"   || name == "uint32")   return PLY_UINT32;
+  if (name == "float"  || name == "float32")  return PLY_FLOAT32;
+  if (name == "double" || name == "float64")  return PLY_FLOAT64;
+  throw std::invalid_argument("Unknown PLY property type '" + name + "'.");
+}
+
+/// Reads a binary scalar of the given type. 'p' must have enough bytes left.
+double readPlyScalar(const char* p, PlyType type, bool swap)
+{
+  uint8_t bytes[8];
+  size_t size = plyTypeSize(type);
+  std::memcpy(bytes, p, size);
+  if (swap)
+    std::reverse(bytes, bytes + size);
+
+  switch (type)
+  {
+    case PLY_INT8:    { int8_t v;   std::memcpy(&v, bytes, 1); return v; }
+    case PLY_UINT8:   { uint8_t v;  std::memcpy(&v, bytes, 1); return v; }
+    case PLY_INT16:   { int16_t v;  std::memcpy(&v, bytes, 2); return v; }
+    case PLY_UINT16:  { uint16_t v; std::memcpy(&v, bytes, 2); return v; }
+    case PLY_INT32:   { int32_t v;  std::memcpy(&v, bytes, 4); return v; }
+    case PLY_UINT32:  { uint32_t v; std::memcpy(&v, bytes, 4); return v; }
+    case PLY_FLOAT32: { float v;    std::memcpy(&v, bytes, 4); return static_cast<double>(v); }
+    case PLY_FLOAT64: { double v;   std::memcpy(&v, bytes, 8); return v; }
+  }
+  return 0.0;
+}
+
+/// Converts a list count / index read as double back into an integer.
+uint32_t plyIndex(double value)
+{
+  if (value < 0.0 || value > 4294967295.0)
+    throw std::invalid_argument("PLY index out of range.");
+  return static_cast<uint32_t>(value);
+}
+
+/// Parsed PLY header.
+struct PlyHeader
+{
+  PlyFormat                 format;
+  std::vector<PlyElement>   elements;
+  size_t                    bodyOffset;
+};
+
+/// Throws if the body, 'bodySize' bytes long, cannot hold the instances the
+/// header announces, so the counts can be multiplied safely afterwards.
+void checkPlyElementCounts(const PlyHeader& header, size_t bodySize)
+{
+  for (auto element = header.elements.begin(); element != header.elements.end(); ++element)
+  {
+    // Binary instances take at least their scalars and list counts, ASCII
+    // ones at least a character per value.
+    size_t minSize = 0;
+    for (auto prop = element->properties.begin(); prop != element->properties.end(); ++prop)
+    {
+      if (header.format == PLY_ASCII)
+        minSize += 1;
+      else
+        minSize += plyTypeSize(prop->isList ? prop->countType : prop->type);
+    }
+    if (element->count > bodySize / std::max(minSize, static_cast<size_t>(1)))
+      throw std::invalid_argument("PLY file is truncated.");
+  }
+}
+
+PlyHeader parsePlyHeader(const char* data, size_t size)
+{
+  PlyHeader header;
+  header.format = PLY_ASCII;
+  header.bodyOffset = 0;
+
+  const char* end = data + size;
+  const char* p = data;
+  bool first = true;
+  bool haveFormat = false;
+  while (p < end)
+  {
+    const char* lineEnd = findLineEnd(p, end);
+    std::string line(p, lineEnd);
+    p = (lineEnd < end) ? lineEnd + 1 : end;
+    if (!line.empty() && line[line.size() - 1] == '\r')
+      line.erase(line.size() - 1);
+
+    if (first)
+    {
+      if (line != "ply")
+        throw std::invalid_argument("Missing PLY magic number.");
+      first = false;
+      continue;
+    }
+
+    std::vector<std::string> tokens;
+    const char* t = line.c_str();
+    const char* tEnd = t + line.size();
+    while (t < tEnd)
+    {
+      skipBlanks(t, tEnd);
+      const char* tokenStart = t;
+      while (t < tEnd && !isBlank(*t))
+        ++t;
+      if (t > tokenStart)
+        tokens.push_back(std::string(tokenStart, t));
+    }
+    if (tokens.empty())
+      continue;
+
+    if (tokens[0] == "end_header")
+    {
+      if (!haveFormat)
+        throw std::invalid_argument("PLY header does not specify a format.");
+      header.bodyOffset = static_cast<size_t>(p - data);
+      checkPlyElementCounts(header, size - header.bodyOffset);
+      return header;
+    }
+    else if (tokens[0] == "format" && tokens.size() >= 2)
+    {
+      if (tokens[1] == "ascii")
+        header.format = PLY_ASCII;
+      else if (tokens[1] == "binary_little_endian")
+        header.format = PLY_BINARY_LITTLE_ENDIAN;
+      else if (tokens[1] == "binary_big_endian")
+        header.format = PLY_BINARY_BIG_ENDIAN;
+      else
+        throw std::invalid_argument("Unknown PLY format '" + tokens[1] + "'.");
+      haveFormat = true;
+    }
+    else if (tokens[0] == "element" && tokens.size() >= 3)
+    {
+      PlyElement element;
+      element.name = tokens[1];
+      element.count = static_cast<size_t>(std::strtoull(tokens[2].c_str(), nullptr, 10));
+      header.elements.push_back(element);
+    }
+    else if (tokens[0] == "property" && !header.elements.empty())
+    {
+      PlyProperty property;
+      if (tokens.size() >= 5 && tokens[1] == "list")
+      {
+        property.isList    = true;
+        property.countType = parsePlyType(tokens[2]);
+        property.type      = parsePlyType(tokens[3]);
+        property.name      = tokens[4];
+      }
+      else if (tokens.size() >= 3)
+      {
+        property.isList    = false;
+        property.countType = PLY_UINT8;
+        property.type      = parsePlyType(tokens[1]);
+        property.name      = tokens[2];
+      }
+      else
+      {
+        throw std::invalid_argument("Malformed PLY property.");
+      }
+      header.elements.back().properties.push_back(property);
+    }
+    // comment / obj_info lines are ignored.
+  }
+
+  throw std::invalid_argument("PLY header is not terminated.");
+}
+
+/// Indices of the properties we care about within the vertex element.
+struct PlyVertexLayout
+{
+  PlyVertexLayout() { std::fill(index, index + 6, -1); }
+
+  bool hasPosition() const { return index[0] >= 0 && index[1] >= 0 && index[2] >= 0; }
+  bool hasNormal() const   { return index[3] >= 0 && index[4] >= 0 && index[5] >= 0; }
+
+  int index[6];   ///< x, y, z, nx, ny, nz.
+};
+
+PlyVertexLayout getVertexLayout(const PlyElement& element)
+{
+  const char* names[] = {"x", "y", "z", "nx", "ny", "nz"};
+  PlyVertexLayout layout;
+  for (size_t i = 0; i < element.properties.size(); ++i)
+  {
+    for (size_t n = 0; n < 6; ++n)
+    {
+      if (!element.properties[i].isList && element.properties[i].name == names[n])
+        layout.index[n] = static_cast<int>(i);
+    }
+  }
+  if (!layout.hasPosition())
+    throw std::invalid_argument("PLY vertices have no position.");
+  return layout;
+}
+
+bool isFaceIndexList(const PlyProperty& property)
+{
+  return property.isList
+      && (property.name == "vertex_indices" || property.name == "vertex_index");
+}
+
+void importBinaryPLY(const char* data, size_t size, const PlyHeader& header,
+                     AssetMesh& mesh)
+{
+  bool swap = (header.format == PLY_BINARY_BIG_ENDIAN);
+  const char* p = data + header.bodyOffset;
+  const char* end = data + size;
+
+  std::vector<float> positions;
+  std::vector<float> normals;
+  std::vector<uint32_t> indices;
+
+  auto need = [&](size_t bytes)
+  {
+    if (static_cast<size_t>(end - p) < bytes)
+      throw std::invalid_argument("PLY file is truncated.");
+  };
+
+  for (auto element = header.elements.begin(); element != header.elements.end(); ++element)
+  {
+    bool fixedSize = true;
+    size_t stride = 0;
+    for (auto prop = element->properties.begin(); prop != element->properties.end(); ++prop)
+    {
+      fixedSize = fixedSize && !prop->isList;
+      stride += plyTypeSize(prop->type);
+    }
+
+    if (element->name == "vertex" && fixedSize)
+    {
+      // Fixed size vertices are decoded in parallel.
+      PlyVertexLayout layout = getVertexLayout(*element);
+      std::vector<size_t> offsets;
+      size_t offset = 0;
+      for (auto prop = element->properties.begin(); prop != element->properties.end(); ++prop)
+      {
+        offsets.push_back(offset);
+        offset += plyTypeSize(prop->type);
+      }
+
+      need(element->count * stride);
+      positions.resize(element->count * 3);
+      if (layout.hasNormal())
+        normals.resize(element->count * 3);
+
+      const char* base = p;
+      size_t numBlocks = (element->count + BINARY_BLOCK_SIZE - 1) / BINARY_BLOCK_SIZE;
+      parallelFor(numBlocks, [&](size_t block)
+      {
+        size_t begin = block * BINARY_BLOCK_SIZE;
+        size_t blockEnd = std::min(begin + BINARY_BLOCK_SIZE, element->count);
+        for (size_t v = begin; v < blockEnd; ++v)
+        {
+          const char* vertex = base + v * stride;
+          for (size_t c = 0; c < 6; ++c)
+          {
+            if (layout.index[c] < 0)
+              continue;
+            size_t prop = static_cast<size_t>(layout.index[c]);
+            float value = static_cast<float>(readPlyScalar(
+                vertex + offsets[prop], element->properties[prop].type, swap));
+            if (c < 3)
+              positions[v * 3 + c] = value;
+            else
+              normals[v * 3 + c - 3] = value;
+          }
+        }
+      });
+      p += element->count * stride;
+      continue;
+    }
+
+    // Variable sized elements (faces) are read sequentially.
+    bool isVertex = (element->name == "vertex");
+    bool isFace = (element->name == "face");
+    PlyVertexLayout layout;
+    if (isVertex)
+    {
+      layout = getVertexLayout(*element);
+      positions.resize(element->count * 3);
+      if (layout.hasNormal())
+        normals.resize(element->count * 3);
+    }
+
+    std::vector<uint32_t> polygon;
+    for (size_t i = 0; i < element->count; ++i)
+    {
+      for (size_t propIndex = 0; propIndex < element->properties.size(); ++propIndex)
+      {
+        const PlyProperty& prop = element->properties[propIndex];
+        size_t typeSize = plyTypeSize(prop.type);
+        if (prop.isList)
+        {
+          size_t countSize = plyTypeSize(prop.countType);
+          need(countSize);
+          size_t count = plyIndex(readPlyScalar(p, prop.countType, swap));
+          p += countSize;
+          need(count * typeSize);
+
+          if (isFace && isFaceIndexList(prop))
+          {
+            polygon.resize(count);
+            for (size_t j = 0; j < count; ++j)
+              polygon[j] = plyIndex(readPlyScalar(p + j * typeSize, prop.type, swap));
+            triangulate(polygon.empty() ? nullptr : &polygon[0], count, indices);
+          }
+          p += count * typeSize;
+        }
+        else
+        {
+          need(typeSize);
+          if (isVertex)
+          {
+            for (size_t c = 0; c < 6; ++c)
+            {
+              if (layout.index[c] != static_cast<int>(propIndex))
+                continue;
+              float value = static_cast<float>(readPlyScalar(p, prop.type, swap));
+              if (c < 3)
+                positions[i * 3 + c] = value;
+              else
+                normals[i * 3 + c - 3] = value;
+            }
+          }
+          p += typeSize;
+        }
+      }
+    }
+  }
+
+  assembleMesh(positions, normals, indices, mesh);
+}
+
+/// Per chunk results of the ASCII PLY parser.
+struct PlyTextChunk
+{
+  size_t                firstLine;  ///< Index of the first non-blank line.
+  size_t                numLines;   ///< Number of non-blank lines.
+  std::vector<uint32_t> indices;    ///< Triangulated faces.
+};
+
+void importAsciiPLY(const char* data, size_t size, const PlyHeader& header,
+                    AssetMesh& mesh)
+{
+  // Locate the line ranges of the vertex and face elements. Every element
+  // instance occupies exactly one line.
+  size_t vertexElement = header.elements.size();
+  size_t faceElement = header.elements.size();
+  std::vector<size_t> firstLine(header.elements.size() + 1, 0);
+  for (size_t e = 0; e < header.elements.size(); ++e)
+  {
+    firstLine[e + 1] = firstLine[e] + header.elements[e].count;
+    if (header.elements[e].name == "vertex")
+      vertexElement = e;
+    else if (header.elements[e].name == "face")
+      faceElement = e;
+  }
+  if (vertexElement == header.elements.size())
+    throw std::invalid_argument("PLY file has no vertices.");
+
+  const PlyElement& vertices = header.elements[vertexElement];
+  PlyVertexLayout layout = getVertexLayout(vertices);
+  std::vector<float> positions(vertices.count * 3);
+  std::vector<float> normals(layout.hasNormal() ? vertices.count * 3 : 0);
+
+  // First pass: count lines per chunk so every chunk knows which element
+  // its lines belong to.
+  std::vector<const char*> bounds = splitIntoChunks(data + header.bodyOffset, data + size);
+  size_t numChunks = bounds.size() - 1;
+  std::vector<PlyTextChunk> chunks(numChunks);
+  parallelFor(numChunks, [&](size_t c)
+  {
+    size_t lines = 0;
+    for (const char* p = bounds[c]; p < bounds[c + 1];)
+    {
+      const char* lineEnd = findLineEnd(p, bounds[c + 1]);
+      if (hasContent(p, lineEnd))
+        ++lines;
+      p = lineEnd + 1;
+    }
+    chunks[c].numLines = lines;
+  });
+
+  size_t totalLines = 0;
+  for (size_t c = 0; c < numChunks; ++c)
+  {
+    chunks[c].firstLine = totalLines;
+    totalLines += chunks[c].numLines;
+  }
+  if (totalLines < firstLine[header.elements.size()])
+    throw std::invalid_argument("PLY file is truncated.");
+
+  parallelFor(numChunks, [&](size_t c)
+  {
+    PlyTextChunk& chunk = chunks[c];
+    size_t line = chunk.firstLine;
+    std::vector<uint32_t> polygon;
+    std::vector<double> values;
+    for (const char* p = bounds[c]; p < bounds[c + 1];)
+    {
+      const char* lineEnd = findLineEnd(p, bounds[c + 1]);
+      const char* next = lineEnd + 1;
+      if (!hasContent(p, lineEnd))
+      {
+        p = next;
+        continue;
+      }
+
+      if (line >= firstLine[vertexElement] && line < firstLine[vertexElement + 1])
+      {
+        size_t v = line - firstLine[vertexElement];
+        values.resize(vertices.properties.size());
+        for (size_t i = 0; i < vertices.properties.size(); ++i)
+        {
+          if (!parseDouble(p, lineEnd, values[i]))
+            throw std::invalid_argument("Malformed PLY vertex.");
+        }
+        for (size_t i = 0; i < 3; ++i)
+          positions[v * 3 + i] = static_cast<float>(values[static_cast<size_t>(layout.index[i])]);
+        if (layout.hasNormal())
+        {
+          for (size_t i = 0; i < 3; ++i)
+            normals[v * 3 + i] = static_cast<float>(values[static_cast<size_t>(layout.index[3 + i])]);
+        }
+      }
+      else if (   faceElement < header.elements.size()
+               && line >= firstLine[faceElement] && line < firstLine[faceElement + 1])
+      {
+        const PlyElement& faces = header.elements[faceElement];
+        for (size_t i = 0; i < faces.properties.size(); ++i)
+        {
+          const PlyProperty& prop = faces.properties[i];
+          double value;
+          if (!prop.isList)
+          {
+            if (!parseDouble(p, lineEnd, value))
+              throw std::invalid_argument("Malformed PLY face.");
+            continue;
+          }
+
+          if (!parseDouble(p, lineEnd, value))
+            throw std::invalid_argument("Malformed PLY face.");
+          size_t count = plyIndex(value);
+          if (count > static_cast<size_t>(lineEnd - p))
+            throw std::invalid_argument("Malformed PLY face.");
+          polygon.resize(count);
+          for (size_t j = 0; j < count; ++j)
+          {
+            if (!parseDouble(p, lineEnd, value))
+              throw std::invalid_argument("Malformed PLY face.");
+            polygon[j] = plyIndex(value);
+          }
+          if (isFaceIndexList(prop))
+            triangulate(polygon.empty() ? nullptr : &polygon[0], count, chunk.indices);
+        }
+      }
+
+      ++line;
+      p = next;
+    }
+  });
+
+  std::vector<uint32_t> indices;
+  size_t numIndices = 0;
+  for (auto it = chunks.begin(); it != chunks.end(); ++it)
+    numIndices += it->indices.size();
+  indices.reserve(numIndices);
+  for (auto it = chunks.begin(); it != chunks.end(); ++it)
+    indices.insert(indices.end(), it->indices.begin(), it->indices.end());
+
+  assembleMesh(positions, normals, indices, mesh);
+}
+
+void importPLY(const char* data, size_t size, AssetMesh& mesh)
+{
+  PlyHeader header = parsePlyHeader(data, size);
+  if (header.format == PLY_ASCII)
+    importAsciiPLY(data, size, header, mesh);
+  else
+    importBinaryPLY(data, size, header, mesh);
+}
+
+} // namespace
+
+//------------------------------------------------------------------------------
+bool getMeshFileFormat(const std::string& filename, MeshFileFormat& format)
+{
+  size_t dot = filename.find_last_of('.');
+  if (dot == std::string::npos)
+    return false;
+
+  std::string extension = filename.substr(dot + 1);
+  std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+  if (extension == "ply")
+    format = MESH_FILE_PLY;
+  else if (extension == "stl")
+    format = MESH_FILE_STL;
+  else if (extension == "obj")
+    format = MESH_FILE_OBJ;
+  else
+    return false;
+  return true;
+}
+
+//------------------------------------------------------------------------------
+void importMesh(const char* data, size_t size, MeshFileFormat format,
+                AssetMesh& mesh)
+{
+  mesh = AssetMesh();
+  switch (format)
+  {
+    case MESH_FILE_PLY: importPLY(data, size, mesh); break;
+    case MESH_FILE_STL: importSTL(data, size, mesh); break;
+    case MESH_FILE_OBJ: importOBJ(data, size, mesh); break;
+  }
+}
+
+//------------------------------------------------------------------------------
+void importMesh(std::istream& stream, MeshFileFormat format, AssetMesh& mesh)
+{
+  std::vector<char> data;
+  const size_t blockSize = 1 << 22;
+  while (stream)
+  {
+    size_t offset = data.size();
+    data.resize(offset + blockSize);
+    stream.read(&data[offset], static_cast<std::streamsize>(blockSize));
+    data.resize(offset + static_cast<size_t>(stream.gcount()));
+  }
+
+  importMesh(data.empty() ? nullptr : &data[0], data.size(), format, mesh);
+}
+
+//------------------------------------------------------------------------------
+void computeVertexNormals(AssetMesh& mesh)
+{
+  if (mesh.vertexFormat != ASSET_VERTEX_FLOAT)
+    throw std::invalid_argument("Normals can only be computed for float vertices.");
+
+  size_t numVertices = mesh.numVertices();
+  if (numVertices == 0)
+    return;
+  float* vertices = reinterpret_cast<float*>(&mesh.vbo[0]);
+  std::vector<float> accum(numVertices * 3, 0.0f);
+
+  // The cross product is twice the triangle area, which gives area weighting.
+  for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3)
+  {
+    const uint32_t* tri = &mesh.indices[t];
+    const float* a = vertices + tri[0] * 6;
+    const float* b = vertices + tri[1] * 6;
+    const float* c = vertices + tri[2] * 6;
+    float e0[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+    float e1[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+    float n[3] = {e0[1] * e1[2] - e0[2] * e1[1],
+                  e0[2] * e1[0] - e0[0] * e1[2],
+                  e0[0] * e1[1] - e0[1] * e1[0]};
+    for (size_t corner = 0; corner < 3; ++corner)
+    {
+      for (size_t i = 0; i < 3; ++i)
+        accum[tri[corner] * 3 + i] += n[i];
+    }
+  }
+
+  size_t numBlocks = (numVertices + BINARY_BLOCK_SIZE - 1) / BINARY_BLOCK_SIZE;
+  parallelFor(numBlocks, [&](size_t block)
+  {
+    size_t begin = block * BINARY_BLOCK_SIZE;
+    size_t end = std::min(begin + BINARY_BLOCK_SIZE, numVertices);
+    for (size_t v = begin; v < end; ++v)
+    {
+      const float* n = &accum[v * 3];
+      float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+      float* out = vertices + v * 6 + 3;
+      if (length > 0.0f)
+      {
+        out[0] = n[0] / length;
+        out[1] = n[1] / length;
+        out[2] = n[2] / length;
+      }
+      else
+      {
+        out[0] = 0.0f;
+        out[1] = 0.0f;
+        out[2] = 1.0f;
+      }
+    }
+  });
+}
+
+} // namespace CPM_SPIRE_NS
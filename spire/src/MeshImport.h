@@ -0,0 +1,76 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+/// \brief  Native importers for PLY (ASCII and binary), binary STL and OBJ.
+///         Files are parsed straight into AssetMesh buffers without building
+///         an intermediate scene graph. Text formats are split into chunks at
+///         line boundaries which are parsed in parallel, binary vertex data is
+///         decoded in parallel.
+
+#ifndef SPIRE_HIGH_MESHIMPORT_H
+#define SPIRE_HIGH_MESHIMPORT_H
+
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+
+#include "AssetFile.h"
+
+namespace CPM_SPIRE_NS {
+
+/// File formats understood by importMesh.
+enum MeshFileFormat
+{
+  MESH_FILE_PLY,
+  MESH_FILE_STL,
+  MESH_FILE_OBJ,
+};
+
+/// Determines the format from the extension of 'filename' (case insensitive).
+/// \return False if the extension is not .ply, .stl or .obj.
+bool getMeshFileFormat(const std::string& filename, MeshFileFormat& format);
+
+/// Imports a mesh file that has been read into memory. The resulting mesh
+/// always has ASSET_VERTEX_FLOAT vertices (position, normal). Normals that
+/// are not present in the file are computed from the triangles. Polygons are
+/// triangulated as fans and geometry is returned as stored in the file (no
+/// change of handedness).
+/// Throws std::invalid_argument if the file is malformed or unsupported.
+void importMesh(const char* data, size_t size, MeshFileFormat format,
+                AssetMesh& mesh);
+
+/// Reads the remainder of 'stream' and imports it.
+void importMesh(std::istream& stream, MeshFileFormat format, AssetMesh& mesh);
+
+/// Replaces the normals of an ASSET_VERTEX_FLOAT mesh with area weighted
+/// vertex normals. Vertices not referenced by any triangle get +Z.
+void computeVertexNormals(AssetMesh& mesh);
+
+} // namespace CPM_SPIRE_NS
+
+#endif
@@ -0,0 +1,593 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include "MeshOptimizer.h"
+#include "Parallel.h"
+
+namespace CPM_SPIRE_NS {
+
+namespace {
+
+const uint32_t INVALID_INDEX = 0xFFFFFFFF;
+
+/// FNV-1a over the bytes of a single vertex.
+uint64_t hashVertex(const uint8_t* data, size_t size)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < size; ++i)
+  {
+    hash ^= data[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+void readPosition(const uint8_t* vbo, size_t stride, size_t positionOffset,
+                  uint32_t vertex, float* out)
+{
+  std::memcpy(out, vbo + static_cast<size_t>(vertex) * stride + positionOffset,
+              sizeof(float) * 3);
+}
+
+void validateIndices(const std::vector<uint32_t>& indices, size_t numVertices)
+{
+  if (indices.size() % 3 != 0)
+    throw std::invalid_argument("Index buffer is not a triangle list.");
+
+  for (auto it = indices.begin(); it != indices.end(); ++it)
+  {
+    if (*it >= numVertices)
+      throw std::out_of_range("Index references a vertex outside of the VBO.");
+  }
+}
+
+/// Tipsify over a triangle list whose indices lie in [0, numVertices).
+/// 'clusters' receives the triangle offsets at which dead ends were resolved.
+void tipsify(const uint32_t* in, size_t numTriangles, size_t numVertices,
+             size_t cacheSize, uint32_t* out, std::vector<uint32_t>& clusters)
+{
+  // Vertex -> triangle adjacency in compressed row form.
+  std::vector<uint32_t> liveCount(numVertices, 0);
+  for (size_t i = 0; i < numTriangles * 3; ++i)
+    ++liveCount[in[i]];
+
+  std::vector<uint32_t> offsets(numVertices + 1, 0);
+  for (size_t v = 0; v < numVertices; ++v)
+    offsets[v + 1] = offsets[v] + liveCount[v];
+
+  std::vector<uint32_t> adjacency(numTriangles * 3);
+  {
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t t = 0; t < numTriangles; ++t)
+    {
+      for (size_t c = 0; c < 3; ++c)
+        adjacency[fill[in[t * 3 + c]]++] = static_cast<uint32_t>(t);
+    }
+  }
+
+  // Cache time stamps. A vertex is in the cache when fewer than 'cacheSize'
+  // vertices have been inserted since it was inserted itself.
+  std::vector<size_t>   cacheTime(numVertices, 0);
+  std::vector<uint8_t>  emitted(numTriangles, 0);
+  std::vector<uint32_t> deadEnd;
+  std::vector<uint32_t> candidates;
+  deadEnd.reserve(numTriangles * 3);
+
+  size_t time = cacheSize + 1;
+  size_t cursor = 0;
+  size_t numEmitted = 0;
+  uint32_t fan = 0;
+
+  clusters.push_back(0);
+  while (numVertices > 0)
+  {
+    candidates.clear();
+    for (uint32_t k = offsets[fan]; k < offsets[fan + 1]; ++k)
+    {
+      uint32_t t = adjacency[k];
+      if (emitted[t])
+        continue;
+
+      for (size_t c = 0; c < 3; ++c)
+      {
+        uint32_t v = in[t * 3 + c];
+        out[numEmitted * 3 + c] = v;
+        deadEnd.push_back(v);
+        candidates.push_back(v);
+        --liveCount[v];
+        if (time - cacheTime[v] > cacheSize)
+          cacheTime[v] = time++;
+      }
+      emitted[t] = 1;
+      ++numEmitted;
+    }
+
+    // Prefer the candidate that has been in the cache longest, provided its
+    // remaining fan will still fit in the cache.
+    uint32_t next = INVALID_INDEX;
+    size_t bestPriority = 0;
+    for (auto it = candidates.begin(); it != candidates.end(); ++it)
+    {
+      if (liveCount[*it] == 0)
+        continue;
+
+      size_t priority = 0;
+      if (time - cacheTime[*it] + 2 * liveCount[*it] <= cacheSize)
+        priority = time - cacheTime[*it];
+
+      if (next == INVALID_INDEX || priority > bestPriority)
+      {
+        next = *it;
+        bestPriority = priority;
+      }
+    }
+
+    if (next == INVALID_INDEX)
+    {
+      // Dead end. Try recently used vertices first, then scan in input order.
+      while (!deadEnd.empty() && next == INVALID_INDEX)
+      {
+        uint32_t d = deadEnd.back();
+        deadEnd.pop_back();
+        if (liveCount[d] > 0)
+          next = d;
+      }
+
+      while (next == INVALID_INDEX && cursor < numVertices)
+      {
+        if (liveCount[cursor] > 0)
+          next = static_cast<uint32_t>(cursor);
+        ++cursor;
+      }
+
+      if (next == INVALID_INDEX)
+        break;
+
+      if (numEmitted > clusters.back())
+        clusters.push_back(static_cast<uint32_t>(numEmitted));
+    }
+
+    fan = next;
+  }
+}
+
+} // anonymous namespace
+
+//------------------------------------------------------------------------------
+std::vector<uint32_t> unpackIndices(const uint8_t* iboData, size_t iboSize,
+                                    size_t indexSize)
+{
+  if (indexSize != 1 && indexSize != 2 && indexSize != 4)
+    throw std::invalid_argument("Index size must be 1, 2, or 4 bytes.");
+
+  size_t numIndices = iboSize / indexSize;
+  std::vector<uint32_t> indices(numIndices);
+  for (size_t i = 0; i < numIndices; ++i)
+  {
+    const uint8_t* src = iboData + i * indexSize;
+    switch (indexSize)
+    {
+      case 1: indices[i] = *src; break;
+      case 2: { uint16_t v; std::memcpy(&v, src, 2); indices[i] = v; } break;
+      default: std::memcpy(&indices[i], src, 4); break;
+    }
+  }
+  return indices;
+}
+
+//------------------------------------------------------------------------------
+void packIndices(const std::vector<uint32_t>& indices, size_t indexSize,
+                 std::vector<uint8_t>& iboOut)
+{
+  if (indexSize != 1 && indexSize != 2 && indexSize != 4)
+    throw std::invalid_argument("Index size must be 1, 2, or 4 bytes.");
+
+  uint64_t maxIndex = (static_cast<uint64_t>(1) << (indexSize * 8)) - 1;
+  iboOut.resize(indices.size() * indexSize);
+  for (size_t i = 0; i < indices.size(); ++i)
+  {
+    if (indices[i] > maxIndex)
+      throw std::range_error("Index does not fit in the requested index size.");
+
+    uint8_t* dst = &iboOut[i * indexSize];
+    switch (indexSize)
+    {
+      case 1: *dst = static_cast<uint8_t>(indices[i]); break;
+      case 2: { uint16_t v = static_cast<uint16_t>(indices[i]); std::memcpy(dst, &v, 2); } break;
+      default: std::memcpy(dst, &indices[i], 4); break;
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+size_t weldVertices(std::vector<uint8_t>& vbo, size_t stride,
+                    std::vector<uint32_t>& indices)
+{
+  if (stride == 0)
+    throw std::invalid_argument("Vertex stride must be non-zero.");
+
+  size_t numVertices = vbo.size() / stride;
+  validateIndices(indices, numVertices);
+  if (numVertices == 0)
+    return 0;
+
+  // Hashing is the expensive part, so it is done in parallel.
+  const size_t blockSize = 16384;
+  std::vector<uint64_t> hashes(numVertices);
+  parallelFor((numVertices + blockSize - 1) / blockSize, [&](size_t block)
+  {
+    size_t end = std::min(numVertices, (block + 1) * blockSize);
+    for (size_t v = block * blockSize; v < end; ++v)
+      hashes[v] = hashVertex(&vbo[v * stride], stride);
+  });
+
+  // Open addressing table holding the compacted index of each unique vertex.
+  // Unique vertices are compacted in place as they are found. This is safe
+  // since a vertex is only ever moved towards the front of the buffer, past
+  // vertices that have already been visited.
+  size_t tableSize = 1;
+  while (tableSize < numVertices * 2)
+    tableSize *= 2;
+  std::vector<uint32_t> table(tableSize, INVALID_INDEX);
+  std::vector<uint32_t> remap(numVertices);
+
+  size_t numUnique = 0;
+  for (size_t v = 0; v < numVertices; ++v)
+  {
+    size_t slot = static_cast<size_t>(hashes[v]) & (tableSize - 1);
+    for (;;)
+    {
+      uint32_t unique = table[slot];
+      if (unique == INVALID_INDEX)
+      {
+        table[slot] = static_cast<uint32_t>(numUnique);
+        remap[v] = static_cast<uint32_t>(numUnique);
+        if (numUnique != v)
+        {
+          std::memmove(&vbo[numUnique * stride], &vbo[v * stride], stride);
+          hashes[numUnique] = hashes[v];
+        }
+        ++numUnique;
+        break;
+      }
+      if (hashes[unique] == hashes[v]
+          && std::memcmp(&vbo[unique * stride], &vbo[v * stride], stride) == 0)
+      {
+        remap[v] = unique;
+        break;
+      }
+      slot = (slot + 1) & (tableSize - 1);
+    }
+  }
+  vbo.resize(numUnique * stride);
+
+  for (auto it = indices.begin(); it != indices.end(); ++it)
+    *it = remap[*it];
+
+  return numUnique;
+}
+
+//------------------------------------------------------------------------------
+std::vector<uint32_t> optimizeVertexCache(std::vector<uint32_t>& indices,
+                                          size_t numVertices, size_t cacheSize)
+{
+  validateIndices(indices, numVertices);
+
+  size_t numTriangles = indices.size() / 3;
+  std::vector<uint32_t> result(indices.size());
+  std::vector<uint32_t> clusters;
+  if (numTriangles == 0)
+  {
+    clusters.push_back(0);
+    return clusters;
+  }
+
+  if (numTriangles <= MESH_PARALLEL_CHUNK_TRIANGLES)
+  {
+    tipsify(&indices[0], numTriangles, numVertices, cacheSize, &result[0],
+            clusters);
+    indices.swap(result);
+    return clusters;
+  }
+
+  // Large meshes are split into fixed size chunks, each of which is reordered
+  // on its own with compact local vertex indices. Triangles are first bucketed
+  // by their smallest vertex index (stable counting sort) so that every chunk
+  // covers a contiguous range of vertices instead of arbitrary input order.
+  {
+    std::vector<uint32_t> offsets(numVertices + 1, 0);
+    for (size_t t = 0; t < numTriangles; ++t)
+    {
+      const uint32_t* tri = &indices[t * 3];
+      ++offsets[std::min(tri[0], std::min(tri[1], tri[2])) + 1];
+    }
+    for (size_t v = 0; v < numVertices; ++v)
+      offsets[v + 1] += offsets[v];
+    for (size_t t = 0; t < numTriangles; ++t)
+    {
+      const uint32_t* tri = &indices[t * 3];
+      uint32_t dst = offsets[std::min(tri[0], std::min(tri[1], tri[2]))]++;
+      std::copy(tri, tri + 3, &result[dst * 3]);
+    }
+    indices.swap(result);
+  }
+
+  size_t numChunks = (numTriangles + MESH_PARALLEL_CHUNK_TRIANGLES - 1)
+                     / MESH_PARALLEL_CHUNK_TRIANGLES;
+  std::vector<std::vector<uint32_t>> chunkClusters(numChunks);
+  parallelFor(numChunks, [&](size_t chunk)
+  {
+    size_t begin = chunk * MESH_PARALLEL_CHUNK_TRIANGLES;
+    size_t count = std::min(MESH_PARALLEL_CHUNK_TRIANGLES, numTriangles - begin);
+
+    std::vector<uint32_t> local(indices.begin() + static_cast<ptrdiff_t>(begin * 3),
+                                indices.begin() + static_cast<ptrdiff_t>((begin + count) * 3));
+    std::vector<uint32_t> unique(local);
+    std::sort(unique.begin(), unique.end());
+    unique.erase(std::unique(unique.begin(), unique.end()), unique.end());
+    for (auto it = local.begin(); it != local.end(); ++it)
+      *it = static_cast<uint32_t>(
+          std::lower_bound(unique.begin(), unique.end(), *it) - unique.begin());
+
+    std::vector<uint32_t> out(local.size());
+    std::vector<uint32_t>& localClusters = chunkClusters[chunk];
+    tipsify(&local[0], count, unique.size(), cacheSize, &out[0], localClusters);
+
+    for (size_t i = 0; i < out.size(); ++i)
+      result[begin * 3 + i] = unique[out[i]];
+    for (auto it = localClusters.begin(); it != localClusters.end(); ++it)
+      *it += static_cast<uint32_t>(begin);
+  });
+
+  for (auto it = chunkClusters.begin(); it != chunkClusters.end(); ++it)
+    clusters.insert(clusters.end(), it->begin(), it->end());
+
+  indices.swap(result);
+  return clusters;
+}
+
+//------------------------------------------------------------------------------
+void optimizeOverdraw(std::vector<uint32_t>& indices,
+                      const std::vector<uint32_t>& clusters,
+                      const uint8_t* vbo, size_t stride, size_t positionOffset,
+                      size_t numVertices, size_t cacheSize, float threshold)
+{
+  validateIndices(indices, numVertices);
+  if (positionOffset + sizeof(float) * 3 > stride)
+    throw std::invalid_argument("Position attribute lies outside of the vertex.");
+
+  size_t numTriangles = indices.size() / 3;
+  if (numTriangles == 0)
+    return;
+
+  // Split the hard clusters further wherever the running ACMR of the current
+  // cluster is already close to that of the entire hard cluster.
+  std::vector<size_t> cacheTime(numVertices, 0);
+  size_t time = cacheSize + 1;
+  auto triangleMisses = [&](size_t t) -> size_t
+  {
+    size_t misses = 0;
+    for (size_t c = 0; c < 3; ++c)
+    {
+      uint32_t v = indices[t * 3 + c];
+      if (time - cacheTime[v] > cacheSize)
+      {
+        cacheTime[v] = time++;
+        ++misses;
+      }
+    }
+    return misses;
+  };
+
+  std::vector<uint32_t> soft;
+  for (size_t i = 0; i < clusters.size(); ++i)
+  {
+    size_t begin = clusters[i];
+    size_t end = (i + 1 < clusters.size()) ? clusters[i + 1] : numTriangles;
+    if (begin >= end || end > numTriangles)
+      continue;
+
+    time += cacheSize + 1;  // Flushes the cache.
+    size_t hardMisses = 0;
+    for (size_t t = begin; t < end; ++t)
+      hardMisses += triangleMisses(t);
+    float hardACMR = static_cast<float>(hardMisses) / static_cast<float>(end - begin);
+
+    time += cacheSize + 1;
+    soft.push_back(static_cast<uint32_t>(begin));
+    size_t runBegin = begin;
+    size_t runMisses = 0;
+    for (size_t t = begin; t < end; ++t)
+    {
+      runMisses += triangleMisses(t);
+      float runACMR = static_cast<float>(runMisses)
+                      / static_cast<float>(t + 1 - runBegin);
+      if (t + 1 < end && runACMR <= threshold * hardACMR)
+      {
+        soft.push_back(static_cast<uint32_t>(t + 1));
+        runBegin = t + 1;
+        runMisses = 0;
+        time += cacheSize + 1;
+      }
+    }
+  }
+
+  // Mesh centroid.
+  float meshCentroid[3] = {0.0f, 0.0f, 0.0f};
+  for (size_t v = 0; v < numVertices; ++v)
+  {
+    float p[3];
+    readPosition(vbo, stride, positionOffset, static_cast<uint32_t>(v), p);
+    for (size_t c = 0; c < 3; ++c)
+      meshCentroid[c] += p[c];
+  }
+  for (size_t c = 0; c < 3; ++c)
+    meshCentroid[c] /= static_cast<float>(std::max(numVertices, static_cast<size_t>(1)));
+
+  // Clusters facing away from the centroid are likely to occlude the rest of
+  // the mesh, so they are drawn first.
+  std::vector<float> sortKey(soft.size());
+  parallelFor(soft.size(), [&](size_t i)
+  {
+    size_t begin = soft[i];
+    size_t end = (i + 1 < soft.size()) ? soft[i + 1] : numTriangles;
+
+    float centroid[3] = {0.0f, 0.0f, 0.0f};
+    float normal[3] = {0.0f, 0.0f, 0.0f};
+    float totalArea = 0.0f;
+    for (size_t t = begin; t < end; ++t)
+    {
+      float p0[3], p1[3], p2[3];
+      readPosition(vbo, stride, positionOffset, indices[t * 3 + 0], p0);
+      readPosition(vbo, stride, positionOffset, indices[t * 3 + 1], p1);
+      readPosition(vbo, stride, positionOffset, indices[t * 3 + 2], p2);
+
+      float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+      float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+      float n[3] = {e1[1] * e2[2] - e1[2] * e2[1],
+                    e1[2] * e2[0] - e1[0] * e2[2],
+                    e1[0] * e2[1] - e1[1] * e2[0]};
+      float area = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+      for (size_t c = 0; c < 3; ++c)
+      {
+        centroid[c] += (p0[c] + p1[c] + p2[c]) * (area / 3.0f);
+        normal[c] += n[c];
+      }
+      totalArea += area;
+    }
+
+    float normalLength = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1]
+                                   + normal[2] * normal[2]);
+    if (totalArea <= 0.0f || normalLength <= 0.0f)
+    {
+      sortKey[i] = 0.0f;
+      return;
+    }
+
+    float key = 0.0f;
+    for (size_t c = 0; c < 3; ++c)
+      key += (centroid[c] / totalArea - meshCentroid[c]) * normal[c];
+    sortKey[i] = key / normalLength;
+  });
+
+  std::vector<uint32_t> order(soft.size());
+  for (size_t i = 0; i < order.size(); ++i)
+    order[i] = static_cast<uint32_t>(i);
+  std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+  {
+    return sortKey[a] > sortKey[b];
+  });
+
+  std::vector<uint32_t> result;
+  result.reserve(indices.size());
+  for (auto it = order.begin(); it != order.end(); ++it)
+  {
+    size_t begin = soft[*it];
+    size_t end = (*it + 1 < soft.size()) ? soft[*it + 1] : numTriangles;
+    result.insert(result.end(),
+                  indices.begin() + static_cast<ptrdiff_t>(begin * 3),
+                  indices.begin() + static_cast<ptrdiff_t>(end * 3));
+  }
+  indices.swap(result);
+}
+
+//------------------------------------------------------------------------------
+size_t optimizeVertexFetch(std::vector<uint8_t>& vbo, size_t stride,
+                           std::vector<uint32_t>& indices)
+{
+  if (stride == 0)
+    throw std::invalid_argument("Vertex stride must be non-zero.");
+
+  size_t numVertices = vbo.size() / stride;
+  validateIndices(indices, numVertices);
+
+  std::vector<uint32_t> remap(numVertices, INVALID_INDEX);
+  uint32_t next = 0;
+  for (auto it = indices.begin(); it != indices.end(); ++it)
+  {
+    if (remap[*it] == INVALID_INDEX)
+      remap[*it] = next++;
+    *it = remap[*it];
+  }
+
+  std::vector<uint8_t> result(static_cast<size_t>(next) * stride);
+  for (size_t v = 0; v < numVertices; ++v)
+  {
+    if (remap[v] != INVALID_INDEX)
+      std::memcpy(&result[remap[v] * stride], &vbo[v * stride], stride);
+  }
+  vbo.swap(result);
+  return next;
+}
+
+//------------------------------------------------------------------------------
+float calculateACMR(const std::vector<uint32_t>& indices, size_t numVertices,
+                    size_t cacheSize)
+{
+  validateIndices(indices, numVertices);
+  if (indices.empty())
+    return 0.0f;
+
+  std::vector<size_t> cacheTime(numVertices, 0);
+  size_t time = cacheSize + 1;
+  size_t misses = 0;
+  for (auto it = indices.begin(); it != indices.end(); ++it)
+  {
+    if (time - cacheTime[*it] > cacheSize)
+    {
+      cacheTime[*it] = time++;
+      ++misses;
+    }
+  }
+
+  return static_cast<float>(misses) / static_cast<float>(indices.size() / 3);
+}
+
+//------------------------------------------------------------------------------
+size_t optimizeMesh(std::vector<uint8_t>& vbo, size_t stride,
+                    size_t positionOffset, std::vector<uint32_t>& indices,
+                    size_t cacheSize)
+{
+  size_t numVertices = weldVertices(vbo, stride, indices);
+  if (numVertices == 0)
+    return 0;
+
+  std::vector<uint32_t> clusters = optimizeVertexCache(indices, numVertices,
+                                                       cacheSize);
+  optimizeOverdraw(indices, clusters, &vbo[0], stride, positionOffset,
+                   numVertices, cacheSize);
+  return optimizeVertexFetch(vbo, stride, indices);
+}
+
+} // namespace CPM_SPIRE_NS
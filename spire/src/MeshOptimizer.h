@@ -0,0 +1,111 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+/// \brief  Runtime mesh processing: vertex welding, post-transform cache
+///         optimization (Tipsify), overdraw-aware cluster ordering and vertex
+///         fetch optimization. These operate directly on the buffers handed to
+///         Interface::addVBO / addIBO so that geometry generated at runtime
+///         receives the same treatment assetConv gives to assets.
+
+#ifndef SPIRE_HIGH_MESHOPTIMIZER_H
+#define SPIRE_HIGH_MESHOPTIMIZER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace CPM_SPIRE_NS {
+
+/// Default post-transform cache size used when reordering triangles.
+/// Conservative enough for all hardware we target.
+const size_t MESH_DEFAULT_CACHE_SIZE = 16;
+
+/// Meshes with more triangles than this are reordered in independent,
+/// fixed-size chunks spread across all cores. The chunk size does not depend
+/// on the number of cores, so results are identical on every machine.
+const size_t MESH_PARALLEL_CHUNK_TRIANGLES = 65536;
+
+/// Expands an IBO of 'indexSize' bytes per index (1, 2 or 4) into 32 bit
+/// indices.
+std::vector<uint32_t> unpackIndices(const uint8_t* iboData, size_t iboSize,
+                                    size_t indexSize);
+
+/// Packs 32 bit indices back into an IBO of 'indexSize' bytes per index.
+/// Throws std::range_error if an index does not fit.
+void packIndices(const std::vector<uint32_t>& indices, size_t indexSize,
+                 std::vector<uint8_t>& iboOut);
+
+/// Merges vertices that are bitwise identical across the entire stride.
+/// Vertices are kept in order of first occurrence and 'indices' are remapped.
+/// \return The number of vertices remaining in 'vbo'.
+size_t weldVertices(std::vector<uint8_t>& vbo, size_t stride,
+                    std::vector<uint32_t>& indices);
+
+/// Reorders the triangle list 'indices' for the post-transform vertex cache
+/// using Tipsify (Sander, Nehab and Barczak 2007).
+/// \return Offsets, in triangles, of the hard cluster boundaries produced by
+///         the reordering (always starts with 0). Feed these to
+///         optimizeOverdraw.
+std::vector<uint32_t> optimizeVertexCache(std::vector<uint32_t>& indices,
+                                          size_t numVertices,
+                                          size_t cacheSize = MESH_DEFAULT_CACHE_SIZE);
+
+/// Splits the clusters generated by optimizeVertexCache further wherever the
+/// local ACMR allows it (at most 'threshold' times the cluster's ACMR) and
+/// sorts them so that outward facing clusters are drawn first. This reduces
+/// overdraw from every viewpoint while keeping the cache friendly ordering.
+/// Positions are three floats located 'positionOffset' bytes into each vertex.
+void optimizeOverdraw(std::vector<uint32_t>& indices,
+                      const std::vector<uint32_t>& clusters,
+                      const uint8_t* vbo, size_t stride, size_t positionOffset,
+                      size_t numVertices,
+                      size_t cacheSize = MESH_DEFAULT_CACHE_SIZE,
+                      float threshold = 1.05f);
+
+/// Reorders vertices in the order in which they are first referenced by
+/// 'indices' and drops unreferenced vertices.
+/// \return The number of vertices remaining in 'vbo'.
+size_t optimizeVertexFetch(std::vector<uint8_t>& vbo, size_t stride,
+                           std::vector<uint32_t>& indices);
+
+/// Average cache miss ratio: transformed vertices per triangle when drawing
+/// 'indices' through a FIFO cache of 'cacheSize' entries. 3.0 is the worst
+/// possible value, 0.5 is the best achievable on large regular meshes.
+float calculateACMR(const std::vector<uint32_t>& indices, size_t numVertices,
+                    size_t cacheSize = MESH_DEFAULT_CACHE_SIZE);
+
+/// Runs the entire pipeline above: weld, cache, overdraw and fetch
+/// optimization.
+/// \return The number of vertices remaining in 'vbo'.
+size_t optimizeMesh(std::vector<uint8_t>& vbo, size_t stride,
+                    size_t positionOffset, std::vector<uint32_t>& indices,
+                    size_t cacheSize = MESH_DEFAULT_CACHE_SIZE);
+
+} // namespace CPM_SPIRE_NS
+
+#endif
@@ -0,0 +1,1208 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <stdexcept>
+
+#include "MeshSimplifier.h"
+#include "Parallel.h"
+
+namespace CPM_SPIRE_NS {
+
+namespace {
+
+const uint32_t INVALID_INDEX = std::numeric_limits<uint32_t>::max();
+
+/// Collapses may not turn a triangle further than this (cosine of the angle
+/// between its normal before and after), which also rejects flips.
+const double MIN_NORMAL_COSINE = 0.2;
+
+enum VertexKind
+{
+  VERTEX_INTERIOR,
+  VERTEX_BOUNDARY,  ///< On an open boundary; only slides along it.
+  VERTEX_LOCKED,    ///< Shared with another partition or non-manifold.
+};
+
+struct Vec3
+{
+  Vec3() : x(0.0), y(0.0), z(0.0) {}
+  Vec3(double ax, double ay, double az) : x(ax), y(ay), z(az) {}
+
+  Vec3 operator+(const Vec3& o) const {return Vec3(x + o.x, y + o.y, z + o.z);}
+  Vec3 operator-(const Vec3& o) const {return Vec3(x - o.x, y - o.y, z - o.z);}
+  Vec3 operator*(double s) const      {return Vec3(x * s, y * s, z * s);}
+
+  double x, y, z;
+};
+
+double dot(const Vec3& a, const Vec3& b)
+{
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+Vec3 cross(const Vec3& a, const Vec3& b)
+{
+  return Vec3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+
+double length(const Vec3& v)
+{
+  return std::sqrt(dot(v, v));
+}
+
+/// Sum of squared distances to a set of planes: x^T A x + 2 b.x + c.
+struct Quadric
+{
+  Quadric()
+  {
+    std::fill(a, a + 10, 0.0);
+  }
+
+  /// Adds (g.x + d)^2.
+  void addSquare(const Vec3& g, double d, double weight)
+  {
+    a[0] += weight * g.x * g.x;
+    a[1] += weight * g.x * g.y;
+    a[2] += weight * g.x * g.z;
+    a[3] += weight * g.y * g.y;
+    a[4] += weight * g.y * g.z;
+    a[5] += weight * g.z * g.z;
+    a[6] += weight * d * g.x;
+    a[7] += weight * d * g.y;
+    a[8] += weight * d * g.z;
+    a[9] += weight * d * d;
+  }
+
+  /// Adds the plane through 'point' with unit normal 'n'.
+  void addPlane(const Vec3& n, const Vec3& point, double weight)
+  {
+    addSquare(n, -dot(n, point), weight);
+  }
+
+  void add(const Quadric& o)
+  {
+    for (int i = 0; i < 10; ++i)
+      a[i] += o.a[i];
+  }
+
+  void subtract(const Quadric& o)
+  {
+    for (int i = 0; i < 10; ++i)
+      a[i] -= o.a[i];
+  }
+
+  double evaluate(const Vec3& v) const
+  {
+    return  v.x * (a[0] * v.x + 2.0 * (a[1] * v.y + a[2] * v.z + a[6]))
+          + v.y * (a[3] * v.y + 2.0 * (a[4] * v.z + a[7]))
+          + v.z * (a[5] * v.z + 2.0 * a[8])
+          + a[9];
+  }
+
+  /// A00 A01 A02 A11 A12 A22, b0 b1 b2, c.
+  double a[10];
+};
+
+/// Error of the normals interpolated across triangles (Hoppe 1999): the sum
+/// over triangles and normal components j of (s_j - (g_j.x + d_j))^2, where
+/// g_j.x + d_j interpolates component j linearly over the triangle's plane.
+/// Evaluated at a position x with normal s, it measures how much the shading
+/// there differs from that of the triangles that were merged.
+struct AttributeQuadric
+{
+  AttributeQuadric() :
+      weight(0.0)
+  {
+    std::fill(offsets, offsets + 3, 0.0);
+  }
+
+  void addTriangle(const Vec3 p[3], const Vec3 n[3])
+  {
+    Vec3 e1 = p[1] - p[0];
+    Vec3 e2 = p[2] - p[0];
+    Vec3 normal = cross(e1, e2);
+    double det = dot(normal, normal);
+    if (!(det > 0.0))
+      return;
+
+    // Rows of the inverse of the matrix with rows e1, e2 and normal.
+    Vec3 toE1 = cross(e2, normal) * (1.0 / det);
+    Vec3 toE2 = cross(normal, e1) * (1.0 / det);
+    double components[3][3] = {{n[0].x, n[1].x, n[2].x},
+                               {n[0].y, n[1].y, n[2].y},
+                               {n[0].z, n[1].z, n[2].z}};
+    for (int j = 0; j < 3; ++j)
+    {
+      const double* c = components[j];
+      Vec3 g = toE1 * (c[1] - c[0]) + toE2 * (c[2] - c[0]);
+      double d = c[0] - dot(g, p[0]);
+      quadric.addSquare(g, d, 1.0);
+      gradients[j] = gradients[j] + g;
+      offsets[j] += d;
+    }
+    weight += 1.0;
+  }
+
+  void add(const AttributeQuadric& o)
+  {
+    quadric.add(o.quadric);
+    for (int j = 0; j < 3; ++j)
+    {
+      gradients[j] = gradients[j] + o.gradients[j];
+      offsets[j] += o.offsets[j];
+    }
+    weight += o.weight;
+  }
+
+  void subtract(const AttributeQuadric& o)
+  {
+    quadric.subtract(o.quadric);
+    for (int j = 0; j < 3; ++j)
+    {
+      gradients[j] = gradients[j] - o.gradients[j];
+      offsets[j] -= o.offsets[j];
+    }
+    weight -= o.weight;
+  }
+
+  double evaluate(const Vec3& x, const Vec3& s) const
+  {
+    double result = quadric.evaluate(x) + weight * dot(s, s)
+        - 2.0 * (  s.x * (dot(gradients[0], x) + offsets[0])
+                 + s.y * (dot(gradients[1], x) + offsets[1])
+                 + s.z * (dot(gradients[2], x) + offsets[2]));
+    return std::max(0.0, result);
+  }
+
+  Quadric quadric;      ///< Sum of (g_j.x + d_j)^2.
+  Vec3    gradients[3]; ///< Sums of g_j.
+  double  offsets[3];   ///< Sums of d_j.
+  double  weight;       ///< Number of triangles.
+};
+
+/// Distance from 'p' to the triangle (a, b, c). See Ericson, Real-Time
+/// Collision Detection, 5.1.5.
+double distanceToTriangle(const Vec3& p, const Vec3& a, const Vec3& b,
+                          const Vec3& c)
+{
+  Vec3 ab = b - a;
+  Vec3 ac = c - a;
+  Vec3 ap = p - a;
+  double d1 = dot(ab, ap);
+  double d2 = dot(ac, ap);
+  if (d1 <= 0.0 && d2 <= 0.0)
+    return length(ap);
+
+  Vec3 bp = p - b;
+  double d3 = dot(ab, bp);
+  double d4 = dot(ac, bp);
+  if (d3 >= 0.0 && d4 <= d3)
+    return length(bp);
+
+  double vc = d1 * d4 - d3 * d2;
+  if (vc <= 0.0 && d1 >= 0.0 && d3 <= 0.0)
+    return length(p - (a + ab * (d1 / (d1 - d3))));
+
+  Vec3 cp = p - c;
+  double d5 = dot(ab, cp);
+  double d6 = dot(ac, cp);
+  if (d6 >= 0.0 && d5 <= d6)
+    return length(cp);
+
+  double vb = d5 * d2 - d1 * d6;
+  if (vb <= 0.0 && d2 >= 0.0 && d6 <= 0.0)
+    return length(p - (a + ac * (d2 / (d2 - d6))));
+
+  double va = d3 * d6 - d5 * d4;
+  if (va <= 0.0 && (d4 - d3) >= 0.0 && (d5 - d6) >= 0.0)
+    return length(p - (b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)))));
+
+  double denominator = va + vb + vc;
+  if (!(denominator > 0.0))
+    return std::min(length(ap), std::min(length(bp), length(cp)));
+  double v = vb / denominator;
+  double w = vc / denominator;
+  return length(p - (a + ab * v + ac * w));
+}
+
+/// Spreads the low 10 bits of 'v' out to every third bit.
+uint32_t spreadBits(uint32_t v)
+{
+  v &= 0x3FF;
+  v = (v | (v << 16)) & 0x030000FF;
+  v = (v | (v <<  8)) & 0x0300F00F;
+  v = (v | (v <<  4)) & 0x030C30C3;
+  v = (v | (v <<  2)) & 0x09249249;
+  return v;
+}
+
+/// The mesh being simplified. Vertex data is read only; positions and
+/// triangles carry over from one round of partitions to the next.
+struct SimplifyMesh
+{
+  std::vector<Vec3>     positions;    ///< Per welded position.
+  std::vector<Vec3>     normals;      ///< Per vertex, empty without normals.
+  std::vector<uint32_t> positionOf;   ///< Welded position of every vertex.
+  std::vector<uint32_t> firstWedge;   ///< Vertices of position p are
+  std::vector<uint32_t> wedges;       ///< wedges[firstWedge[p], firstWedge[p + 1]).
+  Vec3                  boundsMin;
+  Vec3                  boundsMax;
+  double                normalScale;
+
+  std::vector<Quadric>  quadrics;     ///< Per position.
+  std::vector<uint8_t>  kinds;        ///< Per position, see VertexKind.
+  std::vector<uint32_t> parents;      ///< Position a removed position was
+                                      ///< merged into, itself otherwise.
+  std::vector<AttributeQuadric> attributes; ///< Per vertex, empty without
+                                           ///< normals.
+  std::vector<uint32_t> corners;      ///< Vertices of the current triangles.
+};
+
+/// What a partition changed, applied to the mesh once all partitions of a
+/// round are done.
+struct PartitionResult
+{
+  std::vector<uint32_t> corners;
+  std::vector<std::pair<uint32_t, Quadric>>  quadrics;  ///< Added to positions.
+  std::vector<std::pair<uint32_t, AttributeQuadric>> attributes;  ///< Added to
+                                                                  ///< vertices.
+  std::vector<std::pair<uint32_t, uint32_t>> merges;    ///< Removed, parent.
+};
+
+/// A candidate edge collapse: 'from' is merged into 'to'.
+struct Collapse
+{
+  double    cost;
+  uint32_t  from;
+  uint32_t  to;
+  uint32_t  version;  ///< Version of 'from' when the cost was computed.
+
+  bool operator>(const Collapse& o) const
+  {
+    if (cost != o.cost)
+      return cost > o.cost;
+    return from > o.from;
+  }
+};
+
+/// Simplifies the triangles of one partition. Positions are numbered locally
+/// in the order of their global numbers.
+class PartitionSimplifier
+{
+public:
+  /// Positions flagged in 'shared' are used by other partitions as well
+  /// and are not removed.
+  PartitionSimplifier(const SimplifyMesh& mesh,
+                      const std::vector<uint32_t>& triangles,
+                      const std::vector<uint8_t>& shared);
+
+  size_t getNumTriangles() const  {return mNumTriangles;}
+
+  /// Collapses edges until at most 'targetTriangles' remain or no valid
+  /// collapse is left.
+  void simplify(size_t targetTriangles);
+
+  void getResult(PartitionResult& result) const;
+
+private:
+  const Vec3& position(uint32_t local) const
+  {
+    return mMesh.positions[mPositions[local]];
+  }
+
+  /// Normal of triangle 't' with corner position 'from' moved to 'to'.
+  Vec3 triangleNormal(uint32_t t, uint32_t from, uint32_t to) const;
+
+  /// Drops dead triangles from the triangle list of 'p'.
+  void compact(uint32_t p);
+
+  /// Positions sharing a live triangle with 'p'.
+  void getNeighbors(uint32_t p, std::vector<uint32_t>& out) const;
+
+  /// Number of live triangles using the edge (p, q).
+  size_t countEdgeTriangles(uint32_t p, uint32_t q) const;
+
+  bool isValid(uint32_t p, uint32_t q);
+  double getCost(uint32_t p, uint32_t q);
+
+  /// Vertex of position 'q' whose normal is closest to that of 'vertex'.
+  uint32_t findWedge(uint32_t q, uint32_t vertex) const;
+
+  /// Local number of 'vertex', one of the vertices of position 'p'.
+  uint32_t localWedge(uint32_t p, uint32_t vertex) const;
+
+  /// Distinct vertices of the live corners at 'p'.
+  void getWedges(uint32_t p, std::vector<uint32_t>& out) const;
+
+  /// Pushes the cheapest valid collapse of 'p', if any.
+  void evaluate(uint32_t p);
+  void collapse(uint32_t p, uint32_t q);
+
+  const SimplifyMesh&   mMesh;
+  std::vector<uint32_t> mPositions;       ///< Global number of each position.
+  std::vector<uint32_t> mCorners;         ///< Current vertex of each corner.
+  std::vector<uint32_t> mCornerPositions; ///< Local position of each corner.
+  std::vector<uint8_t>  mAlive;           ///< Per triangle.
+  size_t                mNumTriangles;    ///< Live triangles.
+
+  std::vector<std::vector<uint32_t>> mTriangles;  ///< Per position, may
+                                                  ///< contain dead triangles.
+  std::vector<Quadric>  mQuadrics;
+  std::vector<uint8_t>  mKinds;
+  std::vector<uint8_t>  mMerged;          ///< Absorbed another position.
+  std::vector<uint32_t> mParents;
+  std::vector<uint32_t> mVersions;
+  std::vector<uint32_t> mFirstWedge;      ///< Per position, see localWedge.
+  std::vector<AttributeQuadric> mAttributes;  ///< Per local vertex.
+  std::vector<uint8_t>  mMergedWedges;    ///< Absorbed another vertex.
+
+  std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> mHeap;
+  std::vector<uint32_t> mNeighbors[3];
+  std::vector<std::pair<double, uint32_t>> mCandidates;
+  std::vector<uint32_t> mWedges;
+};
+
+//------------------------------------------------------------------------------
+PartitionSimplifier::PartitionSimplifier(const SimplifyMesh& mesh,
+                                         const std::vector<uint32_t>& triangles,
+                                         const std::vector<uint8_t>& shared) :
+    mMesh(mesh),
+    mNumTriangles(triangles.size())
+{
+  size_t numCorners = triangles.size() * 3;
+  mCorners.resize(numCorners);
+  for (size_t t = 0; t < triangles.size(); ++t)
+  {
+    for (size_t i = 0; i < 3; ++i)
+      mCorners[t * 3 + i] = mesh.corners[triangles[t] * 3 + i];
+  }
+
+  mPositions.resize(numCorners);
+  for (size_t c = 0; c < numCorners; ++c)
+    mPositions[c] = mesh.positionOf[mCorners[c]];
+  std::sort(mPositions.begin(), mPositions.end());
+  mPositions.erase(std::unique(mPositions.begin(), mPositions.end()), mPositions.end());
+
+  size_t numPositions = mPositions.size();
+  mCornerPositions.resize(numCorners);
+  for (size_t c = 0; c < numCorners; ++c)
+  {
+    mCornerPositions[c] = static_cast<uint32_t>(
+        std::lower_bound(mPositions.begin(), mPositions.end(),
+                         mesh.positionOf[mCorners[c]]) - mPositions.begin());
+  }
+
+  mAlive.assign(triangles.size(), 1);
+  mTriangles.resize(numPositions);
+  for (uint32_t t = 0; t < triangles.size(); ++t)
+  {
+    for (size_t i = 0; i < 3; ++i)
+      mTriangles[mCornerPositions[t * 3 + i]].push_back(t);
+  }
+
+  mQuadrics.resize(numPositions);
+  mKinds.resize(numPositions);
+  mMerged.assign(numPositions, 0);
+  mParents.resize(numPositions);
+  mVersions.assign(numPositions, 0);
+  for (uint32_t p = 0; p < numPositions; ++p)
+  {
+    uint32_t global = mPositions[p];
+    mQuadrics[p] = mesh.quadrics[global];
+    mKinds[p] = shared[global] ? static_cast<uint8_t>(VERTEX_LOCKED)
+                               : mesh.kinds[global];
+    mParents[p] = p;
+  }
+
+  mFirstWedge.resize(numPositions + 1, 0);
+  for (uint32_t p = 0; p < numPositions; ++p)
+  {
+    uint32_t global = mPositions[p];
+    mFirstWedge[p + 1] = mFirstWedge[p]
+        + mesh.firstWedge[global + 1] - mesh.firstWedge[global];
+  }
+  if (!mesh.attributes.empty())
+  {
+    mAttributes.resize(mFirstWedge[numPositions]);
+    mMergedWedges.assign(mAttributes.size(), 0);
+    for (uint32_t p = 0; p < numPositions; ++p)
+    {
+      uint32_t first = mesh.firstWedge[mPositions[p]];
+      for (uint32_t w = mFirstWedge[p]; w < mFirstWedge[p + 1]; ++w)
+        mAttributes[w] = mesh.attributes[mesh.wedges[first + w - mFirstWedge[p]]];
+    }
+  }
+
+  for (uint32_t p = 0; p < numPositions; ++p)
+    evaluate(p);
+}
+
+//------------------------------------------------------------------------------
+Vec3 PartitionSimplifier::triangleNormal(uint32_t t, uint32_t from,
+                                         uint32_t to) const
+{
+  Vec3 p[3];
+  for (int i = 0; i < 3; ++i)
+  {
+    uint32_t local = mCornerPositions[t * 3 + i];
+    p[i] = position(local == from ? to : local);
+  }
+  return cross(p[1] - p[0], p[2] - p[0]);
+}
+
+//------------------------------------------------------------------------------
+void PartitionSimplifier::compact(uint32_t p)
+{
+  std::vector<uint32_t>& list = mTriangles[p];
+  list.erase(std::remove_if(list.begin(), list.end(), [this](uint32_t t)
+  {
+    return !mAlive[t];
+  }), list.end());
+}
+
+//------------------------------------------------------------------------------
+void PartitionSimplifier::getNeighbors(uint32_t p, std::vector<uint32_t>& out) const
+{
+  out.clear();
+  for (auto it = mTriangles[p].begin(); it != mTriangles[p].end(); ++it)
+  {
+    if (!mAlive[*it])
+      continue;
+    for (int i = 0; i < 3; ++i)
+    {
+      uint32_t q = mCornerPositions[*it * 3 + i];
+      if (q != p && std::find(out.begin(), out.end(), q) == out.end())
+        out.push_back(q);
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+size_t PartitionSimplifier::countEdgeTriangles(uint32_t p, uint32_t q) const
+{
+  size_t count = 0;
+  for (auto it = mTriangles[p].begin(); it != mTriangles[p].end(); ++it)
+  {
+    const uint32_t* tri = &mCornerPositions[*it * 3];
+    if (mAlive[*it] && (tri[0] == q || tri[1] == q || tri[2] == q))
+      ++count;
+  }
+  return count;
+}
+
+//------------------------------------------------------------------------------
+bool PartitionSimplifier::isValid(uint32_t p, uint32_t q)
+{
+  if (mKinds[p] == VERTEX_LOCKED || mParents[p] != p || mParents[q] != q)
+    return false;
+
+  // Boundary positions may only slide along the boundary.
+  size_t edgeTriangles = countEdgeTriangles(p, q);
+  if (edgeTriangles == 0 || edgeTriangles > 2)
+    return false;
+  if (mKinds[p] == VERTEX_BOUNDARY && edgeTriangles != 1)
+    return false;
+
+  // Link condition: the collapse keeps the surface manifold only if p and q
+  // share no neighbors besides the ones opposite of their edge.
+  std::vector<uint32_t>& pNeighbors = mNeighbors[1];
+  std::vector<uint32_t>& qNeighbors = mNeighbors[2];
+  getNeighbors(p, pNeighbors);
+  getNeighbors(q, qNeighbors);
+  size_t common = 0;
+  for (auto it = pNeighbors.begin(); it != pNeighbors.end(); ++it)
+  {
+    if (std::find(qNeighbors.begin(), qNeighbors.end(), *it) != qNeighbors.end())
+      ++common;
+  }
+  if (common != edgeTriangles)
+    return false;
+
+  for (auto it = mTriangles[p].begin(); it != mTriangles[p].end(); ++it)
+  {
+    uint32_t t = *it;
+    const uint32_t* tri = &mCornerPositions[t * 3];
+    if (!mAlive[t] || tri[0] == q || tri[1] == q || tri[2] == q)
+      continue;
+
+    // Triangles may neither flip nor turn too far ...
+    Vec3 before = triangleNormal(t, INVALID_INDEX, INVALID_INDEX);
+    Vec3 after = triangleNormal(t, p, q);
+    double lengths = length(before) * length(after);
+    if (!(lengths > 0.0) || dot(before, after) < MIN_NORMAL_COSINE * lengths)
+      return false;
+
+    // ... nor end up on top of another triangle of q (the last collapse of
+    // a tetrahedron).
+    uint32_t a = (tri[0] == p) ? tri[1] : tri[0];
+    uint32_t b = (tri[2] == p) ? tri[1] : tri[2];
+    for (auto other = mTriangles[q].begin(); other != mTriangles[q].end(); ++other)
+    {
+      const uint32_t* o = &mCornerPositions[*other * 3];
+      if (   mAlive[*other]
+          && (o[0] == a || o[1] == a || o[2] == a)
+          && (o[0] == b || o[1] == b || o[2] == b))
+        return false;
+    }
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+uint32_t PartitionSimplifier::findWedge(uint32_t q, uint32_t vertex) const
+{
+  uint32_t global = mPositions[q];
+  uint32_t first = mMesh.firstWedge[global];
+  uint32_t last = mMesh.firstWedge[global + 1];
+  uint32_t best = mMesh.wedges[first];
+  if (mMesh.normals.empty() || last - first == 1)
+    return best;
+
+  const Vec3& normal = mMesh.normals[vertex];
+  double bestDot = -std::numeric_limits<double>::max();
+  for (uint32_t w = first; w < last; ++w)
+  {
+    double d = dot(mMesh.normals[mMesh.wedges[w]], normal);
+    if (d > bestDot)
+    {
+      bestDot = d;
+      best = mMesh.wedges[w];
+    }
+  }
+  return best;
+}
+
+//------------------------------------------------------------------------------
+uint32_t PartitionSimplifier::localWedge(uint32_t p, uint32_t vertex) const
+{
+  uint32_t first = mMesh.firstWedge[mPositions[p]];
+  uint32_t w = first;
+  while (mMesh.wedges[w] != vertex)
+    ++w;
+  return mFirstWedge[p] + w - first;
+}
+
+//------------------------------------------------------------------------------
+void PartitionSimplifier::getWedges(uint32_t p, std::vector<uint32_t>& out) const
+{
+  out.clear();
+  for (auto it = mTriangles[p].begin(); it != mTriangles[p].end(); ++it)
+  {
+    if (!mAlive[*it])
+      continue;
+    for (uint32_t c = *it * 3; c < *it * 3 + 3; ++c)
+    {
+      if (   mCornerPositions[c] == p
+          && std::find(out.begin(), out.end(), mCorners[c]) == out.end())
+        out.push_back(mCorners[c]);
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+double PartitionSimplifier::getCost(uint32_t p, uint32_t q)
+{
+  Quadric quadric = mQuadrics[p];
+  quadric.add(mQuadrics[q]);
+  const Vec3& target = position(q);
+  double cost = std::max(0.0, quadric.evaluate(target));
+  if (mAttributes.empty())
+    return cost;
+
+  // Every vertex of p joins the vertex of q with the closest normal. Their
+  // attribute quadrics measure how far the normals q then interpolates are
+  // from those of the triangles they stand in for.
+  getWedges(p, mWedges);
+  for (auto it = mWedges.begin(); it != mWedges.end(); ++it)
+  {
+    uint32_t wedge = findWedge(q, *it);
+    AttributeQuadric attributes = mAttributes[localWedge(p, *it)];
+    attributes.add(mAttributes[localWedge(q, wedge)]);
+    cost += mMesh.normalScale * attributes.evaluate(target, mMesh.normals[wedge]);
+  }
+  return cost;
+}
+
+//------------------------------------------------------------------------------
+void PartitionSimplifier::evaluate(uint32_t p)
+{
+  if (mKinds[p] == VERTEX_LOCKED || mParents[p] != p)
+    return;
+
+  // Validity is the expensive part, so candidates are checked cheapest
+  // first.
+  std::vector<uint32_t>& neighbors = mNeighbors[0];
+  getNeighbors(p, neighbors);
+  mCandidates.clear();
+  for (auto it = neighbors.begin(); it != neighbors.end(); ++it)
+    mCandidates.push_back(std::make_pair(getCost(p, *it), *it));
+  std::sort(mCandidates.begin(), mCandidates.end());
+
+  for (auto it = mCandidates.begin(); it != mCandidates.end(); ++it)
+  {
+    if (isValid(p, it->second))
+    {
+      Collapse best;
+      best.cost = it->first;
+      best.from = p;
+      best.to = it->second;
+      best.version = mVersions[p];
+      mHeap.push(best);
+      return;
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+void PartitionSimplifier::collapse(uint32_t p, uint32_t q)
+{
+  if (!mAttributes.empty())
+  {
+    getWedges(p, mWedges);
+    for (auto it = mWedges.begin(); it != mWedges.end(); ++it)
+    {
+      uint32_t wedge = localWedge(q, findWedge(q, *it));
+      mAttributes[wedge].add(mAttributes[localWedge(p, *it)]);
+      mMergedWedges[wedge] = 1;
+    }
+  }
+
+  for (auto it = mTriangles[p].begin(); it != mTriangles[p].end(); ++it)
+  {
+    uint32_t t = *it;
+    if (!mAlive[t])
+      continue;
+    uint32_t* tri = &mCornerPositions[t * 3];
+    if (tri[0] == q || tri[1] == q || tri[2] == q)
+    {
+      mAlive[t] = 0;
+      --mNumTriangles;
+      continue;
+    }
+    for (uint32_t c = t * 3; c < t * 3 + 3; ++c)
+    {
+      if (mCornerPositions[c] == p)
+      {
+        mCornerPositions[c] = q;
+        mCorners[c] = findWedge(q, mCorners[c]);
+      }
+    }
+    mTriangles[q].push_back(t);
+  }
+  mTriangles[p].clear();
+  mQuadrics[q].add(mQuadrics[p]);
+  mMerged[q] = 1;
+  mParents[p] = q;
+
+  // Everything around q may now collapse differently.
+  compact(q);
+  std::vector<uint32_t> affected;
+  getNeighbors(q, affected);
+  affected.push_back(q);
+  for (auto it = affected.begin(); it != affected.end(); ++it)
+  {
+    compact(*it);
+    ++mVersions[*it];
+    evaluate(*it);
+  }
+}
+
+//------------------------------------------------------------------------------
+void PartitionSimplifier::simplify(size_t targetTriangles)
+{
+  while (mNumTriangles > targetTriangles && !mHeap.empty())
+  {
+    Collapse next = mHeap.top();
+    mHeap.pop();
+    if (mParents[next.from] != next.from || next.version != mVersions[next.from])
+      continue;
+
+    // Collapses further away may have changed the neighborhood of 'to'.
+    if (!isValid(next.from, next.to))
+    {
+      ++mVersions[next.from];
+      evaluate(next.from);
+      continue;
+    }
+    collapse(next.from, next.to);
+  }
+}
+
+//------------------------------------------------------------------------------
+void PartitionSimplifier::getResult(PartitionResult& result) const
+{
+  for (size_t t = 0; t < mAlive.size(); ++t)
+  {
+    if (!mAlive[t])
+      continue;
+    result.corners.insert(result.corners.end(), &mCorners[t * 3], &mCorners[t * 3] + 3);
+  }
+
+  // Shared positions may absorb positions of several partitions, so only
+  // what was added is handed back.
+  for (uint32_t p = 0; p < mPositions.size(); ++p)
+  {
+    if (mParents[p] != p)
+      result.merges.push_back(std::make_pair(mPositions[p], mPositions[mParents[p]]));
+    if (mMerged[p])
+    {
+      Quadric added = mQuadrics[p];
+      added.subtract(mMesh.quadrics[mPositions[p]]);
+      result.quadrics.push_back(std::make_pair(mPositions[p], added));
+    }
+  }
+  for (uint32_t p = 0; p < mPositions.size() && !mAttributes.empty(); ++p)
+  {
+    uint32_t first = mMesh.firstWedge[mPositions[p]];
+    for (uint32_t w = mFirstWedge[p]; w < mFirstWedge[p + 1]; ++w)
+    {
+      if (!mMergedWedges[w])
+        continue;
+      uint32_t vertex = mMesh.wedges[first + w - mFirstWedge[p]];
+      AttributeQuadric added = mAttributes[w];
+      added.subtract(mMesh.attributes[vertex]);
+      result.attributes.push_back(std::make_pair(vertex, added));
+    }
+  }
+}
+
+/// Reads the vertices of the mesh, welds their positions and sets up the
+/// quadrics of the positions.
+void buildSimplifyMesh(const uint8_t* vbo, size_t stride, size_t positionOffset,
+                       size_t normalOffset, size_t numVertices,
+                       const std::vector<uint32_t>& indices,
+                       float normalWeight, float boundaryWeight,
+                       SimplifyMesh& mesh)
+{
+  std::vector<Vec3> vertexPositions(numVertices);
+  std::vector<uint8_t> referenced(numVertices, 0);
+  for (auto it = indices.begin(); it != indices.end(); ++it)
+    referenced[*it] = 1;
+
+  std::vector<uint32_t> order;
+  for (size_t v = 0; v < numVertices; ++v)
+  {
+    float p[3];
+    std::memcpy(p, vbo + v * stride + positionOffset, sizeof(p));
+    vertexPositions[v] = Vec3(p[0], p[1], p[2]);
+    if (!referenced[v])
+      continue;
+    if (!std::isfinite(p[0]) || !std::isfinite(p[1]) || !std::isfinite(p[2]))
+      throw std::invalid_argument("Mesh positions must be finite.");
+    order.push_back(static_cast<uint32_t>(v));
+  }
+
+  if (normalOffset != MESH_SIMPLIFY_NO_NORMALS)
+  {
+    mesh.normals.resize(numVertices);
+    for (size_t v = 0; v < numVertices; ++v)
+    {
+      float n[3];
+      std::memcpy(n, vbo + v * stride + normalOffset, sizeof(n));
+      Vec3 normal(n[0], n[1], n[2]);
+      double l = length(normal);
+      mesh.normals[v] = (l > 0.0) ? normal * (1.0 / l) : normal;
+    }
+  }
+
+  // Vertices at the same position (seams) become wedges of one position.
+  std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+  {
+    const Vec3& pa = vertexPositions[a];
+    const Vec3& pb = vertexPositions[b];
+    if (pa.x != pb.x) return pa.x < pb.x;
+    if (pa.y != pb.y) return pa.y < pb.y;
+    if (pa.z != pb.z) return pa.z < pb.z;
+    return a < b;
+  });
+
+  mesh.positionOf.assign(numVertices, INVALID_INDEX);
+  for (size_t i = 0; i < order.size(); ++i)
+  {
+    const Vec3& p = vertexPositions[order[i]];
+    if (   mesh.positions.empty() || p.x != mesh.positions.back().x
+        || p.y != mesh.positions.back().y || p.z != mesh.positions.back().z)
+    {
+      mesh.firstWedge.push_back(static_cast<uint32_t>(mesh.wedges.size()));
+      mesh.positions.push_back(p);
+    }
+    mesh.positionOf[order[i]] = static_cast<uint32_t>(mesh.positions.size() - 1);
+    mesh.wedges.push_back(order[i]);
+  }
+  mesh.firstWedge.push_back(static_cast<uint32_t>(mesh.wedges.size()));
+
+  double maxValue = std::numeric_limits<double>::max();
+  mesh.boundsMin = Vec3(maxValue, maxValue, maxValue);
+  mesh.boundsMax = Vec3(-maxValue, -maxValue, -maxValue);
+  for (auto it = mesh.positions.begin(); it != mesh.positions.end(); ++it)
+  {
+    mesh.boundsMin = Vec3(std::min(mesh.boundsMin.x, it->x),
+                          std::min(mesh.boundsMin.y, it->y),
+                          std::min(mesh.boundsMin.z, it->z));
+    mesh.boundsMax = Vec3(std::max(mesh.boundsMax.x, it->x),
+                          std::max(mesh.boundsMax.y, it->y),
+                          std::max(mesh.boundsMax.z, it->z));
+  }
+  Vec3 diagonal = mesh.boundsMax - mesh.boundsMin;
+  mesh.normalScale = mesh.positions.empty() ? 0.0 : normalWeight * dot(diagonal, diagonal);
+
+  // Triangles with two corners at the same position cover nothing.
+  for (size_t t = 0; t < indices.size(); t += 3)
+  {
+    uint32_t a = mesh.positionOf[indices[t]];
+    uint32_t b = mesh.positionOf[indices[t + 1]];
+    uint32_t c = mesh.positionOf[indices[t + 2]];
+    if (a != b && b != c && a != c)
+      mesh.corners.insert(mesh.corners.end(), &indices[t], &indices[t] + 3);
+  }
+
+  size_t numPositions = mesh.positions.size();
+  mesh.quadrics.assign(numPositions, Quadric());
+  mesh.kinds.assign(numPositions, VERTEX_INTERIOR);
+  mesh.parents.resize(numPositions);
+  for (uint32_t p = 0; p < numPositions; ++p)
+    mesh.parents[p] = p;
+  if (!mesh.normals.empty())
+    mesh.attributes.resize(numVertices);
+
+  // Every position starts out with the planes of its triangles, every vertex
+  // with the normals of its triangles.
+  size_t numTriangles = mesh.corners.size() / 3;
+  std::vector<Vec3> normals(numTriangles);
+  std::vector<uint64_t> edges(mesh.corners.size());
+  for (size_t t = 0; t < numTriangles; ++t)
+  {
+    uint32_t tri[3];
+    for (size_t i = 0; i < 3; ++i)
+      tri[i] = mesh.positionOf[mesh.corners[t * 3 + i]];
+    const Vec3& p0 = mesh.positions[tri[0]];
+    Vec3 n = cross(mesh.positions[tri[1]] - p0, mesh.positions[tri[2]] - p0);
+    double area = length(n);
+    normals[t] = (area > 0.0) ? n * (1.0 / area) : Vec3();
+    if (area > 0.0 && !mesh.normals.empty())
+    {
+      Vec3 cornerPositions[3];
+      Vec3 cornerNormals[3];
+      for (size_t i = 0; i < 3; ++i)
+      {
+        cornerPositions[i] = mesh.positions[tri[i]];
+        cornerNormals[i] = mesh.normals[mesh.corners[t * 3 + i]];
+      }
+      AttributeQuadric attributes;
+      attributes.addTriangle(cornerPositions, cornerNormals);
+      for (size_t i = 0; i < 3; ++i)
+        mesh.attributes[mesh.corners[t * 3 + i]].add(attributes);
+    }
+    for (size_t i = 0; i < 3; ++i)
+    {
+      if (area > 0.0)
+        mesh.quadrics[tri[i]].addPlane(normals[t], p0, 1.0);
+      uint32_t a = tri[i];
+      uint32_t b = tri[(i + 1) % 3];
+      edges[t * 3 + i] = (static_cast<uint64_t>(std::min(a, b)) << 32) | std::max(a, b);
+    }
+  }
+
+  // Edges used by a single triangle are open boundaries. A plane through
+  // the edge, perpendicular to the triangle, keeps it in place. Edges used
+  // by more than two triangles are not manifold; their positions stay.
+  std::vector<uint64_t> sorted = edges;
+  std::sort(sorted.begin(), sorted.end());
+  for (size_t c = 0; c < edges.size(); ++c)
+  {
+    size_t count = static_cast<size_t>(
+        std::upper_bound(sorted.begin(), sorted.end(), edges[c])
+        - std::lower_bound(sorted.begin(), sorted.end(), edges[c]));
+    if (count == 2)
+      continue;
+
+    size_t t = c / 3;
+    uint32_t a = mesh.positionOf[mesh.corners[c]];
+    uint32_t b = mesh.positionOf[mesh.corners[t * 3 + (c + 1) % 3]];
+    if (count > 2)
+    {
+      mesh.kinds[a] = VERTEX_LOCKED;
+      mesh.kinds[b] = VERTEX_LOCKED;
+      continue;
+    }
+
+    mesh.kinds[a] = std::max(mesh.kinds[a], static_cast<uint8_t>(VERTEX_BOUNDARY));
+    mesh.kinds[b] = std::max(mesh.kinds[b], static_cast<uint8_t>(VERTEX_BOUNDARY));
+    Vec3 normal = cross(mesh.positions[b] - mesh.positions[a], normals[t]);
+    double normalLength = length(normal);
+    if (normalLength > 0.0)
+    {
+      normal = normal * (1.0 / normalLength);
+      mesh.quadrics[a].addPlane(normal, mesh.positions[a], boundaryWeight);
+      mesh.quadrics[b].addPlane(normal, mesh.positions[a], boundaryWeight);
+    }
+  }
+}
+
+/// Splits the current triangles into spatially coherent partitions (in
+/// Morton order of their centroids). The first partition has 'offset'
+/// triangles, the others 'trianglesPerPartition' but the last one. Triangles
+/// keep their order within a partition.
+void partitionTriangles(const SimplifyMesh& mesh, size_t trianglesPerPartition,
+                        size_t offset,
+                        std::vector<std::vector<uint32_t>>& partitions)
+{
+  size_t numTriangles = mesh.corners.size() / 3;
+  Vec3 extent = mesh.boundsMax - mesh.boundsMin;
+  Vec3 scale(extent.x > 0.0 ? 1023.0 / extent.x : 0.0,
+             extent.y > 0.0 ? 1023.0 / extent.y : 0.0,
+             extent.z > 0.0 ? 1023.0 / extent.z : 0.0);
+
+  std::vector<uint64_t> keys(numTriangles);
+  for (size_t t = 0; t < numTriangles; ++t)
+  {
+    Vec3 centroid;
+    for (size_t i = 0; i < 3; ++i)
+      centroid = centroid + mesh.positions[mesh.positionOf[mesh.corners[t * 3 + i]]];
+    Vec3 cell = centroid * (1.0 / 3.0) - mesh.boundsMin;
+    uint32_t x = static_cast<uint32_t>(std::min(1023.0, std::max(0.0, cell.x * scale.x)));
+    uint32_t y = static_cast<uint32_t>(std::min(1023.0, std::max(0.0, cell.y * scale.y)));
+    uint32_t z = static_cast<uint32_t>(std::min(1023.0, std::max(0.0, cell.z * scale.z)));
+    uint64_t code = spreadBits(x) | (spreadBits(y) << 1) | (spreadBits(z) << 2);
+    keys[t] = (code << 32) | t;
+  }
+  std::sort(keys.begin(), keys.end());
+
+  partitions.clear();
+  size_t first = 0;
+  size_t last = std::min(offset > 0 ? offset : trianglesPerPartition, numTriangles);
+  while (first < numTriangles)
+  {
+    partitions.push_back(std::vector<uint32_t>());
+    std::vector<uint32_t>& partition = partitions.back();
+    for (size_t i = first; i < last; ++i)
+      partition.push_back(static_cast<uint32_t>(keys[i]));
+    std::sort(partition.begin(), partition.end());
+    first = last;
+    last = std::min(last + trianglesPerPartition, numTriangles);
+  }
+}
+
+/// Simplifies the current triangles of 'mesh' in partitions, see
+/// partitionTriangles, to about 'targetTriangles' triangles in total.
+void simplifyPartitions(SimplifyMesh& mesh, size_t trianglesPerPartition,
+                        size_t offset, size_t targetTriangles)
+{
+  std::vector<std::vector<uint32_t>> partitions;
+  partitionTriangles(mesh, trianglesPerPartition, offset, partitions);
+
+  // Positions used by more than one partition stay where they are.
+  std::vector<uint8_t> shared(mesh.positions.size(), 0);
+  std::vector<uint32_t> owner(mesh.positions.size(), INVALID_INDEX);
+  for (uint32_t p = 0; p < partitions.size(); ++p)
+  {
+    for (auto it = partitions[p].begin(); it != partitions[p].end(); ++it)
+    {
+      for (size_t i = 0; i < 3; ++i)
+      {
+        uint32_t position = mesh.positionOf[mesh.corners[*it * 3 + i]];
+        if (owner[position] == INVALID_INDEX)
+          owner[position] = p;
+        else if (owner[position] != p)
+          shared[position] = 1;
+      }
+    }
+  }
+
+  // Every partition gets its share of the target.
+  double ratio = static_cast<double>(targetTriangles)
+      / static_cast<double>(mesh.corners.size() / 3);
+  std::vector<PartitionResult> results(partitions.size());
+  parallelFor(partitions.size(), [&](size_t p)
+  {
+    PartitionSimplifier simplifier(mesh, partitions[p], shared);
+    simplifier.simplify(static_cast<size_t>(
+        std::floor(ratio * static_cast<double>(partitions[p].size()) + 0.5)));
+    simplifier.getResult(results[p]);
+  });
+
+  mesh.corners.clear();
+  for (auto it = results.begin(); it != results.end(); ++it)
+  {
+    mesh.corners.insert(mesh.corners.end(), it->corners.begin(), it->corners.end());
+    for (auto q = it->quadrics.begin(); q != it->quadrics.end(); ++q)
+      mesh.quadrics[q->first].add(q->second);
+    for (auto a = it->attributes.begin(); a != it->attributes.end(); ++a)
+      mesh.attributes[a->first].add(a->second);
+    for (auto m = it->merges.begin(); m != it->merges.end(); ++m)
+      mesh.parents[m->first] = m->second;
+  }
+}
+
+/// See MeshLOD::error. Every removed position is measured against the
+/// current triangles around the position it ended up merged into.
+double computeError(SimplifyMesh& mesh)
+{
+  size_t numPositions = mesh.positions.size();
+  for (uint32_t p = 0; p < numPositions; ++p)
+  {
+    uint32_t root = p;
+    while (mesh.parents[root] != root)
+      root = mesh.parents[root];
+    for (uint32_t q = p; mesh.parents[q] != root && q != root; )
+    {
+      uint32_t next = mesh.parents[q];
+      mesh.parents[q] = root;
+      q = next;
+    }
+  }
+
+  std::vector<uint32_t> firstTriangle(numPositions + 1, 0);
+  for (auto it = mesh.corners.begin(); it != mesh.corners.end(); ++it)
+    ++firstTriangle[mesh.positionOf[*it] + 1];
+  for (size_t p = 0; p < numPositions; ++p)
+    firstTriangle[p + 1] += firstTriangle[p];
+  std::vector<uint32_t> triangles(mesh.corners.size());
+  std::vector<uint32_t> fill(firstTriangle.begin(), firstTriangle.end() - 1);
+  for (size_t c = 0; c < mesh.corners.size(); ++c)
+    triangles[fill[mesh.positionOf[mesh.corners[c]]]++] = static_cast<uint32_t>(c / 3);
+
+  const size_t blockSize = 4096;
+  std::vector<double> errors((numPositions + blockSize - 1) / blockSize, 0.0);
+  parallelFor(errors.size(), [&](size_t block)
+  {
+    size_t end = std::min((block + 1) * blockSize, numPositions);
+    for (size_t p = block * blockSize; p < end; ++p)
+    {
+      uint32_t root = mesh.parents[p];
+      if (root == p)
+        continue;
+
+      const Vec3& point = mesh.positions[p];
+      double distance = length(point - mesh.positions[root]);
+      for (uint32_t i = firstTriangle[root]; i < firstTriangle[root + 1]; ++i)
+      {
+        const uint32_t* tri = &mesh.corners[triangles[i] * 3];
+        distance = std::min(distance, distanceToTriangle(point,
+            mesh.positions[mesh.positionOf[tri[0]]],
+            mesh.positions[mesh.positionOf[tri[1]]],
+            mesh.positions[mesh.positionOf[tri[2]]]));
+      }
+      errors[block] = std::max(errors[block], distance);
+    }
+  });
+  return errors.empty() ? 0.0 : *std::max_element(errors.begin(), errors.end());
+}
+
+} // namespace
+
+//------------------------------------------------------------------------------
+MeshSimplifyOptions::MeshSimplifyOptions() :
+    normalWeight(0.01f),
+    boundaryWeight(10.0f),
+    trianglesPerPartition(MESH_SIMPLIFY_PARTITION_TRIANGLES)
+{
+}
+
+//------------------------------------------------------------------------------
+MeshLOD::MeshLOD() :
+    error(0.0f)
+{
+}
+
+//------------------------------------------------------------------------------
+void simplifyMesh(const uint8_t* vbo, size_t stride, size_t positionOffset,
+                  size_t normalOffset, size_t numVertices,
+                  const std::vector<uint32_t>& indices,
+                  const std::vector<float>& ratios, std::vector<MeshLOD>& lods,
+                  const MeshSimplifyOptions& options)
+{
+  if (indices.size() % 3 != 0)
+    throw std::invalid_argument("Index buffer is not a triangle list.");
+  for (auto it = indices.begin(); it != indices.end(); ++it)
+  {
+    if (*it >= numVertices)
+      throw std::invalid_argument("Index references a vertex outside of the VBO.");
+  }
+  for (size_t i = 0; i < ratios.size(); ++i)
+  {
+    if (   !(ratios[i] > 0.0f) || ratios[i] > 1.0f
+        || (i > 0 && !(ratios[i] < ratios[i - 1])))
+      throw std::invalid_argument("Simplification ratios must decrease within (0, 1].");
+  }
+  if (options.trianglesPerPartition == 0)
+    throw std::invalid_argument("Partitions need at least one triangle.");
+  if (numVertices >= INVALID_INDEX || indices.size() / 3 >= INVALID_INDEX)
+    throw std::invalid_argument("Too many vertices to simplify.");
+
+  SimplifyMesh mesh;
+  buildSimplifyMesh(vbo, stride, positionOffset, normalOffset, numVertices,
+                    indices, options.normalWeight, options.boundaryWeight, mesh);
+  size_t numTriangles = mesh.corners.size() / 3;
+
+  lods.clear();
+  lods.resize(ratios.size());
+  for (size_t level = 0; level < ratios.size(); ++level)
+  {
+    size_t target = static_cast<size_t>(std::floor(
+        static_cast<double>(ratios[level]) * static_cast<double>(numTriangles) + 0.5));
+
+    // Large meshes are simplified twice per level. The second time the
+    // partitions are shifted by half a partition, so that the positions the
+    // first round had to keep at partition borders are inside a partition.
+    size_t perPartition = options.trianglesPerPartition;
+    bool partitioned = mesh.corners.size() / 3 > perPartition;
+    simplifyPartitions(mesh, perPartition, 0, target);
+    if (partitioned && mesh.corners.size() / 3 > target)
+      simplifyPartitions(mesh, perPartition, (perPartition + 1) / 2, target);
+
+    // The estimate is local, so a coarser level can come out lower.
+    float previous = (level > 0) ? lods[level - 1].error : 0.0f;
+    lods[level].error = std::max(static_cast<float>(computeError(mesh)),
+        std::nextafter(previous, std::numeric_limits<float>::max()));
+    lods[level].indices = mesh.corners;
+  }
+}
+
+//------------------------------------------------------------------------------
+void validateMeshLODs(const std::vector<MeshLOD>& lods, size_t numVertices)
+{
+  for (auto lod = lods.begin(); lod != lods.end(); ++lod)
+  {
+    if (lod->indices.size() % 3 != 0)
+      throw std::invalid_argument("Mesh level of detail is not a triangle list.");
+    for (auto it = lod->indices.begin(); it != lod->indices.end(); ++it)
+    {
+      if (*it >= numVertices)
+        throw std::invalid_argument("Mesh level of detail references a vertex outside of the VBO.");
+    }
+  }
+}
+
+} // namespace CPM_SPIRE_NS
@@ -0,0 +1,107 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+/// \brief  Quadric error mesh simplification (Garland and Heckbert 1997) used
+///         to generate levels of detail offline (see assetConv --lods).
+///         Edges are collapsed into one of their endpoints, so every level
+///         is an index buffer referencing the vertices of the original mesh
+///         and all levels share one VBO.
+
+#ifndef SPIRE_HIGH_MESHSIMPLIFIER_H
+#define SPIRE_HIGH_MESHSIMPLIFIER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace CPM_SPIRE_NS {
+
+/// Meshes with more triangles than this are split into spatial partitions
+/// of this many triangles that are simplified in parallel. Vertices shared
+/// by two partitions are never removed, which keeps the partitions stitched
+/// together. The partitions do not depend on the number of cores, so results
+/// are identical on every machine.
+const size_t MESH_SIMPLIFY_PARTITION_TRIANGLES = 262144;
+
+/// Pass as normal offset to simplifyMesh for meshes without normals.
+const size_t MESH_SIMPLIFY_NO_NORMALS = SIZE_MAX;
+
+/// Options for simplifyMesh.
+struct MeshSimplifyOptions
+{
+  MeshSimplifyOptions();
+
+  /// Weight of the squared error of the interpolated normals, relative to
+  /// the squared diagonal of the mesh bounds. Keeps shading features such
+  /// as creases and highlights. 0 simplifies by geometry alone.
+  float   normalWeight;
+
+  /// Weight of the planes that keep open boundaries in place, relative to
+  /// the planes of the triangles.
+  float   boundaryWeight;
+
+  /// See MESH_SIMPLIFY_PARTITION_TRIANGLES.
+  size_t  trianglesPerPartition;
+};
+
+/// A simplified version of a mesh.
+struct MeshLOD
+{
+  MeshLOD();
+
+  /// Largest distance, in object space, between a vertex of the original
+  /// mesh and the simplified surface near it: an upper bound on how far the
+  /// original vertices are from the simplified surface. Grows from level to
+  /// level and is never 0, as addPassLODToObject requires.
+  float                 error;
+  std::vector<uint32_t> indices;  ///< Triangle list, same VBO as the original.
+};
+
+/// Simplifies the triangle list 'indices' to each of the triangle ratios in
+/// 'ratios' (strictly decreasing, in (0, 1]), for example {0.5, 0.25}. Every
+/// level continues from the previous one. A level has more triangles than
+/// requested when no collapse is left that keeps the mesh manifold, its
+/// triangles facing the same way and its boundaries in place. Degenerate
+/// triangles are dropped.
+/// Positions are three floats located 'positionOffset' bytes into each
+/// vertex, normals three floats 'normalOffset' bytes into it. Vertices that
+/// share a position but differ otherwise (seams) are simplified together.
+/// Throws std::invalid_argument on invalid ratios or indices.
+void simplifyMesh(const uint8_t* vbo, size_t stride, size_t positionOffset,
+                  size_t normalOffset, size_t numVertices,
+                  const std::vector<uint32_t>& indices,
+                  const std::vector<float>& ratios, std::vector<MeshLOD>& lods,
+                  const MeshSimplifyOptions& options = MeshSimplifyOptions());
+
+/// Throws std::invalid_argument unless every level is a triangle list
+/// indexing the first 'numVertices' vertices.
+void validateMeshLODs(const std::vector<MeshLOD>& lods, size_t numVertices);
+
+} // namespace CPM_SPIRE_NS
+
+#endif
@@ -0,0 +1,144 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+
+#include "MeshStream.h"
+#include "IBOObject.h"
+#include "VBOObject.h"
+
+namespace CPM_SPIRE_NS {
+
+//------------------------------------------------------------------------------
+MeshStream::MeshStream(ProgressFunction progress) :
+    buffersCreated(false),
+    mProgress(progress),
+    mHaveLayout(false)
+{
+}
+
+//------------------------------------------------------------------------------
+void MeshStream::setLayout(const AssetMeshLayout& layout)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  if (mHaveLayout)
+    throw std::logic_error("Mesh stream layout has already been set.");
+  mLayout = layout;
+  mHaveLayout = true;
+}
+
+//------------------------------------------------------------------------------
+void MeshStream::addPart(AssetMeshPart& part)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  if (!mHaveLayout)
+    throw std::logic_error("Mesh stream parts require a layout.");
+  mPending.push_back(std::move(part));
+}
+
+//------------------------------------------------------------------------------
+void MeshStream::setError(const std::string& error)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  mError = error;
+}
+
+//------------------------------------------------------------------------------
+bool MeshStream::getLayout(AssetMeshLayout& layout) const
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  if (mHaveLayout)
+    layout = mLayout;
+  return mHaveLayout;
+}
+
+//------------------------------------------------------------------------------
+std::string MeshStream::getError() const
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  return mError;
+}
+
+//------------------------------------------------------------------------------
+void MeshStream::takeParts(std::vector<AssetMeshPart>& parts)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  parts.assign(std::make_move_iterator(mPending.begin()),
+               std::make_move_iterator(mPending.end()));
+  mPending.clear();
+}
+
+//------------------------------------------------------------------------------
+void MeshStream::partsUploaded(const std::vector<AssetMeshPart>& parts)
+{
+  size_t numUploaded;
+  size_t numParts;
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto it = parts.begin(); it != parts.end(); ++it)
+    {
+      AssetMeshPart info;
+      info.firstVertex = it->firstVertex;
+      info.firstIndex = it->firstIndex;
+      std::copy(it->boundsMin, it->boundsMin + 3, info.boundsMin);
+      std::copy(it->boundsMax, it->boundsMax + 3, info.boundsMax);
+      mUploaded.push_back(info);
+    }
+    numUploaded = mUploaded.size();
+    numParts = mLayout.numParts;
+  }
+
+  // Called without holding the lock so the callback may query the stream.
+  if (mProgress)
+    mProgress(numUploaded, numParts);
+}
+
+//------------------------------------------------------------------------------
+size_t MeshStream::getNumPartsUploaded() const
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  return mUploaded.size();
+}
+
+//------------------------------------------------------------------------------
+bool MeshStream::isComplete() const
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  return mHaveLayout && mUploaded.size() == mLayout.numParts;
+}
+
+//------------------------------------------------------------------------------
+std::vector<AssetMeshPart> MeshStream::getUploadedParts() const
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  return mUploaded;
+}
+
+} // namespace CPM_SPIRE_NS
@@ -0,0 +1,119 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef SPIRE_HIGH_MESHSTREAM_H
+#define SPIRE_HIGH_MESHSTREAM_H
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "AssetFile.h"
+
+namespace CPM_SPIRE_NS {
+
+class VBOObject;
+class IBOObject;
+
+/// Hands the parts of a mesh from a reader thread to the rendering thread.
+/// The reader calls setLayout once and then addPart for every part (see
+/// Interface::readMeshStream); the rendering thread uploads whatever has
+/// arrived with Interface::uploadMeshStream. All functions are thread safe.
+class MeshStream
+{
+public:
+  /// Called on the rendering thread after every upload with the number of
+  /// parts uploaded so far and the total number of parts.
+  typedef std::function<void (size_t partsUploaded, size_t numParts)>
+      ProgressFunction;
+
+  MeshStream(ProgressFunction progress = ProgressFunction());
+
+  //-------------
+  // Reader side
+  //-------------
+
+  /// Must be called before the first part is added.
+  void setLayout(const AssetMeshLayout& layout);
+
+  /// Queues 'part' for upload. Its vertex and index data is moved out.
+  void addPart(AssetMeshPart& part);
+
+  /// Records a failure. The message is rethrown by uploadMeshStream.
+  void setError(const std::string& error);
+
+  //----------------
+  // Rendering side
+  //----------------
+
+  /// Returns false if the reader has not determined the layout yet.
+  bool getLayout(AssetMeshLayout& layout) const;
+
+  /// Returns an empty string unless the reader failed.
+  std::string getError() const;
+
+  /// Moves all parts queued since the last call into 'parts'.
+  void takeParts(std::vector<AssetMeshPart>& parts);
+
+  /// Records 'parts' as uploaded and reports progress. Their vertex and
+  /// index data is not retained.
+  void partsUploaded(const std::vector<AssetMeshPart>& parts);
+
+  /// Number of parts uploaded so far.
+  size_t getNumPartsUploaded() const;
+
+  /// True once every part of the mesh has been uploaded.
+  bool isComplete() const;
+
+  /// Index ranges and bounds of the parts uploaded so far. Their vbo and
+  /// indices are empty.
+  std::vector<AssetMeshPart> getUploadedParts() const;
+
+  /// Buffers the parts are uploaded into. Only used on the rendering thread,
+  /// and released once the stream is complete (the passes keep their own
+  /// references).
+  bool                        buffersCreated;
+  std::shared_ptr<VBOObject>  vbo;
+  std::shared_ptr<IBOObject>  ibo;
+
+private:
+  mutable std::mutex          mMutex;
+  ProgressFunction            mProgress;
+  AssetMeshLayout             mLayout;
+  bool                        mHaveLayout;
+  std::deque<AssetMeshPart>   mPending;
+  std::vector<AssetMeshPart>  mUploaded;
+  std::string                 mError;
+};
+
+} // namespace CPM_SPIRE_NS
+
+#endif
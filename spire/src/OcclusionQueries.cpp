@@ -0,0 +1,281 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <string>
+
+#include "Exceptions.h"
+#include "OcclusionQueries.h"
+
+namespace CPM_SPIRE_NS {
+
+namespace {
+
+#ifdef SPIRE_OCCLUSION_QUERIES
+const char* boxVertexShader =
+    "uniform mat4 uWorldToProjection;\n"
+    "uniform vec3 uCenter;\n"
+    "uniform vec3 uExtent;\n"
+    "attribute vec3 aPos;\n"
+    "void main()\n"
+    "{\n"
+    "  gl_Position = uWorldToProjection * vec4(uCenter + aPos * uExtent, 1.0);\n"
+    "}\n";
+
+const char* boxFragmentShader =
+    "#ifdef GL_ES\n"
+    "precision mediump float;\n"
+    "#endif\n"
+    "void main()\n"
+    "{\n"
+    "  gl_FragColor = vec4(1.0);\n"
+    "}\n";
+
+//------------------------------------------------------------------------------
+GLuint compileShader(GLenum type, const char* source)
+{
+  GLuint shader = glCreateShader(type);
+  GL_CHECK();
+  if (shader == 0)
+    throw GLError("Unable to construct shader.");
+  GL(glShaderSource(shader, 1, &source, NULL));
+  GL(glCompileShader(shader));
+
+  GLint compiled = 0;
+  GL(glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled));
+  if (!compiled)
+  {
+    GL(glDeleteShader(shader));
+    throw GLError("Failed to compile the occlusion query shader.");
+  }
+  return shader;
+}
+#endif
+
+} // namespace
+
+//------------------------------------------------------------------------------
+OcclusionQueries::OcclusionQueries() :
+    mNumQueries(0),
+    mProgram(0),
+    mVBO(0),
+    mIBO(0),
+    mViewLocation(-1),
+    mCenterLocation(-1),
+    mExtentLocation(-1)
+{
+}
+
+//------------------------------------------------------------------------------
+OcclusionQueries::~OcclusionQueries()
+{
+  clear();
+}
+
+//------------------------------------------------------------------------------
+void OcclusionQueries::clear()
+{
+#ifdef SPIRE_OCCLUSION_QUERIES
+  for (auto it = mPending.begin(); it != mPending.end(); ++it)
+    mFreeQueries.push_back(it->query);
+  if (!mFreeQueries.empty())
+    GL(glDeleteQueries(static_cast<GLsizei>(mFreeQueries.size()), &mFreeQueries[0]));
+  if (mProgram != 0)
+    GL(glDeleteProgram(mProgram));
+  if (mVBO != 0)
+    GL(glDeleteBuffers(1, &mVBO));
+  if (mIBO != 0)
+    GL(glDeleteBuffers(1, &mIBO));
+#endif
+  mFreeQueries.clear();
+  mPending.clear();
+  mNumQueries = 0;
+  mProgram = 0;
+  mVBO = 0;
+  mIBO = 0;
+}
+
+//------------------------------------------------------------------------------
+void OcclusionQueries::createResources()
+{
+#ifdef SPIRE_OCCLUSION_QUERIES
+  GLuint vertexShader = compileShader(GL_VERTEX_SHADER, boxVertexShader);
+  GLuint fragmentShader = 0;
+  try
+  {
+    fragmentShader = compileShader(GL_FRAGMENT_SHADER, boxFragmentShader);
+  }
+  catch (...)
+  {
+    GL(glDeleteShader(vertexShader));
+    throw;
+  }
+
+  GLuint program = glCreateProgram();
+  GL_CHECK();
+  GL(glAttachShader(program, vertexShader));
+  GL(glAttachShader(program, fragmentShader));
+  GL(glBindAttribLocation(program, 0, "aPos"));
+  GL(glLinkProgram(program));
+  GL(glDeleteShader(vertexShader));
+  GL(glDeleteShader(fragmentShader));
+
+  GLint linked = 0;
+  GL(glGetProgramiv(program, GL_LINK_STATUS, &linked));
+  if (!linked)
+  {
+    GL(glDeleteProgram(program));
+    throw GLError("Failed to link the occlusion query shader.");
+  }
+  mProgram = program;
+  mViewLocation = glGetUniformLocation(program, "uWorldToProjection");
+  mCenterLocation = glGetUniformLocation(program, "uCenter");
+  mExtentLocation = glGetUniformLocation(program, "uExtent");
+  GL_CHECK();
+
+  // Unit box: corner i has the coordinates of the bits of i, from -1 to 1.
+  float corners[8 * 3];
+  for (int i = 0; i < 8; ++i)
+  {
+    corners[i * 3 + 0] = (i & 1) ? 1.0f : -1.0f;
+    corners[i * 3 + 1] = (i & 2) ? 1.0f : -1.0f;
+    corners[i * 3 + 2] = (i & 4) ? 1.0f : -1.0f;
+  }
+  const uint8_t faces[36] =
+  {
+    0, 2, 1,  1, 2, 3,    // -z
+    4, 5, 6,  5, 7, 6,    // +z
+    0, 1, 4,  1, 5, 4,    // -y
+    2, 6, 3,  3, 6, 7,    // +y
+    0, 4, 2,  2, 4, 6,    // -x
+    1, 3, 5,  3, 7, 5     // +x
+  };
+  GL(glGenBuffers(1, &mVBO));
+  GL(glBindBuffer(GL_ARRAY_BUFFER, mVBO));
+  GL(glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW));
+  GL(glGenBuffers(1, &mIBO));
+  GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mIBO));
+  GL(glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(faces), faces, GL_STATIC_DRAW));
+#endif
+}
+
+//------------------------------------------------------------------------------
+size_t OcclusionQueries::readResults(FramePrep& prep)
+{
+  size_t numRead = 0;
+#ifdef SPIRE_OCCLUSION_QUERIES
+  // Queries complete in order: stop at the first one still in flight.
+  while (!mPending.empty())
+  {
+    const Pending& pending = mPending.front();
+    GLuint available = 0;
+    GL(glGetQueryObjectuiv(pending.query, GL_QUERY_RESULT_AVAILABLE, &available));
+    if (!available)
+      break;
+
+    GLuint anySamples = 0;
+    GL(glGetQueryObjectuiv(pending.query, GL_QUERY_RESULT, &anySamples));
+    prep.setOcclusionResult(pending.test, anySamples != 0);
+    mFreeQueries.push_back(pending.query);
+    mPending.pop_front();
+    ++numRead;
+  }
+#else
+  (void)prep;
+#endif
+  return numRead;
+}
+
+//------------------------------------------------------------------------------
+void OcclusionQueries::issueQueries(FramePrep& prep)
+{
+  const std::vector<OcclusionTest>& tests = prep.getOcclusionTests();
+  if (tests.empty())
+    return;
+#ifdef SPIRE_OCCLUSION_QUERIES
+  if (mProgram == 0)
+    createResources();
+
+  if (mFreeQueries.size() < tests.size())
+  {
+    size_t numNew = ((tests.size() - mFreeQueries.size() + QueryBatchSize - 1)
+                     / QueryBatchSize) * QueryBatchSize;
+    size_t first = mFreeQueries.size();
+    mFreeQueries.resize(first + numNew);
+    GL(glGenQueries(static_cast<GLsizei>(numNew), &mFreeQueries[first]));
+    mNumQueries += numNew;
+  }
+
+  // Draw both sides of the boxes without writing anything. Boxes must not
+  // lose the depth test where they touch the objects they enclose.
+  GLboolean colorMask[4];
+  GLboolean depthMask;
+  GLint depthFunc;
+  GL(glGetBooleanv(GL_COLOR_WRITEMASK, colorMask));
+  GL(glGetBooleanv(GL_DEPTH_WRITEMASK, &depthMask));
+  GL(glGetIntegerv(GL_DEPTH_FUNC, &depthFunc));
+  GLboolean cullFace = glIsEnabled(GL_CULL_FACE);
+  GL(glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE));
+  GL(glDepthMask(GL_FALSE));
+  GL(glDepthFunc(GL_LEQUAL));
+  GL(glDisable(GL_CULL_FACE));
+
+  GL(glUseProgram(mProgram));
+  GL(glUniformMatrix4fv(mViewLocation, 1, GL_FALSE,
+                        glm::value_ptr(prep.getWorldToProjection())));
+  GL(glBindBuffer(GL_ARRAY_BUFFER, mVBO));
+  GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mIBO));
+  GL(glEnableVertexAttribArray(0));
+  GL(glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0));
+
+  for (auto it = tests.begin(); it != tests.end(); ++it)
+  {
+    Pending pending;
+    pending.query = mFreeQueries.back();
+    pending.test = *it;
+    mFreeQueries.pop_back();
+
+    GL(glUniform3f(mCenterLocation, it->center.x, it->center.y, it->center.z));
+    GL(glUniform3f(mExtentLocation, it->extent.x, it->extent.y, it->extent.z));
+    GL(glBeginQuery(GL_ANY_SAMPLES_PASSED, pending.query));
+    GL(glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, 0));
+    GL(glEndQuery(GL_ANY_SAMPLES_PASSED));
+
+    prep.setOcclusionPending(*it);
+    mPending.push_back(pending);
+  }
+
+  GL(glDisableVertexAttribArray(0));
+  GL(glColorMask(colorMask[0], colorMask[1], colorMask[2], colorMask[3]));
+  GL(glDepthMask(depthMask));
+  GL(glDepthFunc(static_cast<GLenum>(depthFunc)));
+  if (cullFace)
+    GL(glEnable(GL_CULL_FACE));
+#endif
+}
+
+} // namespace CPM_SPIRE_NS
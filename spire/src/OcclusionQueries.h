@@ -0,0 +1,114 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+/// \brief  Hardware occlusion queries for the occlusion culling of
+///         FramePrep.
+
+#ifndef SPIRE_HIGH_OCCLUSIONQUERIES_H
+#define SPIRE_HIGH_OCCLUSIONQUERIES_H
+
+#include <cstddef>
+#include <deque>
+#include <vector>
+
+#include "Common.h"
+#include "FramePrep.h"
+
+// OpenGL ES 2.0 and legacy OpenGL 2.1 headers have no GL_ANY_SAMPLES_PASSED
+// queries.
+#if !defined(SPIRE_OPENGL_ES_2) && defined(GL_ANY_SAMPLES_PASSED)
+  #define SPIRE_OCCLUSION_QUERIES
+#endif
+
+namespace CPM_SPIRE_NS {
+
+/// Runs the occlusion tests of a FramePrep with GL_ANY_SAMPLES_PASSED
+/// queries: the box of each test is drawn against the depth buffer of the
+/// frame, without writing color or depth. Results are only read once they
+/// are available, in the order the queries were issued, so the pipeline is
+/// never stalled waiting for them; FramePrep keeps using the visibility of
+/// earlier frames meanwhile. Query objects are pooled.
+///
+/// Render thread only: every function needs the rendering context current.
+class OcclusionQueries
+{
+public:
+  /// Query objects created at once when the pool runs out.
+  static const size_t QueryBatchSize = 64;
+
+  OcclusionQueries();
+  ~OcclusionQueries();
+
+  /// Hands the results that are available to 'prep', oldest first, and
+  /// returns their query objects to the pool.
+  /// \return Number of results read.
+  size_t readResults(FramePrep& prep);
+
+  /// Issues queries for the occlusion tests of 'prep'. Call after drawing
+  /// the frame prepared by 'prep', with the depth test set up as for its
+  /// draws (with the depth test disabled, everything is visible). Changes
+  /// the program and buffer bindings; restores the other state it changes.
+  void issueQueries(FramePrep& prep);
+
+  /// Deletes the OpenGL objects and forgets the queries in flight.
+  void clear();
+
+  /// Number of queries whose results have not been read yet.
+  size_t getNumPending() const    {return mPending.size();}
+
+  /// Number of query objects created (in flight or pooled).
+  size_t getNumQueries() const    {return mNumQueries;}
+
+private:
+  OcclusionQueries(const OcclusionQueries&);
+  OcclusionQueries& operator=(const OcclusionQueries&);
+
+  /// Compiles the box program and uploads the unit box.
+  void createResources();
+
+  struct Pending
+  {
+    GLuint          query;
+    OcclusionTest   test;
+  };
+
+  std::vector<GLuint>   mFreeQueries;
+  std::deque<Pending>   mPending;
+  size_t                mNumQueries;
+
+  GLuint                mProgram;
+  GLuint                mVBO;
+  GLuint                mIBO;
+  GLint                 mViewLocation;
+  GLint                 mCenterLocation;
+  GLint                 mExtentLocation;
+};
+
+} // namespace CPM_SPIRE_NS
+
+#endif
@@ -0,0 +1,112 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+
+#include "Parallel.h"
+#include "ThreadPool.h"
+
+namespace CPM_SPIRE_NS {
+
+//------------------------------------------------------------------------------
+void parallelFor(size_t count, const std::function<void (size_t)>& fn)
+{
+  std::shared_ptr<ThreadPool> pool = ThreadPool::getShared();
+  size_t numTasks = std::min(pool->getNumThreads() + 1, count);
+
+  if (numTasks <= 1)
+  {
+    for (size_t i = 0; i < count; ++i)
+      fn(i);
+    return;
+  }
+
+  std::atomic<size_t> next(0);
+  std::exception_ptr error;
+  std::mutex mutex;
+  std::condition_variable finished;
+  size_t numRunning = numTasks - 1;   // Pool tasks, guarded by 'mutex'.
+
+  auto worker = [&]()
+  {
+    for (size_t i = next++; i < count; i = next++)
+    {
+      try
+      {
+        fn(i);
+      }
+      catch (...)
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error)
+          error = std::current_exception();
+        next = count;
+      }
+    }
+  };
+
+  for (size_t i = 1; i < numTasks; ++i)
+  {
+    pool->submit([&]()
+    {
+      worker();
+
+      // Notify while holding the lock, the waiting thread destroys
+      // 'finished' as soon as it sees numRunning reach zero.
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--numRunning == 0)
+        finished.notify_all();
+    });
+  }
+  worker();
+
+  // Help out with queued work (possibly our own tasks) until every task has
+  // finished. Once nothing is queued, our tasks are all running elsewhere.
+  for (;;)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (numRunning == 0)
+        break;
+    }
+    if (!pool->runPendingTask())
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      finished.wait(lock, [&numRunning]() { return numRunning == 0; });
+    }
+  }
+
+  if (error)
+    std::rethrow_exception(error);
+}
+
+} // namespace CPM_SPIRE_NS
@@ -0,0 +1,49 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+/// \brief  Minimal data parallel helper shared by the asset processing code
+///         (mesh optimization, importers). Does not touch OpenGL.
+
+#ifndef SPIRE_HIGH_PARALLEL_H
+#define SPIRE_HIGH_PARALLEL_H
+
+#include <cstddef>
+#include <functional>
+
+namespace CPM_SPIRE_NS {
+
+/// Executes fn(i) for every i in [0, count) on the shared thread pool (see
+/// ThreadPool.h). The calling thread participates and, while waiting, runs
+/// other queued pool tasks, so parallelFor may be nested inside pool tasks.
+/// If any invocation throws, the remaining indices are skipped and the first
+/// exception is rethrown once all threads have finished.
+void parallelFor(size_t count, const std::function<void (size_t)>& fn);
+
+} // namespace CPM_SPIRE_NS
+
+#endif
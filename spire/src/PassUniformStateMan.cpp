@@ -159,6 +159,20 @@ PassUniformStateMan::getPassUninform(const std::string& pass, const std::string&
   }
 }
 
+//------------------------------------------------------------------------------
+const AbstractUniformStateItem*
+PassUniformStateMan::findPassUniform(const std::string& pass, const std::string& name) const
+{
+  const PassUniforms* passStruct = getPass(pass);
+  if (passStruct == nullptr)
+    return nullptr;
+
+  auto it = passStruct->uniforms.find(name);
+  if (it == passStruct->uniforms.end())
+    return nullptr;
+  return it->second.get();
+}
+
 //------------------------------------------------------------------------------
 std::string PassUniformStateMan::uniformAsString(const std::string& pass, const std::string& name) const
 {
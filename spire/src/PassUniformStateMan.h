@@ -85,6 +85,12 @@ public:
   std::shared_ptr<const AbstractUniformStateItem> getPassUninform(
       const std::string& pass, const std::string& name) const;
 
+  /// Same as getPassUninform, without taking a reference. Returns nullptr if
+  /// there is no such uniform. Safe to call from several threads as long as
+  /// no uniforms are updated.
+  const AbstractUniformStateItem* findPassUniform(
+      const std::string& pass, const std::string& name) const;
+
 private:
 
   /// Structures containing all of the uniforms in a pass.
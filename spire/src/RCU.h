@@ -0,0 +1,157 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef SPIRE_HIGH_RCU_H
+#define SPIRE_HIGH_RCU_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace CPM_SPIRE_NS {
+
+/// Read-copy-update cell holding an immutable value. Readers on any thread
+/// get the current value without locks (ReadGuard). Writers replace the whole
+/// value (update) and never wait for readers: replaced values are retired
+/// and only released by reclaim once no reader can still see them.
+///
+/// Grace periods are tracked with epochs. A reader registers in one of two
+/// counters, chosen by the parity of the global epoch. The epoch only moves
+/// forward once the readers of the previous epoch are gone, so a value
+/// retired in epoch e is unreachable once the epoch reaches e + 2.
+///
+/// update, reclaim and getLatest must be serialized by the caller.
+template <typename T>
+class RCUValue
+{
+public:
+  explicit RCUValue(std::shared_ptr<const T> initial) :
+      mCurrent(initial.get()),
+      mLatest(initial),
+      mEpoch(0)
+  {
+    mReaders[0] = 0;
+    mReaders[1] = 0;
+  }
+
+  /// Keeps a value alive (and unchanged) for as long as the guard lives.
+  /// Lock-free. Do not hold guards for long: retired values pile up until
+  /// they are released.
+  class ReadGuard
+  {
+  public:
+    explicit ReadGuard(const RCUValue& rcu) :
+        mRCU(rcu)
+    {
+      for (;;)
+      {
+        size_t epoch = mRCU.mEpoch.load();
+        mSlot = epoch & 1;
+        mRCU.mReaders[mSlot].fetch_add(1);
+        if (mRCU.mEpoch.load() == epoch)
+          break;
+        mRCU.mReaders[mSlot].fetch_sub(1);
+      }
+      mValue = mRCU.mCurrent.load();
+    }
+
+    ~ReadGuard()                        {mRCU.mReaders[mSlot].fetch_sub(1);}
+
+    const T& operator*() const          {return *mValue;}
+    const T* operator->() const         {return mValue;}
+
+  private:
+    ReadGuard(const ReadGuard&);
+    ReadGuard& operator=(const ReadGuard&);
+
+    const RCUValue& mRCU;
+    size_t          mSlot;
+    const T*        mValue;
+  };
+
+  /// Latest value, as seen by writers.
+  const std::shared_ptr<const T>& getLatest() const {return mLatest;}
+
+  /// Replaces the value. The previous value is retired.
+  void update(std::shared_ptr<const T> value)
+  {
+    mCurrent.store(value.get());
+    mRetired.push_back(std::make_pair(mEpoch.load(), std::move(mLatest)));
+    mLatest = std::move(value);
+    tryAdvanceEpoch();
+  }
+
+  /// Releases the retired values no reader can see anymore. Never waits.
+  /// \return Number of values released.
+  size_t reclaim()
+  {
+    tryAdvanceEpoch();
+    size_t epoch = mEpoch.load();
+    size_t numKept = 0;
+    for (size_t i = 0; i < mRetired.size(); ++i)
+    {
+      if (mRetired[i].first + 2 > epoch)
+      {
+        if (numKept != i)
+          mRetired[numKept] = std::move(mRetired[i]);
+        ++numKept;
+      }
+    }
+    size_t numReleased = mRetired.size() - numKept;
+    mRetired.resize(numKept);
+    return numReleased;
+  }
+
+  /// Number of values waiting for reclaim.
+  size_t getNumRetired() const        {return mRetired.size();}
+
+private:
+  RCUValue(const RCUValue&);
+  RCUValue& operator=(const RCUValue&);
+
+  void tryAdvanceEpoch()
+  {
+    // New readers register under the next epoch's parity, which is shared
+    // with the previous epoch: only move on once those readers are gone.
+    size_t epoch = mEpoch.load();
+    if (mReaders[(epoch + 1) & 1].load() == 0)
+      mEpoch.store(epoch + 1);
+  }
+
+  std::atomic<const T*>                                   mCurrent;
+  std::shared_ptr<const T>                                mLatest;
+  std::atomic<size_t>                                     mEpoch;
+  mutable std::atomic<size_t>                             mReaders[2];
+  std::vector<std::pair<size_t, std::shared_ptr<const T>>> mRetired;
+};
+
+} // namespace CPM_SPIRE_NS
+
+#endif
@@ -0,0 +1,844 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+#include "BoundingVolume.h"
+#include "FramePrep.h"
+#include "Parallel.h"
+#include "SceneBVH.h"
+#include "SpireObject.h"
+
+namespace CPM_SPIRE_NS {
+
+const float SceneBVH::RebuildCostRatio = 1.5f;
+const size_t SceneBVH::NumBins;
+const size_t SceneBVH::ParallelBuildSize;
+const int32_t SceneBVH::Null;
+
+namespace {
+
+//------------------------------------------------------------------------------
+float surfaceArea(const V3& min, const V3& max)
+{
+  V3 d = max - min;
+  return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+//------------------------------------------------------------------------------
+bool overlaps(const V3& minA, const V3& maxA, const V3& minB, const V3& maxB)
+{
+  return    minA.x <= maxB.x && minB.x <= maxA.x
+         && minA.y <= maxB.y && minB.y <= maxA.y
+         && minA.z <= maxB.z && minB.z <= maxA.z;
+}
+
+//------------------------------------------------------------------------------
+/// Slab test. 'inverse' holds the reciprocals of the ray direction; the NaNs
+/// of rays lying in a slab's plane are ignored by the comparisons.
+bool intersectRay(const V3& origin, const V3& inverse, const V3& min,
+                  const V3& max, float& distance)
+{
+  float near = 0.0f;
+  float far = std::numeric_limits<float>::infinity();
+  for (int axis = 0; axis < 3; ++axis)
+  {
+    float t0 = (min[axis] - origin[axis]) * inverse[axis];
+    float t1 = (max[axis] - origin[axis]) * inverse[axis];
+    if (t0 > t1)
+      std::swap(t0, t1);
+    near = t0 > near ? t0 : near;
+    far = t1 < far ? t1 : far;
+  }
+  distance = near;
+  return near <= far;
+}
+
+//------------------------------------------------------------------------------
+/// True if the object has bounds; 'min' and 'max' are then set to its box
+/// in world space.
+bool getWorldBox(const SpireObject& object, V3& min, V3& max)
+{
+  if (!object.hasBounds())
+    return false;
+  V3 center;
+  V3 extent;
+  transformBox(object.getTransform(), object.getBoundsMin(),
+               object.getBoundsMax(), center, extent);
+  min = center - extent;
+  max = center + extent;
+  return true;
+}
+
+//------------------------------------------------------------------------------
+/// True if 'tracked' was taken from 'current'. Compares control blocks, which
+/// outlive the objects as long as weak pointers to them exist, so a new
+/// object at a freed address is not mistaken for the old one.
+template <typename T>
+bool sameOwner(const std::weak_ptr<const T>& tracked,
+               const std::shared_ptr<const T>& current)
+{
+  return !tracked.owner_before(current) && !current.owner_before(tracked);
+}
+
+} // namespace
+
+//------------------------------------------------------------------------------
+SceneBVH::SceneBVH() :
+    mRoot(Null),
+    mInnerArea(0.0),
+    mRebuildCost(0.0f),
+    mNumRebuilds(0)
+{
+}
+
+//------------------------------------------------------------------------------
+void SceneBVH::update(const SceneVersion& scene)
+{
+  std::vector<size_t> changedShards;
+  size_t numChanges = 0;
+  for (size_t s = 0; s < SceneVersion::NumShards; ++s)
+  {
+    if (!sameOwner(mShards[s], scene.shards[s]))
+    {
+      changedShards.push_back(s);
+      numChanges += countChanges(s, *scene.shards[s]);
+    }
+  }
+  if (changedShards.empty())
+    return;
+
+  // Building the tree anew is cheaper than inserting or moving most of the
+  // objects one at a time.
+  bool rebuildAll = numChanges * 2 > std::max(getNumObjects(), scene.numObjects);
+  if (rebuildAll)
+    dropTree();
+
+  for (auto it = changedShards.begin(); it != changedShards.end(); ++it)
+  {
+    updateShard(*it, *scene.shards[*it], !rebuildAll);
+    mShards[*it] = scene.shards[*it];
+  }
+
+  if (rebuildAll || getCost() > std::max(mRebuildCost, 1.0f) * RebuildCostRatio)
+    rebuild();
+}
+
+//------------------------------------------------------------------------------
+void SceneBVH::clear()
+{
+  dropTree();
+  mLeaves.clear();
+  mFreeLeaves.clear();
+  mUnbounded.clear();
+  for (size_t s = 0; s < SceneVersion::NumShards; ++s)
+  {
+    mShards[s].reset();
+    mShardLeaves[s].clear();
+  }
+  mRebuildCost = 0.0f;
+}
+
+//------------------------------------------------------------------------------
+size_t SceneBVH::countChanges(size_t shard,
+                              const SceneVersion::Shard& objects) const
+{
+  const std::unordered_map<std::string, int32_t>& leaves = mShardLeaves[shard];
+  size_t numChanges = 0;
+  size_t numKept = 0;
+  for (auto it = objects.begin(); it != objects.end(); ++it)
+  {
+    auto found = leaves.find(it->first);
+    if (found == leaves.end())
+    {
+      ++numChanges;
+      continue;
+    }
+
+    ++numKept;
+    const Leaf& leaf = mLeaves[found->second];
+    if (sameOwner(leaf.object, it->second))
+      continue;
+
+    // Edits that do not move the object (uniforms, passes with the same
+    // bounds) leave the tree alone.
+    V3 min;
+    V3 max;
+    bool bounded = getWorldBox(*it->second, min, max);
+    if (bounded != (leaf.unbounded == Null) || (bounded && (min != leaf.min || max != leaf.max)))
+      ++numChanges;
+  }
+  return numChanges + leaves.size() - numKept;
+}
+
+//------------------------------------------------------------------------------
+void SceneBVH::updateShard(size_t shard, const SceneVersion::Shard& objects,
+                           bool link)
+{
+  std::unordered_map<std::string, int32_t>& leaves = mShardLeaves[shard];
+  size_t numLeaves = leaves.size();
+  size_t numKept = 0;
+  for (auto it = objects.begin(); it != objects.end(); ++it)
+  {
+    auto found = leaves.find(it->first);
+    if (found == leaves.end())
+    {
+      int32_t leaf = allocateLeaf(it->first, it->second);
+      leaves[it->first] = leaf;
+      placeLeaf(leaf, *it->second, link);
+    }
+    else
+    {
+      ++numKept;
+      if (!sameOwner(mLeaves[found->second].object, it->second))
+      {
+        mLeaves[found->second].object = it->second;
+        placeLeaf(found->second, *it->second, link);
+      }
+    }
+  }
+
+  if (numKept == numLeaves)
+    return;
+  for (auto it = leaves.begin(); it != leaves.end();)
+  {
+    if (objects.count(it->first) == 0)
+    {
+      freeLeaf(it->second, link);
+      it = leaves.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+void SceneBVH::placeLeaf(int32_t index, const SpireObject& object, bool link)
+{
+  V3 min;
+  V3 max;
+  if (!getWorldBox(object, min, max))
+  {
+    if (link && mLeaves[index].node != Null)
+      removeLeaf(index);
+    addUnbounded(index);
+    return;
+  }
+
+  removeUnbounded(index);
+  Leaf& leaf = mLeaves[index];
+  leaf.min = min;
+  leaf.max = max;
+  if (!link)
+    return;
+
+  if (leaf.node == Null)
+  {
+    insertLeaf(index);
+  }
+  else if (!overlaps(min, max, mNodes[leaf.node].min, mNodes[leaf.node].max))
+  {
+    // Refitting after a jump would stretch every box up to the root.
+    removeLeaf(index);
+    insertLeaf(index);
+  }
+  else if (min != mNodes[leaf.node].min || max != mNodes[leaf.node].max)
+  {
+    setNodeBox(leaf.node, min, max);
+    refitAncestors(mNodes[leaf.node].parent);
+  }
+}
+
+//------------------------------------------------------------------------------
+int32_t SceneBVH::allocateLeaf(const std::string& name,
+                               const std::shared_ptr<const SpireObject>& object)
+{
+  int32_t index;
+  if (mFreeLeaves.empty())
+  {
+    index = static_cast<int32_t>(mLeaves.size());
+    mLeaves.push_back(Leaf());
+  }
+  else
+  {
+    index = mFreeLeaves.back();
+    mFreeLeaves.pop_back();
+  }
+
+  Leaf& leaf = mLeaves[index];
+  leaf.name = name;
+  leaf.object = object;
+  leaf.node = Null;
+  leaf.unbounded = Null;
+  leaf.used = true;
+  return index;
+}
+
+//------------------------------------------------------------------------------
+void SceneBVH::freeLeaf(int32_t index, bool link)
+{
+  if (link && mLeaves[index].node != Null)
+    removeLeaf(index);
+  removeUnbounded(index);
+
+  Leaf& leaf = mLeaves[index];
+  leaf.name.clear();
+  leaf.object.reset();
+  leaf.node = Null;
+  leaf.used = false;
+  mFreeLeaves.push_back(index);
+}
+
+//------------------------------------------------------------------------------
+int32_t SceneBVH::allocateNode()
+{
+  int32_t index;
+  if (mFreeNodes.empty())
+  {
+    index = static_cast<int32_t>(mNodes.size());
+    mNodes.push_back(Node());
+  }
+  else
+  {
+    index = mFreeNodes.back();
+    mFreeNodes.pop_back();
+  }
+
+  Node& node = mNodes[index];
+  node.min = V3(0.0f, 0.0f, 0.0f);
+  node.max = V3(0.0f, 0.0f, 0.0f);
+  node.parent = Null;
+  node.children[0] = Null;
+  node.children[1] = Null;
+  node.leaf = Null;
+  return index;
+}
+
+//------------------------------------------------------------------------------
+void SceneBVH::freeNode(int32_t index)
+{
+  setNodeBox(index, V3(0.0f, 0.0f, 0.0f), V3(0.0f, 0.0f, 0.0f));
+  mFreeNodes.push_back(index);
+}
+
+//------------------------------------------------------------------------------
+void SceneBVH::setNodeBox(int32_t index, const V3& min, const V3& max)
+{
+  Node& node = mNodes[index];
+  if (node.leaf == Null)
+    mInnerArea += surfaceArea(min, max) - surfaceArea(node.min, node.max);
+  node.min = min;
+  node.max = max;
+}
+
+//------------------------------------------------------------------------------
+void SceneBVH::insertLeaf(int32_t index)
+{
+  const V3 min = mLeaves[index].min;
+  const V3 max = mLeaves[index].max;
+  int32_t node = allocateNode();
+  mNodes[node].leaf = index;
+  setNodeBox(node, min, max);
+  mLeaves[index].node = node;
+  if (mRoot == Null)
+  {
+    mRoot = node;
+    return;
+  }
+
+  // Descend towards the sibling giving the smallest increase of the tree's
+  // surface area (Catto's branch and bound, without rotations).
+  int32_t sibling = mRoot;
+  while (mNodes[sibling].leaf == Null)
+  {
+    const Node& current = mNodes[sibling];
+    float area = surfaceArea(current.min, current.max);
+    float combined = surfaceArea(glm::min(current.min, min), glm::max(current.max, max));
+    float cost = 2.0f * combined;
+    float inheritance = 2.0f * (combined - area);
+
+    float childCosts[2];
+    for (int c = 0; c < 2; ++c)
+    {
+      const Node& child = mNodes[current.children[c]];
+      float enlarged = surfaceArea(glm::min(child.min, min), glm::max(child.max, max));
+      if (child.leaf == Null)
+        enlarged -= surfaceArea(child.min, child.max);
+      childCosts[c] = enlarged + inheritance;
+    }
+
+    if (cost < childCosts[0] && cost < childCosts[1])
+      break;
+    sibling = current.children[childCosts[1] < childCosts[0] ? 1 : 0];
+  }
+
+  int32_t parent = allocateNode();
+  int32_t grandParent = mNodes[sibling].parent;
+  mNodes[parent].parent = grandParent;
+  mNodes[parent].children[0] = sibling;
+  mNodes[parent].children[1] = node;
+  setNodeBox(parent, glm::min(mNodes[sibling].min, min),
+             glm::max(mNodes[sibling].max, max));
+  mNodes[sibling].parent = parent;
+  mNodes[node].parent = parent;
+
+  if (grandParent == Null)
+  {
+    mRoot = parent;
+  }
+  else
+  {
+    Node& grand = mNodes[grandParent];
+    grand.children[grand.children[0] == sibling ? 0 : 1] = parent;
+    refitAncestors(grandParent);
+  }
+}
+
+//------------------------------------------------------------------------------
+void SceneBVH::removeLeaf(int32_t index)
+{
+  int32_t node = mLeaves[index].node;
+  mLeaves[index].node = Null;
+  int32_t parent = mNodes[node].parent;
+  freeNode(node);
+  if (parent == Null)
+  {
+    mRoot = Null;
+    return;
+  }
+
+  const Node& oldParent = mNodes[parent];
+  int32_t sibling = oldParent.children[oldParent.children[0] == node ? 1 : 0];
+  int32_t grandParent = oldParent.parent;
+  freeNode(parent);
+  mNodes[sibling].parent = grandParent;
+
+  if (grandParent == Null)
+  {
+    mRoot = sibling;
+  }
+  else
+  {
+    Node& grand = mNodes[grandParent];
+    grand.children[grand.children[0] == parent ? 0 : 1] = sibling;
+    refitAncestors(grandParent);
+  }
+}
+
+//------------------------------------------------------------------------------
+void SceneBVH::refitAncestors(int32_t index)
+{
+  while (index != Null)
+  {
+    const Node& node = mNodes[index];
+    const Node& first = mNodes[node.children[0]];
+    const Node& second = mNodes[node.children[1]];
+    V3 min = glm::min(first.min, second.min);
+    V3 max = glm::max(first.max, second.max);
+
+    // Boxes further up are unions including this one.
+    if (min == node.min && max == node.max)
+      return;
+    setNodeBox(index, min, max);
+    index = node.parent;
+  }
+}
+
+//------------------------------------------------------------------------------
+void SceneBVH::addUnbounded(int32_t index)
+{
+  Leaf& leaf = mLeaves[index];
+  if (leaf.unbounded != Null)
+    return;
+  leaf.unbounded = static_cast<int32_t>(mUnbounded.size());
+  mUnbounded.push_back(index);
+}
+
+//------------------------------------------------------------------------------
+void SceneBVH::removeUnbounded(int32_t index)
+{
+  Leaf& leaf = mLeaves[index];
+  if (leaf.unbounded == Null)
+    return;
+  int32_t last = mUnbounded.back();
+  mUnbounded[leaf.unbounded] = last;
+  mLeaves[last].unbounded = leaf.unbounded;
+  mUnbounded.pop_back();
+  leaf.unbounded = Null;
+}
+
+//------------------------------------------------------------------------------
+void SceneBVH::dropTree()
+{
+  mNodes.clear();
+  mFreeNodes.clear();
+  mRoot = Null;
+  mInnerArea = 0.0;
+  for (auto it = mLeaves.begin(); it != mLeaves.end(); ++it)
+    it->node = Null;
+}
+
+//------------------------------------------------------------------------------
+void SceneBVH::rebuild()
+{
+  std::vector<BuildRef> refs;
+  refs.reserve(mLeaves.size());
+  for (size_t i = 0; i < mLeaves.size(); ++i)
+  {
+    const Leaf& leaf = mLeaves[i];
+    if (!leaf.used || leaf.unbounded != Null)
+      continue;
+    BuildRef ref;
+    ref.min = leaf.min;
+    ref.max = leaf.max;
+    ref.centroid = (leaf.min + leaf.max) * 0.5f;
+    ref.leaf = static_cast<int32_t>(i);
+    refs.push_back(ref);
+  }
+
+  dropTree();
+  if (!refs.empty())
+  {
+    mNodes.resize(2 * refs.size() - 1);
+    mRoot = 0;
+    buildNode(refs, 0, refs.size(), 0, Null);
+  }
+
+  for (auto it = mNodes.begin(); it != mNodes.end(); ++it)
+  {
+    if (it->leaf == Null)
+      mInnerArea += surfaceArea(it->min, it->max);
+  }
+  mRebuildCost = getCost();
+  ++mNumRebuilds;
+}
+
+//------------------------------------------------------------------------------
+void SceneBVH::buildNode(std::vector<BuildRef>& refs, size_t begin, size_t end,
+                         int32_t index, int32_t parent)
+{
+  Node& node = mNodes[index];
+  node.parent = parent;
+  node.min = refs[begin].min;
+  node.max = refs[begin].max;
+  V3 centroidMin = refs[begin].centroid;
+  V3 centroidMax = refs[begin].centroid;
+  for (size_t i = begin + 1; i < end; ++i)
+  {
+    node.min = glm::min(node.min, refs[i].min);
+    node.max = glm::max(node.max, refs[i].max);
+    centroidMin = glm::min(centroidMin, refs[i].centroid);
+    centroidMax = glm::max(centroidMax, refs[i].centroid);
+  }
+
+  if (end - begin == 1)
+  {
+    node.leaf = refs[begin].leaf;
+    node.children[0] = Null;
+    node.children[1] = Null;
+    mLeaves[node.leaf].node = index;
+    return;
+  }
+  node.leaf = Null;
+
+  // Bin the centroids along their longest axis and split between the two
+  // bins with the lowest SAH cost: objects times surface area, summed over
+  // both sides. Centroids that all coincide are split in half.
+  V3 centroidExtent = centroidMax - centroidMin;
+  int axis = 0;
+  if (centroidExtent[1] > centroidExtent[axis])
+    axis = 1;
+  if (centroidExtent[2] > centroidExtent[axis])
+    axis = 2;
+
+  size_t mid = begin + (end - begin) / 2;
+  if (centroidExtent[axis] > 0.0f)
+  {
+    const float infinity = std::numeric_limits<float>::infinity();
+    const float origin = centroidMin[axis];
+    const float scale = static_cast<float>(NumBins) / centroidExtent[axis];
+    auto binOf = [&](const BuildRef& ref)
+    {
+      return std::min(NumBins - 1, static_cast<size_t>(
+              (ref.centroid[axis] - origin) * scale));
+    };
+
+    struct Bin
+    {
+      size_t  count;
+      V3      min;
+      V3      max;
+    };
+    Bin bins[NumBins];
+    for (size_t b = 0; b < NumBins; ++b)
+    {
+      bins[b].count = 0;
+      bins[b].min = V3(infinity, infinity, infinity);
+      bins[b].max = V3(-infinity, -infinity, -infinity);
+    }
+    for (size_t i = begin; i < end; ++i)
+    {
+      Bin& bin = bins[binOf(refs[i])];
+      ++bin.count;
+      bin.min = glm::min(bin.min, refs[i].min);
+      bin.max = glm::max(bin.max, refs[i].max);
+    }
+
+    // rightCosts[b]: cost of the bins from b on.
+    float rightCosts[NumBins];
+    V3 min = bins[NumBins - 1].min;
+    V3 max = bins[NumBins - 1].max;
+    size_t count = 0;
+    for (size_t b = NumBins - 1; b > 0; --b)
+    {
+      count += bins[b].count;
+      min = glm::min(min, bins[b].min);
+      max = glm::max(max, bins[b].max);
+      rightCosts[b] = count ? static_cast<float>(count) * surfaceArea(min, max) : infinity;
+    }
+
+    size_t bestSplit = 0;
+    float bestCost = infinity;
+    min = bins[0].min;
+    max = bins[0].max;
+    count = 0;
+    for (size_t b = 0; b + 1 < NumBins; ++b)
+    {
+      count += bins[b].count;
+      min = glm::min(min, bins[b].min);
+      max = glm::max(max, bins[b].max);
+      if (count == 0)
+        continue;
+      float cost = static_cast<float>(count) * surfaceArea(min, max) + rightCosts[b + 1];
+      if (cost < bestCost)
+      {
+        bestCost = cost;
+        bestSplit = b;
+      }
+    }
+
+    auto split = std::partition(
+        refs.begin() + begin, refs.begin() + end,
+        [&](const BuildRef& ref) {return binOf(ref) <= bestSplit;});
+    size_t binnedMid = static_cast<size_t>(split - refs.begin());
+    if (binnedMid != begin && binnedMid != end)
+      mid = binnedMid;
+  }
+
+  // The left subtree of n objects takes the 2n - 1 nodes after this one.
+  int32_t left = index + 1;
+  int32_t right = index + 2 * static_cast<int32_t>(mid - begin);
+  node.children[0] = left;
+  node.children[1] = right;
+  if (end - begin >= ParallelBuildSize)
+  {
+    parallelFor(2, [&](size_t i)
+    {
+      if (i == 0)
+        buildNode(refs, begin, mid, left, index);
+      else
+        buildNode(refs, mid, end, right, index);
+    });
+  }
+  else
+  {
+    buildNode(refs, begin, mid, left, index);
+    buildNode(refs, mid, end, right, index);
+  }
+}
+
+//------------------------------------------------------------------------------
+void SceneBVH::queryBox(const V3& min, const V3& max,
+                        std::vector<std::string>& objects) const
+{
+  objects.clear();
+  std::vector<int32_t> stack;
+  if (mRoot != Null)
+    stack.push_back(mRoot);
+  while (!stack.empty())
+  {
+    const Node& node = mNodes[stack.back()];
+    stack.pop_back();
+    if (!overlaps(node.min, node.max, min, max))
+      continue;
+    if (node.leaf != Null)
+    {
+      objects.push_back(mLeaves[node.leaf].name);
+    }
+    else
+    {
+      stack.push_back(node.children[1]);
+      stack.push_back(node.children[0]);
+    }
+  }
+
+  for (auto it = mUnbounded.begin(); it != mUnbounded.end(); ++it)
+    objects.push_back(mLeaves[*it].name);
+}
+
+//------------------------------------------------------------------------------
+void SceneBVH::queryFrustum(const M44& worldToProjection,
+                            std::vector<std::string>& objects) const
+{
+  V4 planes[6];
+  FramePrep::extractFrustumPlanes(worldToProjection, planes);
+
+  // Each entry carries the planes its box is not known to be inside of;
+  // subtrees inside of all planes are taken without further tests.
+  objects.clear();
+  std::vector<std::pair<int32_t, unsigned>> stack;
+  if (mRoot != Null)
+    stack.push_back(std::make_pair(mRoot, 0x3fu));
+  while (!stack.empty())
+  {
+    const Node& node = mNodes[stack.back().first];
+    unsigned planeMask = stack.back().second;
+    stack.pop_back();
+
+    if (planeMask != 0)
+    {
+      V3 center = (node.min + node.max) * 0.5f;
+      V3 extent = (node.max - node.min) * 0.5f;
+      bool outside = false;
+      for (int i = 0; i < 6 && !outside; ++i)
+      {
+        if ((planeMask & (1u << i)) == 0)
+          continue;
+        float distance = glm::dot(V3(planes[i]), center) + planes[i].w;
+        float reach = glm::dot(glm::abs(V3(planes[i])), extent);
+        outside = distance + reach < 0.0f;
+        if (distance - reach >= 0.0f)
+          planeMask &= ~(1u << i);
+      }
+      if (outside)
+        continue;
+    }
+
+    if (node.leaf != Null)
+    {
+      objects.push_back(mLeaves[node.leaf].name);
+    }
+    else
+    {
+      stack.push_back(std::make_pair(node.children[1], planeMask));
+      stack.push_back(std::make_pair(node.children[0], planeMask));
+    }
+  }
+
+  for (auto it = mUnbounded.begin(); it != mUnbounded.end(); ++it)
+    objects.push_back(mLeaves[*it].name);
+}
+
+//------------------------------------------------------------------------------
+void SceneBVH::queryRay(const V3& origin, const V3& direction,
+                        std::vector<RayHit>& hits) const
+{
+  V3 inverse(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+
+  hits.clear();
+  std::vector<int32_t> stack;
+  if (mRoot != Null)
+    stack.push_back(mRoot);
+  while (!stack.empty())
+  {
+    const Node& node = mNodes[stack.back()];
+    stack.pop_back();
+    float distance;
+    if (!intersectRay(origin, inverse, node.min, node.max, distance))
+      continue;
+    if (node.leaf != Null)
+    {
+      RayHit hit;
+      hit.object = mLeaves[node.leaf].name;
+      hit.distance = distance;
+      hits.push_back(hit);
+    }
+    else
+    {
+      stack.push_back(node.children[1]);
+      stack.push_back(node.children[0]);
+    }
+  }
+  std::sort(hits.begin(), hits.end(), [](const RayHit& a, const RayHit& b)
+  {
+    return a.distance < b.distance || (a.distance == b.distance && a.object < b.object);
+  });
+
+  for (auto it = mUnbounded.begin(); it != mUnbounded.end(); ++it)
+  {
+    RayHit hit;
+    hit.object = mLeaves[*it].name;
+    hit.distance = std::numeric_limits<float>::infinity();
+    hits.push_back(hit);
+  }
+}
+
+//------------------------------------------------------------------------------
+size_t SceneBVH::getNumObjects() const
+{
+  return mLeaves.size() - mFreeLeaves.size();
+}
+
+//------------------------------------------------------------------------------
+float SceneBVH::getCost() const
+{
+  if (mRoot == Null || mNodes[mRoot].leaf != Null)
+    return 0.0f;
+  float rootArea = surfaceArea(mNodes[mRoot].min, mNodes[mRoot].max);
+  if (!(rootArea > 0.0f))
+    return 0.0f;
+  return static_cast<float>(mInnerArea / rootArea);
+}
+
+//------------------------------------------------------------------------------
+size_t SceneBVH::getDepth() const
+{
+  size_t depth = 0;
+  std::vector<std::pair<int32_t, size_t>> stack;
+  if (mRoot != Null)
+    stack.push_back(std::make_pair(mRoot, size_t(1)));
+  while (!stack.empty())
+  {
+    const Node& node = mNodes[stack.back().first];
+    size_t nodeDepth = stack.back().second;
+    stack.pop_back();
+    depth = std::max(depth, nodeDepth);
+    if (node.leaf == Null)
+    {
+      stack.push_back(std::make_pair(node.children[0], nodeDepth + 1));
+      stack.push_back(std::make_pair(node.children[1], nodeDepth + 1));
+    }
+  }
+  return depth;
+}
+
+} // namespace CPM_SPIRE_NS
@@ -0,0 +1,229 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+/// \brief  Bounding volume hierarchy over the world space bounds of the
+///         objects of the scene, answering box, frustum and ray queries in
+///         time sublinear in the number of objects.
+
+#ifndef SPIRE_HIGH_SCENEBVH_H
+#define SPIRE_HIGH_SCENEBVH_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Common.h"
+#include "SceneBuffer.h"
+
+namespace CPM_SPIRE_NS {
+
+/// Object found by SceneBVH::queryRay.
+struct RayHit
+{
+  std::string object;
+
+  /// Ray parameter (in multiples of the direction) at which the ray enters
+  /// the object's bounds, 0 if it starts inside of them. Infinite for
+  /// objects without bounds.
+  float       distance;
+};
+
+/// Dynamic bounding volume hierarchy over the objects of a scene, one leaf
+/// per object holding its world space box (its bounds transformed by its
+/// transform). Objects without bounds cannot be placed; they are kept aside
+/// and returned by every query, just as they are never culled.
+///
+/// update brings the tree up to date with a scene version, looking only at
+/// the shards (see SceneVersion) that changed since the last update. New
+/// objects are inserted next to the node they enlarge the least, removed
+/// ones are unlinked, and objects whose box moved are refit: the leaf keeps
+/// its place and only the boxes of its ancestors grow or shrink. Objects
+/// whose new box does not even overlap the old one are reinserted instead.
+/// Both degrade the tree over time, so it is rebuilt from scratch with a
+/// binned surface area heuristic (SAH) on the shared thread pool once its
+/// SAH cost exceeds the cost after the last rebuild by RebuildCostRatio, or
+/// right away when an update changes most of the objects.
+///
+/// Not thread safe. Shards and objects are tracked through weak pointers
+/// only, so the BVH never keeps a version of the scene alive.
+class SceneBVH
+{
+public:
+  /// Growth of the SAH cost that triggers a rebuild.
+  static const float RebuildCostRatio;
+
+  /// Bins of the SAH rebuild.
+  static const size_t NumBins = 16;
+
+  /// Subtrees with at least this many objects are rebuilt in parallel.
+  static const size_t ParallelBuildSize = 4096;
+
+  SceneBVH();
+
+  /// Applies the additions, removals and changes of objects since the last
+  /// update.
+  void update(const SceneVersion& scene);
+
+  /// Forgets all objects.
+  void clear();
+
+  /// Rebuilds the tree from scratch.
+  void rebuild();
+
+  /// Names of the objects whose box intersects ['min', 'max'], followed by
+  /// the objects without bounds.
+  void queryBox(const V3& min, const V3& max,
+                std::vector<std::string>& objects) const;
+
+  /// Names of the objects whose box is not entirely outside of the view
+  /// frustum of 'worldToProjection' (see FramePrep::isBoxVisible), followed
+  /// by the objects without bounds.
+  void queryFrustum(const M44& worldToProjection,
+                    std::vector<std::string>& objects) const;
+
+  /// Objects whose box is hit by the ray from 'origin' along 'direction',
+  /// nearest first (ties by name), followed by the objects without bounds.
+  void queryRay(const V3& origin, const V3& direction,
+                std::vector<RayHit>& hits) const;
+
+  /// Number of objects, with and without bounds.
+  size_t getNumObjects() const;
+
+  /// Number of objects without bounds.
+  size_t getNumUnbounded() const        {return mUnbounded.size();}
+
+  /// Number of rebuilds so far.
+  size_t getNumRebuilds() const         {return mNumRebuilds;}
+
+  /// SAH cost of the tree: surface area of the inner nodes relative to the
+  /// root's. 0 if there are less than two objects with bounds.
+  float getCost() const;
+
+  /// Number of nodes on the longest path from the root to a leaf.
+  size_t getDepth() const;
+
+private:
+  SceneBVH(const SceneBVH&);
+  SceneBVH& operator=(const SceneBVH&);
+
+  static const int32_t Null = -1;
+
+  struct Node
+  {
+    V3      min;
+    V3      max;
+    int32_t parent;
+    int32_t children[2];
+    int32_t leaf;         ///< Null for inner nodes.
+  };
+
+  struct Leaf
+  {
+    std::string                       name;
+    std::weak_ptr<const SpireObject>  object;     ///< Identifies edits.
+    V3                                min;
+    V3                                max;
+    int32_t                           node;       ///< Null if not in the tree.
+    int32_t                           unbounded;  ///< Index in mUnbounded, or Null.
+    bool                              used;
+  };
+
+  /// Leaf and bounds during a rebuild.
+  struct BuildRef
+  {
+    V3      min;
+    V3      max;
+    V3      centroid;
+    int32_t leaf;
+  };
+
+  /// Counts the objects of the changed shard 'shard' that were added,
+  /// removed or edited.
+  size_t countChanges(size_t shard, const SceneVersion::Shard& objects) const;
+
+  /// Applies the changes of shard 'shard'. Leaves are only linked into the
+  /// tree if 'link' is true.
+  void updateShard(size_t shard, const SceneVersion::Shard& objects, bool link);
+
+  /// Sets the box of 'leaf' from 'object' and moves the leaf into or out of
+  /// the tree as needed.
+  void placeLeaf(int32_t leaf, const SpireObject& object, bool link);
+
+  int32_t allocateLeaf(const std::string& name,
+                       const std::shared_ptr<const SpireObject>& object);
+  void freeLeaf(int32_t leaf, bool link);
+
+  int32_t allocateNode();
+  void freeNode(int32_t node);
+
+  /// Sets the box of 'node', keeping mInnerArea up to date.
+  void setNodeBox(int32_t node, const V3& min, const V3& max);
+
+  void insertLeaf(int32_t leaf);
+  void removeLeaf(int32_t leaf);
+
+  /// Recomputes the boxes of 'node' and its ancestors from their children.
+  void refitAncestors(int32_t node);
+
+  void addUnbounded(int32_t leaf);
+  void removeUnbounded(int32_t leaf);
+
+  /// Drops all nodes; leaves are kept.
+  void dropTree();
+
+  /// Builds the subtree of refs [begin, end) into the 2 * (end - begin) - 1
+  /// nodes starting at 'node'.
+  void buildNode(std::vector<BuildRef>& refs, size_t begin, size_t end,
+                 int32_t node, int32_t parent);
+
+  std::vector<Node>                                   mNodes;
+  std::vector<int32_t>                                mFreeNodes;
+  int32_t                                             mRoot;
+
+  std::vector<Leaf>                                   mLeaves;
+  std::vector<int32_t>                                mFreeLeaves;
+  std::vector<int32_t>                                mUnbounded;
+
+  /// Shards as of the last update and the leaves of their objects.
+  std::array<std::weak_ptr<const SceneVersion::Shard>,
+             SceneVersion::NumShards>                 mShards;
+  std::array<std::unordered_map<std::string, int32_t>,
+             SceneVersion::NumShards>                 mShardLeaves;
+
+  double                                              mInnerArea;   ///< Of all inner nodes.
+  float                                               mRebuildCost; ///< Right after the last rebuild.
+  size_t                                              mNumRebuilds;
+};
+
+} // namespace CPM_SPIRE_NS
+
+#endif
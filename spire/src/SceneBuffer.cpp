@@ -0,0 +1,330 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <stdexcept>
+
+#include "SceneBuffer.h"
+#include "Exceptions.h"
+#include "SpireObject.h"
+
+namespace CPM_SPIRE_NS {
+
+//------------------------------------------------------------------------------
+SceneVersion::SceneVersion() :
+    numObjects(0),
+    globalUniforms(std::make_shared<const UniformMap>())
+{
+  std::shared_ptr<const Shard> empty = std::make_shared<const Shard>();
+  shards.fill(empty);
+}
+
+//------------------------------------------------------------------------------
+size_t SceneVersion::getShardIndex(const std::string& name)
+{
+  return std::hash<std::string>()(name) % NumShards;
+}
+
+//------------------------------------------------------------------------------
+std::shared_ptr<const SpireObject>
+SceneVersion::findObject(const std::string& name) const
+{
+  const Shard& shard = *shards[getShardIndex(name)];
+  auto it = shard.find(name);
+  if (it == shard.end())
+    return std::shared_ptr<const SpireObject>();
+  return it->second;
+}
+
+//------------------------------------------------------------------------------
+SceneBuffer::SceneBuffer() :
+    mLatest(std::make_shared<const SceneVersion>()),
+    mHasEdits(false),
+    mNumCopied(0),
+    mNumVersionsRetired(0),
+    mNumVersionsReleased(0),
+    mFront(mLatest.getLatest()),
+    mReleaseQueue(std::make_shared<ReleaseQueue>())
+{
+}
+
+//------------------------------------------------------------------------------
+SceneBuffer::~SceneBuffer()
+{
+  // Pointers of getObject dropped from now on release their object
+  // themselves.
+  std::lock_guard<std::mutex> lock(mReleaseQueue->mutex);
+  mReleaseQueue->closed = true;
+  mReleaseQueue->objects.clear();
+}
+
+//------------------------------------------------------------------------------
+SceneVersion::Shard& SceneBuffer::getPendingShard(size_t shardIndex)
+{
+  if (mPending == nullptr)
+    mPending = std::make_shared<SceneVersion>(*mLatest.getLatest());
+  if (mPendingShards[shardIndex] == nullptr)
+  {
+    mPendingShards[shardIndex] =
+        std::make_shared<SceneVersion::Shard>(*mPending->shards[shardIndex]);
+    mPending->shards[shardIndex] = mPendingShards[shardIndex];
+  }
+  mHasEdits = true;
+  return *mPendingShards[shardIndex];
+}
+
+//------------------------------------------------------------------------------
+void SceneBuffer::retireObject(std::shared_ptr<const SpireObject> object)
+{
+  // The latest version may hold the object too until the next flush retires
+  // it.
+  mRetiredObjects.push_back(RetiredObject(mNumVersionsRetired + 1, std::move(object)));
+}
+
+//------------------------------------------------------------------------------
+void SceneBuffer::flush() const
+{
+  if (mPending != nullptr)
+  {
+    mLatest.update(mPending);
+    ++mNumVersionsRetired;
+    mPending.reset();
+    mPendingShards.fill(nullptr);
+    mPendingUniforms.reset();
+  }
+  mHasEdits = false;
+
+  // Removed objects are kept aside, so the versions can go on any thread.
+  mNumVersionsReleased += mLatest.reclaim();
+
+  // Dropped pointers of getObject: the objects the scene still holds are
+  // released by it, the others wait for publish.
+  std::vector<std::shared_ptr<const SpireObject>> dropped;
+  {
+    std::lock_guard<std::mutex> lock(mReleaseQueue->mutex);
+    dropped.swap(mReleaseQueue->objects);
+    mReleaseQueue->numObjects = 0;
+  }
+  const SceneVersion& latest = *mLatest.getLatest();
+  for (auto it = dropped.begin(); it != dropped.end(); ++it)
+  {
+    if (latest.findObject((*it)->getName()) != *it)
+      mRetiredObjects.push_back(RetiredObject(mNumVersionsRetired, std::move(*it)));
+  }
+}
+
+//------------------------------------------------------------------------------
+void SceneBuffer::flushEdits() const
+{
+  if (!mHasEdits && mReleaseQueue->numObjects < MaxDroppedObjects)
+    return;
+  std::lock_guard<std::mutex> lock(mMutex);
+  flush();
+}
+
+//------------------------------------------------------------------------------
+void SceneBuffer::addObject(std::shared_ptr<SpireObject> object)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  SceneVersion::Shard& shard =
+      getPendingShard(SceneVersion::getShardIndex(object->getName()));
+  if (!shard.insert(std::make_pair(object->getName(), object)).second)
+    throw Duplicate("There already exists an object by that name!");
+  ++mPending->numObjects;
+}
+
+//------------------------------------------------------------------------------
+void SceneBuffer::removeObject(const std::string& name)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  SceneVersion::Shard& shard = getPendingShard(SceneVersion::getShardIndex(name));
+  auto found = shard.find(name);
+  if (found == shard.end())
+    throw std::range_error("Object to remove does not exist!");
+
+  retireObject(std::move(found->second));
+  shard.erase(found);
+  --mPending->numObjects;
+}
+
+//------------------------------------------------------------------------------
+void SceneBuffer::removeAllObjects()
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  const SceneVersion& current = mPending != nullptr ? *mPending : *mLatest.getLatest();
+  for (size_t i = 0; i < SceneVersion::NumShards; ++i)
+  {
+    for (auto it = current.shards[i]->begin(); it != current.shards[i]->end(); ++it)
+      retireObject(it->second);
+  }
+
+  std::shared_ptr<SceneVersion> version = std::make_shared<SceneVersion>();
+  version->globalUniforms = current.globalUniforms;
+  mPending = version;
+  mPendingShards.fill(nullptr);
+  mPendingUniforms.reset();
+  mHasEdits = true;
+}
+
+//------------------------------------------------------------------------------
+void SceneBuffer::editObject(const std::string& name,
+                             const std::function<void (SpireObject&)>& edit)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  const SceneVersion& current = mPending != nullptr ? *mPending : *mLatest.getLatest();
+  size_t index = SceneVersion::getShardIndex(name);
+  std::shared_ptr<SpireObject> object = current.shards[index]->at(name)->clone();
+  edit(*object);
+
+  std::shared_ptr<const SpireObject>& slot = getPendingShard(index)[name];
+  retireObject(std::move(slot));
+  slot = object;
+  ++mNumCopied;
+}
+
+//------------------------------------------------------------------------------
+void SceneBuffer::setGlobalUniform(
+    const std::string& name, std::shared_ptr<const AbstractUniformStateItem> item)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  if (mPending == nullptr)
+    mPending = std::make_shared<SceneVersion>(*mLatest.getLatest());
+  if (mPendingUniforms == nullptr)
+  {
+    mPendingUniforms =
+        std::make_shared<SceneVersion::UniformMap>(*mPending->globalUniforms);
+    mPending->globalUniforms = mPendingUniforms;
+  }
+  (*mPendingUniforms)[name] = item;
+  mHasEdits = true;
+}
+
+//------------------------------------------------------------------------------
+bool SceneBuffer::hasObject(const std::string& name) const
+{
+  flushEdits();
+  RCUValue<SceneVersion>::ReadGuard latest(mLatest);
+  return latest->shards[SceneVersion::getShardIndex(name)]->count(name) != 0;
+}
+
+//------------------------------------------------------------------------------
+size_t SceneBuffer::getNumObjects() const
+{
+  flushEdits();
+  RCUValue<SceneVersion>::ReadGuard latest(mLatest);
+  return latest->numObjects;
+}
+
+//------------------------------------------------------------------------------
+std::shared_ptr<const SpireObject>
+SceneBuffer::getObject(const std::string& name) const
+{
+  // The caller gets an alias of a holder that hands the object back to the
+  // release queue, whichever thread drops it.
+  struct Holder
+  {
+    ~Holder()
+    {
+      // Null if the object was not found.
+      if (object == nullptr)
+        return;
+      std::lock_guard<std::mutex> lock(queue->mutex);
+      if (queue->closed)
+        return;
+      queue->objects.push_back(std::move(object));
+      queue->numObjects = queue->objects.size();
+    }
+
+    std::shared_ptr<ReleaseQueue>       queue;
+    std::shared_ptr<const SpireObject>  object;
+  };
+
+  flushEdits();
+  std::shared_ptr<Holder> holder = std::make_shared<Holder>();
+  holder->queue = mReleaseQueue;
+  {
+    RCUValue<SceneVersion>::ReadGuard latest(mLatest);
+    holder->object = latest->shards[SceneVersion::getShardIndex(name)]->at(name);
+  }
+  const SpireObject* object = holder->object.get();
+  return std::shared_ptr<const SpireObject>(holder, object);
+}
+
+//------------------------------------------------------------------------------
+std::shared_ptr<const AbstractUniformStateItem>
+SceneBuffer::getGlobalUniform(const std::string& name) const
+{
+  flushEdits();
+  RCUValue<SceneVersion>::ReadGuard latest(mLatest);
+  auto it = latest->globalUniforms->find(name);
+  if (it == latest->globalUniforms->end())
+    throw NotFound("Unable to find uniform at any level: '" + name + "'");
+  return it->second;
+}
+
+//------------------------------------------------------------------------------
+void SceneBuffer::readLatest(
+    const std::function<void (const SceneVersion&)>& reader) const
+{
+  flushEdits();
+  RCUValue<SceneVersion>::ReadGuard latest(mLatest);
+  reader(*latest);
+}
+
+//------------------------------------------------------------------------------
+size_t SceneBuffer::getNumObjectsToRelease() const
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  return mRetiredObjects.size() + mReleaseQueue->numObjects;
+}
+
+//------------------------------------------------------------------------------
+bool SceneBuffer::publish(size_t* numCopied)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  if (numCopied)
+    *numCopied = mNumCopied;
+  mNumCopied = 0;
+  flush();
+
+  // Objects no version readers can see holds anymore are released here, on
+  // the render thread, even when no edits were made.
+  size_t numKept = 0;
+  for (size_t i = 0; i < mRetiredObjects.size(); ++i)
+  {
+    if (mRetiredObjects[i].first > mNumVersionsReleased)
+      mRetiredObjects[numKept++] = std::move(mRetiredObjects[i]);
+  }
+  mRetiredObjects.resize(numKept);
+  if (mFront == mLatest.getLatest())
+    return false;
+
+  mFront = mLatest.getLatest();
+  return true;
+}
+
+} // namespace CPM_SPIRE_NS
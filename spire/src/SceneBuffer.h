@@ -0,0 +1,226 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef SPIRE_HIGH_SCENEBUFFER_H
+#define SPIRE_HIGH_SCENEBUFFER_H
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "RCU.h"
+
+namespace CPM_SPIRE_NS {
+
+class AbstractUniformStateItem;
+class SpireObject;
+
+/// Immutable version of the scene: objects by name, plus the global uniform
+/// values for queries. Objects are split into shards so that an edit only
+/// copies the shard of the object it replaces.
+struct SceneVersion
+{
+  static const size_t NumShards = 64;
+
+  typedef std::unordered_map<std::string, std::shared_ptr<const SpireObject>> Shard;
+  typedef std::unordered_map<std::string,
+                             std::shared_ptr<const AbstractUniformStateItem>>
+      UniformMap;
+
+  SceneVersion();
+
+  static size_t getShardIndex(const std::string& name);
+
+  /// Returns an empty pointer if there is no such object.
+  std::shared_ptr<const SpireObject> findObject(const std::string& name) const;
+
+  std::array<std::shared_ptr<const Shard>, NumShards> shards;  ///< Never null.
+  size_t                                              numObjects;
+  std::shared_ptr<const UniformMap>                   globalUniforms;
+};
+
+/// Double buffered scene. Edits copy the edited object (copy-on-write) into
+/// a pending version private to the writers, which is changed in place: an
+/// edit costs the same however large the scene, and each shard is copied
+/// once per batch of edits. Built versions are never modified. Three
+/// versions are of interest:
+///  - the pending version, holding the edits not yet seen by any reader,
+///  - the latest version, which queries on any thread read without locks
+///    (read-copy-update, see RCUValue). The first query after edits builds
+///    it from the pending version, so queries always see all edits made so
+///    far and never a half-updated object,
+///  - the front version, swapped in by publish at frame boundaries and
+///    rendered by the render thread.
+///
+/// Edits are serialized by a mutex but never wait for readers. Replaced
+/// versions are released as soon as no reader can see them, on any thread.
+/// The objects removed from the scene, which may own GL objects, are kept
+/// aside until then and only released by publish, on the render thread. So
+/// are the objects handed out by getObject once the scene no longer holds
+/// them.
+class SceneBuffer
+{
+public:
+  typedef std::shared_ptr<const SceneVersion> Snapshot;
+
+  SceneBuffer();
+  ~SceneBuffer();
+
+  //--------------------------------------------------------------------------
+  // Edits -- thread safe
+  //--------------------------------------------------------------------------
+
+  /// Throws Duplicate if an object by the same name exists.
+  void addObject(std::shared_ptr<SpireObject> object);
+
+  /// Throws std::range_error if there is no such object.
+  void removeObject(const std::string& name);
+
+  void removeAllObjects();
+
+  /// Runs 'edit' on a copy of object 'name', which then replaces the object.
+  /// Throws std::out_of_range if there is no such object. Nothing changes if
+  /// 'edit' throws.
+  void editObject(const std::string& name,
+                  const std::function<void (SpireObject&)>& edit);
+
+  /// Records the value of a global uniform for getGlobalUniform.
+  void setGlobalUniform(const std::string& name,
+                        std::shared_ptr<const AbstractUniformStateItem> item);
+
+  //--------------------------------------------------------------------------
+  // Queries -- thread safe and lock-free, see the latest version
+  //--------------------------------------------------------------------------
+
+  bool hasObject(const std::string& name) const;
+
+  size_t getNumObjects() const;
+
+  /// Throws std::out_of_range if there is no such object. Dropping the
+  /// returned pointer never releases the object: if the scene no longer
+  /// holds it, that is deferred to publish, so the GL objects it may own are
+  /// deleted on the render thread. Pointers still held when the buffer is
+  /// destroyed release the object on the thread that drops them.
+  std::shared_ptr<const SpireObject> getObject(const std::string& name) const;
+
+  /// Throws NotFound if the uniform was never set.
+  std::shared_ptr<const AbstractUniformStateItem>
+      getGlobalUniform(const std::string& name) const;
+
+  /// Calls 'reader' with the latest version. Nothing in the version may be
+  /// kept alive past the call (weak pointers are fine): the last reference
+  /// to a version must be dropped on the render thread.
+  void readLatest(const std::function<void (const SceneVersion&)>& reader) const;
+
+  //--------------------------------------------------------------------------
+  // Front version -- render thread only
+  //--------------------------------------------------------------------------
+
+  /// Objects kept aside until publish or the next query releases them.
+  size_t getNumObjectsToRelease() const;
+
+  /// Makes the latest version the front version and releases the objects
+  /// removed from the scene, or handed out by getObject and dropped, that
+  /// no version readers can see still holds.
+  /// \param  numCopied Set to the number of objects copied by edits since
+  ///                   the last publish, if not null.
+  /// \return False if nothing changed since the last publish.
+  bool publish(size_t* numCopied = nullptr);
+
+  /// Current front version.
+  const Snapshot& getFront() const    {return mFront;}
+
+private:
+  SceneBuffer(const SceneBuffer&);
+  SceneBuffer& operator=(const SceneBuffer&);
+
+  /// Writable shard 'shardIndex' of the pending version, copied from the
+  /// latest version on the first edit of the batch. mMutex must be held.
+  SceneVersion::Shard& getPendingShard(size_t shardIndex);
+
+  /// Keeps 'object', which left the pending version, until publish finds no
+  /// version that holds it left. mMutex must be held.
+  void retireObject(std::shared_ptr<const SpireObject> object);
+
+  /// Makes the pending version the latest one if there were edits, releases
+  /// the versions readers are done with and sorts the objects dropped from
+  /// getObject. mMutex must be held.
+  void flush() const;
+
+  /// Flushes if there were edits since the last flush, or many dropped
+  /// pointers of getObject.
+  void flushEdits() const;
+
+  /// Objects of getObject whose last outside reference was dropped. Shared
+  /// with the handed out pointers, which may outlive the buffer.
+  struct ReleaseQueue
+  {
+    ReleaseQueue() : numObjects(0), closed(false) {}
+
+    std::mutex                                      mutex;
+    std::vector<std::shared_ptr<const SpireObject>> objects;
+    std::atomic<size_t>                             numObjects;
+    bool                                            closed; ///< Buffer gone.
+  };
+
+  /// Queries flush once this many pointers of getObject were dropped.
+  static const size_t MaxDroppedObjects = 64;
+
+  /// Removed object and the number of versions that must have been released
+  /// before no version holds it.
+  typedef std::pair<size_t, std::shared_ptr<const SpireObject>> RetiredObject;
+
+  /// Queries flush the edits, so everything but the front version is
+  /// mutable and guarded by mMutex.
+  mutable std::mutex                  mMutex;
+  mutable RCUValue<SceneVersion>      mLatest;
+  mutable std::shared_ptr<SceneVersion> mPending;       ///< Null if no edits.
+  mutable std::array<std::shared_ptr<SceneVersion::Shard>,
+                     SceneVersion::NumShards> mPendingShards;
+  mutable std::shared_ptr<SceneVersion::UniformMap> mPendingUniforms;
+  mutable std::atomic<bool>           mHasEdits;
+  size_t                              mNumCopied;
+
+  /// Versions retired and released by mLatest so far. Versions are released
+  /// in the order they were retired.
+  mutable size_t                      mNumVersionsRetired;
+  mutable size_t                      mNumVersionsReleased;
+  mutable std::vector<RetiredObject>  mRetiredObjects;
+
+  Snapshot                            mFront;
+  std::shared_ptr<ReleaseQueue>       mReleaseQueue;
+};
+
+} // namespace CPM_SPIRE_NS
+
+#endif
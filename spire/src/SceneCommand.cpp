@@ -0,0 +1,200 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "SceneCommand.h"
+
+namespace CPM_SPIRE_NS {
+
+//------------------------------------------------------------------------------
+void setCommandName(char (&target)[SceneCommand::NameSize],
+                    const std::string& name)
+{
+  if (name.size() >= SceneCommand::NameSize)
+    throw std::invalid_argument("Name too long to be queued: " + name);
+  std::memcpy(target, name.c_str(), name.size() + 1);
+}
+
+//------------------------------------------------------------------------------
+size_t getCommandUniformSize(UNIFORM_TYPE type)
+{
+  switch (type)
+  {
+    case UNIFORM_FLOAT:         return 1;
+    case UNIFORM_FLOAT_VEC2:    return 2;
+    case UNIFORM_FLOAT_VEC3:    return 3;
+    case UNIFORM_FLOAT_VEC4:    return 4;
+    case UNIFORM_FLOAT_MAT4:    return 16;
+    default:                    return 0;
+  }
+}
+
+//------------------------------------------------------------------------------
+static bool isObjectCommand(const SceneCommand& command)
+{
+  return command.type == SceneCommand::ADD_OBJECT
+      || command.type == SceneCommand::REMOVE_OBJECT
+      || command.type == SceneCommand::SET_OBJECT_PASS_UNIFORM
+      || command.type == SceneCommand::SET_OBJECT_GLOBAL_UNIFORM;
+}
+
+//------------------------------------------------------------------------------
+/// Key identifying the uniform a uniform command writes.
+static std::string getUniformKey(const SceneCommand& command)
+{
+  std::string key;
+  key += static_cast<char>('0' + command.type);
+  key += command.object;
+  key += '\0';
+  key += command.pass;
+  key += '\0';
+  key += command.name;
+  key += '\0';
+  key += std::to_string(static_cast<int>(command.uniformType));
+  return key;
+}
+
+//------------------------------------------------------------------------------
+size_t coalesceSceneCommands(
+    std::vector<SceneCommand>& commands,
+    const std::function<bool (const std::string&)>& objectExists)
+{
+  std::vector<bool> dropped(commands.size(), false);
+
+  // Forward pass: cancel add/remove pairs. Track whether each object named by
+  // the list exists at the current point, and for objects this list created,
+  // which commands target them since they were added.
+  struct ObjectState
+  {
+    bool                exists;
+    bool                addedHere;
+    std::vector<size_t> commands;
+  };
+  std::unordered_map<std::string, ObjectState> objects;
+  for (size_t i = 0; i < commands.size(); ++i)
+  {
+    const SceneCommand& command = commands[i];
+    if (!isObjectCommand(command))
+      continue;
+
+    auto it = objects.find(command.object);
+    if (it == objects.end())
+    {
+      ObjectState state;
+      state.exists = objectExists(command.object);
+      state.addedHere = false;
+      it = objects.insert(std::make_pair(std::string(command.object), state)).first;
+    }
+    ObjectState& state = it->second;
+
+    if (command.type == SceneCommand::ADD_OBJECT)
+    {
+      if (!state.exists)
+      {
+        state.exists = true;
+        state.addedHere = true;
+        state.commands.assign(1, i);
+      }
+    }
+    else if (command.type == SceneCommand::REMOVE_OBJECT)
+    {
+      if (state.addedHere)
+      {
+        for (auto c = state.commands.begin(); c != state.commands.end(); ++c)
+          dropped[*c] = true;
+        dropped[i] = true;
+      }
+      state.exists = false;
+      state.addedHere = false;
+      state.commands.clear();
+    }
+    else if (state.addedHere)
+    {
+      state.commands.push_back(i);
+    }
+  }
+
+  // Backward pass: last writer wins.
+  std::unordered_set<std::string> writtenUniforms;
+  std::unordered_map<std::string, std::vector<std::pair<size_t, size_t>>> writtenRanges;
+  for (size_t i = commands.size(); i-- > 0;)
+  {
+    if (dropped[i])
+      continue;
+
+    const SceneCommand& command = commands[i];
+    switch (command.type)
+    {
+      case SceneCommand::SET_OBJECT_PASS_UNIFORM:
+      case SceneCommand::SET_OBJECT_GLOBAL_UNIFORM:
+      case SceneCommand::SET_GLOBAL_UNIFORM:
+        if (!writtenUniforms.insert(getUniformKey(command)).second)
+          dropped[i] = true;
+        break;
+
+      case SceneCommand::UPDATE_VBO:
+        {
+          std::vector<std::pair<size_t, size_t>>& ranges = writtenRanges[command.name];
+          size_t begin = command.offset;
+          size_t end = command.offset + command.size;
+          for (auto r = ranges.begin(); r != ranges.end(); ++r)
+          {
+            if (r->first <= begin && end <= r->second)
+            {
+              dropped[i] = true;
+              break;
+            }
+          }
+          if (!dropped[i])
+            ranges.push_back(std::make_pair(begin, end));
+        }
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  size_t numKept = 0;
+  for (size_t i = 0; i < commands.size(); ++i)
+  {
+    if (dropped[i])
+      delete[] commands[i].data;
+    else
+      commands[numKept++] = commands[i];
+  }
+  size_t numDropped = commands.size() - numKept;
+  commands.resize(numKept);
+  return numDropped;
+}
+
+} // namespace CPM_SPIRE_NS
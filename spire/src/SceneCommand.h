@@ -0,0 +1,100 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef SPIRE_HIGH_SCENECOMMAND_H
+#define SPIRE_HIGH_SCENECOMMAND_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "ShaderUniformStateManTemplates.h"
+
+namespace CPM_SPIRE_NS {
+
+/// Scene edit queued by any thread and applied on the render thread (see
+/// Interface::beginFrame). Plain data so the command queue never allocates:
+/// names are stored inline and uniform values by value. Only UPDATE_VBO
+/// carries heap data, which the command owns.
+struct SceneCommand
+{
+  enum Type
+  {
+    ADD_OBJECT,                 ///< object
+    REMOVE_OBJECT,              ///< object
+    UPDATE_VBO,                 ///< name, data, offset, size
+    SET_OBJECT_PASS_UNIFORM,    ///< object, pass, name, uniform
+    SET_OBJECT_GLOBAL_UNIFORM,  ///< object, name, uniform
+    SET_GLOBAL_UNIFORM,         ///< name, uniform
+  };
+
+  /// Size of the inline name buffers, including the terminating zero.
+  static const size_t NameSize = 64;
+
+  Type          type;
+  char          object[NameSize];
+  char          pass[NameSize];
+  char          name[NameSize];   ///< Uniform or VBO name.
+
+  UNIFORM_TYPE  uniformType;      ///< UNIFORM_FLOAT(_VEC2/3/4) or _MAT4.
+  float         values[16];
+
+  uint8_t*      data;             ///< Allocated with new[].
+  size_t        offset;
+  size_t        size;
+};
+
+/// Copies 'name' into one of the name buffers of a command. Throws
+/// std::invalid_argument if it does not fit.
+void setCommandName(char (&target)[SceneCommand::NameSize],
+                    const std::string& name);
+
+/// Number of floats making up a uniform of 'type', 0 if commands cannot carry
+/// uniforms of that type.
+size_t getCommandUniformSize(UNIFORM_TYPE type);
+
+/// Removes commands from 'commands' that would not change the result of
+/// applying the list in order, freeing their data:
+///  - uniform sets overwritten by a later set of the same uniform (same
+///    object, pass, name and type),
+///  - VBO updates whose byte range a later update of the same VBO covers,
+///  - an object added and removed again within the list, together with the
+///    commands targeting it in between. 'objectExists' tells whether an object
+///    exists before the list is applied; adds of existing objects (which fail)
+///    are never cancelled.
+/// The order of the remaining commands is preserved.
+/// \return Number of commands removed.
+size_t coalesceSceneCommands(
+    std::vector<SceneCommand>& commands,
+    const std::function<bool (const std::string&)>& objectExists);
+
+} // namespace CPM_SPIRE_NS
+
+#endif
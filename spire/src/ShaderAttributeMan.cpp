@@ -159,6 +159,31 @@ bool ShaderAttributeCollection::hasAttribute(const std::string& attribName) cons
   return false;
 }
 
+//------------------------------------------------------------------------------
+bool ShaderAttributeCollection::hasAttributeOfType(Interface::DATA_TYPES type) const
+{
+  for (auto it = mAttributes.begin(); it != mAttributes.end(); ++it)
+  {
+    if (it->type == type)
+      return true;
+  }
+
+  return false;
+}
+
+//------------------------------------------------------------------------------
+void ShaderAttributeCollection::narrowDoubleAttributes()
+{
+  for (auto it = mAttributes.begin(); it != mAttributes.end(); ++it)
+  {
+    if (it->type == Interface::TYPE_DOUBLE)
+    {
+      it->type = Interface::TYPE_FLOAT;
+      it->size = it->size / sizeof(double) * sizeof(float);
+    }
+  }
+}
+
 //------------------------------------------------------------------------------
 bool ShaderAttributeCollection::doesSatisfyShader(const ShaderAttributeCollection& compare) const
 {
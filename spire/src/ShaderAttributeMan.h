@@ -81,6 +81,13 @@ public:
   /// If 'attrib' is contained herein, returns true.
   bool hasAttribute(const std::string& attribName) const;
 
+  /// Returns true if any of the attributes has the given component type.
+  bool hasAttributeOfType(Interface::DATA_TYPES type) const;
+
+  /// Turns all TYPE_DOUBLE attributes into TYPE_FLOAT attributes with the
+  /// same number of components. Used when double data is narrowed on upload.
+  void narrowDoubleAttributes();
+
   /// Binds attributes to the shader indicated by parameter 'program'.
   void bindAttributes(std::shared_ptr<ShaderProgramAsset> program) const;
 
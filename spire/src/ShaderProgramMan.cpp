@@ -150,6 +150,10 @@ ShaderProgramAsset::ShaderProgramAsset(
       GL(glGetActiveAttrib(program, static_cast<GLuint>(i), maxAttribNameSize, &charsWritten,
                            &attribSize, &type, attributeName));
 
+      mAttributeLocations.push_back(
+          std::make_pair(std::string(attributeName),
+                         glGetAttribLocation(program, attributeName)));
+
       try
       {
         mAttributes.addAttribute(attributeName);
@@ -209,6 +213,17 @@ ShaderProgramAsset::~ShaderProgramAsset()
   }
 }
 
+//------------------------------------------------------------------------------
+GLint ShaderProgramAsset::getAttributeLocation(const std::string& codeName) const
+{
+  for (auto it = mAttributeLocations.begin(); it != mAttributeLocations.end(); ++it)
+  {
+    if (it->first == codeName)
+      return it->second;
+  }
+  return -1;
+}
+
 //------------------------------------------------------------------------------
 bool ShaderProgramAsset::areProgramSignaturesIdentical(
     const std::list<std::tuple<std::string, GLenum>>& shaders)
@@ -52,6 +52,10 @@ public:
   /// Shader attribute collection.
   const ShaderAttributeCollection& getAttributes() const  {return mAttributes;}
 
+  /// GL location of the active attribute 'codeName', queried at link time so
+  /// it can be read without a context. -1 if the attribute is not active.
+  GLint getAttributeLocation(const std::string& codeName) const;
+
   /// Shader uniform collection.
   const ShaderUniformCollection& getUniforms() const      {return *mUniforms;}
 
@@ -67,6 +71,7 @@ protected:
   Hub&                      mHub;             ///< Reference to render hub.
 
   ShaderAttributeCollection mAttributes;      ///< All program attributes.
+  std::vector<std::pair<std::string, GLint>> mAttributeLocations;
   std::unique_ptr<ShaderUniformCollection> mUniforms;
 
   ///< This list is used to verify that requested shader programs are not at
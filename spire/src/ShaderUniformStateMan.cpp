@@ -102,6 +102,16 @@ std::shared_ptr<const AbstractUniformStateItem> ShaderUniformStateMan::getGlobal
   }
 }
 
+//------------------------------------------------------------------------------
+const AbstractUniformStateItem*
+ShaderUniformStateMan::findGlobalUniform(const std::string& name) const
+{
+  auto it = mGlobalState.find(name);
+  if (it == mGlobalState.end())
+    return nullptr;
+  return it->second.get();
+}
+
 //------------------------------------------------------------------------------
 std::string ShaderUniformStateMan::uniformAsString(const std::string& name) const
 {
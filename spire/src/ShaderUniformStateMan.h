@@ -93,6 +93,11 @@ public:
   /// exist.
   std::shared_ptr<const AbstractUniformStateItem> getGlobalUniform(const std::string& name);
 
+  /// Returns the global uniform 'name' without taking a reference, or
+  /// nullptr. Safe to call from several threads as long as no uniforms are
+  /// updated.
+  const AbstractUniformStateItem* findGlobalUniform(const std::string& name) const;
+
 private:
 
   /// Contains all current global uniform state. I would use an ordered map,
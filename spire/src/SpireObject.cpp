@@ -29,12 +29,16 @@
 /// \author James Hughes
 /// \date   February 2013
 
+#include <algorithm>
+#include <stdexcept>
 #include <utility>
 
 #include "Common.h"
 #include "SpireObject.h"
 #include "Exceptions.h"
 #include "Hub.h"
+#include "InterfaceImplementation.h"
+#include "PassUniformStateMan.h"
 #include "ShaderUniformStateMan.h"
 
 namespace CPM_SPIRE_NS {
@@ -52,6 +56,8 @@ ObjectPass::ObjectPass(
     mPrimitiveType(primitiveType),
     mVBO(vbo),
     mIBO(ibo),
+    mObjectLoc(-1),
+    mProjIVObjectLoc(-1),
     mHub(hub)
 {
   // findProgram will throw an exception of type std::out_of_range if shader is
@@ -75,7 +81,14 @@ ObjectPass::ObjectPass(
         Interface::UnsatisfiedUniform(uniformData.uniform->codeName, 
                                       uniformData.glUniformLoc,
                                       uniformData.glType));
+
+    if (uniformData.uniform->codeName == "uObject")
+      mObjectLoc = uniformData.glUniformLoc;
+    else if (uniformData.uniform->codeName == "uProjIVObject")
+      mProjIVObjectLoc = uniformData.glUniformLoc;
   }
+
+  buildVertexLayout(*mVBO, mVertexLayout);
 }
 
 //------------------------------------------------------------------------------
@@ -84,7 +97,57 @@ ObjectPass::~ObjectPass()
 }
 
 //------------------------------------------------------------------------------
-void ObjectPass::renderPass()
+void ObjectPass::buildVertexLayout(const VBOObject& vbo,
+                                   std::vector<VertexAttribBinding>& layout) const
+{
+  // Same attributes as ShaderAttributeCollection::bindAttributes, resolved
+  // once for recordPass.
+  const ShaderAttributeCollection& attribs = vbo.getAttributeCollection();
+  GLsizei stride = static_cast<GLsizei>(attribs.calculateStride());
+  size_t offset = 0;
+  layout.clear();
+  for (size_t i = 0; i < attribs.getNumAttributes(); ++i)
+  {
+    AttribState attrib = attribs.getAttribute(i);
+    if (attrib.index != ShaderAttributeMan::getUnknownAttributeIndex()
+        && mShader->getAttributes().hasAttribute(attrib.codeName))
+    {
+      GLint location = mShader->getAttributeLocation(attrib.codeName);
+      if (location >= 0)
+      {
+        VertexAttribBinding binding;
+        binding.location = static_cast<GLuint>(location);
+        binding.numComponents = static_cast<GLint>(attrib.numComponents);
+        binding.type = InterfaceImplementation::getGLType(attrib.type);
+        binding.normalize = static_cast<GLboolean>(attrib.normalize);
+        binding.stride = stride;
+        binding.offset = offset;
+        layout.push_back(binding);
+      }
+    }
+    offset += attrib.size;
+  }
+}
+
+//------------------------------------------------------------------------------
+void ObjectPass::addLODLevel(std::shared_ptr<VBOObject> vbo,
+                             std::shared_ptr<IBOObject> ibo, float error)
+{
+  float last = mLODLevels.empty() ? 0.0f : mLODLevels.back().error;
+  if (!(error > last))
+    throw std::invalid_argument("LOD levels must have growing geometric errors.");
+
+  LODLevel level;
+  level.vbo = vbo;
+  level.ibo = ibo;
+  level.error = error;
+  if (vbo != nullptr)
+    buildVertexLayout(*vbo, level.vertexLayout);
+  mLODLevels.push_back(level);
+}
+
+//------------------------------------------------------------------------------
+void ObjectPass::renderPass(const ObjectTransformUniforms* transforms) const
 {
   GL(glUseProgram(mShader->getProgramID()));
 
@@ -114,6 +177,22 @@ void ObjectPass::renderPass()
   std::list<std::string> unsatisfiedGlobalUniforms;
   for (auto it = mUnsatisfiedUniforms.begin(); it != mUnsatisfiedUniforms.end(); ++it)
   {
+    if (transforms != nullptr && it->shaderLocation != -1)
+    {
+      if (it->shaderLocation == mObjectLoc)
+      {
+        GL(glUniformMatrix4fv(mObjectLoc, 1, GL_FALSE,
+                              glm::value_ptr(transforms->object)));
+        continue;
+      }
+      if (it->shaderLocation == mProjIVObjectLoc)
+      {
+        GL(glUniformMatrix4fv(mProjIVObjectLoc, 1, GL_FALSE,
+                              glm::value_ptr(transforms->projIVObject)));
+        continue;
+      }
+    }
+
     bool applied = mHub.getPassUniformStateMan().tryApplyUniform(mName, it->uniformName, it->shaderLocation);
     if (applied == false)
     {
@@ -129,7 +208,7 @@ void ObjectPass::renderPass()
   }
   
 
-  GL(glDrawElements(mPrimitiveType, static_cast<GLsizei>(mIBO->getNumElements()), mIBO->getType(), 0));
+  GL(glDrawElements(mPrimitiveType, static_cast<GLsizei>(mIBO->getNumDrawElements()), mIBO->getType(), 0));
 
   // We can do away with this once we switch to VAOs.
   attribs.unbindAttributes(mShader);
@@ -138,6 +217,67 @@ void ObjectPass::renderPass()
   //  mHub.getGPUStateManager().apply(priorGPUState);
 }
 
+//------------------------------------------------------------------------------
+void ObjectPass::recordPass(CommandList& list,
+                            const ObjectTransformUniforms* transforms,
+                            const DrawRanges* ranges, size_t lod) const
+{
+  const VBOObject* vbo = mVBO.get();
+  const IBOObject* ibo = mIBO.get();
+  const std::vector<VertexAttribBinding>* layout = &mVertexLayout;
+  if (lod > 0)
+  {
+    const LODLevel& level = mLODLevels[lod - 1];
+    ibo = level.ibo.get();
+    if (level.vbo != nullptr)
+    {
+      vbo = level.vbo.get();
+      layout = &level.vertexLayout;
+    }
+  }
+
+  list.bindProgram(mShader->getProgramID());
+  list.bindBuffers(vbo->getGLIndex(), ibo->getGLIndex(), *layout);
+
+  for (auto it = mUniforms.begin(); it != mUniforms.end(); ++it)
+    list.setUniform(it->shaderLocation, *it->item);
+
+  // Same search order as renderPass: derived transforms, pass global, then
+  // global uniforms.
+  for (auto it = mUnsatisfiedUniforms.begin(); it != mUnsatisfiedUniforms.end(); ++it)
+  {
+    if (transforms != nullptr && it->shaderLocation != -1)
+    {
+      if (it->shaderLocation == mObjectLoc)
+      {
+        list.setUniformMatrix4(mObjectLoc, glm::value_ptr(transforms->object));
+        continue;
+      }
+      if (it->shaderLocation == mProjIVObjectLoc)
+      {
+        list.setUniformMatrix4(mProjIVObjectLoc,
+                               glm::value_ptr(transforms->projIVObject));
+        continue;
+      }
+    }
+
+    const AbstractUniformStateItem* item =
+        mHub.getPassUniformStateMan().findPassUniform(mName, it->uniformName);
+    if (item == nullptr)
+      item = mHub.getGlobalUniformStateMan().findGlobalUniform(it->uniformName);
+    if (item == nullptr)
+      throw ShaderUniformNotFound("Could not initialize uniform: " + it->uniformName);
+
+    list.setUniform(it->shaderLocation, *item);
+  }
+
+  if (ranges != nullptr)
+    list.drawRanges(mPrimitiveType, ibo->getType(), ranges);
+  else
+    list.draw(mPrimitiveType, static_cast<GLsizei>(ibo->getNumDrawElements()),
+              ibo->getType());
+}
+
 //------------------------------------------------------------------------------
 bool ObjectPass::addPassUniform(const std::string& uniformName,
                                 std::shared_ptr<AbstractUniformStateItem> item,
@@ -281,10 +421,48 @@ std::vector<Interface::UnsatisfiedUniform> ObjectPass::getUnsatisfiedUniforms()
 //------------------------------------------------------------------------------
 SpireObject::SpireObject(Hub& hub, const std::string& name) :
     mName(name),
+    mTransform(1.0f),
+    mBoundingSphere(0.0f, 0.0f, 0.0f, -1.0f),
+    mBoundsSet(false),
+    mOccluder(false),
     mHub(hub)
 {
 }
 
+//------------------------------------------------------------------------------
+std::shared_ptr<SpireObject> SpireObject::clone() const
+{
+  std::shared_ptr<SpireObject> copy(new SpireObject(*this));
+
+  // Subpasses are also listed at the top level; keep them shared between the
+  // two lists in the copy.
+  std::unordered_map<const ObjectPass*, std::shared_ptr<ObjectPass>> copies;
+  auto copyPass = [&copies](const std::shared_ptr<ObjectPass>& pass)
+      -> std::shared_ptr<ObjectPass>
+  {
+    if (pass == nullptr)
+      return pass;
+    std::shared_ptr<ObjectPass>& passCopy = copies[pass.get()];
+    if (passCopy == nullptr)
+      passCopy = std::make_shared<ObjectPass>(*pass);
+    return passCopy;
+  };
+
+  for (auto it = copy->mPasses.begin(); it != copy->mPasses.end(); ++it)
+  {
+    it->second.objectPass = copyPass(it->second.objectPass);
+    if (it->second.objectSubPasses != nullptr)
+    {
+      std::shared_ptr<std::vector<std::shared_ptr<ObjectPass>>> subPasses(
+          new std::vector<std::shared_ptr<ObjectPass>>);
+      for (auto sub = it->second.objectSubPasses->begin();
+           sub != it->second.objectSubPasses->end(); ++sub)
+        subPasses->push_back(copyPass(*sub));
+      it->second.objectSubPasses = subPasses;
+    }
+  }
+  return copy;
+}
 
 //------------------------------------------------------------------------------
 void SpireObject::addPass(
@@ -362,6 +540,8 @@ void SpireObject::addPass(
   {
     pass->addPassUniform(it->uniformName, it->item, true);
   }
+
+  updateBoundsFromPasses();
 }
 
 //------------------------------------------------------------------------------
@@ -378,6 +558,77 @@ void SpireObject::removePass(const std::string& passName)
   std::shared_ptr<ObjectPass> pass = getPassByName(passName);
 
   mPasses.erase(passName);
+  updateBoundsFromPasses();
+}
+
+//------------------------------------------------------------------------------
+void SpireObject::addPassLOD(const std::string& passName,
+                             std::shared_ptr<VBOObject> vbo,
+                             std::shared_ptr<IBOObject> ibo, float error)
+{
+  getPassByName(passName)->addLODLevel(vbo, ibo, error);
+}
+
+//------------------------------------------------------------------------------
+void SpireObject::setBoundingBox(const V3& min, const V3& max)
+{
+  mBoundsMin = min;
+  mBoundsMax = max;
+  mBoundingSphere = V4((min + max) * 0.5f, glm::length(max - min) * 0.5f);
+  mBoundsSet = true;
+}
+
+//------------------------------------------------------------------------------
+void SpireObject::setBoundingSphere(const V3& center, float radius)
+{
+  mBoundsMin = center - V3(radius, radius, radius);
+  mBoundsMax = center + V3(radius, radius, radius);
+  mBoundingSphere = V4(center, radius);
+  mBoundsSet = true;
+}
+
+//------------------------------------------------------------------------------
+void SpireObject::updateBoundsFromPasses()
+{
+  if (mBoundsSet)
+    return;
+
+  // Subpasses are listed at the top level too.
+  std::vector<const VBOObject*> vbos;
+  for (auto it = mPasses.begin(); it != mPasses.end(); ++it)
+  {
+    if (it->second.objectPass != nullptr)
+      vbos.push_back(it->second.objectPass->getVBO().get());
+  }
+
+  mBoundingSphere = V4(0.0f, 0.0f, 0.0f, -1.0f);
+  if (vbos.empty())
+    return;
+  for (auto it = vbos.begin(); it != vbos.end(); ++it)
+  {
+    if (!(*it)->hasBounds())
+      return;
+  }
+
+  mBoundsMin = vbos[0]->getBoundsMin();
+  mBoundsMax = vbos[0]->getBoundsMax();
+  for (auto it = vbos.begin() + 1; it != vbos.end(); ++it)
+  {
+    mBoundsMin = glm::min(mBoundsMin, (*it)->getBoundsMin());
+    mBoundsMax = glm::max(mBoundsMax, (*it)->getBoundsMax());
+  }
+
+  // The smaller of the sphere around the box and the union of the spheres.
+  V3 center = (mBoundsMin + mBoundsMax) * 0.5f;
+  float radius = glm::length(mBoundsMax - mBoundsMin) * 0.5f;
+  float unionRadius = 0.0f;
+  for (auto it = vbos.begin(); it != vbos.end(); ++it)
+  {
+    const V4& sphere = (*it)->getBoundingSphere();
+    unionRadius = std::max(unionRadius,
+                           glm::length(V3(sphere) - center) + sphere.w);
+  }
+  mBoundingSphere = V4(center, std::min(radius, unionRadius));
 }
 
 //------------------------------------------------------------------------------
@@ -400,7 +651,7 @@ void SpireObject::addPassUniform(const std::string& passName,
 
 //------------------------------------------------------------------------------
 std::vector<Interface::UnsatisfiedUniform>
-SpireObject::getUnsatisfiedUniforms(const std::string& passName)
+SpireObject::getUnsatisfiedUniforms(const std::string& passName) const
 {
   std::shared_ptr<ObjectPass> pass = getPassByName(passName);
   return pass->getUnsatisfiedUniforms();
@@ -409,7 +660,7 @@ SpireObject::getUnsatisfiedUniforms(const std::string& passName)
 //------------------------------------------------------------------------------
 std::shared_ptr<const AbstractUniformStateItem>
 SpireObject::getPassUniform(const std::string& passName,
-                            const std::string& uniformName)
+                            const std::string& uniformName) const
 {
   // We are going to have a facility similar to UniformStateMan, but we are
   // going to use a more cache-coherent vector. It's unlikely that we ever need
@@ -454,7 +705,7 @@ void SpireObject::addGlobalUniform(const std::string& uniformName,
 
 //------------------------------------------------------------------------------
 std::shared_ptr<const AbstractUniformStateItem>
-SpireObject::getGlobalUniform(const std::string& uniformName)
+SpireObject::getGlobalUniform(const std::string& uniformName) const
 {
   for (auto it = mObjectGlobalUniforms.begin(); it != mObjectGlobalUniforms.end(); ++it)
   {
@@ -499,9 +750,13 @@ bool SpireObject::hasGlobalUniform(const std::string& uniformName) const
 }
 
 //------------------------------------------------------------------------------
-void SpireObject::renderPass(const std::string& passName)
+void SpireObject::renderPass(const std::string& passName) const
 {
-  ObjectPassInternal& internalObjectPass = mPasses[passName];
+  auto found = mPasses.find(passName);
+  if (found == mPasses.end())
+    return;
+
+  const ObjectPassInternal& internalObjectPass = found->second;
   std::shared_ptr<ObjectPass> pass = internalObjectPass.objectPass;
 
   // Render the pass
@@ -519,5 +774,38 @@ void SpireObject::renderPass(const std::string& passName)
   }
 }
 
+//------------------------------------------------------------------------------
+void SpireObject::getRenderPasses(const std::string& passName,
+                                  std::vector<const ObjectPass*>& passes) const
+{
+  auto found = mPasses.find(passName);
+  if (found == mPasses.end())
+    return;
+
+  const ObjectPassInternal& internalObjectPass = found->second;
+  if (internalObjectPass.objectPass != nullptr)
+    passes.push_back(internalObjectPass.objectPass.get());
+
+  if (internalObjectPass.objectSubPasses != nullptr)
+  {
+    for (auto it = internalObjectPass.objectSubPasses->begin(); 
+         it != internalObjectPass.objectSubPasses->end(); ++it)
+    {
+      passes.push_back(it->get());
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+void SpireObject::getPasses(std::vector<const ObjectPass*>& passes) const
+{
+  // Subpasses are listed at the top level too.
+  for (auto it = mPasses.begin(); it != mPasses.end(); ++it)
+  {
+    if (it->second.objectPass != nullptr)
+      passes.push_back(it->second.objectPass.get());
+  }
+}
+
 } // namespace CPM_SPIRE_NS
 
@@ -37,6 +37,7 @@
 #include <map>
 
 #include "Common.h"
+#include "CommandList.h"
 #include "ShaderProgramMan.h"
 #include "ShaderUniformStateManTemplates.h"
 
@@ -45,6 +46,14 @@
 
 namespace CPM_SPIRE_NS {
 
+/// Values of uObject and uProjIVObject for one draw, computed by frame
+/// preparation (see FramePrep.h) from the object's transform.
+struct ObjectTransformUniforms
+{
+  M44 object;         ///< Object -> world.
+  M44 projIVObject;   ///< Projection * inverse view * object.
+};
+
 //------------------------------------------------------------------------------
 // ObjectPassobject
 //------------------------------------------------------------------------------
@@ -59,10 +68,52 @@ public:
       std::shared_ptr<VBOObject> vbo, std::shared_ptr<IBOObject> ibo, GLenum primitiveType);
   virtual ~ObjectPass();
   
-  void renderPass();
+  /// Renders the pass. If 'transforms' is given, its values take the place
+  /// of the global uObject and uProjIVObject uniforms. Uniforms set on the
+  /// pass or object still take precedence.
+  void renderPass(const ObjectTransformUniforms* transforms = nullptr) const;
+
+  /// Records what renderPass would do into 'list' without calling OpenGL.
+  /// Safe to call from several threads as long as the uniform state is not
+  /// changed meanwhile. If 'ranges' is given, only those parts of the IBO
+  /// are drawn. 'lod' picks the level of detail (see addLODLevel), 0 being
+  /// the pass's own buffers.
+  /// throws ShaderUniformNotFound if a uniform cannot be satisfied.
+  void recordPass(CommandList& list,
+                  const ObjectTransformUniforms* transforms = nullptr,
+                  const DrawRanges* ranges = nullptr,
+                  size_t lod = 0) const;
 
   const std::string& getName() const    {return mName;}
   GLenum getPrimitiveType() const       {return mPrimitiveType;}
+  GLuint getProgramID() const           {return mShader->getProgramID();}
+  const std::shared_ptr<VBOObject>& getVBO() const  {return mVBO;}
+  const std::shared_ptr<IBOObject>& getIBO() const  {return mIBO;}
+
+  /// Appends a coarser level of detail: 'ibo', drawn with 'vbo' or, if it
+  /// is null, with the VBO of the pass. 'error' is the geometric error of
+  /// the level in object space: how far its surface strays from the full
+  /// detail one. It must grow from level to level.
+  /// throws std::invalid_argument if 'error' is not above the last level's.
+  void addLODLevel(std::shared_ptr<VBOObject> vbo, std::shared_ptr<IBOObject> ibo,
+                   float error);
+
+  /// Number of levels added by addLODLevel.
+  size_t getNumLODLevels() const        {return mLODLevels.size();}
+
+  /// IBO of level 'lod', 0 being the pass's own.
+  const IBOObject& getLODIBO(size_t lod) const
+  {return lod == 0 ? *mIBO : *mLODLevels[lod - 1].ibo;}
+
+  /// Coarsest level whose geometric error is at most 'maxError' (object
+  /// space), 0 if none is.
+  size_t selectLOD(float maxError) const
+  {
+    size_t lod = mLODLevels.size();
+    while (lod > 0 && !(mLODLevels[lod - 1].error <= maxError))
+      --lod;
+    return lod;
+  }
 
   /// Adds a local uniform to the pass.
   /// throws std::out_of_range if 'uniformName' is not found in the shader's
@@ -89,6 +140,19 @@ public:
 
 protected:
 
+  /// Coarser level of detail of the pass.
+  struct LODLevel
+  {
+    std::shared_ptr<VBOObject>        vbo;            ///< Null for the pass's.
+    std::shared_ptr<IBOObject>        ibo;
+    std::vector<VertexAttribBinding>  vertexLayout;   ///< Of 'vbo'.
+    float                             error;
+  };
+
+  /// VBO attributes of 'vbo' used by the shader.
+  void buildVertexLayout(const VBOObject& vbo,
+                         std::vector<VertexAttribBinding>& layout) const;
+
   struct UniformItem
   {
     UniformItem(const std::string& name,
@@ -122,6 +186,10 @@ protected:
   std::shared_ptr<IBOObject>            mIBO;     ///< ID of IBO to use during pass.
 
   std::shared_ptr<ShaderProgramAsset>   mShader;  ///< Shader to be used when rendering this pass.
+  GLint                                 mObjectLoc;       ///< uObject, or -1.
+  GLint                                 mProjIVObjectLoc; ///< uProjIVObject, or -1.
+  std::vector<VertexAttribBinding>      mVertexLayout;    ///< VBO attributes used by the shader.
+  std::vector<LODLevel>                 mLODLevels;       ///< Coarser levels, finest first.
 
   Hub&                                  mHub;     ///< Hub.
 
@@ -138,6 +206,10 @@ public:
 
   std::string getName() const     {return mName;}
 
+  /// Copies the object. Passes are copied too, uniform values and buffers
+  /// are shared (they are replaced, never modified).
+  std::shared_ptr<SpireObject> clone() const;
+
   /// Adds a geometry pass with the specified index / vertex buffer objects.
   void addPass(const std::string& pass,
                const std::string& program,
@@ -153,6 +225,11 @@ public:
   /// Removes a geometry pass from the object.
   void removePass(const std::string& pass);
 
+  /// Appends a level of detail to the pass 'pass'; see
+  /// ObjectPass::addLODLevel.
+  void addPassLOD(const std::string& pass, std::shared_ptr<VBOObject> vbo,
+                  std::shared_ptr<IBOObject> ibo, float error);
+
   // The precedence for uniforms goes: pass -> uniform -> global.
   // So pass is checked first, then the uniform level of uniforms, then the
   // global level of uniforms.
@@ -168,15 +245,47 @@ public:
                         std::shared_ptr<AbstractUniformStateItem> item);
 
   std::shared_ptr<const AbstractUniformStateItem>
-      getPassUniform(const std::string& passName, const std::string& uniformName);
+      getPassUniform(const std::string& passName, const std::string& uniformName) const;
 
   std::shared_ptr<const AbstractUniformStateItem>
-      getGlobalUniform(const std::string& uniformName);
+      getGlobalUniform(const std::string& uniformName) const;
 
   bool hasPassRenderingOrder(const std::vector<std::string>& passes) const;
 
   /// \todo Ability to render a single named pass. See github issue #15.
-  void renderPass(const std::string& pass);
+  /// Does not modify the object; the front copy of the scene is rendered
+  /// while the back copy is edited.
+  void renderPass(const std::string& pass) const;
+
+  /// Appends the passes renderPass would draw for 'pass' (the pass itself,
+  /// then its subpasses) to 'passes'. Appends nothing if there is no such
+  /// pass.
+  void getRenderPasses(const std::string& pass,
+                       std::vector<const ObjectPass*>& passes) const;
+
+  /// Object -> world transform, identity by default. Frame preparation
+  /// derives uObject and uProjIVObject from it.
+  void setTransform(const M44& transform)   {mTransform = transform;}
+  const M44& getTransform() const           {return mTransform;}
+
+  /// Object space bounds, used for culling. Unless set here, they are the
+  /// union of the bounds of the VBOs of the passes (see VBOObject), and the
+  /// object has no bounds if one of the VBOs has none. Objects without
+  /// bounds are never culled.
+  void setBoundingBox(const V3& min, const V3& max);
+
+  /// Same as above, with the box around the sphere.
+  void setBoundingSphere(const V3& center, float radius);
+
+  /// Occluders are preferred when frame preparation picks the objects to
+  /// rasterize for software occlusion culling. False by default.
+  void setOccluder(bool occluder)           {mOccluder = occluder;}
+  bool isOccluder() const                   {return mOccluder;}
+
+  bool hasBounds() const                    {return mBoundingSphere.w >= 0.0f;}
+  const V3& getBoundsMin() const            {return mBoundsMin;}
+  const V3& getBoundsMax() const            {return mBoundsMax;}
+  const V4& getBoundingSphere() const       {return mBoundingSphere;}
 
   /// Returns the associated pass. Otherwise an empty shared_ptr is returned.
   std::shared_ptr<const ObjectPass> getObjectPassParams(const std::string& passName) const;
@@ -184,12 +293,15 @@ public:
   /// Returns the number of registered passes.
   size_t getNumPasses() const {return mPasses.size();}
 
+  /// Appends all passes, subpasses included, to 'passes'.
+  void getPasses(std::vector<const ObjectPass*>& passes) const;
+
   /// Returns true if there exists a object global uniform with the name
   /// 'uniformName'.
   bool hasGlobalUniform(const std::string& uniformName) const;
 
   /// Get unsatisfied uniforms for pass.
-  std::vector<Interface::UnsatisfiedUniform> getUnsatisfiedUniforms(const std::string& pass);
+  std::vector<Interface::UnsatisfiedUniform> getUnsatisfiedUniforms(const std::string& pass) const;
 
 protected:
 
@@ -225,6 +337,9 @@ protected:
   /// Retrieves the pass by name.
   std::shared_ptr<ObjectPass> getPassByName(const std::string& name) const;
 
+  /// Recomputes the bounds from the VBOs, unless they were set explicitly.
+  void updateBoundsFromPasses();
+
   /// All registered passes.
   std::unordered_map<std::string, ObjectPassInternal>   mPasses;
   std::vector<ObjectGlobalUniformItem>                  mObjectGlobalUniforms;
@@ -235,6 +350,12 @@ protected:
   // size_t represents a std::hash of a string.
   std::hash<std::string>                        mHashFun;
   std::string                                   mName;
+  M44                                           mTransform;
+  V3                                            mBoundsMin;
+  V3                                            mBoundsMax;
+  V4                                            mBoundingSphere;  ///< Center, radius.
+  bool                                          mBoundsSet;       ///< Not derived from the VBOs.
+  bool                                          mOccluder;
 
   Hub&                                          mHub;
 };
@@ -0,0 +1,228 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <algorithm>
+
+#include "ThreadPool.h"
+
+namespace CPM_SPIRE_NS {
+
+namespace {
+
+std::mutex                  sharedPoolMutex;
+std::shared_ptr<ThreadPool> sharedPool;
+size_t                      sharedNumThreads = 0;
+
+/// Pools replaced by setSharedNumThreads that were still referenced.
+std::vector<std::shared_ptr<ThreadPool>> retiredPools;
+
+} // namespace
+
+//------------------------------------------------------------------------------
+ThreadPool::ThreadPool(size_t numThreads) :
+    mNumQueued(0),
+    mNextWorker(0),
+    mStop(false)
+{
+  if (numThreads == 0)
+    numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+  for (size_t i = 0; i < numThreads; ++i)
+    mWorkers.push_back(std::unique_ptr<Worker>(new Worker));
+
+  // No task can be submitted before the constructor returns, so the ids are
+  // in place before findWorker can be called.
+  for (size_t i = 0; i < numThreads; ++i)
+  {
+    mWorkers[i]->thread = std::thread(&ThreadPool::workerMain, this, i);
+    mWorkers[i]->id = mWorkers[i]->thread.get_id();
+  }
+}
+
+//------------------------------------------------------------------------------
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mSleepMutex);
+    mStop = true;
+  }
+  mWake.notify_all();
+
+  for (auto it = mWorkers.begin(); it != mWorkers.end(); ++it)
+    (*it)->thread.join();
+}
+
+//------------------------------------------------------------------------------
+void ThreadPool::submit(Task task)
+{
+  size_t target = findWorker();
+  if (target == mWorkers.size())
+    target = mNextWorker++ % mWorkers.size();
+
+  {
+    std::lock_guard<std::mutex> lock(mWorkers[target]->mutex);
+    mWorkers[target]->tasks.push_back(std::move(task));
+  }
+  ++mNumQueued;
+
+  // Taking the lock orders the increment with a worker that is about to
+  // check mNumQueued and go to sleep.
+  {
+    std::lock_guard<std::mutex> lock(mSleepMutex);
+  }
+  mWake.notify_one();
+}
+
+//------------------------------------------------------------------------------
+bool ThreadPool::runPendingTask()
+{
+  Task task;
+  if (!takeTask(findWorker(), task))
+    return false;
+
+  try
+  {
+    task();
+  }
+  catch (...)
+  {
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+size_t ThreadPool::findWorker() const
+{
+  std::thread::id self = std::this_thread::get_id();
+  for (size_t i = 0; i < mWorkers.size(); ++i)
+  {
+    if (mWorkers[i]->id == self)
+      return i;
+  }
+  return mWorkers.size();
+}
+
+//------------------------------------------------------------------------------
+bool ThreadPool::takeTask(size_t self, Task& task)
+{
+  if (mNumQueued == 0)
+    return false;
+
+  size_t numWorkers = mWorkers.size();
+  if (self < numWorkers)
+  {
+    Worker& own = *mWorkers[self];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (!own.tasks.empty())
+    {
+      task = std::move(own.tasks.back());
+      own.tasks.pop_back();
+      --mNumQueued;
+      return true;
+    }
+  }
+
+  size_t start = (self < numWorkers) ? self + 1 : 0;
+  for (size_t i = 0; i < numWorkers; ++i)
+  {
+    Worker& victim = *mWorkers[(start + i) % numWorkers];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tasks.empty())
+    {
+      task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      --mNumQueued;
+      return true;
+    }
+  }
+  return false;
+}
+
+//------------------------------------------------------------------------------
+void ThreadPool::workerMain(size_t index)
+{
+  for (;;)
+  {
+    Task task;
+    if (takeTask(index, task))
+    {
+      try
+      {
+        task();
+      }
+      catch (...)
+      {
+      }
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(mSleepMutex);
+    if (mStop && mNumQueued == 0)
+      return;
+    mWake.wait(lock, [this]() { return mStop || mNumQueued > 0; });
+  }
+}
+
+//------------------------------------------------------------------------------
+std::shared_ptr<ThreadPool> ThreadPool::getShared()
+{
+  std::lock_guard<std::mutex> lock(sharedPoolMutex);
+  if (!sharedPool)
+    sharedPool = std::make_shared<ThreadPool>(sharedNumThreads);
+  return sharedPool;
+}
+
+//------------------------------------------------------------------------------
+void ThreadPool::setSharedNumThreads(size_t numThreads)
+{
+  std::vector<std::shared_ptr<ThreadPool>> unused;
+  {
+    std::lock_guard<std::mutex> lock(sharedPoolMutex);
+    sharedNumThreads = numThreads;
+
+    // A pool still in use elsewhere (parallelFor on another thread) could
+    // otherwise end up being destroyed from one of its own workers. Keep it
+    // around until a later call finds it unused.
+    if (sharedPool)
+      retiredPools.push_back(sharedPool);
+    sharedPool.reset();
+
+    auto firstUnused = std::partition(
+        retiredPools.begin(), retiredPools.end(),
+        [](const std::shared_ptr<ThreadPool>& pool)
+        { return pool.use_count() > 1; });
+    unused.assign(firstUnused, retiredPools.end());
+    retiredPools.erase(firstUnused, retiredPools.end());
+  }
+
+  // Queued tasks may use the shared pool themselves, so the unused pools
+  // are drained and joined outside of the lock.
+  unused.clear();
+}
+
+} // namespace CPM_SPIRE_NS
@@ -0,0 +1,131 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+/// \brief  Work stealing thread pool shared by the asset processing code and
+///         the asynchronous loaders. Does not touch OpenGL.
+
+#ifndef SPIRE_HIGH_THREADPOOL_H
+#define SPIRE_HIGH_THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace CPM_SPIRE_NS {
+
+/// Fixed size pool of worker threads. Every worker owns a task deque: tasks
+/// submitted from a worker go to the back of its own deque and are popped
+/// from there (most recent first), idle workers steal from the front of the
+/// other deques. Tasks submitted from outside the pool are spread over the
+/// deques round robin. Threads that wait on pool work should call
+/// runPendingTask instead of blocking so nested parallelism cannot deadlock.
+class ThreadPool
+{
+public:
+  typedef std::function<void ()> Task;
+
+  /// Starts 'numThreads' workers; 0 starts one per core.
+  explicit ThreadPool(size_t numThreads = 0);
+
+  /// Finishes every queued task, then joins the workers.
+  ~ThreadPool();
+
+  /// Number of worker threads (not counting threads that help out through
+  /// runPendingTask).
+  size_t getNumThreads() const    {return mWorkers.size();}
+
+  /// Queues 'task'. Exceptions escaping the task are discarded, use async
+  /// to observe them.
+  void submit(Task task);
+
+  /// Queues 'fn' and returns a future for its result (or exception).
+  template <typename F>
+  std::future<typename std::result_of<F()>::type> async(F fn)
+  {
+    typedef typename std::result_of<F()>::type Result;
+    std::shared_ptr<std::packaged_task<Result ()>> task =
+        std::make_shared<std::packaged_task<Result ()>>(std::move(fn));
+    std::future<Result> result = task->get_future();
+    submit([task]() { (*task)(); });
+    return result;
+  }
+
+  /// Runs one queued task on the calling thread. Workers take from their own
+  /// deque first, other threads steal.
+  /// \return False if there was nothing to run.
+  bool runPendingTask();
+
+  /// Pool used by parallelFor and the asynchronous asset loaders. Created
+  /// on first use with one worker per core unless setSharedNumThreads was
+  /// called before.
+  static std::shared_ptr<ThreadPool> getShared();
+
+  /// Replaces the shared pool with one of 'numThreads' workers (0 is one per
+  /// core), e.g. to leave cores to an application scheduler. Work already
+  /// queued finishes on the previous pool. Must not be called from a pool
+  /// task.
+  static void setSharedNumThreads(size_t numThreads);
+
+private:
+  struct Worker
+  {
+    std::mutex        mutex;
+    std::deque<Task>  tasks;
+    std::thread       thread;
+    std::thread::id   id;
+  };
+
+  /// Index of the calling thread's worker, or getNumThreads() if the calling
+  /// thread does not belong to this pool.
+  size_t findWorker() const;
+
+  /// Pops from worker 'self' (if it is one) and then steals from the others.
+  bool takeTask(size_t self, Task& task);
+
+  void workerMain(size_t index);
+
+  std::vector<std::unique_ptr<Worker>>  mWorkers;
+  std::atomic<size_t>                   mNumQueued;   ///< Tasks in all deques.
+  std::atomic<size_t>                   mNextWorker;  ///< Round robin target.
+
+  std::mutex                            mSleepMutex;
+  std::condition_variable               mWake;
+  bool                                  mStop;        ///< Guarded by mSleepMutex.
+};
+
+} // namespace CPM_SPIRE_NS
+
+#endif
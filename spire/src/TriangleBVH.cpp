@@ -0,0 +1,531 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <algorithm>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#include "Parallel.h"
+#include "TriangleBVH.h"
+
+namespace CPM_SPIRE_NS {
+
+const size_t TriangleBVH::TrianglesPerLeaf;
+const size_t TriangleBVH::ParallelBuildSize;
+const int32_t TriangleBVH::Null;
+
+namespace {
+
+/// Bins of the SAH splits.
+const size_t NumBins = 16;
+
+/// Groups filled per task after the build.
+const size_t GroupsPerTask = 4096;
+
+//------------------------------------------------------------------------------
+float surfaceArea(const V3& min, const V3& max)
+{
+  V3 d = max - min;
+  return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+//------------------------------------------------------------------------------
+/// Slab test against [0, 'maxDistance'], see SceneBVH.
+bool intersectBox(const V3& origin, const V3& inverse, float maxDistance,
+                  const V3& min, const V3& max)
+{
+  float near = 0.0f;
+  float far = maxDistance;
+  for (int axis = 0; axis < 3; ++axis)
+  {
+    float t0 = (min[axis] - origin[axis]) * inverse[axis];
+    float t1 = (max[axis] - origin[axis]) * inverse[axis];
+    if (t0 > t1)
+      std::swap(t0, t1);
+    near = t0 > near ? t0 : near;
+    far = t1 < far ? t1 : far;
+  }
+  return near <= far;
+}
+
+} // namespace
+
+//------------------------------------------------------------------------------
+size_t TriangleBVH::getNumTriangles(size_t numIndices, GLenum primitive)
+{
+  switch (primitive)
+  {
+    case GL_TRIANGLES:
+      return numIndices / 3;
+
+    case GL_TRIANGLE_STRIP:
+    case GL_TRIANGLE_FAN:
+      return numIndices < 3 ? 0 : numIndices - 2;
+
+    default:
+      return 0;
+  }
+}
+
+//------------------------------------------------------------------------------
+void TriangleBVH::getTriangle(const uint32_t* indices, GLenum primitive,
+                              size_t triangle, uint32_t vertices[3])
+{
+  switch (primitive)
+  {
+    case GL_TRIANGLE_STRIP:
+      vertices[0] = indices[triangle + (triangle & 1)];
+      vertices[1] = indices[triangle + 1 - (triangle & 1)];
+      vertices[2] = indices[triangle + 2];
+      break;
+
+    case GL_TRIANGLE_FAN:
+      vertices[0] = indices[0];
+      vertices[1] = indices[triangle + 1];
+      vertices[2] = indices[triangle + 2];
+      break;
+
+    default:
+      vertices[0] = indices[3 * triangle];
+      vertices[1] = indices[3 * triangle + 1];
+      vertices[2] = indices[3 * triangle + 2];
+      break;
+  }
+}
+
+//------------------------------------------------------------------------------
+bool TriangleBVH::intersectTriangle(const V3& origin, const V3& direction,
+                                    const V3& v0, const V3& v1, const V3& v2,
+                                    float& distance, float& u, float& v)
+{
+  V3 e1 = v1 - v0;
+  V3 e2 = v2 - v0;
+  V3 p = glm::cross(direction, e2);
+  float det = glm::dot(e1, p);
+  if (det == 0.0f)
+    return false;
+
+  float inverse = 1.0f / det;
+  V3 t = origin - v0;
+  V3 q = glm::cross(t, e1);
+  float hitU = glm::dot(t, p) * inverse;
+  float hitV = glm::dot(direction, q) * inverse;
+  float hitDistance = glm::dot(e2, q) * inverse;
+  if (   hitU >= 0.0f && hitV >= 0.0f && hitU + hitV <= 1.0f
+      && hitDistance >= 0.0f && hitDistance < distance)
+  {
+    distance = hitDistance;
+    u = hitU;
+    v = hitV;
+    return true;
+  }
+  return false;
+}
+
+//------------------------------------------------------------------------------
+bool TriangleBVH::intersectMesh(const std::vector<V3>& positions,
+                                const std::vector<uint32_t>& indices,
+                                GLenum primitive, const V3& origin,
+                                const V3& direction, float maxDistance,
+                                TriangleHit& hit)
+{
+  float distance = maxDistance;
+  float u = 0.0f;
+  float v = 0.0f;
+  bool found = false;
+  size_t numTriangles = getNumTriangles(indices.size(), primitive);
+  for (size_t t = 0; t < numTriangles; ++t)
+  {
+    uint32_t corners[3];
+    getTriangle(&indices[0], primitive, t, corners);
+    if (   corners[0] == corners[1] || corners[1] == corners[2]
+        || corners[0] == corners[2] || corners[0] >= positions.size()
+        || corners[1] >= positions.size() || corners[2] >= positions.size())
+      continue;
+
+    if (intersectTriangle(origin, direction, positions[corners[0]],
+                          positions[corners[1]], positions[corners[2]],
+                          distance, u, v))
+    {
+      hit.triangle = t;
+      std::copy(corners, corners + 3, hit.vertices);
+      found = true;
+    }
+  }
+  if (!found)
+    return false;
+
+  hit.barycentric = V3(1.0f - u - v, u, v);
+  hit.distance = distance;
+  return true;
+}
+
+//------------------------------------------------------------------------------
+TriangleBVH::TriangleBVH(const std::vector<V3>& positions,
+                         std::shared_ptr<const std::vector<uint32_t>> indices,
+                         GLenum primitive) :
+    mIndices(indices),
+    mPrimitive(primitive),
+    mNumTriangles(getNumTriangles(indices->size(), primitive))
+{
+  std::vector<BuildRef> refs;
+  refs.reserve(mNumTriangles);
+  for (size_t t = 0; t < mNumTriangles; ++t)
+  {
+    uint32_t corners[3];
+    getTriangle(&(*indices)[0], primitive, t, corners);
+    if (   corners[0] == corners[1] || corners[1] == corners[2]
+        || corners[0] == corners[2] || corners[0] >= positions.size()
+        || corners[1] >= positions.size() || corners[2] >= positions.size())
+      continue;
+
+    BuildRef ref;
+    ref.min = glm::min(glm::min(positions[corners[0]], positions[corners[1]]),
+                       positions[corners[2]]);
+    ref.max = glm::max(glm::max(positions[corners[0]], positions[corners[1]]),
+                       positions[corners[2]]);
+    ref.triangle = static_cast<uint32_t>(t);
+    refs.push_back(ref);
+  }
+  if (refs.empty())
+    return;
+
+  size_t numGroups = (refs.size() + TrianglesPerLeaf - 1) / TrianglesPerLeaf;
+  mNodes.resize(2 * numGroups - 1);
+  buildNode(refs, 0, refs.size(), 0);
+
+  // Leaves were assigned the groups in the order of 'refs'.
+  mGroups.resize(numGroups);
+  parallelFor((numGroups + GroupsPerTask - 1) / GroupsPerTask, [&](size_t task)
+  {
+    size_t end = std::min(numGroups, (task + 1) * GroupsPerTask);
+    for (size_t g = task * GroupsPerTask; g < end; ++g)
+    {
+      TriangleGroup& group = mGroups[g];
+      for (size_t lane = 0; lane < TrianglesPerLeaf; ++lane)
+      {
+        size_t r = g * TrianglesPerLeaf + lane;
+        V3 v0(0.0f, 0.0f, 0.0f);
+        V3 e1(0.0f, 0.0f, 0.0f);
+        V3 e2(0.0f, 0.0f, 0.0f);
+        group.triangles[lane] = std::numeric_limits<uint32_t>::max();
+        if (r < refs.size())
+        {
+          uint32_t corners[3];
+          getTriangle(&(*mIndices)[0], mPrimitive, refs[r].triangle, corners);
+          v0 = positions[corners[0]];
+          e1 = positions[corners[1]] - v0;
+          e2 = positions[corners[2]] - v0;
+          group.triangles[lane] = refs[r].triangle;
+        }
+        for (int axis = 0; axis < 3; ++axis)
+        {
+          group.v0[axis][lane] = v0[axis];
+          group.e1[axis][lane] = e1[axis];
+          group.e2[axis][lane] = e2[axis];
+        }
+      }
+    }
+  });
+}
+
+//------------------------------------------------------------------------------
+void TriangleBVH::buildNode(std::vector<BuildRef>& refs, size_t begin,
+                            size_t end, size_t index)
+{
+  Node& node = mNodes[index];
+  node.min = refs[begin].min;
+  node.max = refs[begin].max;
+  V3 centroidMin = (refs[begin].min + refs[begin].max) * 0.5f;
+  V3 centroidMax = centroidMin;
+  for (size_t i = begin + 1; i < end; ++i)
+  {
+    node.min = glm::min(node.min, refs[i].min);
+    node.max = glm::max(node.max, refs[i].max);
+    V3 centroid = (refs[i].min + refs[i].max) * 0.5f;
+    centroidMin = glm::min(centroidMin, centroid);
+    centroidMax = glm::max(centroidMax, centroid);
+  }
+
+  if (end - begin <= TrianglesPerLeaf)
+  {
+    node.right = Null;
+    node.axisOrGroup = static_cast<int32_t>(begin / TrianglesPerLeaf);
+    return;
+  }
+
+  // Binned SAH along the longest axis of the centroids, as in SceneBVH.
+  V3 centroidExtent = centroidMax - centroidMin;
+  int axis = 0;
+  if (centroidExtent[1] > centroidExtent[axis])
+    axis = 1;
+  if (centroidExtent[2] > centroidExtent[axis])
+    axis = 2;
+  node.axisOrGroup = axis;
+
+  size_t mid = begin + (end - begin) / 2;
+  if (centroidExtent[axis] > 0.0f)
+  {
+    const float infinity = std::numeric_limits<float>::infinity();
+    const float origin = centroidMin[axis];
+    const float scale = static_cast<float>(NumBins) / centroidExtent[axis];
+    auto binOf = [&](const BuildRef& ref)
+    {
+      return std::min(NumBins - 1, static_cast<size_t>(
+              ((ref.min[axis] + ref.max[axis]) * 0.5f - origin) * scale));
+    };
+
+    size_t counts[NumBins] = {};
+    V3 binMins[NumBins];
+    V3 binMaxs[NumBins];
+    std::fill(binMins, binMins + NumBins, V3(infinity, infinity, infinity));
+    std::fill(binMaxs, binMaxs + NumBins, V3(-infinity, -infinity, -infinity));
+    for (size_t i = begin; i < end; ++i)
+    {
+      size_t b = binOf(refs[i]);
+      ++counts[b];
+      binMins[b] = glm::min(binMins[b], refs[i].min);
+      binMaxs[b] = glm::max(binMaxs[b], refs[i].max);
+    }
+
+    float rightCosts[NumBins];
+    V3 min = binMins[NumBins - 1];
+    V3 max = binMaxs[NumBins - 1];
+    size_t count = 0;
+    for (size_t b = NumBins - 1; b > 0; --b)
+    {
+      count += counts[b];
+      min = glm::min(min, binMins[b]);
+      max = glm::max(max, binMaxs[b]);
+      rightCosts[b] = count ? static_cast<float>(count) * surfaceArea(min, max) : infinity;
+    }
+
+    size_t bestSplit = 0;
+    float bestCost = infinity;
+    min = binMins[0];
+    max = binMaxs[0];
+    count = 0;
+    for (size_t b = 0; b + 1 < NumBins; ++b)
+    {
+      count += counts[b];
+      min = glm::min(min, binMins[b]);
+      max = glm::max(max, binMaxs[b]);
+      if (count == 0)
+        continue;
+      float cost = static_cast<float>(count) * surfaceArea(min, max) + rightCosts[b + 1];
+      if (cost < bestCost)
+      {
+        bestCost = cost;
+        bestSplit = b;
+      }
+    }
+
+    auto split = std::partition(
+        refs.begin() + begin, refs.begin() + end,
+        [&](const BuildRef& ref) {return binOf(ref) <= bestSplit;});
+    mid = static_cast<size_t>(split - refs.begin());
+  }
+
+  // Round the split to whole groups on the left, moving at most two
+  // triangles across it. Both sides keep at least one triangle.
+  size_t leftCount = (mid - begin + TrianglesPerLeaf / 2) / TrianglesPerLeaf * TrianglesPerLeaf;
+  leftCount = std::max(TrianglesPerLeaf, std::min(
+          leftCount, (end - begin - 1) / TrianglesPerLeaf * TrianglesPerLeaf));
+  mid = begin + leftCount;
+
+  // The left subtree of n groups takes the 2n - 1 nodes after this one.
+  size_t left = index + 1;
+  size_t right = index + 2 * (leftCount / TrianglesPerLeaf);
+  node.right = static_cast<int32_t>(right);
+  if (end - begin >= ParallelBuildSize)
+  {
+    parallelFor(2, [&](size_t i)
+    {
+      if (i == 0)
+        buildNode(refs, begin, mid, left);
+      else
+        buildNode(refs, mid, end, right);
+    });
+  }
+  else
+  {
+    buildNode(refs, begin, mid, left);
+    buildNode(refs, mid, end, right);
+  }
+}
+
+//------------------------------------------------------------------------------
+bool TriangleBVH::intersectGroup(size_t index, const V3& origin,
+                                 const V3& direction, float& distance,
+                                 size_t& lane, float& u, float& v) const
+{
+  const TriangleGroup& group = mGroups[index];
+  bool hit = false;
+
+#if defined(__SSE2__) || defined(_M_X64)
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 dx = _mm_set1_ps(direction.x);
+  const __m128 dy = _mm_set1_ps(direction.y);
+  const __m128 dz = _mm_set1_ps(direction.z);
+  const __m128 e1x = _mm_loadu_ps(group.e1[0]);
+  const __m128 e1y = _mm_loadu_ps(group.e1[1]);
+  const __m128 e1z = _mm_loadu_ps(group.e1[2]);
+  const __m128 e2x = _mm_loadu_ps(group.e2[0]);
+  const __m128 e2y = _mm_loadu_ps(group.e2[1]);
+  const __m128 e2z = _mm_loadu_ps(group.e2[2]);
+
+  // p = direction x e2, det = e1 . p
+  __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+  __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+  __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+  __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)),
+                          _mm_mul_ps(e1z, pz));
+
+  // t = origin - v0, q = t x e1
+  __m128 tx = _mm_sub_ps(_mm_set1_ps(origin.x), _mm_loadu_ps(group.v0[0]));
+  __m128 ty = _mm_sub_ps(_mm_set1_ps(origin.y), _mm_loadu_ps(group.v0[1]));
+  __m128 tz = _mm_sub_ps(_mm_set1_ps(origin.z), _mm_loadu_ps(group.v0[2]));
+  __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+  __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+  __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+
+  __m128 inverse = _mm_div_ps(one, det);
+  __m128 hitU = _mm_mul_ps(inverse, _mm_add_ps(_mm_add_ps(
+      _mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)));
+  __m128 hitV = _mm_mul_ps(inverse, _mm_add_ps(_mm_add_ps(
+      _mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)));
+  __m128 hitT = _mm_mul_ps(inverse, _mm_add_ps(_mm_add_ps(
+      _mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)));
+
+  __m128 mask = _mm_and_ps(_mm_cmpneq_ps(det, zero), _mm_cmpge_ps(hitU, zero));
+  mask = _mm_and_ps(mask, _mm_cmpge_ps(hitV, zero));
+  mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(hitU, hitV), one));
+  mask = _mm_and_ps(mask, _mm_cmpge_ps(hitT, zero));
+  mask = _mm_and_ps(mask, _mm_cmplt_ps(hitT, _mm_set1_ps(distance)));
+  int bits = _mm_movemask_ps(mask);
+  if (bits == 0)
+    return false;
+
+  float us[4];
+  float vs[4];
+  float ts[4];
+  _mm_storeu_ps(us, hitU);
+  _mm_storeu_ps(vs, hitV);
+  _mm_storeu_ps(ts, hitT);
+  for (size_t i = 0; i < TrianglesPerLeaf; ++i)
+  {
+    if ((bits & (1 << i)) && ts[i] < distance)
+    {
+      distance = ts[i];
+      lane = i;
+      u = us[i];
+      v = vs[i];
+      hit = true;
+    }
+  }
+#else
+  for (size_t i = 0; i < TrianglesPerLeaf; ++i)
+  {
+    V3 v0(group.v0[0][i], group.v0[1][i], group.v0[2][i]);
+    V3 v1 = v0 + V3(group.e1[0][i], group.e1[1][i], group.e1[2][i]);
+    V3 v2 = v0 + V3(group.e2[0][i], group.e2[1][i], group.e2[2][i]);
+    if (intersectTriangle(origin, direction, v0, v1, v2, distance, u, v))
+    {
+      lane = i;
+      hit = true;
+    }
+  }
+#endif
+
+  return hit;
+}
+
+//------------------------------------------------------------------------------
+bool TriangleBVH::intersect(const V3& origin, const V3& direction,
+                            float maxDistance, TriangleHit& hit) const
+{
+  if (mNodes.empty())
+    return false;
+
+  V3 inverse(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+  float distance = maxDistance;
+  size_t bestGroup = 0;
+  size_t bestLane = 0;
+  float u = 0.0f;
+  float v = 0.0f;
+  bool found = false;
+
+  // Nearer children are visited first so farther ones are mostly pruned by
+  // the distance found so far.
+  std::vector<int32_t> stack;
+  stack.reserve(64);
+  stack.push_back(0);
+  while (!stack.empty())
+  {
+    const Node& node = mNodes[stack.back()];
+    int32_t index = stack.back();
+    stack.pop_back();
+    if (!intersectBox(origin, inverse, distance, node.min, node.max))
+      continue;
+
+    if (node.right == Null)
+    {
+      size_t lane;
+      if (intersectGroup(node.axisOrGroup, origin, direction, distance, lane, u, v))
+      {
+        bestGroup = node.axisOrGroup;
+        bestLane = lane;
+        found = true;
+      }
+    }
+    else if (direction[node.axisOrGroup] < 0.0f)
+    {
+      stack.push_back(index + 1);
+      stack.push_back(node.right);
+    }
+    else
+    {
+      stack.push_back(node.right);
+      stack.push_back(index + 1);
+    }
+  }
+  if (!found)
+    return false;
+
+  hit.triangle = mGroups[bestGroup].triangles[bestLane];
+  getTriangle(&(*mIndices)[0], mPrimitive, hit.triangle, hit.vertices);
+  hit.barycentric = V3(1.0f - u - v, u, v);
+  hit.distance = distance;
+  return true;
+}
+
+} // namespace CPM_SPIRE_NS
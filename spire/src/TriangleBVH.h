@@ -0,0 +1,162 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+/// \brief  Bounding volume hierarchy over the triangles of a mesh for ray
+///         picking. Rays are tested against four triangles at once with SSE
+///         when the compiler targets it, with the same results as the
+///         scalar code otherwise.
+
+#ifndef SPIRE_HIGH_TRIANGLEBVH_H
+#define SPIRE_HIGH_TRIANGLEBVH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Common.h"
+
+namespace CPM_SPIRE_NS {
+
+/// Triangle found by TriangleBVH::intersect.
+struct TriangleHit
+{
+  size_t    triangle;       ///< See TriangleBVH::getTriangle.
+  uint32_t  vertices[3];    ///< Indices of its corners.
+  V3        barycentric;    ///< Weights of the corners at the hit point.
+  float     distance;       ///< Ray parameter (in multiples of the direction).
+};
+
+/// Binary BVH over the triangles drawn by the indices of a mesh, built with
+/// a binned surface area heuristic on the shared thread pool. Leaves hold
+/// up to four triangles stored as a structure of arrays (first corner and
+/// both edges), which are intersected together (Moller-Trumbore). Splits
+/// are rounded so every leaf is exactly one such group, which fixes the
+/// number of nodes of each subtree up front and lets subtrees be built in
+/// parallel without allocation. Takes about 56 bytes per triangle.
+///
+/// Immutable once built; intersect may be called from any number of
+/// threads.
+class TriangleBVH
+{
+public:
+  static const size_t TrianglesPerLeaf = 4;
+
+  /// Subtrees with at least this many triangles are built in parallel.
+  static const size_t ParallelBuildSize = 16384;
+
+  /// Triangles drawn by 'indices' as 'primitive' (GL_TRIANGLES,
+  /// GL_TRIANGLE_STRIP or GL_TRIANGLE_FAN; other primitives have no
+  /// triangles). Triangles with a repeated corner or a corner past the end
+  /// of 'positions' are left out.
+  TriangleBVH(const std::vector<V3>& positions,
+              std::shared_ptr<const std::vector<uint32_t>> indices,
+              GLenum primitive);
+
+  /// Nearest triangle hit by the ray from 'origin' along 'direction' closer
+  /// than 'maxDistance'. Both sides of triangles are hit.
+  bool intersect(const V3& origin, const V3& direction, float maxDistance,
+                 TriangleHit& hit) const;
+
+  /// Number of triangles drawn, including the ones left out.
+  size_t getNumTriangles() const          {return mNumTriangles;}
+
+  size_t getNumNodes() const              {return mNodes.size();}
+
+  /// Number of triangles 'numIndices' indices draw as 'primitive'.
+  static size_t getNumTriangles(size_t numIndices, GLenum primitive);
+
+  /// Corners of triangle 'triangle' of 'indices' drawn as 'primitive', in
+  /// the winding OpenGL uses (odd strip triangles are flipped).
+  static void getTriangle(const uint32_t* indices, GLenum primitive,
+                          size_t triangle, uint32_t vertices[3]);
+
+  /// Same as intersect, testing every triangle of the mesh in turn: for
+  /// picks that cannot wait for the BVH to be built.
+  static bool intersectMesh(const std::vector<V3>& positions,
+                            const std::vector<uint32_t>& indices,
+                            GLenum primitive, const V3& origin,
+                            const V3& direction, float maxDistance,
+                            TriangleHit& hit);
+
+  /// Ray / triangle test (Moller-Trumbore, both sides). On a hit closer
+  /// than 'distance', sets it and the barycentric coordinates 'u' and 'v' of
+  /// the second and third corner.
+  static bool intersectTriangle(const V3& origin, const V3& direction,
+                                const V3& v0, const V3& v1, const V3& v2,
+                                float& distance, float& u, float& v);
+
+private:
+  TriangleBVH(const TriangleBVH&);
+  TriangleBVH& operator=(const TriangleBVH&);
+
+  static const int32_t Null = -1;
+
+  struct Node
+  {
+    V3      min;
+    int32_t right;        ///< Second child (the first follows), Null for leaves.
+    V3      max;
+    int32_t axisOrGroup;  ///< Split axis of inner nodes, group of leaves.
+  };
+
+  /// Four triangles; unused lanes are degenerate and never hit.
+  struct TriangleGroup
+  {
+    float     v0[3][4];
+    float     e1[3][4];
+    float     e2[3][4];
+    uint32_t  triangles[4];
+  };
+
+  struct BuildRef
+  {
+    V3        min;
+    V3        max;
+    uint32_t  triangle;
+  };
+
+  /// Builds the subtree of refs [begin, end), 'begin' being a multiple of
+  /// TrianglesPerLeaf, into the nodes starting at 'node'.
+  void buildNode(std::vector<BuildRef>& refs, size_t begin, size_t end,
+                 size_t node);
+
+  /// Tests the triangles of group 'group'; see intersectTriangle.
+  bool intersectGroup(size_t group, const V3& origin, const V3& direction,
+                      float& distance, size_t& lane, float& u, float& v) const;
+
+  std::vector<Node>                         mNodes;
+  std::vector<TriangleGroup>                mGroups;
+  std::shared_ptr<const std::vector<uint32_t>>  mIndices;
+  GLenum                                    mPrimitive;
+  size_t                                    mNumTriangles;
+};
+
+} // namespace CPM_SPIRE_NS
+
+#endif
@@ -29,27 +29,46 @@
 /// \author James Hughes
 /// \date   February 2013
 
+#include <cstring>
+#include <stdexcept>
+
+#include "BoundingVolume.h"
 #include "VBOObject.h"
+#include "VertexConversion.h"
 
 namespace CPM_SPIRE_NS {
 
 //------------------------------------------------------------------------------
 VBOObject::VBOObject(std::shared_ptr<std::vector<uint8_t>> vboData,
                      const std::vector<std::string>& attributes,
-                     const ShaderAttributeMan& man)
-    : mAttributeCollection(man)
+                     const ShaderAttributeMan& man, bool narrowDoubles,
+                     bool retainPositions)
+    : mAttributeCollection(man),
+      mBoundingSphere(0.0f, 0.0f, 0.0f, -1.0f)
 {
-  buildVBO(&(*vboData)[0], vboData->size(), attributes);
+  buildVBO(&(*vboData)[0], vboData->size(), attributes, narrowDoubles,
+           retainPositions);
 }
 
 //------------------------------------------------------------------------------
 VBOObject::VBOObject(
     const uint8_t* vboData, const size_t vboLength,
     const std::vector<std::string>& attributes,
-    const ShaderAttributeMan& man)
-    : mAttributeCollection(man)
+    const ShaderAttributeMan& man, bool narrowDoubles, bool retainPositions)
+    : mAttributeCollection(man),
+      mBoundingSphere(0.0f, 0.0f, 0.0f, -1.0f)
+{
+  buildVBO(vboData, vboLength, attributes, narrowDoubles, retainPositions);
+}
+
+//------------------------------------------------------------------------------
+VBOObject::VBOObject(GLuint glIndex, const std::vector<std::string>& attributes,
+                     const ShaderAttributeMan& man)
+    : mGLIndex(glIndex),
+      mAttributeCollection(man),
+      mBoundingSphere(0.0f, 0.0f, 0.0f, -1.0f)
 {
-  buildVBO(vboData, vboLength, attributes);
+  addAttributes(attributes);
 }
 
 //------------------------------------------------------------------------------
@@ -58,18 +77,169 @@ VBOObject::~VBOObject()
   GL(glDeleteBuffers(1, &mGLIndex));
 }
 
+//------------------------------------------------------------------------------
+void VBOObject::updateData(size_t offset, const uint8_t* data, size_t size)
+{
+  GL(glBindBuffer(GL_ARRAY_BUFFER, mGLIndex));
+  GL(glBufferSubData(GL_ARRAY_BUFFER, static_cast<GLintptr>(offset),
+                     static_cast<GLsizeiptr>(size), data));
+}
+
+//------------------------------------------------------------------------------
+void VBOObject::setBounds(const V3& min, const V3& max)
+{
+  mBoundsMin = min;
+  mBoundsMax = max;
+  mBoundingSphere = V4((min + max) * 0.5f, glm::length(max - min) * 0.5f);
+}
+
+//------------------------------------------------------------------------------
+bool VBOObject::findPositionAttribute(size_t& offset) const
+{
+  offset = 0;
+  for (size_t i = 0; i < mAttributeCollection.getNumAttributes(); ++i)
+  {
+    AttribState attrib = mAttributeCollection.getAttribute(i);
+    if (attrib.codeName == getPositionAttribute())
+      return attrib.type == Interface::TYPE_FLOAT && attrib.numComponents >= 3;
+    offset += attrib.size;
+  }
+  return false;
+}
+
+//------------------------------------------------------------------------------
+void VBOObject::computeBounds(const uint8_t* vboData, size_t vboLength)
+{
+  size_t stride = mAttributeCollection.calculateStride();
+  size_t offset;
+  if (vboData == nullptr || stride == 0 || !findPositionAttribute(offset))
+    return;
+
+  size_t numVertices = vboLength / stride;
+  V3 min;
+  V3 max;
+  if (computePositionBounds(vboData, numVertices, stride, offset, min, max))
+  {
+    mBoundsMin = min;
+    mBoundsMax = max;
+    V3 center = (min + max) * 0.5f;
+    mBoundingSphere = V4(center, computeBoundingRadius(
+            vboData, numVertices, stride, offset, center));
+  }
+}
+
+//------------------------------------------------------------------------------
+void VBOObject::retainPositions(const uint8_t* vboData, size_t vboLength)
+{
+  size_t stride = mAttributeCollection.calculateStride();
+  size_t offset;
+  if (vboData == nullptr || stride == 0 || !findPositionAttribute(offset))
+    return;
+
+  size_t numVertices = vboLength / stride;
+  std::shared_ptr<std::vector<V3>> positions =
+      std::make_shared<std::vector<V3>>(numVertices);
+  for (size_t v = 0; v < numVertices; ++v)
+  {
+    float xyz[3];
+    std::memcpy(xyz, vboData + v * stride + offset, sizeof(xyz));
+    (*positions)[v] = V3(xyz[0], xyz[1], xyz[2]);
+  }
+  mRetainedPositions = positions;
+}
+
+//------------------------------------------------------------------------------
+void VBOObject::addAttributes(const std::vector<std::string>& attributes)
+{
+  for (auto it = attributes.begin(); it != attributes.end(); ++it)
+  {
+    mAttributeCollection.addAttribute(*it);
+  }
+}
+
 //------------------------------------------------------------------------------
 void VBOObject::buildVBO(const uint8_t* vboData, const size_t vboLength,
-                         const std::vector<std::string>& attributes)
+                         const std::vector<std::string>& attributes,
+                         bool narrowDoubles, bool retain)
 {
+  addAttributes(attributes);
+
+  std::vector<uint8_t> narrowed;
+  size_t uploadLength = vboLength;
+  if (narrowDoubles && mAttributeCollection.hasAttributeOfType(Interface::TYPE_DOUBLE))
+  {
+    narrowDoubleAttributes(vboData, vboLength, narrowed);
+    vboData = narrowed.empty() ? nullptr : &narrowed[0];
+    uploadLength = narrowed.size();
+  }
+
+  computeBounds(vboData, uploadLength);
+  if (retain)
+    retainPositions(vboData, uploadLength);
+
   GL(glGenBuffers(1, &mGLIndex));
   GL(glBindBuffer(GL_ARRAY_BUFFER, mGLIndex));
-  GL(glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(vboLength), 
+  GL(glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(uploadLength), 
                   vboData, GL_STATIC_DRAW));
+}
 
-  for (auto it = attributes.begin(); it != attributes.end(); ++it)
+//------------------------------------------------------------------------------
+void VBOObject::narrowDoubleAttributes(const uint8_t* vboData, size_t vboLength,
+                                       std::vector<uint8_t>& out)
+{
+  size_t inStride = mAttributeCollection.calculateStride();
+  if (inStride == 0 || vboLength % inStride != 0)
+    throw std::invalid_argument("VBO size does not match its attributes.");
+  size_t numVertices = vboLength / inStride;
+
+  std::vector<AttribState> inAttribs;
+  for (size_t i = 0; i < mAttributeCollection.getNumAttributes(); ++i)
+    inAttribs.push_back(mAttributeCollection.getAttribute(i));
+
+  mAttributeCollection.narrowDoubleAttributes();
+  size_t outStride = mAttributeCollection.calculateStride();
+  out.resize(numVertices * outStride);
+
+  // The common case of a VBO made up entirely of doubles (positions coming
+  // straight out of SCIRun fields) is a single contiguous conversion.
+  if (outStride * 2 == inStride)
   {
-    mAttributeCollection.addAttribute(*it);
+    convertDoubleToFloat(reinterpret_cast<const double*>(vboData),
+                         reinterpret_cast<float*>(&out[0]),
+                         vboLength / sizeof(double));
+    return;
+  }
+
+  size_t inOffset = 0;
+  size_t outOffset = 0;
+  std::vector<double> scratchIn;
+  std::vector<float> scratchOut;
+  for (auto it = inAttribs.begin(); it != inAttribs.end(); ++it)
+  {
+    if (it->type == Interface::TYPE_DOUBLE)
+    {
+      // Interleaved doubles need not be 8 byte aligned, so go through
+      // aligned scratch buffers.
+      size_t count = it->size / sizeof(double);
+      scratchIn.resize(count);
+      scratchOut.resize(count);
+      for (size_t v = 0; v < numVertices; ++v)
+      {
+        std::memcpy(&scratchIn[0], vboData + v * inStride + inOffset, it->size);
+        convertDoubleToFloat(&scratchIn[0], &scratchOut[0], count);
+        std::memcpy(&out[v * outStride + outOffset], &scratchOut[0],
+                    count * sizeof(float));
+      }
+      outOffset += count * sizeof(float);
+    }
+    else
+    {
+      for (size_t v = 0; v < numVertices; ++v)
+        std::memcpy(&out[v * outStride + outOffset],
+                    vboData + v * inStride + inOffset, it->size);
+      outOffset += it->size;
+    }
+    inOffset += it->size;
   }
 }
 
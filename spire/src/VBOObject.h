@@ -51,10 +51,20 @@ public:
   // This constructor delegates to the raw version below.
   VBOObject(std::shared_ptr<std::vector<uint8_t>> vboData,
             const std::vector<std::string>& attributes,
-            const ShaderAttributeMan& man);
+            const ShaderAttributeMan& man, bool narrowDoubles = false,
+            bool retainPositions = false);
 
+  /// If 'narrowDoubles' is true, TYPE_DOUBLE attributes are converted to
+  /// floats before being uploaded. If 'retainPositions' is true, a copy of
+  /// the positions is kept for picking (see getRetainedPositions).
   VBOObject(const uint8_t* vboData, const size_t vboLength,
             const std::vector<std::string>& attributes,
+            const ShaderAttributeMan& man, bool narrowDoubles = false,
+            bool retainPositions = false);
+
+  /// Takes ownership of the existing buffer object 'glIndex', e.g. one
+  /// created on the upload context (see GLUploader).
+  VBOObject(GLuint glIndex, const std::vector<std::string>& attributes,
             const ShaderAttributeMan& man);
 
   ~VBOObject();
@@ -63,15 +73,62 @@ public:
   const std::vector<std::string>& getAttributes() const {return mAttributes;}
   const ShaderAttributeCollection& getAttributeCollection() const {return mAttributeCollection;}
 
+  /// Replaces 'size' bytes of the buffer starting at byte 'offset'. The data
+  /// must already be in the uploaded layout (doubles are not narrowed).
+  void updateData(size_t offset, const uint8_t* data, size_t size);
+
+  /// Name of the attribute bounds are computed from. It must hold three
+  /// floats.
+  static const char* getPositionAttribute()             {return "aPos";}
+
+  /// Object space bounds of the vertex positions, computed when the VBO is
+  /// built from data or set with setBounds. updateData does not change
+  /// them. A VBO without bounds (negative sphere radius) is never culled.
+  bool hasBounds() const                  {return mBoundingSphere.w >= 0.0f;}
+  const V3& getBoundsMin() const          {return mBoundsMin;}
+  const V3& getBoundsMax() const          {return mBoundsMax;}
+  const V4& getBoundingSphere() const     {return mBoundingSphere;}
+
+  void setBounds(const V3& min, const V3& max);
+
+  /// Computes the bounds from 'vboLength' bytes of vertices in the layout of
+  /// this VBO. Leaves the bounds alone if there is no position attribute.
+  void computeBounds(const uint8_t* vboData, size_t vboLength);
+
+  /// CPU copy of the vertex positions, if retained when the VBO was built
+  /// and it has a position attribute. Null otherwise.
+  const std::shared_ptr<const std::vector<V3>>& getRetainedPositions() const
+  {return mRetainedPositions;}
+
 private:
 
+  /// Byte offset of the position attribute within a vertex. False if there
+  /// is no position attribute of three or more floats.
+  bool findPositionAttribute(size_t& offset) const;
+
+  /// Copies the positions of 'vboLength' bytes of vertices into
+  /// mRetainedPositions.
+  void retainPositions(const uint8_t* vboData, size_t vboLength);
+
+  void addAttributes(const std::vector<std::string>& attributes);
+
   void buildVBO(const uint8_t* vboData, const size_t vboLength,
-                const std::vector<std::string>& attributes);
+                const std::vector<std::string>& attributes,
+                bool narrowDoubles, bool retain);
+
+  /// Converts the double attributes of the interleaved 'vboData' into floats
+  /// and updates mAttributeCollection accordingly.
+  void narrowDoubleAttributes(const uint8_t* vboData, size_t vboLength,
+                              std::vector<uint8_t>& out);
                 
 
   GLuint                    mGLIndex;    ///< Corresponds to the map index but obtained from OpenGL.
   std::vector<std::string>  mAttributes; ///< Attributes for shader verification.
   ShaderAttributeCollection mAttributeCollection;
+  V3                        mBoundsMin;
+  V3                        mBoundsMax;
+  V4                        mBoundingSphere;  ///< Center, radius.
+  std::shared_ptr<const std::vector<V3>>  mRetainedPositions;
 };
 
 } // namespace CPM_SPIRE_NS
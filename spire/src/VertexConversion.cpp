@@ -0,0 +1,161 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <cstring>
+
+#if defined(__F16C__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#include "VertexConversion.h"
+
+namespace CPM_SPIRE_NS {
+
+//------------------------------------------------------------------------------
+uint16_t floatToHalf(float value)
+{
+  uint32_t f;
+  std::memcpy(&f, &value, sizeof(f));
+
+  uint32_t sign = (f >> 16) & 0x8000;
+  uint32_t abs  = f & 0x7FFFFFFF;
+
+  // Infinity and NaN (keep NaNs quiet and non-zero).
+  if (abs >= 0x7F800000)
+  {
+    uint32_t nan = (abs > 0x7F800000) ? (0x200 | ((abs >> 13) & 0x3FF)) : 0;
+    return static_cast<uint16_t>(sign | 0x7C00 | nan);
+  }
+
+  // Overflow to infinity. Values slightly below this threshold round up to
+  // infinity in the normal path below.
+  if (abs >= 0x47800000)
+    return static_cast<uint16_t>(sign | 0x7C00);
+
+  // Results in the half subnormal range (or zero).
+  if (abs < 0x38800000)
+  {
+    if (abs < 0x33000000)
+      return static_cast<uint16_t>(sign);
+
+    uint32_t exponent = abs >> 23;
+    uint32_t mantissa = (abs & 0x7FFFFF) | 0x800000;
+    uint32_t shift    = 126 - exponent;
+    uint32_t h        = mantissa >> shift;
+    uint32_t rem      = mantissa & ((1u << shift) - 1);
+    uint32_t halfway  = 1u << (shift - 1);
+    if (rem > halfway || (rem == halfway && (h & 1)))
+      ++h;
+    return static_cast<uint16_t>(sign | h);
+  }
+
+  // Normal numbers: rebias the exponent and round the mantissa. A carry out
+  // of the mantissa correctly increments the exponent.
+  uint32_t h   = (abs - 0x38000000) >> 13;
+  uint32_t rem = abs & 0x1FFF;
+  if (rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+    ++h;
+  return static_cast<uint16_t>(sign | h);
+}
+
+//------------------------------------------------------------------------------
+float halfToFloat(uint16_t value)
+{
+  uint32_t sign     = static_cast<uint32_t>(value & 0x8000) << 16;
+  uint32_t exponent = (value >> 10) & 0x1F;
+  uint32_t mantissa = value & 0x3FFu;
+
+  uint32_t f;
+  if (exponent == 0)
+  {
+    // Zero or subnormal: mantissa * 2^-24 is exact in float.
+    float result = static_cast<float>(mantissa) * 5.9604644775390625e-8f;
+    std::memcpy(&f, &result, sizeof(f));
+    f |= sign;
+  }
+  else if (exponent == 31)
+  {
+    f = sign | 0x7F800000 | (mantissa << 13);
+  }
+  else
+  {
+    f = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  }
+
+  float result;
+  std::memcpy(&result, &f, sizeof(result));
+  return result;
+}
+
+//------------------------------------------------------------------------------
+void convertFloatToHalf(const float* in, uint16_t* out, size_t count)
+{
+  size_t i = 0;
+#if defined(__F16C__)
+  for (; i + 4 <= count; i += 4)
+  {
+    __m128i h = _mm_cvtps_ph(_mm_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out + i), h);
+  }
+#endif
+  for (; i < count; ++i)
+    out[i] = floatToHalf(in[i]);
+}
+
+//------------------------------------------------------------------------------
+void convertHalfToFloat(const uint16_t* in, float* out, size_t count)
+{
+  size_t i = 0;
+#if defined(__F16C__)
+  for (; i + 4 <= count; i += 4)
+  {
+    __m128i h = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(in + i));
+    _mm_storeu_ps(out + i, _mm_cvtph_ps(h));
+  }
+#endif
+  for (; i < count; ++i)
+    out[i] = halfToFloat(in[i]);
+}
+
+//------------------------------------------------------------------------------
+void convertDoubleToFloat(const double* in, float* out, size_t count)
+{
+  size_t i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+  for (; i + 4 <= count; i += 4)
+  {
+    __m128 lo = _mm_cvtpd_ps(_mm_loadu_pd(in + i));
+    __m128 hi = _mm_cvtpd_ps(_mm_loadu_pd(in + i + 2));
+    _mm_storeu_ps(out + i, _mm_movelh_ps(lo, hi));
+  }
+#endif
+  for (; i < count; ++i)
+    out[i] = static_cast<float>(in[i]);
+}
+
+} // namespace CPM_SPIRE_NS
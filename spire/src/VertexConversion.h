@@ -0,0 +1,60 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+/// \brief  Conversion of attribute streams at upload time: float <-> half
+///         float and double -> float. The bulk conversions use F16C / SSE2
+///         when the compiler targets them (e.g. -mf16c or -march=native) and
+///         fall back to exact scalar code otherwise. All variants round to
+///         nearest even and produce identical results.
+
+#ifndef SPIRE_HIGH_VERTEXCONVERSION_H
+#define SPIRE_HIGH_VERTEXCONVERSION_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace CPM_SPIRE_NS {
+
+/// Converts a single float to an IEEE 754 half float. Values too large for a
+/// half become infinity, NaNs stay NaNs.
+uint16_t floatToHalf(float value);
+
+/// Converts a single IEEE 754 half float to float (exact).
+float halfToFloat(uint16_t value);
+
+/// Converts 'count' floats to half floats. Use with Interface::TYPE_HALFFLOAT
+void convertFloatToHalf(const float* in, uint16_t* out, size_t count);
+
+/// Converts 'count' half floats to floats.
+void convertHalfToFloat(const uint16_t* in, float* out, size_t count);
+
+void convertDoubleToFloat(const double* in, float* out, size_t count);
+
+} // namespace CPM_SPIRE_NS
+
+#endif
@@ -0,0 +1,219 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include "VertexQuantization.h"
+
+namespace CPM_SPIRE_NS {
+
+namespace {
+
+const size_t FLOAT_VERTEX_SIZE = sizeof(float) * 6;
+
+float signNotZero(float v)
+{
+  return (v >= 0.0f) ? 1.0f : -1.0f;
+}
+
+void readFloat3(const uint8_t* src, float out[3])
+{
+  std::memcpy(out, src, sizeof(float) * 3);
+}
+
+} // namespace
+
+//------------------------------------------------------------------------------
+QuantizationInfo::QuantizationInfo()
+{
+  for (size_t i = 0; i < 3; ++i)
+  {
+    offset[i] = 0.0f;
+    scale[i]  = 1.0f;
+  }
+}
+
+//------------------------------------------------------------------------------
+int16_t quantizeSnorm16(float v)
+{
+  v = std::max(-1.0f, std::min(1.0f, v));
+  return static_cast<int16_t>(std::floor(v * 32767.0f + 0.5f));
+}
+
+//------------------------------------------------------------------------------
+float dequantizeSnorm16(int16_t v)
+{
+  return std::max(static_cast<float>(v) / 32767.0f, -1.0f);
+}
+
+//------------------------------------------------------------------------------
+void encodeOctahedral(const float n[3], int16_t out[2])
+{
+  float l1 = std::fabs(n[0]) + std::fabs(n[1]) + std::fabs(n[2]);
+  if (l1 == 0.0f)
+    throw std::invalid_argument("Cannot encode a zero length normal.");
+
+  float x = n[0] / l1;
+  float y = n[1] / l1;
+  if (n[2] < 0.0f)
+  {
+    float fx = (1.0f - std::fabs(y)) * signNotZero(x);
+    float fy = (1.0f - std::fabs(x)) * signNotZero(y);
+    x = fx;
+    y = fy;
+  }
+
+  out[0] = quantizeSnorm16(x);
+  out[1] = quantizeSnorm16(y);
+}
+
+//------------------------------------------------------------------------------
+void decodeOctahedral(const int16_t in[2], float out[3])
+{
+  float x = dequantizeSnorm16(in[0]);
+  float y = dequantizeSnorm16(in[1]);
+  float z = 1.0f - std::fabs(x) - std::fabs(y);
+  if (z < 0.0f)
+  {
+    float fx = (1.0f - std::fabs(y)) * signNotZero(x);
+    float fy = (1.0f - std::fabs(x)) * signNotZero(y);
+    x = fx;
+    y = fy;
+  }
+
+  float len = std::sqrt(x * x + y * y + z * z);
+  out[0] = x / len;
+  out[1] = y / len;
+  out[2] = z / len;
+}
+
+//------------------------------------------------------------------------------
+QuantizationInfo calculateQuantization(const uint8_t* vbo, size_t numVertices,
+                                       size_t stride, size_t positionOffset)
+{
+  QuantizationInfo info;
+  if (numVertices == 0)
+    return info;
+
+  float lo[3];
+  float hi[3];
+  for (size_t i = 0; i < 3; ++i)
+  {
+    lo[i] = std::numeric_limits<float>::max();
+    hi[i] = -std::numeric_limits<float>::max();
+  }
+
+  for (size_t v = 0; v < numVertices; ++v)
+  {
+    float p[3];
+    readFloat3(vbo + v * stride + positionOffset, p);
+    for (size_t i = 0; i < 3; ++i)
+    {
+      lo[i] = std::min(lo[i], p[i]);
+      hi[i] = std::max(hi[i], p[i]);
+    }
+  }
+
+  for (size_t i = 0; i < 3; ++i)
+  {
+    info.offset[i] = (lo[i] + hi[i]) * 0.5f;
+    info.scale[i]  = (hi[i] - lo[i]) * 0.5f;
+  }
+  return info;
+}
+
+//------------------------------------------------------------------------------
+QuantizationInfo quantizeVertices(const std::vector<uint8_t>& vbo, size_t stride,
+                                  size_t positionOffset, size_t normalOffset,
+                                  std::vector<uint8_t>& out)
+{
+  if (   positionOffset + sizeof(float) * 3 > stride
+      || normalOffset + sizeof(float) * 3 > stride)
+    throw std::invalid_argument("Position or normal lies outside of the vertex.");
+  if (vbo.size() % stride != 0)
+    throw std::invalid_argument("VBO size is not a multiple of the stride.");
+
+  size_t numVertices = vbo.size() / stride;
+  QuantizationInfo info;
+  out.resize(numVertices * QUANTIZED_VERTEX_SIZE);
+  if (numVertices == 0)
+    return info;
+
+  info = calculateQuantization(&vbo[0], numVertices, stride, positionOffset);
+
+  for (size_t v = 0; v < numVertices; ++v)
+  {
+    const uint8_t* src = &vbo[v * stride];
+    float p[3];
+    float n[3];
+    readFloat3(src + positionOffset, p);
+    readFloat3(src + normalOffset, n);
+
+    int16_t q[6];
+    for (size_t i = 0; i < 3; ++i)
+    {
+      float s = (info.scale[i] > 0.0f) ? (p[i] - info.offset[i]) / info.scale[i] : 0.0f;
+      q[i] = quantizeSnorm16(s);
+    }
+    q[3] = 0;
+    encodeOctahedral(n, &q[4]);
+
+    std::memcpy(&out[v * QUANTIZED_VERTEX_SIZE], q, QUANTIZED_VERTEX_SIZE);
+  }
+
+  return info;
+}
+
+//------------------------------------------------------------------------------
+void dequantizeVertices(const std::vector<uint8_t>& quantized,
+                        const QuantizationInfo& info, std::vector<uint8_t>& out)
+{
+  if (quantized.size() % QUANTIZED_VERTEX_SIZE != 0)
+    throw std::invalid_argument("Quantized VBO has an unexpected size.");
+
+  size_t numVertices = quantized.size() / QUANTIZED_VERTEX_SIZE;
+  out.resize(numVertices * FLOAT_VERTEX_SIZE);
+  for (size_t v = 0; v < numVertices; ++v)
+  {
+    int16_t q[6];
+    std::memcpy(q, &quantized[v * QUANTIZED_VERTEX_SIZE], QUANTIZED_VERTEX_SIZE);
+
+    float f[6];
+    for (size_t i = 0; i < 3; ++i)
+      f[i] = info.offset[i] + info.scale[i] * dequantizeSnorm16(q[i]);
+    decodeOctahedral(&q[4], &f[3]);
+
+    std::memcpy(&out[v * FLOAT_VERTEX_SIZE], f, FLOAT_VERTEX_SIZE);
+  }
+}
+
+} // namespace CPM_SPIRE_NS
@@ -0,0 +1,104 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+/// \brief  Quantized vertex formats: 16 bit normalized positions relative to
+///         the mesh bounds and octahedral encoded normals. Shared by assetConv
+///         and the asset loader. Nothing in here touches OpenGL.
+
+#ifndef SPIRE_HIGH_VERTEXQUANTIZATION_H
+#define SPIRE_HIGH_VERTEXQUANTIZATION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace CPM_SPIRE_NS {
+
+/// Size of a quantized vertex in bytes. Layout:
+///  int16 x, y, z, pad  - snorm16 position relative to the mesh bounds.
+///  int16 u, v          - snorm16 octahedral normal.
+/// The position is padded to 4 components to keep every attribute 4 byte
+/// aligned, which most drivers require for good performance (the unpadded
+/// 10 byte layout is slower to fetch than it is smaller).
+const size_t QUANTIZED_VERTEX_SIZE = 12;
+
+/// Byte offsets of the attributes inside of a quantized vertex.
+const size_t QUANTIZED_POSITION_OFFSET = 0;
+const size_t QUANTIZED_NORMAL_OFFSET   = 8;
+
+/// Maps the snorm16 position back into object space:
+///   position = offset + scale * snorm
+/// Pass offset and scale to the vertex shader as uniforms, the attribute
+/// itself should be added as 4 normalized TYPE_SHORT components.
+struct QuantizationInfo
+{
+  QuantizationInfo();
+
+  float offset[3];
+  float scale[3];
+};
+
+/// Converts a value in [-1, 1] to snorm16. Values outside are clamped.
+int16_t quantizeSnorm16(float v);
+
+/// Converts snorm16 back to float using the OpenGL 4.2 / ES 3.0 convention
+/// (max(v / 32767, -1)).
+float dequantizeSnorm16(int16_t v);
+
+/// Octahedral encoding of a unit vector (Meyer et al. 2010) into two snorm16
+/// values. 'n' need not be normalized but must not be zero.
+/// Decode in GLSL with:
+///   vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+///   if (n.z < 0.0) n.xy = (1.0 - abs(n.yx)) * sign(n.xy);
+///   n = normalize(n);
+/// (use step(0.0, n.xy) * 2.0 - 1.0 instead of sign() if zero must map to 1).
+void encodeOctahedral(const float n[3], int16_t out[2]);
+
+/// Inverse of encodeOctahedral. The result is normalized.
+void decodeOctahedral(const int16_t in[2], float out[3]);
+
+/// Computes the quantization parameters for the positions in 'vbo'.
+QuantizationInfo calculateQuantization(const uint8_t* vbo, size_t numVertices,
+                                       size_t stride, size_t positionOffset);
+
+/// Quantizes positions and normals (3 floats each) of every vertex in 'vbo'
+/// into the QUANTIZED_VERTEX_SIZE layout above. Other attributes are dropped.
+/// \return Parameters required to reconstruct the positions.
+QuantizationInfo quantizeVertices(const std::vector<uint8_t>& vbo, size_t stride,
+                                  size_t positionOffset, size_t normalOffset,
+                                  std::vector<uint8_t>& out);
+
+/// Expands quantized vertices back into 6 floats per vertex (position,
+/// normal). Used when a quantized asset is loaded by code that expects float
+/// vertices.
+void dequantizeVertices(const std::vector<uint8_t>& quantized,
+                        const QuantizationInfo& info, std::vector<uint8_t>& out);
+
+} // namespace CPM_SPIRE_NS
+
+#endif
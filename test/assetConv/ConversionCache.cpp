@@ -0,0 +1,140 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "ConversionCache.h"
+
+namespace {
+
+const uint64_t FNV_PRIME = 1099511628211ULL;
+
+uint64_t hashBytes(const char* data, size_t size, uint64_t hash)
+{
+  for (size_t i = 0; i < size; ++i)
+  {
+    hash ^= static_cast<uint8_t>(data[i]);
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+} // namespace
+
+//------------------------------------------------------------------------------
+ConversionCache::ConversionCache(const std::string& cacheFile,
+                                 bool ignoreExisting) :
+    mCacheFile(cacheFile),
+    mIgnoreExisting(ignoreExisting)
+{
+  std::ifstream input(cacheFile);
+  std::string line;
+  while (std::getline(input, line))
+  {
+    // Each line is '<hex hash> <output file>'.
+    std::istringstream stream(line);
+    uint64_t hash;
+    if (!(stream >> std::hex >> hash))
+      continue;
+
+    std::string outputFile;
+    stream.get();
+    std::getline(stream, outputFile);
+    if (!outputFile.empty())
+      mEntries[outputFile] = hash;
+  }
+}
+
+//------------------------------------------------------------------------------
+uint64_t ConversionCache::hashFile(const std::string& file, uint64_t seed)
+{
+  std::ifstream input(file, std::ifstream::binary);
+  if (!input)
+    throw std::runtime_error("Unable to read " + file);
+
+  std::vector<char> buffer(1 << 20);
+  uint64_t hash = seed;
+  while (input)
+  {
+    input.read(&buffer[0], static_cast<std::streamsize>(buffer.size()));
+    hash = hashBytes(&buffer[0], static_cast<size_t>(input.gcount()), hash);
+  }
+  return hash;
+}
+
+//------------------------------------------------------------------------------
+uint64_t ConversionCache::hashString(const std::string& str, uint64_t seed)
+{
+  return hashBytes(str.c_str(), str.length(), seed);
+}
+
+//------------------------------------------------------------------------------
+bool ConversionCache::isUpToDate(const std::string& outputFile,
+                                 uint64_t inputHash) const
+{
+  if (mIgnoreExisting)
+    return false;
+
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mEntries.find(outputFile);
+    if (it == mEntries.end() || it->second != inputHash)
+      return false;
+  }
+
+  return boost::filesystem::exists(outputFile);
+}
+
+//------------------------------------------------------------------------------
+void ConversionCache::update(const std::string& outputFile, uint64_t inputHash)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  mEntries[outputFile] = inputHash;
+}
+
+//------------------------------------------------------------------------------
+void ConversionCache::save() const
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  std::string tempFile = mCacheFile + ".tmp";
+  {
+    std::ofstream output(tempFile);
+    for (auto it = mEntries.begin(); it != mEntries.end(); ++it)
+      output << std::hex << it->second << " " << it->first << "\n";
+    if (!output)
+      throw std::runtime_error("Unable to write " + tempFile);
+  }
+
+  boost::filesystem::rename(tempFile, mCacheFile);
+}
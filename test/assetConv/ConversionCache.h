@@ -0,0 +1,75 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+/// \brief  Remembers the content hash of every input that has been converted
+///         so that unchanged inputs can be skipped on the next run.
+
+#ifndef ASSETCONV_CONVERSIONCACHE_H
+#define ASSETCONV_CONVERSIONCACHE_H
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+/// Persistent map from output file to the hash of the input (and conversion
+/// options) it was produced from. Safe to use from multiple threads.
+class ConversionCache
+{
+public:
+  /// Loads the cache from 'cacheFile' if it exists. If 'ignoreExisting' is
+  /// true, existing entries are never considered up to date but are still
+  /// updated and saved.
+  ConversionCache(const std::string& cacheFile, bool ignoreExisting);
+
+  /// Hashes the contents of 'file' (64 bit FNV-1a) seeded with 'seed'.
+  /// Throws std::runtime_error if the file cannot be read.
+  static uint64_t hashFile(const std::string& file, uint64_t seed);
+
+  /// Hashes a string, used to fold the conversion options into the seed.
+  static uint64_t hashString(const std::string& str, uint64_t seed);
+
+  /// Returns true if 'outputFile' exists and was produced from an input with
+  /// the given hash.
+  bool isUpToDate(const std::string& outputFile, uint64_t inputHash) const;
+
+  /// Records that 'outputFile' was produced from an input with 'inputHash'.
+  void update(const std::string& outputFile, uint64_t inputHash);
+
+  /// Writes the cache back to disk (via a temporary file and a rename so an
+  /// interrupted run never leaves a corrupt cache behind).
+  void save() const;
+
+private:
+  std::string                       mCacheFile;
+  bool                              mIgnoreExisting;
+  std::map<std::string, uint64_t>   mEntries;
+  mutable std::mutex                mMutex;
+};
+
+#endif
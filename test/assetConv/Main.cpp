@@ -33,9 +33,16 @@
 ///         Extensions section of the code.
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
 #include <string>
 #include <map>
+#include <mutex>
 #include <fstream>
+#include <sstream>
+#include <thread>
 #include <boost/filesystem.hpp>
 
 #include <glm/glm.hpp>
@@ -54,8 +61,76 @@
 #include "assimp/DefaultLogger.hpp"
 #include "assimp/LogStream.hpp"
 
+// Spire asset file support (compiled directly into assetConv).
+#include "spire/src/AssetFile.h"
+#include "spire/src/MeshClusters.h"
+#include "spire/src/MeshImport.h"
+#include "spire/src/MeshOptimizer.h"
+#include "spire/src/MeshSimplifier.h"
+#include "spire/src/Parallel.h"
+#include "spire/src/ThreadPool.h"
+#include "spire/src/VertexQuantization.h"
+
+#include "ConversionCache.h"
+
+/// Bump whenever the output of the converter changes for identical inputs so
+/// that all cached conversions are redone.
+const char* CONVERTER_VERSION = "assetConv-3";
+
+/// Triangle ratios of the levels of detail generated with --lods.
+const std::vector<float> LOD_RATIOS = {0.5f, 0.25f, 0.1f, 0.05f};
+
+/// Options controlling the generated asset files.
+struct ConvOptions
+{
+  ConvOptions() :
+      quantize(false), compressIndices(false), partTriangles(0),
+      clusters(false), lods(false), benchmark(false)
+  {}
+
+  /// Seed for the conversion cache. Folds in everything that influences the
+  /// generated file besides the input contents.
+  uint64_t hashSeed() const
+  {
+    std::ostringstream stream;
+    stream << CONVERTER_VERSION << " quantize=" << quantize
+           << " compressIndices=" << compressIndices
+           << " partTriangles=" << partTriangles
+           << " clusters=" << clusters
+           << " lods=" << lods;
+    return ConversionCache::hashString(stream.str(), 14695981039346656037ULL);
+  }
+
+  /// Options handed to spire's asset file writer.
+  spire::AssetWriteOptions writeOptions() const
+  {
+    spire::AssetWriteOptions write;
+    write.compressIndices = compressIndices;
+    write.trianglesPerPart = partTriangles;
+    return write;
+  }
+
+  bool quantize;        ///< Write snorm16 positions and octahedral normals.
+  bool compressIndices; ///< Delta / varint code the index buffers.
+  size_t partTriangles; ///< Split meshes into streamable parts (0 = off).
+  bool clusters;        ///< Store triangle clusters for cluster culling.
+  bool lods;            ///< Store simplified levels of detail.
+  bool benchmark;       ///< Time native imports against assimp (not hashed).
+};
+
 // Forward declarations
-int processFile(const std::string& inFile, const std::string& outputDirectory);
+int processFile(const std::string& inFile, const std::string& outputDirectory,
+                const ConvOptions& options, ConversionCache* cache);
+
+/// Serializes console output from the worker threads.
+std::mutex gOutputMutex;
+
+//------------------------------------------------------------------------------
+void printLine(const std::string& line)
+{
+  std::lock_guard<std::mutex> lock(gOutputMutex);
+  std::cout << line << std::endl;
+}
 
 //------------------------------------------------------------------------------
 void createAssimpLogger()
@@ -76,6 +151,9 @@ int main(int argc, char* argv[])
 {
   std::vector<std::string> inputFiles;
   std::string outputDirectory;
+  ConvOptions options;
+  unsigned int numJobs = 0;
+  bool force = false;
   try
   {
     TCLAP::CmdLine cmd("Asset Converter");
@@ -88,9 +166,60 @@ int main(int argc, char* argv[])
                                            true, "", "Path");
     TCLAP::ValueArg<std::string> outputDir("o", "output", "Output directory.",
                                            false, "", "String");
+    TCLAP::SwitchArg quantize("q", "quantize",
+                              "Quantize positions to 16 bits relative to the "
+                              "mesh bounds and normals to 2x16 bit octahedral "
+                              "coordinates (12 instead of 24 bytes per vertex).",
+                              false);
+
+    TCLAP::ValueArg<unsigned int> jobs("j", "jobs",
+                                       "Number of files to convert in parallel "
+                                       "(defaults to the number of cores).",
+                                       false, 0, "Count");
+    TCLAP::SwitchArg forceArg("f", "force",
+                           "Convert all inputs, even those that have not "
+                           "changed since the last conversion.", false);
+
+    TCLAP::SwitchArg compressIndices("c", "compress-indices",
+                                     "Store delta and varint coded indices. "
+                                     "Requires a reader supporting version 3 "
+                                     "asset files.", false);
+
+    TCLAP::ValueArg<unsigned int> parts("p", "parts",
+                                        "Split meshes into parts of at most "
+                                        "this many triangles so they can be "
+                                        "streamed. Requires a reader supporting "
+                                        "version 3 asset files.",
+                                        false, 0, "Triangles");
+
+    TCLAP::SwitchArg clusters("k", "clusters",
+                              "Split meshes of 4096 triangles or more into "
+                              "clusters of about 128 triangles with bounds "
+                              "and normal cones, culled one by one at render "
+                              "time. Readers that predate clusters ignore "
+                              "them.", false);
+
+    TCLAP::SwitchArg lods("l", "lods",
+                          "Store levels of detail with 50, 25, 10 and 5% of "
+                          "the triangles of every mesh, generated by quadric "
+                          "error simplification. Readers that predate levels "
+                          "of detail ignore them.", false);
+
+    TCLAP::SwitchArg benchmark("b", "benchmark",
+                               "Time the native PLY, STL and OBJ importers "
+                               "against assimp and print their throughput.",
+                               false);
 
     cmd.xorAdd(inputs, directory);
     cmd.add(outputDir);
+    cmd.add(quantize);
+    cmd.add(compressIndices);
+    cmd.add(parts);
+    cmd.add(clusters);
+    cmd.add(lods);
+    cmd.add(jobs);
+    cmd.add(forceArg);
+    cmd.add(benchmark);
     cmd.parse(argc, argv);
 
     // If inputs have been set, go ahead and add them to the list of inut files.
@@ -128,10 +257,13 @@ int main(int argc, char* argv[])
         
         if (boost::filesystem::is_regular_file(path))
         {
-          // Ensure the file has the correct extension (.dae)
+          // Ensure the file has the correct extension (.dae, or one of the
+          // formats spire imports natively).
           std::string extension = path.extension().string();
           std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
-          if (extension == ".dae")
+          spire::MeshFileFormat format;
+          if (   extension == ".dae"
+              || spire::getMeshFileFormat(path.generic_string(), format))
             inputFiles.push_back(path.generic_string());
         }
 
@@ -154,6 +286,14 @@ int main(int argc, char* argv[])
     }
 
     outputDirectory = outputDir.getValue();
+    options.quantize = quantize.getValue();
+    options.compressIndices = compressIndices.getValue();
+    options.partTriangles = parts.getValue();
+    options.clusters = clusters.getValue();
+    options.lods = lods.getValue();
+    options.benchmark = benchmark.getValue();
+    numJobs = jobs.getValue();
+    force = forceArg.getValue();
   }
   catch (const TCLAP::ArgException& e)
   {
@@ -167,8 +307,15 @@ int main(int argc, char* argv[])
     std::cout << i << std::endl;
   }
 
-  // Initialize assimp.
-  createAssimpLogger();
+  if (numJobs == 0)
+    numJobs = std::max(1u, std::thread::hardware_concurrency());
+  numJobs = std::min(numJobs, static_cast<unsigned int>(inputFiles.size()));
+
+  // Initialize assimp. The verbose default logger is shared by all importers
+  // and would interleave output from different files, so it is only used when
+  // converting serially.
+  if (numJobs <= 1)
+    createAssimpLogger();
   std::cout << "Assimp initialized." << std::endl;
 
   // Determine IL Version
@@ -182,73 +329,130 @@ int main(int argc, char* argv[])
   }
 
   ilInit();
-  
-  int lastExitCode = EXIT_SUCCESS;
-  for (auto i : inputFiles)
+
+  // The cache lives next to the outputs.
+  std::string cacheDir = outputDirectory.empty() ? "." : outputDirectory;
+  std::unique_ptr<ConversionCache> cache(
+      new ConversionCache(cacheDir + "/.assetconv_cache", force));
+
+  // Workers pull the next input off of a shared counter until none are left.
+  std::atomic<size_t> nextInput(0);
+  std::atomic<int> exitCode(EXIT_SUCCESS);
+  auto worker = [&]()
   {
-    lastExitCode = processFile(i, outputDirectory);
+    for (size_t i = nextInput++; i < inputFiles.size(); i = nextInput++)
+    {
+      int result = EXIT_FAILURE;
+      try
+      {
+        result = processFile(inputFiles[i], outputDirectory, options, cache.get());
+      }
+      catch (const std::exception& e)
+      {
+        printLine("Error converting " + inputFiles[i] + ": " + e.what());
+      }
+      if (result != EXIT_SUCCESS)
+        exitCode = result;
+    }
+  };
+
+  // Files are converted as tasks on the shared thread pool, which also runs
+  // the parallel loops inside each conversion. Those loops only spread to
+  // idle workers, so converting several files at once does not oversubscribe
+  // the cores.
+  if (numJobs > 1 + spire::ThreadPool::getShared()->getNumThreads())
+    spire::ThreadPool::setSharedNumThreads(numJobs - 1);
+  std::shared_ptr<spire::ThreadPool> pool = spire::ThreadPool::getShared();
+  std::vector<std::future<void>> conversions;
+  for (unsigned int i = 1; i < numJobs; ++i)
+    conversions.push_back(pool->async(worker));
+  worker();
+  for (auto it = conversions.begin(); it != conversions.end(); ++it)
+    it->get();
+
+  try
+  {
+    cache->save();
+  }
+  catch (const std::exception& e)
+  {
+    std::cout << "Unable to save conversion cache: " << e.what() << std::endl;
   }
 
-  return lastExitCode;
+  if (numJobs <= 1)
+    destroyAssimpLogger();
+
+  return exitCode;
 }
 
-int processFile(const std::string& inFile, const std::string& outputDirectory)
+//------------------------------------------------------------------------------
+/// Converts an assimp mesh into the representation used by spire's asset file
+/// writer. Quads are split into two triangles the same way the version 1
+/// writer does it.
+spire::AssetMesh convertMesh(const struct aiMesh* mesh)
 {
-  std::string outFile;
-
-  if (outputDirectory.length() > 0)
+  spire::AssetMesh out;
+  out.vbo.resize(mesh->mNumVertices * sizeof(float) * 6);
+  float* vboPtr = reinterpret_cast<float*>(&out.vbo[0]);
+  for (size_t j = 0; j < mesh->mNumVertices; j++)
   {
-    // Convert the filename to a path so we can extract path information.
-    boost::filesystem::path boostPath(inFile);
-    boost::filesystem::path outputFilePath(outputDirectory + "/" + boostPath.filename().string());
-
-    outputFilePath.replace_extension(".sp");
-    outFile = outputFilePath.string();
+    vboPtr[0] = mesh->mVertices[j].x;
+    vboPtr[1] = mesh->mVertices[j].y;
+    vboPtr[2] = mesh->mVertices[j].z;
+    vboPtr[3] = mesh->mNormals[j].x;
+    vboPtr[4] = mesh->mNormals[j].y;
+    vboPtr[5] = mesh->mNormals[j].z;
+    vboPtr += 6;
   }
-  else
+
+  out.indices.reserve(mesh->mNumFaces * 3);
+  for (size_t j = 0; j < mesh->mNumFaces; j++)
   {
-    boost::filesystem::path boostPath(inFile);
-    boostPath.replace_extension(".sp");
-    outFile = boostPath.string();
+    const unsigned int* idx = mesh->mFaces[j].mIndices;
+    if (mesh->mFaces[j].mNumIndices == 3)
+    {
+      out.indices.insert(out.indices.end(), {idx[0], idx[1], idx[2]});
+    }
+    else if (mesh->mFaces[j].mNumIndices == 4)
+    {
+      out.indices.insert(out.indices.end(), {idx[0], idx[1], idx[2]});
+      out.indices.insert(out.indices.end(), {idx[3], idx[2], idx[1]});
+    }
   }
 
-  std::cout << "Target output file: " << outFile << std::endl;
-
-  const aiScene* scene = nullptr;
-  Assimp::Importer importer;
+  return out;
+}
 
-  scene = importer.ReadFile(inFile,
-    aiProcess_MakeLeftHanded |
-    aiProcess_FlipWindingOrder |
-    aiProcess_CalcTangentSpace |
-    aiProcess_LimitBoneWeights |
-    aiProcess_JoinIdenticalVertices |
-    aiProcess_ImproveCacheLocality |
-    aiProcess_LimitBoneWeights |
-    aiProcess_RemoveRedundantMaterials |
-    aiProcess_GenUVCoords |
-    aiProcess_FindDegenerates |
-    aiProcess_FindInvalidData |
-    aiProcess_FindInstances |
-    aiProcess_ValidateDataStructure |
-    aiProcess_OptimizeMeshes); 
+//------------------------------------------------------------------------------
+template <typename T>
+void appendValue(std::vector<uint8_t>& buffer, const T& value)
+{
+  const uint8_t* raw = reinterpret_cast<const uint8_t*>(&value);
+  buffer.insert(buffer.end(), raw, raw + sizeof(T));
+}
 
-  if (!scene)
+//------------------------------------------------------------------------------
+/// Serializes 'scene' into the version 1 asset format.
+void buildVersion1Asset(const aiScene* scene, std::vector<uint8_t>& buffer)
+{
+  // Reserve the worst case (all quads) up front so the buffer never grows.
+  size_t reserveSize = 8 + sizeof(uint32_t);
+  for (size_t i = 0; i < scene->mNumMeshes; i++)
   {
-    std::cout << "Error: " << importer.GetErrorString() << std::endl;
-    return EXIT_FAILURE;
+    reserveSize += 2 * sizeof(uint32_t)
+        + scene->mMeshes[i]->mNumVertices * sizeof(float) * 6
+        + scene->mMeshes[i]->mNumFaces * (1 + 6 * sizeof(uint16_t));
   }
+  buffer.clear();
+  buffer.reserve(reserveSize);
 
   std::string header = "SCR5";
 
-  // Open file for output.
-  std::ofstream output(outFile, std::ofstream::binary);
-
   // Write out the file header.
-  output.write(header.c_str(), header.length());
+  buffer.insert(buffer.end(), header.begin(), header.end());
 
   // Write out number of meshes contained in the file.
-  output.write(reinterpret_cast<const char*>(&scene->mNumMeshes), sizeof(uint32_t));
+  appendValue(buffer, static_cast<uint32_t>(scene->mNumMeshes));
 
   /// \todo There are a lot of potential errors in the following code.
   ///       Most of the errors come from relying on unsigned int values
@@ -261,76 +465,375 @@ int processFile(const std::string& inFile, const std::string& outputDirectory)
     assert(mesh->mNumVertices > 0);
 
     // Write out VBO data.
-    output.write(reinterpret_cast<const char*>(&mesh->mNumVertices), sizeof(uint32_t));
+    appendValue(buffer, static_cast<uint32_t>(mesh->mNumVertices));
     for (size_t j = 0; j < mesh->mNumVertices; j++)
     {
-      // Position data
-      output.write(reinterpret_cast<const char*>(&mesh->mVertices[j].x), sizeof(float));
-      output.write(reinterpret_cast<const char*>(&mesh->mVertices[j].y), sizeof(float));
-      output.write(reinterpret_cast<const char*>(&mesh->mVertices[j].z), sizeof(float));
-
-      // Normal data
-      output.write(reinterpret_cast<const char*>(&mesh->mNormals[j].x), sizeof(float));
-      output.write(reinterpret_cast<const char*>(&mesh->mNormals[j].y), sizeof(float));
-      output.write(reinterpret_cast<const char*>(&mesh->mNormals[j].z), sizeof(float));
+      float vertex[6] = {
+        mesh->mVertices[j].x, mesh->mVertices[j].y, mesh->mVertices[j].z,
+        mesh->mNormals[j].x,  mesh->mNormals[j].y,  mesh->mNormals[j].z };
+      appendValue(buffer, vertex);
     }
 
     // Write out IBO data.
-    output.write(reinterpret_cast<const char*>(&mesh->mNumFaces), sizeof(uint32_t));
+    appendValue(buffer, static_cast<uint32_t>(mesh->mNumFaces));
     for (size_t j = 0; j < mesh->mNumFaces; j++)
     {
+      const unsigned int* idx = mesh->mFaces[j].mIndices;
       uint8_t numIndices = static_cast<uint8_t>(mesh->mFaces[j].mNumIndices);
-      output.write(reinterpret_cast<const char*>(&numIndices), sizeof(uint8_t));
+      appendValue(buffer, numIndices);
       if (numIndices == 3)
       {
         // Handle triangles.
 
         // The following is a precaution until we can start using 32 bit data.
-        // But we still write the indices out using 32 bit data.
-        assert(mesh->mFaces[j].mIndices[0] < 65536);
-        assert(mesh->mFaces[j].mIndices[1] < 65536);
-        assert(mesh->mFaces[j].mIndices[2] < 65536);
-
-        uint16_t index0 = static_cast<uint16_t>(mesh->mFaces[j].mIndices[0]);
-        uint16_t index1 = static_cast<uint16_t>(mesh->mFaces[j].mIndices[1]);
-        uint16_t index2 = static_cast<uint16_t>(mesh->mFaces[j].mIndices[2]);
-        output.write(reinterpret_cast<const char*>(&index0), sizeof(uint16_t));
-        output.write(reinterpret_cast<const char*>(&index1), sizeof(uint16_t));
-        output.write(reinterpret_cast<const char*>(&index2), sizeof(uint16_t));
+        assert(idx[0] < 65536 && idx[1] < 65536 && idx[2] < 65536);
+
+        uint16_t tri[3] = { static_cast<uint16_t>(idx[0]),
+                            static_cast<uint16_t>(idx[1]),
+                            static_cast<uint16_t>(idx[2]) };
+        appendValue(buffer, tri);
       }
       else if (numIndices == 4)
       {
         // Handle quads. Need to convert to triangles. Ensure to swap winding
         // order of the quads.
-        
+
         // The following is a precaution until we can start using 32 bit data.
-        // But we still write the indices out using 32 bit data.
-        assert(mesh->mFaces[j].mIndices[0] < 65536);
-        assert(mesh->mFaces[j].mIndices[1] < 65536);
-        assert(mesh->mFaces[j].mIndices[2] < 65536);
-        assert(mesh->mFaces[j].mIndices[3] < 65536);
-
-        uint16_t index0 = static_cast<uint16_t>(mesh->mFaces[j].mIndices[0]);
-        uint16_t index1 = static_cast<uint16_t>(mesh->mFaces[j].mIndices[1]);
-        uint16_t index2 = static_cast<uint16_t>(mesh->mFaces[j].mIndices[2]);
-        uint16_t index3 = static_cast<uint16_t>(mesh->mFaces[j].mIndices[3]);
-
-        // First triangle.
-        output.write(reinterpret_cast<const char*>(&index0), sizeof(uint16_t));
-        output.write(reinterpret_cast<const char*>(&index1), sizeof(uint16_t));
-        output.write(reinterpret_cast<const char*>(&index2), sizeof(uint16_t));
-
-        // Second triangle (opposite winding order).
-        output.write(reinterpret_cast<const char*>(&index3), sizeof(uint16_t));
-        output.write(reinterpret_cast<const char*>(&index2), sizeof(uint16_t));
-        output.write(reinterpret_cast<const char*>(&index1), sizeof(uint16_t));
+        assert(   idx[0] < 65536 && idx[1] < 65536
+               && idx[2] < 65536 && idx[3] < 65536);
+
+        // First triangle, then the second triangle (opposite winding order).
+        uint16_t tris[6] = { static_cast<uint16_t>(idx[0]),
+                             static_cast<uint16_t>(idx[1]),
+                             static_cast<uint16_t>(idx[2]),
+                             static_cast<uint16_t>(idx[3]),
+                             static_cast<uint16_t>(idx[2]),
+                             static_cast<uint16_t>(idx[1]) };
+        appendValue(buffer, tris);
       }
     }
   }
-  uint32_t voidIndex = 0;
-  output.write(reinterpret_cast<const char*>(&voidIndex), sizeof(uint32_t));
+  appendValue(buffer, static_cast<uint32_t>(0));
+}
+
+//------------------------------------------------------------------------------
+/// Splits a float mesh into clusters in place, if it is large enough to
+/// benefit. Must run before quantizeMesh.
+void clusterMesh(spire::AssetMesh& mesh)
+{
+  if (mesh.indices.size() / 3 < spire::MESH_CLUSTER_MIN_TRIANGLES)
+    return;
+  spire::buildMeshClusters(mesh.vbo.empty() ? nullptr : &mesh.vbo[0],
+                           sizeof(float) * 6, 0, mesh.numVertices(),
+                           mesh.indices, mesh.clusters);
+}
+
+//------------------------------------------------------------------------------
+/// Adds the levels of detail of LOD_RATIOS to a float mesh and prints how
+/// long they took and how far each one deviates from the mesh. Must run
+/// before quantizeMesh.
+void buildLODs(spire::AssetMesh& mesh, const std::string& name)
+{
+  typedef std::chrono::high_resolution_clock Clock;
+  Clock::time_point start = Clock::now();
+  spire::simplifyMesh(mesh.vbo.empty() ? nullptr : &mesh.vbo[0],
+                      sizeof(float) * 6, 0, sizeof(float) * 3,
+                      mesh.numVertices(), mesh.indices, LOD_RATIOS, mesh.lods);
+
+  // Small meshes run out of collapses: levels that remove nothing, or
+  // everything, are not worth storing.
+  size_t previous = mesh.indices.size();
+  auto useless = [&previous](const spire::MeshLOD& lod)
+  {
+    bool drop = lod.indices.empty() || lod.indices.size() >= previous;
+    previous = std::min(previous, lod.indices.size());
+    return drop;
+  };
+  mesh.lods.erase(std::remove_if(mesh.lods.begin(), mesh.lods.end(), useless),
+                  mesh.lods.end());
+  for (auto it = mesh.lods.begin(); it != mesh.lods.end(); ++it)
+    spire::optimizeVertexCache(it->indices, mesh.numVertices());
+  double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+  std::ostringstream report;
+  report << "LODs " << name << ": " << mesh.indices.size() / 3
+         << " triangles in " << ms << " ms:";
+  for (auto it = mesh.lods.begin(); it != mesh.lods.end(); ++it)
+    report << " " << it->indices.size() / 3 << " (error " << it->error << ")";
+  printLine(report.str());
+}
 
+//------------------------------------------------------------------------------
+/// Converts a float mesh to the quantized vertex format in place.
+void quantizeMesh(spire::AssetMesh& mesh)
+{
+  std::vector<uint8_t> quantized;
+  mesh.quantization = spire::quantizeVertices(
+      mesh.vbo, sizeof(float) * 6, 0, sizeof(float) * 3, quantized);
+  mesh.vbo.swap(quantized);
+  mesh.vertexFormat = spire::ASSET_VERTEX_QUANTIZED;
+}
+
+//------------------------------------------------------------------------------
+/// Reads the entire contents of 'filename' into 'contents'.
+bool readFileContents(const std::string& filename, std::vector<char>& contents)
+{
+  std::ifstream input(filename, std::ifstream::binary);
+  if (!input)
+    return false;
+
+  input.seekg(0, std::ifstream::end);
+  std::streamoff size = input.tellg();
+  input.seekg(0, std::ifstream::beg);
+  contents.resize(static_cast<size_t>(size));
+  if (size > 0)
+    input.read(&contents[0], size);
+  return static_cast<bool>(input);
+}
+
+//------------------------------------------------------------------------------
+/// Imports 'inFile' with spire's PLY / STL / OBJ importers. The resulting mesh
+/// is stored as is: unlike the assimp path the geometry is not converted to a
+/// left handed coordinate system.
+bool convertNativeFile(const std::string& inFile, spire::MeshFileFormat format,
+                       const ConvOptions& options, std::vector<uint8_t>& buffer)
+{
+  std::vector<char> contents;
+  if (!readFileContents(inFile, contents))
+  {
+    printLine("Error: unable to read " + inFile);
+    return false;
+  }
+
+  std::vector<spire::AssetMesh> meshes(1);
+  try
+  {
+    spire::importMesh(contents.empty() ? nullptr : &contents[0],
+                      contents.size(), format, meshes[0]);
+  }
+  catch (const std::exception& e)
+  {
+    printLine("Error: " + inFile + ": " + e.what());
+    return false;
+  }
+
+  // Compressed indices are smallest when neighbouring triangles reference
+  // nearby vertices. Assimp imports already get this from
+  // aiProcess_ImproveCacheLocality. Clusters keep most of the order.
+  if (options.compressIndices || options.clusters)
+    spire::optimizeMesh(meshes[0].vbo, sizeof(float) * 6, 0, meshes[0].indices);
+
+  if (options.lods)
+    buildLODs(meshes[0], inFile);
+
+  if (options.clusters)
+    clusterMesh(meshes[0]);
+
+  if (options.quantize)
+    quantizeMesh(meshes[0]);
+
+  // Native imports may exceed 16 bit indices, so they always use the version
+  // 2 (or 3) asset file.
+  spire::serializeAssetFile(meshes, buffer, options.writeOptions());
+  return true;
+}
+
+//------------------------------------------------------------------------------
+/// Imports 'inFile' with both the native importer and assimp and prints the
+/// throughput of each. The file is read into memory once beforehand so the
+/// native timing excludes disk access; assimp reads through the OS cache.
+void benchmarkImport(const std::string& inFile, spire::MeshFileFormat format)
+{
+  typedef std::chrono::high_resolution_clock Clock;
+
+  std::vector<char> contents;
+  if (!readFileContents(inFile, contents))
+  {
+    printLine("Error: unable to read " + inFile);
+    return;
+  }
+  double megabytes = static_cast<double>(contents.size()) / (1024.0 * 1024.0);
+
+  auto seconds = [](Clock::time_point begin, Clock::time_point end)
+  {
+    return std::chrono::duration<double>(end - begin).count();
+  };
+
+  std::ostringstream report;
+  report << "Benchmark " << inFile << " (" << megabytes << " MB):";
+
+  spire::AssetMesh mesh;
+  Clock::time_point start = Clock::now();
+  try
+  {
+    spire::importMesh(contents.empty() ? nullptr : &contents[0],
+                      contents.size(), format, mesh);
+    double elapsed = seconds(start, Clock::now());
+    report << " native " << elapsed * 1000.0 << " ms ("
+           << megabytes / elapsed << " MB/s, "
+           << mesh.indices.size() / 3 << " triangles)";
+  }
+  catch (const std::exception& e)
+  {
+    report << " native failed (" << e.what() << ")";
+  }
+
+  // Request the same work from assimp: triangulation, welding and normals.
+  Assimp::Importer importer;
+  start = Clock::now();
+  const aiScene* scene = importer.ReadFile(inFile,
+    aiProcess_Triangulate |
+    aiProcess_JoinIdenticalVertices |
+    aiProcess_GenSmoothNormals);
+  double elapsed = seconds(start, Clock::now());
+  if (scene)
+    report << ", assimp " << elapsed * 1000.0 << " ms ("
+           << megabytes / elapsed << " MB/s)";
+  else
+    report << ", assimp failed (" << importer.GetErrorString() << ")";
+
+  printLine(report.str());
+}
+
+//------------------------------------------------------------------------------
+/// Imports 'inFile' through assimp and serializes every mesh it contains.
+bool convertAssimpFile(const std::string& inFile, const ConvOptions& options,
+                       std::vector<uint8_t>& buffer)
+{
+  const aiScene* scene = nullptr;
+  Assimp::Importer importer;
+
+  scene = importer.ReadFile(inFile,
+    aiProcess_MakeLeftHanded |
+    aiProcess_FlipWindingOrder |
+    aiProcess_CalcTangentSpace |
+    aiProcess_LimitBoneWeights |
+    aiProcess_JoinIdenticalVertices |
+    aiProcess_ImproveCacheLocality |
+    aiProcess_LimitBoneWeights |
+    aiProcess_RemoveRedundantMaterials |
+    aiProcess_GenUVCoords |
+    aiProcess_FindDegenerates |
+    aiProcess_FindInvalidData |
+    aiProcess_FindInstances |
+    aiProcess_ValidateDataStructure |
+    aiProcess_OptimizeMeshes); 
+
+  if (!scene)
+  {
+    printLine(std::string("Error: ") + importer.GetErrorString());
+    return false;
+  }
+
+  if (   options.quantize || options.compressIndices || options.partTriangles > 0
+      || options.clusters || options.lods)
+  {
+    // Quantized vertices, compressed indices, parts, clusters and levels of
+    // detail require the newer asset file versions.
+    std::vector<spire::AssetMesh> meshes;
+    for (size_t i = 0; i < scene->mNumMeshes; i++)
+      meshes.push_back(convertMesh(scene->mMeshes[i]));
+
+    // Simplification dominates, so meshes are processed in parallel.
+    spire::parallelFor(meshes.size(), [&](size_t i)
+    {
+      spire::AssetMesh& mesh = meshes[i];
+      if (options.lods)
+      {
+        std::ostringstream name;
+        name << inFile << " mesh " << i;
+        buildLODs(mesh, name.str());
+      }
+      if (options.clusters)
+        clusterMesh(mesh);
+      if (options.quantize)
+        quantizeMesh(mesh);
+    });
+
+    spire::serializeAssetFile(meshes, buffer, options.writeOptions());
+  }
+  else
+  {
+    buildVersion1Asset(scene, buffer);
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+int processFile(const std::string& inFile, const std::string& outputDirectory,
+                const ConvOptions& options, ConversionCache* cache)
+{
+  std::string outFile;
+
+  if (outputDirectory.length() > 0)
+  {
+    // Convert the filename to a path so we can extract path information.
+    boost::filesystem::path boostPath(inFile);
+    boost::filesystem::path outputFilePath(outputDirectory + "/" + boostPath.filename().string());
+
+    outputFilePath.replace_extension(".sp");
+    outFile = outputFilePath.string();
+  }
+  else
+  {
+    boost::filesystem::path boostPath(inFile);
+    boostPath.replace_extension(".sp");
+    outFile = boostPath.string();
+  }
+
+  spire::MeshFileFormat benchmarkFormat;
+  if (options.benchmark && spire::getMeshFileFormat(inFile, benchmarkFormat))
+    benchmarkImport(inFile, benchmarkFormat);
+
+  // Skip inputs whose contents (and conversion options) have not changed
+  // since the last time they were converted.
+  uint64_t inputHash = 0;
+  if (cache)
+  {
+    try
+    {
+      inputHash = ConversionCache::hashFile(inFile, options.hashSeed());
+    }
+    catch (const std::exception& e)
+    {
+      printLine(std::string("Error: ") + e.what());
+      return EXIT_FAILURE;
+    }
+
+    if (cache->isUpToDate(outFile, inputHash))
+    {
+      printLine("Up to date: " + outFile);
+      return EXIT_SUCCESS;
+    }
+  }
+
+  printLine("Target output file: " + outFile);
+
+  // The entire file is built in memory and written with a single call.
+  std::vector<uint8_t> buffer;
+  spire::MeshFileFormat nativeFormat;
+  if (spire::getMeshFileFormat(inFile, nativeFormat))
+  {
+    if (!convertNativeFile(inFile, nativeFormat, options, buffer))
+      return EXIT_FAILURE;
+  }
+  else if (!convertAssimpFile(inFile, options, buffer))
+  {
+    return EXIT_FAILURE;
+  }
+
+  std::ofstream output(outFile, std::ofstream::binary);
+  output.write(reinterpret_cast<const char*>(&buffer[0]),
+               static_cast<std::streamsize>(buffer.size()));
   output.close();
+  if (!output)
+  {
+    printLine("Error: unable to write " + outFile);
+    return EXIT_FAILURE;
+  }
+
+  if (cache)
+    cache->update(outFile, inputHash);
 
   return EXIT_SUCCESS;
 }
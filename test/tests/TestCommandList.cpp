@@ -0,0 +1,258 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <batch-testing/GlobalGTestEnv.hpp>
+#include <batch-testing/SpireTestFixture.hpp>
+#include "namespaces.h"
+
+#include "spire/src/Common.h"
+#include "spire/src/CommandList.h"
+#include "spire/src/Exceptions.h"
+#include "spire/src/FramePrep.h"
+#include "spire/src/SceneBuffer.h"
+#include "spire/src/SpireObject.h"
+#include "spire/src/ThreadPool.h"
+
+#include "TestCamera.h"
+#include "TestCommon.h"
+
+using namespace spire;
+using namespace CPM_BATCH_TESTING_NS;
+
+namespace {
+
+//------------------------------------------------------------------------------
+/// Adds a quad VBO / IBO and the UniformColor shader, and an object
+/// 'prototype' drawing the quad in red.
+void addPrototype(std::shared_ptr<Interface> spire)
+{
+  addQuadResources(spire);
+  spire->addObject("prototype");
+  spire->addPassToObject("prototype", "UniformColor", "quad", "quad",
+                         Interface::TRIANGLE_STRIP);
+  spire->addObjectPassUniform("prototype", "uColor", V4(1.0f, 0.0f, 0.0f, 1.0f));
+}
+
+//------------------------------------------------------------------------------
+/// Builds a scene version of 'count' copies of 'prototype' scattered in a
+/// cube of size 2 * 'extent' around the origin.
+std::shared_ptr<const SceneVersion>
+makeScatteredScene(const SpireObject& prototype, size_t count, float extent)
+{
+  std::mt19937 rng(1234);
+  std::uniform_real_distribution<float> position(-extent, extent);
+
+  std::vector<std::shared_ptr<SpireObject>> objects;
+  for (size_t i = 0; i < count; ++i)
+  {
+    std::shared_ptr<SpireObject> object = prototype.clone();
+    M44 transform;
+    transform[3] = V4(position(rng), position(rng), position(rng), 1.0f);
+    object->setTransform(transform);
+    object->setBoundingSphere(V3(0.0f, 0.0f, 0.0f), 1.5f);
+    objects.push_back(object);
+  }
+  return makeScene(objects);
+}
+
+//------------------------------------------------------------------------------
+bool sameCommands(const std::vector<CommandList>& a,
+                  const std::vector<CommandList>& b)
+{
+  if (a.size() != b.size())
+    return false;
+  for (size_t l = 0; l < a.size(); ++l)
+  {
+    const std::vector<RenderCommand>& x = a[l].getCommands();
+    const std::vector<RenderCommand>& y = b[l].getCommands();
+    if (x.size() != y.size())
+      return false;
+    for (size_t i = 0; i < x.size(); ++i)
+    {
+      if (x[i].op != y[i].op)
+        return false;
+      bool same = true;
+      switch (x[i].op)
+      {
+        case RenderCommand::BIND_PROGRAM:
+          same = x[i].program == y[i].program;
+          break;
+        case RenderCommand::BIND_BUFFERS:
+          same =    x[i].buffers.vbo == y[i].buffers.vbo
+                 && x[i].buffers.ibo == y[i].buffers.ibo
+                 && x[i].buffers.numAttribs == y[i].buffers.numAttribs;
+          break;
+        case RenderCommand::DRAW:
+          same =    x[i].draw.count == y[i].draw.count
+                 && x[i].draw.primitive == y[i].draw.primitive;
+          break;
+        default:
+          same =    x[i].uniform.location == y[i].uniform.location
+                 && x[i].uniform.data == y[i].uniform.data;
+          break;
+      }
+      if (!same)
+        return false;
+    }
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, TestCommandListState)
+{
+  std::unique_ptr<TestCamera> myCamera = std::unique_ptr<TestCamera>(new TestCamera);
+  addPrototype(mSpire);
+  std::shared_ptr<const SceneVersion> scene =
+      makeScatteredScene(*mSpire->getObjectWithName("prototype"), 20000, 10.0f);
+
+  ThreadPool::setSharedNumThreads(1);
+  FramePrep prep;
+  prep.prepare(scene, myCamera->getWorldToProjection(),
+               std::vector<std::string>(1, SPIRE_DEFAULT_PASS));
+  const std::vector<DrawItem>& draws = prep.getDrawList();
+  ASSERT_LT(CommandList::DrawsPerList, draws.size());
+
+  std::vector<CommandList> reference;
+  recordCommandLists(draws, reference);
+  EXPECT_EQ((draws.size() + CommandList::DrawsPerList - 1)
+            / CommandList::DrawsPerList, reference.size());
+
+  // All copies share the program, buffers and uColor: every list sets them
+  // once. Only uProjIVObject changes from draw to draw.
+  NullCommandBackend backend;
+  for (auto it = reference.begin(); it != reference.end(); ++it)
+    replayCommandList(*it, backend);
+  EXPECT_EQ(draws.size(), backend.numDraws);
+  EXPECT_EQ(draws.size() * 4, backend.numIndices);
+  EXPECT_EQ(reference.size(), backend.numPrograms);
+  EXPECT_EQ(reference.size(), backend.numBufferBinds);
+  EXPECT_EQ(reference.size() + draws.size(), backend.numUniforms);
+
+  // Recording does not depend on the number of threads.
+  size_t numThreads[] = {2, 3, 8};
+  for (size_t i = 0; i < sizeof(numThreads) / sizeof(numThreads[0]); ++i)
+  {
+    ThreadPool::setSharedNumThreads(numThreads[i]);
+    std::vector<CommandList> lists;
+    recordCommandLists(draws, lists);
+    EXPECT_TRUE(sameCommands(reference, lists)) << numThreads[i];
+  }
+  ThreadPool::setSharedNumThreads(0);
+}
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, TestRenderPreparedFrameUniforms)
+{
+  std::unique_ptr<TestCamera> myCamera = std::unique_ptr<TestCamera>(new TestCamera);
+  addPrototype(mSpire);
+  mSpire->removeObject("prototype");
+
+  // uColor is not set on the object: recording fails until there is a
+  // global uColor.
+  mSpire->addObject("quad");
+  mSpire->addPassToObject("quad", "UniformColor", "quad", "quad",
+                          Interface::TRIANGLE_STRIP);
+  std::vector<std::string> passes = {SPIRE_DEFAULT_PASS};
+  mSpire->beginFrame();
+  EXPECT_EQ(1u, mSpire->prepareFrame(myCamera->getWorldToProjection(), passes));
+  EXPECT_THROW(mSpire->renderPreparedFrame(), ShaderUniformNotFound);
+
+  mSpire->addGlobalUniform("uColor", V4(0.0f, 1.0f, 0.0f, 1.0f));
+  beginFrame();
+  mSpire->renderPreparedFrame();
+  std::vector<uint8_t> pixel = readCenterPixel();
+  EXPECT_EQ(0, pixel[0]);
+  EXPECT_EQ(255, pixel[1]);
+}
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, DISABLED_TestCommandListBenchmark)
+{
+  std::unique_ptr<TestCamera> myCamera = std::unique_ptr<TestCamera>(new TestCamera);
+  addPrototype(mSpire);
+
+  // Wide enough for most of the objects to be visible.
+  const size_t numObjects = 100000;
+  std::shared_ptr<const SceneVersion> scene =
+      makeScatteredScene(*mSpire->getObjectWithName("prototype"), numObjects, 5.0f);
+  FramePrep prep;
+  prep.prepare(scene, myCamera->getWorldToProjection(),
+               std::vector<std::string>(1, SPIRE_DEFAULT_PASS));
+  const std::vector<DrawItem>& draws = prep.getDrawList();
+
+  size_t maxWorkers = std::max(2u, std::thread::hardware_concurrency()) - 1;
+  for (size_t workers = 1;; workers = std::min(workers * 2, maxWorkers))
+  {
+    ThreadPool::setSharedNumThreads(workers);
+    std::vector<CommandList> lists;
+    double record = 0.0;
+    double replay = 0.0;
+    size_t numCommands = 0;
+    for (int run = 0; run < 5; ++run)
+    {
+      std::chrono::high_resolution_clock::time_point start =
+          std::chrono::high_resolution_clock::now();
+      recordCommandLists(draws, lists);
+      std::chrono::high_resolution_clock::time_point recorded =
+          std::chrono::high_resolution_clock::now();
+
+      NullCommandBackend backend;
+      for (auto it = lists.begin(); it != lists.end(); ++it)
+        replayCommandList(*it, backend);
+      std::chrono::high_resolution_clock::time_point replayed =
+          std::chrono::high_resolution_clock::now();
+      EXPECT_EQ(draws.size(), backend.numDraws);
+
+      double recordMs = std::chrono::duration<double, std::milli>(recorded - start).count();
+      double replayMs = std::chrono::duration<double, std::milli>(replayed - recorded).count();
+      if (run == 0 || recordMs < record)
+        record = recordMs;
+      if (run == 0 || replayMs < replay)
+        replay = replayMs;
+      numCommands = backend.numPrograms + backend.numBufferBinds
+          + backend.numUniforms + backend.numDraws;
+    }
+
+    std::cout << "Command lists, " << draws.size() << " draws, " << numCommands
+              << " commands, " << workers + 1 << " threads: record " << record
+              << " ms, null replay " << replay << " ms" << std::endl;
+
+    if (workers == maxWorkers)
+      break;
+  }
+  ThreadPool::setSharedNumThreads(0);
+}
+
+} // namespace
@@ -0,0 +1,170 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <tuple>
+#include "TestCommon.h"
+
+#include "spire/src/CommandList.h"
+#include "spire/src/FramePrep.h"
+#include "spire/src/SceneBuffer.h"
+#include "spire/src/SpireObject.h"
+
+using namespace spire;
+
+//------------------------------------------------------------------------------
+std::vector<uint8_t> readCenterPixel()
+{
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  std::vector<uint8_t> pixel(4);
+  glReadPixels(viewport[0] + viewport[2] / 2, viewport[1] + viewport[3] / 2,
+               1, 1, GL_RGBA, GL_UNSIGNED_BYTE, &pixel[0]);
+  return pixel;
+}
+
+//------------------------------------------------------------------------------
+std::shared_ptr<const SceneVersion> makeScene(
+    const std::map<std::string, std::shared_ptr<const SpireObject>>& objects)
+{
+  std::vector<SceneVersion::Shard> shards(SceneVersion::NumShards);
+  for (auto it = objects.begin(); it != objects.end(); ++it)
+    shards[SceneVersion::getShardIndex(it->first)][it->first] = it->second;
+
+  std::shared_ptr<SceneVersion> scene = std::make_shared<SceneVersion>();
+  for (size_t i = 0; i < SceneVersion::NumShards; ++i)
+    scene->shards[i] = std::make_shared<const SceneVersion::Shard>(std::move(shards[i]));
+  scene->numObjects = objects.size();
+  return scene;
+}
+
+//------------------------------------------------------------------------------
+std::shared_ptr<const SceneVersion> makeScene(
+    const std::vector<std::shared_ptr<SpireObject>>& objects)
+{
+  std::map<std::string, std::shared_ptr<const SpireObject>> keyed;
+  for (size_t i = 0; i < objects.size(); ++i)
+    keyed["object" + std::to_string(i)] = objects[i];
+  return makeScene(keyed);
+}
+
+//------------------------------------------------------------------------------
+size_t countDrawnIndices(const FramePrep& prep)
+{
+  std::vector<CommandList> lists;
+  recordCommandLists(prep.getDrawList(), lists);
+  NullCommandBackend backend;
+  for (auto it = lists.begin(); it != lists.end(); ++it)
+    replayCommandList(*it, backend);
+  return backend.numIndices;
+}
+
+namespace {
+
+//------------------------------------------------------------------------------
+void addUniformColorShader(std::shared_ptr<Interface> spire)
+{
+  spire->addPersistentShader(
+      "UniformColor",
+      { std::make_tuple("UniformColor.vsh", Interface::VERTEX_SHADER),
+        std::make_tuple("UniformColor.fsh", Interface::FRAGMENT_SHADER),
+      });
+}
+
+} // namespace
+
+//------------------------------------------------------------------------------
+void addQuadResources(std::shared_ptr<Interface> spire)
+{
+  std::vector<float> vboData =
+  {
+    -1.0f,  1.0f,  0.0f,
+     1.0f,  1.0f,  0.0f,
+    -1.0f, -1.0f,  0.0f,
+     1.0f, -1.0f,  0.0f
+  };
+  std::vector<uint16_t> iboData = {0, 1, 2, 3};
+  spire->addVBO("quad", reinterpret_cast<uint8_t*>(&vboData[0]),
+                vboData.size() * sizeof(float), {"aPos"});
+  spire->addIBO("quad", reinterpret_cast<uint8_t*>(&iboData[0]),
+                iboData.size() * sizeof(uint16_t), Interface::IBO_16BIT);
+  addUniformColorShader(spire);
+}
+
+//------------------------------------------------------------------------------
+void addGridResources(std::shared_ptr<Interface> spire, size_t cells)
+{
+  std::vector<float> vboData;
+  for (size_t y = 0; y <= cells; ++y)
+  {
+    for (size_t x = 0; x <= cells; ++x)
+    {
+      vboData.push_back(2.0f * static_cast<float>(x) / static_cast<float>(cells) - 1.0f);
+      vboData.push_back(2.0f * static_cast<float>(y) / static_cast<float>(cells) - 1.0f);
+      vboData.push_back(0.0f);
+    }
+  }
+  std::vector<uint32_t> iboData;
+  uint32_t side = static_cast<uint32_t>(cells + 1);
+  for (uint32_t y = 0; y < cells; ++y)
+  {
+    for (uint32_t x = 0; x < cells; ++x)
+    {
+      uint32_t corner = y * side + x;
+      uint32_t quad[6] = {corner, corner + 1, corner + side,
+                          corner + 1, corner + side + 1, corner + side};
+      iboData.insert(iboData.end(), quad, quad + 6);
+    }
+  }
+  spire->addVBO("grid", reinterpret_cast<uint8_t*>(&vboData[0]),
+                vboData.size() * sizeof(float), {"aPos"});
+  spire->addIBO("grid", reinterpret_cast<uint8_t*>(&iboData[0]),
+                iboData.size() * sizeof(uint32_t), Interface::IBO_32BIT);
+  addUniformColorShader(spire);
+}
+
+//------------------------------------------------------------------------------
+void addGridObject(std::shared_ptr<Interface> spire, const std::string& name,
+                   const V3& position, float scale, const V4& color)
+{
+  spire->addObject(name);
+  spire->addPassToObject(name, "UniformColor", "grid", "grid",
+                         Interface::TRIANGLES);
+  spire->addObjectPassUniform(name, "uColor", color);
+  spire->setObjectTransform(name, makeTransform(position, scale));
+}
+
+//------------------------------------------------------------------------------
+M44 makeTransform(const V3& position, float scale)
+{
+  M44 transform;
+  transform[0][0] = scale;
+  transform[1][1] = scale;
+  transform[2][2] = scale;
+  transform[3] = V4(position, 1.0f);
+  return transform;
+}
@@ -37,4 +37,53 @@
 // compare the results to see if they are the same. If no golden images already
 // exist, then add the generated image to the directory of golden images.
 
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "namespaces.h"
+#include "spire/Interface.h"
+#include "spire/src/Common.h"
+
+namespace CPM_SPIRE_NS {
+class FramePrep;
+class SpireObject;
+struct SceneVersion;
+}
+
+/// RGBA pixel at the center of the viewport.
+std::vector<uint8_t> readCenterPixel();
+
+/// Builds a scene version holding 'objects' under their keys.
+std::shared_ptr<const spire::SceneVersion> makeScene(
+    const std::map<std::string, std::shared_ptr<const spire::SpireObject>>& objects);
+
+/// Builds a scene version holding 'objects'. The objects are often copies of
+/// one prototype, so they are keyed "object<index>" instead of by name.
+std::shared_ptr<const spire::SceneVersion> makeScene(
+    const std::vector<std::shared_ptr<spire::SpireObject>>& objects);
+
+/// Indices drawn by the draw list of 'prep'.
+size_t countDrawnIndices(const spire::FramePrep& prep);
+
+/// Adds a quad covering [-1, 1] in x and y as VBO / IBO "quad", drawn as a
+/// triangle strip, and the UniformColor shader.
+void addQuadResources(std::shared_ptr<spire::Interface> spire);
+
+/// Adds a 'cells' by 'cells' grid covering [-1, 1] in x and y as VBO / IBO
+/// "grid", and the UniformColor shader.
+void addGridResources(std::shared_ptr<spire::Interface> spire, size_t cells);
+
+/// Adds an object drawing the grid in 'color', scaled by 'scale' at
+/// 'position'.
+void addGridObject(std::shared_ptr<spire::Interface> spire, const std::string& name,
+                   const spire::V3& position, float scale,
+                   const spire::V4& color = spire::V4(1.0f, 1.0f, 1.0f, 1.0f));
+
+/// Transform scaling by 'scale', then moving to 'position'.
+spire::M44 makeTransform(const spire::V3& position, float scale);
+
 #endif 
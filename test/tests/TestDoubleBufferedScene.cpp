@@ -0,0 +1,188 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <atomic>
+#include <thread>
+#include <batch-testing/GlobalGTestEnv.hpp>
+#include <batch-testing/SpireTestFixture.hpp>
+#include "namespaces.h"
+
+#include "spire/src/Common.h"
+
+#include "TestCamera.h"
+#include "TestCommon.h"
+
+using namespace spire;
+using namespace CPM_BATCH_TESTING_NS;
+
+namespace {
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, TestDoubleBufferedScene)
+{
+  std::unique_ptr<TestCamera> myCamera = std::unique_ptr<TestCamera>(new TestCamera);
+  std::vector<float> vboData = 
+  {
+    -1.0f,  1.0f,  0.0f,
+     1.0f,  1.0f,  0.0f,
+    -1.0f, -1.0f,  0.0f,
+     1.0f, -1.0f,  0.0f
+  };
+  std::vector<std::string> attribNames = {"aPos"};
+  std::vector<uint16_t> iboData = {0, 1, 2, 3};
+
+  mSpire->addVBO("quad", reinterpret_cast<uint8_t*>(&vboData[0]),
+                 vboData.size() * sizeof(float), attribNames);
+  mSpire->addIBO("quad", reinterpret_cast<uint8_t*>(&iboData[0]),
+                 iboData.size() * sizeof(uint16_t), Interface::IBO_16BIT);
+  mSpire->addPersistentShader(
+      "UniformColor", 
+      { std::make_tuple("UniformColor.vsh", Interface::VERTEX_SHADER), 
+        std::make_tuple("UniformColor.fsh", Interface::FRAGMENT_SHADER),
+      });
+  mSpire->addGlobalUniform("uProjIVObject", myCamera->getWorldToProjection());
+
+  mSpire->addObject("quad");
+  mSpire->addPassToObject("quad", "UniformColor", "quad", "quad",
+                          Interface::TRIANGLE_STRIP);
+  mSpire->addObjectPassUniform("quad", "uColor", V4(1.0f, 0.0f, 0.0f, 1.0f));
+
+  // No longer needed, the pass keeps the buffers alive.
+  mSpire->removeVBO("quad");
+  mSpire->removeIBO("quad");
+
+  mSpire->beginFrame();
+  beginFrame();
+  mSpire->renderObject("quad");
+  EXPECT_EQ(255, readCenterPixel()[0]);
+
+  // Edits from another thread go to the back copy. The renderer keeps
+  // drawing the published scene.
+  std::thread editor([this]()
+  {
+    mSpire->addObjectPassUniform("quad", "uColor", V4(0.5f, 0.0f, 0.0f, 1.0f));
+    mSpire->addObjectPassUniform("quad", "uColor", V4(0.0f, 1.0f, 0.0f, 1.0f));
+    mSpire->addObject("other");
+  });
+  editor.join();
+
+  EXPECT_EQ(2u, mSpire->getNumObjects());
+  EXPECT_EQ(V4(0.0f, 1.0f, 0.0f, 1.0f),
+            mSpire->getObjectPassUniform<V4>("quad", "uColor"));
+  beginFrame();
+  mSpire->renderObject("quad");
+  EXPECT_EQ(255, readCenterPixel()[0]);
+  EXPECT_THROW(mSpire->renderObject("other"), std::out_of_range);
+
+  // The next frame shows all of the edits. Each uniform edit copied the
+  // quad; adding 'other' copied nothing.
+  mSpire->beginFrame();
+  EXPECT_EQ(2u, mSpire->getFrameStatistics().numObjectsCopied);
+  beginFrame();
+  mSpire->renderObject("quad");
+  mSpire->renderObject("other");
+  EXPECT_EQ(0, readCenterPixel()[0]);
+
+  // Removing the pass (and with it the last reference to the buffers) only
+  // takes effect at the next frame too.
+  std::thread remover([this]() {mSpire->removePassFromObject("quad", SPIRE_DEFAULT_PASS);});
+  remover.join();
+  beginFrame();
+  mSpire->renderObject("quad");
+  EXPECT_EQ(255, readCenterPixel()[1]);
+  mSpire->beginFrame();
+  beginFrame();
+  mSpire->renderObject("quad");
+  EXPECT_EQ(0, readCenterPixel()[1]);
+}
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, TestConcurrentSceneEdits)
+{
+  std::unique_ptr<TestCamera> myCamera = std::unique_ptr<TestCamera>(new TestCamera);
+  std::vector<float> vboData = 
+  {
+    -1.0f,  1.0f,  0.0f,
+     1.0f,  1.0f,  0.0f,
+    -1.0f, -1.0f,  0.0f,
+     1.0f, -1.0f,  0.0f
+  };
+  std::vector<uint16_t> iboData = {0, 1, 2, 3};
+  mSpire->addVBO("quad", reinterpret_cast<uint8_t*>(&vboData[0]),
+                 vboData.size() * sizeof(float), {"aPos"});
+  mSpire->addIBO("quad", reinterpret_cast<uint8_t*>(&iboData[0]),
+                 iboData.size() * sizeof(uint16_t), Interface::IBO_16BIT);
+  mSpire->addPersistentShader(
+      "UniformColor", 
+      { std::make_tuple("UniformColor.vsh", Interface::VERTEX_SHADER), 
+        std::make_tuple("UniformColor.fsh", Interface::FRAGMENT_SHADER),
+      });
+  mSpire->addGlobalUniform("uProjIVObject", myCamera->getWorldToProjection());
+  mSpire->addObject("quad");
+  mSpire->addPassToObject("quad", "UniformColor", "quad", "quad",
+                          Interface::TRIANGLE_STRIP);
+  mSpire->addObjectPassUniform("quad", "uColor", V4(1.0f, 0.0f, 0.0f, 1.0f));
+  mSpire->beginFrame();
+
+  // The editor flips the quad between black and red, and churns objects
+  // and passes, while the render thread draws and churns buffers. Every
+  // frame shows one of the two colors.
+  std::atomic<bool> done(false);
+  std::thread editor([this, &done]()
+  {
+    for (int i = 0; i < 2000; ++i)
+    {
+      float value = (i % 2) ? 1.0f : 0.0f;
+      mSpire->addObjectPassUniform("quad", "uColor", V4(value, 0.0f, 0.0f, 1.0f));
+      mSpire->addObjectGlobalUniform("quad", "uUnused", value);
+      mSpire->addObject("temp");
+      mSpire->addPassToObject("temp", "UniformColor", "quad", "quad",
+                              Interface::TRIANGLE_STRIP);
+      mSpire->removeObject("temp");
+    }
+    done = true;
+  });
+
+  size_t numFrames = 0;
+  while (!done || numFrames < 10)
+  {
+    mSpire->beginFrame();
+    beginFrame();
+    mSpire->renderObject("quad");
+    uint8_t red = readCenterPixel()[0];
+    EXPECT_TRUE(red == 0 || red == 255);
+    mSpire->addVBO("scratch", reinterpret_cast<uint8_t*>(&vboData[0]),
+                   vboData.size() * sizeof(float), {"aPos"});
+    mSpire->removeVBO("scratch");
+    ++numFrames;
+  }
+  editor.join();
+  EXPECT_EQ(1u, mSpire->getNumObjects());
+}
+
+} // namespace
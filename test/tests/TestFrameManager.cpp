@@ -0,0 +1,301 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <batch-testing/GlobalGTestEnv.hpp>
+#include <batch-testing/SpireTestFixture.hpp>
+#include "namespaces.h"
+
+#include "spire/src/Common.h"
+#include "spire/src/FrameManager.h"
+
+#include "TestCamera.h"
+#include "TestCommon.h"
+
+using namespace spire;
+using namespace CPM_BATCH_TESTING_NS;
+
+namespace {
+
+//------------------------------------------------------------------------------
+/// Renderer of 'numPasses' passes of 'drawsPerPass' draws, each pass
+/// 'indicesPerPass' indices at full detail. Fewer indices are drawn with the
+/// square of the pixel error, and a frame takes 0.5 ms plus 1 ms per 100
+/// draws plus 10 ms per million indices.
+struct SimulatedRenderer
+{
+  SimulatedRenderer(size_t draws, double indices) :
+      drawsPerPass(draws),
+      indicesPerPass(indices)
+  {}
+
+  FrameManager::FrameSample drawFrame(const FrameManager& manager) const
+  {
+    std::vector<std::string> passes = {"main", "transparent", "outline"};
+    std::vector<std::string> selected;
+    manager.selectPasses(passes, selected);
+
+    float error = std::max(manager.getPixelError(), 1.0f);
+    FrameManager::FrameSample sample;
+    sample.numDraws = drawsPerPass * selected.size();
+    sample.numIndices = static_cast<size_t>(
+        indicesPerPass * static_cast<double>(selected.size()) / (error * error));
+    sample.cpuMs = 0.5 + 0.01 * static_cast<double>(sample.numDraws)
+                   + 1.0e-5 * static_cast<double>(sample.numIndices);
+    sample.gpuMs = sample.cpuMs;
+    return sample;
+  }
+
+  size_t  drawsPerPass;
+  double  indicesPerPass;
+};
+
+//------------------------------------------------------------------------------
+/// Draws 'numFrames' frames. Returns the number of times the detail changed
+/// over the last 'tail' of them, and their longest frame time in 'maxMs'.
+size_t runFrames(FrameManager& manager, const SimulatedRenderer& renderer,
+                 size_t numFrames, size_t tail, double& maxMs)
+{
+  size_t changes = 0;
+  maxMs = 0.0;
+  float error = manager.getPixelError();
+  float cull = manager.getCullPixels();
+  size_t skipped = manager.getNumSkippedPasses();
+  for (size_t frame = 0; frame < numFrames; ++frame)
+  {
+    FrameManager::FrameSample sample = renderer.drawFrame(manager);
+    manager.endFrame(sample);
+    manager.update();
+    if (frame + tail >= numFrames)
+    {
+      maxMs = std::max(maxMs, sample.getFrameTime());
+      if (error != manager.getPixelError() || cull != manager.getCullPixels()
+          || skipped != manager.getNumSkippedPasses())
+        ++changes;
+    }
+    error = manager.getPixelError();
+    cull = manager.getCullPixels();
+    skipped = manager.getNumSkippedPasses();
+  }
+  return changes;
+}
+
+//------------------------------------------------------------------------------
+/// Adds an object drawing the quad scaled by 'scale' at 'position'.
+void addQuadObject(std::shared_ptr<Interface> spire, const std::string& name,
+                   const V3& position, float scale)
+{
+  spire->addObject(name);
+  spire->addPassToObject(name, "UniformColor", "quad", "quad",
+                         Interface::TRIANGLE_STRIP);
+  spire->addObjectPassUniform(name, "uColor", V4(1.0f, 1.0f, 1.0f, 1.0f));
+  spire->setObjectTransform(name, makeTransform(position, scale));
+}
+
+} // namespace
+
+//------------------------------------------------------------------------------
+TEST(FrameManager, TestCostModel)
+{
+  // time = 2 + 5 ms per 1000 draws + 8 ms per million indices.
+  FrameManager manager;
+  EXPECT_FALSE(manager.isEnabled());
+  for (size_t i = 0; i < 40; ++i)
+  {
+    FrameManager::FrameSample sample;
+    sample.numDraws = 100 + (i * 37) % 900;
+    sample.numIndices = 10000 + (i * 7919) % 20 * 100000;
+    sample.cpuMs = 2.0 + 0.005 * static_cast<double>(sample.numDraws)
+                   + 8.0e-6 * static_cast<double>(sample.numIndices);
+    sample.gpuMs = sample.cpuMs * 0.5;
+    manager.addSample(sample);
+  }
+  EXPECT_EQ(100u + (39 * 37) % 900, manager.getLastSample().numDraws);
+
+  EXPECT_NEAR(2.0 + 2.5 + 8.0, manager.predictFrameTime(500, 1000000), 0.1);
+  EXPECT_NEAR(2.0 + 0.5 + 1.6, manager.predictFrameTime(100, 200000), 0.1);
+  EXPECT_NEAR(0.005 * 10 + 8.0e-6 * 3000, manager.predictObjectTime(10, 3000), 0.01);
+  EXPECT_NEAR(1.0e6, manager.getIndexBudget(2.0 + 2.5 + 8.0, 500), 2.0e4);
+  EXPECT_EQ(0.0, manager.getIndexBudget(1.0, 500));
+
+  // Samples alone do not change the detail.
+  EXPECT_EQ(0.0f, manager.getPixelError());
+  EXPECT_EQ(0u, manager.getNumSkippedPasses());
+
+  // With draws and indices varying together, the time goes to the indices.
+  manager.clear();
+  EXPECT_EQ(0.0, manager.predictFrameTime(1000, 1000000));
+  for (size_t i = 1; i <= 20; ++i)
+  {
+    FrameManager::FrameSample sample;
+    sample.numDraws = i * 10;
+    sample.numIndices = i * 100000;
+    sample.cpuMs = 0.01 * static_cast<double>(sample.numIndices) * 1.0e-3;
+    manager.addSample(sample);
+  }
+  EXPECT_NEAR(10.0, manager.predictFrameTime(1000, 1000000), 0.1);
+  EXPECT_NEAR(5.0, manager.predictObjectTime(0, 500000), 0.1);
+}
+
+//------------------------------------------------------------------------------
+TEST(FrameManager, TestControl)
+{
+  FrameManager manager;
+  manager.setOptionalPasses({"transparent", "outline"});
+  std::vector<std::string> selected;
+  manager.selectPasses({"main", "outline", "transparent"}, selected);
+  EXPECT_EQ(3u, selected.size());
+
+  // Disabled, nothing changes however slow the frames are.
+  SimulatedRenderer heavy(100, 3.0e6);
+  double maxMs;
+  EXPECT_EQ(0u, runFrames(manager, heavy, 20, 20, maxMs));
+  EXPECT_NEAR(93.5, maxMs, 0.1);
+
+  // 93.5 ms at full detail: the pixel error settles between 2.7 and 4
+  // pixels and stays there, without culling objects or skipping passes.
+  manager.setTargetFrameTime(16.0);
+  EXPECT_EQ(0u, runFrames(manager, heavy, 200, 100, maxMs));
+  EXPECT_GE(16.0, maxMs);
+  EXPECT_LT(2.7f, manager.getPixelError());
+  EXPECT_GT(4.0f, manager.getPixelError());
+  EXPECT_EQ(0.0f, manager.getCullPixels());
+  EXPECT_EQ(0u, manager.getNumSkippedPasses());
+  EXPECT_LT(0.0, manager.getLastSample().numIndices);
+  EXPECT_LT(16.0 * (1.0 - FrameManager::Headroom) - 1.0,
+            manager.getLastSample().getFrameTime());
+
+  // Draws alone take 15 ms: the pixel error goes to its maximum, then the
+  // culled size, then the outline pass is skipped, and the rest fits.
+  SimulatedRenderer overloaded(500, 3.0e7);
+  EXPECT_EQ(0u, runFrames(manager, overloaded, 200, 100, maxMs));
+  EXPECT_GE(16.0, maxMs);
+  EXPECT_EQ(16.0f, manager.getPixelError());
+  EXPECT_EQ(16.0f, manager.getCullPixels());
+  EXPECT_EQ(1u, manager.getNumSkippedPasses());
+  manager.selectPasses({"main", "outline", "transparent"}, selected);
+  ASSERT_EQ(2u, selected.size());
+  EXPECT_EQ("main", selected[0]);
+  EXPECT_EQ("transparent", selected[1]);
+
+  // Once the scene is light, full detail and every pass come back.
+  SimulatedRenderer light(50, 1.0e5);
+  EXPECT_EQ(0u, runFrames(manager, light, 200, 100, maxMs));
+  EXPECT_GE(16.0, maxMs);
+  EXPECT_EQ(0.0f, manager.getPixelError());
+  EXPECT_EQ(0.0f, manager.getCullPixels());
+  EXPECT_EQ(0u, manager.getNumSkippedPasses());
+
+  // A lower maximum is applied right away; disabling restores full detail.
+  runFrames(manager, heavy, 100, 0, maxMs);
+  manager.setTargetFrameTime(16.0, 2.0f);
+  EXPECT_EQ(2.0f, manager.getPixelError());
+  manager.setTargetFrameTime(0.0);
+  EXPECT_EQ(0.0f, manager.getPixelError());
+  EXPECT_EQ(0u, manager.getNumSkippedPasses());
+  EXPECT_EQ(0u, runFrames(manager, heavy, 20, 20, maxMs));
+}
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, TestFrameTimeControl)
+{
+  std::unique_ptr<TestCamera> myCamera = std::unique_ptr<TestCamera>(new TestCamera);
+  addQuadResources(mSpire);
+
+  // A quad filling the center of the view, and 100 quads about a pixel
+  // wide around it.
+  addQuadObject(mSpire, "large", V3(0.0f, 0.0f, 0.0f), 0.5f);
+  const size_t numSmall = 100;
+  for (size_t i = 0; i < numSmall; ++i)
+  {
+    V3 position(0.2f * static_cast<float>(i % 10) - 0.9f,
+                0.2f * static_cast<float>(i / 10) - 0.9f, 1.0f);
+    addQuadObject(mSpire, "small" + std::to_string(i), position, 0.002f);
+  }
+
+  std::vector<std::string> passes = {SPIRE_DEFAULT_PASS};
+  auto renderFrame = [&]() -> size_t
+  {
+    size_t numVisible = mSpire->prepareFrame(myCamera->getWorldToProjection(), passes);
+    beginFrame();
+    mSpire->renderPreparedFrame();
+    uint8_t pixel[4];
+    glReadPixels(0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixel);
+    return numVisible;
+  };
+  mSpire->beginFrame();
+
+  // Without a target nothing is dropped, nor measured.
+  EXPECT_EQ(numSmall + 1, renderFrame());
+  Interface::FrameTiming timing = mSpire->getFrameTiming();
+  EXPECT_EQ(0.0, timing.cpuMs);
+  EXPECT_EQ(0.0f, timing.pixelError);
+
+  // A target no frame can hold: the pixel error goes to its maximum first,
+  // keeping every quad, then the small quads are dropped, the large one is
+  // not.
+  mSpire->setTargetFrameTime(1.0e-6, 8.0f);
+  size_t numVisible = 0;
+  for (int frame = 0; frame < 40; ++frame)
+  {
+    numVisible = renderFrame();
+    timing = mSpire->getFrameTiming();
+    if (timing.pixelError < 8.0f)
+    {
+      EXPECT_EQ(0.0f, timing.cullPixels);
+      EXPECT_EQ(numSmall + 1, numVisible);
+    }
+  }
+  timing = mSpire->getFrameTiming();
+  EXPECT_EQ(1u, numVisible);
+  EXPECT_EQ(8.0f, timing.pixelError);
+  EXPECT_EQ(8.0f, timing.cullPixels);
+  EXPECT_EQ(0u, timing.numSkippedPasses);
+  EXPECT_LT(0.0, timing.cpuMs);
+#ifdef SPIRE_TIMER_QUERIES
+  EXPECT_LE(0.0, timing.gpuMs);
+#endif
+
+  // A target any frame holds: detail comes back.
+  mSpire->setTargetFrameTime(1.0e4);
+  for (int frame = 0; frame < 120; ++frame)
+    numVisible = renderFrame();
+  EXPECT_EQ(numSmall + 1, numVisible);
+  EXPECT_EQ(0.0f, mSpire->getFrameTiming().pixelError);
+
+  // The host's own small feature culling is kept while it is coarser.
+  mSpire->setSmallFeatureCulling(4.0f, 480.0f);
+  EXPECT_EQ(1u, renderFrame());
+  mSpire->setTargetFrameTime(0.0);
+  EXPECT_EQ(1u, renderFrame());
+  mSpire->setSmallFeatureCulling(0.0f, 0.0f);
+  EXPECT_EQ(numSmall + 1, renderFrame());
+}
@@ -0,0 +1,476 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <batch-testing/GlobalGTestEnv.hpp>
+#include <batch-testing/SpireTestFixture.hpp>
+#include "namespaces.h"
+
+#include "spire/src/BoundingVolume.h"
+#include "spire/src/Common.h"
+#include "spire/src/FramePrep.h"
+#include "spire/src/SceneBuffer.h"
+#include "spire/src/SpireObject.h"
+#include "spire/src/ThreadPool.h"
+
+#include "TestCamera.h"
+#include "TestCommon.h"
+
+using namespace spire;
+using namespace CPM_BATCH_TESTING_NS;
+
+namespace {
+
+//------------------------------------------------------------------------------
+/// Copies of 'prototype' scattered in a cube of size 2 * 'extent' around the
+/// origin, with bounds.
+std::vector<std::shared_ptr<SpireObject>>
+scatterObjects(const SpireObject& prototype, size_t count, float extent)
+{
+  std::mt19937 rng(1234);
+  std::uniform_real_distribution<float> position(-extent, extent);
+
+  std::vector<std::shared_ptr<SpireObject>> objects;
+  for (size_t i = 0; i < count; ++i)
+  {
+    std::shared_ptr<SpireObject> object = prototype.clone();
+    M44 transform;
+    transform[3] = V4(position(rng), position(rng), position(rng), 1.0f);
+    object->setTransform(transform);
+    object->setBoundingSphere(V3(0.0f, 0.0f, 0.0f), 1.5f);
+    objects.push_back(object);
+  }
+  return objects;
+}
+
+//------------------------------------------------------------------------------
+bool sameDrawLists(const std::vector<DrawItem>& a, const std::vector<DrawItem>& b)
+{
+  if (a.size() != b.size())
+    return false;
+  for (size_t i = 0; i < a.size(); ++i)
+  {
+    if (   a[i].sortKey != b[i].sortKey || a[i].sequence != b[i].sequence
+        || a[i].pass != b[i].pass
+        || a[i].transforms->projIVObject != b[i].transforms->projIVObject)
+      return false;
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+TEST(FramePrep, TestFrustumAndSortKeys)
+{
+  M44 projection = glm::perspective(1.0f, 1.0f, 1.0f, 100.0f);
+  V4 planes[6];
+  FramePrep::extractFrustumPlanes(projection, planes);
+
+  EXPECT_TRUE(FramePrep::isSphereVisible(planes, V3(0.0f, 0.0f, -10.0f), 1.0f));
+  EXPECT_FALSE(FramePrep::isSphereVisible(planes, V3(0.0f, 0.0f, 10.0f), 1.0f));
+  EXPECT_FALSE(FramePrep::isSphereVisible(planes, V3(0.0f, 0.0f, -200.0f), 1.0f));
+  EXPECT_FALSE(FramePrep::isSphereVisible(planes, V3(50.0f, 0.0f, -10.0f), 1.0f));
+  // Outside of the frustum, but overlapping it.
+  EXPECT_TRUE(FramePrep::isSphereVisible(planes, V3(0.0f, 0.0f, -0.5f), 1.0f));
+
+  // Pass first, then program, then front to back.
+  EXPECT_LT(FramePrep::makeSortKey(0, 9, 100.0f), FramePrep::makeSortKey(1, 1, 1.0f));
+  EXPECT_LT(FramePrep::makeSortKey(0, 1, 100.0f), FramePrep::makeSortKey(0, 2, 1.0f));
+  EXPECT_LT(FramePrep::makeSortKey(0, 1, 1.0f), FramePrep::makeSortKey(0, 1, 1.5f));
+  EXPECT_EQ(FramePrep::makeSortKey(0, 1, -3.0f), FramePrep::makeSortKey(0, 1, 0.0f));
+}
+
+//------------------------------------------------------------------------------
+TEST(FramePrep, TestBoundingVolumes)
+{
+  // Interleaved position and normal, an odd number of vertices so that the
+  // scalar tail runs too.
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<float> value(-10.0f, 10.0f);
+  const size_t numVertices = 101;
+  std::vector<float> vertices(numVertices * 6);
+  for (auto it = vertices.begin(); it != vertices.end(); ++it)
+    *it = value(rng);
+
+  V3 expectedMin(vertices[0], vertices[1], vertices[2]);
+  V3 expectedMax = expectedMin;
+  for (size_t i = 0; i < numVertices; ++i)
+  {
+    V3 p(vertices[i * 6], vertices[i * 6 + 1], vertices[i * 6 + 2]);
+    expectedMin = glm::min(expectedMin, p);
+    expectedMax = glm::max(expectedMax, p);
+  }
+
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(&vertices[0]);
+  V3 min;
+  V3 max;
+  EXPECT_FALSE(computePositionBounds(data, 0, 6 * sizeof(float), 0, min, max));
+  ASSERT_TRUE(computePositionBounds(data, numVertices, 6 * sizeof(float), 0,
+                                    min, max));
+  EXPECT_EQ(expectedMin, min);
+  EXPECT_EQ(expectedMax, max);
+
+  V3 center = (min + max) * 0.5f;
+  float radius = computeBoundingRadius(data, numVertices, 6 * sizeof(float), 0,
+                                       center);
+  EXPECT_GE(glm::length(max - min) * 0.5f + 1e-4f, radius);
+  for (size_t i = 0; i < numVertices; ++i)
+  {
+    V3 p(vertices[i * 6], vertices[i * 6 + 1], vertices[i * 6 + 2]);
+    EXPECT_GE(radius + 1e-4f, glm::length(p - center));
+  }
+
+  // A box rotated a quarter turn around z swaps its x and y extents.
+  M44 transform;
+  transform[0] = V4(0.0f, 1.0f, 0.0f, 0.0f);
+  transform[1] = V4(-1.0f, 0.0f, 0.0f, 0.0f);
+  transform[3] = V4(5.0f, 0.0f, 0.0f, 1.0f);
+  V3 worldCenter;
+  V3 worldExtent;
+  transformBox(transform, V3(-1.0f, -2.0f, -3.0f), V3(1.0f, 2.0f, 3.0f),
+               worldCenter, worldExtent);
+  EXPECT_EQ(V3(5.0f, 0.0f, 0.0f), worldCenter);
+  EXPECT_EQ(V3(2.0f, 1.0f, 3.0f), worldExtent);
+
+  M44 projection = glm::perspective(1.0f, 1.0f, 1.0f, 100.0f);
+  V4 planes[6];
+  FramePrep::extractFrustumPlanes(projection, planes);
+  EXPECT_TRUE(FramePrep::isBoxVisible(planes, V3(0.0f, 0.0f, -10.0f), V3(1.0f, 1.0f, 1.0f)));
+  EXPECT_FALSE(FramePrep::isBoxVisible(planes, V3(0.0f, 0.0f, 10.0f), V3(1.0f, 1.0f, 1.0f)));
+  // Long and thin: its sphere would not reach into the frustum.
+  EXPECT_TRUE(FramePrep::isBoxVisible(planes, V3(50.0f, 0.0f, -10.0f), V3(60.0f, 0.1f, 0.1f)));
+}
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, TestPrepareFrame)
+{
+  std::unique_ptr<TestCamera> myCamera = std::unique_ptr<TestCamera>(new TestCamera);
+  addQuadResources(mSpire);
+
+  // No global uProjIVObject: prepareFrame supplies it for every object.
+  // "vboBounds" is bounded by its quad, like objects are by default.
+  const char* names[] = {"center", "behind", "left", "vboBounds"};
+  float offsets[] = {0.0f, 0.0f, -100.0f, -100.0f};
+  float depths[] = {0.0f, 10.0f, 0.0f, 0.0f};
+  for (int i = 0; i < 4; ++i)
+  {
+    mSpire->addObject(names[i]);
+    mSpire->addPassToObject(names[i], "UniformColor", "quad", "quad",
+                            Interface::TRIANGLE_STRIP);
+    mSpire->addObjectPassUniform(names[i], "uColor", V4(1.0f, 0.0f, 0.0f, 1.0f));
+    M44 transform;
+    transform[3] = V4(offsets[i], 0.0f, depths[i], 1.0f);
+    mSpire->setObjectTransform(names[i], transform);
+    if (i != 3)
+      mSpire->setObjectBounds(names[i], V3(0.0f, 0.0f, 0.0f), 1.5f);
+  }
+
+  std::vector<std::string> passes = {SPIRE_DEFAULT_PASS};
+  mSpire->beginFrame();
+  EXPECT_EQ(1u, mSpire->prepareFrame(myCamera->getWorldToProjection(), passes));
+  beginFrame();
+  mSpire->renderPreparedFrame();
+  EXPECT_EQ(255, readCenterPixel()[0]);
+
+  // Move the center quad out of view.
+  M44 transform;
+  transform[3] = V4(100.0f, 0.0f, 0.0f, 1.0f);
+  mSpire->setObjectTransform("center", transform);
+  mSpire->beginFrame();
+  EXPECT_EQ(0u, mSpire->prepareFrame(myCamera->getWorldToProjection(), passes));
+  beginFrame();
+  mSpire->renderPreparedFrame();
+  EXPECT_EQ(0, readCenterPixel()[0]);
+
+  // Passes that no object has prepare nothing.
+  EXPECT_EQ(0u, mSpire->prepareFrame(myCamera->getWorldToProjection(),
+                                     std::vector<std::string>(1, "none")));
+  EXPECT_THROW(mSpire->setObjectTransform("missing", transform), std::out_of_range);
+}
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, TestVBOBounds)
+{
+  addQuadResources(mSpire);
+  mSpire->addObject("quad");
+  mSpire->addPassToObject("quad", "UniformColor", "quad", "quad",
+                          Interface::TRIANGLE_STRIP);
+
+  // Computed from aPos when the VBO was added.
+  std::shared_ptr<const SpireObject> object = mSpire->getObjectWithName("quad");
+  ASSERT_TRUE(object->hasBounds());
+  EXPECT_EQ(V3(-1.0f, -1.0f, 0.0f), object->getBoundsMin());
+  EXPECT_EQ(V3(1.0f, 1.0f, 0.0f), object->getBoundsMax());
+  EXPECT_FLOAT_EQ(std::sqrt(2.0f), object->getBoundingSphere().w);
+
+  // Objects read the bounds of their VBOs when their passes change.
+  mSpire->setVBOBounds("quad", V3(0.0f, 0.0f, 0.0f), V3(4.0f, 4.0f, 4.0f));
+  EXPECT_EQ(V3(1.0f, 1.0f, 0.0f), mSpire->getObjectWithName("quad")->getBoundsMax());
+  mSpire->addPassToObject("quad", "UniformColor", "quad", "quad",
+                          Interface::TRIANGLE_STRIP, "second");
+  object = mSpire->getObjectWithName("quad");
+  EXPECT_EQ(V3(0.0f, 0.0f, 0.0f), object->getBoundsMin());
+  EXPECT_EQ(V3(4.0f, 4.0f, 4.0f), object->getBoundsMax());
+
+  // Bounds set on the object are kept when passes change.
+  mSpire->setObjectBounds("quad", V3(-2.0f, -2.0f, -2.0f), V3(2.0f, 2.0f, 2.0f));
+  mSpire->removePassFromObject("quad", "second");
+  object = mSpire->getObjectWithName("quad");
+  EXPECT_EQ(V3(2.0f, 2.0f, 2.0f), object->getBoundsMax());
+
+  EXPECT_THROW(mSpire->setVBOBounds("missing", V3(), V3()), std::out_of_range);
+}
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, TestCullingAndReuse)
+{
+  std::unique_ptr<TestCamera> myCamera = std::unique_ptr<TestCamera>(new TestCamera);
+  addQuadResources(mSpire);
+  mSpire->addObject("prototype");
+  mSpire->addPassToObject("prototype", "UniformColor", "quad", "quad",
+                          Interface::TRIANGLE_STRIP);
+
+  // Rotated, scaled copies with the quad's own bounds. Every tenth has no
+  // bounds at all.
+  std::shared_ptr<const SpireObject> prototype = mSpire->getObjectWithName("prototype");
+  std::vector<std::shared_ptr<SpireObject>> objects =
+      scatterObjects(*prototype, 3000, 30.0f);
+  std::mt19937 rng(99);
+  std::uniform_real_distribution<float> angle(0.0f, 3.0f);
+  std::uniform_real_distribution<float> scale(0.1f, 3.0f);
+  for (size_t i = 0; i < objects.size(); ++i)
+  {
+    M44 transform = objects[i]->getTransform();
+    transform = glm::rotate(transform, angle(rng), glm::normalize(V3(1.0f, 2.0f, 3.0f)));
+    transform = glm::scale(transform, V3(scale(rng), scale(rng), scale(rng)));
+    objects[i]->setTransform(transform);
+    if (i % 10 == 0)
+      objects[i]->setBoundingSphere(V3(0.0f, 0.0f, 0.0f), -1.0f);
+    else
+      objects[i]->setBoundingBox(prototype->getBoundsMin(), prototype->getBoundsMax());
+  }
+  std::shared_ptr<const SceneVersion> scene = makeScene(objects);
+
+  // Scalar reference, in scene order.
+  const float minPixels = 120.0f;
+  const float viewportHeight = 600.0f;
+  M44 worldToProjection = myCamera->getWorldToProjection();
+  V4 planes[6];
+  FramePrep::extractFrustumPlanes(worldToProjection, planes);
+  V4 clipW(worldToProjection[0][3], worldToProjection[1][3],
+           worldToProjection[2][3], worldToProjection[3][3]);
+  float sizeScale = glm::length(V3(worldToProjection[0][1], worldToProjection[1][1],
+                                   worldToProjection[2][1])) * viewportHeight;
+  std::vector<uint64_t> expected;
+  size_t numSmall = 0;
+  uint64_t index = 0;
+  for (size_t s = 0; s < SceneVersion::NumShards; ++s)
+  {
+    for (auto it = scene->shards[s]->begin(); it != scene->shards[s]->end(); ++it, ++index)
+    {
+      const SpireObject& object = *it->second;
+      if (!object.hasBounds())
+      {
+        expected.push_back(index);
+        continue;
+      }
+      const M44& transform = object.getTransform();
+      V3 center;
+      V3 extent;
+      transformBox(transform, object.getBoundsMin(), object.getBoundsMax(),
+                   center, extent);
+      if (!FramePrep::isBoxVisible(planes, center, extent))
+        continue;
+      float radius = object.getBoundingSphere().w
+          * std::max(glm::length(V3(transform[0])),
+                     std::max(glm::length(V3(transform[1])),
+                              glm::length(V3(transform[2]))));
+      float w = glm::dot(V3(clipW), center) + clipW.w;
+      if (w > radius && radius * sizeScale < minPixels * w)
+      {
+        ++numSmall;
+        continue;
+      }
+      expected.push_back(index);
+    }
+  }
+  EXPECT_LT(0u, numSmall);
+
+  std::vector<std::string> passes = {SPIRE_DEFAULT_PASS};
+  FramePrep prep;
+  prep.setSmallFeatureCulling(minPixels, viewportHeight);
+  prep.prepare(scene, worldToProjection, passes);
+  EXPECT_EQ(objects.size(), prep.getNumObjectsCulled());
+
+  std::vector<uint64_t> visible;
+  const std::vector<DrawItem>& draws = prep.getDrawList();
+  for (auto it = draws.begin(); it != draws.end(); ++it)
+    visible.push_back(it->sequence >> 16);
+  std::sort(visible.begin(), visible.end());
+  EXPECT_EQ(expected, visible);
+
+  // Same camera and scene: nothing is culled again.
+  prep.prepare(scene, worldToProjection, passes);
+  EXPECT_EQ(0u, prep.getNumObjectsCulled());
+  EXPECT_EQ(expected.size(), prep.getDrawList().size());
+
+  // Same camera, one object changed: only its shard is culled again.
+  std::vector<std::shared_ptr<SpireObject>> edited = objects;
+  edited[0] = objects[0]->clone();
+  std::shared_ptr<const SceneVersion> editedScene = makeScene(edited);
+  std::shared_ptr<SceneVersion> mixed = std::make_shared<SceneVersion>(*scene);
+  size_t editedShard = SceneVersion::getShardIndex("object0");
+  mixed->shards[editedShard] = editedScene->shards[editedShard];
+  prep.prepare(mixed, worldToProjection, passes);
+  EXPECT_EQ(mixed->shards[editedShard]->size(), prep.getNumObjectsCulled());
+  EXPECT_EQ(expected.size(), prep.getDrawList().size());
+
+  // Changing the settings culls everything again; without small feature
+  // culling, more objects are visible.
+  prep.setSmallFeatureCulling(0.0f, viewportHeight);
+  prep.prepare(mixed, worldToProjection, passes);
+  EXPECT_EQ(objects.size(), prep.getNumObjectsCulled());
+  EXPECT_EQ(expected.size() + numSmall, prep.getDrawList().size());
+}
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, TestPrepareFrameDeterminism)
+{
+  std::unique_ptr<TestCamera> myCamera = std::unique_ptr<TestCamera>(new TestCamera);
+  addQuadResources(mSpire);
+  mSpire->addObject("prototype");
+  mSpire->addPassToObject("prototype", "UniformColor", "quad", "quad",
+                          Interface::TRIANGLE_STRIP);
+  mSpire->addPassToObject("prototype", "UniformColor", "quad", "quad",
+                          Interface::TRIANGLE_STRIP, "second");
+
+  std::vector<std::shared_ptr<SpireObject>> objects =
+      scatterObjects(*mSpire->getObjectWithName("prototype"), 5000, 20.0f);
+  std::shared_ptr<const SceneVersion> scene = makeScene(objects);
+
+  std::vector<std::string> passes = {"second", SPIRE_DEFAULT_PASS};
+  FramePrep reference;
+  ThreadPool::setSharedNumThreads(1);
+  reference.prepare(scene, myCamera->getWorldToProjection(), passes);
+
+  // Some objects are culled, the draw list is sorted, and the passes come
+  // in the requested order.
+  const std::vector<DrawItem>& draws = reference.getDrawList();
+  EXPECT_LT(0u, reference.getNumVisibleObjects());
+  EXPECT_GT(objects.size(), reference.getNumVisibleObjects());
+  EXPECT_EQ(reference.getNumVisibleObjects() * 2, draws.size());
+  for (size_t i = 1; i < draws.size(); ++i)
+    EXPECT_LE(draws[i - 1].sortKey, draws[i].sortKey);
+  EXPECT_EQ("second", draws.front().pass->getName());
+  EXPECT_EQ(SPIRE_DEFAULT_PASS, draws.back().pass->getName());
+
+  size_t numThreads[] = {2, 3, 8};
+  for (size_t i = 0; i < sizeof(numThreads) / sizeof(numThreads[0]); ++i)
+  {
+    ThreadPool::setSharedNumThreads(numThreads[i]);
+    FramePrep prep;
+    prep.prepare(scene, myCamera->getWorldToProjection(), passes);
+    EXPECT_TRUE(sameDrawLists(draws, prep.getDrawList())) << numThreads[i];
+  }
+  ThreadPool::setSharedNumThreads(0);
+}
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, DISABLED_TestPrepareFrameScalingBenchmark)
+{
+  std::unique_ptr<TestCamera> myCamera = std::unique_ptr<TestCamera>(new TestCamera);
+  addQuadResources(mSpire);
+  mSpire->addObject("prototype");
+  mSpire->addPassToObject("prototype", "UniformColor", "quad", "quad",
+                          Interface::TRIANGLE_STRIP);
+
+  const size_t numObjects = 100000;
+  std::vector<std::shared_ptr<SpireObject>> objects =
+      scatterObjects(*mSpire->getObjectWithName("prototype"), numObjects, 40.0f);
+  std::shared_ptr<const SceneVersion> scene = makeScene(objects);
+  std::vector<std::string> passes = {SPIRE_DEFAULT_PASS};
+
+  // The calling thread takes part in the work: a pool of n workers runs
+  // on n + 1 threads.
+  size_t maxWorkers = std::max(2u, std::thread::hardware_concurrency()) - 1;
+  std::unique_ptr<FramePrep> reference;
+  double baseline = 0.0;
+  for (size_t workers = 1;; workers = std::min(workers * 2, maxWorkers))
+  {
+    ThreadPool::setSharedNumThreads(workers);
+    std::unique_ptr<FramePrep> prep(new FramePrep);
+    // The first run gathers the scene, later runs reuse it (static scene)
+    // while the camera moves. The last run sees the same camera again and
+    // reuses everything.
+    double first = 0.0;
+    double best = 0.0;
+    double still = 0.0;
+    for (int run = 0; run < 6; ++run)
+    {
+      M44 shift;
+      shift[3] = V4(0.01f * static_cast<float>(std::min(run, 4)), 0.0f, 0.0f, 1.0f);
+      M44 worldToProjection = myCamera->getWorldToProjection() * shift;
+
+      std::chrono::high_resolution_clock::time_point start =
+          std::chrono::high_resolution_clock::now();
+      prep->prepare(scene, worldToProjection, passes);
+      double ms = std::chrono::duration<double, std::milli>(
+          std::chrono::high_resolution_clock::now() - start).count();
+      if (run == 0)
+        first = ms;
+      else if (run == 5)
+        still = ms;
+      else if (run == 1 || ms < best)
+        best = ms;
+    }
+    EXPECT_EQ(0u, prep->getNumObjectsCulled());
+    if (workers == 1)
+      baseline = best;
+
+    std::cout << "prepareFrame, " << numObjects << " objects ("
+              << prep->getNumVisibleObjects() << " visible), " << workers + 1
+              << " threads: " << first << " ms first, " << best
+              << " ms static scene (x" << baseline / best << " vs. 2 threads), "
+              << still << " ms static camera" << std::endl;
+
+    if (reference)
+      EXPECT_TRUE(sameDrawLists(reference->getDrawList(), prep->getDrawList()));
+    else
+      reference = std::move(prep);
+
+    if (workers == maxWorkers)
+      break;
+  }
+  ThreadPool::setSharedNumThreads(0);
+}
+
+} // namespace
@@ -0,0 +1,187 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <gtest/gtest.h>
+#include "namespaces.h"
+#include "spire/src/AssetFile.h"
+#include "spire/src/IndexCompression.h"
+#include "spire/src/MeshOptimizer.h"
+
+using namespace spire;
+
+namespace {
+
+std::vector<uint32_t> roundTrip(const std::vector<uint32_t>& indices,
+                                size_t* compressedSize = nullptr)
+{
+  std::vector<uint8_t> encoded;
+  encodeIndices(indices, encoded);
+  if (compressedSize)
+    *compressedSize = encoded.size();
+
+  std::vector<uint32_t> decoded(indices.size());
+  size_t used = decodeIndices(encoded.data(), encoded.size(), decoded.data(),
+                              decoded.size());
+  EXPECT_EQ(encoded.size(), used);
+  return decoded;
+}
+
+//------------------------------------------------------------------------------
+TEST(IndexCompression, TestRoundTripExtremes)
+{
+  EXPECT_TRUE(roundTrip(std::vector<uint32_t>()).empty());
+
+  // Large jumps in both directions take the full 5 byte encoding.
+  std::vector<uint32_t> indices = {0, 0xffffffffu, 0, 0x80000000u, 0x7fffffffu,
+                                   1, 127, 128, 16383, 16384, 5, 5, 5};
+  EXPECT_EQ(indices, roundTrip(indices));
+
+  std::mt19937 rng(7);
+  std::vector<uint32_t> random(10000);
+  for (auto it = random.begin(); it != random.end(); ++it)
+    *it = static_cast<uint32_t>(rng());
+  EXPECT_EQ(random, roundTrip(random));
+}
+
+//------------------------------------------------------------------------------
+TEST(IndexCompression, TestMalformedInput)
+{
+  std::vector<uint32_t> indices = {1000000, 3, 2000000};
+  std::vector<uint8_t> encoded;
+  encodeIndices(indices, encoded);
+
+  std::vector<uint32_t> decoded(indices.size());
+  for (size_t size = 0; size < encoded.size(); ++size)
+  {
+    EXPECT_THROW(decodeIndices(encoded.data(), size, decoded.data(),
+                               decoded.size()), std::invalid_argument);
+  }
+
+  // Six continuation bytes never terminate a 32 bit value.
+  std::vector<uint8_t> overlong(16, 0xff);
+  EXPECT_THROW(decodeIndices(overlong.data(), overlong.size(), decoded.data(), 1),
+               std::invalid_argument);
+}
+
+//------------------------------------------------------------------------------
+TEST(IndexCompression, TestAssetRoundTrip)
+{
+  const char* assets[] = {"Assets/Sphere.sp", "Assets/UncappedCylinder.sp"};
+  for (size_t i = 0; i < sizeof(assets) / sizeof(assets[0]); ++i)
+  {
+    std::ifstream file(assets[i], std::ios::binary);
+    ASSERT_TRUE(file.good()) << assets[i];
+    std::vector<AssetMesh> meshes;
+    readAssetFile(file, meshes);
+
+    // Through the asset file writer and reader.
+    std::vector<uint8_t> raw;
+    std::vector<uint8_t> compressed;
+    AssetWriteOptions options;
+    serializeAssetFile(meshes, raw, options);
+    options.compressIndices = true;
+    serializeAssetFile(meshes, compressed, options);
+
+    std::istringstream stream(std::string(compressed.begin(), compressed.end()));
+    std::vector<AssetMesh> loaded;
+    readAssetFile(stream, loaded);
+    ASSERT_EQ(meshes.size(), loaded.size());
+    for (size_t m = 0; m < meshes.size(); ++m)
+    {
+      EXPECT_EQ(meshes[m].vbo, loaded[m].vbo);
+      EXPECT_EQ(meshes[m].indices, loaded[m].indices);
+    }
+
+    // Index data on its own, as stored and after vertex fetch optimization.
+    const AssetMesh& mesh = meshes.front();
+    size_t compressedSize = 0;
+    EXPECT_EQ(mesh.indices, roundTrip(mesh.indices, &compressedSize));
+
+    std::vector<uint8_t> vbo = mesh.vbo;
+    std::vector<uint32_t> optimized = mesh.indices;
+    optimizeMesh(vbo, sizeof(float) * 6, 0, optimized);
+    size_t optimizedSize = 0;
+    EXPECT_EQ(optimized, roundTrip(optimized, &optimizedSize));
+
+    size_t rawSize = mesh.indices.size() * sizeof(uint16_t);
+    EXPECT_LT(compressedSize, rawSize);
+    EXPECT_LT(optimizedSize, rawSize);
+    EXPECT_LT(compressed.size(), raw.size());
+  }
+}
+
+//------------------------------------------------------------------------------
+TEST(IndexCompression, DISABLED_TestDecodeThroughput)
+{
+  // A cache optimized grid, the typical input for compressed assets.
+  const uint32_t n = 512;
+  std::vector<uint8_t> vbo((n + 1) * (n + 1) * sizeof(float) * 6, 0);
+  float* vertices = reinterpret_cast<float*>(&vbo[0]);
+  std::vector<uint32_t> indices;
+  for (uint32_t y = 0; y <= n; ++y)
+  {
+    for (uint32_t x = 0; x <= n; ++x)
+    {
+      vertices[(y * (n + 1) + x) * 6 + 0] = static_cast<float>(x);
+      vertices[(y * (n + 1) + x) * 6 + 1] = static_cast<float>(y);
+      if (x < n && y < n)
+      {
+        uint32_t i0 = y * (n + 1) + x;
+        uint32_t tris[] = {i0, i0 + 1, i0 + n + 1, i0 + n + 1, i0 + 1, i0 + n + 2};
+        indices.insert(indices.end(), tris, tris + 6);
+      }
+    }
+  }
+  optimizeMesh(vbo, sizeof(float) * 6, 0, indices);
+
+  std::vector<uint8_t> encoded;
+  encodeIndices(indices, encoded);
+  std::vector<uint32_t> decoded(indices.size());
+
+  const int iterations = 20;
+  std::chrono::high_resolution_clock::time_point start =
+      std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < iterations; ++i)
+    decodeIndices(encoded.data(), encoded.size(), decoded.data(), decoded.size());
+  double seconds = std::chrono::duration<double>(
+      std::chrono::high_resolution_clock::now() - start).count();
+  EXPECT_EQ(indices, decoded);
+
+  double bytes = static_cast<double>(decoded.size() * sizeof(uint32_t)) * iterations;
+  std::cout << indices.size() << " indices: "
+            << static_cast<double>(encoded.size()) / static_cast<double>(indices.size())
+            << " bytes per index, decoded at "
+            << bytes / seconds / (1024.0 * 1024.0 * 1024.0) << " GB/s" << std::endl;
+}
+
+} // namespace
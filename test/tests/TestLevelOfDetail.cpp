@@ -0,0 +1,335 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <batch-testing/GlobalGTestEnv.hpp>
+#include <batch-testing/SpireTestFixture.hpp>
+#include "namespaces.h"
+
+#include "spire/src/CommandList.h"
+#include "spire/src/Common.h"
+#include "spire/src/Exceptions.h"
+#include "spire/src/FramePrep.h"
+#include "spire/src/SceneBuffer.h"
+#include "spire/src/SpireObject.h"
+
+#include "TestCamera.h"
+#include "TestCommon.h"
+
+using namespace spire;
+using namespace CPM_BATCH_TESTING_NS;
+
+namespace {
+
+//------------------------------------------------------------------------------
+/// Indices of the triangles of a 'cells' by 'cells' grid of vertices,
+/// using every 'step'th row and column.
+std::vector<uint16_t> makeGridIndices(uint16_t cells, uint16_t step)
+{
+  std::vector<uint16_t> indices;
+  uint16_t side = static_cast<uint16_t>(cells + 1);
+  for (uint16_t y = 0; y < cells; y = static_cast<uint16_t>(y + step))
+  {
+    for (uint16_t x = 0; x < cells; x = static_cast<uint16_t>(x + step))
+    {
+      uint16_t corner = static_cast<uint16_t>(y * side + x);
+      uint16_t right = static_cast<uint16_t>(corner + step);
+      uint16_t up = static_cast<uint16_t>(corner + step * side);
+      uint16_t quad[6] = {corner, right, up,
+                          right, static_cast<uint16_t>(up + step), up};
+      indices.insert(indices.end(), quad, quad + 6);
+    }
+  }
+  return indices;
+}
+
+//------------------------------------------------------------------------------
+/// Adds a 16 by 16 cell grid covering [-1, 1] in x and y as VBO "grid",
+/// with the IBOs "grid16", "grid8" and "grid4" drawing it at 16, 8 and 4
+/// cells a side. Adds a quad covering [0.5, 1] as VBO / IBO "corner" and
+/// the UniformColor shader.
+void addLODGridResources(std::shared_ptr<Interface> spire)
+{
+  const uint16_t cells = 16;
+  std::vector<float> vboData;
+  for (uint16_t y = 0; y <= cells; ++y)
+  {
+    for (uint16_t x = 0; x <= cells; ++x)
+    {
+      vboData.push_back(2.0f * static_cast<float>(x) / cells - 1.0f);
+      vboData.push_back(2.0f * static_cast<float>(y) / cells - 1.0f);
+      vboData.push_back(0.0f);
+    }
+  }
+  spire->addVBO("grid", reinterpret_cast<uint8_t*>(&vboData[0]),
+                vboData.size() * sizeof(float), {"aPos"});
+  for (uint16_t step = 1; step <= 4; step = static_cast<uint16_t>(step * 2))
+  {
+    std::vector<uint16_t> iboData = makeGridIndices(cells, step);
+    spire->addIBO("grid" + std::to_string(cells / step),
+                  reinterpret_cast<uint8_t*>(&iboData[0]),
+                  iboData.size() * sizeof(uint16_t), Interface::IBO_16BIT);
+  }
+
+  std::vector<float> cornerData = {0.5f, 0.5f, 0.0f,  1.0f, 0.5f, 0.0f,
+                                   0.5f, 1.0f, 0.0f,  1.0f, 1.0f, 0.0f};
+  std::vector<uint16_t> cornerIndices = {0, 1, 2, 1, 3, 2};
+  spire->addVBO("corner", reinterpret_cast<uint8_t*>(&cornerData[0]),
+                cornerData.size() * sizeof(float), {"aPos"});
+  spire->addIBO("corner", reinterpret_cast<uint8_t*>(&cornerIndices[0]),
+                cornerIndices.size() * sizeof(uint16_t), Interface::IBO_16BIT);
+
+  spire->addPersistentShader(
+      "UniformColor",
+      { std::make_tuple("UniformColor.vsh", Interface::VERTEX_SHADER),
+        std::make_tuple("UniformColor.fsh", Interface::FRAGMENT_SHADER),
+      });
+}
+
+//------------------------------------------------------------------------------
+/// Adds an object drawing the grid in white, with the levels of detail
+/// "grid8", "grid4" and "corner" of errors 0.01, 0.05 and 0.2.
+void addLODGridObject(std::shared_ptr<Interface> spire, const std::string& name)
+{
+  spire->addObject(name);
+  spire->addPassToObject(name, "UniformColor", "grid", "grid16",
+                         Interface::TRIANGLES);
+  spire->addObjectPassUniform(name, "uColor", V4(1.0f, 1.0f, 1.0f, 1.0f));
+  spire->addPassLODToObject(name, "", "grid8", 0.01f);
+  spire->addPassLODToObject(name, "", "grid4", 0.05f);
+  spire->addPassLODToObject(name, "corner", "corner", 0.2f);
+}
+
+} // namespace
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, TestLODSelection)
+{
+  std::unique_ptr<TestCamera> myCamera = std::unique_ptr<TestCamera>(new TestCamera);
+  addLODGridResources(mSpire);
+  addLODGridObject(mSpire, "grid");
+
+  // Levels must get coarser.
+  EXPECT_THROW(mSpire->addPassLODToObject("grid", "", "grid4", 0.05f),
+               std::invalid_argument);
+  EXPECT_THROW(mSpire->addPassLODToObject("grid", "", "missing", 1.0f),
+               std::out_of_range);
+  EXPECT_THROW(mSpire->addPassLODToObject("grid", "", "grid4", 1.0f, "missing"),
+               NotFound);
+
+  std::shared_ptr<SpireObject> object = mSpire->getObjectWithName("grid")->clone();
+  std::shared_ptr<const ObjectPass> pass = object->getObjectPassParams(SPIRE_DEFAULT_PASS);
+  ASSERT_EQ(3u, pass->getNumLODLevels());
+  EXPECT_EQ(0u, pass->selectLOD(0.0f));
+  EXPECT_EQ(1u, pass->selectLOD(0.01f));
+  EXPECT_EQ(2u, pass->selectLOD(0.1f));
+  EXPECT_EQ(3u, pass->selectLOD(1.0f));
+  EXPECT_EQ(96u, pass->getLODIBO(2).getNumElements());
+
+  std::vector<std::shared_ptr<SpireObject>> objects(1, object);
+  std::vector<std::string> passes = {SPIRE_DEFAULT_PASS};
+  M44 worldToProjection = myCamera->getWorldToProjection();
+  auto prepare = [&](FramePrep& prep) -> size_t
+  {
+    prep.prepare(makeScene(objects), worldToProjection, passes);
+    return countDrawnIndices(prep);
+  };
+
+  // 5 units away, the nearest point of the bounds is about 3.6 units from
+  // the eye, where a unit covers about 233 pixels of 480: the errors of the
+  // levels cover 2.3, 11.7 and 46.6 pixels.
+  FramePrep prep;
+  EXPECT_EQ(1536u, prepare(prep));
+  EXPECT_EQ(0u, prep.getNumCoarseDraws());
+  prep.setLODPixelError(1.0f, 480.0f);
+  EXPECT_EQ(1536u, prepare(prep));
+  prep.setLODPixelError(5.0f, 480.0f);
+  EXPECT_EQ(384u, prepare(prep));
+  EXPECT_EQ(1u, prep.getNumCoarseDraws());
+  EXPECT_EQ(384u, prep.getNumIndices());
+  prep.setLODPixelError(20.0f, 480.0f);
+  EXPECT_EQ(96u, prepare(prep));
+  prep.setLODPixelError(100.0f, 480.0f);
+  EXPECT_EQ(6u, prepare(prep));
+
+  // Smaller objects cover fewer pixels: at half the size, one level
+  // coarser, at twice the size, one finer.
+  prep.setLODPixelError(6.0f, 480.0f);
+  EXPECT_EQ(384u, prepare(prep));
+  M44 transform;
+  transform[0][0] = 0.5f;
+  transform[1][1] = 0.5f;
+  transform[2][2] = 0.5f;
+  object->setTransform(transform);
+  EXPECT_EQ(96u, prepare(prep));
+  transform = M44();
+  transform[0][0] = 2.0f;
+  transform[1][1] = 2.0f;
+  transform[2][2] = 2.0f;
+  object->setTransform(transform);
+  EXPECT_EQ(1536u, prepare(prep));
+
+  // 50 units away, a unit covers about 17 pixels.
+  transform = M44();
+  transform[3] = V4(0.0f, 0.0f, -45.0f, 1.0f);
+  object->setTransform(transform);
+  prep.setLODPixelError(1.0f, 480.0f);
+  EXPECT_EQ(96u, prepare(prep));
+
+  // Full detail with the eye inside of the bounds.
+  transform[3] = V4(0.0f, 0.0f, 4.5f, 1.0f);
+  object->setTransform(transform);
+  prep.setLODPixelError(100.0f, 480.0f);
+  EXPECT_EQ(1536u, prepare(prep));
+  EXPECT_EQ(0u, prep.getNumCoarseDraws());
+
+  // Orthographic, 480 pixels for 3 units whatever the distance: the errors
+  // cover 1.6, 8 and 32 pixels.
+  object->setTransform(M44());
+  myCamera->setAsOrthographic(2.0f, 1.5f);
+  M44 view;
+  view[3] = V4(0.0f, 0.0f, 50.0f, 1.0f);
+  myCamera->setViewTransform(view);
+  worldToProjection = myCamera->getWorldToProjection();
+  prep.setLODPixelError(10.0f, 480.0f);
+  EXPECT_EQ(96u, prepare(prep));
+
+  // Disabled again.
+  prep.setLODPixelError(0.0f, 480.0f);
+  EXPECT_EQ(1536u, prepare(prep));
+}
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, TestLODRendering)
+{
+  std::unique_ptr<TestCamera> myCamera = std::unique_ptr<TestCamera>(new TestCamera);
+  addLODGridResources(mSpire);
+  addLODGridObject(mSpire, "grid");
+
+  std::vector<std::string> passes = {SPIRE_DEFAULT_PASS};
+  auto renderCenter = [&]() -> uint8_t
+  {
+    mSpire->prepareFrame(myCamera->getWorldToProjection(), passes);
+    beginFrame();
+    mSpire->renderPreparedFrame();
+    return readCenterPixel()[0];
+  };
+  mSpire->beginFrame();
+
+  // The grid covers the center of the view at every level but the last,
+  // drawn from its own VBO.
+  EXPECT_EQ(255, renderCenter());
+  EXPECT_EQ(0u, mSpire->getNumCoarseDraws());
+  mSpire->setLODPixelError(20.0f, 480.0f);
+  EXPECT_EQ(255, renderCenter());
+  EXPECT_EQ(1u, mSpire->getNumCoarseDraws());
+  mSpire->setLODPixelError(100.0f, 480.0f);
+  EXPECT_EQ(0, renderCenter());
+  mSpire->setLODPixelError(0.0f, 480.0f);
+  EXPECT_EQ(255, renderCenter());
+  EXPECT_EQ(0u, mSpire->getNumCoarseDraws());
+
+  // Frame time control coarsens the levels when frames are too slow, and
+  // restores the host's threshold when turned off.
+  mSpire->setTargetFrameTime(1.0e-6, 16.0f);
+  for (int frame = 0; frame < 10; ++frame)
+    renderCenter();
+  EXPECT_EQ(16.0f, mSpire->getFrameTiming().pixelError);
+  EXPECT_EQ(1u, mSpire->getNumCoarseDraws());
+  mSpire->setTargetFrameTime(0.0);
+  EXPECT_EQ(255, renderCenter());
+  EXPECT_EQ(0u, mSpire->getNumCoarseDraws());
+}
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, DISABLED_TestLODSelectionBenchmark)
+{
+  std::unique_ptr<TestCamera> myCamera = std::unique_ptr<TestCamera>(new TestCamera);
+  addLODGridResources(mSpire);
+  mSpire->addObject("plain");
+  mSpire->addPassToObject("plain", "UniformColor", "grid", "grid16",
+                          Interface::TRIANGLES);
+  addLODGridObject(mSpire, "lod");
+
+  // 16384 small grids receding from the eye, every frame from a slightly
+  // different view so that nothing is reused.
+  auto makeObjects = [&](const std::string& name)
+  {
+    std::shared_ptr<const SpireObject> prototype = mSpire->getObjectWithName(name);
+    std::vector<std::shared_ptr<SpireObject>> objects;
+    for (int i = 0; i < 16384; ++i)
+    {
+      M44 transform;
+      transform[0][0] = 0.05f;
+      transform[1][1] = 0.05f;
+      transform[2][2] = 0.05f;
+      transform[3] = V4(0.1f * static_cast<float>(i % 32 - 16),
+                        0.1f * static_cast<float>(i / 32 % 32 - 16),
+                        -0.5f * static_cast<float>(i / 1024), 1.0f);
+      std::shared_ptr<SpireObject> object = prototype->clone();
+      object->setTransform(transform);
+      objects.push_back(object);
+    }
+    return makeScene(objects);
+  };
+  std::vector<std::string> passes = {SPIRE_DEFAULT_PASS};
+
+  auto timePrepare = [&](FramePrep& prep, std::shared_ptr<const SceneVersion> scene) -> double
+  {
+    double best = 0.0;
+    for (int run = 0; run < 5; ++run)
+    {
+      M44 shift;
+      shift[3] = V4(0.001f * static_cast<float>(4 - run), 0.0f, 0.0f, 1.0f);
+      std::chrono::high_resolution_clock::time_point start =
+          std::chrono::high_resolution_clock::now();
+      prep.prepare(scene, myCamera->getWorldToProjection() * shift, passes);
+      double ms = std::chrono::duration<double, std::milli>(
+          std::chrono::high_resolution_clock::now() - start).count();
+      if (run == 0 || ms < best)
+        best = ms;
+    }
+    return best;
+  };
+
+  FramePrep without;
+  double withoutMs = timePrepare(without, makeObjects("plain"));
+  FramePrep with;
+  with.setLODPixelError(1.0f, 480.0f);
+  double withMs = timePrepare(with, makeObjects("lod"));
+  EXPECT_EQ(without.getNumVisibleObjects(), with.getNumVisibleObjects());
+  EXPECT_LT(0u, with.getNumCoarseDraws());
+  EXPECT_GT(without.getNumIndices(), with.getNumIndices() * 4);
+  std::cout << "Prepared " << without.getNumVisibleObjects() << " objects in "
+            << withoutMs << " ms, " << withMs << " ms selecting levels ("
+            << with.getNumCoarseDraws() << " coarser, "
+            << with.getNumIndices() << " of " << without.getNumIndices()
+            << " indices)." << std::endl;
+}
@@ -0,0 +1,475 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <batch-testing/GlobalGTestEnv.hpp>
+#include <batch-testing/SpireTestFixture.hpp>
+#include "namespaces.h"
+
+#include "spire/src/AssetFile.h"
+#include "spire/src/CommandList.h"
+#include "spire/src/Common.h"
+#include "spire/src/FramePrep.h"
+#include "spire/src/MeshClusters.h"
+#include "spire/src/SceneBuffer.h"
+#include "spire/src/SpireObject.h"
+
+#include "TestCamera.h"
+#include "TestCommon.h"
+
+using namespace spire;
+using namespace CPM_BATCH_TESTING_NS;
+
+namespace {
+
+//------------------------------------------------------------------------------
+/// Unit sphere of 'rings' by 'segments' quads, 3 float positions followed by
+/// 3 float normals, counter clockwise seen from outside.
+void makeSphere(size_t rings, size_t segments, std::vector<float>& vbo,
+                std::vector<uint32_t>& indices)
+{
+  vbo.clear();
+  indices.clear();
+  for (size_t r = 0; r <= rings; ++r)
+  {
+    float theta = PI * static_cast<float>(r) / static_cast<float>(rings);
+    for (size_t s = 0; s <= segments; ++s)
+    {
+      float phi = 2.0f * PI * static_cast<float>(s) / static_cast<float>(segments);
+      V3 p(std::sin(theta) * std::cos(phi), std::cos(theta),
+           -std::sin(theta) * std::sin(phi));
+      for (int k = 0; k < 2; ++k)
+      {
+        vbo.push_back(p.x);
+        vbo.push_back(p.y);
+        vbo.push_back(p.z);
+      }
+    }
+  }
+
+  uint32_t side = static_cast<uint32_t>(segments + 1);
+  for (uint32_t r = 0; r < rings; ++r)
+  {
+    for (uint32_t s = 0; s < segments; ++s)
+    {
+      uint32_t a = r * side + s;
+      uint32_t b = a + side;
+      if (r != 0)
+      {
+        uint32_t top[3] = {a, b, a + 1};
+        indices.insert(indices.end(), top, top + 3);
+      }
+      if (r != rings - 1)
+      {
+        uint32_t bottom[3] = {a + 1, b, b + 1};
+        indices.insert(indices.end(), bottom, bottom + 3);
+      }
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+V3 getPosition(const std::vector<float>& vbo, uint32_t vertex)
+{
+  return V3(vbo[vertex * 6], vbo[vertex * 6 + 1], vbo[vertex * 6 + 2]);
+}
+
+//------------------------------------------------------------------------------
+std::vector<std::array<uint32_t, 3>> getTriangles(const uint32_t* indices,
+                                                  size_t numIndices)
+{
+  std::vector<std::array<uint32_t, 3>> triangles(numIndices / 3);
+  for (size_t t = 0; t < triangles.size(); ++t)
+    for (size_t k = 0; k < 3; ++k)
+      triangles[t][k] = indices[t * 3 + k];
+  std::sort(triangles.begin(), triangles.end());
+  return triangles;
+}
+
+//------------------------------------------------------------------------------
+/// Adds the sphere as VBO / IBO "sphere", clustered, the UniformColor shader
+/// and an object "sphere" drawing it in white.
+void addClusteredSphere(std::shared_ptr<Interface> spire, size_t rings,
+                        size_t segments)
+{
+  std::vector<float> vertices;
+  std::vector<uint32_t> indices;
+  makeSphere(rings, segments, vertices, indices);
+  std::vector<uint8_t> vbo(reinterpret_cast<uint8_t*>(&vertices[0]),
+                           reinterpret_cast<uint8_t*>(&vertices[0] + vertices.size()));
+  std::vector<uint8_t> ibo(reinterpret_cast<uint8_t*>(&indices[0]),
+                           reinterpret_cast<uint8_t*>(&indices[0] + indices.size()));
+  std::shared_ptr<std::vector<MeshCluster>> clusters =
+      std::make_shared<std::vector<MeshCluster>>();
+  Interface::buildMeshClusters(vbo, sizeof(float) * 6, 0, ibo,
+                               Interface::IBO_32BIT, *clusters);
+
+  spire->addVBO("sphere", &vbo[0], vbo.size(), {"aPos", "aNormal"});
+  spire->addIBO("sphere", &ibo[0], ibo.size(), Interface::IBO_32BIT);
+  spire->setIBOClusters("sphere", clusters);
+  spire->addPersistentShader(
+      "UniformColor",
+      { std::make_tuple("UniformColor.vsh", Interface::VERTEX_SHADER),
+        std::make_tuple("UniformColor.fsh", Interface::FRAGMENT_SHADER),
+      });
+  spire->addObject("sphere");
+  spire->addPassToObject("sphere", "UniformColor", "sphere", "sphere",
+                         Interface::TRIANGLES);
+  spire->addObjectPassUniform("sphere", "uColor", V4(1.0f, 1.0f, 1.0f, 1.0f));
+}
+
+} // namespace
+
+//------------------------------------------------------------------------------
+TEST(MeshClusters, TestBuildClusters)
+{
+  std::vector<float> vbo;
+  std::vector<uint32_t> indices;
+  makeSphere(64, 128, vbo, indices);
+  std::vector<uint32_t> original = indices;
+
+  std::vector<MeshCluster> clusters;
+  buildMeshClusters(reinterpret_cast<const uint8_t*>(&vbo[0]), sizeof(float) * 6,
+                    0, vbo.size() / 6, indices, clusters);
+  ASSERT_EQ(original.size(), indices.size());
+  EXPECT_EQ((indices.size() / 3 + MESH_CLUSTER_TRIANGLES - 1) / MESH_CLUSTER_TRIANGLES,
+            clusters.size());
+  EXPECT_NO_THROW(validateMeshClusters(clusters, indices.size()));
+  EXPECT_THROW(validateMeshClusters(clusters, indices.size() - 3),
+               std::invalid_argument);
+
+  // The same triangles, in consecutive ranges.
+  EXPECT_TRUE(getTriangles(&original[0], original.size())
+              == getTriangles(&indices[0], indices.size()));
+  uint32_t next = 0;
+  size_t numCulledSometimes = 0;
+  for (auto it = clusters.begin(); it != clusters.end(); ++it)
+  {
+    EXPECT_EQ(next, it->firstIndex);
+    EXPECT_LE(it->numIndices, MESH_CLUSTER_TRIANGLES * 3);
+    next = it->firstIndex + it->numIndices;
+
+    // Bounds hold every vertex and every face normal.
+    V3 center(it->center[0], it->center[1], it->center[2]);
+    V3 axis(it->coneAxis[0], it->coneAxis[1], it->coneAxis[2]);
+    EXPECT_NEAR(1.0f, glm::length(axis), 1e-4f);
+    if (it->coneCutoff < 1.0f)
+      ++numCulledSometimes;
+    float minDot = std::sqrt(std::max(0.0f, 1.0f - it->coneCutoff * it->coneCutoff));
+    for (uint32_t i = it->firstIndex; i < next; i += 3)
+    {
+      V3 p[3];
+      for (int k = 0; k < 3; ++k)
+      {
+        p[k] = getPosition(vbo, indices[i + k]);
+        EXPECT_LE(glm::length(p[k] - center), it->radius * 1.0001f + 1e-5f);
+      }
+      V3 normal = glm::cross(p[1] - p[0], p[2] - p[0]);
+      float length = glm::length(normal);
+      if (length > 0.0f && it->coneCutoff < 1.0f)
+      {
+        EXPECT_GE(glm::dot(normal / length, axis), minDot - 1e-4f);
+      }
+    }
+  }
+  EXPECT_EQ(indices.size(), next);
+
+  // Small patches of a sphere are nearly flat.
+  EXPECT_LT(clusters.size() * 9 / 10, numCulledSometimes);
+
+  // Clusters that test back facing from an eye really are: every triangle
+  // faces away from it.
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<float> spread(-4.0f, 4.0f);
+  size_t numBackFacing = 0;
+  for (int e = 0; e < 20; ++e)
+  {
+    V3 eye(spread(rng), spread(rng), spread(rng));
+    if (glm::length(eye) < 1.5f)
+      continue;
+    for (auto it = clusters.begin(); it != clusters.end(); ++it)
+    {
+      if (!FramePrep::isClusterBackFacing(*it, V4(eye, 1.0f)))
+        continue;
+      ++numBackFacing;
+      for (uint32_t i = it->firstIndex; i < it->firstIndex + it->numIndices; i += 3)
+      {
+        V3 p0 = getPosition(vbo, indices[i]);
+        V3 normal = glm::cross(getPosition(vbo, indices[i + 1]) - p0,
+                               getPosition(vbo, indices[i + 2]) - p0);
+        EXPECT_LE(0.0f, glm::dot(normal, p0 - eye));
+      }
+    }
+  }
+  EXPECT_LT(0u, numBackFacing);
+}
+
+//------------------------------------------------------------------------------
+TEST(MeshClusters, TestObjectSpaceEye)
+{
+  TestCamera camera;
+  M44 object;
+  object[0][0] = 2.0f;
+  object[3] = V4(1.0f, 2.0f, -3.0f, 1.0f);
+
+  // The camera is at (0, 0, 5) in world space.
+  V4 eye = FramePrep::getObjectSpaceEye(camera.getWorldToProjection() * object);
+  EXPECT_NEAR(-0.5f, eye.x, 1e-3f);
+  EXPECT_NEAR(-2.0f, eye.y, 1e-3f);
+  EXPECT_NEAR( 8.0f, eye.z, 1e-3f);
+  EXPECT_EQ(1.0f, eye.w);
+
+  // Orthographic projections look down -z.
+  M44 view;
+  view[3] = V4(0.0f, 0.0f, 5.0f, 1.0f);
+  camera.setAsOrthographic(2.0f, 1.5f);
+  camera.setViewTransform(view);
+  eye = FramePrep::getObjectSpaceEye(camera.getWorldToProjection() * object);
+  EXPECT_NEAR( 0.0f, eye.x, 1e-4f);
+  EXPECT_NEAR( 0.0f, eye.y, 1e-4f);
+  EXPECT_NEAR(-1.0f, eye.z, 1e-4f);
+  EXPECT_EQ(0.0f, eye.w);
+}
+
+//------------------------------------------------------------------------------
+TEST(MeshClusters, TestAssetFileClusters)
+{
+  std::vector<float> vbo;
+  std::vector<uint32_t> indices;
+  makeSphere(32, 64, vbo, indices);
+
+  std::vector<AssetMesh> meshes(1);
+  meshes[0].vbo.assign(reinterpret_cast<uint8_t*>(&vbo[0]),
+                       reinterpret_cast<uint8_t*>(&vbo[0] + vbo.size()));
+  meshes[0].indices = indices;
+  buildMeshClusters(&meshes[0].vbo[0], meshes[0].vertexSize(), 0,
+                    meshes[0].numVertices(), meshes[0].indices, meshes[0].clusters);
+  ASSERT_LT(1u, meshes[0].clusters.size());
+
+  // Whole meshes and meshes in parts keep their clusters.
+  for (size_t parts = 0; parts <= 1000; parts += 1000)
+  {
+    AssetWriteOptions options;
+    options.trianglesPerPart = parts;
+    std::vector<uint8_t> buffer;
+    serializeAssetFile(meshes, buffer, options);
+
+    std::istringstream stream(std::string(buffer.begin(), buffer.end()));
+    std::vector<AssetMesh> read;
+    readAssetFile(stream, read);
+    ASSERT_EQ(1u, read.size());
+    ASSERT_EQ(meshes[0].clusters.size(), read[0].clusters.size()) << parts;
+    for (size_t c = 0; c < read[0].clusters.size(); ++c)
+    {
+      const MeshCluster& a = meshes[0].clusters[c];
+      const MeshCluster& b = read[0].clusters[c];
+      EXPECT_EQ(a.firstIndex, b.firstIndex);
+      EXPECT_EQ(a.numIndices, b.numIndices);
+      EXPECT_EQ(a.radius, b.radius);
+      EXPECT_EQ(a.coneCutoff, b.coneCutoff);
+      for (int k = 0; k < 3; ++k)
+      {
+        EXPECT_EQ(a.center[k], b.center[k]);
+        EXPECT_EQ(a.coneAxis[k], b.coneAxis[k]);
+      }
+    }
+
+    // The index ranges still hold the same triangles.
+    for (size_t c = 0; c < read[0].clusters.size(); c += 17)
+    {
+      const MeshCluster& cluster = read[0].clusters[c];
+      for (uint32_t i = cluster.firstIndex; i < cluster.firstIndex + cluster.numIndices; ++i)
+      {
+        for (int k = 0; k < 3; ++k)
+        {
+          float original;
+          float position;
+          std::memcpy(&original, &meshes[0].vbo[meshes[0].indices[i] * 24 + k * 4], 4);
+          std::memcpy(&position, &read[0].vbo[read[0].indices[i] * 24 + k * 4], 4);
+          EXPECT_EQ(original, position);
+        }
+      }
+    }
+  }
+
+  // Clusters reaching past the indices are rejected.
+  meshes[0].clusters.back().numIndices += 3;
+  std::vector<uint8_t> buffer;
+  serializeAssetFile(meshes, buffer, AssetWriteOptions());
+  std::istringstream stream(std::string(buffer.begin(), buffer.end()));
+  std::vector<AssetMesh> read;
+  EXPECT_THROW(readAssetFile(stream, read), std::invalid_argument);
+}
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, TestClusterCulling)
+{
+  std::unique_ptr<TestCamera> myCamera = std::unique_ptr<TestCamera>(new TestCamera);
+  addClusteredSphere(mSpire, 64, 128);
+  const size_t numIndices = 6 * 128 * 63;
+  EXPECT_THROW(mSpire->setIBOClusters("missing", nullptr), std::out_of_range);
+
+  std::shared_ptr<SpireObject> object = mSpire->getObjectWithName("sphere")->clone();
+  std::vector<std::shared_ptr<SpireObject>> objects(1, object);
+  std::vector<std::string> passes = {SPIRE_DEFAULT_PASS};
+  M44 worldToProjection = myCamera->getWorldToProjection();
+
+  // The sphere is entirely in view: only back faces are culled. From 4
+  // radii away, 60% of a sphere faces away; the cones are conservative.
+  FramePrep prep;
+  prep.prepare(makeScene(objects), worldToProjection, passes);
+  EXPECT_EQ(numIndices, countDrawnIndices(prep));
+  prep.setClusterCulling(true, false);
+  prep.prepare(makeScene(objects), worldToProjection, passes);
+  EXPECT_EQ(0u, prep.getNumClustersCulled());
+  EXPECT_EQ(numIndices, countDrawnIndices(prep));
+  ASSERT_EQ(1u, prep.getDrawList().size());
+  EXPECT_EQ(nullptr, prep.getDrawList()[0].ranges);
+
+  prep.setClusterCulling(true, true);
+  prep.prepare(makeScene(objects), worldToProjection, passes);
+  size_t backFacing = countDrawnIndices(prep);
+  EXPECT_LT(0u, prep.getNumClustersCulled());
+  EXPECT_LT(numIndices * 4 / 10, backFacing);
+  EXPECT_GT(numIndices * 3 / 4, backFacing);
+  ASSERT_NE(nullptr, prep.getDrawList()[0].ranges);
+
+  // Mirroring the sphere turns it inside out: the side facing the eye is
+  // culled instead, less of it since the eye is outside.
+  M44 mirror;
+  mirror[0][0] = -1.0f;
+  object->setTransform(mirror);
+  prep.prepare(makeScene(objects), worldToProjection, passes);
+  size_t mirrored = countDrawnIndices(prep);
+  EXPECT_LT(0u, prep.getNumClustersCulled());
+  EXPECT_LT(backFacing, mirrored);
+  EXPECT_GT(numIndices, mirrored);
+
+  // Mostly out of the view on the right, without back face culling: a
+  // fifth of the sphere is left of the right plane.
+  M44 shifted;
+  shifted[3] = V4(2.5f, 0.0f, 0.0f, 1.0f);
+  object->setTransform(shifted);
+  prep.setClusterCulling(true, false);
+  prep.prepare(makeScene(objects), worldToProjection, passes);
+  size_t inView = countDrawnIndices(prep);
+  EXPECT_LT(numIndices / 10, inView);
+  EXPECT_GT(numIndices / 2, inView);
+
+  // Just out of the view, turned by 45 degrees so that the bounding box of
+  // the object still reaches into it. None of the clusters do.
+  float half = std::sqrt(0.5f);
+  shifted[0] = V4(half, 0.0f, -half, 0.0f);
+  shifted[2] = V4(half, 0.0f, half, 0.0f);
+  shifted[3] = V4(3.5f, 0.0f, 0.0f, 1.0f);
+  object->setTransform(shifted);
+  prep.prepare(makeScene(objects), worldToProjection, passes);
+  EXPECT_EQ(1u, prep.getNumVisibleObjects());
+  EXPECT_EQ(0u, prep.getDrawList().size());
+
+  // Through the interface, the front of the sphere is drawn.
+  mSpire->setClusterCulling(true, true);
+  mSpire->beginFrame();
+  EXPECT_EQ(1u, mSpire->prepareFrame(worldToProjection, passes));
+  EXPECT_LT(0u, mSpire->getNumClustersCulled());
+  beginFrame();
+  mSpire->renderPreparedFrame();
+  std::vector<uint8_t> pixel = readCenterPixel();
+  EXPECT_EQ(255, pixel[0]);
+  EXPECT_EQ(255, pixel[1]);
+  EXPECT_EQ(255, pixel[2]);
+
+  mSpire->setClusterCulling(false);
+  EXPECT_EQ(1u, mSpire->prepareFrame(worldToProjection, passes));
+  EXPECT_EQ(0u, mSpire->getNumClustersCulled());
+}
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, DISABLED_TestClusterCullingBenchmark)
+{
+  std::unique_ptr<TestCamera> myCamera = std::unique_ptr<TestCamera>(new TestCamera);
+  addClusteredSphere(mSpire, 256, 512);
+  const size_t numIndices = 6 * 512 * 255;
+
+  // 64 large spheres around the camera, most of them partly in view.
+  std::shared_ptr<const SpireObject> prototype = mSpire->getObjectWithName("sphere");
+  std::vector<std::shared_ptr<SpireObject>> objects;
+  for (int i = 0; i < 64; ++i)
+  {
+    M44 transform;
+    transform[3] = V4(1.5f * static_cast<float>(i % 8 - 4) + 0.75f,
+                      1.5f * static_cast<float>(i / 8 - 4) + 0.75f, -6.0f, 1.0f);
+    std::shared_ptr<SpireObject> object = prototype->clone();
+    object->setTransform(transform);
+    objects.push_back(object);
+  }
+  std::shared_ptr<const SceneVersion> scene = makeScene(objects);
+  std::vector<std::string> passes = {SPIRE_DEFAULT_PASS};
+
+  auto timePrepare = [&](FramePrep& prep) -> double
+  {
+    double best = 0.0;
+    for (int run = 0; run < 5; ++run)
+    {
+      M44 shift;
+      shift[3] = V4(0.001f * static_cast<float>(4 - run), 0.0f, 0.0f, 1.0f);
+      std::chrono::high_resolution_clock::time_point start =
+          std::chrono::high_resolution_clock::now();
+      prep.prepare(scene, myCamera->getWorldToProjection() * shift, passes);
+      double ms = std::chrono::duration<double, std::milli>(
+          std::chrono::high_resolution_clock::now() - start).count();
+      if (run == 0 || ms < best)
+        best = ms;
+    }
+    return best;
+  };
+
+  FramePrep without;
+  double withoutMs = timePrepare(without);
+  size_t withoutIndices = countDrawnIndices(without);
+  FramePrep with;
+  with.setClusterCulling(true, true);
+  double withMs = timePrepare(with);
+  size_t withIndices = countDrawnIndices(with);
+  EXPECT_EQ(without.getNumVisibleObjects() * numIndices, withoutIndices);
+  EXPECT_GT(withoutIndices / 2, withIndices);
+
+  std::cout << "Cluster culling " << without.getNumVisibleObjects()
+            << " spheres in view of " << numIndices / 3 << " triangles: "
+            << withIndices / 3 << " of " << withoutIndices / 3
+            << " triangles drawn, " << with.getNumClustersCulled()
+            << " clusters culled; prepareFrame " << withMs << " ms, "
+            << withoutMs << " ms without." << std::endl;
+}
@@ -0,0 +1,417 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <gtest/gtest.h>
+#include "namespaces.h"
+#include "spire/Interface.h"
+#include "spire/src/MeshImport.h"
+
+using namespace spire;
+
+namespace {
+
+/// (n+1) x (n+1) grid in the z = 0 plane made of n * n quads.
+struct Grid
+{
+  explicit Grid(size_t size) : n(size) {}
+
+  size_t numVertices() const  {return (n + 1) * (n + 1);}
+  size_t numQuads() const     {return n * n;}
+
+  float x(size_t v) const     {return static_cast<float>(v % (n + 1)) * 0.5f;}
+  float y(size_t v) const     {return static_cast<float>(v / (n + 1)) * 0.25f;}
+
+  /// Counter clockwise corners of quad 'q'.
+  void quad(size_t q, uint32_t corners[4]) const
+  {
+    uint32_t row = static_cast<uint32_t>(n + 1);
+    uint32_t i0 = static_cast<uint32_t>((q / n) * (n + 1) + q % n);
+    corners[0] = i0;
+    corners[1] = i0 + 1;
+    corners[2] = i0 + row + 1;
+    corners[3] = i0 + row;
+  }
+
+  size_t n;
+};
+
+template <typename T>
+void appendBinary(std::string& out, T value, bool bigEndian)
+{
+  char bytes[sizeof(T)];
+  std::memcpy(bytes, &value, sizeof(T));
+  if (bigEndian)
+    std::reverse(bytes, bytes + sizeof(T));
+  out.append(bytes, sizeof(T));
+}
+
+std::string asciiPLY(const Grid& grid)
+{
+  std::ostringstream out;
+  out << "ply\nformat ascii 1.0\ncomment generated\n"
+      << "element vertex " << grid.numVertices() << "\n"
+      << "property float x\nproperty float y\nproperty float z\n"
+      << "property uchar red\n"
+      << "element face " << grid.numQuads() << "\n"
+      << "property list uchar int vertex_indices\n"
+      << "end_header\n";
+  for (size_t v = 0; v < grid.numVertices(); ++v)
+    out << grid.x(v) << " " << grid.y(v) << " 0 255\n";
+  for (size_t q = 0; q < grid.numQuads(); ++q)
+  {
+    uint32_t c[4];
+    grid.quad(q, c);
+    out << "4 " << c[0] << " " << c[1] << " " << c[2] << " " << c[3] << "\n";
+  }
+  return out.str();
+}
+
+/// Binary PLY with normals. Big endian files use doubles for positions.
+std::string binaryPLY(const Grid& grid, bool bigEndian)
+{
+  std::ostringstream header;
+  header << "ply\nformat "
+         << (bigEndian ? "binary_big_endian" : "binary_little_endian") << " 1.0\n"
+         << "element vertex " << grid.numVertices() << "\n"
+         << "property " << (bigEndian ? "double" : "float") << " x\n"
+         << "property " << (bigEndian ? "double" : "float") << " y\n"
+         << "property " << (bigEndian ? "double" : "float") << " z\n"
+         << "property float nx\nproperty float ny\nproperty float nz\n"
+         << "element face " << grid.numQuads() * 2 << "\n"
+         << "property list uchar uint vertex_indices\n"
+         << "end_header\n";
+
+  std::string out = header.str();
+  for (size_t v = 0; v < grid.numVertices(); ++v)
+  {
+    if (bigEndian)
+    {
+      appendBinary(out, static_cast<double>(grid.x(v)), true);
+      appendBinary(out, static_cast<double>(grid.y(v)), true);
+      appendBinary(out, 0.0, true);
+    }
+    else
+    {
+      appendBinary(out, grid.x(v), false);
+      appendBinary(out, grid.y(v), false);
+      appendBinary(out, 0.0f, false);
+    }
+    appendBinary(out, 0.0f, bigEndian);
+    appendBinary(out, 0.0f, bigEndian);
+    appendBinary(out, 1.0f, bigEndian);
+  }
+  for (size_t q = 0; q < grid.numQuads(); ++q)
+  {
+    uint32_t c[4];
+    grid.quad(q, c);
+    uint32_t tris[2][3] = {{c[0], c[1], c[2]}, {c[0], c[2], c[3]}};
+    for (size_t t = 0; t < 2; ++t)
+    {
+      appendBinary(out, static_cast<uint8_t>(3), bigEndian);
+      for (size_t i = 0; i < 3; ++i)
+        appendBinary(out, tris[t][i], bigEndian);
+    }
+  }
+  return out;
+}
+
+std::string binarySTL(const Grid& grid)
+{
+  std::string out(80, ' ');
+  appendBinary(out, static_cast<uint32_t>(grid.numQuads() * 2), false);
+  for (size_t q = 0; q < grid.numQuads(); ++q)
+  {
+    uint32_t c[4];
+    grid.quad(q, c);
+    uint32_t tris[2][3] = {{c[0], c[1], c[2]}, {c[0], c[2], c[3]}};
+    for (size_t t = 0; t < 2; ++t)
+    {
+      float normal[3] = {0.0f, 0.0f, 1.0f};
+      for (size_t i = 0; i < 3; ++i)
+        appendBinary(out, normal[i], false);
+      for (size_t i = 0; i < 3; ++i)
+      {
+        appendBinary(out, grid.x(tris[t][i]), false);
+        appendBinary(out, grid.y(tris[t][i]), false);
+        appendBinary(out, 0.0f, false);
+      }
+      appendBinary(out, static_cast<uint16_t>(0), false);
+    }
+  }
+  return out;
+}
+
+enum ObjFaceStyle
+{
+  OBJ_POSITIONS,        ///< f 1 2 3 4
+  OBJ_NORMALS,          ///< f 1//1 2//1 3//1 4//1
+  OBJ_TEXCOORDS,        ///< f 1/1/1 ...
+  OBJ_RELATIVE,         ///< f -4 -3 -2 -1 (a quad is emitted after its vertices)
+};
+
+std::string gridOBJ(const Grid& grid, ObjFaceStyle style)
+{
+  std::ostringstream out;
+  out << "# generated\no grid\n";
+  if (style == OBJ_RELATIVE)
+  {
+    // Every quad gets its own four vertices.
+    for (size_t q = 0; q < grid.numQuads(); ++q)
+    {
+      uint32_t c[4];
+      grid.quad(q, c);
+      for (size_t i = 0; i < 4; ++i)
+        out << "v " << grid.x(c[i]) << " " << grid.y(c[i]) << " 0\n";
+      out << "f -4 -3 -2 -1\n";
+    }
+    return out.str();
+  }
+
+  for (size_t v = 0; v < grid.numVertices(); ++v)
+    out << "v " << grid.x(v) << " " << grid.y(v) << " 0.0e0\n";
+  out << "vt 0 0\nvn 0 0 1\n";
+  for (size_t q = 0; q < grid.numQuads(); ++q)
+  {
+    uint32_t c[4];
+    grid.quad(q, c);
+    out << "f";
+    for (size_t i = 0; i < 4; ++i)
+    {
+      out << " " << c[i] + 1;
+      if (style == OBJ_NORMALS)
+        out << "//1";
+      else if (style == OBJ_TEXCOORDS)
+        out << "/1/1";
+    }
+    out << "\n";
+  }
+  return out.str();
+}
+
+void importString(const std::string& data, MeshFileFormat format, AssetMesh& mesh)
+{
+  importMesh(data.data(), data.size(), format, mesh);
+}
+
+/// Checks that 'mesh' is the welded grid: every triangle is counter clockwise
+/// in the z = 0 plane and every normal points along +z.
+void checkGrid(const Grid& grid, const AssetMesh& mesh)
+{
+  ASSERT_EQ(ASSET_VERTEX_FLOAT, mesh.vertexFormat);
+  EXPECT_EQ(grid.numVertices(), mesh.numVertices());
+  ASSERT_EQ(grid.numQuads() * 6, mesh.indices.size());
+
+  const float* vertices = reinterpret_cast<const float*>(&mesh.vbo[0]);
+  for (size_t v = 0; v < mesh.numVertices(); ++v)
+  {
+    EXPECT_FLOAT_EQ(0.0f, vertices[v * 6 + 2]);
+    EXPECT_NEAR(1.0f, vertices[v * 6 + 5], 1e-6f);
+  }
+
+  double area = 0.0;
+  for (size_t t = 0; t < mesh.indices.size(); t += 3)
+  {
+    const float* a = vertices + mesh.indices[t] * 6;
+    const float* b = vertices + mesh.indices[t + 1] * 6;
+    const float* c = vertices + mesh.indices[t + 2] * 6;
+    double cross = (b[0] - a[0]) * (c[1] - a[1]) - (b[1] - a[1]) * (c[0] - a[0]);
+    EXPECT_GT(cross, 0.0);
+    area += cross * 0.5;
+  }
+  double expected = static_cast<double>(grid.n) * 0.5 * static_cast<double>(grid.n) * 0.25;
+  EXPECT_NEAR(expected, area, expected * 1e-6);
+}
+
+TEST(MeshImport, FileFormat)
+{
+  MeshFileFormat format;
+  EXPECT_TRUE(getMeshFileFormat("bunny.PLY", format));
+  EXPECT_EQ(MESH_FILE_PLY, format);
+  EXPECT_TRUE(getMeshFileFormat("dir.v2/part.stl", format));
+  EXPECT_EQ(MESH_FILE_STL, format);
+  EXPECT_TRUE(getMeshFileFormat("sphere.obj", format));
+  EXPECT_EQ(MESH_FILE_OBJ, format);
+  EXPECT_FALSE(getMeshFileFormat("sphere.dae", format));
+  EXPECT_FALSE(getMeshFileFormat("obj", format));
+}
+
+TEST(MeshImport, AsciiPLY)
+{
+  Grid grid(17);
+  AssetMesh mesh;
+  importString(asciiPLY(grid), MESH_FILE_PLY, mesh);
+  checkGrid(grid, mesh);
+}
+
+TEST(MeshImport, BinaryPLY)
+{
+  Grid grid(33);
+  AssetMesh little;
+  importString(binaryPLY(grid, false), MESH_FILE_PLY, little);
+  checkGrid(grid, little);
+
+  AssetMesh big;
+  importString(binaryPLY(grid, true), MESH_FILE_PLY, big);
+  checkGrid(grid, big);
+  EXPECT_EQ(little.vbo, big.vbo);
+  EXPECT_EQ(little.indices, big.indices);
+
+  // Truncated body.
+  std::string truncated = binaryPLY(grid, false);
+  truncated.resize(truncated.size() - 5);
+  EXPECT_THROW(importString(truncated, MESH_FILE_PLY, little), std::invalid_argument);
+}
+
+TEST(MeshImport, MalformedPLYHeader)
+{
+  // Counts whose products with the vertex size or with 3 wrap around must be
+  // rejected instead of allocating or reading too little.
+  Grid grid(5);
+  const char* counts[] = {"18446744073709551615", "6148914691236517206",
+                          "768614336404564651", "-1"};
+  std::string vertexCount = "element vertex " + std::to_string(grid.numVertices()) + "\n";
+  AssetMesh mesh;
+  for (size_t i = 0; i < 4; ++i)
+  {
+    std::string huge = std::string("element vertex ") + counts[i] + "\n";
+    std::string binary = binaryPLY(grid, false);
+    binary.replace(binary.find(vertexCount), vertexCount.size(), huge);
+    EXPECT_THROW(importString(binary, MESH_FILE_PLY, mesh), std::invalid_argument) << counts[i];
+
+    std::string ascii = asciiPLY(grid);
+    ascii.replace(ascii.find(vertexCount), vertexCount.size(), huge);
+    EXPECT_THROW(importString(ascii, MESH_FILE_PLY, mesh), std::invalid_argument) << counts[i];
+
+    // Vertices with a list property are read sequentially.
+    std::string listed = binaryPLY(grid, false);
+    listed.replace(listed.find(vertexCount), vertexCount.size(),
+                   huge + "property list uchar uint extra\n");
+    EXPECT_THROW(importString(listed, MESH_FILE_PLY, mesh), std::invalid_argument) << counts[i];
+  }
+
+  // So must a face announcing more indices than its line holds.
+  std::string ascii = asciiPLY(grid);
+  size_t face = ascii.rfind("\n4 ");
+  ASSERT_NE(std::string::npos, face);
+  ascii.replace(face + 1, 1, "4000000000");
+  EXPECT_THROW(importString(ascii, MESH_FILE_PLY, mesh), std::invalid_argument);
+}
+
+TEST(MeshImport, STL)
+{
+  Grid grid(20);
+  AssetMesh mesh;
+  importString(binarySTL(grid), MESH_FILE_STL, mesh);
+  checkGrid(grid, mesh);
+
+  EXPECT_THROW(importString("solid grid\nendsolid grid\n", MESH_FILE_STL, mesh),
+               std::invalid_argument);
+}
+
+TEST(MeshImport, OBJ)
+{
+  Grid grid(12);
+  AssetMesh positions;
+  importString(gridOBJ(grid, OBJ_POSITIONS), MESH_FILE_OBJ, positions);
+  checkGrid(grid, positions);
+
+  AssetMesh normals;
+  importString(gridOBJ(grid, OBJ_NORMALS), MESH_FILE_OBJ, normals);
+  checkGrid(grid, normals);
+
+  AssetMesh texcoords;
+  importString(gridOBJ(grid, OBJ_TEXCOORDS), MESH_FILE_OBJ, texcoords);
+  checkGrid(grid, texcoords);
+
+  // Relative indices reference per-quad vertices; the quads stay unwelded.
+  AssetMesh relative;
+  importString(gridOBJ(grid, OBJ_RELATIVE), MESH_FILE_OBJ, relative);
+  EXPECT_EQ(grid.numQuads() * 4, relative.numVertices());
+  EXPECT_EQ(grid.numQuads() * 6, relative.indices.size());
+
+  EXPECT_THROW(importString("v 0 0 0\nf 1 2 3\n", MESH_FILE_OBJ, positions),
+               std::invalid_argument);
+}
+
+TEST(MeshImport, InterfaceImport)
+{
+  Grid grid(8);
+  std::istringstream stream(binaryPLY(grid, false));
+  std::vector<uint8_t> vbo;
+  std::vector<uint8_t> ibo;
+  Interface::AssetInfo info;
+  size_t numTriangles = Interface::importMeshFile(stream, Interface::MESH_PLY,
+                                                  vbo, ibo, info);
+  EXPECT_EQ(grid.numQuads() * 2, numTriangles);
+  EXPECT_FALSE(info.quantized);
+  EXPECT_EQ(sizeof(float) * 6, info.stride);
+  EXPECT_EQ(Interface::IBO_16BIT, info.iboType);
+  EXPECT_EQ(grid.numVertices() * info.stride, vbo.size());
+  EXPECT_EQ(numTriangles * 3 * sizeof(uint16_t), ibo.size());
+}
+
+TEST(MeshImport, DISABLED_Throughput)
+{
+  typedef std::chrono::high_resolution_clock Clock;
+
+  // A few million triangles worth of data in each format.
+  Grid grid(700);
+  struct Case
+  {
+    const char*     name;
+    MeshFileFormat  format;
+    std::string     data;
+  };
+  Case cases[] = {
+    {"binary PLY", MESH_FILE_PLY, binaryPLY(grid, false)},
+    {"ascii PLY",  MESH_FILE_PLY, asciiPLY(grid)},
+    {"STL",        MESH_FILE_STL, binarySTL(grid)},
+    {"OBJ",        MESH_FILE_OBJ, gridOBJ(grid, OBJ_POSITIONS)},
+  };
+
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i)
+  {
+    AssetMesh mesh;
+    Clock::time_point start = Clock::now();
+    importString(cases[i].data, cases[i].format, mesh);
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    EXPECT_EQ(grid.numQuads() * 6, mesh.indices.size());
+
+    double megabytes = static_cast<double>(cases[i].data.size()) / (1024.0 * 1024.0);
+    std::cout << cases[i].name << ": " << megabytes << " MB in "
+              << seconds * 1000.0 << " ms (" << megabytes / seconds
+              << " MB/s)" << std::endl;
+  }
+}
+
+} // namespace
@@ -0,0 +1,228 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <gtest/gtest.h>
+#include "namespaces.h"
+#include "spire/Interface.h"
+#include "spire/src/MeshOptimizer.h"
+
+using namespace spire;
+
+namespace {
+
+/// Builds an (n+1) x (n+1) vertex grid with position and normal (24 bytes per
+/// vertex) and 2 * n * n triangles.
+void buildGrid(size_t n, std::vector<uint8_t>& vbo, std::vector<uint32_t>& indices)
+{
+  std::vector<float> vertices;
+  for (size_t y = 0; y <= n; ++y)
+  {
+    for (size_t x = 0; x <= n; ++x)
+    {
+      float fx = static_cast<float>(x);
+      float fy = static_cast<float>(y);
+      float v[] = {fx, fy, 0.0f, 0.0f, 0.0f, 1.0f};
+      vertices.insert(vertices.end(), v, v + 6);
+    }
+  }
+  const uint8_t* raw = reinterpret_cast<const uint8_t*>(&vertices[0]);
+  vbo.assign(raw, raw + vertices.size() * sizeof(float));
+
+  indices.clear();
+  for (uint32_t y = 0; y < n; ++y)
+  {
+    for (uint32_t x = 0; x < n; ++x)
+    {
+      uint32_t i0 = y * static_cast<uint32_t>(n + 1) + x;
+      uint32_t i1 = i0 + 1;
+      uint32_t i2 = i0 + static_cast<uint32_t>(n + 1);
+      uint32_t i3 = i2 + 1;
+      uint32_t tris[] = {i0, i1, i2, i2, i1, i3};
+      indices.insert(indices.end(), tris, tris + 6);
+    }
+  }
+}
+
+void shuffleTriangles(std::vector<uint32_t>& indices)
+{
+  std::vector<size_t> order(indices.size() / 3);
+  for (size_t i = 0; i < order.size(); ++i)
+    order[i] = i;
+  std::shuffle(order.begin(), order.end(), std::mt19937(42));
+
+  std::vector<uint32_t> result;
+  for (auto it = order.begin(); it != order.end(); ++it)
+    result.insert(result.end(), indices.begin() + *it * 3, indices.begin() + *it * 3 + 3);
+  indices.swap(result);
+}
+
+/// Sorted list of triangles expressed as vertex contents, rotated so the
+/// smallest vertex comes first (winding is preserved).
+std::vector<std::vector<uint8_t>> canonicalTriangles(
+    const std::vector<uint8_t>& vbo, size_t stride, const std::vector<uint32_t>& indices)
+{
+  std::vector<std::vector<uint8_t>> result;
+  for (size_t t = 0; t < indices.size() / 3; ++t)
+  {
+    std::vector<std::vector<uint8_t>> v;
+    for (size_t c = 0; c < 3; ++c)
+      v.push_back(std::vector<uint8_t>(vbo.begin() + indices[t * 3 + c] * stride,
+                                       vbo.begin() + (indices[t * 3 + c] + 1) * stride));
+    size_t first = static_cast<size_t>(std::min_element(v.begin(), v.end()) - v.begin());
+    std::vector<uint8_t> tri;
+    for (size_t c = 0; c < 3; ++c)
+      tri.insert(tri.end(), v[(first + c) % 3].begin(), v[(first + c) % 3].end());
+    result.push_back(tri);
+  }
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+//------------------------------------------------------------------------------
+TEST(MeshOptimizer, TestWeldVertices)
+{
+  std::vector<uint8_t> vbo;
+  std::vector<uint32_t> indices;
+  buildGrid(4, vbo, indices);
+
+  // Append a duplicate of every vertex and point the second half of the
+  // triangles at the duplicates.
+  size_t stride = sizeof(float) * 6;
+  uint32_t numVertices = static_cast<uint32_t>(vbo.size() / stride);
+  std::vector<uint8_t> copy(vbo);
+  vbo.insert(vbo.end(), copy.begin(), copy.end());
+  for (size_t i = indices.size() / 2; i < indices.size(); ++i)
+    indices[i] += numVertices;
+
+  std::vector<std::vector<uint8_t>> before = canonicalTriangles(vbo, stride, indices);
+  EXPECT_EQ(numVertices, weldVertices(vbo, stride, indices));
+  EXPECT_EQ(numVertices * stride, vbo.size());
+  EXPECT_EQ(before, canonicalTriangles(vbo, stride, indices));
+}
+
+//------------------------------------------------------------------------------
+TEST(MeshOptimizer, TestVertexCacheOnShuffledGrid)
+{
+  std::vector<uint8_t> vbo;
+  std::vector<uint32_t> indices;
+  buildGrid(64, vbo, indices);
+  shuffleTriangles(indices);
+
+  size_t stride = sizeof(float) * 6;
+  size_t numVertices = vbo.size() / stride;
+  float before = calculateACMR(indices, numVertices);
+
+  std::vector<std::vector<uint8_t>> trianglesBefore = canonicalTriangles(vbo, stride, indices);
+  std::vector<uint32_t> clusters = optimizeVertexCache(indices, numVertices);
+  float after = calculateACMR(indices, numVertices);
+
+  ASSERT_FALSE(clusters.empty());
+  EXPECT_EQ(0, clusters[0]);
+  EXPECT_GT(before, 2.0f);
+  EXPECT_LT(after, 1.0f);
+  EXPECT_EQ(trianglesBefore, canonicalTriangles(vbo, stride, indices));
+
+  // Overdraw ordering must keep the cache efficiency close to Tipsify's.
+  optimizeOverdraw(indices, clusters, &vbo[0], stride, 0, numVertices);
+  EXPECT_LT(calculateACMR(indices, numVertices), after * 1.1f);
+  EXPECT_EQ(trianglesBefore, canonicalTriangles(vbo, stride, indices));
+}
+
+//------------------------------------------------------------------------------
+TEST(MeshOptimizer, TestLargeMeshIsDeterministic)
+{
+  // Large enough to be split into several chunks processed in parallel.
+  std::vector<uint8_t> vbo;
+  std::vector<uint32_t> indices;
+  buildGrid(300, vbo, indices);
+  shuffleTriangles(indices);
+  ASSERT_GT(indices.size() / 3, 2 * MESH_PARALLEL_CHUNK_TRIANGLES);
+
+  size_t stride = sizeof(float) * 6;
+  std::vector<std::vector<uint8_t>> trianglesBefore = canonicalTriangles(vbo, stride, indices);
+
+  std::vector<uint8_t> vbo2(vbo);
+  std::vector<uint32_t> indices2(indices);
+  size_t numVertices = optimizeMesh(vbo, stride, 0, indices);
+  EXPECT_EQ(numVertices, optimizeMesh(vbo2, stride, 0, indices2));
+  EXPECT_EQ(indices, indices2);
+  EXPECT_EQ(vbo, vbo2);
+
+  EXPECT_LT(calculateACMR(indices, numVertices), 1.0f);
+  EXPECT_EQ(trianglesBefore, canonicalTriangles(vbo, stride, indices));
+
+  // Vertex fetch order: vertices are referenced in increasing order.
+  uint32_t maxSeen = 0;
+  for (auto it = indices.begin(); it != indices.end(); ++it)
+  {
+    ASSERT_LE(*it, maxSeen + 1);
+    maxSeen = std::max(maxSeen, *it);
+  }
+}
+
+//------------------------------------------------------------------------------
+TEST(MeshOptimizer, DISABLED_TestACMRBenchmarkOnAssets)
+{
+  const char* assets[] = {"Assets/Sphere.sp", "Assets/UncappedCylinder.sp"};
+  for (size_t i = 0; i < sizeof(assets) / sizeof(assets[0]); ++i)
+  {
+    std::ifstream file(assets[i], std::ios::binary);
+    ASSERT_TRUE(file.good()) << assets[i];
+
+    std::vector<uint8_t> vbo;
+    std::vector<uint8_t> ibo;
+    Interface::loadProprietarySR5AssetFile(file, vbo, ibo);
+
+    size_t stride = sizeof(float) * 6;
+    std::vector<uint32_t> indices = unpackIndices(&ibo[0], ibo.size(), sizeof(uint16_t));
+    float before = calculateACMR(indices, vbo.size() / stride);
+
+    std::chrono::high_resolution_clock::time_point start =
+        std::chrono::high_resolution_clock::now();
+    size_t numVertices = Interface::optimizeMesh(vbo, stride, 0, ibo, Interface::IBO_16BIT);
+    double ms = std::chrono::duration<double, std::milli>(
+        std::chrono::high_resolution_clock::now() - start).count();
+
+    indices = unpackIndices(&ibo[0], ibo.size(), sizeof(uint16_t));
+    float after = calculateACMR(indices, numVertices);
+
+    std::cout << assets[i] << ": " << indices.size() / 3 << " triangles, ACMR "
+              << before << " -> " << after << " (" << ms << " ms)" << std::endl;
+
+    // These assets already went through assimp's cache optimization, so only
+    // require that we do not make them meaningfully worse.
+    EXPECT_LE(after, before * 1.05f);
+  }
+}
+
+}
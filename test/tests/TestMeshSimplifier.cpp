@@ -0,0 +1,532 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <gtest/gtest.h>
+#include "namespaces.h"
+#include "spire/Interface.h"
+#include "spire/src/AssetFile.h"
+#include "spire/src/MeshSimplifier.h"
+
+using namespace spire;
+
+namespace {
+
+const std::vector<float> LOD_RATIOS = {0.5f, 0.25f, 0.1f, 0.05f};
+
+/// Builds an (n+1) x (n+1) vertex grid over the unit square with position
+/// and normal (24 bytes per vertex) and 2 * n * n triangles. Heights are
+/// 'bump' * sin(4 x) * cos(4 y).
+void buildGrid(size_t n, float bump, std::vector<uint8_t>& vbo,
+               std::vector<uint32_t>& indices)
+{
+  std::vector<float> vertices;
+  for (size_t y = 0; y <= n; ++y)
+  {
+    for (size_t x = 0; x <= n; ++x)
+    {
+      float fx = static_cast<float>(x) / static_cast<float>(n);
+      float fy = static_cast<float>(y) / static_cast<float>(n);
+      float v[] = {fx, fy, bump * std::sin(4.0f * fx) * std::cos(4.0f * fy),
+                   0.0f, 0.0f, 1.0f};
+      vertices.insert(vertices.end(), v, v + 6);
+    }
+  }
+  vbo.assign(reinterpret_cast<uint8_t*>(&vertices[0]),
+             reinterpret_cast<uint8_t*>(&vertices[0] + vertices.size()));
+
+  indices.clear();
+  uint32_t side = static_cast<uint32_t>(n + 1);
+  for (uint32_t y = 0; y < n; ++y)
+  {
+    for (uint32_t x = 0; x < n; ++x)
+    {
+      uint32_t a = y * side + x;
+      uint32_t quad[6] = {a, a + 1, a + side, a + side, a + 1, a + side + 1};
+      indices.insert(indices.end(), quad, quad + 6);
+    }
+  }
+}
+
+/// The bundled sphere (assetsRaw/Sphere.dae, converted by assetConv).
+AssetMesh loadSphere()
+{
+  std::ifstream file("Assets/Sphere.sp", std::ios::binary);
+  std::vector<AssetMesh> meshes;
+  readAssetFile(file, meshes, 1);
+  return meshes.front();
+}
+
+V3 getPosition(const std::vector<uint8_t>& vbo, uint32_t vertex)
+{
+  float p[3];
+  std::memcpy(p, &vbo[vertex * 24], sizeof(p));
+  return V3(p[0], p[1], p[2]);
+}
+
+V3 getNormal(const std::vector<uint8_t>& vbo, uint32_t vertex)
+{
+  float n[3];
+  std::memcpy(n, &vbo[vertex * 24 + 12], sizeof(n));
+  return V3(n[0], n[1], n[2]);
+}
+
+float distanceToSegment(const V3& p, const V3& a, const V3& b)
+{
+  V3 ab = b - a;
+  float t = glm::dot(p - a, ab) / glm::dot(ab, ab);
+  t = std::min(1.0f, std::max(0.0f, t));
+  return glm::length(p - (a + ab * t));
+}
+
+/// Distance from 'p' to the closest triangle of 'indices'.
+float distanceToMesh(const V3& p, const std::vector<uint8_t>& vbo,
+                     const std::vector<uint32_t>& indices)
+{
+  float best = std::numeric_limits<float>::max();
+  for (size_t t = 0; t < indices.size(); t += 3)
+  {
+    V3 a = getPosition(vbo, indices[t]);
+    V3 b = getPosition(vbo, indices[t + 1]);
+    V3 c = getPosition(vbo, indices[t + 2]);
+    V3 n = glm::normalize(glm::cross(b - a, c - a));
+    V3 q = p - n * glm::dot(p - a, n);
+    bool inside = glm::dot(glm::cross(b - a, q - a), n) >= 0.0f
+               && glm::dot(glm::cross(c - b, q - b), n) >= 0.0f
+               && glm::dot(glm::cross(a - c, q - c), n) >= 0.0f;
+    float distance = inside ? std::abs(glm::dot(p - a, n))
+        : std::min(distanceToSegment(p, a, b),
+                   std::min(distanceToSegment(p, b, c), distanceToSegment(p, c, a)));
+    best = std::min(best, distance);
+  }
+  return best;
+}
+
+float getArea(const std::vector<uint8_t>& vbo, const std::vector<uint32_t>& indices)
+{
+  float area = 0.0f;
+  for (size_t t = 0; t < indices.size(); t += 3)
+  {
+    V3 a = getPosition(vbo, indices[t]);
+    area += 0.5f * glm::length(glm::cross(getPosition(vbo, indices[t + 1]) - a,
+                                          getPosition(vbo, indices[t + 2]) - a));
+  }
+  return area;
+}
+
+/// Signed volume enclosed by a closed triangle list, negative if it faces
+/// inward.
+float getVolume(const std::vector<uint8_t>& vbo, const std::vector<uint32_t>& indices)
+{
+  float volume = 0.0f;
+  for (size_t t = 0; t < indices.size(); t += 3)
+  {
+    volume += glm::dot(getPosition(vbo, indices[t]),
+                       glm::cross(getPosition(vbo, indices[t + 1]),
+                                  getPosition(vbo, indices[t + 2]))) / 6.0f;
+  }
+  return volume;
+}
+
+/// Directed edges of 'indices' that have no opposite edge.
+std::vector<std::pair<uint32_t, uint32_t>> getOpenEdges(
+    const std::vector<uint32_t>& indices)
+{
+  std::map<std::pair<uint32_t, uint32_t>, int> edges;
+  for (size_t t = 0; t < indices.size(); t += 3)
+  {
+    for (size_t i = 0; i < 3; ++i)
+      ++edges[std::make_pair(indices[t + i], indices[t + (i + 1) % 3])];
+  }
+
+  std::vector<std::pair<uint32_t, uint32_t>> open;
+  for (auto it = edges.begin(); it != edges.end(); ++it)
+  {
+    EXPECT_EQ(1, it->second) << "Edge used twice in the same direction.";
+    if (edges.find(std::make_pair(it->first.second, it->first.first)) == edges.end())
+      open.push_back(it->first);
+  }
+  return open;
+}
+
+/// Checks the reported error of every level against the distance of the
+/// original vertices from the level.
+void checkErrors(const std::vector<uint8_t>& vbo,
+                 const std::vector<uint32_t>& indices,
+                 const std::vector<MeshLOD>& lods)
+{
+  for (size_t level = 0; level < lods.size(); ++level)
+  {
+    std::vector<uint32_t> vertices(indices);
+    std::sort(vertices.begin(), vertices.end());
+    vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
+    float measured = 0.0f;
+    for (auto it = vertices.begin(); it != vertices.end(); ++it)
+      measured = std::max(measured, distanceToMesh(getPosition(vbo, *it), vbo,
+                                                   lods[level].indices));
+    EXPECT_LE(measured, lods[level].error * 1.001f + 1e-6f) << level;
+  }
+}
+
+} // namespace
+
+//------------------------------------------------------------------------------
+TEST(MeshSimplifier, TestSphereLevels)
+{
+  AssetMesh sphere = loadSphere();
+  ASSERT_EQ(ASSET_VERTEX_FLOAT, sphere.vertexFormat);
+  size_t numTriangles = sphere.indices.size() / 3;
+
+  float radius = 0.0f;
+  for (uint32_t v = 0; v < sphere.numVertices(); ++v)
+    radius = std::max(radius, glm::length(getPosition(sphere.vbo, v)));
+
+  std::vector<MeshLOD> lods;
+  simplifyMesh(&sphere.vbo[0], 24, 0, 12, sphere.numVertices(), sphere.indices,
+               LOD_RATIOS, lods);
+  ASSERT_EQ(LOD_RATIOS.size(), lods.size());
+
+  float previousError = 0.0f;
+  for (size_t level = 0; level < lods.size(); ++level)
+  {
+    const MeshLOD& lod = lods[level];
+
+    // Every level hits its ratio exactly and stays closed and consistently
+    // wound.
+    size_t target = static_cast<size_t>(LOD_RATIOS[level] * static_cast<float>(numTriangles) + 0.5f);
+    EXPECT_EQ(target * 3, lod.indices.size()) << level;
+    EXPECT_TRUE(getOpenEdges(lod.indices).empty()) << level;
+
+    // Triangles still face outward: the signed volume keeps its sign.
+    EXPECT_LT(0.0f, getVolume(sphere.vbo, sphere.indices)
+                    * getVolume(sphere.vbo, lod.indices)) << level;
+
+    EXPECT_LE(previousError, lod.error) << level;
+    previousError = lod.error;
+  }
+
+  // Half the triangles of a sphere cost little; the coarsest level is a
+  // small polyhedron.
+  EXPECT_LT(0.0f, lods[0].error);
+  EXPECT_GT(0.25f * radius, lods[0].error);
+  EXPECT_GT(radius, lods.back().error);
+  checkErrors(sphere.vbo, sphere.indices, lods);
+}
+
+//------------------------------------------------------------------------------
+TEST(MeshSimplifier, TestBoundaries)
+{
+  std::vector<uint8_t> vbo;
+  std::vector<uint32_t> indices;
+  buildGrid(16, 0.0f, vbo, indices);
+
+  std::vector<MeshLOD> lods;
+  simplifyMesh(&vbo[0], 24, 0, 12, vbo.size() / 24, indices, LOD_RATIOS, lods);
+  for (size_t level = 0; level < lods.size(); ++level)
+  {
+    const std::vector<uint32_t>& lod = lods[level].indices;
+    EXPECT_GE(static_cast<size_t>(LOD_RATIOS[level] * static_cast<float>(indices.size() / 3) + 0.5f),
+              lod.size() / 3) << level;
+
+    // The square keeps its outline, including the corners, and is flat.
+    EXPECT_NEAR(1.0f, getArea(vbo, lod), 1e-5f) << level;
+    EXPECT_NEAR(0.0f, lods[level].error, 1e-6f) << level;
+    std::vector<std::pair<uint32_t, uint32_t>> open = getOpenEdges(lod);
+    for (auto it = open.begin(); it != open.end(); ++it)
+    {
+      V3 a = getPosition(vbo, it->first);
+      V3 b = getPosition(vbo, it->second);
+      EXPECT_TRUE((a.x == b.x && (a.x == 0.0f || a.x == 1.0f))
+                  || (a.y == b.y && (a.y == 0.0f || a.y == 1.0f)));
+    }
+    for (uint32_t corner : {0u, 16u, 17u * 16u, 17u * 17u - 1u})
+      EXPECT_NE(lod.end(), std::find(lod.begin(), lod.end(), corner)) << level;
+  }
+}
+
+//------------------------------------------------------------------------------
+TEST(MeshSimplifier, TestNormals)
+{
+  // A flat grid whose right half is shaded with a tilted normal.
+  std::vector<uint8_t> vbo;
+  std::vector<uint32_t> indices;
+  buildGrid(16, 0.0f, vbo, indices);
+  float tilted[3] = {0.6f, 0.0f, 0.8f};
+  for (uint32_t v = 0; v < vbo.size() / 24; ++v)
+  {
+    if (getPosition(vbo, v).x > 0.5f)
+      std::memcpy(&vbo[v * 24 + 12], tilted, sizeof(tilted));
+  }
+
+  // Area of the triangles blending both normals.
+  auto blendedArea = [&](const std::vector<uint32_t>& lod)
+  {
+    std::vector<uint32_t> blended;
+    for (size_t t = 0; t < lod.size(); t += 3)
+    {
+      float n0 = getNormal(vbo, lod[t]).z;
+      if (n0 != getNormal(vbo, lod[t + 1]).z || n0 != getNormal(vbo, lod[t + 2]).z)
+        blended.insert(blended.end(), &lod[t], &lod[t] + 3);
+    }
+    return getArea(vbo, blended);
+  };
+
+  float original = blendedArea(indices);
+  std::vector<MeshLOD> aware;
+  simplifyMesh(&vbo[0], 24, 0, 12, vbo.size() / 24, indices, {0.25f}, aware);
+  MeshSimplifyOptions options;
+  options.normalWeight = 0.0f;
+  std::vector<MeshLOD> geometric;
+  simplifyMesh(&vbo[0], 24, 0, 12, vbo.size() / 24, indices, {0.25f}, geometric,
+               options);
+  size_t target = indices.size() / 3 / 4;
+  EXPECT_GE(target * 3, aware[0].indices.size());
+  EXPECT_GE(target * 3, geometric[0].indices.size());
+
+  // Positions alone give no reason to keep the shading edge.
+  EXPECT_NEAR(original, blendedArea(aware[0].indices), 1e-5f);
+  EXPECT_LT(2.0f * original, blendedArea(geometric[0].indices));
+}
+
+//------------------------------------------------------------------------------
+TEST(MeshSimplifier, TestSeams)
+{
+  // Same sphere, but every triangle has vertices of its own (flat shaded).
+  AssetMesh sphere = loadSphere();
+  std::vector<uint8_t> vbo;
+  std::vector<uint32_t> indices;
+  for (size_t t = 0; t < sphere.indices.size(); t += 3)
+  {
+    V3 a = getPosition(sphere.vbo, sphere.indices[t]);
+    V3 n = glm::normalize(glm::cross(getPosition(sphere.vbo, sphere.indices[t + 1]) - a,
+                                     getPosition(sphere.vbo, sphere.indices[t + 2]) - a));
+    for (size_t i = 0; i < 3; ++i)
+    {
+      indices.push_back(static_cast<uint32_t>(indices.size()));
+      V3 p = getPosition(sphere.vbo, sphere.indices[t + i]);
+      float vertex[6] = {p.x, p.y, p.z, n.x, n.y, n.z};
+      vbo.insert(vbo.end(), reinterpret_cast<uint8_t*>(vertex),
+                 reinterpret_cast<uint8_t*>(vertex + 6));
+    }
+  }
+
+  // Seams are simplified together with the rest: levels reach the same size
+  // as those of the smooth sphere and have no holes along the seams.
+  std::vector<MeshLOD> lods;
+  simplifyMesh(&vbo[0], 24, 0, 12, vbo.size() / 24, indices, LOD_RATIOS, lods);
+  for (size_t level = 0; level < lods.size(); ++level)
+  {
+    size_t target = static_cast<size_t>(LOD_RATIOS[level] * static_cast<float>(indices.size() / 3) + 0.5f);
+    EXPECT_EQ(target * 3, lods[level].indices.size()) << level;
+
+    std::vector<uint32_t> welded;
+    for (auto it = lods[level].indices.begin(); it != lods[level].indices.end(); ++it)
+      welded.push_back(sphere.indices[*it]);
+    EXPECT_TRUE(getOpenEdges(welded).empty()) << level;
+  }
+  checkErrors(vbo, indices, lods);
+}
+
+//------------------------------------------------------------------------------
+TEST(MeshSimplifier, TestPartitions)
+{
+  std::vector<uint8_t> vbo;
+  std::vector<uint32_t> indices;
+  buildGrid(64, 0.1f, vbo, indices);
+
+  MeshSimplifyOptions options;
+  options.trianglesPerPartition = 1024;
+  std::vector<MeshLOD> lods;
+  simplifyMesh(&vbo[0], 24, 0, 12, vbo.size() / 24, indices, LOD_RATIOS, lods,
+               options);
+
+  for (size_t level = 0; level < lods.size(); ++level)
+  {
+    // Partitions round their own targets.
+    const std::vector<uint32_t>& lod = lods[level].indices;
+    float target = LOD_RATIOS[level] * static_cast<float>(indices.size() / 3);
+    EXPECT_NEAR(target, static_cast<float>(lod.size() / 3), 8.0f) << level;
+
+    // No cracks between the partitions: the only open edges are on the
+    // outline of the grid.
+    std::vector<std::pair<uint32_t, uint32_t>> open = getOpenEdges(lod);
+    for (auto it = open.begin(); it != open.end(); ++it)
+    {
+      V3 a = getPosition(vbo, it->first);
+      V3 b = getPosition(vbo, it->second);
+      EXPECT_TRUE((a.x == b.x && (a.x == 0.0f || a.x == 1.0f))
+                  || (a.y == b.y && (a.y == 0.0f || a.y == 1.0f)));
+    }
+  }
+  checkErrors(vbo, indices, lods);
+
+  // The result does not depend on the number of threads.
+  std::vector<MeshLOD> again;
+  simplifyMesh(&vbo[0], 24, 0, 12, vbo.size() / 24, indices, LOD_RATIOS, again,
+               options);
+  for (size_t level = 0; level < lods.size(); ++level)
+  {
+    EXPECT_EQ(lods[level].error, again[level].error);
+    EXPECT_EQ(lods[level].indices, again[level].indices);
+  }
+}
+
+//------------------------------------------------------------------------------
+TEST(MeshSimplifier, TestInvalidInput)
+{
+  std::vector<uint8_t> vbo;
+  std::vector<uint32_t> indices;
+  buildGrid(4, 0.0f, vbo, indices);
+  size_t numVertices = vbo.size() / 24;
+
+  std::vector<MeshLOD> lods;
+  EXPECT_THROW(simplifyMesh(&vbo[0], 24, 0, 12, numVertices, indices,
+                            {0.25f, 0.5f}, lods), std::invalid_argument);
+  EXPECT_THROW(simplifyMesh(&vbo[0], 24, 0, 12, numVertices, indices,
+                            {0.0f}, lods), std::invalid_argument);
+  EXPECT_THROW(simplifyMesh(&vbo[0], 24, 0, 12, numVertices, indices,
+                            {1.5f}, lods), std::invalid_argument);
+  indices.push_back(0);
+  EXPECT_THROW(simplifyMesh(&vbo[0], 24, 0, 12, numVertices, indices,
+                            {0.5f}, lods), std::invalid_argument);
+  indices.resize(indices.size() - 1);
+  indices.back() = static_cast<uint32_t>(numVertices);
+  EXPECT_THROW(simplifyMesh(&vbo[0], 24, 0, 12, numVertices, indices,
+                            {0.5f}, lods), std::invalid_argument);
+
+  // Without normals.
+  indices.back() = 0;
+  buildGrid(4, 0.0f, vbo, indices);
+  EXPECT_NO_THROW(simplifyMesh(&vbo[0], 24, 0, MESH_SIMPLIFY_NO_NORMALS,
+                               numVertices, indices, {0.5f}, lods));
+  EXPECT_EQ(16u * 3u, lods[0].indices.size());
+}
+
+//------------------------------------------------------------------------------
+TEST(MeshSimplifier, TestAssetFileLODs)
+{
+  std::vector<AssetMesh> meshes(1, loadSphere());
+  simplifyMesh(&meshes[0].vbo[0], 24, 0, 12, meshes[0].numVertices(),
+               meshes[0].indices, LOD_RATIOS, meshes[0].lods);
+
+  // Whole meshes, compressed indices and meshes in parts keep their levels.
+  for (int mode = 0; mode < 3; ++mode)
+  {
+    AssetWriteOptions options;
+    options.compressIndices = (mode == 1);
+    options.trianglesPerPart = (mode == 2) ? 32 : 0;
+    std::vector<uint8_t> buffer;
+    serializeAssetFile(meshes, buffer, options);
+
+    std::istringstream stream(std::string(buffer.begin(), buffer.end()));
+    std::vector<AssetMesh> read;
+    readAssetFile(stream, read);
+    ASSERT_EQ(meshes[0].lods.size(), read[0].lods.size()) << mode;
+    for (size_t level = 0; level < read[0].lods.size(); ++level)
+    {
+      const MeshLOD& a = meshes[0].lods[level];
+      const MeshLOD& b = read[0].lods[level];
+      EXPECT_EQ(a.error, b.error);
+      ASSERT_EQ(a.indices.size(), b.indices.size());
+      for (size_t i = 0; i < a.indices.size(); ++i)
+      {
+        EXPECT_EQ(getPosition(meshes[0].vbo, a.indices[i]),
+                  getPosition(read[0].vbo, b.indices[i]));
+      }
+    }
+  }
+
+  // Files without other version 3 features stay readable by version 2
+  // readers, which skip the levels.
+  std::vector<uint8_t> buffer;
+  serializeAssetFile(meshes, buffer);
+  uint32_t version;
+  std::memcpy(&version, &buffer[4], sizeof(version));
+  EXPECT_EQ(2u, version);
+
+  // Interface::loadAssetFile hands the levels out as IBOs.
+  std::istringstream stream(std::string(buffer.begin(), buffer.end()));
+  std::vector<uint8_t> vbo;
+  std::vector<uint8_t> ibo;
+  Interface::AssetInfo info;
+  Interface::loadAssetFile(stream, vbo, ibo, info);
+  ASSERT_EQ(meshes[0].lods.size(), info.lods.size());
+  for (size_t level = 0; level < info.lods.size(); ++level)
+  {
+    EXPECT_EQ(meshes[0].lods[level].error, info.lods[level].geometricError);
+    EXPECT_EQ(meshes[0].lods[level].indices.size() / 3, info.lods[level].numTriangles);
+    EXPECT_EQ(meshes[0].lods[level].indices.size() * sizeof(uint16_t),
+              info.lods[level].ibo.size());
+  }
+
+  // Levels referencing vertices past the VBO are rejected.
+  meshes[0].lods.back().indices.back() = static_cast<uint32_t>(meshes[0].numVertices());
+  serializeAssetFile(meshes, buffer);
+  std::istringstream bad(std::string(buffer.begin(), buffer.end()));
+  std::vector<AssetMesh> read;
+  EXPECT_THROW(readAssetFile(bad, read), std::invalid_argument);
+}
+
+//------------------------------------------------------------------------------
+TEST(MeshSimplifier, DISABLED_TestLargeMeshBenchmark)
+{
+  // 2 * 256 * 256 triangles in one partition at the default size, against
+  // partitions of 16384 triangles.
+  std::vector<uint8_t> vbo;
+  std::vector<uint32_t> indices;
+  buildGrid(256, 0.1f, vbo, indices);
+
+  typedef std::chrono::high_resolution_clock Clock;
+  for (size_t partition : {MESH_SIMPLIFY_PARTITION_TRIANGLES, static_cast<size_t>(16384)})
+  {
+    MeshSimplifyOptions options;
+    options.trianglesPerPartition = partition;
+    std::vector<MeshLOD> lods;
+    Clock::time_point start = Clock::now();
+    simplifyMesh(&vbo[0], 24, 0, 12, vbo.size() / 24, indices, LOD_RATIOS, lods,
+                 options);
+    double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    std::ostringstream report;
+    report << indices.size() / 3 << " triangles in partitions of " << partition
+           << ": " << ms << " ms,";
+    for (auto it = lods.begin(); it != lods.end(); ++it)
+      report << " " << it->indices.size() / 3 << " (error " << it->error << ")";
+    std::cout << report.str() << std::endl;
+
+    ASSERT_EQ(LOD_RATIOS.size(), lods.size());
+    EXPECT_GT(0.1f, lods.back().error);
+  }
+}
@@ -0,0 +1,288 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <batch-testing/GlobalGTestEnv.hpp>
+#include <batch-testing/SpireTestFixture.hpp>
+#include "namespaces.h"
+
+#include "spire/src/Common.h"
+#include "spire/src/AssetFile.h"
+#include "spire/src/MeshStream.h"
+
+#include "TestCamera.h"
+
+using namespace spire;
+using namespace CPM_BATCH_TESTING_NS;
+
+namespace {
+
+AssetMesh loadSphere()
+{
+  std::ifstream file("Assets/Sphere.sp", std::ios::binary);
+  std::vector<AssetMesh> meshes;
+  readAssetFile(file, meshes, 1);
+  return meshes.front();
+}
+
+std::string writeParts(const AssetMesh& mesh, size_t trianglesPerPart,
+                       bool compressIndices)
+{
+  AssetWriteOptions options;
+  options.trianglesPerPart = trianglesPerPart;
+  options.compressIndices = compressIndices;
+  std::vector<uint8_t> out;
+  serializeAssetFile(std::vector<AssetMesh>(1, mesh), out, options);
+  return std::string(out.begin(), out.end());
+}
+
+//------------------------------------------------------------------------------
+TEST(MeshStream, TestSplitParts)
+{
+  AssetMesh mesh = loadSphere();
+  AssetMeshLayout layout;
+  std::vector<AssetMeshPart> parts;
+  splitAssetMesh(mesh, 25, layout, parts);
+
+  size_t numTriangles = mesh.indices.size() / 3;
+  ASSERT_EQ((numTriangles + 24) / 25, layout.numParts);
+  ASSERT_EQ(layout.numParts, parts.size());
+  EXPECT_EQ(mesh.indices.size(), layout.numIndices);
+
+  size_t nextVertex = 0;
+  size_t nextIndex = 0;
+  for (auto it = parts.begin(); it != parts.end(); ++it)
+  {
+    EXPECT_EQ(nextVertex, it->firstVertex);
+    EXPECT_EQ(nextIndex, it->firstIndex);
+    nextVertex += it->vbo.size() / layout.vertexSize();
+    nextIndex += it->indices.size();
+
+    // Only vertices delivered so far are referenced and every vertex lies
+    // inside the part's bounds.
+    for (auto idx = it->indices.begin(); idx != it->indices.end(); ++idx)
+    {
+      ASSERT_LT(*idx, nextVertex);
+      const AssetMeshPart& owner = *std::find_if(parts.begin(), parts.end(),
+          [idx, &layout](const AssetMeshPart& p)
+          {
+            return *idx >= p.firstVertex
+                && *idx < p.firstVertex + p.vbo.size() / layout.vertexSize();
+          });
+      const float* position = reinterpret_cast<const float*>(
+          &owner.vbo[(*idx - owner.firstVertex) * layout.vertexSize()]);
+      for (size_t i = 0; i < 3; ++i)
+      {
+        EXPECT_LE(it->boundsMin[i], position[i]);
+        EXPECT_GE(it->boundsMax[i], position[i]);
+      }
+    }
+  }
+  EXPECT_EQ(layout.numVertices, nextVertex);
+  EXPECT_EQ(layout.numIndices, nextIndex);
+}
+
+//------------------------------------------------------------------------------
+TEST(MeshStream, TestPartFileRoundTrip)
+{
+  AssetMesh mesh = loadSphere();
+  AssetMeshLayout layout;
+  std::vector<AssetMeshPart> expected;
+  splitAssetMesh(mesh, 40, layout, expected);
+
+  for (int compress = 0; compress < 2; ++compress)
+  {
+    std::string file = writeParts(mesh, 40, compress != 0);
+
+    // Streamed parts are the ones written.
+    std::istringstream stream(file);
+    std::vector<AssetMeshPart> parts;
+    size_t numLayouts = 0;
+    streamAssetFile(stream, 1000,
+                    [&](const AssetMeshLayout& l)
+                    {
+                      ++numLayouts;
+                      EXPECT_EQ(layout.numParts, l.numParts);
+                      EXPECT_TRUE(parts.empty());
+                    },
+                    [&](AssetMeshPart& part) { parts.push_back(part); });
+    EXPECT_EQ(1u, numLayouts);
+    ASSERT_EQ(expected.size(), parts.size());
+    for (size_t i = 0; i < parts.size(); ++i)
+    {
+      EXPECT_EQ(expected[i].vbo, parts[i].vbo);
+      EXPECT_EQ(expected[i].indices, parts[i].indices);
+    }
+
+    // Reading the file whole reassembles the parts.
+    std::istringstream whole(file);
+    std::vector<AssetMesh> meshes;
+    readAssetFile(whole, meshes);
+    ASSERT_EQ(1u, meshes.size());
+    EXPECT_EQ(layout.numVertices, meshes[0].numVertices());
+    for (size_t i = 0; i < parts.size(); ++i)
+    {
+      EXPECT_TRUE(std::equal(parts[i].indices.begin(), parts[i].indices.end(),
+                             meshes[0].indices.begin() + static_cast<ptrdiff_t>(parts[i].firstIndex)));
+    }
+
+    // A file cut off in the middle of the parts is rejected.
+    std::istringstream truncated(file.substr(0, file.size() / 2));
+    EXPECT_THROW(streamAssetFile(truncated, 1000,
+                                 [](const AssetMeshLayout&) {},
+                                 [](AssetMeshPart&) {}),
+                 std::invalid_argument);
+  }
+}
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, TestProgressiveStreaming)
+{
+  std::unique_ptr<TestCamera> myCamera = std::unique_ptr<TestCamera>(new TestCamera);
+
+  std::string shaderName = "DirGouraud";
+  mSpire->addPersistentShader(
+      shaderName, 
+      { std::make_tuple("DirGouraud.vsh", Interface::VERTEX_SHADER), 
+        std::make_tuple("DirGouraud.fsh", Interface::FRAGMENT_SHADER),
+      });
+  mSpire->addGlobalUniform("uLightDirWorld", V3(1.0f, 0.0f, 0.0f));
+  myCamera->setCommonUniforms(mSpire);
+
+  std::vector<std::string> attribNames = {"aPos", "aNormal"};
+  auto addSphereObject = [&](const std::string& objectName,
+                             const std::string& vboName,
+                             const std::string& iboName)
+  {
+    mSpire->addObject(objectName);
+    mSpire->addPassToObject(objectName, shaderName, vboName, iboName,
+                            Interface::TRIANGLES);
+    mSpire->addObjectPassUniform(objectName, "uAmbientColor", V4(0.1f, 0.1f, 0.1f, 1.0f));
+    mSpire->addObjectPassUniform(objectName, "uDiffuseColor", V4(0.8f, 0.8f, 0.0f, 1.0f));
+    mSpire->addObjectPassUniform(objectName, "uSpecularColor", V4(0.5f, 0.5f, 0.5f, 1.0f));
+    mSpire->addObjectPassUniform(objectName, "uSpecularPower", 32.0f);
+    M44 xform;
+    mSpire->addObjectPassUniform(objectName, "uObject", xform);
+    mSpire->addObjectGlobalUniform(objectName, "uProjIVObject",
+                                   myCamera->getWorldToProjection() * xform);
+    mSpire->removeIBO(iboName);
+    mSpire->removeVBO(vboName);
+  };
+
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  auto readPixels = [&viewport]()
+  {
+    std::vector<uint8_t> pixels(static_cast<size_t>(viewport[2] * viewport[3] * 4));
+    glReadPixels(viewport[0], viewport[1], viewport[2], viewport[3], GL_RGBA,
+                 GL_UNSIGNED_BYTE, &pixels[0]);
+    return pixels;
+  };
+
+  // Reference image with the mesh loaded up front.
+  {
+    std::vector<uint8_t> vbo;
+    std::vector<uint8_t> ibo;
+    std::ifstream file("Assets/Sphere.sp", std::ios::binary);
+    Interface::loadProprietarySR5AssetFile(file, vbo, ibo);
+    mSpire->addVBO("fullVBO", &vbo[0], vbo.size(), attribNames);
+    mSpire->addIBO("fullIBO", &ibo[0], ibo.size(), Interface::IBO_16BIT);
+    addSphereObject("full", "fullVBO", "fullIBO");
+  }
+  beginFrame();
+  mSpire->renderObject("full");
+  std::vector<uint8_t> reference = readPixels();
+  mSpire->removeObject("full");
+
+  // Stream a part file from a background thread.
+  std::vector<size_t> progress;
+  MeshStream meshStream([&progress](size_t uploaded, size_t total)
+  {
+    EXPECT_GT(uploaded, 0u);
+    EXPECT_LE(uploaded, total);
+    progress.push_back(uploaded);
+  });
+  std::string partFile = writeParts(loadSphere(), 10, true);
+  std::thread reader([&meshStream, &partFile]()
+  {
+    std::istringstream stream(partFile);
+    Interface::readMeshStream(stream, meshStream);
+  });
+
+  bool passAdded = false;
+  while (!meshStream.isComplete())
+  {
+    if (mSpire->uploadMeshStream(meshStream, "streamVBO", "streamIBO", attribNames)
+        && !passAdded)
+    {
+      addSphereObject("streamed", "streamVBO", "streamIBO");
+      passAdded = true;
+    }
+
+    // Whatever has arrived so far can be rendered.
+    if (passAdded)
+    {
+      beginFrame();
+      mSpire->renderObject("streamed");
+    }
+    std::this_thread::yield();
+  }
+  reader.join();
+
+  EXPECT_TRUE(meshStream.getError().empty());
+  ASSERT_FALSE(progress.empty());
+  EXPECT_EQ(meshStream.getUploadedParts().size(), progress.back());
+  EXPECT_TRUE(std::is_sorted(progress.begin(), progress.end()));
+
+  beginFrame();
+  mSpire->renderObject("streamed");
+  EXPECT_EQ(reference, readPixels());
+
+  compareFBOWithExistingFile(
+      "streamedSphere.png",
+      TEST_IMAGE_OUTPUT_DIR,
+      TEST_IMAGE_COMPARE_DIR,
+      TEST_PERCEPTUAL_COMPARE_BINARY,
+      50);
+}
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, TestStreamingErrorsReachRenderThread)
+{
+  MeshStream meshStream;
+  std::istringstream garbage("not an asset file");
+  Interface::readMeshStream(garbage, meshStream);
+
+  std::vector<std::string> attribNames = {"aPos", "aNormal"};
+  EXPECT_THROW(mSpire->uploadMeshStream(meshStream, "vbo", "ibo", attribNames),
+               std::runtime_error);
+}
+
+} // namespace
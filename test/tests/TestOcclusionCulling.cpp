@@ -0,0 +1,175 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <chrono>
+#include <iostream>
+#include <batch-testing/GlobalGTestEnv.hpp>
+#include <batch-testing/SpireTestFixture.hpp>
+#include "namespaces.h"
+
+#include "spire/src/Common.h"
+#include "spire/src/FramePrep.h"
+
+#include "TestCamera.h"
+#include "TestCommon.h"
+
+using namespace spire;
+using namespace CPM_BATCH_TESTING_NS;
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, TestOcclusionCulling)
+{
+  std::unique_ptr<TestCamera> myCamera = std::unique_ptr<TestCamera>(new TestCamera);
+  addGridResources(mSpire, 1);
+
+  // A red wall filling the view hides a green grid of 11 x 11 small quads
+  // (one of them in the center of the view). A blue quad is in front of
+  // the wall, off to the side of the grid.
+  addGridObject(mSpire, "wall", V3(0.0f, 0.0f, 2.0f), 3.0f, V4(1.0f, 0.0f, 0.0f, 1.0f));
+  addGridObject(mSpire, "front", V3(0.45f, 0.0f, 3.0f), 0.05f, V4(0.0f, 0.0f, 1.0f, 1.0f));
+  const size_t numHidden = 11 * 11;
+  for (int y = 0; y < 11; ++y)
+  {
+    for (int x = 0; x < 11; ++x)
+    {
+      V3 position(0.2f * static_cast<float>(x - 5), 0.2f * static_cast<float>(y - 5), -2.0f);
+      addGridObject(mSpire, "hidden" + std::to_string(y * 11 + x), position,
+                    0.08f, V4(0.0f, 1.0f, 0.0f, 1.0f));
+    }
+  }
+  mSpire->setOcclusionCulling(true);
+
+  std::vector<std::string> passes = {SPIRE_DEFAULT_PASS};
+  auto renderFrame = [&]() -> size_t
+  {
+    mSpire->beginFrame();
+    size_t numDraws = mSpire->prepareFrame(myCamera->getWorldToProjection(), passes);
+    beginFrame();
+    GL(glEnable(GL_DEPTH_TEST));
+    mSpire->renderPreparedFrame();
+    GL(glFinish());
+    return numDraws;
+  };
+
+  // Everything is drawn until the first results are in, then visible
+  // objects are only tested every few frames: give all of them a chance.
+  EXPECT_EQ(2 + numHidden, renderFrame());
+  EXPECT_EQ(0u, mSpire->getNumOccludedObjects());
+  for (int frame = 0; frame < 20 && mSpire->getNumOccludedObjects() < numHidden; ++frame)
+    renderFrame();
+  EXPECT_EQ(numHidden, mSpire->getNumOccludedObjects());
+  EXPECT_EQ(2u, renderFrame());
+  EXPECT_EQ(255, readCenterPixel()[0]);
+
+  // Objects that stay visible stay drawn.
+  for (int frame = 0; frame < 20; ++frame)
+    EXPECT_EQ(2u, renderFrame());
+
+  // Occluded objects are tested every frame: once the wall is moved out of
+  // the way they are back after a frame or two.
+  M44 transform;
+  transform[3] = V4(100.0f, 0.0f, 2.0f, 1.0f);
+  mSpire->setObjectTransform("wall", transform);
+  for (int frame = 0; frame < 5 && mSpire->getNumOccludedObjects() > 0; ++frame)
+    renderFrame();
+  EXPECT_EQ(0u, mSpire->getNumOccludedObjects());
+  EXPECT_EQ(1 + numHidden, renderFrame());
+  std::vector<uint8_t> pixel = readCenterPixel();
+  EXPECT_EQ(0, pixel[0]);
+  EXPECT_EQ(255, pixel[1]);
+
+  // Turning culling off forgets the results.
+  transform[3] = V4(0.0f, 0.0f, 2.0f, 1.0f);
+  mSpire->setObjectTransform("wall", transform);
+  for (int frame = 0; frame < 20 && mSpire->getNumOccludedObjects() < numHidden; ++frame)
+    renderFrame();
+  EXPECT_EQ(numHidden, mSpire->getNumOccludedObjects());
+  mSpire->setOcclusionCulling(false);
+  EXPECT_EQ(2 + numHidden, renderFrame());
+  EXPECT_EQ(0u, mSpire->getNumOccludedObjects());
+}
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, DISABLED_TestOcclusionCullingBenchmark)
+{
+  std::unique_ptr<TestCamera> myCamera = std::unique_ptr<TestCamera>(new TestCamera);
+
+  // Eight layers of 16 x 16 tiles, 800 triangles each, one behind the
+  // other: the first layer hides the others.
+  const size_t cells = 20;
+  const int layers = 8;
+  const int tiles = 16;
+  addGridResources(mSpire, cells);
+  for (int z = 0; z < layers; ++z)
+  {
+    for (int y = 0; y < tiles; ++y)
+    {
+      for (int x = 0; x < tiles; ++x)
+      {
+        V3 position(0.5f * static_cast<float>(x) - 3.75f,
+                    0.5f * static_cast<float>(y) - 3.75f, -static_cast<float>(z));
+        float shade = 1.0f - static_cast<float>(z) / layers;
+        addGridObject(mSpire, "tile" + std::to_string((z * tiles + y) * tiles + x),
+                      position, 0.25f, V4(shade, shade, shade, 1.0f));
+      }
+    }
+  }
+
+  std::vector<std::string> passes = {SPIRE_DEFAULT_PASS};
+  auto timeFrames = [&](int numFrames) -> double
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int frame = 0; frame < numFrames; ++frame)
+    {
+      mSpire->beginFrame();
+      mSpire->prepareFrame(myCamera->getWorldToProjection(), passes);
+      beginFrame();
+      GL(glEnable(GL_DEPTH_TEST));
+      mSpire->renderPreparedFrame();
+      GL(glFinish());
+    }
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::high_resolution_clock::now() - start).count() / numFrames;
+  };
+
+  const int numFrames = 20;
+  timeFrames(2);
+  double withoutMs = timeFrames(numFrames);
+
+  // Let every object in view be tested once.
+  mSpire->setOcclusionCulling(true);
+  timeFrames(2 * static_cast<int>(FramePrep::VisibleTestInterval));
+  double withMs = timeFrames(numFrames);
+  size_t numOccluded = mSpire->getNumOccludedObjects();
+  EXPECT_LT(0u, numOccluded);
+
+  std::cout << "Occlusion culling " << layers * tiles * tiles << " objects ("
+            << cells * cells * 2 << " triangles each): " << numOccluded
+            << " culled as occluded, " << withMs << " ms per frame, "
+            << withoutMs << " ms without." << std::endl;
+}
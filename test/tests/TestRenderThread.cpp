@@ -0,0 +1,202 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <batch-testing/GlobalGTestEnv.hpp>
+#include <batch-testing/SpireTestFixture.hpp>
+#include "namespaces.h"
+
+#include "spire/Interface.h"
+#include "spire/Context.h"
+
+using namespace spire;
+using namespace CPM_BATCH_TESTING_NS;
+
+namespace {
+
+/// Context that only records what is done to it. Enough for the render
+/// thread tests below, which never draw.
+class RecordingContext : public Context
+{
+public:
+  RecordingContext() :
+      mNumMakeCurrent(0),
+      mNumDoneCurrent(0),
+      mNumSwaps(0)
+  {}
+
+  void makeCurrent() override
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    ++mNumMakeCurrent;
+    mCurrentThread = std::this_thread::get_id();
+  }
+
+  void doneCurrent() override
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    ++mNumDoneCurrent;
+    mCurrentThread = std::thread::id();
+  }
+
+  void swapBuffers() override
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    ++mNumSwaps;
+  }
+
+  size_t getNumMakeCurrent()            {std::lock_guard<std::mutex> lock(mMutex); return mNumMakeCurrent;}
+  size_t getNumDoneCurrent()            {std::lock_guard<std::mutex> lock(mMutex); return mNumDoneCurrent;}
+  size_t getNumSwaps()                  {std::lock_guard<std::mutex> lock(mMutex); return mNumSwaps;}
+  std::thread::id getCurrentThread()    {std::lock_guard<std::mutex> lock(mMutex); return mCurrentThread;}
+
+private:
+  std::mutex      mMutex;
+  size_t          mNumMakeCurrent;
+  size_t          mNumDoneCurrent;
+  size_t          mNumSwaps;
+  std::thread::id mCurrentThread;
+};
+
+//------------------------------------------------------------------------------
+/// Waits up to a few seconds for 'condition'.
+template <typename F>
+bool waitFor(F condition)
+{
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (!condition())
+  {
+    if (std::chrono::steady_clock::now() > deadline)
+      return false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, TestRenderThreadOnDemand)
+{
+  std::shared_ptr<RecordingContext> context = std::make_shared<RecordingContext>();
+  Interface spire(context, std::vector<std::string>());
+  EXPECT_FALSE(spire.hasRenderThread());
+
+  std::atomic<size_t> numFrames(0);
+  std::atomic<size_t> numObjects(0);
+  std::atomic<bool> fail(false);
+  std::thread::id renderThread;
+  auto render = [&](Interface& iface)
+  {
+    renderThread = std::this_thread::get_id();
+    numObjects = iface.getNumObjects();
+    ++numFrames;
+    if (fail)
+      throw std::runtime_error("Failed frame.");
+  };
+
+  spire.startRenderThread(render, Interface::RenderThreadOptions());
+  EXPECT_TRUE(spire.hasRenderThread());
+  EXPECT_THROW(spire.startRenderThread(render), std::logic_error);
+  ASSERT_TRUE(waitFor([&]() {return numFrames > 0;}));
+
+  // The context moved to the render thread once.
+  EXPECT_EQ(1u, context->getNumDoneCurrent());
+  EXPECT_EQ(2u, context->getNumMakeCurrent());
+  EXPECT_NE(std::this_thread::get_id(), context->getCurrentThread());
+
+  // Nothing changes, so the thread sleeps (the first frame may be followed
+  // by one more, see startRenderThread).
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  size_t idleFrames = numFrames;
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  EXPECT_EQ(idleFrames, numFrames);
+  EXPECT_EQ(numFrames, context->getNumSwaps());
+
+  // Scene edits from other threads wake it up.
+  std::thread producer([&spire]()
+  {
+    EXPECT_TRUE(spire.queueAddObject("obj1"));
+    EXPECT_TRUE(spire.queueAddObject("obj2"));
+  });
+  producer.join();
+  EXPECT_TRUE(waitFor([&]() {return numObjects == 2;}));
+
+  // So do redraw requests, and failing frames do not stop the thread.
+  fail = true;
+  size_t before = numFrames;
+  spire.requestRedraw();
+  EXPECT_TRUE(waitFor([&]() {return numFrames > before;}));
+  fail = false;
+  before = numFrames;
+  spire.requestRedraw();
+  EXPECT_TRUE(waitFor([&]() {return numFrames > before;}));
+
+  spire.stopRenderThread();
+  EXPECT_FALSE(spire.hasRenderThread());
+  EXPECT_EQ(2u, context->getNumDoneCurrent());
+  EXPECT_EQ(3u, context->getNumMakeCurrent());
+  EXPECT_EQ(std::this_thread::get_id(), context->getCurrentThread());
+  EXPECT_NE(std::this_thread::get_id(), renderThread);
+  EXPECT_EQ(2u, spire.getNumObjects());
+
+  // Stopping again is harmless; requests without a thread are ignored.
+  spire.stopRenderThread();
+  spire.requestRedraw();
+}
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, TestRenderThreadPacing)
+{
+  std::shared_ptr<RecordingContext> context = std::make_shared<RecordingContext>();
+  Interface spire(context, std::vector<std::string>());
+
+  std::atomic<size_t> numFrames(0);
+  Interface::RenderThreadOptions options;
+  options.targetFrameRate = 100.0;
+  options.continuous = true;
+  spire.startRenderThread([&numFrames](Interface&) {++numFrames;}, options);
+
+  // Continuous rendering keeps going without requests, but no faster than
+  // the target rate.
+  std::this_thread::sleep_for(std::chrono::milliseconds(300));
+  spire.stopRenderThread();
+  EXPECT_GE(numFrames, 5u);
+  EXPECT_LE(numFrames, 35u);
+
+  options.targetFrameRate = -1.0;
+  EXPECT_THROW(spire.startRenderThread([](Interface&) {}, options),
+               std::invalid_argument);
+  EXPECT_FALSE(spire.hasRenderThread());
+  EXPECT_THROW(spire.startRenderThread(Interface::RenderFunction()),
+               std::invalid_argument);
+  EXPECT_EQ(std::this_thread::get_id(), context->getCurrentThread());
+}
+
+} // namespace
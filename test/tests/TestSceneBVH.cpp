@@ -0,0 +1,383 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <random>
+#include <batch-testing/GlobalGTestEnv.hpp>
+#include <batch-testing/SpireTestFixture.hpp>
+#include "namespaces.h"
+
+#include "spire/src/BoundingVolume.h"
+#include "spire/src/Common.h"
+#include "spire/src/FramePrep.h"
+#include "spire/src/SceneBVH.h"
+#include "spire/src/SceneBuffer.h"
+#include "spire/src/SpireObject.h"
+
+#include "TestCamera.h"
+#include "TestCommon.h"
+
+using namespace spire;
+using namespace CPM_BATCH_TESTING_NS;
+
+namespace {
+
+typedef std::map<std::string, std::shared_ptr<const SpireObject>> ObjectMap;
+
+//------------------------------------------------------------------------------
+/// Copy of 'prototype' with a random position, rotation and size. Every
+/// tenth has no bounds unless 'bounded'.
+std::shared_ptr<const SpireObject>
+makeObject(const SpireObject& prototype, std::mt19937& rng, float extent,
+           bool bounded = false)
+{
+  std::uniform_real_distribution<float> position(-extent, extent);
+  std::uniform_real_distribution<float> angle(0.0f, 3.0f);
+  std::uniform_real_distribution<float> size(0.05f, 1.0f);
+  std::uniform_int_distribution<int> kind(0, 9);
+
+  std::shared_ptr<SpireObject> object = prototype.clone();
+  M44 transform;
+  transform[3] = V4(position(rng), position(rng), position(rng), 1.0f);
+  transform = glm::rotate(transform, angle(rng), glm::normalize(V3(1.0f, 2.0f, 3.0f)));
+  object->setTransform(transform);
+  if (kind(rng) == 0 && !bounded)
+    object->setBoundingSphere(V3(0.0f, 0.0f, 0.0f), -1.0f);
+  else
+    object->setBoundingBox(V3(0.0f, 0.0f, 0.0f), V3(size(rng), size(rng), size(rng)));
+  return object;
+}
+
+//------------------------------------------------------------------------------
+bool worldBox(const SpireObject& object, V3& min, V3& max)
+{
+  if (!object.hasBounds())
+    return false;
+  V3 center;
+  V3 extent;
+  transformBox(object.getTransform(), object.getBoundsMin(),
+               object.getBoundsMax(), center, extent);
+  min = center - extent;
+  max = center + extent;
+  return true;
+}
+
+//------------------------------------------------------------------------------
+/// Brute force versions of the SceneBVH queries, sorted by name.
+std::vector<std::string> bruteForceBox(const ObjectMap& objects, const V3& qmin,
+                                       const V3& qmax)
+{
+  std::vector<std::string> result;
+  for (auto it = objects.begin(); it != objects.end(); ++it)
+  {
+    V3 min;
+    V3 max;
+    if (   !worldBox(*it->second, min, max)
+        || (   min.x <= qmax.x && qmin.x <= max.x && min.y <= qmax.y
+            && qmin.y <= max.y && min.z <= qmax.z && qmin.z <= max.z))
+      result.push_back(it->first);
+  }
+  return result;
+}
+
+std::vector<std::string> bruteForceFrustum(const ObjectMap& objects,
+                                           const M44& worldToProjection)
+{
+  V4 planes[6];
+  FramePrep::extractFrustumPlanes(worldToProjection, planes);
+  std::vector<std::string> result;
+  for (auto it = objects.begin(); it != objects.end(); ++it)
+  {
+    V3 min;
+    V3 max;
+    if (   !worldBox(*it->second, min, max)
+        || FramePrep::isBoxVisible(planes, (min + max) * 0.5f, (max - min) * 0.5f))
+      result.push_back(it->first);
+  }
+  return result;
+}
+
+std::vector<std::string> bruteForceRay(const ObjectMap& objects,
+                                       const V3& origin, const V3& direction)
+{
+  std::vector<std::string> result;
+  for (auto it = objects.begin(); it != objects.end(); ++it)
+  {
+    V3 min;
+    V3 max;
+    if (!worldBox(*it->second, min, max))
+    {
+      result.push_back(it->first);
+      continue;
+    }
+    float near = 0.0f;
+    float far = std::numeric_limits<float>::infinity();
+    for (int axis = 0; axis < 3; ++axis)
+    {
+      float t0 = (min[axis] - origin[axis]) / direction[axis];
+      float t1 = (max[axis] - origin[axis]) / direction[axis];
+      near = std::max(near, std::min(t0, t1));
+      far = std::min(far, std::max(t0, t1));
+    }
+    if (near <= far)
+      result.push_back(it->first);
+  }
+  return result;
+}
+
+//------------------------------------------------------------------------------
+std::vector<std::string> sorted(std::vector<std::string> names)
+{
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+//------------------------------------------------------------------------------
+/// Compares all three queries of 'bvh' against brute force.
+void checkQueries(const SceneBVH& bvh, const ObjectMap& objects,
+                  std::mt19937& rng)
+{
+  std::uniform_real_distribution<float> position(-25.0f, 25.0f);
+  std::uniform_real_distribution<float> size(0.0f, 8.0f);
+  std::vector<std::string> result;
+  for (int i = 0; i < 10; ++i)
+  {
+    V3 min(position(rng), position(rng), position(rng));
+    V3 max = min + V3(size(rng), size(rng), size(rng));
+    bvh.queryBox(min, max, result);
+    ASSERT_EQ(bruteForceBox(objects, min, max), sorted(result));
+  }
+
+  std::unique_ptr<TestCamera> camera(new TestCamera);
+  for (int i = 0; i < 5; ++i)
+  {
+    M44 shift;
+    shift[3] = V4(position(rng), position(rng), position(rng) * 0.2f, 1.0f);
+    M44 worldToProjection = camera->getWorldToProjection() * shift;
+    bvh.queryFrustum(worldToProjection, result);
+    ASSERT_EQ(bruteForceFrustum(objects, worldToProjection), sorted(result));
+  }
+
+  std::vector<RayHit> hits;
+  for (int i = 0; i < 10; ++i)
+  {
+    V3 origin(position(rng), position(rng), 30.0f);
+    V3 direction(position(rng) * 0.02f, position(rng) * 0.02f, -1.0f);
+    bvh.queryRay(origin, direction, hits);
+    std::vector<std::string> names;
+    for (size_t h = 0; h < hits.size(); ++h)
+      names.push_back(hits[h].object);
+    for (size_t h = 1; h < hits.size(); ++h)
+      ASSERT_LE(hits[h - 1].distance, hits[h].distance);
+    ASSERT_EQ(bruteForceRay(objects, origin, direction), sorted(names));
+  }
+}
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, TestSceneBVHUpdates)
+{
+  mSpire->addObject("prototype");
+  std::shared_ptr<const SpireObject> prototype = mSpire->getObjectWithName("prototype");
+
+  std::mt19937 rng(77);
+  ObjectMap objects;
+  for (int i = 0; i < 3000; ++i)
+    objects["object" + std::to_string(i)] = makeObject(*prototype, rng, 20.0f);
+
+  // The first update builds the whole tree at once.
+  SceneBVH bvh;
+  bvh.update(*makeScene(objects));
+  EXPECT_EQ(objects.size(), bvh.getNumObjects());
+  EXPECT_EQ(1u, bvh.getNumRebuilds());
+  float builtCost = bvh.getCost();
+  EXPECT_LT(bvh.getDepth(), 40u);
+  checkQueries(bvh, objects, rng);
+
+  // Small edits are applied in place: objects move (refit), appear, vanish,
+  // lose or gain bounds. Shards left alone are not looked at.
+  std::uniform_int_distribution<int> pick(0, 2999);
+  for (int round = 0; round < 40; ++round)
+  {
+    for (int i = 0; i < 30; ++i)
+    {
+      std::string name = "object" + std::to_string(pick(rng));
+      if (i % 3 == 0)
+        objects.erase(name);
+      else
+        objects[name] = makeObject(*prototype, rng, 20.0f);
+    }
+    bvh.update(*makeScene(objects));
+    ASSERT_EQ(objects.size(), bvh.getNumObjects());
+    checkQueries(bvh, objects, rng);
+  }
+  // Rebuilds kept the tree from degrading.
+  EXPECT_LT(bvh.getCost(), builtCost * SceneBVH::RebuildCostRatio * 1.01f);
+
+  // Edits that do not move objects leave the tree alone.
+  size_t numRebuilds = bvh.getNumRebuilds();
+  for (auto it = objects.begin(); it != objects.end(); ++it)
+    it->second = it->second->clone();
+  bvh.update(*makeScene(objects));
+  EXPECT_EQ(numRebuilds, bvh.getNumRebuilds());
+  checkQueries(bvh, objects, rng);
+
+  // Removing everything.
+  bvh.update(SceneVersion());
+  EXPECT_EQ(0u, bvh.getNumObjects());
+  std::vector<std::string> result;
+  bvh.queryBox(V3(-100.0f, -100.0f, -100.0f), V3(100.0f, 100.0f, 100.0f), result);
+  EXPECT_TRUE(result.empty());
+}
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, TestSpatialQueries)
+{
+  // Three unit boxes along -z, and one object without bounds.
+  for (int i = 0; i < 3; ++i)
+  {
+    std::string name = "box" + std::to_string(i);
+    mSpire->addObject(name);
+    mSpire->setObjectBounds(name, V3(-0.5f, -0.5f, -0.5f), V3(0.5f, 0.5f, 0.5f));
+    M44 transform;
+    transform[3] = V4(0.0f, 0.0f, -2.0f * static_cast<float>(i), 1.0f);
+    mSpire->setObjectTransform(name, transform);
+  }
+  mSpire->addObject("unbounded");
+
+  std::vector<float> distances;
+  std::vector<std::string> hits =
+      mSpire->queryObjectsOnRay(V3(0.0f, 0.0f, 10.0f), V3(0.0f, 0.0f, -1.0f), &distances);
+  std::vector<std::string> expected = {"box0", "box1", "box2", "unbounded"};
+  EXPECT_EQ(expected, hits);
+  ASSERT_EQ(4u, distances.size());
+  EXPECT_FLOAT_EQ(9.5f, distances[0]);
+  EXPECT_FLOAT_EQ(11.5f, distances[1]);
+  EXPECT_EQ(std::numeric_limits<float>::infinity(), distances[3]);
+
+  // Queries see the edits made before them.
+  M44 transform;
+  transform[3] = V4(5.0f, 0.0f, 0.0f, 1.0f);
+  mSpire->setObjectTransform("box0", transform);
+  mSpire->removeObject("box2");
+  hits = mSpire->queryObjectsOnRay(V3(0.0f, 0.0f, 10.0f), V3(0.0f, 0.0f, -1.0f));
+  expected = {"box1", "unbounded"};
+  EXPECT_EQ(expected, hits);
+
+  hits = mSpire->queryObjectsInBox(V3(4.0f, -1.0f, -1.0f), V3(6.0f, 1.0f, 1.0f));
+  expected = {"box0", "unbounded"};
+  EXPECT_EQ(expected, hits);
+
+  // The test camera looks down -z from z = 5.
+  std::unique_ptr<TestCamera> camera(new TestCamera);
+  hits = sorted(mSpire->queryObjectsInFrustum(camera->getWorldToProjection()));
+  expected = {"box1", "unbounded"};
+  EXPECT_EQ(expected, hits);
+}
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, DISABLED_TestSceneBVHBenchmark)
+{
+  mSpire->addObject("prototype");
+  std::shared_ptr<const SpireObject> prototype = mSpire->getObjectWithName("prototype");
+  std::unique_ptr<TestCamera> camera(new TestCamera);
+
+  // Same density at both sizes, so queries of the same size find about as
+  // many objects.
+  std::mt19937 rng(5);
+  for (size_t numObjects = 10000; numObjects <= 100000; numObjects *= 10)
+  {
+    float extent = 20.0f * std::cbrt(static_cast<float>(numObjects) / 10000.0f);
+    ObjectMap objects;
+    for (size_t i = 0; i < numObjects; ++i)
+      objects["object" + std::to_string(i)] = makeObject(*prototype, rng, extent, true);
+    std::shared_ptr<const SceneVersion> scene = makeScene(objects);
+
+    SceneBVH bvh;
+    std::chrono::high_resolution_clock::time_point start =
+        std::chrono::high_resolution_clock::now();
+    bvh.update(*scene);
+    double buildMs = std::chrono::duration<double, std::milli>(
+        std::chrono::high_resolution_clock::now() - start).count();
+
+    // Picking rays through the scene and a small box around their start.
+    const int numQueries = 200;
+    std::uniform_real_distribution<float> position(-extent, extent);
+    std::vector<RayHit> hits;
+    std::vector<std::string> result;
+    size_t numFound = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < numQueries; ++i)
+    {
+      V3 origin(position(rng), position(rng), extent + 1.0f);
+      bvh.queryRay(origin, V3(0.0f, 0.0f, -1.0f), hits);
+      bvh.queryBox(origin - V3(2.0f, 2.0f, extent), origin + V3(2.0f, 2.0f, 0.0f), result);
+      numFound += hits.size() + result.size();
+    }
+    double queryUs = std::chrono::duration<double, std::micro>(
+        std::chrono::high_resolution_clock::now() - start).count() / numQueries;
+
+    start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < 10; ++i)
+      bruteForceRay(objects, V3(position(rng), position(rng), extent + 1.0f),
+                    V3(0.0f, 0.0f, -1.0f));
+    double bruteUs = std::chrono::duration<double, std::micro>(
+        std::chrono::high_resolution_clock::now() - start).count() / 10.0;
+
+    // Moving a thousand objects.
+    ObjectMap moved = objects;
+    auto it = moved.begin();
+    for (int i = 0; i < 1000; ++i, ++it)
+      it->second = makeObject(*prototype, rng, extent, true);
+    std::shared_ptr<const SceneVersion> movedScene = makeScene(moved);
+    start = std::chrono::high_resolution_clock::now();
+    bvh.update(*movedScene);
+    double updateMs = std::chrono::duration<double, std::milli>(
+        std::chrono::high_resolution_clock::now() - start).count();
+
+    start = std::chrono::high_resolution_clock::now();
+    bvh.queryFrustum(camera->getWorldToProjection(), result);
+    double frustumMs = std::chrono::duration<double, std::milli>(
+        std::chrono::high_resolution_clock::now() - start).count();
+
+    std::cout << "SceneBVH, " << numObjects << " objects: build " << buildMs
+              << " ms, ray + box query " << queryUs << " us ("
+              << numFound / numQueries << " found, brute force ray "
+              << bruteUs << " us), 1000 moved " << updateMs
+              << " ms, frustum " << frustumMs << " ms (" << result.size()
+              << " found), depth " << bvh.getDepth() << ", SAH cost "
+              << bvh.getCost() << std::endl;
+  }
+}
+
+} // namespace
@@ -0,0 +1,315 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <thread>
+#include <batch-testing/GlobalGTestEnv.hpp>
+#include <batch-testing/SpireTestFixture.hpp>
+#include "namespaces.h"
+
+#include "spire/src/Common.h"
+#include "spire/src/MPSCQueue.h"
+#include "spire/src/SceneCommand.h"
+
+#include "TestCamera.h"
+
+using namespace spire;
+using namespace CPM_BATCH_TESTING_NS;
+
+namespace {
+
+//------------------------------------------------------------------------------
+TEST(MPSCQueue, TestBounded)
+{
+  BoundedMPSCQueue<int> queue(5);
+  EXPECT_EQ(8u, queue.capacity());
+
+  int value = 0;
+  EXPECT_FALSE(queue.pop(value));
+  for (int i = 0; i < 8; ++i)
+    EXPECT_TRUE(queue.push(i));
+  EXPECT_FALSE(queue.push(8));
+
+  // Wrap around a few times.
+  for (int i = 0; i < 20; ++i)
+  {
+    EXPECT_TRUE(queue.pop(value));
+    EXPECT_EQ(i, value);
+    EXPECT_TRUE(queue.push(i + 8));
+  }
+}
+
+//------------------------------------------------------------------------------
+TEST(MPSCQueue, TestConcurrentProducers)
+{
+  const size_t numProducers = 4;
+  const size_t numValues = 20000;
+  BoundedMPSCQueue<size_t> queue(64);
+
+  std::vector<std::thread> producers;
+  for (size_t p = 0; p < numProducers; ++p)
+  {
+    producers.push_back(std::thread([&queue, p, numValues]()
+    {
+      for (size_t i = 0; i < numValues; ++i)
+        while (!queue.push(p * numValues + i))
+          std::this_thread::yield();
+    }));
+  }
+
+  // Every value arrives exactly once, and each producer's values arrive in
+  // the order they were pushed.
+  std::vector<size_t> next(numProducers, 0);
+  size_t numPopped = 0;
+  while (numPopped < numProducers * numValues)
+  {
+    size_t value;
+    if (!queue.pop(value))
+    {
+      std::this_thread::yield();
+      continue;
+    }
+    size_t producer = value / numValues;
+    ASSERT_LT(producer, numProducers);
+    ASSERT_EQ(next[producer], value % numValues);
+    ++next[producer];
+    ++numPopped;
+  }
+
+  for (auto it = producers.begin(); it != producers.end(); ++it)
+    it->join();
+  size_t value;
+  EXPECT_FALSE(queue.pop(value));
+}
+
+//------------------------------------------------------------------------------
+SceneCommand makeCommand(SceneCommand::Type type, const std::string& object,
+                         const std::string& name = "", float value = 0.0f)
+{
+  SceneCommand command = SceneCommand();
+  command.type = type;
+  setCommandName(command.object, object);
+  setCommandName(command.name, name);
+  command.uniformType = UNIFORM_FLOAT;
+  command.values[0] = value;
+  return command;
+}
+
+//------------------------------------------------------------------------------
+SceneCommand makeVBOUpdate(const std::string& vbo, size_t offset, size_t size)
+{
+  SceneCommand command = makeCommand(SceneCommand::UPDATE_VBO, "", vbo);
+  command.offset = offset;
+  command.size = size;
+  command.data = new uint8_t[size];
+  return command;
+}
+
+//------------------------------------------------------------------------------
+TEST(SceneCommands, TestCoalescing)
+{
+  auto exists = [](const std::string& name) {return name == "existing";};
+  std::vector<SceneCommand> commands;
+
+  // Slider drag: only the last value of each uniform survives.
+  for (int i = 0; i < 10; ++i)
+  {
+    commands.push_back(makeCommand(SceneCommand::SET_OBJECT_GLOBAL_UNIFORM,
+                                   "existing", "uColor", static_cast<float>(i)));
+    commands.push_back(makeCommand(SceneCommand::SET_GLOBAL_UNIFORM,
+                                   "", "uTime", static_cast<float>(i)));
+  }
+  EXPECT_EQ(18u, coalesceSceneCommands(commands, exists));
+  ASSERT_EQ(2u, commands.size());
+  EXPECT_EQ(SceneCommand::SET_OBJECT_GLOBAL_UNIFORM, commands[0].type);
+  EXPECT_FLOAT_EQ(9.0f, commands[0].values[0]);
+  EXPECT_EQ(SceneCommand::SET_GLOBAL_UNIFORM, commands[1].type);
+  EXPECT_FLOAT_EQ(9.0f, commands[1].values[0]);
+
+  // VBO updates only disappear when a later update covers their range.
+  commands.clear();
+  commands.push_back(makeVBOUpdate("vbo", 0, 16));
+  commands.push_back(makeVBOUpdate("vbo", 8, 16));
+  commands.push_back(makeVBOUpdate("other", 0, 64));
+  commands.push_back(makeVBOUpdate("vbo", 4, 8));
+  commands.push_back(makeVBOUpdate("vbo", 0, 32));
+  EXPECT_EQ(3u, coalesceSceneCommands(commands, exists));
+  ASSERT_EQ(2u, commands.size());
+  EXPECT_STREQ("other", commands[0].name);
+  EXPECT_EQ(32u, commands[1].size);
+  for (auto it = commands.begin(); it != commands.end(); ++it)
+    delete[] it->data;
+
+  // Objects added and removed again vanish along with their edits. Removing
+  // and re-adding an existing object resets it, so that pair stays, as does
+  // the failing add of an object that already exists.
+  commands.clear();
+  commands.push_back(makeCommand(SceneCommand::ADD_OBJECT, "temp"));
+  commands.push_back(makeCommand(SceneCommand::SET_OBJECT_GLOBAL_UNIFORM, "temp", "u"));
+  commands.push_back(makeCommand(SceneCommand::SET_OBJECT_GLOBAL_UNIFORM, "existing", "u", 1.0f));
+  commands.push_back(makeCommand(SceneCommand::REMOVE_OBJECT, "temp"));
+  commands.push_back(makeCommand(SceneCommand::ADD_OBJECT, "existing"));
+  commands.push_back(makeCommand(SceneCommand::REMOVE_OBJECT, "existing"));
+  commands.push_back(makeCommand(SceneCommand::ADD_OBJECT, "existing"));
+  commands.push_back(makeCommand(SceneCommand::SET_OBJECT_GLOBAL_UNIFORM, "existing", "u", 2.0f));
+  commands.push_back(makeCommand(SceneCommand::REMOVE_OBJECT, "existing"));
+  EXPECT_EQ(6u, coalesceSceneCommands(commands, exists));
+  ASSERT_EQ(3u, commands.size());
+  EXPECT_EQ(SceneCommand::SET_OBJECT_GLOBAL_UNIFORM, commands[0].type);
+  EXPECT_FLOAT_EQ(1.0f, commands[0].values[0]);
+  EXPECT_EQ(SceneCommand::ADD_OBJECT, commands[1].type);
+  EXPECT_EQ(SceneCommand::REMOVE_OBJECT, commands[2].type);
+}
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, TestQueuedSceneEdits)
+{
+  std::unique_ptr<TestCamera> myCamera = std::unique_ptr<TestCamera>(new TestCamera);
+  std::vector<float> vboData = 
+  {
+    -1.0f,  1.0f,  0.0f,
+     1.0f,  1.0f,  0.0f,
+    -1.0f, -1.0f,  0.0f,
+     1.0f, -1.0f,  0.0f
+  };
+  std::vector<std::string> attribNames = {"aPos"};
+  std::vector<uint16_t> iboData = {0, 1, 2, 3};
+
+  mSpire->addVBO("quad", reinterpret_cast<uint8_t*>(&vboData[0]),
+                 vboData.size() * sizeof(float), attribNames);
+  mSpire->addIBO("quad", reinterpret_cast<uint8_t*>(&iboData[0]),
+                 iboData.size() * sizeof(uint16_t), Interface::IBO_16BIT);
+  mSpire->addPersistentShader(
+      "UniformColor", 
+      { std::make_tuple("UniformColor.vsh", Interface::VERTEX_SHADER), 
+        std::make_tuple("UniformColor.fsh", Interface::FRAGMENT_SHADER),
+      });
+
+  // Objects are created from several threads at once; nothing happens until
+  // the render thread starts its next frame.
+  const size_t numThreads = 4;
+  const size_t objectsPerThread = 8;
+  auto objectName = [](size_t t, size_t i)
+  {
+    return "obj" + std::to_string(t) + "_" + std::to_string(i);
+  };
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < numThreads; ++t)
+  {
+    threads.push_back(std::thread([this, t, objectsPerThread, &objectName]()
+    {
+      for (size_t i = 0; i < objectsPerThread; ++i)
+      {
+        std::string name = objectName(t, i);
+        EXPECT_TRUE(mSpire->queueAddObject(name));
+        EXPECT_TRUE(mSpire->queueObjectGlobalUniform(
+            name, "uScale", static_cast<float>(t * objectsPerThread + i)));
+      }
+    }));
+  }
+  for (auto it = threads.begin(); it != threads.end(); ++it)
+    it->join();
+
+  EXPECT_EQ(0u, mSpire->getNumObjects());
+  mSpire->beginFrame();
+  EXPECT_EQ(numThreads * objectsPerThread, mSpire->getNumObjects());
+  for (size_t t = 0; t < numThreads; ++t)
+  {
+    for (size_t i = 0; i < objectsPerThread; ++i)
+    {
+      EXPECT_FLOAT_EQ(static_cast<float>(t * objectsPerThread + i),
+                      mSpire->getObjectGlobalUniform<float>(objectName(t, i),
+                                                            "uScale"));
+    }
+  }
+
+  // Edits are applied in queue order, and failing edits do not stop the
+  // ones after them.
+  EXPECT_TRUE(mSpire->queueRemoveObject("doesNotExist"));
+  EXPECT_TRUE(mSpire->queueGlobalUniform("uProjIVObject",
+                                         myCamera->getWorldToProjection()));
+  EXPECT_TRUE(mSpire->queueObjectGlobalUniform(objectName(0, 0), "uScale", 1.0f));
+  EXPECT_TRUE(mSpire->queueObjectGlobalUniform(objectName(0, 0), "uScale", 2.0f));
+  for (size_t i = 1; i < objectsPerThread; ++i)
+    EXPECT_TRUE(mSpire->queueRemoveObject(objectName(0, i)));
+  mSpire->beginFrame();
+  EXPECT_EQ((numThreads - 1) * objectsPerThread + 1, mSpire->getNumObjects());
+  EXPECT_EQ(3 + objectsPerThread, mSpire->getFrameStatistics().numCommandsQueued);
+  EXPECT_EQ(2 + objectsPerThread, mSpire->getFrameStatistics().numCommandsApplied);
+  EXPECT_FLOAT_EQ(2.0f, mSpire->getObjectGlobalUniform<float>(objectName(0, 0),
+                                                             "uScale"));
+  EXPECT_EQ(myCamera->getWorldToProjection(),
+            mSpire->getGlobalUniform<M44>("uProjIVObject"));
+
+  std::string longName(SceneCommand::NameSize, 'x');
+  EXPECT_THROW(mSpire->queueAddObject(longName), std::invalid_argument);
+  float values[2] = {0.0f, 0.0f};
+  EXPECT_THROW(mSpire->queueObjectGlobalUniformConcrete(
+                   objectName(0, 0), "uScale", UNIFORM_FLOAT_VEC3, values,
+                   sizeof(values)),
+               std::invalid_argument);
+
+  // Queued VBO updates: squash the quad into the bottom half of the screen.
+  mSpire->addObject("quad");
+  mSpire->addPassToObject("quad", "UniformColor", "quad", "quad",
+                          Interface::TRIANGLE_STRIP);
+  mSpire->addObjectPassUniform("quad", "uColor", V4(1.0f, 0.0f, 0.0f, 1.0f));
+
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  auto readPixel = [](GLint x, GLint y)
+  {
+    uint8_t pixel[4];
+    glReadPixels(x, y, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixel);
+    return pixel[0];
+  };
+  GLint centerX = viewport[0] + viewport[2] / 2;
+  GLint topY = viewport[1] + viewport[3] * 3 / 4;
+  GLint bottomY = viewport[1] + viewport[3] / 4;
+
+  beginFrame();
+  mSpire->beginFrame();
+  mSpire->renderObject("quad");
+  EXPECT_EQ(255, readPixel(centerX, topY));
+  EXPECT_EQ(255, readPixel(centerX, bottomY));
+
+  std::vector<float> top = {-1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f};
+  EXPECT_TRUE(mSpire->queueUpdateVBO("quad", 0,
+                                     reinterpret_cast<uint8_t*>(&top[0]),
+                                     top.size() * sizeof(float)));
+  EXPECT_TRUE(mSpire->queueUpdateVBO("doesNotExist", 0,
+                                     reinterpret_cast<uint8_t*>(&top[0]),
+                                     top.size() * sizeof(float)));
+  beginFrame();
+  mSpire->beginFrame();
+  EXPECT_EQ(2u, mSpire->getFrameStatistics().numCommandsApplied);
+  mSpire->renderObject("quad");
+  EXPECT_EQ(0, readPixel(centerX, topY));
+  EXPECT_EQ(255, readPixel(centerX, bottomY));
+}
+
+} // namespace
@@ -0,0 +1,275 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include <atomic>
+#include <thread>
+#include <batch-testing/GlobalGTestEnv.hpp>
+#include <batch-testing/SpireTestFixture.hpp>
+#include "namespaces.h"
+
+#include "spire/src/Common.h"
+#include "spire/src/RCU.h"
+#include "spire/src/SceneBuffer.h"
+#include "spire/src/SpireObject.h"
+#include "spire/src/VBOObject.h"
+
+#include "TestCamera.h"
+#include "TestCommon.h"
+
+using namespace spire;
+using namespace CPM_BATCH_TESTING_NS;
+
+namespace {
+
+struct Pair
+{
+  explicit Pair(size_t v) : first(v), second(v) {}
+  size_t first;
+  size_t second;
+};
+
+//------------------------------------------------------------------------------
+TEST(RCU, TestGracePeriod)
+{
+  std::shared_ptr<const Pair> initial = std::make_shared<const Pair>(0);
+  std::weak_ptr<const Pair> weakInitial = initial;
+  RCUValue<Pair> rcu(initial);
+  initial.reset();
+
+  std::unique_ptr<RCUValue<Pair>::ReadGuard> reader(
+      new RCUValue<Pair>::ReadGuard(rcu));
+  rcu.update(std::make_shared<const Pair>(1));
+
+  // New readers see the new value right away; the old one stays alive for
+  // the reader that still holds it.
+  {
+    RCUValue<Pair>::ReadGuard guard(rcu);
+    EXPECT_EQ(1u, guard->first);
+  }
+  EXPECT_EQ(0u, rcu.reclaim());
+  EXPECT_EQ(1u, rcu.getNumRetired());
+  EXPECT_EQ(0u, (*reader)->first);
+  EXPECT_FALSE(weakInitial.expired());
+
+  reader.reset();
+  EXPECT_EQ(1u, rcu.reclaim());
+  EXPECT_EQ(0u, rcu.getNumRetired());
+  EXPECT_TRUE(weakInitial.expired());
+}
+
+//------------------------------------------------------------------------------
+TEST(RCU, TestConcurrentReaders)
+{
+  RCUValue<Pair> rcu(std::make_shared<const Pair>(0));
+  const size_t numUpdates = 20000;
+
+  std::atomic<bool> done(false);
+  std::atomic<size_t> numTorn(0);
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 4; ++i)
+  {
+    readers.emplace_back([&rcu, &done, &numTorn]()
+    {
+      size_t last = 0;
+      while (!done)
+      {
+        RCUValue<Pair>::ReadGuard guard(rcu);
+        if (guard->first != guard->second || guard->first < last)
+          ++numTorn;
+        last = guard->first;
+      }
+    });
+  }
+
+  for (size_t i = 1; i <= numUpdates; ++i)
+  {
+    rcu.update(std::make_shared<const Pair>(i));
+    if (i % 16 == 0)
+      rcu.reclaim();
+  }
+  done = true;
+  for (auto it = readers.begin(); it != readers.end(); ++it)
+    it->join();
+
+  EXPECT_EQ(0u, numTorn.load());
+  rcu.reclaim();
+  rcu.reclaim();
+  EXPECT_EQ(0u, rcu.getNumRetired());
+}
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, TestLockFreeQueries)
+{
+  std::unique_ptr<TestCamera> myCamera = std::unique_ptr<TestCamera>(new TestCamera);
+  std::vector<float> vboData = 
+  {
+    -1.0f,  1.0f,  0.0f,
+     1.0f,  1.0f,  0.0f,
+    -1.0f, -1.0f,  0.0f,
+     1.0f, -1.0f,  0.0f
+  };
+  std::vector<uint16_t> iboData = {0, 1, 2, 3};
+  mSpire->addVBO("quad", reinterpret_cast<uint8_t*>(&vboData[0]),
+                 vboData.size() * sizeof(float), {"aPos"});
+  mSpire->addIBO("quad", reinterpret_cast<uint8_t*>(&iboData[0]),
+                 iboData.size() * sizeof(uint16_t), Interface::IBO_16BIT);
+  mSpire->addPersistentShader(
+      "UniformColor", 
+      { std::make_tuple("UniformColor.vsh", Interface::VERTEX_SHADER), 
+        std::make_tuple("UniformColor.fsh", Interface::FRAGMENT_SHADER),
+      });
+  mSpire->addGlobalUniform("uProjIVObject", myCamera->getWorldToProjection());
+  mSpire->addGlobalUniform("uFrame", 0.0f);
+  mSpire->addObject("quad");
+  mSpire->addPassToObject("quad", "UniformColor", "quad", "quad",
+                          Interface::TRIANGLE_STRIP);
+  mSpire->addObjectPassUniform("quad", "uColor", V4(0.0f, 0.0f, 0.0f, 1.0f));
+
+  // Queries see edits as soon as they are made, before any frame.
+  EXPECT_EQ(1u, mSpire->getNumObjects());
+  EXPECT_EQ(0.0f, mSpire->getGlobalUniform<float>("uFrame"));
+  EXPECT_TRUE(mSpire->getUnsatisfiedUniforms("quad").size() > 0);
+  EXPECT_THROW(mSpire->getObjectWithName("missing"), std::out_of_range);
+
+  // Readers query while this thread edits and renders. Every answer must be
+  // one the scene actually had.
+  std::atomic<bool> done(false);
+  std::atomic<size_t> numBadAnswers(0);
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 3; ++i)
+  {
+    readers.emplace_back([this, &done, &numBadAnswers]()
+    {
+      while (!done)
+      {
+        size_t numObjects = mSpire->getNumObjects();
+        V4 color = mSpire->getObjectPassUniform<V4>("quad", "uColor");
+        float frame = mSpire->getGlobalUniform<float>("uFrame");
+        size_t numUnsatisfied = mSpire->getUnsatisfiedUniforms("quad").size();
+        if (   (numObjects != 1 && numObjects != 2)
+            || (color.x != 0.0f && color.x != 1.0f)
+            || frame < 0.0f || numUnsatisfied == 0)
+          ++numBadAnswers;
+      }
+    });
+  }
+
+  for (int i = 0; i < 200; ++i)
+  {
+    float value = (i % 2) ? 1.0f : 0.0f;
+    mSpire->addObjectPassUniform("quad", "uColor", V4(value, 0.0f, 0.0f, 1.0f));
+    mSpire->addGlobalUniform("uFrame", static_cast<float>(i));
+    mSpire->addObject("temp");
+    mSpire->beginFrame();
+    beginFrame();
+    mSpire->renderObject("quad");
+    mSpire->removeObject("temp");
+  }
+  done = true;
+  for (auto it = readers.begin(); it != readers.end(); ++it)
+    it->join();
+
+  EXPECT_EQ(0u, numBadAnswers.load());
+  EXPECT_EQ(199.0f, mSpire->getGlobalUniform<float>("uFrame"));
+  EXPECT_EQ(1u, mSpire->getNumObjects());
+}
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, TestObjectHandlesReleasedOnRenderThread)
+{
+  std::vector<float> vboData = {0.0f, 0.0f, 0.0f};
+  std::vector<uint16_t> iboData = {0};
+  mSpire->addVBO("point", reinterpret_cast<uint8_t*>(&vboData[0]),
+                 vboData.size() * sizeof(float), {"aPos"});
+  mSpire->addIBO("point", reinterpret_cast<uint8_t*>(&iboData[0]),
+                 iboData.size() * sizeof(uint16_t), Interface::IBO_16BIT);
+  mSpire->addPersistentShader(
+      "UniformColor", 
+      { std::make_tuple("UniformColor.vsh", Interface::VERTEX_SHADER), 
+        std::make_tuple("UniformColor.fsh", Interface::FRAGMENT_SHADER),
+      });
+  mSpire->addObject("point");
+  mSpire->addPassToObject("point", "UniformColor", "point", "point",
+                          Interface::POINTS);
+  mSpire->removeVBO("point");
+  mSpire->removeIBO("point");
+
+  // Once the object is gone from the scene, the handle holds the last
+  // reference to its buffers.
+  std::shared_ptr<const SpireObject> handle = mSpire->getObjectWithName("point");
+  GLuint vbo = handle->getObjectPassParams(SPIRE_DEFAULT_PASS)->getVBO()->getGLIndex();
+  mSpire->removeObject("point");
+  for (int i = 0; i < 3; ++i)
+    mSpire->beginFrame();
+  EXPECT_TRUE(glIsBuffer(vbo));
+
+  // Dropping it on a thread without a context defers the release to the
+  // next frame on the render thread.
+  std::thread dropper([&handle]() {handle.reset();});
+  dropper.join();
+  EXPECT_TRUE(glIsBuffer(vbo));
+  mSpire->beginFrame();
+  EXPECT_FALSE(glIsBuffer(vbo));
+}
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, TestObjectHandlesWithoutFrames)
+{
+  addQuadResources(mSpire);
+  mSpire->addObject("quad");
+  mSpire->addPassToObject("quad", "UniformColor", "quad", "quad",
+                          Interface::TRIANGLE_STRIP);
+
+  // A host that only queries, and never renders, must not pile up handles.
+  SceneBuffer scene;
+  scene.addObject(mSpire->getObjectWithName("quad")->clone());
+  for (int i = 0; i < 10000; ++i)
+  {
+    EXPECT_EQ("quad", scene.getObject("quad")->getName());
+    EXPECT_THROW(scene.getObject("missing"), std::out_of_range);
+  }
+  EXPECT_GT(100u, scene.getNumObjectsToRelease());
+
+  // Neither must edits: only the objects they replaced are kept for the
+  // render thread.
+  for (int i = 0; i < 1000; ++i)
+  {
+    scene.editObject("quad", [](SpireObject&) {});
+    EXPECT_EQ(1u, scene.getNumObjects());
+  }
+  EXPECT_GT(1100u, scene.getNumObjectsToRelease());
+  scene.publish();
+  EXPECT_EQ(0u, scene.getNumObjectsToRelease());
+
+  // The same through the interface.
+  for (int i = 0; i < 10000; ++i)
+    EXPECT_EQ("quad", mSpire->getObjectWithName("quad")->getName());
+}
+
+} // namespace
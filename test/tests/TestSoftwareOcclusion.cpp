@@ -0,0 +1,312 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <batch-testing/GlobalGTestEnv.hpp>
+#include <batch-testing/SpireTestFixture.hpp>
+#include "namespaces.h"
+
+#include "spire/src/Common.h"
+#include "spire/src/FramePrep.h"
+#include "spire/src/HiZBuffer.h"
+#include "spire/src/SceneBuffer.h"
+#include "spire/src/SpireObject.h"
+
+#include "TestCamera.h"
+#include "TestCommon.h"
+
+using namespace spire;
+using namespace CPM_BATCH_TESTING_NS;
+
+namespace {
+
+//------------------------------------------------------------------------------
+/// Quad covering [-1, 1] in x and y, scaled by 'scale' at 'position'.
+Occluder makeQuadOccluder(const M44& worldToProjection, const V3& position,
+                          float scale)
+{
+  std::shared_ptr<std::vector<V3>> positions = std::make_shared<std::vector<V3>>();
+  positions->push_back(V3(-1.0f, -1.0f, 0.0f));
+  positions->push_back(V3( 1.0f, -1.0f, 0.0f));
+  positions->push_back(V3(-1.0f,  1.0f, 0.0f));
+  positions->push_back(V3( 1.0f,  1.0f, 0.0f));
+  std::shared_ptr<std::vector<uint32_t>> indices =
+      std::make_shared<std::vector<uint32_t>>();
+  uint32_t quad[6] = {0, 1, 2, 1, 3, 2};
+  indices->assign(quad, quad + 6);
+
+  Occluder occluder;
+  occluder.objectToProjection = worldToProjection * makeTransform(position, scale);
+  occluder.positions = positions;
+  occluder.indices = indices;
+  occluder.primitive = GL_TRIANGLES;
+  return occluder;
+}
+
+} // namespace
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, TestHiZBuffer)
+{
+  std::unique_ptr<TestCamera> myCamera = std::unique_ptr<TestCamera>(new TestCamera);
+  M44 worldToProjection = myCamera->getWorldToProjection();
+
+  // A wall of 1 x 1, 3 units in front of the camera, in the middle of the
+  // view.
+  HiZBuffer hiz;
+  std::vector<Occluder> occluders;
+  occluders.push_back(makeQuadOccluder(worldToProjection, V3(0.0f, 0.0f, 2.0f), 0.5f));
+  hiz.render(occluders, worldToProjection);
+  EXPECT_EQ(2u, hiz.getNumTriangles());
+
+  const V3 extent(0.2f, 0.2f, 0.2f);
+  EXPECT_FALSE(hiz.isBoxVisible(V3(0.0f, 0.0f, -1.0f), extent));
+  EXPECT_FALSE(hiz.isBoxVisible(V3(0.0f, 0.0f, 1.5f), extent * 0.5f));
+  EXPECT_TRUE(hiz.isBoxVisible(V3(0.0f, 0.0f, 3.0f), extent));
+  EXPECT_TRUE(hiz.isBoxVisible(V3(0.0f, 0.0f, 2.0f), extent));   // Through the wall.
+  EXPECT_TRUE(hiz.isBoxVisible(V3(1.5f, 0.0f, -1.0f), extent));  // Sticks out.
+  EXPECT_TRUE(hiz.isBoxVisible(V3(0.0f, 0.0f, 4.95f), extent));  // Reaches the near plane.
+
+  // Every pyramid texel is at least as far as the four below it.
+  for (int level = 1; level < HiZBuffer::NumLevels; ++level)
+  {
+    for (int y = 0; y < (HiZBuffer::Height >> level); ++y)
+    {
+      for (int x = 0; x < (HiZBuffer::Width >> level); ++x)
+      {
+        float depth = hiz.getDepth(x, y, level);
+        for (int c = 0; c < 4; ++c)
+          EXPECT_LE(hiz.getDepth(2 * x + (c & 1), 2 * y + (c >> 1), level - 1), depth);
+      }
+    }
+  }
+  float wallDepth = hiz.getDepth(HiZBuffer::Width / 2, HiZBuffer::Height / 2);
+  EXPECT_LT(0.0f, wallDepth);
+  EXPECT_GT(1.0f, wallDepth);
+  EXPECT_EQ(std::numeric_limits<float>::infinity(), hiz.getDepth(0, HiZBuffer::Height / 2));
+
+  // Four at a time, with a scalar tail, gives the same answers as one at a
+  // time.
+  const size_t numBoxes = 1003;
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<float> spread(-1.0f, 1.0f);
+  std::uniform_real_distribution<float> depth(-2.0f, 2.0f);
+  std::uniform_real_distribution<float> size(0.01f, 0.3f);
+  std::vector<float> soa[6];
+  std::vector<uint8_t> visible(numBoxes, 1);
+  for (size_t i = 0; i < numBoxes; ++i)
+  {
+    soa[0].push_back(spread(rng));
+    soa[1].push_back(spread(rng));
+    soa[2].push_back(depth(rng));
+    soa[3].push_back(size(rng));
+    soa[4].push_back(size(rng));
+    soa[5].push_back(size(rng));
+  }
+  visible[7] = 0;
+  hiz.cullBoxes(&soa[0][0], &soa[1][0], &soa[2][0], &soa[3][0], &soa[4][0],
+                &soa[5][0], numBoxes, &visible[0]);
+  size_t numOccluded = 0;
+  for (size_t i = 0; i < numBoxes; ++i)
+  {
+    bool expected = i != 7 && hiz.isBoxVisible(V3(soa[0][i], soa[1][i], soa[2][i]),
+                                               V3(soa[3][i], soa[4][i], soa[5][i]));
+    EXPECT_EQ(expected, visible[i] != 0);
+    if (!expected)
+      ++numOccluded;
+  }
+  EXPECT_LT(100u, numOccluded);
+
+  // Nothing is hidden by an empty buffer.
+  hiz.clear(worldToProjection);
+  EXPECT_TRUE(hiz.isBoxVisible(V3(0.0f, 0.0f, -1.0f), extent));
+  EXPECT_EQ(0u, hiz.getNumTriangles());
+}
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, TestSoftwareOcclusionCulling)
+{
+  std::unique_ptr<TestCamera> myCamera = std::unique_ptr<TestCamera>(new TestCamera);
+  mSpire->setMeshRetention(true);
+  addGridResources(mSpire, 4);
+
+  // A wall filling the view hides a grid of 11 x 11 small quads.
+  addGridObject(mSpire, "wall", V3(0.0f, 0.0f, 2.0f), 3.0f);
+  const size_t numHidden = 11 * 11;
+  for (int y = 0; y < 11; ++y)
+  {
+    for (int x = 0; x < 11; ++x)
+    {
+      V3 position(0.2f * static_cast<float>(x - 5), 0.2f * static_cast<float>(y - 5), -2.0f);
+      addGridObject(mSpire, "hidden" + std::to_string(y * 11 + x), position, 0.08f);
+    }
+  }
+
+  // Unlike occlusion queries, results are in the frame they are asked for.
+  std::vector<std::string> passes = {SPIRE_DEFAULT_PASS};
+  EXPECT_EQ(1 + numHidden, mSpire->prepareFrame(myCamera->getWorldToProjection(), passes));
+  mSpire->setSoftwareOcclusionCulling(true);
+  EXPECT_EQ(1u, mSpire->prepareFrame(myCamera->getWorldToProjection(), passes));
+  EXPECT_EQ(1u, mSpire->getNumOccluders());
+  EXPECT_EQ(numHidden, mSpire->getNumOccludedObjects());
+
+  // Small objects are not picked as occluders unless flagged.
+  mSpire->setObjectOccluder("hidden0", true);
+  EXPECT_EQ(1u, mSpire->prepareFrame(myCamera->getWorldToProjection(), passes));
+  EXPECT_EQ(2u, mSpire->getNumOccluders());
+
+  // Once the wall is moved away everything is back in the next frame.
+  mSpire->setObjectTransform("wall", makeTransform(V3(100.0f, 0.0f, 2.0f), 3.0f));
+  EXPECT_EQ(numHidden, mSpire->prepareFrame(myCamera->getWorldToProjection(), passes));
+  EXPECT_EQ(1u, mSpire->getNumOccluders());
+  EXPECT_EQ(0u, mSpire->getNumOccludedObjects());
+
+  mSpire->setObjectTransform("wall", makeTransform(V3(0.0f, 0.0f, 2.0f), 3.0f));
+  EXPECT_EQ(1u, mSpire->prepareFrame(myCamera->getWorldToProjection(), passes));
+  mSpire->setSoftwareOcclusionCulling(false);
+  EXPECT_EQ(1 + numHidden, mSpire->prepareFrame(myCamera->getWorldToProjection(), passes));
+  EXPECT_EQ(0u, mSpire->getNumOccluders());
+  EXPECT_EQ(0u, mSpire->getNumOccludedObjects());
+}
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, DISABLED_TestSoftwareOcclusionCullingBenchmark)
+{
+  std::unique_ptr<TestCamera> myCamera = std::unique_ptr<TestCamera>(new TestCamera);
+  M44 worldToProjection = myCamera->getWorldToProjection();
+  mSpire->setMeshRetention(true);
+  addGridResources(mSpire, 20);
+  addGridObject(mSpire, "prototype", V3(0.0f, 0.0f, 0.0f), 1.0f);
+
+  // 100000 small objects in a box behind four walls which between them
+  // hide about half of it, drawing 800 triangles each.
+  const size_t numObjects = 100000;
+  std::shared_ptr<const SpireObject> prototype = mSpire->getObjectWithName("prototype");
+  std::vector<std::shared_ptr<SpireObject>> objects;
+  std::mt19937 rng(1234);
+  std::uniform_real_distribution<float> spread(-3.0f, 3.0f);
+  std::uniform_real_distribution<float> depth(-20.0f, 0.0f);
+  for (size_t i = 0; i < numObjects; ++i)
+  {
+    std::shared_ptr<SpireObject> object = prototype->clone();
+    object->setTransform(makeTransform(V3(spread(rng), spread(rng), depth(rng)), 0.05f));
+    objects.push_back(object);
+  }
+  for (int w = 0; w < 4; ++w)
+  {
+    std::shared_ptr<SpireObject> wall = prototype->clone();
+    V3 position(0.6f * static_cast<float>(w % 2) - 0.3f,
+                0.6f * static_cast<float>(w / 2) - 0.3f, 1.0f);
+    wall->setTransform(makeTransform(position, 0.25f));
+    objects.push_back(wall);
+  }
+  std::shared_ptr<const SceneVersion> scene = makeScene(objects);
+  std::vector<std::string> passes = {SPIRE_DEFAULT_PASS};
+
+  // The camera moves a little every frame.
+  auto timePrepare = [&](FramePrep& prep) -> double
+  {
+    double best = 0.0;
+    for (int run = 0; run < 5; ++run)
+    {
+      M44 shift;
+      shift[3] = V4(0.001f * static_cast<float>(4 - run), 0.0f, 0.0f, 1.0f);
+      std::chrono::high_resolution_clock::time_point start =
+          std::chrono::high_resolution_clock::now();
+      prep.prepare(scene, worldToProjection * shift, passes);
+      double ms = std::chrono::duration<double, std::milli>(
+          std::chrono::high_resolution_clock::now() - start).count();
+      if (run == 0 || ms < best)
+        best = ms;
+    }
+    return best;
+  };
+
+  FramePrep without;
+  double withoutMs = timePrepare(without);
+  FramePrep with;
+  with.setSoftwareOcclusionCulling(true);
+  double withMs = timePrepare(with);
+  EXPECT_EQ(4u, with.getNumOccluders());
+  EXPECT_LT(0u, with.getNumOccludedObjects());
+  EXPECT_EQ(without.getNumVisibleObjects(),
+            with.getNumVisibleObjects() + with.getNumOccludedObjects());
+
+  // The occluder and box tests alone.
+  std::vector<Occluder> occluders;
+  for (int w = 0; w < 4; ++w)
+  {
+    V3 position(0.6f * static_cast<float>(w % 2) - 0.3f,
+                0.6f * static_cast<float>(w / 2) - 0.3f, 1.0f);
+    occluders.push_back(makeQuadOccluder(worldToProjection, position, 0.25f));
+  }
+  HiZBuffer hiz;
+  std::vector<float> soa[6];
+  for (size_t i = 0; i < numObjects; ++i)
+  {
+    V3 center = V3(objects[i]->getTransform()[3]);
+    soa[0].push_back(center.x);
+    soa[1].push_back(center.y);
+    soa[2].push_back(center.z);
+    for (int a = 3; a < 6; ++a)
+      soa[a].push_back(0.05f);
+  }
+  double renderMs = 0.0;
+  double cullMs = 0.0;
+  size_t numCulled = 0;
+  for (int run = 0; run < 5; ++run)
+  {
+    std::chrono::high_resolution_clock::time_point start =
+        std::chrono::high_resolution_clock::now();
+    hiz.render(occluders, worldToProjection);
+    std::chrono::high_resolution_clock::time_point rendered =
+        std::chrono::high_resolution_clock::now();
+    std::vector<uint8_t> visible(numObjects, 1);
+    hiz.cullBoxes(&soa[0][0], &soa[1][0], &soa[2][0], &soa[3][0], &soa[4][0],
+                  &soa[5][0], numObjects, &visible[0]);
+    std::chrono::high_resolution_clock::time_point culled =
+        std::chrono::high_resolution_clock::now();
+    double ms = std::chrono::duration<double, std::milli>(rendered - start).count();
+    renderMs = run == 0 ? ms : std::min(renderMs, ms);
+    ms = std::chrono::duration<double, std::milli>(culled - rendered).count();
+    cullMs = run == 0 ? ms : std::min(cullMs, ms);
+    numCulled = numObjects - static_cast<size_t>(
+        std::count(visible.begin(), visible.end(), static_cast<uint8_t>(1)));
+  }
+  EXPECT_LT(numObjects / 4, numCulled);
+
+  std::cout << "Software occlusion culling " << numObjects << " objects: "
+            << with.getNumOccludedObjects() << " culled behind "
+            << with.getNumOccluders() << " occluders, prepareFrame " << withMs
+            << " ms, " << withoutMs << " ms without; occluders " << renderMs
+            << " ms, box tests " << cullMs << " ms (" << numCulled
+            << " culled)." << std::endl;
+}
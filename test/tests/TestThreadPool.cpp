@@ -0,0 +1,223 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <batch-testing/GlobalGTestEnv.hpp>
+#include <batch-testing/SpireTestFixture.hpp>
+#include "namespaces.h"
+
+#include "spire/src/Common.h"
+#include "spire/src/Exceptions.h"
+#include "spire/src/Parallel.h"
+#include "spire/src/ThreadPool.h"
+
+#include "TestCamera.h"
+
+using namespace spire;
+using namespace CPM_BATCH_TESTING_NS;
+
+namespace {
+
+//------------------------------------------------------------------------------
+TEST(ThreadPool, TestAsyncResults)
+{
+  ThreadPool pool(3);
+  EXPECT_EQ(3u, pool.getNumThreads());
+
+  std::vector<std::future<size_t>> results;
+  for (size_t i = 0; i < 200; ++i)
+    results.push_back(pool.async([i]() { return i * i; }));
+  for (size_t i = 0; i < results.size(); ++i)
+    EXPECT_EQ(i * i, results[i].get());
+
+  std::future<int> failed = pool.async([]() -> int
+  {
+    throw std::invalid_argument("failed");
+  });
+  EXPECT_THROW(failed.get(), std::invalid_argument);
+}
+
+//------------------------------------------------------------------------------
+TEST(ThreadPool, TestIdleWorkersSteal)
+{
+  ThreadPool pool(4);
+  std::mutex mutex;
+  std::set<std::thread::id> threads;
+
+  // Subtasks land in the deque of the worker running the outer task; the
+  // other workers can only get to them by stealing.
+  std::future<void> outer = pool.async([&]()
+  {
+    std::vector<std::future<void>> inner;
+    for (int i = 0; i < 64; ++i)
+    {
+      inner.push_back(pool.async([&]()
+      {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        std::lock_guard<std::mutex> lock(mutex);
+        threads.insert(std::this_thread::get_id());
+      }));
+    }
+    for (auto it = inner.begin(); it != inner.end(); ++it)
+    {
+      while (it->wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        pool.runPendingTask();
+    }
+  });
+  outer.get();
+  EXPECT_LT(1u, threads.size());
+}
+
+//------------------------------------------------------------------------------
+TEST(ThreadPool, TestNestedParallelFor)
+{
+  // With a single worker busy in the outer tasks, the inner loops only
+  // finish because waiting threads run queued work themselves.
+  ThreadPool::setSharedNumThreads(1);
+  std::shared_ptr<ThreadPool> pool = ThreadPool::getShared();
+  EXPECT_EQ(1u, pool->getNumThreads());
+
+  std::atomic<size_t> sum(0);
+  std::vector<std::future<void>> outer;
+  for (size_t i = 0; i < 4; ++i)
+  {
+    outer.push_back(pool->async([&sum]()
+    {
+      parallelFor(100, [&sum](size_t j) { sum += j; });
+    }));
+  }
+  parallelFor(100, [&sum](size_t j) { sum += j; });
+  for (auto it = outer.begin(); it != outer.end(); ++it)
+    it->get();
+  EXPECT_EQ(5u * 4950u, sum.load());
+
+  EXPECT_THROW(parallelFor(100, [](size_t j)
+                           {
+                             if (j == 50)
+                               throw std::runtime_error("stop");
+                           }),
+               std::runtime_error);
+
+  pool.reset();
+  ThreadPool::setSharedNumThreads(0);
+}
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, TestLoadMeshAsync)
+{
+  std::unique_ptr<TestCamera> myCamera = std::unique_ptr<TestCamera>(new TestCamera);
+
+  std::string shaderName = "DirGouraud";
+  mSpire->addPersistentShader(
+      shaderName, 
+      { std::make_tuple("DirGouraud.vsh", Interface::VERTEX_SHADER), 
+        std::make_tuple("DirGouraud.fsh", Interface::FRAGMENT_SHADER),
+      });
+  mSpire->addGlobalUniform("uLightDirWorld", V3(1.0f, 0.0f, 0.0f));
+  myCamera->setCommonUniforms(mSpire);
+
+  std::vector<std::string> attribNames = {"aPos", "aNormal"};
+  auto addSphereObject = [&](const std::string& objectName,
+                             const std::string& bufferName)
+  {
+    mSpire->addObject(objectName);
+    mSpire->addPassToObject(objectName, shaderName, bufferName, bufferName,
+                            Interface::TRIANGLES);
+    mSpire->addObjectPassUniform(objectName, "uAmbientColor", V4(0.1f, 0.1f, 0.1f, 1.0f));
+    mSpire->addObjectPassUniform(objectName, "uDiffuseColor", V4(0.8f, 0.8f, 0.0f, 1.0f));
+    mSpire->addObjectPassUniform(objectName, "uSpecularColor", V4(0.5f, 0.5f, 0.5f, 1.0f));
+    mSpire->addObjectPassUniform(objectName, "uSpecularPower", 32.0f);
+    M44 xform;
+    mSpire->addObjectPassUniform(objectName, "uObject", xform);
+    mSpire->addObjectGlobalUniform(objectName, "uProjIVObject",
+                                   myCamera->getWorldToProjection() * xform);
+  };
+
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  auto readPixels = [&viewport]()
+  {
+    std::vector<uint8_t> pixels(static_cast<size_t>(viewport[2] * viewport[3] * 4));
+    glReadPixels(viewport[0], viewport[1], viewport[2], viewport[3], GL_RGBA,
+                 GL_UNSIGNED_BYTE, &pixels[0]);
+    return pixels;
+  };
+
+  // Reference image with the mesh loaded on this thread.
+  Interface::AssetInfo info;
+  {
+    std::vector<uint8_t> vbo;
+    std::vector<uint8_t> ibo;
+    std::ifstream file("Assets/Sphere.sp", std::ios::binary);
+    Interface::loadAssetFile(file, vbo, ibo, info);
+    mSpire->addVBO("sync", &vbo[0], vbo.size(), attribNames);
+    mSpire->addIBO("sync", &ibo[0], ibo.size(), info.iboType);
+    addSphereObject("sync", "sync");
+  }
+  beginFrame();
+  mSpire->renderObject("sync");
+  std::vector<uint8_t> reference = readPixels();
+  mSpire->removeObject("sync");
+
+  std::future<Interface::MeshHandle> sphere =
+      mSpire->loadMeshAsync("Assets/Sphere.sp", attribNames);
+  std::future<Interface::MeshHandle> missing =
+      mSpire->loadMeshAsync("Assets/DoesNotExist.sp", attribNames);
+  std::future<Interface::MeshHandle> duplicate =
+      mSpire->loadMeshAsync("Assets/Sphere.sp", attribNames, "sync");
+
+  // The render thread keeps going while the loads run in the background.
+  size_t numFinished = 0;
+  while (sphere.wait_for(std::chrono::seconds(0)) != std::future_status::ready
+         || duplicate.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+  {
+    numFinished += mSpire->processAsyncLoads();
+    std::this_thread::yield();
+  }
+  EXPECT_EQ(2u, numFinished);
+
+  EXPECT_THROW(missing.get(), std::runtime_error);
+  EXPECT_THROW(duplicate.get(), Duplicate);
+
+  Interface::MeshHandle handle = sphere.get();
+  EXPECT_EQ("Assets/Sphere.sp", handle.name);
+  EXPECT_EQ(info.numTriangles, handle.info.numTriangles);
+  EXPECT_EQ(info.stride, handle.info.stride);
+
+  addSphereObject("async", handle.name);
+  beginFrame();
+  mSpire->renderObject("async");
+  EXPECT_EQ(reference, readPixels());
+}
+
+} // namespace
@@ -0,0 +1,352 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <batch-testing/GlobalGTestEnv.hpp>
+#include <batch-testing/SpireTestFixture.hpp>
+#include "namespaces.h"
+
+#include "spire/src/Common.h"
+#include "spire/src/TriangleBVH.h"
+
+#include "TestCamera.h"
+
+using namespace spire;
+using namespace CPM_BATCH_TESTING_NS;
+
+namespace {
+
+//------------------------------------------------------------------------------
+/// Grid of 'cells' by 'cells' quads covering [-1, 1] in x and y with a
+/// gentle bump in z, drawn as GL_TRIANGLES.
+void makeGrid(size_t cells, std::vector<V3>& positions,
+              std::vector<uint32_t>& indices)
+{
+  size_t side = cells + 1;
+  positions.resize(side * side);
+  for (size_t y = 0; y < side; ++y)
+  {
+    for (size_t x = 0; x < side; ++x)
+    {
+      float fx = 2.0f * static_cast<float>(x) / static_cast<float>(cells) - 1.0f;
+      float fy = 2.0f * static_cast<float>(y) / static_cast<float>(cells) - 1.0f;
+      positions[y * side + x] = V3(fx, fy, 0.1f * std::sin(3.0f * fx) * std::cos(3.0f * fy));
+    }
+  }
+
+  indices.clear();
+  indices.reserve(cells * cells * 6);
+  for (size_t y = 0; y < cells; ++y)
+  {
+    for (size_t x = 0; x < cells; ++x)
+    {
+      uint32_t corner = static_cast<uint32_t>(y * side + x);
+      uint32_t quad[6] = {corner, corner + 1, corner + static_cast<uint32_t>(side),
+                          corner + 1, corner + static_cast<uint32_t>(side) + 1,
+                          corner + static_cast<uint32_t>(side)};
+      indices.insert(indices.end(), quad, quad + 6);
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+/// Nearest hit of every triangle, tested one at a time.
+bool bruteForce(const std::vector<V3>& positions,
+                const std::vector<uint32_t>& indices, GLenum primitive,
+                const V3& origin, const V3& direction, float& distance)
+{
+  distance = std::numeric_limits<float>::infinity();
+  bool found = false;
+  size_t numTriangles = TriangleBVH::getNumTriangles(indices.size(), primitive);
+  for (size_t t = 0; t < numTriangles; ++t)
+  {
+    uint32_t v[3];
+    TriangleBVH::getTriangle(&indices[0], primitive, t, v);
+    float d = distance;
+    float u;
+    float w;
+    if (TriangleBVH::intersectTriangle(origin, direction, positions[v[0]],
+                                       positions[v[1]], positions[v[2]], d, u, w))
+    {
+      distance = d;
+      found = true;
+    }
+  }
+  return found;
+}
+
+//------------------------------------------------------------------------------
+/// Adds a retained grid, the shader to draw it and an object "grid" showing
+/// it, moved by 'offset'.
+void addGridObject(std::shared_ptr<Interface> spire, size_t cells, const V3& offset)
+{
+  std::vector<V3> positions;
+  std::vector<uint32_t> indices;
+  makeGrid(cells, positions, indices);
+  spire->setMeshRetention(true);
+  spire->addVBO("grid", reinterpret_cast<uint8_t*>(&positions[0]),
+                positions.size() * sizeof(V3), {"aPos"});
+  spire->addIBO("grid", reinterpret_cast<uint8_t*>(&indices[0]),
+                indices.size() * sizeof(uint32_t), Interface::IBO_32BIT);
+  spire->addPersistentShader(
+      "UniformColor",
+      { std::make_tuple("UniformColor.vsh", Interface::VERTEX_SHADER),
+        std::make_tuple("UniformColor.fsh", Interface::FRAGMENT_SHADER),
+      });
+
+  spire->addObject("grid");
+  spire->addPassToObject("grid", "UniformColor", "grid", "grid",
+                         Interface::TRIANGLES);
+  spire->addObjectPassUniform("grid", "uColor", V4(1.0f, 0.0f, 0.0f, 1.0f));
+  M44 transform;
+  transform[3] = V4(offset, 1.0f);
+  spire->setObjectTransform("grid", transform);
+}
+
+} // namespace
+
+//------------------------------------------------------------------------------
+TEST(TriangleBVHTests, TestPrimitives)
+{
+  std::vector<uint32_t> indices = {0, 1, 2, 3, 4};
+  uint32_t v[3];
+
+  EXPECT_EQ(1u, TriangleBVH::getNumTriangles(5, GL_TRIANGLES));
+  EXPECT_EQ(3u, TriangleBVH::getNumTriangles(5, GL_TRIANGLE_STRIP));
+  EXPECT_EQ(3u, TriangleBVH::getNumTriangles(5, GL_TRIANGLE_FAN));
+  EXPECT_EQ(0u, TriangleBVH::getNumTriangles(2, GL_TRIANGLE_STRIP));
+  EXPECT_EQ(0u, TriangleBVH::getNumTriangles(5, GL_LINES));
+
+  // Odd strip triangles are flipped to keep the winding.
+  TriangleBVH::getTriangle(&indices[0], GL_TRIANGLE_STRIP, 1, v);
+  EXPECT_EQ(2u, v[0]);
+  EXPECT_EQ(1u, v[1]);
+  EXPECT_EQ(3u, v[2]);
+  TriangleBVH::getTriangle(&indices[0], GL_TRIANGLE_STRIP, 2, v);
+  EXPECT_EQ(2u, v[0]);
+  EXPECT_EQ(3u, v[1]);
+  EXPECT_EQ(4u, v[2]);
+
+  TriangleBVH::getTriangle(&indices[0], GL_TRIANGLE_FAN, 2, v);
+  EXPECT_EQ(0u, v[0]);
+  EXPECT_EQ(3u, v[1]);
+  EXPECT_EQ(4u, v[2]);
+}
+
+//------------------------------------------------------------------------------
+TEST(TriangleBVHTests, TestIntersect)
+{
+  // A soup of random triangles, large and small, drawn as each primitive.
+  std::mt19937 rng(44);
+  std::uniform_real_distribution<float> coord(-10.0f, 10.0f);
+  std::uniform_real_distribution<float> size(0.01f, 3.0f);
+  std::vector<V3> positions;
+  for (size_t i = 0; i < 3000; ++i)
+  {
+    V3 center(coord(rng), coord(rng), coord(rng));
+    float s = size(rng);
+    positions.push_back(center + V3(coord(rng), coord(rng), coord(rng)) * (s / 10.0f));
+  }
+  std::uniform_int_distribution<uint32_t> vertex(
+      0, static_cast<uint32_t>(positions.size() - 1));
+
+  GLenum primitives[] = {GL_TRIANGLES, GL_TRIANGLE_STRIP, GL_TRIANGLE_FAN};
+  for (int p = 0; p < 3; ++p)
+  {
+    std::shared_ptr<std::vector<uint32_t>> indices =
+        std::make_shared<std::vector<uint32_t>>();
+    for (size_t i = 0; i < 6001; ++i)
+      indices->push_back(static_cast<uint32_t>(i % positions.size()));
+    // Degenerate and out of range triangles are left out.
+    (*indices)[4] = (*indices)[3];
+    indices->push_back(static_cast<uint32_t>(positions.size() + 5));
+
+    TriangleBVH bvh(positions, indices, primitives[p]);
+    EXPECT_EQ(TriangleBVH::getNumTriangles(indices->size(), primitives[p]),
+              bvh.getNumTriangles());
+
+    size_t numHits = 0;
+    for (int r = 0; r < 500; ++r)
+    {
+      V3 origin(coord(rng), coord(rng), 30.0f);
+      V3 target(coord(rng), coord(rng), -30.0f);
+      // Every fifth ray is limited to half its length.
+      float maxDistance = (r % 5 == 0) ? 0.5f : std::numeric_limits<float>::infinity();
+      V3 direction = target - origin;
+
+      float expected;
+      bool expectHit = bruteForce(positions, *indices, primitives[p], origin,
+                                  direction, expected)
+                       && expected < maxDistance;
+      TriangleHit hit;
+      bool found = bvh.intersect(origin, direction, maxDistance, hit);
+      ASSERT_EQ(expectHit, found);
+
+      // Picks test the triangles one by one until the BVH is built.
+      TriangleHit meshHit;
+      ASSERT_EQ(found, TriangleBVH::intersectMesh(positions, *indices, primitives[p],
+                                                  origin, direction, maxDistance,
+                                                  meshHit));
+      if (!found)
+        continue;
+      ++numHits;
+
+      // Distinct triangles may tie, so compare the distances.
+      EXPECT_NEAR(expected, hit.distance, 1e-5f);
+      EXPECT_NEAR(expected, meshHit.distance, 1e-5f);
+      V3 meshPoint = positions[meshHit.vertices[0]] * meshHit.barycentric[0]
+                   + positions[meshHit.vertices[1]] * meshHit.barycentric[1]
+                   + positions[meshHit.vertices[2]] * meshHit.barycentric[2];
+      EXPECT_NEAR(0.0f, glm::length(meshPoint - (origin + direction * meshHit.distance)),
+                  1e-3f);
+      uint32_t v[3];
+      TriangleBVH::getTriangle(&(*indices)[0], primitives[p], hit.triangle, v);
+      EXPECT_EQ(v[0], hit.vertices[0]);
+      EXPECT_EQ(v[1], hit.vertices[1]);
+      EXPECT_EQ(v[2], hit.vertices[2]);
+      V3 point = positions[v[0]] * hit.barycentric[0]
+               + positions[v[1]] * hit.barycentric[1]
+               + positions[v[2]] * hit.barycentric[2];
+      V3 onRay = origin + direction * hit.distance;
+      EXPECT_NEAR(0.0f, glm::length(point - onRay), 1e-3f);
+    }
+    EXPECT_LT(0u, numHits);
+  }
+}
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, TestPicking)
+{
+  std::unique_ptr<TestCamera> myCamera = std::unique_ptr<TestCamera>(new TestCamera);
+  addGridObject(mSpire, 16, V3(0.5f, 0.0f, 0.0f));
+  std::vector<std::string> passes = {SPIRE_DEFAULT_PASS};
+  mSpire->beginFrame();
+  mSpire->prepareFrame(myCamera->getWorldToProjection(), passes);
+
+  // Straight down onto the center of the quad second from the right in the
+  // top row of the grid.
+  V3 origin(0.5f + 1.0f - 3.0f / 16.0f, 1.0f - 1.0f / 16.0f, 5.0f);
+  Interface::PickResult result = mSpire->pickRay(origin, V3(0.0f, 0.0f, -1.0f));
+  ASSERT_TRUE(result.hit);
+  EXPECT_EQ("grid", result.object);
+  EXPECT_EQ(SPIRE_DEFAULT_PASS, result.pass);
+  EXPECT_NEAR(0.5f + 1.0f - 3.0f / 16.0f, result.position.x, 1e-5f);
+  EXPECT_NEAR(1.0f - 1.0f / 16.0f, result.position.y, 1e-5f);
+  EXPECT_NEAR(5.0f - result.position.z, result.distance, 1e-5f);
+  float weights = result.barycentric[0] + result.barycentric[1] + result.barycentric[2];
+  EXPECT_NEAR(1.0f, weights, 1e-5f);
+  // Quad (14, 15) is made of triangles 2 * (15 * 16 + 14) and the next one;
+  // its center lies on their shared edge.
+  EXPECT_TRUE(result.triangle == 2 * (15 * 16 + 14) || result.triangle == 2 * (15 * 16 + 14) + 1);
+
+  // Misses.
+  EXPECT_FALSE(mSpire->pickRay(V3(3.0f, 0.0f, 5.0f), V3(0.0f, 0.0f, -1.0f)).hit);
+  EXPECT_FALSE(mSpire->pickRay(origin, V3(0.0f, 0.0f, 1.0f)).hit);
+
+  // Through the center of the view (the camera looks down -z from z = 5).
+  result = mSpire->pick(0.0f, 0.0f);
+  ASSERT_TRUE(result.hit);
+  EXPECT_NEAR(0.0f, result.position.x, 1e-3f);
+  EXPECT_NEAR(0.0f, result.position.y, 1e-3f);
+  EXPECT_GT(result.distance, 0.0f);
+  EXPECT_LT(result.distance, 1.0f);
+
+  // A closer object without retained data is not picked.
+  mSpire->setMeshRetention(false);
+  std::vector<float> quad = {-1.0f, 1.0f, 0.0f,  1.0f, 1.0f, 0.0f,
+                             -1.0f, -1.0f, 0.0f,  1.0f, -1.0f, 0.0f};
+  std::vector<uint16_t> quadIndices = {0, 1, 2, 3};
+  mSpire->addVBO("quad", reinterpret_cast<uint8_t*>(&quad[0]),
+                 quad.size() * sizeof(float), {"aPos"});
+  mSpire->addIBO("quad", reinterpret_cast<uint8_t*>(&quadIndices[0]),
+                 quadIndices.size() * sizeof(uint16_t), Interface::IBO_16BIT);
+  mSpire->addObject("quad");
+  mSpire->addPassToObject("quad", "UniformColor", "quad", "quad",
+                          Interface::TRIANGLE_STRIP);
+  M44 transform;
+  transform[3] = V4(0.0f, 0.0f, 1.0f, 1.0f);
+  mSpire->setObjectTransform("quad", transform);
+  EXPECT_EQ("grid", mSpire->pick(0.0f, 0.0f).object);
+
+  // Moving the grid moves the hit point.
+  transform[3] = V4(0.0f, 0.0f, -2.0f, 1.0f);
+  mSpire->setObjectTransform("grid", transform);
+  result = mSpire->pickRay(V3(0.0f, 0.0f, 5.0f), V3(0.0f, 0.0f, -1.0f));
+  ASSERT_TRUE(result.hit);
+  EXPECT_NEAR(-2.0f, result.position.z, 1e-5f);
+}
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, DISABLED_TestPickingBenchmark)
+{
+  // 2M triangles, enough to show the log scaling of picks without making
+  // the test slow.
+  const size_t cells = 1000;
+  addGridObject(mSpire, cells, V3(0.0f, 0.0f, 0.0f));
+
+  std::mt19937 rng(44);
+  std::uniform_real_distribution<float> coord(-0.99f, 0.99f);
+  V3 down(0.0f, 0.0f, -1.0f);
+
+  // The first pick starts building the BVH and tests every triangle. Later
+  // ones do the same until picks get much faster: the BVH is in.
+  typedef std::chrono::high_resolution_clock Clock;
+  auto start = Clock::now();
+  ASSERT_TRUE(mSpire->pickRay(V3(0.0f, 0.0f, 5.0f), down).hit);
+  double firstMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  double pickMs = firstMs;
+  while (pickMs > firstMs * 0.1)
+  {
+    auto pickStart = Clock::now();
+    ASSERT_TRUE(mSpire->pickRay(V3(0.0f, 0.0f, 5.0f), down).hit);
+    pickMs = std::chrono::duration<double, std::milli>(Clock::now() - pickStart).count();
+  }
+  double buildMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+  const int numPicks = 1000;
+  start = std::chrono::high_resolution_clock::now();
+  int numHits = 0;
+  for (int i = 0; i < numPicks; ++i)
+  {
+    V3 origin(coord(rng), coord(rng), 5.0f);
+    V3 direction = V3(coord(rng), coord(rng), -5.0f) * 0.2f;
+    if (mSpire->pickRay(origin, direction + down).hit)
+      ++numHits;
+  }
+  double pickUs = std::chrono::duration<double, std::micro>(
+      std::chrono::high_resolution_clock::now() - start).count() / numPicks;
+  EXPECT_LT(numPicks / 2, numHits);
+
+  std::cout << "Picking " << cells * cells * 2 << " triangles: first pick "
+            << firstMs << " ms, BVH in after " << buildMs << " ms, then "
+            << pickUs << " us per pick." << std::endl;
+}
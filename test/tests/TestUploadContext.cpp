@@ -0,0 +1,313 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <chrono>
+#include <fstream>
+#include <thread>
+#include <batch-testing/GlobalGTestEnv.hpp>
+#include <batch-testing/SpireTestFixture.hpp>
+#include "namespaces.h"
+
+#ifdef USE_OS_MESA
+  #include <GL/osmesa.h>
+#endif
+
+#include "spire/src/Common.h"
+#include "spire/src/Exceptions.h"
+
+#include "TestCamera.h"
+
+using namespace spire;
+using namespace CPM_BATCH_TESTING_NS;
+
+namespace {
+
+//------------------------------------------------------------------------------
+/// Adds a lit sphere object using 'bufferName' as VBO and IBO.
+void addSphereObject(std::shared_ptr<Interface> spire,
+                     const std::string& objectName,
+                     const std::string& bufferName)
+{
+  TestCamera camera;
+  camera.setCommonUniforms(spire);
+  spire->addGlobalUniform("uLightDirWorld", V3(1.0f, 0.0f, 0.0f));
+
+  spire->addObject(objectName);
+  spire->addPassToObject(objectName, "DirGouraud", bufferName, bufferName,
+                         Interface::TRIANGLES);
+  spire->addObjectPassUniform(objectName, "uAmbientColor", V4(0.1f, 0.1f, 0.1f, 1.0f));
+  spire->addObjectPassUniform(objectName, "uDiffuseColor", V4(0.8f, 0.8f, 0.0f, 1.0f));
+  spire->addObjectPassUniform(objectName, "uSpecularColor", V4(0.5f, 0.5f, 0.5f, 1.0f));
+  spire->addObjectPassUniform(objectName, "uSpecularPower", 32.0f);
+  M44 xform;
+  spire->addObjectPassUniform(objectName, "uObject", xform);
+  spire->addObjectGlobalUniform(objectName, "uProjIVObject",
+                                camera.getWorldToProjection() * xform);
+}
+
+//------------------------------------------------------------------------------
+template <typename T>
+bool isReady(const std::future<T>& future)
+{
+  return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, TestAsyncUploadsWithoutSharedContext)
+{
+  // Without a shared context the uploads happen in processAsyncLoads.
+  mSpire->addPersistentShader(
+      "DirGouraud", 
+      { std::make_tuple("DirGouraud.vsh", Interface::VERTEX_SHADER), 
+        std::make_tuple("DirGouraud.fsh", Interface::FRAGMENT_SHADER),
+      });
+
+  std::vector<uint8_t> vbo;
+  std::vector<uint8_t> ibo;
+  Interface::AssetInfo info;
+  std::ifstream file("Assets/Sphere.sp", std::ios::binary);
+  Interface::loadAssetFile(file, vbo, ibo, info);
+
+  std::future<void> vboDone = mSpire->addVBOAsync(
+      "sphere", std::make_shared<std::vector<uint8_t>>(vbo), {"aPos", "aNormal"});
+  std::future<void> iboDone = mSpire->addIBOAsync(
+      "sphere", std::make_shared<std::vector<uint8_t>>(ibo), info.iboType);
+  std::future<void> duplicate = mSpire->addIBOAsync(
+      "sphere", std::make_shared<std::vector<uint8_t>>(ibo), info.iboType);
+  EXPECT_FALSE(isReady(vboDone));
+
+  EXPECT_EQ(3u, mSpire->processAsyncLoads());
+  vboDone.get();
+  iboDone.get();
+  EXPECT_THROW(duplicate.get(), Duplicate);
+
+  addSphereObject(mSpire, "async", "sphere");
+  beginFrame();
+  mSpire->renderObject("async");
+  compareFBOWithExistingFile(
+      "asyncUploadSphere.png",
+      TEST_IMAGE_OUTPUT_DIR,
+      TEST_IMAGE_COMPARE_DIR,
+      TEST_PERCEPTUAL_COMPARE_BINARY,
+      50);
+
+  std::shared_ptr<std::vector<uint8_t>> pixels =
+      std::make_shared<std::vector<uint8_t>>(4 * 4 * 4, 200);
+  std::future<GLuint> texture = mSpire->uploadTextureAsync(pixels, 4, 4);
+  EXPECT_THROW(mSpire->uploadTextureAsync(pixels, 4, 5), std::invalid_argument);
+  EXPECT_EQ(1u, mSpire->processAsyncLoads());
+  GLuint textureName = texture.get();
+  EXPECT_EQ(GL_TRUE, glIsTexture(textureName));
+  GL(glDeleteTextures(1, &textureName));
+}
+
+#ifdef USE_OS_MESA
+
+const size_t imageWidth = 640;
+const size_t imageHeight = 480;
+
+//------------------------------------------------------------------------------
+/// Clears the current framebuffer, renders 'objectName' and reads it back.
+std::vector<uint8_t> renderToPixels(std::shared_ptr<Interface> spire,
+                                    const std::string& objectName)
+{
+  GL(glClearColor(0.0f, 0.0f, 0.0f, 1.0f));
+  GL(glEnable(GL_DEPTH_TEST));
+  GL(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
+  spire->renderObject(objectName);
+
+  std::vector<uint8_t> pixels(imageWidth * imageHeight * 4);
+  GL(glReadPixels(0, 0, static_cast<GLsizei>(imageWidth),
+                  static_cast<GLsizei>(imageHeight), GL_RGBA, GL_UNSIGNED_BYTE,
+                  &pixels[0]));
+  return pixels;
+}
+
+//------------------------------------------------------------------------------
+/// Adds the sphere as 'bufferName' the synchronous way.
+void addSphereBuffers(std::shared_ptr<Interface> spire,
+                      const std::string& bufferName)
+{
+  std::vector<uint8_t> vbo;
+  std::vector<uint8_t> ibo;
+  Interface::AssetInfo info;
+  std::ifstream file("Assets/Sphere.sp", std::ios::binary);
+  Interface::loadAssetFile(file, vbo, ibo, info);
+  spire->addVBO(bufferName, &vbo[0], vbo.size(), {"aPos", "aNormal"});
+  spire->addIBO(bufferName, &ibo[0], ibo.size(), info.iboType);
+}
+
+//------------------------------------------------------------------------------
+/// OSMesa context rendering into a buffer of its own. Shared contexts get a
+/// buffer of their own as well.
+class OSMesaTestContext : public Context
+{
+public:
+  OSMesaTestContext(OSMesaContext shareWith = NULL) :
+      mBuffer(imageWidth * imageHeight * 4)
+  {
+    mContext = OSMesaCreateContextExt(OSMESA_RGBA, 24, 0, 0, shareWith);
+  }
+
+  ~OSMesaTestContext()
+  {
+    OSMesaDestroyContext(mContext);
+  }
+
+  bool isValid() const  {return mContext != NULL;}
+
+  void makeCurrent() override
+  {
+    OSMesaMakeCurrent(mContext, &mBuffer[0], GL_UNSIGNED_BYTE,
+                      static_cast<GLsizei>(imageWidth),
+                      static_cast<GLsizei>(imageHeight));
+    mThread = std::this_thread::get_id();
+  }
+
+  void swapBuffers() override {}
+
+  std::shared_ptr<Context> createSharedContext() override
+  {
+    mShared = std::make_shared<OSMesaTestContext>(mContext);
+    return mShared;
+  }
+
+  /// Thread the context was last made current on.
+  std::thread::id getThread() const   {return mThread;}
+
+  std::shared_ptr<OSMesaTestContext> getShared() const {return mShared;}
+
+private:
+  OSMesaContext                       mContext;
+  std::vector<uint8_t>                mBuffer;
+  std::thread::id                     mThread;
+  std::shared_ptr<OSMesaTestContext>  mShared;
+};
+
+//------------------------------------------------------------------------------
+TEST(UploadContext, TestSharedContextUploads)
+{
+  std::shared_ptr<OSMesaTestContext> context =
+      std::make_shared<OSMesaTestContext>();
+  ASSERT_TRUE(context->isValid());
+  context->makeCurrent();
+
+  std::shared_ptr<Interface> spire = std::make_shared<Interface>(
+      context, std::vector<std::string>());
+  std::shared_ptr<OSMesaTestContext> uploadContext = context->getShared();
+  ASSERT_TRUE(uploadContext && uploadContext->isValid());
+
+  spire->addShaderAttribute("aPos", 3, false, sizeof(float) * 3, Interface::TYPE_FLOAT);
+  spire->addShaderAttribute("aNormal", 3, false, sizeof(float) * 3, Interface::TYPE_FLOAT);
+  spire->addPersistentShader(
+      "DirGouraud", 
+      { std::make_tuple("DirGouraud.vsh", Interface::VERTEX_SHADER), 
+        std::make_tuple("DirGouraud.fsh", Interface::FRAGMENT_SHADER),
+      });
+
+  // Reference image with buffers created on the render thread.
+  addSphereBuffers(spire, "sync");
+  addSphereObject(spire, "sync", "sync");
+  std::vector<uint8_t> reference = renderToPixels(spire, "sync");
+
+  std::future<Interface::MeshHandle> sphere =
+      spire->loadMeshAsync("Assets/Sphere.sp", {"aPos", "aNormal"}, "async");
+  std::vector<uint8_t> texels(8 * 8 * 4);
+  for (size_t i = 0; i < texels.size(); ++i)
+    texels[i] = static_cast<uint8_t>(i);
+  std::future<GLuint> texture = spire->uploadTextureAsync(
+      std::make_shared<std::vector<uint8_t>>(texels), 8, 8);
+
+  // Keep rendering on this thread until the loader thread is done.
+  size_t numFinished = 0;
+  while (!isReady(sphere) || !isReady(texture))
+  {
+    renderToPixels(spire, "sync");
+    numFinished += spire->processAsyncLoads();
+    std::this_thread::yield();
+  }
+  EXPECT_EQ(2u, numFinished);
+  EXPECT_NE(std::this_thread::get_id(), uploadContext->getThread());
+  spire->removeObject("sync");
+
+  Interface::MeshHandle handle = sphere.get();
+  addSphereObject(spire, "async", handle.name);
+  EXPECT_EQ(reference, renderToPixels(spire, "async"));
+
+  // The texture made it across the share group intact.
+  GLuint textureName = texture.get();
+  std::vector<uint8_t> readBack(texels.size());
+  GL(glBindTexture(GL_TEXTURE_2D, textureName));
+  GL(glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, &readBack[0]));
+  EXPECT_EQ(texels, readBack);
+  GL(glDeleteTextures(1, &textureName));
+
+  spire.reset();
+}
+
+//------------------------------------------------------------------------------
+TEST(UploadContext, TestShutdownResolvesPendingUploads)
+{
+  std::shared_ptr<OSMesaTestContext> context =
+      std::make_shared<OSMesaTestContext>();
+  ASSERT_TRUE(context->isValid());
+  context->makeCurrent();
+
+  std::shared_ptr<Interface> spire = std::make_shared<Interface>(
+      context, std::vector<std::string>());
+  std::vector<std::future<GLuint>> textures;
+  for (size_t i = 0; i < 16; ++i)
+  {
+    textures.push_back(spire->uploadTextureAsync(
+        std::make_shared<std::vector<uint8_t>>(64 * 64 * 4, 0), 64, 64));
+  }
+
+  // Destroying the interface right away either publishes the uploads or
+  // fails them; no future is left with a broken promise.
+  spire.reset();
+  for (auto it = textures.begin(); it != textures.end(); ++it)
+  {
+    ASSERT_TRUE(isReady(*it));
+    try
+    {
+      GLuint texture = it->get();
+      GL(glDeleteTextures(1, &texture));
+    }
+    catch (const std::future_error& e)
+    {
+      FAIL() << e.what();
+    }
+    catch (const std::runtime_error&)
+    {
+    }
+  }
+}
+
+#endif
+
+} // namespace
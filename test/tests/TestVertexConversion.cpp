@@ -0,0 +1,169 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <batch-testing/GlobalGTestEnv.hpp>
+#include <batch-testing/SpireTestFixture.hpp>
+#include "namespaces.h"
+
+#include "spire/src/Common.h"
+#include "spire/src/InterfaceImplementation.h"
+#include "spire/src/ShaderAttributeMan.h"
+#include "spire/src/VBOObject.h"
+#include "spire/src/VertexConversion.h"
+
+using namespace spire;
+using namespace CPM_BATCH_TESTING_NS;
+
+namespace {
+
+//------------------------------------------------------------------------------
+TEST(VertexConversion, TestHalfRoundTripIsExact)
+{
+  // Every half float survives a trip through float unchanged.
+  for (uint32_t i = 0; i < 65536; ++i)
+  {
+    uint16_t h = static_cast<uint16_t>(i);
+    float f = halfToFloat(h);
+    if (f != f)
+    {
+      uint16_t back = floatToHalf(f);
+      EXPECT_EQ(0x7C00, back & 0x7C00);
+      EXPECT_NE(0, back & 0x3FF);
+    }
+    else
+    {
+      ASSERT_EQ(h, floatToHalf(f)) << i;
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+TEST(VertexConversion, TestHalfRounding)
+{
+  EXPECT_EQ(0x3C00, floatToHalf(1.0f));
+  EXPECT_EQ(0xC000, floatToHalf(-2.0f));
+  EXPECT_EQ(0x7BFF, floatToHalf(65504.0f));
+  EXPECT_EQ(0x7C00, floatToHalf(65520.0f));                          // Rounds up to inf.
+  EXPECT_EQ(0x7BFF, floatToHalf(65519.0f));
+  EXPECT_EQ(0x0001, floatToHalf(5.9604644775390625e-8f));            // Smallest subnormal.
+  EXPECT_EQ(0x0000, floatToHalf(2.98023223876953125e-8f));           // Tie to even (zero).
+  EXPECT_EQ(0x3C00, floatToHalf(1.0f + 1.0f / 2048.0f));             // Tie to even.
+  EXPECT_EQ(0x3C02, floatToHalf(1.0f + 3.0f / 2048.0f));             // Tie to even.
+  EXPECT_EQ(0xFC00, floatToHalf(-std::numeric_limits<float>::infinity()));
+  EXPECT_EQ(0x8000, floatToHalf(-0.0f));
+}
+
+//------------------------------------------------------------------------------
+TEST(VertexConversion, TestBulkMatchesScalar)
+{
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<float> dist(-70000.0f, 70000.0f);
+  std::vector<float> in(1027);
+  for (auto it = in.begin(); it != in.end(); ++it)
+    *it = dist(rng) * std::pow(2.0f, static_cast<float>(static_cast<int>(rng() % 40) - 30));
+
+  std::vector<uint16_t> halves(in.size());
+  convertFloatToHalf(&in[0], &halves[0], in.size());
+  for (size_t i = 0; i < in.size(); ++i)
+    ASSERT_EQ(floatToHalf(in[i]), halves[i]) << in[i];
+
+  std::vector<float> back(in.size());
+  convertHalfToFloat(&halves[0], &back[0], halves.size());
+  for (size_t i = 0; i < in.size(); ++i)
+    ASSERT_EQ(halfToFloat(halves[i]), back[i]);
+
+  std::vector<double> doubles(in.size());
+  for (size_t i = 0; i < in.size(); ++i)
+    doubles[i] = static_cast<double>(in[i]) + 1e-9;
+  std::vector<float> narrowed(in.size());
+  convertDoubleToFloat(&doubles[0], &narrowed[0], doubles.size());
+  for (size_t i = 0; i < in.size(); ++i)
+    ASSERT_EQ(static_cast<float>(doubles[i]), narrowed[i]);
+}
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, TestHalfFloatGLType)
+{
+#ifndef SPIRE_OPENGL_ES_2
+  EXPECT_EQ(static_cast<GLenum>(GL_HALF_FLOAT),
+            InterfaceImplementation::getGLType(Interface::TYPE_HALFFLOAT));
+#endif
+}
+
+//------------------------------------------------------------------------------
+TEST_F(SpireTestFixture, TestNarrowDoublesOnUpload)
+{
+  // An interleaved 4 byte color followed by a double position, so that the
+  // doubles are not 8 byte aligned.
+  ShaderAttributeMan man;
+  man.addAttribute("aColorUB", 4, true, 4, Interface::TYPE_UBYTE);
+  man.addAttribute("aPosD", 3, false, sizeof(double) * 3, Interface::TYPE_DOUBLE);
+
+  const size_t numVertices = 5;
+  const size_t inStride = 4 + sizeof(double) * 3;
+  std::vector<uint8_t> data(numVertices * inStride);
+  for (size_t v = 0; v < numVertices; ++v)
+  {
+    uint8_t color[4] = {uint8_t(v), 1, 2, 3};
+    double pos[3] = {0.1 * double(v), -1.0 / 3.0, 1e10};
+    std::memcpy(&data[v * inStride], color, 4);
+    std::memcpy(&data[v * inStride + 4], pos, sizeof(pos));
+  }
+
+  VBOObject vbo(&data[0], data.size(), {"aColorUB", "aPosD"}, man, true);
+  const ShaderAttributeCollection& attribs = vbo.getAttributeCollection();
+  ASSERT_EQ(2, attribs.getNumAttributes());
+  EXPECT_EQ(Interface::TYPE_FLOAT, attribs.getAttribute(1).type);
+  EXPECT_EQ(sizeof(float) * 3, attribs.getAttribute(1).size);
+  const size_t outStride = 4 + sizeof(float) * 3;
+  ASSERT_EQ(outStride, attribs.calculateStride());
+
+#ifndef SPIRE_OPENGL_ES_2
+  std::vector<uint8_t> uploaded(numVertices * outStride);
+  GL(glBindBuffer(GL_ARRAY_BUFFER, vbo.getGLIndex()));
+  GL(glGetBufferSubData(GL_ARRAY_BUFFER, 0, static_cast<GLsizeiptr>(uploaded.size()),
+                        &uploaded[0]));
+  for (size_t v = 0; v < numVertices; ++v)
+  {
+    EXPECT_EQ(uint8_t(v), uploaded[v * outStride]);
+    EXPECT_EQ(3, uploaded[v * outStride + 3]);
+
+    float pos[3];
+    std::memcpy(pos, &uploaded[v * outStride + 4], sizeof(pos));
+    EXPECT_EQ(static_cast<float>(0.1 * double(v)), pos[0]);
+    EXPECT_EQ(static_cast<float>(-1.0 / 3.0), pos[1]);
+    EXPECT_EQ(1e10f, pos[2]);
+  }
+#endif
+}
+
+}
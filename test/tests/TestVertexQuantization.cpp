@@ -0,0 +1,294 @@
+/*
+   For more information, please see: http://software.sci.utah.edu
+
+   The MIT License
+
+   Copyright (c) 2013 Scientific Computing and Imaging Institute,
+   University of Utah.
+
+   License for the specific language governing rights and limitations under
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included
+   in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+   DEALINGS IN THE SOFTWARE.
+*/
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <gtest/gtest.h>
+#include "namespaces.h"
+#include "spire/Interface.h"
+#include "spire/src/AssetFile.h"
+#include "spire/src/VertexQuantization.h"
+
+using namespace spire;
+
+namespace {
+
+/// Angle in radians between two vectors, computed in double precision since
+/// acos(dot) is far too coarse in float for the errors we care about.
+double angleBetween(const float a[3], const float b[3])
+{
+  double cx = double(a[1]) * b[2] - double(a[2]) * b[1];
+  double cy = double(a[2]) * b[0] - double(a[0]) * b[2];
+  double cz = double(a[0]) * b[1] - double(a[1]) * b[0];
+  double d  = double(a[0]) * b[0] + double(a[1]) * b[1] + double(a[2]) * b[2];
+  return std::atan2(std::sqrt(cx * cx + cy * cy + cz * cz), d);
+}
+
+//------------------------------------------------------------------------------
+TEST(VertexQuantization, TestSnorm16)
+{
+  EXPECT_EQ(32767, quantizeSnorm16(1.0f));
+  EXPECT_EQ(-32767, quantizeSnorm16(-1.0f));
+  EXPECT_EQ(0, quantizeSnorm16(0.0f));
+  EXPECT_EQ(32767, quantizeSnorm16(2.0f));
+  EXPECT_FLOAT_EQ(1.0f, dequantizeSnorm16(32767));
+  EXPECT_FLOAT_EQ(-1.0f, dequantizeSnorm16(-32768));
+}
+
+//------------------------------------------------------------------------------
+TEST(VertexQuantization, TestOctahedralErrorBound)
+{
+  // Axes and diagonals are the troublesome cases for the octahedral fold.
+  std::vector<std::vector<float>> normals = {
+    {1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1},
+    {1, 1, -1}, {-1, -1, -1}, {1, -1, 0}, {-1, 1, 0.001f}};
+
+  std::mt19937 rng(1234);
+  std::normal_distribution<float> dist;
+  for (int i = 0; i < 10000; ++i)
+    normals.push_back({dist(rng), dist(rng), dist(rng)});
+
+  double maxError = 0.0;
+  for (auto it = normals.begin(); it != normals.end(); ++it)
+  {
+    int16_t encoded[2];
+    float decoded[3];
+    encodeOctahedral(&(*it)[0], encoded);
+    decodeOctahedral(encoded, decoded);
+    maxError = std::max(maxError, angleBetween(&(*it)[0], decoded));
+  }
+
+  // A 16 bit octahedral grid spacing of 1/32767 bounds the angular error well
+  // below 0.01 degrees.
+  EXPECT_LT(maxError, 0.01 * 3.14159265 / 180.0);
+}
+
+//------------------------------------------------------------------------------
+TEST(VertexQuantization, TestPositionErrorBound)
+{
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+  // Scene in SCIRun units with a large offset from the origin.
+  std::vector<float> vertices;
+  for (int i = 0; i < 1000; ++i)
+  {
+    float v[] = {1000.0f + 50.0f * dist(rng), -20.0f + 3.0f * dist(rng),
+                 0.25f * dist(rng), dist(rng), dist(rng), 1.0f};
+    vertices.insert(vertices.end(), v, v + 6);
+  }
+  const uint8_t* raw = reinterpret_cast<const uint8_t*>(&vertices[0]);
+  std::vector<uint8_t> vbo(raw, raw + vertices.size() * sizeof(float));
+
+  std::vector<uint8_t> quantized;
+  QuantizationInfo info = quantizeVertices(vbo, sizeof(float) * 6, 0,
+                                           sizeof(float) * 3, quantized);
+  ASSERT_EQ(1000 * QUANTIZED_VERTEX_SIZE, quantized.size());
+
+  std::vector<uint8_t> expanded;
+  dequantizeVertices(quantized, info, expanded);
+  ASSERT_EQ(vbo.size(), expanded.size());
+
+  const float* original = &vertices[0];
+  const float* result = reinterpret_cast<const float*>(&expanded[0]);
+  for (size_t v = 0; v < 1000; ++v)
+  {
+    for (size_t i = 0; i < 3; ++i)
+    {
+      // Half a quantization step plus float rounding at the offset magnitude.
+      float bound = info.scale[i] / 32767.0f * 0.5f
+                    + (std::fabs(info.offset[i]) + info.scale[i]) * 1e-6f;
+      EXPECT_LE(std::fabs(original[v * 6 + i] - result[v * 6 + i]), bound);
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+TEST(VertexQuantization, TestQuantizedAssetRoundTrip)
+{
+  std::ifstream file("Assets/Sphere.sp", std::ios::binary);
+  ASSERT_TRUE(file.good());
+  std::vector<AssetMesh> meshes;
+  readAssetFile(file, meshes);
+  ASSERT_EQ(1, meshes.size());
+  ASSERT_EQ(62, meshes[0].numVertices());
+
+  AssetMesh original = meshes[0];
+  meshes[0].quantization = quantizeVertices(original.vbo, sizeof(float) * 6, 0,
+                                            sizeof(float) * 3, meshes[0].vbo);
+  meshes[0].vertexFormat = ASSET_VERTEX_QUANTIZED;
+
+  std::stringstream stream;
+  writeAssetFile(stream, meshes);
+
+  // Quantized buffers are handed out untouched.
+  std::vector<uint8_t> vbo;
+  std::vector<uint8_t> ibo;
+  Interface::AssetInfo info;
+  stream.seekg(0);
+  EXPECT_EQ(120, Interface::loadAssetFile(stream, vbo, ibo, info));
+  EXPECT_TRUE(info.quantized);
+  EXPECT_EQ(QUANTIZED_VERTEX_SIZE, info.stride);
+  EXPECT_EQ(Interface::IBO_16BIT, info.iboType);
+  EXPECT_EQ(62 * QUANTIZED_VERTEX_SIZE, vbo.size());
+  EXPECT_EQ(meshes[0].vbo, vbo);
+  EXPECT_FLOAT_EQ(meshes[0].quantization.scale[0], info.positionScale.x);
+
+  // The legacy loader expands them back to floats.
+  stream.clear();
+  stream.seekg(0);
+  EXPECT_EQ(120, Interface::loadProprietarySR5AssetFile(stream, vbo, ibo));
+  ASSERT_EQ(original.vbo.size(), vbo.size());
+  const float* a = reinterpret_cast<const float*>(&original.vbo[0]);
+  const float* b = reinterpret_cast<const float*>(&vbo[0]);
+  for (size_t v = 0; v < 62; ++v)
+  {
+    for (size_t i = 0; i < 3; ++i)
+      EXPECT_NEAR(a[v * 6 + i], b[v * 6 + i], 1e-4f);
+    EXPECT_LT(angleBetween(a + v * 6 + 3, b + v * 6 + 3), 1e-3f);
+  }
+
+  std::vector<uint32_t> indices(ibo.size() / sizeof(uint16_t));
+  for (size_t i = 0; i < indices.size(); ++i)
+  {
+    uint16_t index;
+    std::memcpy(&index, &ibo[i * sizeof(uint16_t)], sizeof(uint16_t));
+    indices[i] = index;
+  }
+  EXPECT_EQ(original.indices, indices);
+}
+
+//------------------------------------------------------------------------------
+TEST(VertexQuantization, TestCorruptCountsThrowBeforeAllocating)
+{
+  std::ifstream file("Assets/Sphere.sp", std::ios::binary);
+  ASSERT_TRUE(file.good());
+  std::vector<AssetMesh> meshes;
+  readAssetFile(file, meshes);
+  std::vector<uint8_t> contents;
+  serializeAssetFile(meshes, contents);
+
+  // Both chunks start with a 32 bit field (format, index size) followed by
+  // the count. A count far past the end of the chunk must be rejected
+  // instead of being allocated.
+  const char* tags[] = {"VERT", "INDX"};
+  for (size_t i = 0; i < 2; ++i)
+  {
+    std::string data(contents.begin(), contents.end());
+    size_t chunk = data.find(tags[i]);
+    ASSERT_NE(std::string::npos, chunk);
+    uint32_t count = 0xfffffff0u;
+    std::memcpy(&data[chunk + 12], &count, sizeof(count));
+    std::istringstream corrupt(data);
+    EXPECT_THROW(readAssetFile(corrupt, meshes), std::invalid_argument) << tags[i];
+  }
+}
+
+//------------------------------------------------------------------------------
+TEST(VertexQuantization, TestPartsMixedWithWholeMeshThrow)
+{
+  std::ifstream file("Assets/Sphere.sp", std::ios::binary);
+  ASSERT_TRUE(file.good());
+  std::vector<AssetMesh> meshes;
+  readAssetFile(file, meshes);
+  std::vector<uint8_t> whole;
+  serializeAssetFile(meshes, whole);
+  AssetWriteOptions options;
+  options.trianglesPerPart = 16;
+  std::vector<uint8_t> split;
+  serializeAssetFile(meshes, split, options);
+
+  // A small vertex chunk after the layout used to shrink the buffer the
+  // parts are copied into.
+  std::string wholeData(whole.begin(), whole.end());
+  size_t vert = wholeData.find("VERT");
+  ASSERT_NE(std::string::npos, vert);
+  uint32_t numVertices = 1;
+  std::memcpy(&wholeData[vert + 12], &numVertices, sizeof(numVertices));
+  uint32_t size = static_cast<uint32_t>(8 + meshes[0].vertexSize());
+  std::memcpy(&wholeData[vert + 4], &size, sizeof(size));
+  std::string vertChunk = wholeData.substr(vert, 8 + size);
+
+  std::string data(split.begin(), split.end());
+  size_t part = data.find("PART");
+  ASSERT_NE(std::string::npos, part);
+  data.insert(part, vertChunk);
+  uint32_t numChunks = 0;
+  std::memcpy(&numChunks, &data[12], sizeof(numChunks));
+  ++numChunks;
+  std::memcpy(&data[12], &numChunks, sizeof(numChunks));
+  std::istringstream mixed(data);
+  EXPECT_THROW(readAssetFile(mixed, meshes), std::invalid_argument);
+
+  // Nor may a layout follow the whole mesh.
+  std::string layout = data.substr(data.find("PLAY"));
+  layout = layout.substr(0, 8 + *reinterpret_cast<const uint32_t*>(&layout[4]));
+  wholeData.assign(whole.begin(), whole.end());
+  wholeData.insert(wholeData.find("INDX"), layout);
+  std::memcpy(&numChunks, &wholeData[12], sizeof(numChunks));
+  ++numChunks;
+  std::memcpy(&wholeData[12], &numChunks, sizeof(numChunks));
+  std::istringstream layoutAfter(wholeData);
+  EXPECT_THROW(readAssetFile(layoutAfter, meshes), std::invalid_argument);
+
+  // A layout announcing far more than the parts hold allocates nothing.
+  data.assign(split.begin(), split.end());
+  size_t play = data.find("PLAY");
+  uint32_t count = 0xfffffff0u;
+  std::memcpy(&data[play + 12], &count, sizeof(count));
+  std::memcpy(&data[play + 16], &count, sizeof(count));
+  std::istringstream huge(data);
+  EXPECT_THROW(readAssetFile(huge, meshes), std::invalid_argument);
+}
+
+//------------------------------------------------------------------------------
+TEST(VertexQuantization, TestIndicesPastVerticesThrow)
+{
+  std::ifstream file("Assets/Sphere.sp", std::ios::binary);
+  ASSERT_TRUE(file.good());
+  std::vector<AssetMesh> meshes;
+  readAssetFile(file, meshes);
+  size_t numVertices = meshes[0].numVertices();
+  meshes[0].indices[7] = static_cast<uint32_t>(numVertices);
+
+  for (int compressed = 0; compressed < 2; ++compressed)
+  {
+    AssetWriteOptions options;
+    options.compressIndices = (compressed != 0);
+    std::vector<uint8_t> contents;
+    serializeAssetFile(meshes, contents, options);
+    std::istringstream stream(std::string(contents.begin(), contents.end()));
+    std::vector<AssetMesh> read;
+    EXPECT_THROW(readAssetFile(stream, read), std::invalid_argument);
+  }
+}
+
+}